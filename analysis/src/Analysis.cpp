@@ -36,27 +36,13 @@
 #include <sirikata/core/util/MotionPath.hpp>
 #include "AnalysisEvents.hpp"
 #include "RecordedMotionPath.hpp"
+#include "ParallelAnalysis.hpp"
 #include <algorithm>
 
-namespace Sirikata {
-
-bool read_record(std::istream& is, uint16* type_hint_out, std::string* payload_out) {
-    if (!is) return false;
-
-    uint32 record_size;
-    is.read( (char*)&record_size, sizeof(record_size) );
-    if (!is) return false;
-
-    is.read( (char*)type_hint_out, sizeof(uint16) );
-    if (!is) return false;
-
-    assert(payload_out != NULL);
-    payload_out->resize(record_size, (char)0);
-    is.read( (char*)payload_out->c_str(), record_size );
-    if (!is) return false;
+// Number of events buffered to put datagram events back in time order
+#define DATAGRAM_REORDER_WINDOW 4096
 
-    return true;
-}
+namespace Sirikata {
 
 TimedMotionVector3f extractTimedMotionVector(const Sirikata::Trace::ITimedMotionVector& tmv) {
     return TimedMotionVector3f( tmv.t(), MotionVector3f(tmv.position(), tmv.velocity()) );
@@ -146,6 +132,9 @@ Event* Event::parse(uint16 type_hint, const std::string& record, const ServerID&
     else if (type_hint == OSegCacheResponseTag) {
         PARSE_PBJ_RECORD(Trace::OSeg::CacheResponse);
     }
+    else if (type_hint == OSegLookupBatchTag) {
+        PARSE_PBJ_RECORD(Trace::OSeg::LookupBatch);
+    }
     else if (type_hint == OSegShutdownEventTag) {
         PARSE_PBJ_RECORD(Trace::OSeg::Shutdown);
         pevt->data.set_server(trace_server_id);
@@ -173,51 +162,85 @@ Event* Event::parse(uint16 type_hint, const std::string& record, const ServerID&
 }
 
 
+EventStream::EventStream(const String& filename, const ServerID& trace_server_id, uint32 reorder_window)
+ : mReader(filename),
+   mServerID(trace_server_id),
+   mReorderWindow(reorder_window)
+{
+}
 
+EventStream::~EventStream() {
+    while(!mPending.empty()) {
+        delete mPending.top();
+        mPending.pop();
+    }
+}
 
-template<typename EventType, typename IteratorType>
-class EventIterator {
-public:
-    typedef EventType event_type;
-    typedef IteratorType iterator_type;
+void EventStream::filterType(uint16 type_hint) {
+    mReader.filterType(type_hint);
+}
 
-    EventIterator(const ServerID& sender, const ServerID& receiver, IteratorType begin, IteratorType end)
-     : mSender(sender), mReceiver(receiver), mRangeCurrent(begin), mRangeEnd(end)
-    {
-        if (mRangeCurrent != mRangeEnd && !currentMatches())
-            next();
+bool EventStream::fill() {
+    uint16 type_hint;
+    const uint8* payload;
+    uint32 payload_size;
+    while(mReader.next(&type_hint, &payload, &payload_size)) {
+        mRecord.assign((const char*)payload, payload_size);
+        Event* evt = Event::parse(type_hint, mRecord, mServerID);
+        // Unknown records are logged by parse, just skip them
+        if (evt == NULL) continue;
+        mPending.push(evt);
+        return true;
     }
+    return false;
+}
 
-    EventType* current() {
-        if (mRangeCurrent == mRangeEnd)
-            return NULL;
+const Event* EventStream::peek() {
+    while(mPending.size() <= mReorderWindow && fill())
+        ;
+    if (mPending.empty())
+        return NULL;
+    return mPending.top();
+}
 
-        EventType* event = dynamic_cast<EventType*>(*mRangeCurrent);
-        assert(event != NULL);
-        return event;
-    }
+Event* EventStream::next() {
+    if (peek() == NULL)
+        return NULL;
+    Event* evt = mPending.top();
+    mPending.pop();
+    return evt;
+}
 
-    EventType* next() {
-        if (mRangeCurrent == mRangeEnd) return NULL;
-        do {
-            mRangeCurrent++;
-        } while(mRangeCurrent != mRangeEnd && !currentMatches());
-        return current();
-    }
 
-private:
-    bool currentMatches() {
-        EventType* event = dynamic_cast<EventType*>(*mRangeCurrent);
-        if (event == NULL) return false;
-        if (event->data.source_server() != mSender || event->data.dest_server() != mReceiver) return false;
-        return true;
+MergedEventStream::MergedEventStream() {
+}
+
+MergedEventStream::~MergedEventStream() {
+    for(uint32 i = 0; i < mStreams.size(); i++)
+        delete mStreams[i];
+}
+
+void MergedEventStream::add(EventStream* stream) {
+    mStreams.push_back(stream);
+}
+
+Event* MergedEventStream::next() {
+    EventStream* earliest = NULL;
+    const Event* earliest_evt = NULL;
+    for(uint32 i = 0; i < mStreams.size(); i++) {
+        const Event* evt = mStreams[i]->peek();
+        if (evt == NULL) continue;
+        if (earliest_evt == NULL || evt->time < earliest_evt->time) {
+            earliest = mStreams[i];
+            earliest_evt = evt;
+        }
     }
+    if (earliest == NULL)
+        return NULL;
+    return earliest->next();
+}
+
 
-    ServerID mSender;
-    ServerID mReceiver;
-    IteratorType mRangeCurrent;
-    IteratorType mRangeEnd;
-};
 
 
 template<typename EventListType, typename EventListMapType>
@@ -234,16 +257,13 @@ LocationErrorAnalysis::LocationErrorAnalysis(const char* opt_name, const uint32
     // read in all our data
     for(uint32 server_id = 1; server_id <= nservers; server_id++) {
         String loc_file = GetPerServerFile(opt_name, server_id);
-        std::ifstream is(loc_file.c_str(), std::ios::in);
-
-        while(is) {
-            uint16 type_hint;
-            std::string raw_evt;
-            if (!read_record(is, &type_hint, &raw_evt)) break;
-            Event* evt = Event::parse(type_hint, raw_evt, server_id);
-            if (evt == NULL)
-                break;
+        EventStream events(loc_file, server_id);
+        events.filterType(ProximityTag);
+        events.filterType(ObjectLocationTag);
+        events.filterType(ServerObjectEventTag);
+        events.filterType(ServerLocationTag);
 
+        while(Event* evt = events.next()) {
             ObjectEvent* obj_evt = dynamic_cast<ObjectEvent*>(evt);
             ProximityEvent* pe = dynamic_cast<ProximityEvent*>(evt);
             LocationEvent* le = dynamic_cast<LocationEvent*>(evt);
@@ -494,161 +514,99 @@ LocationErrorAnalysis::EventList* LocationErrorAnalysis::getEventList(const Serv
 
 
 
-template<typename EventType, typename EventListType, typename EventListMapType>
-void insert_event(EventType* evt, EventListMapType& lists) {
-    assert(evt != NULL);
+BandwidthAnalysis::RateStats::RateStats()
+ : total_bytes(0),
+   max_bandwidth(0),
+   weight(0),
+   last_bytes(0),
+   last_duration(Duration::zero()),
+   last_time(Time::null())
+{
+}
 
-    // put it in the source queue
-    typename EventListMapType::iterator source_it = lists.find( evt->data.source_server() );
-    if (source_it == lists.end()) {
-        lists[ evt->data.source_server() ] = new EventListType;
-        source_it = lists.find( evt->data.source_server() );
-    }
-    assert( source_it != lists.end() );
+void BandwidthAnalysis::RateStats::add(const Time& t, uint32 size) {
+    total_bytes += size;
 
-    EventListType* evt_list = source_it->second;
-    evt_list->push_back(evt);
+    if (t != last_time) {
+        double bandwidth = (double)last_bytes / last_duration.toSeconds();
+        if (bandwidth > max_bandwidth)
+            max_bandwidth = bandwidth;
 
-    // put it in the dest queue
-    typename EventListMapType::iterator dest_it = lists.find( evt->data.dest_server() );
-    if (dest_it == lists.end()) {
-        lists[ evt->data.dest_server() ] = new EventListType;
-        dest_it = lists.find( evt->data.dest_server() );
+        last_bytes = 0;
+        last_duration = t - last_time;
+        last_time = t;
     }
-    assert( dest_it != lists.end() );
 
-    evt_list = dest_it->second;
-    evt_list->push_back(evt);
+    last_bytes += size;
 }
 
-BandwidthAnalysis::BandwidthAnalysis(const char* opt_name, const uint32 nservers) {
-    // read in all our data
-    mNumberOfServers = nservers;
-
+BandwidthAnalysis::BandwidthAnalysis(const char* opt_name, const uint32 nservers)
+ : mOptName(opt_name),
+   mNumberOfServers(nservers)
+{
+    // Make a single pass over the data, only keeping running totals for each
+    // pair of servers. Rates depend on datagrams being processed in time
+    // order, so buffer some events to put them back in order.
     for(uint32 server_id = 1; server_id <= nservers; server_id++) {
-        String loc_file = GetPerServerFile(opt_name, server_id);
-        std::ifstream is(loc_file.c_str(), std::ios::in);
-
-        while(is) {
-            uint16 type_hint;
-            std::string raw_evt;
-            if (!read_record(is, &type_hint, &raw_evt)) break;
-            Event* evt = Event::parse(type_hint, raw_evt, server_id);
-            if (evt == NULL)
-                break;
-
-            bool used = false;
+        EventStream events(GetPerServerFile(opt_name, server_id), server_id, DATAGRAM_REORDER_WINDOW);
+        events.filterType(ServerDatagramSentTag);
+        events.filterType(ServerDatagramReceivedTag);
 
-            DatagramQueuedEvent* datagram_queued_evt = dynamic_cast<DatagramQueuedEvent*>(evt);
+        while(Event* evt = events.next()) {
             DatagramSentEvent* datagram_sent_evt = dynamic_cast<DatagramSentEvent*>(evt);
             DatagramReceivedEvent* datagram_received_evt = dynamic_cast<DatagramReceivedEvent*>(evt);
-            if (datagram_queued_evt != NULL) {
-                used = true;
-                insert_event<DatagramQueuedEvent, DatagramEventList, ServerDatagramEventListMap>(datagram_queued_evt, mDatagramEventLists);
-            }
-            else if (datagram_sent_evt != NULL) {
-                used = true;
-                insert_event<DatagramSentEvent, DatagramEventList, ServerDatagramEventListMap>(datagram_sent_evt, mDatagramEventLists);
+            if (datagram_sent_evt != NULL) {
+                RateStats& stats = mSendRates[ ServerPair(datagram_sent_evt->data.source_server(), datagram_sent_evt->data.dest_server()) ];
+                stats.add(datagram_sent_evt->time, datagram_sent_evt->data.size());
+                stats.weight = datagram_sent_evt->data.weight();
             }
             else if (datagram_received_evt != NULL) {
-                used = true;
-                insert_event<DatagramReceivedEvent, DatagramEventList, ServerDatagramEventListMap>(datagram_received_evt, mDatagramEventLists);
+                RateStats& stats = mReceiveRates[ ServerPair(datagram_received_evt->data.source_server(), datagram_received_evt->data.dest_server()) ];
+                stats.add(datagram_received_evt->time, datagram_received_evt->data.size());
             }
 
-            if (!used) delete evt;
+            delete evt;
         }
     }
-
-    // Sort all lists of events by time
-    sort_events<DatagramEventList, ServerDatagramEventListMap>(mDatagramEventLists);
 }
 
 BandwidthAnalysis::~BandwidthAnalysis() {
-    for(ServerDatagramEventListMap::iterator event_lists_it = mDatagramEventLists.begin(); event_lists_it != mDatagramEventLists.end(); event_lists_it++) {
-        ServerID server_id = event_lists_it->first;
-        DatagramEventList* event_list = event_lists_it->second;
-        for(DatagramEventList::iterator events_it = event_list->begin(); events_it != event_list->end(); events_it++) {
-            // each event is put in both the source and the dest server event lists,
-            // to avoid double deleting, only delete if this is the event's source list
-            DatagramQueuedEvent* datagram_queued_evt = dynamic_cast<DatagramQueuedEvent*>(*events_it);
-            DatagramSentEvent* datagram_sent_evt = dynamic_cast<DatagramSentEvent*>(*events_it);
-            DatagramReceivedEvent* datagram_received_evt = dynamic_cast<DatagramReceivedEvent*>(*events_it);
-            if ((datagram_queued_evt != NULL && datagram_queued_evt->data.source_server() == server_id) ||
-                (datagram_sent_evt != NULL && datagram_sent_evt->data.source_server() == server_id) ||
-                (datagram_received_evt != NULL && datagram_received_evt->data.source_server() == server_id))
-                delete *events_it;
-        }
-    }
-}
-
-const BandwidthAnalysis::DatagramEventList* BandwidthAnalysis::getDatagramEventList(const ServerID& server) const {
-    ServerDatagramEventListMap::const_iterator event_lists_it = mDatagramEventLists.find(server);
-    if (event_lists_it == mDatagramEventLists.end()) return &mEmptyDatagramEventList;
-
-    return event_lists_it->second;
-}
-
-
-BandwidthAnalysis::DatagramEventList::const_iterator BandwidthAnalysis::datagramBegin(const ServerID& server) const {
-    return getDatagramEventList(server)->begin();
-}
-
-BandwidthAnalysis::DatagramEventList::const_iterator BandwidthAnalysis::datagramEnd(const ServerID& server) const {
-    return getDatagramEventList(server)->end();
 }
 
-
-template<typename EventType, typename EventIteratorType>
-void computeRate(const ServerID& sender, const ServerID& receiver, const EventIteratorType& filter_begin, const EventIteratorType& filter_end) {
-    uint64 total_bytes = 0;
-    uint32 last_bytes = 0;
-    Duration last_duration;
-    Time last_time(Time::null());
-    double max_bandwidth = 0;
-    for(EventIterator<EventType, EventIteratorType> event_it(sender, receiver, filter_begin, filter_end); event_it.current() != NULL; event_it.next() ) {
-        EventType* p_evt = event_it.current();
-
-        total_bytes += p_evt->data.size();
-
-        if (p_evt->time != last_time) {
-            double bandwidth = (double)last_bytes / last_duration.toSeconds();
-            if (bandwidth > max_bandwidth)
-                max_bandwidth = bandwidth;
-
-            last_bytes = 0;
-            last_duration = p_evt->time - last_time;
-            last_time = p_evt->time;
-        }
-
-        last_bytes += p_evt->data.size();
-    }
-
-    printf("%d to %d: %ld total, %f max\n", sender, receiver, total_bytes, max_bandwidth);
+const BandwidthAnalysis::RateStats& BandwidthAnalysis::getRateStats(const ServerPairRateMap& rates, const ServerID& sender, const ServerID& receiver) const {
+    ServerPairRateMap::const_iterator it = rates.find( ServerPair(sender, receiver) );
+    if (it == rates.end()) return mEmptyRateStats;
+    return it->second;
 }
 
-
 void BandwidthAnalysis::computeSendRate(const ServerID& sender, const ServerID& receiver) const {
-    if (getDatagramEventList(sender) == NULL ) {
-        printf("%d to %d: unknown total, unknown max\n", sender, receiver);
-	return;
-    }
-
-    computeRate<DatagramSentEvent, DatagramEventList::const_iterator>(sender, receiver, datagramBegin(sender), datagramEnd(sender));
+    const RateStats& stats = getRateStats(mSendRates, sender, receiver);
+    printf("%d to %d: %ld total, %f max\n", sender, receiver, stats.total_bytes, stats.max_bandwidth);
 }
 
 void BandwidthAnalysis::computeReceiveRate(const ServerID& sender, const ServerID& receiver) const {
-    if (getDatagramEventList(receiver) == NULL ) {
-        printf("%d to %d: unknown total, unknown max\n", sender, receiver);
-	return;
+    const RateStats& stats = getRateStats(mReceiveRates, sender, receiver);
+    printf("%d to %d: %ld total, %f max\n", sender, receiver, stats.total_bytes, stats.max_bandwidth);
+}
+
+// Get the next datagram event from sender to receiver in the stream, or NULL
+// if there are none left
+template<typename EventType>
+EventType* next_datagram(const ServerID& sender, const ServerID& receiver, EventStream& events) {
+    while(Event* evt = events.next()) {
+        EventType* datagram_evt = dynamic_cast<EventType*>(evt);
+        if (datagram_evt != NULL && datagram_evt->data.source_server() == sender && datagram_evt->data.dest_server() == receiver)
+            return datagram_evt;
+        delete evt;
     }
-
-    computeRate<DatagramReceivedEvent, DatagramEventList::const_iterator>(sender, receiver, datagramBegin(receiver), datagramEnd(receiver));
+    return NULL;
 }
 
 // note: swap_sender_receiver optionally swaps order for sake of graphing code, generally will be used when collecting stats for "receiver" side
-template<typename EventType, typename EventIteratorType>
-void computeWindowedRate(const ServerID& sender, const ServerID& receiver, const EventIteratorType& filter_begin, const EventIteratorType& filter_end, const Duration& window, const Duration& sample_rate, const Time& start_time, const Time& end_time, std::ostream& summary_out, std::ostream& detail_out, bool swap_sender_receiver) {
-    EventIterator<EventType, EventIteratorType> event_it(sender, receiver, filter_begin, filter_end);
+template<typename EventType>
+void computeWindowedRate(const ServerID& sender, const ServerID& receiver, EventStream& events, const Duration& window, const Duration& sample_rate, const Time& start_time, const Time& end_time, std::ostream& summary_out, std::ostream& detail_out, bool swap_sender_receiver) {
+    // Only the next datagram and those in the current window are kept in memory
+    EventType* next_evt = next_datagram<EventType>(sender, receiver, events);
     std::queue<EventType*> window_events;
 
     uint64 bytes = 0;
@@ -661,7 +619,7 @@ void computeWindowedRate(const ServerID& sender, const ServerID& receiver, const
         // add in any new packets that now fit in the window
         uint32 last_packet_partial_size = 0;
         while(true) {
-            EventType* evt = event_it.current();
+            EventType* evt = next_evt;
             if (evt == NULL) break;
             if (evt->data.end_time() > window_end) {
                 if (evt->data.start_time() + window < window_end) {
@@ -673,7 +631,7 @@ void computeWindowedRate(const ServerID& sender, const ServerID& receiver, const
             bytes += evt->data.size();
             total_bytes += evt->data.size();
             window_events.push(evt);
-            event_it.next();
+            next_evt = next_datagram<EventType>(sender, receiver, events);
         }
 
         // subtract out any packets that have fallen out of the window
@@ -690,8 +648,10 @@ void computeWindowedRate(const ServerID& sender, const ServerID& receiver, const
                 // note the order of the numerator is important to avoid underflow
                 double packet_frac = (pevt->data.end_time() + window - window_end).toSeconds() / (pevt->data.end_time() - pevt->data.start_time()).toSeconds();
                 first_packet_partial_size = pevt->data.size() * packet_frac;
+                delete pevt;
                 break;
             }
+            delete pevt;
         }
 
         // finally compute the current bandwidth
@@ -707,6 +667,12 @@ void computeWindowedRate(const ServerID& sender, const ServerID& receiver, const
         detail_out << (window_center-Time::null()).toMilliseconds() << " " << bandwidth << std::endl;
     }
 
+    delete next_evt;
+    while(!window_events.empty()) {
+        delete window_events.front();
+        window_events.pop();
+    }
+
     // optionally swap order for sake of graphing code, generally will be used when collecting stats for "receiver" side
     if (swap_sender_receiver)
         summary_out << receiver << " from " << sender << ": ";
@@ -715,29 +681,27 @@ void computeWindowedRate(const ServerID& sender, const ServerID& receiver, const
     summary_out << total_bytes << " total, " << max_bandwidth << " max" << std::endl;
 }
 
-template<typename EventType, typename EventIteratorType>
-void BandwidthAnalysis::computeJFI(const ServerID& sender, const ServerID& filter) const {
-      uint64 total_bytes = 0;
+void BandwidthAnalysis::computeWindowedDatagramSendRate(const ServerID& sender, const ServerID& receiver, const Duration& window, const Duration& sample_rate, const Time& start_time, const Time& end_time, std::ostream& summary_out, std::ostream& detail_out) {
+    EventStream events(GetPerServerFile(mOptName.c_str(), sender), sender, DATAGRAM_REORDER_WINDOW);
+    events.filterType(ServerDatagramSentTag);
+    computeWindowedRate<DatagramSentEvent>(sender, receiver, events, window, sample_rate, start_time, end_time, summary_out, detail_out, false);
+}
+
+void BandwidthAnalysis::computeWindowedDatagramReceiveRate(const ServerID& sender, const ServerID& receiver, const Duration& window, const Duration& sample_rate, const Time& start_time, const Time& end_time, std::ostream& summary_out, std::ostream& detail_out) {
+    EventStream events(GetPerServerFile(mOptName.c_str(), receiver), receiver, DATAGRAM_REORDER_WINDOW);
+    events.filterType(ServerDatagramReceivedTag);
+    computeWindowedRate<DatagramReceivedEvent>(sender, receiver, events, window, sample_rate, start_time, end_time, summary_out, detail_out, true);
+}
 
+void BandwidthAnalysis::computeJFI(const ServerID& sender) const {
       float sum = 0;
       float sum_of_squares = 0;
 
       for (uint32 receiver = 1; receiver <= mNumberOfServers; receiver++) {
         if (receiver != sender) {
-          total_bytes = 0;
-          float weight = 0;
-          if (getDatagramEventList(receiver) == NULL) continue;
-
-          for (EventIterator<EventType, EventIteratorType> event_it(sender, receiver, datagramBegin(receiver), datagramEnd(receiver)); event_it.current() != NULL; event_it.next() )
-            {
-              EventType* p_evt = event_it.current();
-
-              total_bytes += p_evt->data.size();
-
-              weight = p_evt->data.weight();
-
-
-            }
+          const RateStats& stats = getRateStats(mSendRates, sender, receiver);
+          uint64 total_bytes = stats.total_bytes;
+          float weight = stats.weight;
 
           sum += total_bytes/weight;
           sum_of_squares += (total_bytes/weight) * (total_bytes/weight);
@@ -754,150 +718,214 @@ void BandwidthAnalysis::computeJFI(const ServerID& sender, const ServerID& filte
 
 
 
-void BandwidthAnalysis::computeWindowedDatagramSendRate(const ServerID& sender, const ServerID& receiver, const Duration& window, const Duration& sample_rate, const Time& start_time, const Time& end_time, std::ostream& summary_out, std::ostream& detail_out) {
-    computeWindowedRate<DatagramSentEvent, DatagramEventList::const_iterator>(sender, receiver, datagramBegin(sender), datagramEnd(sender), window, sample_rate, start_time, end_time, summary_out, detail_out, false);
-}
-
-void BandwidthAnalysis::computeWindowedDatagramReceiveRate(const ServerID& sender, const ServerID& receiver, const Duration& window, const Duration& sample_rate, const Time& start_time, const Time& end_time, std::ostream& summary_out, std::ostream& detail_out) {
-    computeWindowedRate<DatagramReceivedEvent, DatagramEventList::const_iterator>(sender, receiver, datagramBegin(receiver), datagramEnd(receiver), window, sample_rate, start_time, end_time, summary_out, detail_out, true);
-}
+namespace {
 
-void BandwidthAnalysis::computeJFI(const ServerID& sender) const {
-  computeJFI<DatagramSentEvent, DatagramEventList::const_iterator>(sender, sender);
-}
+// The parts of a datagram's queued and received events needed to compute its
+// latency. Queued records only use start.
+struct DatagramRecord {
+    uint64 uid;
+    ServerID source;
+    ServerID dest;
+    bool received;
+    Time start;
+    Time end;
+};
+typedef SortMergeJoin<DatagramRecord> DatagramJoin;
 
+class LatencyStats {
+public:
+    LatencyStats()
+     : finished(0), unfinished(0), latency(Duration::microseconds(0))
+    {}
 
+    void sample(Duration dt) {
+        latency += dt;
+        finished++;
+    }
 
-LatencyAnalysis::PacketData::PacketData()
- :_send_start_time(Time::null()),
-  _send_end_time(Time::null()),
-  _receive_start_time(Time::null()),
-  _receive_end_time(Time::null())
-{
-    mSize=0;
-    mId=0;
-}
-void LatencyAnalysis::PacketData::addPacketSentEvent(DatagramQueuedEvent*sde) {
-    mSize=sde->data.size();
-    mId=sde->data.uid();
-    source=sde->data.source_server();
-    dest=sde->data.dest_server();
-    if (_send_start_time==Time::null()||_send_start_time>=sde->time) {
-        _send_start_time=sde->time;
-        _send_end_time=sde->time;
+    void merge(const LatencyStats& rhs) {
+        latency += rhs.latency;
+        finished += rhs.finished;
+        unfinished += rhs.unfinished;
     }
-}
-void LatencyAnalysis::PacketData::addPacketReceivedEvent(DatagramReceivedEvent*sde) {
-    mSize=sde->data.size();
-    mId=sde->data.uid();
-    source=sde->data.source_server();
-    dest=sde->data.dest_server();
-    if (_receive_end_time==Time::null()||_receive_end_time<=sde->data.end_time()) {
-        _receive_start_time=sde->data.start_time();
-        _receive_end_time=sde->data.end_time();
+
+    Duration avg() const {
+        if (finished > 0)
+            return latency / (double)finished;
+        else
+            return Duration::microseconds(0);
     }
-}
 
-LatencyAnalysis::LatencyAnalysis(const char* opt_name, const uint32 nservers) {
-    // read in all our data
-    mNumberOfServers = nservers;
-    std::tr1::unordered_map<uint64,PacketData> packetFlow;
-    for(uint32 server_id = 1; server_id <= nservers; server_id++) {
-        String loc_file = GetPerServerFile(opt_name, server_id);
-        std::ifstream is(loc_file.c_str(), std::ios::in);
-
-        while(is) {
-            uint16 type_hint;
-            std::string raw_evt;
-            if (!read_record(is, &type_hint, &raw_evt)) break;
-            Event* evt = Event::parse(type_hint, raw_evt, server_id);
-            if (evt == NULL)
-                break;
+    uint32 finished;
+    uint32 unfinished;
+private:
+    Duration latency;
+};
 
+struct ServerLatencyInfo {
+    ServerLatencyInfo() : to(NULL) {}
+    ~ServerLatencyInfo() { delete[] to; }
 
-            {
-                DatagramReceivedEvent* datagram_evt = dynamic_cast<DatagramReceivedEvent*>(evt);
-                if (datagram_evt != NULL) {
-                    packetFlow[datagram_evt->data.uid()].addPacketReceivedEvent(datagram_evt);
-                }
-            }
-            {
-                DatagramQueuedEvent* datagram_evt = dynamic_cast<DatagramQueuedEvent*>(evt);
-                if (datagram_evt != NULL) {
-                    packetFlow[datagram_evt->data.uid()].addPacketSentEvent(datagram_evt);
-                }
-            }
+    void init(uint32 nservers)
+    { to = new LatencyStats[nservers+1]; }
 
-            delete evt;
-        }
-    }
+    LatencyStats in;
+    LatencyStats out;
 
-    class LatencyStats {
-    public:
-        LatencyStats()
-         : finished(0), unfinished(0), latency(Duration::microseconds(0))
-        {}
+    LatencyStats* to;
+};
 
-        void sample(Duration dt) {
-            latency += dt;
-            finished++;
+ServerLatencyInfo* newServerLatencies(uint32 nservers) {
+    ServerLatencyInfo* server_latencies = new ServerLatencyInfo[nservers+1];
+    for(uint32 i = 0; i < nservers+1; i++)
+        server_latencies[i].init(nservers+1);
+    return server_latencies;
+}
+
+// Reads the datagram events from one server's trace which happened before
+// window_end into that server's run of the join. Anything later stays in the
+// stream for the next window.
+void readDatagramWindow(std::vector<EventStream*>* streams, DatagramJoin* join, Time window_end, uint32 idx) {
+    EventStream* events = (*streams)[idx];
+    DatagramJoin::Run& records = join->run(idx);
+
+    while(const Event* next_evt = events->peek()) {
+        if (next_evt->time >= window_end) break;
+        Event* evt = events->next();
+        DatagramRecord rec;
+        if (DatagramQueuedEvent* queued_evt = dynamic_cast<DatagramQueuedEvent*>(evt)) {
+            rec.uid = queued_evt->data.uid();
+            rec.source = queued_evt->data.source_server();
+            rec.dest = queued_evt->data.dest_server();
+            rec.received = false;
+            rec.start = queued_evt->time;
+            rec.end = queued_evt->time;
+            records.push_back(rec);
         }
-
-        Duration avg() const {
-            if (finished > 0)
-                return latency / (double)finished;
-            else
-                return Duration::microseconds(0);
+        else if (DatagramReceivedEvent* received_evt = dynamic_cast<DatagramReceivedEvent*>(evt)) {
+            rec.uid = received_evt->data.uid();
+            rec.source = received_evt->data.source_server();
+            rec.dest = received_evt->data.dest_server();
+            rec.received = true;
+            rec.start = received_evt->data.start_time();
+            rec.end = received_evt->data.end_time();
+            records.push_back(rec);
         }
+        delete evt;
+    }
+}
 
-        uint32 finished;
-        uint32 unfinished;
-    private:
-        Duration latency;
-    };
-
-    struct ServerLatencyInfo {
-        ServerLatencyInfo() : to(NULL) {}
-        ~ServerLatencyInfo() { delete to; }
+// Records the latency of a single datagram, from the earliest time it was
+// queued to the latest time it was received. Until the last window, datagrams
+// which are missing either end are put in pending instead, so they can be
+// joined with the rest of their events from later windows.
+void sampleDatagramLatency(std::vector<ServerLatencyInfo*>* partition_latencies, std::vector<DatagramJoin::Run>* partition_pending, bool last_window, uint32 partition, const DatagramJoin::Group& group) {
+    ServerLatencyInfo* server_latencies = (*partition_latencies)[partition];
 
-        void init(uint32 nservers)
-        { to = new LatencyStats[nservers+1]; }
+    Time send_start_time(Time::null());
+    Time receive_end_time(Time::null());
+    ServerID source = group[0].source, dest = group[0].dest;
+    for(uint32 i = 0; i < group.size(); i++) {
+        const DatagramRecord& rec = group[i];
+        if (!rec.received) {
+            if (send_start_time == Time::null() || send_start_time >= rec.start)
+                send_start_time = rec.start;
+        }
+        else {
+            if (receive_end_time == Time::null() || receive_end_time <= rec.end)
+                receive_end_time = rec.end;
+        }
+    }
 
-        LatencyStats in;
-        LatencyStats out;
+    if (send_start_time == Time::null() || receive_end_time == Time::null()) {
+        if (!last_window) {
+            DatagramJoin::Run& pending = (*partition_pending)[partition];
+            pending.insert(pending.end(), group.begin(), group.end());
+            return;
+        }
+        // Never made it to its destination
+        server_latencies[source].to[dest].unfinished++;
+        return;
+    }
 
-        LatencyStats* to;
-    };
+    Duration delta = receive_end_time - send_start_time;
+    if (delta>Duration::seconds(0.0f)) {
+        // From one to the other
+        server_latencies[source].to[dest].sample(delta);
+        // And the totals
+        server_latencies[source].out.sample(delta);
+        server_latencies[dest].in.sample(delta);
+    }
+}
 
-    ServerLatencyInfo* server_latencies = new ServerLatencyInfo[nservers+1];
-    for(uint32 i = 0; i < nservers+1; i++)
-        server_latencies[i].init(nservers+1);
+}
 
-    Time epoch(Time::null());
+LatencyAnalysis::LatencyAnalysis(const char* opt_name, const uint32 nservers, const Duration& window) {
+    mNumberOfServers = nservers;
 
-    for (std::tr1::unordered_map<uint64,PacketData>::iterator i=packetFlow.begin(),ie=packetFlow.end();i!=ie;++i) {
-        PacketData data = i->second;
+    // Read each server's datagram events in parallel, then join them on the
+    // datagram's uid. Each partition of the join collects its own stats,
+    // which are combined at the end. To keep memory bounded, this is done one
+    // window of trace time at a time. Datagrams missing their queued or
+    // received events at the end of a window are carried over in an extra run
+    // and joined again with the next window's events, so only datagrams in
+    // flight across a window boundary, or dropped, are held onto.
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+    std::vector<EventStream*> streams;
+    for(uint32 server_id = 1; server_id <= nservers; server_id++) {
+        EventStream* events = new EventStream(GetPerServerFile(opt_name, server_id), server_id);
+        events->filterType(ServerDatagramQueuedTag);
+        events->filterType(ServerDatagramReceivedTag);
+        streams.push_back(events);
+    }
+    DatagramJoin join(nservers+1);
+    DatagramJoin::Run& carried = join.run(nservers);
+
+    std::vector<ServerLatencyInfo*> partition_latencies;
+    for(uint32 p = 0; p < join.numPartitions(); p++)
+        partition_latencies.push_back(newServerLatencies(nservers));
+    std::vector<DatagramJoin::Run> partition_pending(join.numPartitions());
+
+    bool last_window = false;
+    while(!last_window) {
+        // Each window starts at the earliest event left in any trace, which
+        // skips over idle periods
+        Time window_end = Time::null();
+        for(uint32 i = 0; i < nservers; i++) {
+            const Event* next_evt = streams[i]->peek();
+            if (next_evt != NULL && (window_end == Time::null() || next_evt->time < window_end))
+                window_end = next_evt->time;
+        }
+        window_end += std::max(window, Duration::milliseconds((int64)1));
+        ParallelFor(nservers, std::tr1::bind(&readDatagramWindow, &streams, &join, window_end, _1));
+        last_window = true;
+        for(uint32 i = 0; i < nservers; i++)
+            if (streams[i]->peek() != NULL) last_window = false;
+
+        join.sort();
+        join.join(std::tr1::bind(&sampleDatagramLatency, &partition_latencies, &partition_pending, last_window, _1, _2));
+
+        join.clear();
+        for(uint32 p = 0; p < partition_pending.size(); p++) {
+            carried.insert(carried.end(), partition_pending[p].begin(), partition_pending[p].end());
+            partition_pending[p].clear();
+        }
+    }
 
-        if (data._receive_end_time != epoch && data._send_start_time != epoch) {
-            Duration delta = data._receive_end_time-data._send_start_time;
-            if (delta>Duration::seconds(0.0f)) {
+    for(uint32 i = 0; i < nservers; i++)
+        delete streams[i];
 
-                // From one to the other
-                server_latencies[data.source].to[data.dest].sample(delta);
-                // And the totals
-                server_latencies[data.source].out.sample(delta);
-                server_latencies[data.dest].in.sample(delta);
-            }else if (delta<Duration::seconds(0.0f)){
-                //printf ("Packet with id %ld, negative duration %f (%f %f)->(%f %f) %d (%f %f) (%f %f)\n",data.mId,delta.toSeconds(),0.,(data._send_end_time-data._send_start_time).toSeconds(),(data._receive_start_time-data._send_start_time).toSeconds(),(data._receive_end_time-data._send_start_time).toSeconds(),data.mSize, (data._send_start_time-Time::null()).toSeconds(),(data._send_end_time-Time::null()).toSeconds(),(data._receive_start_time-Time::null()).toSeconds(),(data._receive_end_time-Time::null()).toSeconds());
-            }
-        }else{
-            server_latencies[data.source].to[data.dest].unfinished++;
-            if (data._receive_end_time == epoch && data._send_start_time == epoch) {
-                printf ("Packet with uninitialized duration\n");
-            }
+    ServerLatencyInfo* server_latencies = newServerLatencies(nservers);
+    for(uint32 p = 0; p < partition_latencies.size(); p++) {
+        for(uint32 i = 0; i < nservers+1; i++) {
+            server_latencies[i].in.merge(partition_latencies[p][i].in);
+            server_latencies[i].out.merge(partition_latencies[p][i].out);
+            for(uint32 j = 0; j < nservers+1; j++)
+                server_latencies[i].to[j].merge(partition_latencies[p][i].to[j]);
         }
+        delete[] partition_latencies[p];
     }
-    packetFlow.clear();
 
 
     for(uint32 source_id = 1; source_id <= nservers; source_id++) {
@@ -919,6 +947,7 @@ LatencyAnalysis::LatencyAnalysis(const char* opt_name, const uint32 nservers) {
                   << " (" << server_latencies[serv_id].out.finished << ")" << std::endl;
     }
 
+    delete[] server_latencies;
 }
 
 LatencyAnalysis::~LatencyAnalysis() {
@@ -956,16 +985,12 @@ LatencyAnalysis::~LatencyAnalysis() {
     for(uint32 server_id = 1; server_id <= nservers; server_id++)
     {
       String loc_file = GetPerServerFile(opt_name, server_id);
-      std::ifstream is(loc_file.c_str(), std::ios::in);
+      EventStream events(loc_file, server_id);
+      events.filterType(MigrationBeginTag);
+      events.filterType(MigrationAckTag);
 
-      while(is)
+      while(Event* evt = events.next())
       {
-          uint16 type_hint;
-          std::string raw_evt;
-          if (!read_record(is, &type_hint, &raw_evt)) break;
-          Event* evt = Event::parse(type_hint, raw_evt, server_id);
-          if (evt == NULL)
-              break;
 
 
         MigrationBeginEvent* obj_mig_evt = dynamic_cast<MigrationBeginEvent*>(evt);
@@ -1130,16 +1155,11 @@ LatencyAnalysis::~LatencyAnalysis() {
     for(uint32 server_id = 1; server_id <= nservers; server_id++)
     {
       String loc_file = GetPerServerFile(opt_name, server_id);
-      std::ifstream is(loc_file.c_str(), std::ios::in);
+      EventStream events(loc_file, server_id);
+      events.filterType(ObjectSegmentationCraqLookupRequestAnalysisTag);
 
-      while(is)
+      while(Event* evt = events.next())
       {
-          uint16 type_hint;
-          std::string raw_evt;
-          if (!read_record(is, &type_hint, &raw_evt)) break;
-          Event* evt = Event::parse(type_hint, raw_evt, server_id);
-        if (evt == NULL)
-          break;
 
         OSegCraqRequestEvent* obj_lookup_evt = dynamic_cast<OSegCraqRequestEvent*> (evt);
         if (obj_lookup_evt != NULL)
@@ -1238,16 +1258,11 @@ LatencyAnalysis::~LatencyAnalysis() {
     for(uint32 server_id = 1; server_id <= nservers; server_id++)
     {
       String loc_file = GetPerServerFile(opt_name, server_id);
-      std::ifstream is(loc_file.c_str(), std::ios::in);
+      EventStream events(loc_file, server_id);
+      events.filterType(OSegLookupNotOnServerAnalysisTag);
 
-      while(is)
+      while(Event* evt = events.next())
       {
-          uint16 type_hint;
-          std::string raw_evt;
-          if (!read_record(is, &type_hint, &raw_evt)) break;
-          Event* evt = Event::parse(type_hint, raw_evt, server_id);
-        if (evt == NULL)
-          break;
 
         OSegInvalidLookupEvent* obj_lookup_evt = dynamic_cast<OSegInvalidLookupEvent*> (evt);
         if (obj_lookup_evt != NULL)
@@ -1347,16 +1362,11 @@ LatencyAnalysis::~LatencyAnalysis() {
     for(uint32 server_id = 1; server_id <= nservers; server_id++)
     {
       String loc_file = GetPerServerFile(opt_name, server_id);
-      std::ifstream is(loc_file.c_str(), std::ios::in);
+      EventStream events(loc_file, server_id);
+      events.filterType(ObjectSegmentationProcessedRequestAnalysisTag);
 
-      while(is)
+      while(Event* evt = events.next())
       {
-          uint16 type_hint;
-          std::string raw_evt;
-          if (!read_record(is, &type_hint, &raw_evt)) break;
-          Event* evt = Event::parse(type_hint, raw_evt, server_id);
-        if (evt == NULL)
-          break;
 
         OSegProcessedRequestEvent* obj_lookup_proc_evt = dynamic_cast<OSegProcessedRequestEvent*> (evt);
 
@@ -1553,16 +1563,11 @@ LatencyAnalysis::~LatencyAnalysis() {
     for(uint32 server_id = 1; server_id <= nservers; server_id++)
     {
       String loc_file = GetPerServerFile(opt_name, server_id);
-      std::ifstream is(loc_file.c_str(), std::ios::in);
+      EventStream events(loc_file, server_id);
+      events.filterType(MigrationRoundTripTag);
 
-      while(is)
+      while(Event* evt = events.next())
       {
-          uint16 type_hint;
-          std::string raw_evt;
-          if (!read_record(is, &type_hint, &raw_evt)) break;
-          Event* evt = Event::parse(type_hint, raw_evt, server_id);
-        if (evt == NULL)
-          break;
 
         MigrationRoundTripEvent* obj_rdt_evt = dynamic_cast<MigrationRoundTripEvent*> (evt);
 
@@ -1637,16 +1642,11 @@ LatencyAnalysis::~LatencyAnalysis() {
     for(uint32 server_id = 1; server_id <= nservers; server_id++)
     {
       String loc_file = GetPerServerFile(opt_name, server_id);
-      std::ifstream is(loc_file.c_str(), std::ios::in);
+      EventStream events(loc_file, server_id);
+      events.filterType(OSegTrackedSetResultAnalysisTag);
 
-      while(is)
+      while(Event* evt = events.next())
       {
-          uint16 type_hint;
-          std::string raw_evt;
-          if (!read_record(is, &type_hint, &raw_evt)) break;
-          Event* evt = Event::parse(type_hint, raw_evt, server_id);
-        if (evt == NULL)
-          break;
 
         OSegTrackedSetResultsEvent* oseg_tracked_evt = dynamic_cast<OSegTrackedSetResultsEvent*> (evt);
 
@@ -1716,16 +1716,11 @@ LatencyAnalysis::~LatencyAnalysis() {
     for(uint32 server_id = 1; server_id <= nservers; server_id++)
     {
       String loc_file = GetPerServerFile(opt_name, server_id);
-      std::ifstream is(loc_file.c_str(), std::ios::in);
+      EventStream events(loc_file, server_id);
+      events.filterType(OSegShutdownEventTag);
 
-      while(is)
+      while(Event* evt = events.next())
       {
-          uint16 type_hint;
-          std::string raw_evt;
-          if (!read_record(is, &type_hint, &raw_evt)) break;
-          Event* evt = Event::parse(type_hint, raw_evt, server_id);
-        if (evt == NULL)
-          break;
 
         OSegShutdownEvent* oseg_shutdown_evt = dynamic_cast<OSegShutdownEvent*> (evt);
 
@@ -1777,16 +1772,11 @@ OSegCacheResponseAnalysis::OSegCacheResponseAnalysis(const char* opt_name, const
   for(uint32 server_id = 1; server_id <= nservers; server_id++)
   {
     String loc_file = GetPerServerFile(opt_name, server_id);
-    std::ifstream is(loc_file.c_str(), std::ios::in);
+    EventStream events(loc_file, server_id);
+    events.filterType(OSegCacheResponseTag);
 
-    while(is)
+    while(Event* evt = events.next())
     {
-        uint16 type_hint;
-        std::string raw_evt;
-        if (!read_record(is, &type_hint, &raw_evt)) break;
-        Event* evt = Event::parse(type_hint, raw_evt, server_id);
-      if (evt == NULL)
-        break;
 
       OSegCacheResponseEvent* oseg_cache_evt = dynamic_cast<OSegCacheResponseEvent*> (evt);
 
@@ -1853,16 +1843,14 @@ OSegCacheErrorAnalysis::OSegCacheErrorAnalysis(const char* opt_name, const uint3
   for(uint32 server_id = 1; server_id <= nservers; server_id++)
   {
     String loc_file = GetPerServerFile(opt_name, server_id);
-    std::ifstream is(loc_file.c_str(), std::ios::in);
+    EventStream events(loc_file, server_id);
+    events.filterType(MigrationRoundTripTag);
+    events.filterType(ObjectSegmentationProcessedRequestAnalysisTag);
+    events.filterType(OSegCacheResponseTag);
+    events.filterType(OSegLookupNotOnServerAnalysisTag);
 
-    while(is)
+    while(Event* evt = events.next())
     {
-        uint16 type_hint;
-        std::string raw_evt;
-        if (!read_record(is, &type_hint, &raw_evt)) break;
-        Event* evt = Event::parse(type_hint, raw_evt, server_id);
-      if (evt == NULL)
-        break;
 
       MigrationRoundTripEvent* oseg_rd_trip_evt = dynamic_cast<MigrationRoundTripEvent*> (evt);
       if (oseg_rd_trip_evt != NULL)
@@ -2074,7 +2062,9 @@ OSegCacheErrorAnalysis::~OSegCacheErrorAnalysis()
 void LocationLatencyAnalysis(const char* opt_name, const uint32 nservers) {
     for(uint32 server_id = 1; server_id <= nservers; server_id++) {
         String loc_file = GetPerServerFile(opt_name, server_id);
-        std::ifstream is(loc_file.c_str(), std::ios::in);
+        EventStream events(loc_file, server_id);
+        events.filterType(ObjectGeneratedLocationTag);
+        events.filterType(ObjectLocationTag);
 
         typedef std::vector<Event*> EventList;
         typedef std::map<UUID, EventList*> EventListMap;
@@ -2085,14 +2075,7 @@ void LocationLatencyAnalysis(const char* opt_name, const uint32 nservers) {
         MotionPathMap paths;
 
         // Extract all loc and gen loc events
-        while(is) {
-            uint16 type_hint;
-            std::string raw_evt;
-            if (!read_record(is, &type_hint, &raw_evt)) break;
-            Event* evt = Event::parse(type_hint, raw_evt, server_id);
-            if (evt == NULL)
-                break;
-
+        while(Event* evt = events.next()) {
             GeneratedLocationEvent* gen_loc_evt = dynamic_cast<GeneratedLocationEvent*>(evt);
             LocationEvent* loc_evt = dynamic_cast<LocationEvent*>(evt);
 
@@ -2177,16 +2160,10 @@ void ProximityDumpAnalysis(const char* opt_name, const uint32 nservers, const St
     // Get all prox events for all servers
     for(uint32 server_id = 1; server_id <= nservers; server_id++) {
         String prox_file = GetPerServerFile(opt_name, server_id);
-        std::ifstream is(prox_file.c_str(), std::ios::in);
-
-        while(is) {
-            uint16 type_hint;
-            std::string raw_evt;
-            if (!read_record(is, &type_hint, &raw_evt)) break;
-            Event* evt = Event::parse(type_hint, raw_evt, server_id);
-            if (evt == NULL)
-                break;
+        EventStream events(prox_file, server_id);
+        events.filterType(ProximityTag);
 
+        while(Event* evt = events.next()) {
             ProximityEvent* prox_evt = dynamic_cast<ProximityEvent*>(evt);
             if (prox_evt != NULL)
                 prox_events.push_back(prox_evt);
@@ -2222,16 +2199,11 @@ OSegCumulativeTraceAnalysis::OSegCumulativeTraceAnalysis(const char* opt_name, c
   for(uint32 server_id = 1; server_id <= nservers; server_id++)
   {
     String loc_file = GetPerServerFile(opt_name, server_id);
-    std::ifstream is(loc_file.c_str(), std::ios::in);
+    EventStream events(loc_file, server_id);
+    events.filterType(OSegCumulativeTraceAnalysisTag);
 
-    while(is)
+    while(Event* evt = events.next())
     {
-        uint16 type_hint;
-        std::string raw_evt;
-        if (!read_record(is, &type_hint, &raw_evt)) break;
-        Event* evt = Event::parse(type_hint, raw_evt, server_id);
-      if (evt == NULL)
-        break;
 
       OSegCumulativeResponseEvent* oseg_cum_evt = dynamic_cast<OSegCumulativeResponseEvent*> (evt);
       if (oseg_cum_evt != NULL)
@@ -92,21 +92,35 @@ public:
    void computeJFI(const ServerID& server_id) const;
 
 private:
-    typedef std::vector<Event*> DatagramEventList;
-    typedef std::map<ServerID, DatagramEventList*> ServerDatagramEventListMap;
-    DatagramEventList mEmptyDatagramEventList;
+    // Running totals for datagrams from one server to another
+    struct RateStats {
+        RateStats();
 
-    DatagramEventList::const_iterator datagramBegin(const ServerID& server) const;
-    DatagramEventList::const_iterator datagramEnd(const ServerID& server) const;
+        void add(const Time& t, uint32 size);
 
-    const DatagramEventList* getDatagramEventList(const ServerID& server) const;
+        uint64 total_bytes;
+        double max_bandwidth;
+        // Weight of the most recent datagram
+        float weight;
 
-    template<typename EventType, typename EventIteratorType>
-    void computeJFI(const ServerID& sender, const ServerID& filter) const;
+        // Bandwidth is computed over groups of datagrams with the same time
+        uint32 last_bytes;
+        Duration last_duration;
+        Time last_time;
+    };
+    typedef std::pair<ServerID, ServerID> ServerPair;
+    typedef std::map<ServerPair, RateStats> ServerPairRateMap;
 
-    ServerDatagramEventListMap mDatagramEventLists;
+    const RateStats& getRateStats(const ServerPairRateMap& rates, const ServerID& sender, const ServerID& receiver) const;
 
+    // Windowed rates need all the datagrams in each window, so they stream
+    // through the trace again rather than keeping every datagram in memory.
+    String mOptName;
     uint32 mNumberOfServers;
+
+    ServerPairRateMap mSendRates;
+    ServerPairRateMap mReceiveRates;
+    RateStats mEmptyRateStats;
 }; // class BandwidthAnalysis
 
 
@@ -114,24 +128,10 @@ private:
  *  checking relative bandwidths when under load, etc.
  */
 class LatencyAnalysis {
-    class PacketData {
-        uint32 mSize;
-        uint64 mId;
-        ServerID source;
-        ServerID dest;
-        Time _send_start_time;
-        Time _send_end_time;
-        Time _receive_start_time;
-        Time _receive_end_time;
-        friend class LatencyAnalysis;
-    public:
-        PacketData();
-        void addPacketSentEvent(DatagramQueuedEvent*);
-        void addPacketReceivedEvent(DatagramReceivedEvent*);
-    };
-
 public:
-    LatencyAnalysis(const char* opt_name, const uint32 nservers);
+    // Reads and joins the servers' datagram events one window of trace time
+    // at a time
+    LatencyAnalysis(const char* opt_name, const uint32 nservers, const Duration& window);
     ~LatencyAnalysis();
 
 private:
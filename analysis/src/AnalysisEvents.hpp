@@ -35,6 +35,7 @@
 #define __SIRIKATA_ANALYSIS_EVENTS_HPP__
 
 #include <sirikata/core/trace/Trace.hpp>
+#include <sirikata/core/trace/TraceReader.hpp>
 #include "Protocol_ObjectTrace.pbj.hpp"
 #include "Protocol_OSegTrace.pbj.hpp"
 #include "Protocol_MigrationTrace.pbj.hpp"
@@ -45,9 +46,6 @@
 
 namespace Sirikata {
 
-/** Read a single trace record, storing the type hint in type_hint_out and the result in payload_out.*/
-bool read_record(std::istream& is, uint16* type_hint_out, std::string* payload_out);
-
 struct Event {
     static Event* parse(uint16 type_hint, const std::string& record, const ServerID& trace_server_id);
 
@@ -65,6 +63,68 @@ struct EventTimeComparator {
     }
 };
 
+/** Streams the events from one server's trace file. Records with types the
+ *  analysis doesn't ask for are skipped without being parsed, and whole chunks
+ *  of the trace are skipped if they don't contain any of them.
+ *
+ *  Events are only roughly in time order in the trace. If a reorder window is
+ *  given, up to that many events are buffered and the earliest is returned
+ *  each time, which restores time order as long as events aren't displaced by
+ *  more than the window. With no window events are returned in trace order.
+ */
+class EventStream {
+public:
+    EventStream(const String& filename, const ServerID& trace_server_id, uint32 reorder_window = 0);
+    ~EventStream();
+
+    // Only return events with this type hint. Can be called multiple times,
+    // but only before reading any events. By default all events are returned.
+    void filterType(uint16 type_hint);
+
+    // Get the next event, or NULL if there are no more. The caller takes
+    // ownership of the event.
+    Event* next();
+    // Get the next event without removing it from the stream, or NULL if
+    // there are no more.
+    const Event* peek();
+
+private:
+    // Parse another event into mPending, returning false at the end of the
+    // trace
+    bool fill();
+
+    struct LaterEventComparator {
+        bool operator()(const Event* lhs, const Event* rhs) const {
+            return (lhs->time > rhs->time);
+        }
+    };
+
+    Trace::TraceReader mReader;
+    ServerID mServerID;
+    uint32 mReorderWindow;
+    std::string mRecord;
+    std::priority_queue<Event*, std::vector<Event*>, LaterEventComparator> mPending;
+};
+
+/** Merges several EventStreams, returning the earliest event available from
+ *  any of them. If each stream is in time order, so is the merged stream.
+ */
+class MergedEventStream {
+public:
+    MergedEventStream();
+    ~MergedEventStream();
+
+    // Add a stream to merge, taking ownership of it
+    void add(EventStream* stream);
+
+    // Get the next event, or NULL if all the streams are empty. The caller
+    // takes ownership of the event.
+    Event* next();
+
+private:
+    std::vector<EventStream*> mStreams;
+};
+
 template<typename T>
 struct PBJEvent : public Event {
     T data;
@@ -102,6 +162,7 @@ typedef PBJEvent<Trace::OSeg::Shutdown> OSegShutdownEvent;
 typedef PBJEvent<Trace::OSeg::CacheResponse> OSegCacheResponseEvent;
 typedef PBJEvent<Trace::OSeg::InvalidLookup> OSegInvalidLookupEvent;
 typedef PBJEvent<Trace::OSeg::CumulativeResponse> OSegCumulativeResponseEvent;
+typedef PBJEvent<Trace::OSeg::LookupBatch> OSegLookupBatchEvent;
 //Migration
 typedef PBJEvent<Trace::Migration::Begin> MigrationBeginEvent;
 typedef PBJEvent<Trace::Migration::Ack> MigrationAckEvent;
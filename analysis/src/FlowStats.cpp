@@ -52,17 +52,14 @@ FlowStatsAnalysis::FlowStatsAnalysis(const char* opt_name, const uint32 nservers
     bool firstHitPointSample=true;
     for(uint32 server_id = 1; server_id <= nservers; server_id++) {
         String loc_file = GetPerServerFile(opt_name, server_id);
-        std::ifstream is(loc_file.c_str(), std::ios::in);
-
-        while(is) {
-            uint16 type_hint;
-            std::string raw_evt;
-            if (!read_record(is, &type_hint, &raw_evt)) break;
-            if (!is) break;
-            Event* evt = Event::parse(type_hint, raw_evt, server_id);
-            if (evt == NULL)
-                break;
-
+        EventStream events(loc_file, server_id);
+        events.filterType(ObjectConnectedTag);
+        events.filterType(ObjectGeneratedLocationTag);
+        events.filterType(ObjectPingCreatedTag);
+        events.filterType(ObjectPingTag);
+        events.filterType(ObjectHitPointTag);
+
+        while(Event* evt = events.next()) {
             {
                 ObjectConnectedEvent* conn_evt = dynamic_cast<ObjectConnectedEvent*>(evt);
                 if (conn_evt != NULL) {
@@ -32,7 +32,9 @@
 
 #include "AnalysisEvents.hpp"
 #include "MessageLatency.hpp"
+#include "ParallelAnalysis.hpp"
 #include <sirikata/core/options/CommonOptions.hpp>
+#include <boost/thread/mutex.hpp>
 
 #define INFO_LOG(msg) SILOG(msg_lat_anls,insane,msg)
 #define ERROR_LOG(msg) SILOG(msg_lat_anls,error,msg)
@@ -74,6 +76,11 @@ class Average {
     uint32 samples() const {
         return numSamples;
     }
+    void merge(const Average& rhs) {
+        sample_sum += rhs.sample_sum;
+        sample2_sum += rhs.sample2_sum;
+        numSamples += rhs.numSamples;
+    }
 };
 
 
@@ -811,6 +818,164 @@ void reportStats(PathPair pp, PathAverageMap* pam) {
           );
 }
 
+// A single timestamp of a message. Ports are only filled in for creation
+// timestamps.
+struct TimestampRecord {
+    uint64 uid;
+    Time time;
+    uint32 server;
+    Trace::MessagePath path;
+    ObjectMessagePort srcport;
+    ObjectMessagePort dstport;
+};
+typedef SortMergeJoin<TimestampRecord> TimestampJoin;
+typedef std::tr1::unordered_set<uint64> PacketIDSet;
+typedef std::priority_queue<uint64> PacketIDPriority;
+
+// Collects the timestamps for the packets handled in one round from one
+// server's trace. Like the round as a whole, this keeps only the
+// max_packets smallest packet IDs greater than base_id, which is a superset
+// of this server's packets that make it into the round.
+struct TimestampReader {
+    TimestampReader()
+     : packets(NULL),
+       compact_size(0)
+    {}
+
+    void read(const String& filename, uint32 server_id, uint64 base_id, uint32 max_packets) {
+        compact_size = max_packets;
+
+        EventStream events(filename, server_id);
+        events.filterType(MessageTimestampTag);
+        events.filterType(MessageCreationTimestampTag);
+
+        while(Event* evt = events.next()) {
+            MessageTimestampEvent* tevt = dynamic_cast<MessageTimestampEvent*>(evt);
+            if (tevt != NULL) {
+                uint64 pid = tevt->uid;
+
+                // Figure out if we need to / can add this packet
+                bool should_insert = false;
+                if (included.find(pid) != included.end()) {
+                    should_insert = true;
+                }
+                else if (pid > base_id) {
+                    // Either we fit in now problem
+                    if (priorities.size() < max_packets) {
+                        priorities.push(pid);
+                        included.insert(pid);
+                        should_insert = true;
+                    }
+                    else {
+                        // Or we need to evict, or are ignored
+                        uint64 top_pid = priorities.top();
+                        if (top_pid > pid) {
+                            priorities.pop();
+                            included.erase(top_pid);
+                            priorities.push(pid);
+                            included.insert(pid);
+                            should_insert = true;
+                        }
+                    }
+                }
+
+                if (should_insert) {
+                    TimestampRecord rec;
+                    rec.uid = pid;
+                    rec.time = tevt->time;
+                    rec.server = server_id;
+                    rec.path = tevt->path;
+                    rec.srcport = 0;
+                    rec.dstport = 0;
+                    MessageCreationTimestampEvent* cevt = dynamic_cast<MessageCreationTimestampEvent*>(evt);
+                    if (cevt != NULL) {
+                        rec.srcport = cevt->srcport;
+                        rec.dstport = cevt->dstport;
+                    }
+                    packets->push_back(rec);
+                    if (packets->size() >= 2*compact_size)
+                        compact();
+                }
+            }
+            delete evt;
+        }
+        compact();
+    }
+
+    // Drop timestamps of evicted packets
+    void compact() {
+        TimestampJoin::Run::iterator out = packets->begin();
+        for(TimestampJoin::Run::iterator it = packets->begin(); it != packets->end(); it++) {
+            if (included.find(it->uid) == included.end()) continue;
+            *out = *it;
+            out++;
+        }
+        packets->erase(out, packets->end());
+        compact_size = std::max(compact_size, (uint64)packets->size());
+    }
+
+    TimestampJoin::Run* packets;
+    PacketIDPriority priorities;
+    PacketIDSet included;
+    uint64 compact_size;
+};
+
+void readTimestamps(const char* opt_name, uint64 base_id, uint32 max_packets, std::vector<TimestampReader>* readers, uint32 idx) {
+    uint32 server_id = idx + 1;
+    (*readers)[idx].read(GetPerServerFile(opt_name, server_id), server_id, base_id, max_packets);
+}
+
+// Results from one partition of the join. Stage samples are buffered per
+// packet so each packet's samples are written to the dump file together.
+struct PartitionResults {
+    PartitionResults()
+     : dump(NULL)
+    {}
+    ~PartitionResults() {
+        delete dump;
+    }
+
+    PathAverageMap averages;
+    std::ostringstream* dump;
+};
+
+void matchPacket(const PacketStageGraph* stage_graph, const MessageLatencyFilters* filter,
+    std::vector<PartitionResults>* partition_results, std::ostream* stage_dump_file, boost::mutex* stage_dump_mutex,
+    uint32 partition, const TimestampJoin::Group& group)
+{
+    PacketData pd;
+    pd.id = group[0].uid;
+    for(uint32 i = 0; i < group.size(); i++) {
+        const TimestampRecord& rec = group[i];
+        pd.stamps[rec.server].push_back(PacketSample(rec.time, rec.server, rec.path));
+        if (rec.srcport!=0) pd.source_port = rec.srcport;
+        if (rec.dstport!=0) pd.dest_port = rec.dstport;
+    }
+
+    if ( !matches(*filter, pd) ) return;
+
+    // Perform a stable sort for each packet's server timestamp lists, then try
+    // to match it to the graph.
+    // Note that the stable sort is only necessary because the logging is
+    // multithreaded and may not get everything perfectly in order.
+    for(PacketData::ServerPacketMap::iterator server_it = pd.stamps.begin();
+        server_it != pd.stamps.end();
+        server_it++) {
+        std::stable_sort(server_it->second.begin(), server_it->second.end());
+    }
+
+    PartitionResults& results = (*partition_results)[partition];
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+    stage_graph->match_path(pd, std::tr1::bind(&reportPair, _1, _2, &results.averages, results.dump));
+
+    if (results.dump != NULL) {
+        boost::lock_guard<boost::mutex> lck(*stage_dump_mutex);
+        (*stage_dump_file) << results.dump->str();
+        results.dump->str("");
+    }
+}
+
 } // namespace
 
 MessageLatencyFilters::MessageLatencyFilters(ObjectMessagePort *destPort, const uint32*filterByCreationServer,const uint32 *filterByDestructionServer, const uint32*filterByForwardingServer, const uint32 *filterByDeliveryServer) {
@@ -890,19 +1055,19 @@ void MessageLatencyAnalysis(const char* opt_name, const uint32 nservers, Message
     // then the largest packet ID from the current round.  For the first round,
     // the base packet ID will obviously be 0.
 
-    typedef std::tr1::unordered_map<uint64,PacketData> PacketMap;
-    typedef std::priority_queue<uint64> PacketIDPriority;
+    // Each round reads the servers' traces in parallel and then joins their
+    // timestamps on the packet ID, matching each packet's path in parallel.
 
     // Prepare output data structures
     std::ofstream* stage_dump_file = NULL;
     if (!stage_dump_filename.empty()) {
         stage_dump_file = new std::ofstream(stage_dump_filename.c_str());
     }
+    boost::mutex stage_dump_mutex;
     PathAverageMap results;
 
     using std::tr1::placeholders::_1;
     using std::tr1::placeholders::_2;
-    ReportPairFunction report_func = std::tr1::bind(&reportPair, _1, _2, &results, stage_dump_file);
 
     // Round data
     uint32 round_max_packets = 1024*1024; // maximum # of packets per round
@@ -911,94 +1076,51 @@ void MessageLatencyAnalysis(const char* opt_name, const uint32 nservers, Message
     while(true) { // condition near bottom will break out of loop if we end up
                   // processing fewer than our target number of packets
 
-        PacketMap packetFlow;
-        PacketIDPriority packetPriorities;
+        TimestampJoin join(nservers);
+        std::vector<TimestampReader> readers(nservers);
+        for(uint32 i = 0; i < nservers; i++)
+            readers[i].packets = &join.run(i);
 
         // Read in data for this round
-        for(uint32 server_id = 1; server_id <= nservers; server_id++) {
-            String loc_file = GetPerServerFile(opt_name, server_id);
-            std::ifstream is(loc_file.c_str(), std::ios::in);
-
-            while(is) {
-                uint16 type_hint;
-                std::string raw_evt;
-                if (!read_record(is, &type_hint, &raw_evt)) break;
-                Event* evt = Event::parse(type_hint, raw_evt, server_id);
-                if (evt == NULL)
-                    break;
-
-                {
-                    MessageTimestampEvent* tevt = dynamic_cast<MessageTimestampEvent*>(evt);
-                    if (tevt != NULL) {
-                        uint64 pid = tevt->uid;
-
-                        // Figure out if we need to / can add this packet
-                        bool should_insert = false;
-                        if (packetFlow.find(pid) != packetFlow.end()) {
-                            should_insert = true;
-                        }
-                        else {
-                            if (pid > round_base_id) {
-                                // Either we fit in now problem
-                                if (packetPriorities.size() < round_max_packets) {
-                                    packetPriorities.push(pid);
-                                    should_insert = true;
-                                }
-                                else {
-                                    // Or we need to evict, or are ignored
-                                    uint64 top_pid = packetPriorities.top();
-                                    if (top_pid > pid) {
-                                        packetPriorities.pop();
-                                        packetFlow.erase(top_pid);
-                                        packetPriorities.push(pid);
-                                        should_insert = true;
-                                    }
-                                }
-                            }
-                        }
+        ParallelFor(nservers, std::tr1::bind(&readTimestamps, opt_name, round_base_id, round_max_packets, &readers, _1));
+
+        // Each server chose its own smallest packet IDs, from which we choose
+        // the smallest overall
+        std::vector<uint64> round_packets;
+        for(uint32 i = 0; i < nservers; i++) {
+            round_packets.insert(round_packets.end(), readers[i].included.begin(), readers[i].included.end());
+            readers[i].included.clear();
+        }
+        std::sort(round_packets.begin(), round_packets.end());
+        round_packets.erase(std::unique(round_packets.begin(), round_packets.end()), round_packets.end());
+        if (round_packets.size() > round_max_packets)
+            round_packets.resize(round_max_packets);
 
-                        if (should_insert) {
-                            PacketData* pd = &packetFlow[tevt->uid];
-                            pd->stamps[server_id].push_back(PacketSample(tevt->time, server_id, tevt->path));
-                            MessageCreationTimestampEvent* cevt = dynamic_cast<MessageCreationTimestampEvent*>(evt);
-                            if (cevt != NULL) {
-                                if (cevt->srcport!=0) pd->source_port = cevt->srcport;
-                                if (cevt->dstport!=0) pd->dest_port = cevt->dstport;
-                            }
-                        }
-                    }
-                }
-                delete evt;
-            }
+        if (round_packets.empty()) {
+            SILOG(analysis,error,"Empty packet priorities\n");
+            break;
         }
 
-        // Perform a stable sort for each packet's server timestamp lists, then try
-        // to match it to the graph.
-        // Note that the stable sort is only necessary because the logging is
-        // multithreaded and may not get everything perfectly in order.
-        for (PacketMap::iterator iter = packetFlow.begin(),ie=packetFlow.end();
-             iter!=ie;
-             ++iter) {
-            PacketData& pd = iter->second;
-            if ( !matches(filter, pd) || (pd.stamps.size() == 0) ) continue;
-
-            for(PacketData::ServerPacketMap::iterator server_it = pd.stamps.begin();
-                server_it != pd.stamps.end();
-                server_it++) {
-                std::stable_sort(server_it->second.begin(), server_it->second.end());
-            }
+        join.sort();
+        join.truncate(round_packets.back());
 
-            stage_graph.match_path(pd, report_func);
+        std::vector<PartitionResults> partition_results(join.numPartitions());
+        if (stage_dump_file != NULL) {
+            for(uint32 p = 0; p < partition_results.size(); p++)
+                partition_results[p].dump = new std::ostringstream();
+        }
+        join.join(
+            std::tr1::bind(&matchPacket, &stage_graph, &filter, &partition_results, stage_dump_file, &stage_dump_mutex, _1, _2)
+        );
+        for(uint32 p = 0; p < partition_results.size(); p++) {
+            for(PathAverageMap::iterator it = partition_results[p].averages.begin(); it != partition_results[p].averages.end(); it++)
+                results[it->first].merge(it->second);
         }
 
         // Finally, with all of this rounds packets report, prepare for next round
-        if (packetPriorities.empty()) {
-            SILOG(analysis,error,"Empty packet priorities\n");
-            break;
-        }
-        round_base_id = packetPriorities.top();
+        round_base_id = round_packets.back();
         // We can stop when we had fewer than our max number of packets for the round
-        if (packetPriorities.size() < round_max_packets)
+        if (round_packets.size() < round_max_packets)
             break;
     }
 
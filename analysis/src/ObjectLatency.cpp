@@ -40,16 +40,10 @@ ObjectLatencyAnalysis::ObjectLatencyAnalysis(const char*opt_name, const uint32 n
     mNumberOfServers = nservers;
     for(uint32 server_id = 1; server_id <= nservers; server_id++) {
         String loc_file = GetPerServerFile(opt_name, server_id);
-        std::ifstream is(loc_file.c_str(), std::ios::in);
-
-        while(is) {
-            uint16 type_hint;
-            std::string raw_evt;
-            if (!read_record(is, &type_hint, &raw_evt)) break;
-            Event* evt = Event::parse(type_hint, raw_evt, server_id);
-            if (evt == NULL)
-                break;
+        EventStream events(loc_file, server_id);
+        events.filterType(ObjectPingTag);
 
+        while(Event* evt = events.next()) {
             {
                 PingEvent* ping_evt = dynamic_cast<PingEvent*>(evt);
                 if (ping_evt != NULL) {
@@ -48,6 +48,7 @@ void InitAnalysisOptions() {
 
         .addOption(new OptionValue(ANALYSIS_BANDWIDTH, "false", Sirikata::OptionValueType<bool>(), "Do a bandwidth analysis instead of a normal run"))
         .addOption(new OptionValue(ANALYSIS_LATENCY, "false", Sirikata::OptionValueType<bool>(), "Do a latency analysis instead of a normal run"))
+        .addOption(new OptionValue(ANALYSIS_LATENCY_WINDOW, "10s", Sirikata::OptionValueType<Duration>(), "Amount of trace time the latency analysis reads and joins at once"))
 
         .addOption(new OptionValue(ANALYSIS_OBJECT_LATENCY, "false", Sirikata::OptionValueType<bool>(), "Do a object distance latency analysis instead of a normal run"))
         .addOption(new OptionValue(ANALYSIS_MESSAGE_LATENCY, "false", Sirikata::OptionValueType<bool>(), "Do a message stage latency analysis instead of a normal run"))
@@ -61,6 +62,7 @@ void InitAnalysisOptions() {
 
 
         .addOption(new OptionValue(ANALYSIS_TOTAL_NUM_ALL_SERVERS ,"0",Sirikata::OptionValueType<uint32>(),"Number of all servers/trace files to go through."))
+        .addOption(new OptionValue(ANALYSIS_THREADS, "0", Sirikata::OptionValueType<uint32>(), "Number of worker threads used to read trace files and join their events, 0 for one per core."))
         
 
         
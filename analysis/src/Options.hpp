@@ -40,6 +40,7 @@
 #define ANALYSIS_LOCVIS_SEED         "analysis.locvis.seed"
 #define ANALYSIS_BANDWIDTH   "analysis.bandwidth"
 #define ANALYSIS_LATENCY   "analysis.latency"
+#define ANALYSIS_LATENCY_WINDOW   "analysis.latency.window"
 #define ANALYSIS_OBJECT_LATENCY   "analysis.object.latency"
 #define ANALYSIS_MESSAGE_LATENCY   "analysis.message.latency"
 #define ANALYSIS_WINDOWED_BANDWIDTH          "analysis.windowed-bandwidth"
@@ -51,6 +52,7 @@
 #define ANALYSIS_FLOW_STATS "analysis.flow.stats"
 
 #define ANALYSIS_TOTAL_NUM_ALL_SERVERS "analysis.total.num.all.servers"
+#define ANALYSIS_THREADS "analysis.threads"
 
 #define OSEG_ANALYZE_AFTER         "oseg_analyze_after"
 
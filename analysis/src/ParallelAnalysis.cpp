@@ -0,0 +1,22 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "ParallelAnalysis.hpp"
+#include "Options.hpp"
+#include <sirikata/core/options/CommonOptions.hpp>
+
+namespace Sirikata {
+
+uint32 AnalysisThreads() {
+    uint32 nthreads = GetOptionValue<uint32>(ANALYSIS_THREADS);
+    if (nthreads == 0)
+        nthreads = std::max(Thread::hardware_concurrency(), (unsigned)1);
+    return nthreads;
+}
+
+void ParallelFor(uint32 count, const ParallelTask& task) {
+    ParallelFor(count, task, AnalysisThreads());
+}
+
+} // namespace Sirikata
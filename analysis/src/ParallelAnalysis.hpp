@@ -0,0 +1,225 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_ANALYSIS_PARALLEL_ANALYSIS_HPP_
+#define _SIRIKATA_ANALYSIS_PARALLEL_ANALYSIS_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <queue>
+
+namespace Sirikata {
+
+// Number of worker threads analyses should use, from the analysis.threads
+// option, where 0 means one per core.
+uint32 AnalysisThreads();
+
+typedef std::tr1::function<void(uint32)> ParallelTask;
+
+namespace ParallelForImpl {
+
+struct State {
+    State(uint32 _count, const ParallelTask& _task)
+     : count(_count),
+       next(0),
+       task(_task)
+    {}
+
+    const uint32 count;
+    boost::mutex mutex;
+    uint32 next;
+    ParallelTask task;
+};
+
+inline void worker(State* state) {
+    while(true) {
+        uint32 idx;
+        {
+            boost::lock_guard<boost::mutex> lck(state->mutex);
+            if (state->next >= state->count) return;
+            idx = state->next++;
+        }
+        state->task(idx);
+    }
+}
+
+} // namespace ParallelForImpl
+
+/** Runs task(0) through task(count-1) on up to nthreads worker threads and
+ *  returns once they have all finished. Tasks are handed out in order as
+ *  workers become free, so it's fine for them to vary in length, e.g. one per
+ *  server trace file.
+ */
+inline void ParallelFor(uint32 count, const ParallelTask& task, uint32 nthreads) {
+    nthreads = std::min(nthreads, count);
+    if (nthreads <= 1) {
+        for(uint32 i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    ParallelForImpl::State state(count, task);
+    std::vector<Thread*> workers;
+    for(uint32 i = 0; i < nthreads; i++)
+        workers.push_back(new Thread("Analysis Worker", std::tr1::bind(&ParallelForImpl::worker, &state)));
+    for(uint32 i = 0; i < nthreads; i++) {
+        workers[i]->join();
+        delete workers[i];
+    }
+}
+
+// ParallelFor using AnalysisThreads() workers
+void ParallelFor(uint32 count, const ParallelTask& task);
+
+/** Joins records from several sources, e.g. one per server trace file, on
+ *  their uid member. Each source's records are collected into a run, the runs
+ *  are sorted independently and then the uid space is split into partitions
+ *  which are merged across all the runs in parallel. Every group of records
+ *  sharing a uid is handed to the callback exactly once, along with the
+ *  partition it was found in, so callers can keep per-partition results
+ *  without locking and combine them afterwards.
+ *
+ *  Within a group, records are ordered by the run they came from and then by
+ *  the order they were added to that run.
+ */
+template<typename Record>
+class SortMergeJoin {
+public:
+    typedef std::vector<Record> Run;
+    typedef std::vector<Record> Group;
+    typedef std::tr1::function<void(uint32, const Group&)> GroupCallback;
+
+    SortMergeJoin(uint32 nruns)
+     : mRuns(nruns),
+       mThreads(AnalysisThreads()),
+       mPartitions(mThreads * 4)
+    {}
+    SortMergeJoin(uint32 nruns, uint32 nthreads)
+     : mRuns(nruns),
+       mThreads(std::max(nthreads, (uint32)1)),
+       mPartitions(mThreads * 4)
+    {}
+
+    uint32 numRuns() const { return mRuns.size(); }
+    Run& run(uint32 idx) { return mRuns[idx]; }
+
+    // Remove the records from all the runs, keeping their storage so the join
+    // can be reused, e.g. for the next window of a trace.
+    void clear() {
+        for(uint32 r = 0; r < mRuns.size(); r++)
+            mRuns[r].clear();
+    }
+
+    // Upper bound on the partition index passed to the callback
+    uint32 numPartitions() const { return mPartitions; }
+
+    // Sort all the runs by uid, in parallel.
+    void sort() {
+        using std::tr1::placeholders::_1;
+        ParallelFor(mRuns.size(), std::tr1::bind(&SortMergeJoin::sortRun, this, _1), mThreads);
+    }
+
+    // Drop all records with uids greater than max_uid. The runs must be
+    // sorted.
+    void truncate(uint64 max_uid) {
+        for(uint32 r = 0; r < mRuns.size(); r++)
+            mRuns[r].erase(std::upper_bound(mRuns[r].begin(), mRuns[r].end(), max_uid, UIDLess()), mRuns[r].end());
+    }
+
+    // Merge the sorted runs, calling cb for each group of records with the
+    // same uid. Partitions are processed in parallel, so cb may be called
+    // concurrently for different partitions.
+    void join(const GroupCallback& cb) {
+        computeBounds();
+        using std::tr1::placeholders::_1;
+        ParallelFor(mBounds.size(), std::tr1::bind(&SortMergeJoin::joinPartition, this, _1, cb), mThreads);
+    }
+
+private:
+    struct UIDLess {
+        bool operator()(const Record& lhs, const Record& rhs) const {
+            return lhs.uid < rhs.uid;
+        }
+        bool operator()(const Record& lhs, uint64 rhs) const {
+            return lhs.uid < rhs;
+        }
+        bool operator()(uint64 lhs, const Record& rhs) const {
+            return lhs < rhs.uid;
+        }
+    };
+
+    void sortRun(uint32 idx) {
+        std::stable_sort(mRuns[idx].begin(), mRuns[idx].end(), UIDLess());
+    }
+
+    // Choose the first uid of each partition by sampling the runs, so
+    // partitions hold roughly equal numbers of records.
+    void computeBounds() {
+        const uint32 samples_per_run = 64;
+        std::vector<uint64> samples;
+        for(uint32 r = 0; r < mRuns.size(); r++) {
+            const Run& run = mRuns[r];
+            if (run.empty()) continue;
+            uint32 nsamples = std::min((uint32)run.size(), samples_per_run);
+            for(uint32 i = 0; i < nsamples; i++)
+                samples.push_back(run[(uint64)i * run.size() / nsamples].uid);
+        }
+        std::sort(samples.begin(), samples.end());
+
+        mBounds.clear();
+        mBounds.push_back(0);
+        for(uint32 p = 1; p < mPartitions && !samples.empty(); p++) {
+            uint64 bound = samples[(uint64)p * samples.size() / mPartitions];
+            if (bound > mBounds.back())
+                mBounds.push_back(bound);
+        }
+    }
+
+    void joinPartition(uint32 partition, const GroupCallback& cb) {
+        bool last = (partition + 1 == mBounds.size());
+
+        // Find the slice of each run that falls in this partition
+        typedef typename Run::const_iterator RunIterator;
+        std::vector<RunIterator> cursors(mRuns.size()), ends(mRuns.size());
+        for(uint32 r = 0; r < mRuns.size(); r++) {
+            const Run& run = mRuns[r];
+            cursors[r] = std::lower_bound(run.begin(), run.end(), mBounds[partition], UIDLess());
+            ends[r] = last ? run.end() : std::lower_bound(cursors[r], run.end(), mBounds[partition+1], UIDLess());
+        }
+
+        // Then merge the slices, taking the run with the smallest next uid
+        typedef std::pair<uint64, uint32> HeapEntry;
+        std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > heap;
+        for(uint32 r = 0; r < mRuns.size(); r++)
+            if (cursors[r] != ends[r]) heap.push(HeapEntry(cursors[r]->uid, r));
+
+        Group group;
+        while(!heap.empty()) {
+            uint64 uid = heap.top().first;
+            group.clear();
+            while(!heap.empty() && heap.top().first == uid) {
+                uint32 r = heap.top().second;
+                heap.pop();
+                while(cursors[r] != ends[r] && cursors[r]->uid == uid) {
+                    group.push_back(*cursors[r]);
+                    cursors[r]++;
+                }
+                if (cursors[r] != ends[r]) heap.push(HeapEntry(cursors[r]->uid, r));
+            }
+            cb(partition, group);
+        }
+    }
+
+    std::vector<Run> mRuns;
+    const uint32 mThreads;
+    const uint32 mPartitions;
+    // First uid in each partition
+    std::vector<uint64> mBounds;
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_ANALYSIS_PARALLEL_ANALYSIS_HPP_
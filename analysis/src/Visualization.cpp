@@ -238,13 +238,10 @@ LocationVisualization::LocationVisualization(const char *opt_name, const uint32
     // read in all our data
     for(uint32 server_id = 1; server_id <= nservers; server_id++) {
         String loc_file = GetPerServerFile(opt_name, server_id);
-        std::ifstream is(loc_file.c_str(), std::ios::in);
+        EventStream events(loc_file, server_id);
+        events.filterType(SegmentationChangeTag);
 
-        while(is) {
-            uint16 type_hint;
-            std::string raw_evt;
-            if (!read_record(is, &type_hint, &raw_evt)) break;
-            Event* evt = Event::parse(type_hint, raw_evt, server_id);
+        while(Event* evt = events.next()) {
             SegmentationChangeEvent* sce;
 	    if ((sce=dynamic_cast<SegmentationChangeEvent*>(evt))) {
 	      mSegmentationChangeEvents.push_back(sce);
@@ -128,7 +128,7 @@ int main(int argc, char** argv) {
         assert(false);
     }
     else if ( GetOptionValue<bool>(ANALYSIS_LATENCY) ) {
-        LatencyAnalysis la(STATS_TRACE_FILE,nservers);
+        LatencyAnalysis la(STATS_TRACE_FILE,nservers,GetOptionValue<Duration>(ANALYSIS_LATENCY_WINDOW));
 
         exit(0);
     }
@@ -0,0 +1,178 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "BulletPhysicsBenchmark.hpp"
+#include "../../libspace/plugins/physics/BulletParallelDynamicsWorld.hpp"
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <cmath>
+
+namespace Sirikata {
+
+namespace {
+
+// Bullet's default fixed time step
+const float STEP_SECONDS = 1.f / 60.f;
+
+// The ground plane and bodies, set up the same way as BulletPhysicsService
+// sets up its world.
+class FallingBodiesScene {
+public:
+    FallingBodiesScene(uint32 nbodies, uint32 pile_size, uint32 nthreads)
+     : mConfig(new btDefaultCollisionConfiguration()),
+       mDispatcher(new btCollisionDispatcher(mConfig)),
+       mBroadphase(new btDbvtBroadphase()),
+       mSolver(new btSequentialImpulseConstraintSolver()),
+       mWorld(new BulletParallelDynamicsWorld(mDispatcher, mBroadphase, mSolver, mConfig, nthreads)),
+       mGroundShape(new btStaticPlaneShape(btVector3(0, 1, 0), 0)),
+       mBodyShape(new btBoxShape(btVector3(0.5f, 0.5f, 0.5f)))
+    {
+        mWorld->setGravity(btVector3(0,-9.8,0));
+
+        addBody(mGroundShape, 0.f, btVector3(0, 0, 0));
+
+        // Piles are far enough apart that they never touch, so each one is
+        // its own island. Bodies are offset a bit within a pile so the piles
+        // topple instead of settling immediately.
+        uint32 npiles = (nbodies + pile_size - 1) / pile_size;
+        uint32 side = (uint32)ceil(sqrt((float)npiles));
+        for(uint32 i = 0; i < nbodies; i++) {
+            uint32 pile = i / pile_size, level = i % pile_size;
+            btVector3 pos(
+                6.f * (pile % side) + 0.3f * (level % 2),
+                2.f + 1.5f * level,
+                6.f * (pile / side) + 0.2f * (level % 3)
+            );
+            addBody(mBodyShape, 1.f, pos);
+        }
+    }
+
+    ~FallingBodiesScene() {
+        for(uint32 i = 0; i < mBodies.size(); i++) {
+            mWorld->removeRigidBody(mBodies[i]);
+            delete mBodies[i]->getMotionState();
+            delete mBodies[i];
+        }
+        delete mWorld;
+        delete mBodyShape;
+        delete mGroundShape;
+        delete mSolver;
+        delete mBroadphase;
+        delete mDispatcher;
+        delete mConfig;
+    }
+
+    BulletParallelDynamicsWorld* world() { return mWorld; }
+
+private:
+    void addBody(btCollisionShape* shape, float mass, const btVector3& pos) {
+        btVector3 inertia(0, 0, 0);
+        if (mass > 0)
+            shape->calculateLocalInertia(mass, inertia);
+        btDefaultMotionState* motion_state = new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), pos));
+        btRigidBody::btRigidBodyConstructionInfo info(mass, motion_state, shape, inertia);
+        btRigidBody* body = new btRigidBody(info);
+        mWorld->addRigidBody(body);
+        mBodies.push_back(body);
+    }
+
+    btDefaultCollisionConfiguration* mConfig;
+    btCollisionDispatcher* mDispatcher;
+    btDbvtBroadphase* mBroadphase;
+    btSequentialImpulseConstraintSolver* mSolver;
+    BulletParallelDynamicsWorld* mWorld;
+    btCollisionShape* mGroundShape;
+    btCollisionShape* mBodyShape;
+    std::vector<btRigidBody*> mBodies;
+};
+
+} // namespace
+
+BulletPhysicsBenchmark::BulletPhysicsBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* bodies;
+    OptionValue* pile_size;
+    OptionValue* steps;
+    OptionValue* threads;
+    Sirikata::InitializeClassOptions ico("BulletPhysicsBenchmark",this,
+        bodies=new OptionValue("bodies","4000",Sirikata::OptionValueType<uint32>(),"Number of falling bodies"),
+        pile_size=new OptionValue("pile-size","4",Sirikata::OptionValueType<uint32>(),"Number of bodies dropped on top of each other in each pile"),
+        steps=new OptionValue("steps","300",Sirikata::OptionValueType<uint32>(),"Number of simulation steps to time"),
+        threads=new OptionValue("threads","0",Sirikata::OptionValueType<uint32>(),"Maximum number of threads to step with, or 0 for the number of cores"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("BulletPhysicsBenchmark",this);
+    optionsSet->parse(param);
+
+    mBodies = std::max(bodies->as<uint32>(), (uint32)1);
+    mPileSize = std::max(pile_size->as<uint32>(), (uint32)1);
+    mSteps = std::max(steps->as<uint32>(), (uint32)1);
+    mMaxThreads = threads->as<uint32>();
+    if (mMaxThreads == 0)
+        mMaxThreads = std::max(Thread::hardware_concurrency(), (unsigned)1);
+}
+
+String BulletPhysicsBenchmark::name() {
+    return "bullet-physics";
+}
+
+Duration BulletPhysicsBenchmark::run(uint32 nthreads, Duration baseline) {
+    FallingBodiesScene scene(mBodies, mPileSize, nthreads);
+    BulletParallelDynamicsWorld* world = scene.world();
+
+    Duration total = Duration::zero(), max_step = Duration::zero();
+    uint32 asleep = 0;
+    std::vector<btCollisionObject*> deactivated;
+    uint32 step = 0;
+    for(; step < mSteps && !mForceStop; step++) {
+        Time start = Timer::now();
+        world->stepSimulation(STEP_SECONDS, 1, STEP_SECONDS);
+        Duration elapsed = Timer::now() - start;
+        total += elapsed;
+        max_step = std::max(max_step, elapsed);
+
+        world->getDeactivated(&deactivated);
+        asleep += deactivated.size();
+    }
+    if (step == 0) return Duration::zero();
+
+    Duration mean = total / step;
+    // The baseline run compares against itself
+    if (baseline == Duration::zero())
+        baseline = mean;
+    SILOG(benchmark,info,
+          nthreads << " threads: "
+          << (mean.toSeconds() * 1000) << " ms/step mean, "
+          << (max_step.toSeconds() * 1000) << " ms max, "
+          << (mean > Duration::zero() ? baseline / mean : 0) << "x speedup, "
+          << asleep << " bodies put to sleep");
+    return mean;
+}
+
+void BulletPhysicsBenchmark::start() {
+    mForceStop = false;
+
+    SILOG(benchmark,info,
+          mBodies << " bodies in piles of " << mPileSize << ", "
+          << mSteps << " steps of " << (STEP_SECONDS * 1000) << " ms");
+
+    Duration baseline = run(1, Duration::zero());
+    // Double the threads each run, always finishing with the maximum
+    uint32 nthreads = 1;
+    while(nthreads < mMaxThreads && !mForceStop) {
+        nthreads = std::min(nthreads * 2, mMaxThreads);
+        run(nthreads, baseline);
+    }
+
+    notifyFinished();
+}
+
+void BulletPhysicsBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,49 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_BULLET_PHYSICS_BENCHMARK_HPP_
+#define _SIRIKATA_BULLET_PHYSICS_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** Drops a grid of small piles of rigid bodies onto a ground plane and steps
+ *  the simulation with the physics plugin's island-parallel dynamics world,
+ *  reporting the time per step for an increasing number of threads. Each pile
+ *  is its own simulation island, so the piles can be solved in parallel.
+ *
+ *  Also reports how many bodies were put to sleep by the end of the run, which
+ *  should be the same for every thread count.
+ */
+class BulletPhysicsBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new BulletPhysicsBenchmark(finished_cb, param);
+    }
+
+    BulletPhysicsBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Returns the mean time per step
+    Duration run(uint32 nthreads, Duration baseline);
+
+    bool mForceStop;
+
+    uint32 mBodies;
+    uint32 mPileSize;
+    uint32 mSteps;
+    uint32 mMaxThreads;
+}; // class BulletPhysicsBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_BULLET_PHYSICS_BENCHMARK_HPP_
@@ -0,0 +1,238 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "ForwarderShardBenchmark.hpp"
+#include <sirikata/core/queue/ShardedWorkQueue.hpp>
+#include <sirikata/core/queue/ThreadSafeQueue.hpp>
+#include <sirikata/core/network/ObjectMessage.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+typedef Sirikata::Protocol::Object::ObjectMessage RoutedMessage;
+typedef ShardedWorkQueue<RoutedMessage*> RoutingShards;
+typedef std::tr1::function<void(RoutedMessage*)> DispatchFunc;
+
+struct RouteInfo {
+    ServerID server;
+    uint32 index;
+};
+
+struct ForwardingState {
+    ForwardingState(uint32 nobjects, uint32 nservers)
+     : next_seq(nobjects, 0),
+       out_of_order(0),
+       routed(0),
+       finished(false)
+    {
+        for(uint32 i = 0; i < nobjects; i++) {
+            objects.push_back(UUID::random());
+            RouteInfo info;
+            info.server = i % nservers;
+            info.index = i;
+            routes[objects.back()] = info;
+        }
+        for(uint32 i = 0; i < nservers; i++)
+            server_queues.push_back(new ThreadSafeQueue<String*>());
+    }
+
+    ~ForwardingState() {
+        for(uint32 i = 0; i < server_queues.size(); i++)
+            delete server_queues[i];
+    }
+
+    void reset() {
+        next_seq.assign(next_seq.size(), 0);
+        out_of_order = 0;
+        routed = 0;
+        finished = false;
+    }
+
+    std::vector<UUID> objects;
+    // Stands in for the OSeg cache. It's never modified while routing, so
+    // it doesn't need a lock.
+    typedef std::tr1::unordered_map<UUID, RouteInfo, UUID::Hasher> RouteMap;
+    RouteMap routes;
+    // Stand in for the per-server queues in the ForwarderServiceQueue
+    std::vector<ThreadSafeQueue<String*>*> server_queues;
+
+    // Next sequence number expected for each object, only touched while
+    // routing a message to that object
+    std::vector<uint64> next_seq;
+    AtomicValue<uint32> out_of_order;
+    AtomicValue<uint32> routed;
+    // Set when no more messages will be queued for servers
+    volatile bool finished;
+};
+
+void routeMessage(ForwardingState* state, RoutedMessage* msg) {
+    const RouteInfo& info = state->routes.find(msg->dest_object())->second;
+
+    if (msg->unique() != state->next_seq[info.index])
+        ++state->out_of_order;
+    state->next_seq[info.index] = msg->unique() + 1;
+
+    String* serialized = new String();
+    serializePBJMessage(serialized, *msg);
+    state->server_queues[info.server]->push(serialized);
+    ++state->routed;
+    delete msg;
+}
+
+void routeShardedMessage(ForwardingState* state, RoutedMessage*& msg, uint32 worker) {
+    routeMessage(state, msg);
+}
+
+void pushSharded(RoutingShards* shards, RoutedMessage* msg) {
+    shards->push(UUID::Hasher()(msg->dest_object()), msg);
+}
+
+// Generates messages for every nreceivers'th object, starting with
+// receiver_idx, so each object gets all its messages from one receiver and
+// they have a well defined order.
+void receiverMain(ForwardingState* state, uint32 receiver_idx, uint32 nreceivers, uint32 nmessages, const String& payload, DispatchFunc dispatch) {
+    uint32 nobjects = (state->objects.size() - receiver_idx + nreceivers - 1) / nreceivers;
+    if (nobjects == 0) return;
+    std::vector<uint64> seqnos(nobjects, 0);
+    UUID source = UUID::random();
+    for(uint32 i = 0; i < nmessages; i++) {
+        uint32 local_idx = i % nobjects;
+        RoutedMessage* msg = createObjectMessage(
+            0, source, 14000,
+            state->objects[receiver_idx + local_idx * nreceivers], 14001,
+            payload
+        );
+        msg->set_unique(seqnos[local_idx]++);
+        dispatch(msg);
+    }
+}
+
+// Sends queued messages, i.e. just throws them away
+void drainerMain(ForwardingState* state) {
+    while(true) {
+        bool finished = state->finished;
+        bool any = false;
+        for(uint32 i = 0; i < state->server_queues.size(); i++) {
+            String* serialized = NULL;
+            while(state->server_queues[i]->pop(serialized)) {
+                delete serialized;
+                any = true;
+            }
+        }
+        if (!any) {
+            if (finished) return;
+            Thread::yield();
+        }
+    }
+}
+
+}
+
+ForwarderShardBenchmark::ForwarderShardBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* receivers;
+    OptionValue* messages;
+    OptionValue* objects;
+    OptionValue* servers;
+    OptionValue* payload;
+    OptionValue* max_threads;
+    Sirikata::InitializeClassOptions ico("ForwarderShardBenchmark",this,
+        receivers=new OptionValue("receivers","2",Sirikata::OptionValueType<uint32>(),"Number of threads receiving messages"),
+        messages=new OptionValue("messages","200000",Sirikata::OptionValueType<uint32>(),"Number of messages received by each receiving thread"),
+        objects=new OptionValue("objects","10000",Sirikata::OptionValueType<uint32>(),"Number of destination objects"),
+        servers=new OptionValue("servers","8",Sirikata::OptionValueType<uint32>(),"Number of servers the destination objects are spread across"),
+        payload=new OptionValue("payload","100",Sirikata::OptionValueType<uint32>(),"Payload size of each message, in bytes"),
+        max_threads=new OptionValue("max-threads","0",Sirikata::OptionValueType<uint32>(),"Largest number of routing workers to try, or 0 for the number of cores"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("ForwarderShardBenchmark",this);
+    optionsSet->parse(param);
+
+    mReceivers = std::max(receivers->as<uint32>(), (uint32)1);
+    mMessages = messages->as<uint32>();
+    mObjects = std::max(objects->as<uint32>(), mReceivers);
+    mServers = std::max(servers->as<uint32>(), (uint32)1);
+    mPayloadSize = payload->as<uint32>();
+    mMaxThreads = max_threads->as<uint32>();
+    if (mMaxThreads == 0)
+        mMaxThreads = std::max(Thread::hardware_concurrency(), (unsigned)1);
+}
+
+String ForwarderShardBenchmark::name() {
+    return "forwarder-shards";
+}
+
+void ForwarderShardBenchmark::start() {
+    mForceStop = false;
+
+    ForwardingState state(mObjects, mServers);
+    String payload(mPayloadSize, 'x');
+    uint64 total_messages = (uint64)mReceivers * mMessages;
+
+    SILOG(benchmark,info,
+          mReceivers << " receivers each routing " << mMessages << " messages to "
+          << mObjects << " objects on " << mServers << " servers");
+
+    // 0 workers means routing on the receiving threads
+    std::vector<uint32> configs;
+    configs.push_back(0);
+    for(uint32 nthreads = 1; nthreads < mMaxThreads; nthreads *= 2)
+        configs.push_back(nthreads);
+    configs.push_back(mMaxThreads);
+
+    for(uint32 ci = 0; ci < configs.size() && !mForceStop; ci++) {
+        uint32 nthreads = configs[ci];
+        state.reset();
+
+        RoutingShards* shards = NULL;
+        DispatchFunc dispatch = std::tr1::bind(&routeMessage, &state, std::tr1::placeholders::_1);
+        if (nthreads > 0) {
+            shards = new RoutingShards(
+                "ForwarderShardBenchmark Worker",
+                nthreads, nthreads * RoutingShards::DefaultShardsPerWorker,
+                std::tr1::bind(&routeShardedMessage, &state, std::tr1::placeholders::_1, std::tr1::placeholders::_2)
+            );
+            dispatch = std::tr1::bind(&pushSharded, shards, std::tr1::placeholders::_1);
+        }
+
+        Time start = Timer::now();
+        Thread drainer("ForwarderShardBenchmark Drainer", std::tr1::bind(&drainerMain, &state));
+        if (shards != NULL)
+            shards->start();
+        std::vector<Thread*> receivers;
+        for(uint32 i = 0; i < mReceivers; i++)
+            receivers.push_back(new Thread("ForwarderShardBenchmark Receiver", std::tr1::bind(&receiverMain, &state, i, mReceivers, mMessages, payload, dispatch)));
+        for(uint32 i = 0; i < mReceivers; i++) {
+            receivers[i]->join();
+            delete receivers[i];
+        }
+        // Finishes routing everything that was received
+        delete shards;
+        state.finished = true;
+        drainer.join();
+        Duration dur = Timer::now() - start;
+
+        String label = (nthreads == 0) ? String("receiving threads") : (boost::lexical_cast<String>(nthreads) + " workers");
+        SILOG(benchmark,info,
+              label << ": " << dur << ", "
+              << (total_messages / dur.toSeconds()) << " msgs/sec"
+              << (state.routed.read() != total_messages ? ", MESSAGES LOST" : "")
+              << (state.out_of_order.read() > 0 ? ", OUT OF ORDER" : ""));
+    }
+
+    notifyFinished();
+}
+
+void ForwarderShardBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
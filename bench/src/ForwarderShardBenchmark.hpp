@@ -0,0 +1,53 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_FORWARDER_SHARD_BENCHMARK_HPP_
+#define _SIRIKATA_FORWARDER_SHARD_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** Measures how forwarding throughput scales with the number of cores used to
+ *  route messages. Receiving threads generate object messages, as the
+ *  space server's networking threads do, and each message goes through the
+ *  same steps as a message which hits in the OSeg cache: look up its
+ *  destination server, serialize it and push it onto that server's outgoing
+ *  queue, which a separate thread drains.
+ *
+ *  This is run first with routing done on the receiving threads, and then on
+ *  a ShardedWorkQueue with increasing numbers of workers, as the Forwarder
+ *  does with forwarder.route-threads set. Messages are checked to still be in
+ *  order for each destination object, and messages/sec is reported for each
+ *  configuration.
+ */
+class ForwarderShardBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new ForwarderShardBenchmark(finished_cb, param);
+    }
+
+    ForwarderShardBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    bool mForceStop;
+
+    uint32 mReceivers;
+    uint32 mMessages;
+    uint32 mObjects;
+    uint32 mServers;
+    uint32 mPayloadSize;
+    uint32 mMaxThreads;
+}; // class ForwarderShardBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_FORWARDER_SHARD_BENCHMARK_HPP_
@@ -0,0 +1,280 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "HttpPipeliningBenchmark.hpp"
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOServicePool.hpp>
+#include <sirikata/core/network/Asio.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+// A minimal HTTP/1.1 server that answers every request with the same
+// response. Requests are all GETs without bodies, so a blank line marks the
+// end of each one. Everything runs on a single thread.
+class LoopbackHttpServer {
+  public:
+    LoopbackHttpServer(uint32 body_size, const Duration& latency)
+     : mPool("LoopbackHttpServer", 1),
+       mListener(mPool.service(), boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+       mLatency(latency)
+    {
+        std::ostringstream response;
+        response << "HTTP/1.1 200 OK\r\n"
+                 << "Content-Type: application/octet-stream\r\n"
+                 << "Content-Length: " << body_size << "\r\n"
+                 << "\r\n"
+                 << String(body_size, 'x');
+        mResponse = response.str();
+
+        accept();
+        mPool.startWork();
+        mPool.run();
+    }
+
+    ~LoopbackHttpServer() {
+        mPool.service()->stop();
+        mPool.join();
+    }
+
+    uint16 port() {
+        return mListener.local_endpoint().port();
+    }
+
+  private:
+    struct Connection {
+        Connection(Network::IOService* ios)
+         : socket(ios), writing(false)
+        {}
+
+        Network::TCPSocket socket;
+        char buffer[4096];
+        // Data for requests that haven't been completely received yet
+        String partial;
+        // Responses waiting for the current write to finish
+        String outgoing;
+        String sending;
+        bool writing;
+    };
+    typedef std::tr1::shared_ptr<Connection> ConnectionPtr;
+
+    void accept() {
+        ConnectionPtr conn(new Connection(mPool.service()));
+        mListener.async_accept(
+            conn->socket,
+            std::tr1::bind(&LoopbackHttpServer::handleAccept, this, conn, std::tr1::placeholders::_1)
+        );
+    }
+
+    void handleAccept(ConnectionPtr conn, const boost::system::error_code& err) {
+        if (err) return;
+        read(conn);
+        accept();
+    }
+
+    void read(ConnectionPtr conn) {
+        conn->socket.async_read_some(
+            boost::asio::buffer(conn->buffer),
+            boost::bind(&LoopbackHttpServer::handleRead, this, conn,
+                boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)
+        );
+    }
+
+    void handleRead(ConnectionPtr conn, const boost::system::error_code& err, std::size_t bytes_transferred) {
+        if (err) {
+            boost::system::error_code ec;
+            conn->socket.close(ec);
+            return;
+        }
+
+        conn->partial.append(conn->buffer, bytes_transferred);
+        uint32 complete = 0;
+        String::size_type end;
+        while((end = conn->partial.find("\r\n\r\n")) != String::npos) {
+            conn->partial.erase(0, end + 4);
+            complete++;
+        }
+
+        // Everything that arrived together is answered together after the
+        // simulated round trip
+        if (complete > 0) {
+            mPool.service()->post(
+                mLatency,
+                std::tr1::bind(&LoopbackHttpServer::respond, this, conn, complete),
+                "LoopbackHttpServer::respond"
+            );
+        }
+        read(conn);
+    }
+
+    void respond(ConnectionPtr conn, uint32 count) {
+        for(uint32 i = 0; i < count; i++)
+            conn->outgoing.append(mResponse);
+        write(conn);
+    }
+
+    void write(ConnectionPtr conn) {
+        if (conn->writing || conn->outgoing.empty()) return;
+
+        conn->writing = true;
+        conn->sending.swap(conn->outgoing);
+        conn->outgoing.clear();
+        boost::asio::async_write(
+            conn->socket, boost::asio::buffer(conn->sending),
+            boost::bind(&LoopbackHttpServer::handleWrite, this, conn, boost::asio::placeholders::error)
+        );
+    }
+
+    void handleWrite(ConnectionPtr conn, const boost::system::error_code& err) {
+        conn->writing = false;
+        conn->sending.clear();
+        // Errors are handled by the read side
+        if (err) return;
+        write(conn);
+    }
+
+    Network::IOServicePool mPool;
+    Network::TCPListener mListener;
+    Duration mLatency;
+    String mResponse;
+}; // class LoopbackHttpServer
+
+} // namespace
+
+
+HttpPipeliningBenchmark::HttpPipeliningBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mIssued(0),
+          mOutstanding(0),
+          mFailed(0),
+          mTotalLatency(Duration::zero())
+{
+    OptionValue* requests;
+    OptionValue* outstanding;
+    OptionValue* hosts;
+    OptionValue* body_size;
+    OptionValue* latency;
+    Sirikata::InitializeClassOptions ico("HttpPipeliningBenchmark",this,
+        requests=new OptionValue("requests","4000",Sirikata::OptionValueType<uint32>(),"Number of requests to make in each run"),
+        outstanding=new OptionValue("outstanding","500",Sirikata::OptionValueType<uint32>(),"Maximum number of requests outstanding at once"),
+        hosts=new OptionValue("hosts","2",Sirikata::OptionValueType<uint32>(),"Number of servers requests are spread over"),
+        body_size=new OptionValue("body-size","2048",Sirikata::OptionValueType<uint32>(),"Size of each response body"),
+        latency=new OptionValue("latency","5ms",Sirikata::OptionValueType<Duration>(),"Simulated round trip time to the servers"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("HttpPipeliningBenchmark",this);
+    optionsSet->parse(param);
+
+    mRequests = requests->as<uint32>();
+    mOutstandingLimit = std::max(outstanding->as<uint32>(), (uint32)1);
+    mHosts = std::max(hosts->as<uint32>(), (uint32)1);
+    mBodySize = body_size->as<uint32>();
+    mLatency = latency->as<Duration>();
+}
+
+String HttpPipeliningBenchmark::name() {
+    return "http-pipelining";
+}
+
+void HttpPipeliningBenchmark::issueRequest() {
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+    using std::tr1::placeholders::_3;
+
+    uint32 idx = mIssued++;
+    mOutstanding++;
+
+    const Network::Address& addr = mAddresses[idx % mAddresses.size()];
+    Transfer::HttpManager::Headers headers;
+    headers["Host"] = addr.getHostName();
+    Transfer::HttpManager::getSingleton().get(
+        addr, "/resource/" + boost::lexical_cast<String>(idx),
+        std::tr1::bind(&HttpPipeliningBenchmark::requestFinished, this, Timer::now(), _1, _2, _3),
+        headers
+    );
+}
+
+void HttpPipeliningBenchmark::requestFinished(Time started,
+    std::tr1::shared_ptr<Transfer::HttpManager::HttpResponse> response,
+    Transfer::HttpManager::ERR_TYPE error, const boost::system::error_code& boost_error)
+{
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    if (error != Transfer::HttpManager::SUCCESS || !response || response->getStatusCode() != 200)
+        mFailed++;
+    mTotalLatency += Timer::now() - started;
+    mOutstanding--;
+
+    if (mIssued < mRequests && !mForceStop)
+        issueRequest();
+    if (mOutstanding == 0)
+        mCond.notify_one();
+}
+
+void HttpPipeliningBenchmark::run(uint32 conns_per_host, uint32 pipeline_depth) {
+    Transfer::HttpManager& http = Transfer::HttpManager::getSingleton();
+    http.setMaxConnectionsPerHost(conns_per_host);
+    http.setMaxPipelineDepth(pipeline_depth);
+
+    // New servers for each run so no connections carry over from the last one
+    std::vector<LoopbackHttpServer*> servers;
+    mAddresses.clear();
+    for(uint32 i = 0; i < mHosts; i++) {
+        servers.push_back(new LoopbackHttpServer(mBodySize, mLatency));
+        mAddresses.push_back(Network::Address("127.0.0.1", boost::lexical_cast<String>(servers.back()->port())));
+    }
+
+    Time start = Timer::now();
+    uint32 completed = 0;
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mIssued = 0;
+        mFailed = 0;
+        mTotalLatency = Duration::zero();
+        while(mIssued < mRequests && mOutstanding < mOutstandingLimit)
+            issueRequest();
+        while(mOutstanding > 0)
+            mCond.wait(lock);
+        completed = mIssued;
+    }
+    Duration dur = Timer::now() - start;
+
+    if (completed > 0) {
+        SILOG(benchmark,info,
+              conns_per_host << " connections per host, pipeline depth " << pipeline_depth << ": "
+              << (completed / dur.toSeconds()) << " requests/sec, "
+              << (mTotalLatency.toMicroseconds() / 1000.0 / completed) << " ms mean latency, "
+              << mFailed << " failed");
+    }
+
+    for(uint32 i = 0; i < servers.size(); i++)
+        delete servers[i];
+}
+
+void HttpPipeliningBenchmark::start() {
+    mForceStop = false;
+
+    SILOG(benchmark,info,
+          mRequests << " requests for " << mBodySize << " byte resources from "
+          << mHosts << " hosts, " << (mLatency.toMicroseconds() / 1000.0) << " ms round trip, at most "
+          << mOutstandingLimit << " outstanding");
+
+    // The old behavior: 8 connections per host, one request on each at a time
+    if (!mForceStop) run(8, 1);
+    if (!mForceStop) run(8, 4);
+    if (!mForceStop) run(2, 1);
+    if (!mForceStop) run(2, 8);
+
+    notifyFinished();
+}
+
+void HttpPipeliningBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
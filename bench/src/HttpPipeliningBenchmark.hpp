@@ -0,0 +1,68 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_HTTP_PIPELINING_BENCHMARK_HPP_
+#define _SIRIKATA_HTTP_PIPELINING_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/transfer/HttpManager.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+
+/** Fetches many small resources through HttpManager from HTTP servers running
+ *  on the loopback interface and reports requests/sec, like loading a scene
+ *  with lots of small meshes and textures from the CDN.
+ *
+ *  Loopback has almost no latency, so the servers delay their responses to
+ *  simulate a round trip. Requests that arrive together are answered
+ *  together, so pipelined requests share a round trip like they would over a
+ *  real network. This runs with a few connection and pipelining limits.
+ */
+class HttpPipeliningBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new HttpPipeliningBenchmark(finished_cb, param);
+    }
+
+    HttpPipeliningBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    void run(uint32 conns_per_host, uint32 pipeline_depth);
+    // Issue the next request, spreading them over the hosts. Called with
+    // mMutex held.
+    void issueRequest();
+    void requestFinished(Time started,
+        std::tr1::shared_ptr<Transfer::HttpManager::HttpResponse> response,
+        Transfer::HttpManager::ERR_TYPE error, const boost::system::error_code& boost_error);
+
+    bool mForceStop;
+
+    uint32 mRequests;
+    uint32 mOutstandingLimit;
+    uint32 mHosts;
+    uint32 mBodySize;
+    Duration mLatency;
+
+    // Tracks progress of the current run
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    std::vector<Network::Address> mAddresses;
+    uint32 mIssued;
+    uint32 mOutstanding;
+    uint32 mFailed;
+    Duration mTotalLatency;
+}; // class HttpPipeliningBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_HTTP_PIPELINING_BENCHMARK_HPP_
@@ -0,0 +1,230 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "LocUpdateQueueBenchmark.hpp"
+#include <sirikata/core/util/SlotHashTable.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/UUID.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+struct ObjectState {
+    UUID id;
+    Vector3f position;
+    float32 radius;
+    String mesh;
+    String physics;
+    String queryData;
+};
+
+// Queued update as originally stored, with full copies of the object's state
+struct MapUpdate {
+    MapUpdate() : dirty(0) {}
+    Vector3f position;
+    float32 radius;
+    String mesh;
+    String physics;
+    String queryData;
+    uint32 dirty;
+};
+typedef std::map<UUID, MapUpdate> MapQueue;
+
+// Compact queued update, looking up the rest of the state at send time
+struct SlotUpdate {
+    SlotUpdate() : dirty(0) {}
+    Vector3f position;
+    float32 radius;
+    uint32 queued;
+    uint32 dirty;
+};
+typedef SlotHashTable<UUID, SlotUpdate, UUID::Hasher> SlotQueue;
+
+float32 randFloat() {
+    return rand() / (float32)RAND_MAX;
+}
+
+Vector3f randPosition() {
+    return Vector3f(randFloat() * 1000.f, randFloat() * 1000.f, randFloat() * 100.f);
+}
+
+}
+
+LocUpdateQueueBenchmark::LocUpdateQueueBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* objects;
+    OptionValue* subscribers;
+    OptionValue* rounds;
+    OptionValue* updateFraction;
+    OptionValue* capacity;
+    Sirikata::InitializeClassOptions ico("LocUpdateQueueBenchmark",this,
+        objects=new OptionValue("objects","10000",Sirikata::OptionValueType<uint32>(),"Number of objects, each watched by every subscriber"),
+        subscribers=new OptionValue("subscribers","100",Sirikata::OptionValueType<uint32>(),"Number of subscribers"),
+        rounds=new OptionValue("rounds","20",Sirikata::OptionValueType<uint32>(),"Number of rounds of updates"),
+        updateFraction=new OptionValue("update-fraction","0.1",Sirikata::OptionValueType<float32>(),"Fraction of objects updated each round"),
+        capacity=new OptionValue("capacity","150",Sirikata::OptionValueType<uint32>(),"Updates each subscriber can ship per round, e.g. 25 messages of 6 updates"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("LocUpdateQueueBenchmark",this);
+    optionsSet->parse(param);
+
+    mObjects = objects->as<uint32>();
+    mSubscribers = subscribers->as<uint32>();
+    mRounds = rounds->as<uint32>();
+    mUpdateFraction = updateFraction->as<float32>();
+    mCapacity = capacity->as<uint32>();
+}
+
+String LocUpdateQueueBenchmark::name() {
+    return "loc-update-queue";
+}
+
+void LocUpdateQueueBenchmark::start() {
+    mForceStop = false;
+
+    srand(1234);
+    std::vector<ObjectState> objects(mObjects);
+    for(uint32 i = 0; i < mObjects; i++) {
+        objects[i].id = UUID::random();
+        objects[i].position = randPosition();
+        objects[i].radius = 0.5f + randFloat() * 10.f;
+        objects[i].mesh = "meerkat:///sirikata/models/object_" + boost::lexical_cast<String>(i) + ".dae/optimized/0/object.dae";
+        objects[i].physics = "{ \"treatment\" : \"static\" }";
+    }
+    std::vector<Vector3f> observers(mSubscribers);
+    for(uint32 i = 0; i < mSubscribers; i++)
+        observers[i] = randPosition();
+
+    // Both queues see the same sequence of updates
+    uint32 per_round = std::max((uint32)(mObjects * mUpdateFraction), (uint32)1);
+    std::vector<uint32> updated(mRounds * per_round);
+    for(uint32 i = 0; i < updated.size(); i++)
+        updated[i] = rand() % mObjects;
+    uint64 total_updates = (uint64)updated.size() * mSubscribers;
+
+    // Original std::map queues, drained in UUID order
+    uint64 map_shipped = 0;
+    Duration map_queue_dur = Duration::zero(), map_drain_dur = Duration::zero();
+    {
+        std::vector<MapQueue> queues(mSubscribers);
+        for(uint32 round = 0; round < mRounds && !mForceStop; round++) {
+            Time queue_start = Timer::now();
+            for(uint32 u = round * per_round; u < (round+1) * per_round; u++) {
+                const ObjectState& obj = objects[updated[u]];
+                for(uint32 s = 0; s < mSubscribers; s++) {
+                    MapQueue::iterator it = queues[s].find(obj.id);
+                    if (it == queues[s].end()) {
+                        MapUpdate ui;
+                        ui.position = obj.position;
+                        ui.radius = obj.radius;
+                        ui.mesh = obj.mesh;
+                        ui.physics = obj.physics;
+                        ui.queryData = obj.queryData;
+                        queues[s][obj.id] = ui;
+                    }
+                    MapUpdate& ui = queues[s][obj.id];
+                    ui.position = obj.position;
+                    ui.dirty |= 1;
+                }
+            }
+            Time drain_start = Timer::now();
+            for(uint32 s = 0; s < mSubscribers; s++) {
+                MapQueue::iterator it = queues[s].begin();
+                for(uint32 n = 0; n < mCapacity && it != queues[s].end(); n++, it++)
+                    map_shipped++;
+                queues[s].erase(queues[s].begin(), it);
+            }
+            Time drain_end = Timer::now();
+            map_queue_dur += drain_start - queue_start;
+            map_drain_dur += drain_end - drain_start;
+        }
+    }
+
+    if (mForceStop)
+        return;
+
+    // Slot table queues, drained most important first
+    uint64 slot_shipped = 0;
+    Duration slot_queue_dur = Duration::zero(), slot_drain_dur = Duration::zero();
+    {
+        std::vector<SlotQueue> queues(mSubscribers);
+        std::vector<SlotQueue::SlotID> order;
+        typedef std::pair<float32, SlotQueue::SlotID> ScoredSlot;
+        std::vector<ScoredSlot> scored;
+        for(uint32 round = 0; round < mRounds && !mForceStop; round++) {
+            Time queue_start = Timer::now();
+            for(uint32 u = round * per_round; u < (round+1) * per_round; u++) {
+                const ObjectState& obj = objects[updated[u]];
+                for(uint32 s = 0; s < mSubscribers; s++) {
+                    bool inserted = false;
+                    SlotQueue::SlotID slot = queues[s].insert(obj.id, &inserted);
+                    SlotUpdate& ui = queues[s].value(slot);
+                    if (inserted) {
+                        ui.radius = obj.radius;
+                        ui.queued = round;
+                    }
+                    ui.position = obj.position;
+                    ui.dirty |= 1;
+                }
+            }
+            Time drain_start = Timer::now();
+            for(uint32 s = 0; s < mSubscribers; s++) {
+                SlotQueue& queue = queues[s];
+                order.clear();
+                for(SlotQueue::SlotID slot = 0; slot < queue.slotCount(); slot++)
+                    if (queue.valid(slot)) order.push_back(slot);
+                if (order.size() > mCapacity) {
+                    scored.clear();
+                    for(uint32 i = 0; i < order.size(); i++) {
+                        const SlotUpdate& ui = queue.value(order[i]);
+                        float32 dist2 = std::max((ui.position - observers[s]).lengthSquared(), 1.f);
+                        float32 score = (1.f + round - ui.queued) * std::max(ui.radius * ui.radius / dist2, 1e-6f);
+                        scored.push_back(ScoredSlot(-score, order[i]));
+                    }
+                    std::partial_sort(scored.begin(), scored.begin() + mCapacity, scored.end());
+                    for(uint32 i = 0; i < mCapacity; i++)
+                        order[i] = scored[i].second;
+                    order.resize(mCapacity);
+                }
+                for(uint32 i = 0; i < order.size(); i++) {
+                    queue.eraseSlot(order[i]);
+                    slot_shipped++;
+                }
+            }
+            Time drain_end = Timer::now();
+            slot_queue_dur += drain_start - queue_start;
+            slot_drain_dur += drain_end - drain_start;
+        }
+    }
+
+    if (mForceStop)
+        return;
+
+    SILOG(benchmark,info,
+          mObjects << " objects x " << mSubscribers << " subscribers, "
+          << mRounds << " rounds of " << per_round << " updates, "
+          << mCapacity << " updates shipped per subscriber per round");
+    SILOG(benchmark,info,
+          "std::map queue: " << map_queue_dur << " queueing, "
+          << (map_queue_dur.toMicroseconds()*1000/float(total_updates)) << "ns/update, "
+          << map_drain_dur << " draining " << map_shipped << " updates in UUID order");
+    SILOG(benchmark,info,
+          "slot table queue: " << slot_queue_dur << " queueing, "
+          << (slot_queue_dur.toMicroseconds()*1000/float(total_updates)) << "ns/update, "
+          << slot_drain_dur << " draining " << slot_shipped << " updates by priority");
+
+    notifyFinished();
+}
+
+void LocUpdateQueueBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,51 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_LOC_UPDATE_QUEUE_BENCHMARK_HPP_
+#define _SIRIKATA_LOC_UPDATE_QUEUE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** Measures the per-subscriber queues of outstanding loc updates kept by the
+ *  space's location update policy. Many objects are each watched by many
+ *  subscribers; every round a fraction of the objects move, queueing an
+ *  update with every subscriber, and then each subscriber drains as many
+ *  updates as it can send before hitting its outstanding message limit.
+ *
+ *  This compares the original queue, a std::map keyed by UUID holding full
+ *  copies of the object's state and drained in UUID order, with a
+ *  SlotHashTable holding compact entries drained in order of importance.
+ */
+class LocUpdateQueueBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new LocUpdateQueueBenchmark(finished_cb, param);
+    }
+
+    LocUpdateQueueBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    bool mForceStop;
+
+    uint32 mObjects;
+    uint32 mSubscribers;
+    uint32 mRounds;
+    // Fraction of objects updated each round
+    float32 mUpdateFraction;
+    // Updates each subscriber can ship per round
+    uint32 mCapacity;
+}; // class LocUpdateQueueBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LOC_UPDATE_QUEUE_BENCHMARK_HPP_
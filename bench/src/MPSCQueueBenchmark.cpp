@@ -0,0 +1,205 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "MPSCQueueBenchmark.hpp"
+#include <sirikata/core/queue/MPSCRing.hpp>
+#include <sirikata/core/queue/SizedThreadSafeQueue.hpp>
+#include <sirikata/core/queue/LockFreeQueue.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+// Items are the producer index in the top 32 bits and a sequence number in
+// the bottom 32 bits, so the consumer can check each producer's items come
+// out in order.
+typedef uint64 Item;
+
+class RingQueue {
+public:
+    RingQueue(uint32 capacity) : mRing(capacity) {}
+    static const char* name() { return "MPSCRing"; }
+    bool push(Item item) { return mRing.push(item); }
+    uint32 popBatch(Item* out, uint32 max_items) { return mRing.popBatch(out, max_items); }
+private:
+    MPSCRing<Item> mRing;
+};
+
+// The pattern the Forwarder used: a SizedThreadSafeQueue, which has its own
+// lock, behind another lock so the consumer can tell whether the queue was
+// empty when pushing
+class LockedSizedQueue {
+public:
+    LockedSizedQueue(uint32 capacity) : mQueue(SizedResourceMonitor(capacity)) {}
+    static const char* name() { return "SizedThreadSafeQueue"; }
+    bool push(Item item) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        return mQueue.push(SizedItem(item), false);
+    }
+    uint32 popBatch(Item* out, uint32 max_items) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        uint32 count = 0;
+        SizedItem popped(0);
+        while(count < max_items && mQueue.pop(popped))
+            out[count++] = popped.item;
+        return count;
+    }
+private:
+    struct SizedItem {
+        SizedItem(Item _item) : item(_item) {}
+        uint32 size() const { return 1; }
+        Item item;
+    };
+    boost::mutex mMutex;
+    SizedThreadSafeQueue<SizedItem> mQueue;
+};
+
+// Unbounded, so push never fails
+class PlainThreadSafeQueue {
+public:
+    PlainThreadSafeQueue(uint32 capacity) {}
+    static const char* name() { return "ThreadSafeQueue"; }
+    bool push(Item item) { mQueue.push(item); return true; }
+    uint32 popBatch(Item* out, uint32 max_items) {
+        uint32 count = 0;
+        while(count < max_items && mQueue.pop(out[count]))
+            count++;
+        return count;
+    }
+private:
+    ThreadSafeQueue<Item> mQueue;
+};
+
+// Unbounded, so push never fails
+class NodeQueue {
+public:
+    NodeQueue(uint32 capacity) {}
+    static const char* name() { return "LockFreeQueue"; }
+    bool push(Item item) { mQueue.push(item); return true; }
+    uint32 popBatch(Item* out, uint32 max_items) {
+        uint32 count = 0;
+        while(count < max_items && mQueue.pop(out[count]))
+            count++;
+        return count;
+    }
+private:
+    LockFreeQueue<Item> mQueue;
+};
+
+template<typename QueueType>
+void producerMain(QueueType* queue, uint32 producer, uint32 items) {
+    for(uint32 i = 0; i < items; i++) {
+        Item item = ((Item)producer << 32) | i;
+        while(!queue->push(item))
+            Thread::yield();
+    }
+}
+
+// Returns the time taken for all the items to get through the queue, or
+// Duration::zero() if any came out of order.
+template<typename QueueType>
+Duration runQueue(uint32 nproducers, uint32 items_per_producer, uint32 capacity, uint32 batch_size) {
+    QueueType queue(capacity);
+    std::vector<uint32> next(nproducers, 0);
+    std::vector<Item> batch(batch_size);
+    bool in_order = true;
+
+    Time start = Timer::now();
+    std::vector<Thread*> producers;
+    for(uint32 i = 0; i < nproducers; i++)
+        producers.push_back(new Thread("MPSCQueueBenchmark Producer", std::tr1::bind(&producerMain<QueueType>, &queue, i, items_per_producer)));
+
+    uint64 total = (uint64)nproducers * items_per_producer;
+    uint64 received = 0;
+    while(received < total) {
+        uint32 popped = queue.popBatch(&batch[0], batch_size);
+        if (popped == 0) {
+            Thread::yield();
+            continue;
+        }
+        for(uint32 i = 0; i < popped; i++) {
+            uint32 producer = (uint32)(batch[i] >> 32);
+            uint32 seq = (uint32)(batch[i] & 0xFFFFFFFF);
+            if (seq != next[producer])
+                in_order = false;
+            next[producer] = seq + 1;
+        }
+        received += popped;
+    }
+    Duration dur = Timer::now() - start;
+
+    for(uint32 i = 0; i < nproducers; i++) {
+        producers[i]->join();
+        delete producers[i];
+    }
+    return in_order ? dur : Duration::zero();
+}
+
+template<typename QueueType>
+void reportQueue(uint32 nproducers, uint32 items, uint32 capacity, uint32 batch_size) {
+    uint32 items_per_producer = std::max(items / nproducers, (uint32)1);
+    Duration dur = runQueue<QueueType>(nproducers, items_per_producer, capacity, batch_size);
+    if (dur == Duration::zero()) {
+        SILOG(benchmark,error,QueueType::name() << ", " << nproducers << " producers: items out of order");
+        return;
+    }
+    uint64 total = (uint64)nproducers * items_per_producer;
+    SILOG(benchmark,info,
+          QueueType::name() << ", " << nproducers << " producers: " << dur << ", "
+          << (dur.toMicroseconds()*1000/float(total)) << "ns/item, "
+          << (total / dur.toSeconds()) << " items/sec");
+}
+
+}
+
+MPSCQueueBenchmark::MPSCQueueBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* items;
+    OptionValue* max_producers;
+    OptionValue* capacity;
+    OptionValue* batch;
+    Sirikata::InitializeClassOptions ico("MPSCQueueBenchmark",this,
+        items=new OptionValue("items","2000000",Sirikata::OptionValueType<uint32>(),"Total number of items pushed by all producers in each run"),
+        max_producers=new OptionValue("max-producers","32",Sirikata::OptionValueType<uint32>(),"Largest number of producer threads to try"),
+        capacity=new OptionValue("capacity","16384",Sirikata::OptionValueType<uint32>(),"Capacity of the bounded queues"),
+        batch=new OptionValue("batch","20",Sirikata::OptionValueType<uint32>(),"Maximum number of items the consumer pops at once"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("MPSCQueueBenchmark",this);
+    optionsSet->parse(param);
+
+    mItems = items->as<uint32>();
+    mMaxProducers = std::max(max_producers->as<uint32>(), (uint32)1);
+    mCapacity = capacity->as<uint32>();
+    mBatchSize = std::max(batch->as<uint32>(), (uint32)1);
+}
+
+String MPSCQueueBenchmark::name() {
+    return "mpsc-queue";
+}
+
+void MPSCQueueBenchmark::start() {
+    mForceStop = false;
+
+    for(uint32 nproducers = 1; nproducers <= mMaxProducers && !mForceStop; nproducers *= 2) {
+        reportQueue<RingQueue>(nproducers, mItems, mCapacity, mBatchSize);
+        reportQueue<LockedSizedQueue>(nproducers, mItems, mCapacity, mBatchSize);
+        reportQueue<PlainThreadSafeQueue>(nproducers, mItems, mCapacity, mBatchSize);
+        reportQueue<NodeQueue>(nproducers, mItems, mCapacity, mBatchSize);
+    }
+
+    notifyFinished();
+}
+
+void MPSCQueueBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
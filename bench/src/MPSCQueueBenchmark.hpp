@@ -0,0 +1,50 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_MPSC_QUEUE_BENCHMARK_HPP_
+#define _SIRIKATA_MPSC_QUEUE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** Measures queues handing items from many producer threads to a single
+ *  consumer, as the space server's networking threads hand messages to the
+ *  main strand. Every producer pushes as fast as it can, retrying when a
+ *  bounded queue is full, while the consumer drains the queue.
+ *
+ *  This compares the MPSCRing with the queues it replaced: a
+ *  SizedThreadSafeQueue behind an extra mutex, as the Forwarder and Server
+ *  used, a plain ThreadSafeQueue, and the LockFreeQueue, which allocates a
+ *  node for every push. Each is run with 1 up to max-producers producer
+ *  threads, doubling each time.
+ */
+class MPSCQueueBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new MPSCQueueBenchmark(finished_cb, param);
+    }
+
+    MPSCQueueBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    bool mForceStop;
+
+    // Total items pushed by all producers in each run
+    uint32 mItems;
+    uint32 mMaxProducers;
+    uint32 mCapacity;
+    uint32 mBatchSize;
+}; // class MPSCQueueBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_MPSC_QUEUE_BENCHMARK_HPP_
@@ -0,0 +1,299 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "MeshSimplifierBenchmark.hpp"
+#include <sirikata/mesh/MeshSimplifier.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <cmath>
+
+namespace Sirikata {
+
+using namespace Mesh;
+
+namespace {
+
+// Adds a sphere with a bumpy surface as a new submesh, returning its index
+uint32 addSphere(MeshdataPtr md, uint32 rings, uint32 segments, float bumpiness) {
+    SubMeshGeometry geom;
+    geom.name = "sphere";
+    SubMeshGeometry::TextureSet uvs;
+    uvs.stride = 2;
+    for(uint32 r = 0; r <= rings; r++) {
+        for(uint32 s = 0; s <= segments; s++) {
+            float theta = M_PI * r / rings, phi = 2 * M_PI * s / segments;
+            Vector3f normal(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+            float radius = 1.f + bumpiness * sin(5 * theta) * cos(7 * phi);
+            geom.positions.push_back(normal * radius);
+            geom.normals.push_back(normal);
+            uvs.uvs.push_back((float)s / segments);
+            uvs.uvs.push_back((float)r / rings);
+        }
+    }
+    geom.texUVs.push_back(uvs);
+
+    SubMeshGeometry::Primitive prim;
+    prim.primitiveType = SubMeshGeometry::Primitive::TRIANGLES;
+    prim.materialId = 0;
+    for(uint32 r = 0; r < rings; r++) {
+        for(uint32 s = 0; s < segments; s++) {
+            unsigned short a = r * (segments + 1) + s, b = a + segments + 1;
+            prim.indices.push_back(a); prim.indices.push_back(b); prim.indices.push_back(a + 1);
+            prim.indices.push_back(a + 1); prim.indices.push_back(b); prim.indices.push_back(b + 1);
+        }
+    }
+    geom.primitives.push_back(prim);
+
+    md->geometry.push_back(geom);
+    return md->geometry.size() - 1;
+}
+
+// Adds a square heightfield with open edges as a new submesh
+uint32 addTerrain(MeshdataPtr md, uint32 size, float roughness) {
+    SubMeshGeometry geom;
+    geom.name = "terrain";
+    for(uint32 y = 0; y <= size; y++) {
+        for(uint32 x = 0; x <= size; x++) {
+            float fx = (float)x / size, fy = (float)y / size;
+            float height = roughness * (sin(fx * 13.f) * cos(fy * 7.f) + 0.3f * sin(fx * 41.f + fy * 29.f));
+            geom.positions.push_back(Vector3f(fx * 10.f, height, fy * 10.f));
+            geom.normals.push_back(Vector3f(0, 1, 0));
+        }
+    }
+
+    SubMeshGeometry::Primitive prim;
+    prim.primitiveType = SubMeshGeometry::Primitive::TRIANGLES;
+    prim.materialId = 0;
+    for(uint32 y = 0; y < size; y++) {
+        for(uint32 x = 0; x < size; x++) {
+            unsigned short a = y * (size + 1) + x, b = a + size + 1;
+            prim.indices.push_back(a); prim.indices.push_back(b); prim.indices.push_back(a + 1);
+            prim.indices.push_back(a + 1); prim.indices.push_back(b); prim.indices.push_back(b + 1);
+        }
+    }
+    geom.primitives.push_back(prim);
+
+    md->geometry.push_back(geom);
+    return md->geometry.size() - 1;
+}
+
+void addInstance(MeshdataPtr md, uint32 geom_idx, const Matrix4x4f& xform) {
+    NodeIndex node_idx = md->nodes.size();
+    md->nodes.push_back(Node(xform));
+    md->rootNodes.push_back(node_idx);
+
+    GeometryInstance inst;
+    inst.geometryIndex = geom_idx;
+    inst.parentNode = node_idx;
+    md->instances.push_back(inst);
+}
+
+struct Triangle {
+    Vector3d a, b, c;
+};
+typedef std::vector<Triangle> TriangleList;
+
+// Collects the triangles of all instances, transformed into the mesh's space
+void collectTriangles(MeshdataPtr md, TriangleList* tris_out, uint32* count_out) {
+    uint32 count = 0;
+    uint32 geoinst_idx;
+    Matrix4x4f pos_xform;
+    Meshdata::GeometryInstanceIterator geoinst_it = md->getGeometryInstanceIterator();
+    while(geoinst_it.next(&geoinst_idx, &pos_xform)) {
+        const SubMeshGeometry& geom = md->geometry[ md->instances[geoinst_idx].geometryIndex ];
+        for(uint32 p = 0; p < geom.primitives.size(); p++) {
+            const SubMeshGeometry::Primitive& prim = geom.primitives[p];
+            if (prim.primitiveType != SubMeshGeometry::Primitive::TRIANGLES) continue;
+            for(uint32 i = 0; i+2 < prim.indices.size(); i += 3) {
+                count++;
+                if (tris_out == NULL) continue;
+                Triangle tri;
+                Vector3f a = pos_xform * geom.positions[prim.indices[i]];
+                Vector3f b = pos_xform * geom.positions[prim.indices[i+1]];
+                Vector3f c = pos_xform * geom.positions[prim.indices[i+2]];
+                tri.a = Vector3d(a.x, a.y, a.z);
+                tri.b = Vector3d(b.x, b.y, b.z);
+                tri.c = Vector3d(c.x, c.y, c.z);
+                tris_out->push_back(tri);
+            }
+        }
+    }
+    if (count_out != NULL) *count_out = count;
+}
+
+// Closest point on a triangle, from Ericson's Real-Time Collision Detection
+float64 distanceToTriangle(const Vector3d& p, const Triangle& tri) {
+    const Vector3d& a = tri.a;
+    const Vector3d& b = tri.b;
+    const Vector3d& c = tri.c;
+
+    Vector3d ab = b - a, ac = c - a, ap = p - a;
+    float64 d1 = ab.dot(ap), d2 = ac.dot(ap);
+    if (d1 <= 0 && d2 <= 0) return (p - a).length();
+
+    Vector3d bp = p - b;
+    float64 d3 = ab.dot(bp), d4 = ac.dot(bp);
+    if (d3 >= 0 && d4 <= d3) return (p - b).length();
+
+    float64 vc = d1*d4 - d3*d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0)
+        return (p - (a + ab * (d1 / (d1 - d3)))).length();
+
+    Vector3d cp = p - c;
+    float64 d5 = ab.dot(cp), d6 = ac.dot(cp);
+    if (d6 >= 0 && d5 <= d6) return (p - c).length();
+
+    float64 vb = d5*d2 - d1*d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0)
+        return (p - (a + ac * (d2 / (d2 - d6)))).length();
+
+    float64 va = d3*d6 - d5*d4;
+    if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+        return (p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))))).length();
+
+    float64 denom = 1.0 / (va + vb + vc);
+    return (p - (a + ab * (vb * denom) + ac * (vc * denom))).length();
+}
+
+} // namespace
+
+MeshSimplifierBenchmark::MeshSimplifierBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* ratio;
+    OptionValue* iterations;
+    OptionValue* threads;
+    OptionValue* error_samples;
+    Sirikata::InitializeClassOptions ico("MeshSimplifierBenchmark",this,
+        ratio=new OptionValue("ratio","0.1",Sirikata::OptionValueType<float64>(),"Fraction of faces to simplify each mesh to"),
+        iterations=new OptionValue("iterations","3",Sirikata::OptionValueType<uint32>(),"Number of times to simplify each mesh"),
+        threads=new OptionValue("threads","0",Sirikata::OptionValueType<uint32>(),"Number of threads to simplify with, or 0 for the number of cores"),
+        error_samples=new OptionValue("error-samples","2000",Sirikata::OptionValueType<uint32>(),"Number of points on the original surface to measure error at"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("MeshSimplifierBenchmark",this);
+    optionsSet->parse(param);
+
+    mRatio = std::min(std::max(ratio->as<float64>(), 0.0), 1.0);
+    mIterations = std::max(iterations->as<uint32>(), (uint32)1);
+    mThreads = threads->as<uint32>();
+    if (mThreads == 0)
+        mThreads = std::max(Thread::hardware_concurrency(), (unsigned)1);
+    mErrorSamples = std::max(error_samples->as<uint32>(), (uint32)1);
+}
+
+String MeshSimplifierBenchmark::name() {
+    return "mesh-simplifier";
+}
+
+MeshdataPtr MeshSimplifierBenchmark::generateMesh(const String& name) {
+    MeshdataPtr md(new Meshdata());
+
+    if (name == "sphere") {
+        addInstance(md, addSphere(md, 128, 256, 0.1f), Matrix4x4f::identity());
+    }
+    else if (name == "terrain") {
+        addInstance(md, addTerrain(md, 160, 1.f), Matrix4x4f::identity());
+    }
+    else if (name == "city") {
+        // Lots of small, independent objects at different resolutions, some
+        // of them placed more than once
+        for(uint32 i = 0; i < 64; i++) {
+            uint32 geom_idx = (i % 4 == 0) ?
+                addTerrain(md, 12 + i % 16, 0.2f) :
+                addSphere(md, 8 + i % 24, 16 + (i * 7) % 40, 0.02f * (i % 5));
+            uint32 ninstances = 1 + (i % 3 == 0 ? i % 4 : 0);
+            for(uint32 inst = 0; inst < ninstances; inst++)
+                addInstance(md, geom_idx, Matrix4x4f::translate(Vector3f(3.f * (i % 8), 3.f * inst, 3.f * (i / 8))));
+        }
+    }
+
+    return md;
+}
+
+void MeshSimplifierBenchmark::run(const String& mesh_name, uint32 nthreads) {
+    MeshSimplifier simplifier(nthreads);
+
+    uint32 input_faces = 0, output_faces = 0;
+    Duration total = Duration::zero();
+    MeshdataPtr simplified;
+    for(uint32 it = 0; it < mIterations && !mForceStop; it++) {
+        simplified = generateMesh(mesh_name);
+        collectTriangles(simplified, NULL, &input_faces);
+        int32 target_faces = (int32)(input_faces * mRatio);
+
+        Time start = Timer::now();
+        simplifier.simplify(simplified, target_faces);
+        total += Timer::now() - start;
+    }
+    if (mForceStop) return;
+
+    TriangleList simplified_tris;
+    collectTriangles(simplified, &simplified_tris, &output_faces);
+
+    // Sample points evenly from the original surface, and find the bounds to
+    // normalize the error by
+    MeshdataPtr original = generateMesh(mesh_name);
+    TriangleList original_tris;
+    collectTriangles(original, &original_tris, NULL);
+    if (original_tris.empty()) return;
+    const Vector3d& first = original_tris[0].a;
+    BoundingBox3f3f bounds(Vector3f(first.x, first.y, first.z), 0);
+    for(uint32 i = 0; i < original_tris.size(); i++) {
+        const Triangle& tri = original_tris[i];
+        bounds.mergeIn(Vector3f(tri.a.x, tri.a.y, tri.a.z));
+        bounds.mergeIn(Vector3f(tri.b.x, tri.b.y, tri.b.z));
+        bounds.mergeIn(Vector3f(tri.c.x, tri.c.y, tri.c.z));
+    }
+    float64 diag = bounds.across().length();
+
+    float64 total_error = 0, max_error = 0;
+    uint32 nsamples = 0;
+    uint32 stride = std::max((uint32)original_tris.size() / mErrorSamples, (uint32)1);
+    for(uint32 i = 0; i < original_tris.size() && !simplified_tris.empty() && !mForceStop; i += stride) {
+        const Triangle& tri = original_tris[i];
+        Vector3d sample = (tri.a + tri.b + tri.c) / 3.0;
+
+        float64 dist = distanceToTriangle(sample, simplified_tris[0]);
+        for(uint32 j = 1; j < simplified_tris.size(); j++)
+            dist = std::min(dist, distanceToTriangle(sample, simplified_tris[j]));
+
+        total_error += dist;
+        max_error = std::max(max_error, dist);
+        nsamples++;
+    }
+    if (nsamples == 0 || diag <= 0) return;
+
+    float64 secs = total.toSeconds() / mIterations;
+    SILOG(benchmark,info,
+          mesh_name << " (" << original->geometry.size() << " submeshes), " << nthreads << " threads: "
+          << input_faces << " -> " << output_faces << " faces, "
+          << (secs * 1000) << " ms, "
+          << (secs > 0 ? input_faces / secs : 0) << " faces/sec, "
+          << "mean error " << (total_error / nsamples / diag) << ", "
+          << "max error " << (max_error / diag));
+}
+
+void MeshSimplifierBenchmark::start() {
+    mForceStop = false;
+
+    SILOG(benchmark,info, "Simplifying to " << (mRatio * 100) << "% of faces, " << mIterations << " iterations");
+
+    const char* meshes[] = { "sphere", "terrain", "city" };
+    for(uint32 i = 0; i < sizeof(meshes)/sizeof(meshes[0]) && !mForceStop; i++) {
+        run(meshes[i], 1);
+        if (mThreads > 1 && !mForceStop)
+            run(meshes[i], mThreads);
+    }
+
+    notifyFinished();
+}
+
+void MeshSimplifierBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
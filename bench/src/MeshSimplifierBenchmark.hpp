@@ -0,0 +1,56 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_MESH_SIMPLIFIER_BENCHMARK_HPP_
+#define _SIRIKATA_MESH_SIMPLIFIER_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/mesh/Meshdata.hpp>
+
+namespace Sirikata {
+
+/** Simplifies a few generated reference meshes with MeshSimplifier, as
+ *  MeshAggregateManager does when generating aggregates, and reports
+ *  throughput in input faces per second and the error of the result.
+ *
+ *  The reference meshes are a single dense sphere, a terrain heightfield with
+ *  open boundaries, and a "city" of many small submeshes, some of them
+ *  instanced more than once, like an aggregate of many objects. Each is
+ *  simplified with one thread and with the requested number of threads.
+ *
+ *  The error is the distance from points on the original surface to the
+ *  nearest triangle of the simplified mesh, as a fraction of the mesh's
+ *  bounding box diagonal.
+ */
+class MeshSimplifierBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new MeshSimplifierBenchmark(finished_cb, param);
+    }
+
+    MeshSimplifierBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Generate one of the reference meshes by name
+    Mesh::MeshdataPtr generateMesh(const String& name);
+    void run(const String& mesh_name, uint32 nthreads);
+
+    bool mForceStop;
+
+    float64 mRatio;
+    uint32 mIterations;
+    uint32 mThreads;
+    uint32 mErrorSamples;
+}; // class MeshSimplifierBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_MESH_SIMPLIFIER_BENCHMARK_HPP_
@@ -0,0 +1,322 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "OSegCacheReplayBenchmark.hpp"
+#include <sirikata/core/util/ShardedClockCache.hpp>
+#include <sirikata/core/trace/Trace.hpp>
+#include <sirikata/core/trace/TraceReader.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/lexical_cast.hpp>
+#include "Protocol_OSegTrace.pbj.hpp"
+#include <map>
+
+namespace Sirikata {
+
+namespace {
+
+// The cached value, standing in for an OSegEntry
+typedef uint32 CachedServer;
+
+class ReplayCache {
+public:
+    virtual ~ReplayCache() {}
+    virtual String name() const = 0;
+    virtual bool get(const UUID& id, CachedServer* server_out) = 0;
+    virtual void insert(const UUID& id, CachedServer server) = 0;
+    // Extra statistics to report after a run
+    virtual String stats() { return ""; }
+};
+
+// Mirrors CacheLRUOriginal: one mutex, records in a hash map and in a
+// multimap ordered by insertion, and the oldest group of entries thrown out
+// when the cache overflows. Lookups don't affect eviction.
+class LockedGroupEvictionCache : public ReplayCache {
+public:
+    LockedGroupEvictionCache(uint32 capacity, uint32 clean_group_size)
+     : mCapacity(capacity),
+       mCleanGroupSize(clean_group_size),
+       mNextAge(0)
+    {}
+
+    ~LockedGroupEvictionCache() {
+        for(IDRecordMap::iterator it = mRecords.begin(); it != mRecords.end(); it++)
+            delete it->second;
+    }
+
+    virtual String name() const { return "locked-group-eviction"; }
+
+    virtual bool get(const UUID& id, CachedServer* server_out) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        IDRecordMap::iterator it = mRecords.find(id);
+        if (it == mRecords.end()) return false;
+        *server_out = it->second->server;
+        return true;
+    }
+
+    virtual void insert(const UUID& id, CachedServer server) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        IDRecordMap::iterator it = mRecords.find(id);
+        if (it != mRecords.end()) {
+            removeFromAgeMap(it->second);
+            it->second->server = server;
+            it->second->age = mNextAge++;
+            mAges.insert(std::make_pair(it->second->age, it->second));
+            return;
+        }
+
+        Record* rec = new Record();
+        rec->id = id;
+        rec->server = server;
+        rec->age = mNextAge++;
+        mRecords[id] = rec;
+        mAges.insert(std::make_pair(rec->age, rec));
+
+        if (mRecords.size() > mCapacity) {
+            for(uint32 i = 0; i < mCleanGroupSize && !mAges.empty(); i++) {
+                Record* oldest = mAges.begin()->second;
+                mAges.erase(mAges.begin());
+                mRecords.erase(oldest->id);
+                delete oldest;
+            }
+        }
+    }
+
+private:
+    struct Record {
+        UUID id;
+        CachedServer server;
+        uint64 age;
+    };
+
+    void removeFromAgeMap(Record* rec) {
+        std::pair<AgeMap::iterator, AgeMap::iterator> range = mAges.equal_range(rec->age);
+        for(AgeMap::iterator it = range.first; it != range.second; it++) {
+            if (it->second == rec) {
+                mAges.erase(it);
+                return;
+            }
+        }
+    }
+
+    typedef std::tr1::unordered_map<UUID, Record*, UUID::Hasher> IDRecordMap;
+    typedef std::multimap<uint64, Record*> AgeMap;
+
+    boost::mutex mMutex;
+    IDRecordMap mRecords;
+    AgeMap mAges;
+    const uint32 mCapacity;
+    const uint32 mCleanGroupSize;
+    uint64 mNextAge;
+};
+
+class ShardedReplayCache : public ReplayCache {
+public:
+    ShardedReplayCache(uint32 capacity, uint32 nshards)
+     : mCache(capacity, nshards)
+    {}
+
+    virtual String name() const {
+        return "sharded-clock (" + boost::lexical_cast<String>(mCache.numShards()) + " shards)";
+    }
+
+    virtual bool get(const UUID& id, CachedServer* server_out) {
+        return mCache.get(id, server_out);
+    }
+
+    virtual void insert(const UUID& id, CachedServer server) {
+        mCache.insert(id, server);
+    }
+
+    virtual String stats() {
+        ClockCache::Stats stats = mCache.stats();
+        return
+            ", " + boost::lexical_cast<String>(stats.evictions) + " evictions"
+            ", " + boost::lexical_cast<String>(stats.rejections) + " rejected"
+            ", " + boost::lexical_cast<String>(stats.contended) + " contended";
+    }
+
+private:
+    typedef ShardedClockCache<UUID, CachedServer, UUID::Hasher> ClockCache;
+    ClockCache mCache;
+};
+
+struct ReplayResult {
+    ReplayResult() : hits(0), lookups(0) {}
+    uint64 hits;
+    uint64 lookups;
+};
+
+void replayMain(ReplayCache* cache, const std::vector<UUID>* lookups, uint32 offset, ReplayResult* result) {
+    uint32 count = lookups->size();
+    for(uint32 i = 0; i < count; i++) {
+        const UUID& id = (*lookups)[(offset + i) % count];
+        CachedServer server;
+        if (cache->get(id, &server)) {
+            result->hits++;
+        }
+        else {
+            // The result of the full lookup
+            cache->insert(id, (CachedServer)(UUID::Hasher()(id) % 16) + 1);
+        }
+        result->lookups++;
+    }
+}
+
+}
+
+OSegCacheReplayBenchmark::OSegCacheReplayBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* trace;
+    OptionValue* lookups;
+    OptionValue* objects;
+    OptionValue* skew;
+    OptionValue* capacity;
+    OptionValue* shards;
+    OptionValue* max_threads;
+    Sirikata::InitializeClassOptions ico("OSegCacheReplayBenchmark",this,
+        trace=new OptionValue("trace","",Sirikata::OptionValueType<String>(),"Space server trace to take OSeg lookups from. If empty, a synthetic workload is used"),
+        lookups=new OptionValue("lookups","1000000",Sirikata::OptionValueType<uint32>(),"Number of lookups in the synthetic workload"),
+        objects=new OptionValue("objects","100000",Sirikata::OptionValueType<uint32>(),"Number of distinct objects in the synthetic workload"),
+        skew=new OptionValue("skew","0.9",Sirikata::OptionValueType<float64>(),"Zipf exponent for object popularity in the synthetic workload"),
+        capacity=new OptionValue("capacity","10000",Sirikata::OptionValueType<uint32>(),"Number of entries each cache can hold"),
+        shards=new OptionValue("shards","16",Sirikata::OptionValueType<uint32>(),"Number of shards in the sharded cache"),
+        max_threads=new OptionValue("max-threads","0",Sirikata::OptionValueType<uint32>(),"Largest number of threads to replay with, or 0 for the number of cores"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("OSegCacheReplayBenchmark",this);
+    optionsSet->parse(param);
+
+    mTrace = trace->as<String>();
+    mLookups = std::max(lookups->as<uint32>(), (uint32)1);
+    mObjects = std::max(objects->as<uint32>(), (uint32)1);
+    mSkew = skew->as<float64>();
+    mCapacity = std::max(capacity->as<uint32>(), (uint32)1);
+    mShards = std::max(shards->as<uint32>(), (uint32)1);
+    mMaxThreads = max_threads->as<uint32>();
+    if (mMaxThreads == 0)
+        mMaxThreads = std::max(Thread::hardware_concurrency(), (unsigned)1);
+}
+
+String OSegCacheReplayBenchmark::name() {
+    return "oseg-cache-replay";
+}
+
+bool OSegCacheReplayBenchmark::loadTrace(std::vector<UUID>* lookups) {
+    Trace::TraceReader reader(mTrace);
+    if (!reader.valid()) {
+        SILOG(benchmark,error,"Couldn't read trace " << mTrace);
+        return false;
+    }
+    reader.filterType(OSegLookupNotOnServerAnalysisTag);
+
+    uint16 type_hint;
+    const uint8* payload;
+    uint32 size;
+    while(reader.next(&type_hint, &payload, &size)) {
+        Sirikata::Trace::OSeg::InvalidLookup rec;
+        if (!rec.ParseFromArray(payload, size) || !rec.has_object())
+            continue;
+        lookups->push_back(rec.object());
+    }
+    if (lookups->empty()) {
+        SILOG(benchmark,error,"No OSeg lookups in trace " << mTrace << ". Was it recorded with OSeg tracing enabled?");
+        return false;
+    }
+    return true;
+}
+
+void OSegCacheReplayBenchmark::generateLookups(std::vector<UUID>* lookups) {
+    std::vector<UUID> objects;
+    std::vector<float64> cdf;
+    float64 total = 0;
+    for(uint32 i = 0; i < mObjects; i++) {
+        objects.push_back(UUID::random());
+        total += 1.0 / pow((float64)(i+1), mSkew);
+        cdf.push_back(total);
+    }
+
+    lookups->reserve(mLookups);
+    for(uint32 i = 0; i < mLookups; i++) {
+        float64 r = randFloat() * total;
+        uint32 idx = std::lower_bound(cdf.begin(), cdf.end(), r) - cdf.begin();
+        lookups->push_back(objects[std::min(idx, mObjects-1)]);
+    }
+}
+
+void OSegCacheReplayBenchmark::start() {
+    mForceStop = false;
+
+    std::vector<UUID> lookups;
+    if (!mTrace.empty()) {
+        if (!loadTrace(&lookups)) {
+            notifyFinished();
+            return;
+        }
+        SILOG(benchmark,info, "Replaying " << lookups.size() << " OSeg lookups from " << mTrace);
+    }
+    else {
+        generateLookups(&lookups);
+        SILOG(benchmark,info, "Replaying " << lookups.size() << " synthetic OSeg lookups of " << mObjects << " objects, skew " << mSkew);
+    }
+    SILOG(benchmark,info, "Caches hold " << mCapacity << " entries");
+
+    std::vector<uint32> thread_counts;
+    for(uint32 nthreads = 1; nthreads < mMaxThreads; nthreads *= 2)
+        thread_counts.push_back(nthreads);
+    thread_counts.push_back(mMaxThreads);
+
+    for(uint32 ci = 0; ci < 3 && !mForceStop; ci++) {
+        for(uint32 ti = 0; ti < thread_counts.size() && !mForceStop; ti++) {
+            uint32 nthreads = thread_counts[ti];
+
+            ReplayCache* cache = NULL;
+            if (ci == 0)
+                cache = new LockedGroupEvictionCache(mCapacity, 25);
+            else if (ci == 1)
+                cache = new ShardedReplayCache(mCapacity, 1);
+            else
+                cache = new ShardedReplayCache(mCapacity, mShards);
+
+            std::vector<ReplayResult> results(nthreads);
+            std::vector<Thread*> threads;
+            Time start = Timer::now();
+            for(uint32 i = 0; i < nthreads; i++) {
+                uint32 offset = (uint32)(((uint64)lookups.size() * i) / nthreads);
+                threads.push_back(new Thread("OSegCacheReplayBenchmark", std::tr1::bind(&replayMain, cache, &lookups, offset, &results[i])));
+            }
+            for(uint32 i = 0; i < nthreads; i++) {
+                threads[i]->join();
+                delete threads[i];
+            }
+            Duration dur = Timer::now() - start;
+
+            uint64 hits = 0, total = 0;
+            for(uint32 i = 0; i < nthreads; i++) {
+                hits += results[i].hits;
+                total += results[i].lookups;
+            }
+            SILOG(benchmark,info,
+                  cache->name() << ", " << nthreads << " threads: "
+                  << (total / dur.toSeconds()) << " lookups/sec, "
+                  << (dur.toMicroseconds() * 1000.0 * nthreads / total) << " ns/lookup per thread, "
+                  << (100.0 * hits / total) << "% hits"
+                  << cache->stats());
+            delete cache;
+        }
+    }
+
+    notifyFinished();
+}
+
+void OSegCacheReplayBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,62 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_OSEG_CACHE_REPLAY_BENCHMARK_HPP_
+#define _SIRIKATA_OSEG_CACHE_REPLAY_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/core/util/UUID.hpp>
+
+namespace Sirikata {
+
+/** Replays a stream of OSeg lookups against OSeg caches from several threads
+ *  at once, as the space server's networking threads and main strand do.
+ *  Every lookup checks the cache and a miss inserts the object, standing in
+ *  for the result of a full OSeg lookup.
+ *
+ *  The lookups come from the OSeg lookup records (objects not found on the
+ *  server) in a space server trace, or if no trace is given, from a synthetic
+ *  workload with Zipf-distributed object popularity. Each thread replays the
+ *  whole stream, starting at a different point in it.
+ *
+ *  This compares a single mutex around a hash map with insertion-ordered
+ *  group eviction, as CacheLRUOriginal does, with the ShardedClockCache used
+ *  by ShardedOSegCache, both with a single shard and with many.
+ */
+class OSegCacheReplayBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new OSegCacheReplayBenchmark(finished_cb, param);
+    }
+
+    OSegCacheReplayBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Fill lookups from the trace, returning false if it couldn't be read
+    bool loadTrace(std::vector<UUID>* lookups);
+    void generateLookups(std::vector<UUID>* lookups);
+
+    bool mForceStop;
+
+    String mTrace;
+    // Synthetic workload
+    uint32 mLookups;
+    uint32 mObjects;
+    float64 mSkew;
+
+    uint32 mCapacity;
+    uint32 mShards;
+    uint32 mMaxThreads;
+}; // class OSegCacheReplayBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_OSEG_CACHE_REPLAY_BENCHMARK_HPP_
@@ -0,0 +1,179 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "SQLiteStorageBenchmark.hpp"
+#include <sirikata/oh/ObjectHostContext.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/network/IOWork.hpp>
+#include <sirikata/core/odp/SST.hpp>
+#include <sirikata/core/ohdp/SST.hpp>
+#include <sirikata/core/trace/Trace.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/filesystem.hpp>
+
+namespace Sirikata {
+
+SQLiteStorageBenchmark::SQLiteStorageBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mOutstanding(0),
+          mFailed(0),
+          mTotalLatency(Duration::zero())
+{
+    OptionValue* db;
+    OptionValue* objects;
+    OptionValue* ticks;
+    OptionValue* keys;
+    OptionValue* value_size;
+    Sirikata::InitializeClassOptions ico("SQLiteStorageBenchmark",this,
+        db=new OptionValue("db","storage-bench.db",Sirikata::OptionValueType<String>(),"Database file to use. It's deleted before each run"),
+        objects=new OptionValue("objects","200",Sirikata::OptionValueType<uint32>(),"Number of objects committing each tick"),
+        ticks=new OptionValue("ticks","20",Sirikata::OptionValueType<uint32>(),"Number of ticks to run"),
+        keys=new OptionValue("keys","2",Sirikata::OptionValueType<uint32>(),"Number of keys written in each commit"),
+        value_size=new OptionValue("value-size","128",Sirikata::OptionValueType<uint32>(),"Size of each value written"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("SQLiteStorageBenchmark",this);
+    optionsSet->parse(param);
+
+    mDB = db->as<String>();
+    mObjects = std::max(objects->as<uint32>(), (uint32)1);
+    mTicks = std::max(ticks->as<uint32>(), (uint32)1);
+    mKeysPerCommit = std::max(keys->as<uint32>(), (uint32)1);
+    mValueSize = value_size->as<uint32>();
+}
+
+String SQLiteStorageBenchmark::name() {
+    return "sqlite-storage";
+}
+
+void SQLiteStorageBenchmark::commitFinished(Time started, OH::Storage::Result result, OH::Storage::ReadSet* rs) {
+    delete rs;
+
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    if (result != OH::Storage::SUCCESS)
+        mFailed++;
+    mTotalLatency += Timer::now() - started;
+    mOutstanding--;
+    if (mOutstanding == 0)
+        mCond.notify_one();
+}
+
+void SQLiteStorageBenchmark::run(const String& desc, const String& storage_args) {
+    // Start from an empty database each time
+    try {
+        boost::filesystem::remove(mDB);
+        boost::filesystem::remove(mDB + "-wal");
+        boost::filesystem::remove(mDB + "-shm");
+    } catch (boost::filesystem::filesystem_error) {
+    }
+
+    // Storage is tied to the main event loop, which requires quite a bit of
+    // setup. This mirrors StorageTestBase.
+    Trace::Trace* trace = new Trace::Trace("storage-bench.trace");
+    Network::IOService* ios = new Network::IOService("SQLiteStorageBenchmark");
+    Network::IOStrand* main_strand = ios->createStrand("SQLiteStorageBenchmark");
+    Network::IOWork* work = new Network::IOWork(*ios, "SQLiteStorageBenchmark");
+    ODPSST::ConnectionManager* sst_conn_mgr = new ODPSST::ConnectionManager();
+    OHDPSST::ConnectionManager* oh_sst_conn_mgr = new OHDPSST::ConnectionManager();
+    ObjectHostContext* ctx = new ObjectHostContext("bench", ObjectHostID(1), sst_conn_mgr, oh_sst_conn_mgr, ios, main_strand, trace, Timer::now(), Duration::zero());
+
+    OH::Storage* storage = OH::StorageFactory::getSingleton().getConstructor("sqlite")(ctx, "--db=" + mDB + " " + storage_args);
+
+    std::vector<OH::Storage::Bucket> buckets;
+    for(uint32 i = 0; i < mObjects; i++) {
+        buckets.push_back(UUID::random());
+        storage->leaseBucket(buckets.back());
+    }
+
+    ctx->add(ctx);
+    ctx->add(storage);
+    ctx->run(1, Context::AllNew);
+
+    String value(mValueSize, 'x');
+    mFailed = 0;
+    mTotalLatency = Duration::zero();
+    Time start = Timer::now();
+    uint32 ticks_run = 0;
+    for(; ticks_run < mTicks && !mForceStop; ticks_run++) {
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            mOutstanding = mObjects;
+        }
+        // Like everything else using storage, commit from the main strand
+        for(uint32 i = 0; i < mObjects; i++) {
+            main_strand->post(
+                std::tr1::bind(&SQLiteStorageBenchmark::issueCommit, this, storage, buckets[i], ticks_run, value),
+                "SQLiteStorageBenchmark::issueCommit"
+            );
+        }
+
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        while(mOutstanding > 0)
+            mCond.wait(lock);
+    }
+    Duration dur = Timer::now() - start;
+
+    uint64 commits = (uint64)ticks_run * mObjects;
+    if (commits > 0) {
+        SILOG(benchmark,info,
+              desc << ": "
+              << (commits / dur.toSeconds()) << " commits/sec, "
+              << (mTotalLatency.toMicroseconds() / 1000.0 / commits) << " ms mean commit latency, "
+              << mFailed << " failed");
+    }
+
+    for(uint32 i = 0; i < mObjects; i++)
+        storage->releaseBucket(buckets[i]);
+
+    delete work;
+    ctx->shutdown();
+    trace->prepareShutdown();
+    delete storage;
+    delete ctx;
+    trace->shutdown();
+    delete trace;
+    delete sst_conn_mgr;
+    delete oh_sst_conn_mgr;
+    delete main_strand;
+    delete ios;
+}
+
+void SQLiteStorageBenchmark::issueCommit(OH::Storage* storage, const OH::Storage::Bucket& bucket, uint32 tick, const String& value) {
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+
+    storage->beginTransaction(bucket);
+    for(uint32 k = 0; k < mKeysPerCommit; k++)
+        storage->write(bucket, "key" + boost::lexical_cast<String>(k), value + boost::lexical_cast<String>(tick));
+    storage->commitTransaction(bucket,
+        std::tr1::bind(&SQLiteStorageBenchmark::commitFinished, this, Timer::now(), _1, _2)
+    );
+}
+
+void SQLiteStorageBenchmark::start() {
+    mForceStop = false;
+
+    mPluginManager.load("oh-sqlite");
+
+    SILOG(benchmark,info, mObjects << " objects each committing " << mKeysPerCommit << " keys of " << mValueSize << " bytes per tick, " << mTicks << " ticks");
+
+    // Close to the old behavior: rollback journal and groups limited to the
+    // transactions that happened to be queued, at most 5
+    if (!mForceStop) run("journal, max group 5", "--wal=false --group-commit-latency=0s --max-group-commit=5");
+    if (!mForceStop) run("wal, no group commit latency", "--wal=true --group-commit-latency=0s --max-group-commit=64");
+    if (!mForceStop) run("wal, 2ms group commit", "--wal=true --group-commit-latency=2ms --max-group-commit=256");
+    if (!mForceStop) run("wal, 10ms group commit", "--wal=true --group-commit-latency=10ms --max-group-commit=256");
+
+    notifyFinished();
+}
+
+void SQLiteStorageBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,65 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SQLITE_STORAGE_BENCHMARK_HPP_
+#define _SIRIKATA_SQLITE_STORAGE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <sirikata/oh/Storage.hpp>
+#include <sirikata/core/util/PluginManager.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+
+/** Measures commit throughput and latency of the SQLite storage plugin when
+ *  many objects persist state at once. Each tick, every object commits a small
+ *  transaction to its own bucket, and the next tick starts once all of them
+ *  have completed, like scripts saving state on a timer.
+ *
+ *  This runs with the rollback journal and with the write-ahead log, and with
+ *  a few group commit settings.
+ */
+class SQLiteStorageBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new SQLiteStorageBenchmark(finished_cb, param);
+    }
+
+    SQLiteStorageBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Run the workload against storage created with the given arguments
+    void run(const String& desc, const String& storage_args);
+    // Commit one tick's worth of data for a bucket. Runs on the main strand.
+    void issueCommit(OH::Storage* storage, const OH::Storage::Bucket& bucket, uint32 tick, const String& value);
+    void commitFinished(Time started, OH::Storage::Result result, OH::Storage::ReadSet* rs);
+
+    bool mForceStop;
+    PluginManager mPluginManager;
+
+    String mDB;
+    uint32 mObjects;
+    uint32 mTicks;
+    uint32 mKeysPerCommit;
+    uint32 mValueSize;
+
+    // Tracks completion of the current tick
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    uint32 mOutstanding;
+    uint32 mFailed;
+    Duration mTotalLatency;
+}; // class SQLiteStorageBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SQLITE_STORAGE_BENCHMARK_HPP_
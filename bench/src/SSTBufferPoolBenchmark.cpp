@@ -0,0 +1,110 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "SSTBufferPoolBenchmark.hpp"
+#include <sirikata/core/network/SSTBufferPool.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+#define ITERATIONS 1000000
+// Number of segments kept alive at once, roughly a full send queue
+#define WINDOW 256
+
+namespace Sirikata {
+
+namespace {
+// The pre-pool segment buffer: a heap copy owned by the segment.
+class HeapSegment {
+public:
+    HeapSegment(const void* data, uint32 len)
+     : mBuffer(new uint8[len]),
+       mBufferLength(len)
+    {
+        memcpy(mBuffer, data, len);
+    }
+    ~HeapSegment() {
+        delete[] mBuffer;
+    }
+    uint8* mBuffer;
+    uint32 mBufferLength;
+};
+typedef std::tr1::shared_ptr<HeapSegment> HeapSegmentPtr;
+
+class PooledSegment {
+public:
+    PooledSegment(const SST::BufferSlice& buf)
+     : mBuffer(buf)
+    {}
+    SST::BufferSlice mBuffer;
+};
+typedef std::tr1::shared_ptr<PooledSegment> PooledSegmentPtr;
+
+// Payload sizes cycle through a typical mix of small control packets and full
+// stream segments.
+uint32 payloadSize(uint32 ii) {
+    static const uint32 sizes[] = { 40, 1000, 1000, 1300, 200, 1000 };
+    return sizes[ii % (sizeof(sizes)/sizeof(sizes[0]))];
+}
+}
+
+SSTBufferPoolBenchmark::SSTBufferPoolBenchmark(const FinishedCallback& finished_cb)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+}
+
+String SSTBufferPoolBenchmark::name() {
+    return "sst-buffer-pool";
+}
+
+void SSTBufferPoolBenchmark::start() {
+    mForceStop = false;
+
+    uint8 payload[2048];
+    memset(payload, 'x', sizeof(payload));
+
+    // Heap allocated segments, as ChannelSegment and StreamBuffer used to do
+    // it
+    std::vector<HeapSegmentPtr> heap_window(WINDOW);
+    Time heap_start_time = Timer::now();
+    for(uint32 ii = 0; ii < ITERATIONS && !mForceStop; ii++)
+        heap_window[ii % WINDOW] = HeapSegmentPtr(new HeapSegment(payload, payloadSize(ii)));
+    heap_window.clear();
+    Duration heap_dur = Timer::now() - heap_start_time;
+
+    if (mForceStop)
+        return;
+
+    // Pooled segments
+    SST::BufferPool pool;
+    std::vector<PooledSegmentPtr> pool_window(WINDOW);
+    Time pool_start_time = Timer::now();
+    for(uint32 ii = 0; ii < ITERATIONS && !mForceStop; ii++)
+        pool_window[ii % WINDOW] = PooledSegmentPtr(new PooledSegment(pool.copy(payload, payloadSize(ii))));
+    pool_window.clear();
+    Duration pool_dur = Timer::now() - pool_start_time;
+
+    if (mForceStop)
+        return;
+
+    SST::BufferPool::Stats stats = pool.stats();
+
+    SILOG(benchmark,info,
+          ITERATIONS << " heap segments, " << heap_dur << ": "
+          << (heap_dur.toMicroseconds()*1000/float(ITERATIONS)) << "ns/segment, "
+          << float(ITERATIONS)/heap_dur.toSeconds() << " segments/s");
+    SILOG(benchmark,info,
+          ITERATIONS << " pooled segments, " << pool_dur << ": "
+          << (pool_dur.toMicroseconds()*1000/float(ITERATIONS)) << "ns/segment, "
+          << float(ITERATIONS)/pool_dur.toSeconds() << " segments/s, "
+          << stats.slabs << " slabs, " << stats.heapAllocations << " heap fallbacks");
+
+    notifyFinished();
+}
+
+void SSTBufferPoolBenchmark::stop() {
+    mForceStop = true;
+}
+
+
+} // namespace Sirikata
@@ -0,0 +1,37 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SST_BUFFER_POOL_BENCHMARK_HPP_
+#define _SIRIKATA_SST_BUFFER_POOL_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** Compare the cost of SST segment buffer management using plain heap
+ *  allocations (new[] + memcpy, owned by a shared_ptr) with the pooled
+ *  BufferSlices used by SST::BufferPool.
+ */
+class SSTBufferPoolBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& _param) {
+        return new SSTBufferPoolBenchmark(finished_cb);
+    }
+
+    SSTBufferPoolBenchmark(const FinishedCallback& finished_cb);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    bool mForceStop;
+}; // class SSTBufferPoolBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SST_BUFFER_POOL_BENCHMARK_HPP_
@@ -0,0 +1,167 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "SSTConnectStressBenchmark.hpp"
+#include "SSTLink.hpp"
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOWork.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+// The server just accepts connections and lets the client tear them down
+void acceptConnection(int err, SSTLink::Stream::Ptr s) {
+}
+
+}
+
+SSTConnectStressBenchmark::SSTConnectStressBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mListenPort(1),
+          mOutstanding(0),
+          mSucceeded(0),
+          mFailed(0)
+{
+    OptionValue* threads;
+    OptionValue* ioThreads;
+    OptionValue* connections;
+    OptionValue* window;
+    Sirikata::InitializeClassOptions ico("SSTConnectStressBenchmark",this,
+        threads=new OptionValue("threads","4",Sirikata::OptionValueType<uint32>(),"Number of threads opening connections"),
+        ioThreads=new OptionValue("io-threads","4",Sirikata::OptionValueType<uint32>(),"Number of threads handling packets and timers"),
+        connections=new OptionValue("connections","1000",Sirikata::OptionValueType<uint32>(),"Number of connections each thread opens and closes"),
+        window=new OptionValue("window","32",Sirikata::OptionValueType<uint32>(),"Number of connection attempts each thread keeps outstanding"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("SSTConnectStressBenchmark",this);
+    optionsSet->parse(param);
+
+    mThreads = threads->as<uint32>();
+    mIOThreads = ioThreads->as<uint32>();
+    mConnections = connections->as<uint32>();
+    mWindow = window->as<uint32>();
+}
+
+String SSTConnectStressBenchmark::name() {
+    return "sst-connect-stress";
+}
+
+void SSTConnectStressBenchmark::handleConnected(int err, StreamPtr s) {
+    if (err == SST_IMPL_SUCCESS) {
+        // Forcing the close tears down the stream and its connection right
+        // away, removing them from the connection tables.
+        std::tr1::shared_ptr<SST::Connection<SSTLink::ID> > conn = s->connection().lock();
+        s->close(true);
+        if (conn) conn->close(true);
+    }
+
+    boost::mutex::scoped_lock lock(mMutex);
+    if (err == SST_IMPL_SUCCESS)
+        mSucceeded++;
+    else
+        mFailed++;
+    mOutstanding--;
+    mCond.notify_all();
+}
+
+void SSTConnectStressBenchmark::connectLoop(ConnectionManager* conn_mgr, uint32 client) {
+    SSTLink::ID client_id(client);
+    for(uint32 i = 0; i < mConnections && !mForceStop; i++) {
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            while(mOutstanding >= mWindow * mThreads && !mForceStop)
+                mCond.wait(lock);
+            mOutstanding++;
+        }
+
+        bool started = conn_mgr->connectStream(
+            SSTLink::Endpoint(client_id, 0),
+            SSTLink::Endpoint(SSTLink::ID(1), mListenPort),
+            std::tr1::bind(&SSTConnectStressBenchmark::handleConnected, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2)
+        );
+        if (!started) {
+            boost::mutex::scoped_lock lock(mMutex);
+            mFailed++;
+            mOutstanding--;
+        }
+    }
+}
+
+void SSTConnectStressBenchmark::start() {
+    mForceStop = false;
+    mOutstanding = 0;
+    mSucceeded = 0;
+    mFailed = 0;
+
+    Network::IOService* ios = new Network::IOService("SSTConnectStressBenchmark");
+    Network::IOStrand* strand = ios->createStrand("SSTConnectStressBenchmark Main");
+    Network::IOWork* work = new Network::IOWork(*ios, "SSTConnectStressBenchmark IOWork");
+    Context* ctx = new Context("SSTConnectStressBenchmark", ios, strand, NULL, Timer::now());
+
+    // An effectively unlimited, zero delay link so connection handling
+    // dominates.
+    SSTLink::Link* link = new SSTLink::Link(ctx, Duration::zero(), 0, 1 << 30, 0);
+    link->setParallelDelivery(true);
+    ConnectionManager* conn_mgr = new ConnectionManager();
+    ctx->add(ctx);
+    ctx->add(conn_mgr);
+
+    SSTLink::ID server(1);
+    conn_mgr->createDatagramLayer(server, ctx, link);
+    // Each thread connects from its own endpoint, as separate objects would
+    for(uint32 i = 0; i < mThreads; i++)
+        conn_mgr->createDatagramLayer(SSTLink::ID(2 + i), ctx, link);
+
+    ctx->run(mIOThreads, Context::AllNew);
+
+    conn_mgr->listen(
+        std::tr1::bind(&acceptConnection, std::tr1::placeholders::_1, std::tr1::placeholders::_2),
+        SSTLink::Endpoint(server, mListenPort)
+    );
+
+    Time start_time = Timer::now();
+    boost::thread_group threads;
+    for(uint32 i = 0; i < mThreads; i++)
+        threads.create_thread(std::tr1::bind(&SSTConnectStressBenchmark::connectLoop, this, conn_mgr, 2 + i));
+    threads.join_all();
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        while(mOutstanding > 0 && !mForceStop)
+            mCond.wait(lock);
+    }
+    Time end_time = Timer::now();
+
+    if (!mForceStop) {
+        Duration dur = end_time - start_time;
+        SILOG(benchmark,info,
+              mSucceeded << " connections (" << mFailed << " failed) from "
+              << mThreads << " threads with " << mIOThreads << " IO threads: "
+              << dur << ", " << (mSucceeded / dur.toSeconds()) << " connections/s");
+    }
+
+    delete work;
+    ctx->shutdown();
+    delete ctx;
+    delete strand;
+    delete ios;
+    // As in the SST tests, these must come after the IOService is gone since
+    // queued handlers may still reference them.
+    delete conn_mgr;
+    delete link;
+
+    if (!mForceStop)
+        notifyFinished();
+}
+
+void SSTConnectStressBenchmark::stop() {
+    mForceStop = true;
+    boost::mutex::scoped_lock lock(mMutex);
+    mCond.notify_all();
+}
+
+} // namespace Sirikata
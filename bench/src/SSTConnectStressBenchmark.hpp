@@ -0,0 +1,68 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SST_CONNECT_STRESS_BENCHMARK_HPP_
+#define _SIRIKATA_SST_CONNECT_STRESS_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+
+namespace SSTLink {
+class ID;
+}
+namespace SST {
+template <class EndPointType> class ConnectionManager;
+template <class EndPointType> class Stream;
+}
+
+/** SSTConnectStressBenchmark opens and tears down many short lived SST
+ *  connections from several threads at once over a simulated link, with
+ *  packets handled by a pool of IO threads. It reports connections/sec,
+ *  which is mostly limited by contention on the connection tables, e.g.
+ *
+ *    bench sst-connect-stress "--threads=8 --io-threads=8 --connections=2000"
+ */
+class SSTConnectStressBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new SSTConnectStressBenchmark(finished_cb, param);
+    }
+
+    SSTConnectStressBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    typedef SST::ConnectionManager<SSTLink::ID> ConnectionManager;
+    typedef std::tr1::shared_ptr<SST::Stream<SSTLink::ID> > StreamPtr;
+
+    void connectLoop(ConnectionManager* conn_mgr, uint32 client);
+    void handleConnected(int err, StreamPtr s);
+
+    bool mForceStop;
+
+    uint32 mThreads;
+    uint32 mIOThreads;
+    uint32 mConnections; // per thread
+    uint32 mWindow; // outstanding connection attempts per thread
+    uint32 mListenPort;
+
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    uint32 mOutstanding;
+    uint32 mSucceeded;
+    uint32 mFailed;
+}; // class SSTConnectStressBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SST_CONNECT_STRESS_BENCHMARK_HPP_
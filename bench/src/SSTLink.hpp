@@ -0,0 +1,303 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_BENCH_SST_LINK_HPP_
+#define _SIRIKATA_BENCH_SST_LINK_HPP_
+
+#include <sirikata/core/network/SSTImpl.hpp>
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/util/Random.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+// A simulated, in-process link for running SST in benchmarks, along with the
+// BaseDatagramLayer specialization that lets SST use it.
+
+namespace Sirikata {
+
+namespace SSTLink {
+
+// Endpoints on the simulated link are just numbered
+class ID {
+public:
+    ID()
+     : mID(0)
+    {}
+    ID(uint32 id)
+     : mID(id)
+    {}
+
+    String toString() const { return boost::lexical_cast<String>(mID); }
+
+    bool operator<(const ID& rhs) const { return mID < rhs.mID; }
+    bool operator==(const ID& rhs) const { return mID == rhs.mID; }
+    bool operator!=(const ID& rhs) const { return mID != rhs.mID; }
+    class Hasher {
+    public:
+        size_t operator()(const ID& objr) const {
+            return std::tr1::hash<uint32>()(objr.mID);
+        }
+    };
+
+private:
+    uint32 mID;
+};
+
+typedef Sirikata::SST::EndPoint<ID> Endpoint;
+typedef Sirikata::SST::Stream<ID> Stream;
+typedef Sirikata::SST::ConnectionManager<ID> ConnectionManager;
+
+/** A simulated link between endpoints. Each sender gets its own pipe with the
+ *  given bandwidth and propagation delay, fronted by a drop-tail queue, and
+ *  packets are additionally dropped at random at the given rate.
+ */
+class Link {
+public:
+    typedef std::tr1::function<void(const ID&, const ObjectMessagePort, const ID, const ObjectMessagePort, void* , uint32)> DatagramCallback;
+
+    Link(Context* ctx, const Duration& delay, float32 loss, uint32 bandwidth, uint32 queue_size)
+     : mContext(ctx),
+       mDelay(delay),
+       mLoss(loss),
+       mBandwidth(bandwidth),
+       mQueueSize(queue_size),
+       mParallelDelivery(false)
+    {}
+
+    /** By default packets are delivered on the Context's main strand. With
+     *  parallel delivery they're posted directly to the IOService instead,
+     *  so they are handled concurrently by all of its threads, as they would
+     *  be when arriving from multiple sockets.
+     */
+    void setParallelDelivery(bool parallel) {
+        mParallelDelivery = parallel;
+    }
+
+    void listen(const ID& ep, ObjectMessagePort port, DatagramCallback cb) {
+        boost::mutex::scoped_lock lock(mMutex);
+        mHandlers[ep][port] = cb;
+    }
+    void unlisten(const ID& ep, ObjectMessagePort port) {
+        boost::mutex::scoped_lock lock(mMutex);
+        mHandlers[ep].erase(port);
+    }
+
+    ObjectMessagePort unused(const ID& ep) {
+        boost::mutex::scoped_lock lock(mMutex);
+        PortHandlerMap& handlers = mHandlers[ep];
+        ObjectMessagePort idx = 1;
+        while(handlers.find(idx) != handlers.end())
+            idx++;
+        return idx;
+    }
+
+    void send(const ID& src, const ObjectMessagePort src_port, const ID dst, const ObjectMessagePort dst_port, void* payload, uint32 payload_size) {
+        if (mLoss > 0 && randFloat() < mLoss)
+            return;
+
+        Time now = Timer::now();
+        Time deliver_time = now;
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            Pipe& pipe = mPipes[src];
+            if (mQueueSize > 0 && pipe.queued >= mQueueSize)
+                return;
+            pipe.queued++;
+
+            Time start = std::max(now, pipe.busyUntil);
+            pipe.busyUntil = start + Duration::seconds(payload_size / (double)mBandwidth);
+            deliver_time = pipe.busyUntil + mDelay;
+        }
+
+        Network::IOCallback deliver_cb = std::tr1::bind(&Link::deliver, this,
+            src, src_port,
+            dst, dst_port,
+            String((char*)payload, payload_size)
+        );
+        if (mParallelDelivery)
+            mContext->ioService->post(deliver_time - now, deliver_cb);
+        else
+            mContext->mainStrand->post(deliver_time - now, deliver_cb);
+    }
+
+private:
+    void deliver(const ID& src, const ObjectMessagePort src_port, const ID dst, const ObjectMessagePort dst_port, String payload) {
+        DatagramCallback cb;
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            mPipes[src].queued--;
+
+            EndpointMap::iterator ep_it = mHandlers.find(dst);
+            if (ep_it == mHandlers.end()) return;
+            PortHandlerMap::iterator port_it = ep_it->second.find(dst_port);
+            if (port_it == ep_it->second.end()) return;
+            cb = port_it->second;
+        }
+        cb(src, src_port, dst, dst_port, (void*)payload.c_str(), payload.size());
+    }
+
+    Context* mContext;
+
+    Duration mDelay;
+    float32 mLoss;
+    uint32 mBandwidth;
+    uint32 mQueueSize;
+    bool mParallelDelivery;
+
+    boost::mutex mMutex;
+
+    typedef std::map<ObjectMessagePort, DatagramCallback> PortHandlerMap;
+    typedef std::map<ID, PortHandlerMap> EndpointMap;
+    EndpointMap mHandlers;
+
+    struct Pipe {
+        Pipe()
+         : busyUntil(Time::null()),
+           queued(0)
+        {}
+        Time busyUntil;
+        uint32 queued;
+    };
+    typedef std::map<ID, Pipe> PipeMap;
+    PipeMap mPipes;
+};
+
+} // namespace SSTLink
+
+namespace SST {
+
+template <>
+class BaseDatagramLayer<SSTLink::ID>
+{
+  private:
+    typedef SSTLink::ID EndPointType;
+
+  public:
+    typedef std::tr1::shared_ptr<BaseDatagramLayer<EndPointType> > Ptr;
+    typedef Ptr BaseDatagramLayerPtr;
+
+    typedef std::tr1::function<void(void*, int)> DataCallback;
+
+    static BaseDatagramLayerPtr getDatagramLayer(ConnectionVariables<EndPointType>* sstConnVars,
+                                                 EndPointType endPoint)
+    {
+        return sstConnVars->getDatagramLayer(endPoint);
+    }
+
+    static BaseDatagramLayerPtr createDatagramLayer(
+        ConnectionVariables<EndPointType>* sstConnVars,
+        EndPointType endPoint,
+        const Context* ctx,
+        SSTLink::Link* link)
+    {
+        BaseDatagramLayerPtr datagramLayer = getDatagramLayer(sstConnVars, endPoint);
+        if (datagramLayer) return datagramLayer;
+
+        datagramLayer = BaseDatagramLayerPtr(
+            new BaseDatagramLayer(sstConnVars, ctx, link, endPoint)
+        );
+        sstConnVars->addDatagramLayer(endPoint, datagramLayer);
+
+        return datagramLayer;
+    }
+
+    static void stopListening(ConnectionVariables<EndPointType>* sstConnVars, EndPoint<EndPointType>& listeningEndPoint) {
+        EndPointType endPointID = listeningEndPoint.endPoint;
+
+        BaseDatagramLayerPtr bdl = sstConnVars->getDatagramLayer(endPointID);
+        if (!bdl) return;
+        sstConnVars->removeDatagramLayer(endPointID, true);
+        bdl->unlisten(listeningEndPoint);
+    }
+
+    void listenOn(EndPoint<EndPointType>& listeningEndPoint, DataCallback cb) {
+        mLink->listen(
+            listeningEndPoint.endPoint, listeningEndPoint.port,
+            std::tr1::bind(
+                &BaseDatagramLayer::receiveMessageToCallback, this,
+                std::tr1::placeholders::_1,
+                std::tr1::placeholders::_2,
+                std::tr1::placeholders::_3,
+                std::tr1::placeholders::_4,
+                std::tr1::placeholders::_5,
+                std::tr1::placeholders::_6,
+                cb
+            )
+        );
+    }
+
+    void listenOn(const EndPoint<EndPointType>& listeningEndPoint) {
+        mLink->listen(
+            listeningEndPoint.endPoint, listeningEndPoint.port,
+            std::tr1::bind(
+                &BaseDatagramLayer::receiveMessage, this,
+                std::tr1::placeholders::_1,
+                std::tr1::placeholders::_2,
+                std::tr1::placeholders::_3,
+                std::tr1::placeholders::_4,
+                std::tr1::placeholders::_5,
+                std::tr1::placeholders::_6
+            )
+        );
+    }
+
+    void unlisten(EndPoint<EndPointType>& ep) {
+        mLink->unlisten(ep.endPoint, ep.port);
+    }
+
+    void send(EndPoint<EndPointType>* src, EndPoint<EndPointType>* dest, void* data, int len) {
+        mLink->send(
+            src->endPoint, src->port,
+            dest->endPoint, dest->port,
+            data, len
+        );
+    }
+
+    const Context* context() {
+        return mContext;
+    }
+
+    uint32 getUnusedPort(const EndPointType& ep) {
+        return mLink->unused(ep);
+    }
+
+    void invalidate() {
+        mLink = NULL;
+        mSSTConnVars->removeDatagramLayer(mEndpoint, true);
+    }
+
+  private:
+    BaseDatagramLayer(ConnectionVariables<EndPointType>* sstConnVars, const Context* ctx, SSTLink::Link* link, const EndPointType&ep)
+        : mContext(ctx),
+          mLink(link),
+          mSSTConnVars(sstConnVars),
+          mEndpoint(ep)
+        {
+        }
+
+    void receiveMessage(const SSTLink::ID& src, const ObjectMessagePort src_port, const SSTLink::ID dst, const ObjectMessagePort dst_port, void* payload, uint32 payload_size) {
+        Connection<EndPointType>::handleReceive(
+            mSSTConnVars,
+            EndPoint<EndPointType> (src, src_port),
+            EndPoint<EndPointType> (dst, dst_port),
+            payload, payload_size
+        );
+    }
+
+    void receiveMessageToCallback(const SSTLink::ID& src, const ObjectMessagePort src_port, const SSTLink::ID dst, const ObjectMessagePort dst_port, void* payload, uint32 payload_size, DataCallback cb) {
+        cb(payload, payload_size );
+    }
+
+    const Context* mContext;
+    SSTLink::Link* mLink;
+
+    ConnectionVariables<EndPointType>* mSSTConnVars;
+    EndPointType mEndpoint;
+};
+
+} // namespace SST
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_BENCH_SST_LINK_HPP_
@@ -0,0 +1,214 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "SSTLinkBenchmark.hpp"
+#include "SSTLink.hpp"
+#include <sirikata/core/network/IOService.hpp>
+#include <sirikata/core/network/IOWork.hpp>
+#include <sirikata/core/options/Options.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+void listenForData(SSTLink::Stream::ReadCallback read_cb, int err, SSTLink::Stream::Ptr s) {
+    if (err != SST_IMPL_SUCCESS) return;
+    s->registerReadCallback(read_cb);
+}
+
+// Keeps writing until the entire payload has been accepted by the stream,
+// backing off briefly whenever its buffer is full.
+void writeData(Context* ctx, SSTLink::Stream::Ptr s, const String* payload, uint32 from) {
+    from += s->write((const uint8*)payload->data() + from, payload->size() - from);
+    if (from == payload->size()) return;
+    ctx->mainStrand->post(
+        Duration::milliseconds(1),
+        std::tr1::bind(&writeData, ctx, s, payload, from)
+    );
+}
+
+void sendData(Context* ctx, const String* payload, int err, SSTLink::Stream::Ptr s) {
+    if (err != SST_IMPL_SUCCESS) {
+        SILOG(benchmark,error,"SST connection over simulated link failed");
+        return;
+    }
+    writeData(ctx, s, payload, 0);
+}
+
+}
+
+SSTLinkBenchmark::SSTLinkBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false),
+          mBytesReceived(0),
+          mFirstReadTime(Time::null()),
+          mFinished(false)
+{
+    OptionValue* congestionControl;
+    OptionValue* delay;
+    OptionValue* loss;
+    OptionValue* bandwidth;
+    OptionValue* queueSize;
+    OptionValue* bytes;
+    OptionValue* fastRetransmit;
+    OptionValue* lossSweep;
+    Sirikata::InitializeClassOptions ico("SSTLinkBenchmark",this,
+        congestionControl=new OptionValue("congestion-control","reno",Sirikata::OptionValueType<String>(),"SST congestion control algorithm: reno, cubic or delay"),
+        delay=new OptionValue("delay","10ms",Sirikata::OptionValueType<Duration>(),"One way propagation delay of the link"),
+        loss=new OptionValue("loss","0",Sirikata::OptionValueType<float32>(),"Fraction of packets dropped at random"),
+        bandwidth=new OptionValue("bandwidth","10000000",Sirikata::OptionValueType<uint32>(),"Link bandwidth, in bytes per second"),
+        queueSize=new OptionValue("queue-size","100",Sirikata::OptionValueType<uint32>(),"Packets buffered at the link before tail drops, 0 for unlimited"),
+        bytes=new OptionValue("bytes","10000000",Sirikata::OptionValueType<uint32>(),"Number of bytes to transfer"),
+        fastRetransmit=new OptionValue("fast-retransmit","true",Sirikata::OptionValueType<bool>(),"Retransmit segments on duplicate acks instead of waiting for the retransmission timeout"),
+        lossSweep=new OptionValue("loss-sweep","false",Sirikata::OptionValueType<bool>(),"Ignore loss and fast-retransmit, compare fast retransmit against timeouts only at 1%, 5% and 10% loss"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("SSTLinkBenchmark",this);
+    optionsSet->parse(param);
+
+    mCongestionControl = congestionControl->as<String>();
+    mDelay = delay->as<Duration>();
+    mLoss = loss->as<float32>();
+    mBandwidth = bandwidth->as<uint32>();
+    mQueueSize = queueSize->as<uint32>();
+    mBytes = bytes->as<uint32>();
+    mFastRetransmit = fastRetransmit->as<bool>();
+    mLossSweep = lossSweep->as<bool>();
+}
+
+String SSTLinkBenchmark::name() {
+    return "sst-link";
+}
+
+void SSTLinkBenchmark::handleRead(uint8* data, int size) {
+    boost::mutex::scoped_lock lock(mMutex);
+    if (mFirstReadTime == Time::null())
+        mFirstReadTime = Timer::now();
+    mBytesReceived += size;
+    if (mBytesReceived >= mBytes) {
+        mFinished = true;
+        mFinishedCond.notify_all();
+    }
+}
+
+void SSTLinkBenchmark::markFinished() {
+    boost::mutex::scoped_lock lock(mMutex);
+    mFinished = true;
+    mFinishedCond.notify_all();
+}
+
+Duration SSTLinkBenchmark::run(float32 loss, bool fast_retransmit) {
+    mFinished = false;
+    mBytesReceived = 0;
+    mFirstReadTime = Time::null();
+
+    String payload;
+    payload.resize(mBytes);
+    for(uint32 i = 0; i < mBytes; i++)
+        payload[i] = ('a' + (i % 26));
+
+    Network::IOService* ios = new Network::IOService("SSTLinkBenchmark");
+    Network::IOStrand* strand = ios->createStrand("SSTLinkBenchmark Main");
+    Network::IOWork* work = new Network::IOWork(*ios, "SSTLinkBenchmark IOWork");
+    Context* ctx = new Context("SSTLinkBenchmark", ios, strand, NULL, Timer::now());
+
+    SSTLink::Link* link = new SSTLink::Link(ctx, mDelay, loss, mBandwidth, mQueueSize);
+    SSTLink::ConnectionManager* conn_mgr = new SSTLink::ConnectionManager();
+    conn_mgr->setCongestionControl(mCongestionControl);
+    conn_mgr->setFastRetransmit(fast_retransmit);
+    ctx->add(ctx);
+    ctx->add(conn_mgr);
+
+    SSTLink::ID sender(1), receiver(2);
+    conn_mgr->createDatagramLayer(sender, ctx, link);
+    conn_mgr->createDatagramLayer(receiver, ctx, link);
+
+    ctx->run(1, Context::AllNew);
+
+    Time start_time = Timer::now();
+    conn_mgr->listen(
+        std::tr1::bind(&listenForData,
+            SSTLink::Stream::ReadCallback(std::tr1::bind(&SSTLinkBenchmark::handleRead, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2)),
+            std::tr1::placeholders::_1, std::tr1::placeholders::_2),
+        SSTLink::Endpoint(receiver, 1)
+    );
+    conn_mgr->connectStream(
+        SSTLink::Endpoint(sender, 1),
+        SSTLink::Endpoint(receiver, 1),
+        std::tr1::bind(&sendData, ctx, &payload, std::tr1::placeholders::_1, std::tr1::placeholders::_2)
+    );
+
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        while(!mFinished)
+            mFinishedCond.wait(lock);
+    }
+    Time end_time = Timer::now();
+
+    Duration dur = Duration::zero();
+    if (!mForceStop) {
+        dur = end_time - start_time;
+        SILOG(benchmark,info,
+              mBytes << " bytes with " << mCongestionControl
+              << (fast_retransmit ? "" : " (no fast retransmit)") << " over "
+              << mBandwidth << " B/s, " << mDelay << " delay, " << loss << " loss link: "
+              << dur << ", " << (mBytes / dur.toSeconds()) << " B/s, "
+              << "first data after " << (mFirstReadTime - start_time));
+
+        SSTLink::ConnectionManager::ConnectionStatsList stats = conn_mgr->getConnectionStats();
+        for(uint32 i = 0; i < stats.size(); i++) {
+            const SST::ConnectionStats& cs = stats[i].second;
+            SILOG(benchmark,info,
+                  "Connection to " << stats[i].first.toString() << ": "
+                  << "cwnd " << cs.cwnd << ", ssthresh " << cs.ssthresh
+                  << ", rtt " << cs.rtt << ", rto " << cs.rto
+                  << ", sent " << cs.segmentsSent
+                  << ", fast retransmits " << cs.fastRetransmits
+                  << ", timeouts " << cs.timeouts);
+        }
+    }
+
+    delete work;
+    ctx->shutdown();
+    delete ctx;
+    delete strand;
+    delete ios;
+    // As in the SST tests, these must come after the IOService is gone since
+    // queued handlers may still reference them.
+    delete conn_mgr;
+    delete link;
+
+    return dur;
+}
+
+void SSTLinkBenchmark::start() {
+    mForceStop = false;
+
+    if (!mLossSweep) {
+        run(mLoss, mFastRetransmit);
+    }
+    else {
+        float32 losses[] = { 0.01f, 0.05f, 0.10f };
+        for(uint32 i = 0; i < sizeof(losses)/sizeof(losses[0]) && !mForceStop; i++) {
+            Duration with_fr = run(losses[i], true);
+            if (mForceStop) break;
+            Duration without_fr = run(losses[i], false);
+            if (mForceStop) break;
+            SILOG(benchmark,info,
+                  (losses[i] * 100) << "% loss: fast retransmit " << with_fr
+                  << ", timeouts only " << without_fr << ", "
+                  << (without_fr / with_fr) << "x faster with fast retransmit");
+        }
+    }
+
+    if (!mForceStop)
+        notifyFinished();
+}
+
+void SSTLinkBenchmark::stop() {
+    mForceStop = true;
+    markFinished();
+}
+
+} // namespace Sirikata
@@ -0,0 +1,73 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SST_LINK_BENCHMARK_HPP_
+#define _SIRIKATA_SST_LINK_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace Sirikata {
+
+namespace SSTLink {
+class Link;
+}
+
+/** SSTLinkBenchmark measures SST throughput and latency over a simulated link
+ *  with configurable bandwidth, delay, loss and queue size, using the
+ *  selected congestion control algorithm. Unlike the ping benchmark, which
+ *  runs over a real stream plugin (tcpsst), this exercises SST's own
+ *  reliability and congestion control, e.g.
+ *
+ *    bench sst-link "--congestion-control=cubic --delay=50ms --loss=0.01"
+ *
+ *  With --loss-sweep, it instead transfers at 1%, 5% and 10% random loss,
+ *  each with and without fast retransmit, and reports how much faster the
+ *  transfer completes with it.
+ */
+class SSTLinkBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new SSTLinkBenchmark(finished_cb, param);
+    }
+
+    SSTLinkBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    // Transfer mBytes over a new link, returning the time it took or
+    // Duration::zero() if stopped.
+    Duration run(float32 loss, bool fast_retransmit);
+    void handleRead(uint8* data, int size);
+    void markFinished();
+
+    bool mForceStop;
+
+    String mCongestionControl;
+    Duration mDelay;
+    float32 mLoss;
+    bool mFastRetransmit;
+    bool mLossSweep;
+    uint32 mBandwidth; // bytes/s
+    uint32 mQueueSize; // packets
+    uint32 mBytes;
+
+    uint32 mBytesReceived;
+    Time mFirstReadTime;
+
+    boost::mutex mMutex;
+    boost::condition_variable mFinishedCond;
+    bool mFinished;
+}; // class SSTLinkBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SST_LINK_BENCHMARK_HPP_
@@ -41,6 +41,8 @@
 #include <sirikata/core/util/Timer.hpp>
 #include <sirikata/core/options/Options.hpp>
 #include <sirikata/core/util/PluginManager.hpp>
+#include <sirikata/core/util/Base64.hpp>
+#include <boost/lexical_cast.hpp>
 #define ITERATIONS 1000000
 
 namespace Sirikata {
@@ -249,4 +251,249 @@ void SSTBenchmark::stop() {
 }
 
 
+namespace {
+
+// The framing modes compared by TCPSSTThroughputBenchmark and the stream
+// options which select them
+const uint32 NumFramingModes = 2;
+const char* FramingModeNames[NumFramingModes] = { "websocket", "binary" };
+const char* FramingModeOptions[NumFramingModes] = { "", " --binary-framing=true" };
+
+const char* SimpleAlphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// Straightforward codec, one character at a time, for comparison
+size_t simpleEncode(uint8* dest, const uint8* src, size_t len) {
+    uint8* out = dest;
+    size_t i = 0;
+    for(; i + 3 <= len; i += 3) {
+        *out++ = SimpleAlphabet[src[i] >> 2];
+        *out++ = SimpleAlphabet[((src[i] & 0x3) << 4) | (src[i+1] >> 4)];
+        *out++ = SimpleAlphabet[((src[i+1] & 0xF) << 2) | (src[i+2] >> 6)];
+        *out++ = SimpleAlphabet[src[i+2] & 0x3F];
+    }
+    if (i < len) {
+        uint8 b1 = (i + 1 < len) ? src[i+1] : 0;
+        *out++ = SimpleAlphabet[src[i] >> 2];
+        *out++ = SimpleAlphabet[((src[i] & 0x3) << 4) | (b1 >> 4)];
+        if (i + 1 < len)
+            *out++ = SimpleAlphabet[(b1 & 0xF) << 2];
+    }
+    return out - dest;
+}
+
+size_t simpleDecode(uint8* dest, const uint8* src, size_t len) {
+    uint8* out = dest;
+    uint32 accum = 0;
+    uint32 bits = 0;
+    for(size_t i = 0; i < len; i++) {
+        const char* pos = strchr(SimpleAlphabet, src[i]);
+        if (pos == NULL || *pos == 0) break;
+        accum = (accum << 6) | (uint32)(pos - SimpleAlphabet);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            *out++ = (uint8)(accum >> bits);
+        }
+    }
+    return out - dest;
+}
+
+double megabytesPerSecond(size_t bytes, const Duration& dur) {
+    return (bytes / (1024.0*1024.0)) / std::max(dur.toSeconds(), 1e-9);
+}
+
+} // namespace
+
+TCPSSTThroughputBenchmark::TCPSSTThroughputBenchmark(const FinishedCallback& finished_cb, const String&param)
+ : Benchmark(finished_cb),
+   mForceStop(false),
+   mIOService(NULL),
+   mIOStrand(NULL),
+   mStream(NULL),
+   mMode(0),
+   mSent(0),
+   mReceived(0),
+   mModeStart(Time::epoch())
+{
+    OptionValue* port;
+    OptionValue* messageSize;
+    OptionValue* numMessages;
+    OptionValue* codecBytes;
+    OptionValue* streamOptions;
+    Sirikata::InitializeClassOptions ico("TCPSSTThroughputBenchmark",this,
+        port=new OptionValue("port","4092",Sirikata::OptionValueType<uint32>(),"First port to listen on, one port is used per framing mode"),
+        messageSize=new OptionValue("message-size","1024",Sirikata::OptionValueType<size_t>(),"Size of each message"),
+        numMessages=new OptionValue("messages","100000",Sirikata::OptionValueType<uint32>(),"Number of messages to send with each framing mode"),
+        codecBytes=new OptionValue("codec-bytes","67108864",Sirikata::OptionValueType<uint32>(),"Number of bytes to run through each base64 codec"),
+        streamOptions=new OptionValue("stream-options","--send-buffer-size=32768 --parallel-sockets=1 --no-delay=true",Sirikata::OptionValueType<String>(),"options passed to tcpsst"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("TCPSSTThroughputBenchmark",this);
+    optionsSet->parse(param);
+
+    mPort = port->as<uint32>();
+    mMessageSize = std::max(messageSize->as<size_t>(), (size_t)1);
+    mNumMessages = numMessages->as<uint32>();
+    mCodecBytes = codecBytes->as<uint32>();
+    mStreamOptions = streamOptions->as<String>();
+
+    mMessage.resize(mMessageSize);
+    for(size_t i = 0; i < mMessageSize; i++)
+        mMessage[i] = (uint8)(i * 131 + 7);
+}
+
+String TCPSSTThroughputBenchmark::name() {
+    return "tcpsst-throughput";
+}
+
+void TCPSSTThroughputBenchmark::benchmarkCodec() {
+    // Encode packet sized buffers, as the base64 framing would
+    std::vector<uint8> src(mMessageSize);
+    for(size_t i = 0; i < src.size(); i++)
+        src[i] = (uint8)(i * 131 + 7);
+    std::vector<uint8> encoded(Base64::encodedLength(src.size(), false) + 4);
+    std::vector<uint8> decoded(Base64::decodedLength(encoded.size()) + 4);
+    uint32 iterations = std::max(mCodecBytes / (uint32)mMessageSize, (uint32)1);
+    size_t total = (size_t)iterations * mMessageSize;
+
+    size_t encoded_size = 0, decoded_size = 0;
+    Time start = Timer::now();
+    for(uint32 i = 0; i < iterations && !mForceStop; i++)
+        encoded_size = simpleEncode(&encoded[0], &src[0], src.size());
+    Time mid = Timer::now();
+    for(uint32 i = 0; i < iterations && !mForceStop; i++)
+        decoded_size = simpleDecode(&decoded[0], &encoded[0], encoded_size);
+    Time end = Timer::now();
+    if (decoded_size != src.size() || memcmp(&decoded[0], &src[0], src.size()) != 0)
+        SILOG(benchmark,error,"Simple base64 codec round trip failed");
+    SILOG(benchmark,info,"Simple base64: encode " << megabytesPerSecond(total, mid - start) << " MB/s, decode " << megabytesPerSecond(total, end - mid) << " MB/s");
+
+    start = Timer::now();
+    for(uint32 i = 0; i < iterations && !mForceStop; i++)
+        encoded_size = Base64::encode(&encoded[0], &src[0], src.size(), Base64::URLSafeAlphabet, false);
+    mid = Timer::now();
+    for(uint32 i = 0; i < iterations && !mForceStop; i++)
+        Base64::decode(&decoded[0], &decoded_size, &encoded[0], encoded_size);
+    end = Timer::now();
+    if (decoded_size != src.size() || memcmp(&decoded[0], &src[0], src.size()) != 0)
+        SILOG(benchmark,error,"Base64 codec round trip failed");
+    SILOG(benchmark,info,"Table base64: encode " << megabytesPerSecond(total, mid - start) << " MB/s, decode " << megabytesPerSecond(total, end - mid) << " MB/s");
+    SILOG(benchmark,info,"Base64 framing inflates each " << src.size() << " byte message to " << encoded_size << " bytes");
+}
+
+void TCPSSTThroughputBenchmark::startMode() {
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+
+    mSent = 0;
+    mReceived = 0;
+    String port = boost::lexical_cast<String>(mPort + mMode);
+    String options = mStreamOptions + FramingModeOptions[mMode];
+
+    Sirikata::Network::StreamListener* listener =
+        Sirikata::Network::StreamListenerFactory::getSingleton().getConstructor("tcpsst")(mIOStrand,Sirikata::Network::StreamListenerFactory::getSingleton().getOptionParser("tcpsst")(mStreamOptions));
+    mListeners.push_back(listener);
+    listener->listen(Sirikata::Network::Address("127.0.0.1",port),
+        std::tr1::bind(&TCPSSTThroughputBenchmark::newStream,this,_1,_2));
+    listener->start();
+
+    mStream = Sirikata::Network::StreamFactory::getSingleton().getConstructor("tcpsst")(mIOStrand,Sirikata::Network::StreamFactory::getSingleton().getOptionParser("tcpsst")(options));
+    mStreams.push_back(mStream);
+    mStream->connect(Sirikata::Network::Address("127.0.0.1",port),
+        &Sirikata::Network::Stream::ignoreSubstreamCallback,
+        std::tr1::bind(&TCPSSTThroughputBenchmark::connected,this,_1,_2),
+        &Sirikata::Network::Stream::ignoreReceivedCallback,
+        std::tr1::bind(&TCPSSTThroughputBenchmark::sendMore,this));
+}
+
+void TCPSSTThroughputBenchmark::connected(Sirikata::Network::Stream::ConnectionStatus status,const std::string&reason) {
+    if (status == Sirikata::Network::Stream::Connected) {
+        mModeStart = Timer::now();
+        sendMore();
+    }
+    else if (status != Sirikata::Network::Stream::Disconnected) {
+        SILOG(benchmark,error,"Connection failed with " << FramingModeNames[mMode] << " framing: " << reason);
+        stop();
+    }
+}
+
+void TCPSSTThroughputBenchmark::sendMore() {
+    // Fill the send buffer, we'll get a ready send callback when it drains
+    while(mSent < mNumMessages && !mForceStop) {
+        if (!mStream->send(MemoryReference(&mMessage[0], mMessage.size()), Sirikata::Network::ReliableOrdered))
+            break;
+        mSent++;
+    }
+}
+
+void TCPSSTThroughputBenchmark::newStream(Sirikata::Network::Stream*newStream, Sirikata::Network::Stream::SetCallbacks&cb) {
+    if (newStream == NULL) return;
+    mStreams.push_back(newStream);
+    cb(&Sirikata::Network::Stream::ignoreConnectionCallback,
+        std::tr1::bind(&TCPSSTThroughputBenchmark::received,this,std::tr1::placeholders::_1,std::tr1::placeholders::_2),
+        &Sirikata::Network::Stream::ignoreReadySendCallback);
+}
+
+void TCPSSTThroughputBenchmark::received(Sirikata::Network::Chunk&chk, const Sirikata::Network::Stream::PauseReceiveCallback& pause) {
+    if (chk.size() != mMessageSize)
+        SILOG(benchmark,error,"Received " << chk.size() << " byte message, expected " << mMessageSize);
+    if (++mReceived == mNumMessages)
+        finishMode();
+}
+
+void TCPSSTThroughputBenchmark::finishMode() {
+    mModeTimes.push_back(Timer::now() - mModeStart);
+    mStream->close();
+    mListeners.back()->stop();
+
+    mMode++;
+    if (mMode < NumFramingModes && !mForceStop) {
+        startMode();
+        return;
+    }
+
+    for(uint32 i = 0; i < mModeTimes.size(); i++) {
+        double secs = std::max(mModeTimes[i].toSeconds(), 1e-9);
+        SILOG(benchmark,info,FramingModeNames[i] << " framing: " << mNumMessages << " messages of " << mMessageSize << " bytes in " << mModeTimes[i] << ", " << (mNumMessages / secs) << " msgs/s, " << megabytesPerSecond((size_t)mNumMessages * mMessageSize, mModeTimes[i]) << " MB/s");
+    }
+    stop();
+}
+
+void TCPSSTThroughputBenchmark::start() {
+    mForceStop = false;
+    benchmarkCodec();
+
+    static Sirikata::PluginManager pluginManager;
+    pluginManager.load("tcpsst");
+
+    mIOService = new Sirikata::Network::IOService("TCPSSTThroughputBenchmark");
+    mIOStrand = mIOService->createStrand("TCPSSTThroughputBenchmark Main");
+    mMode = 0;
+    mModeTimes.clear();
+    if (mNumMessages > 0 && !mForceStop) {
+        startMode();
+        mIOService->run();
+    }
+
+    for(uint32 i = 0; i < mStreams.size(); i++)
+        delete mStreams[i];
+    mStreams.clear();
+    mStream = NULL;
+    for(uint32 i = 0; i < mListeners.size(); i++)
+        delete mListeners[i];
+    mListeners.clear();
+    delete mIOStrand;
+    mIOStrand = NULL;
+    delete mIOService;
+    mIOService = NULL;
+
+    notifyFinished();
+}
+
+void TCPSSTThroughputBenchmark::stop() {
+    mForceStop = true;
+    if (mIOService)
+        mIOService->stop();
+}
+
 } // namespace Sirikata
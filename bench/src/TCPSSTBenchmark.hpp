@@ -103,6 +103,62 @@ class SSTBenchmark : public Benchmark {
     std::vector<Duration> mPingResponses;
 }; // class TimerSpeedBenchmark
 
+/** Measures bulk one-way throughput over a loopback TCPSST connection, first
+ *  with the default RFC 6455 WebSocket framing and then with the negotiated
+ *  length-prefixed binary framing. Before the network runs it also times the
+ *  base64 codec used by the legacy base64 framing, against a simple
+ *  byte-at-a-time codec, to show what text framing costs.
+ */
+class TCPSSTThroughputBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new TCPSSTThroughputBenchmark(finished_cb,param);
+    }
+
+    TCPSSTThroughputBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    void benchmarkCodec();
+
+    // Start sending with the framing mode mMode
+    void startMode();
+    void finishMode();
+    void connected(Sirikata::Network::Stream::ConnectionStatus,const std::string&reason);
+    void sendMore();
+    void newStream(Sirikata::Network::Stream*newStream, Sirikata::Network::Stream::SetCallbacks&cb);
+    void received(Sirikata::Network::Chunk&chk, const Sirikata::Network::Stream::PauseReceiveCallback& pause);
+
+    bool mForceStop;
+
+    uint32 mPort;
+    size_t mMessageSize;
+    uint32 mNumMessages;
+    uint32 mCodecBytes;
+    String mStreamOptions;
+
+    Sirikata::Network::IOService*mIOService;
+    Sirikata::Network::IOStrand* mIOStrand;
+    // Streams and listeners from completed modes are kept until the
+    // IOService has stopped so none of their callbacks can still be pending
+    std::vector<Sirikata::Network::Stream*> mStreams;
+    std::vector<Sirikata::Network::StreamListener*> mListeners;
+    Sirikata::Network::Stream* mStream;
+
+    uint32 mMode;
+    uint32 mSent;
+    uint32 mReceived;
+    Time mModeStart;
+    std::vector<Duration> mModeTimes;
+    Sirikata::Network::Chunk mMessage;
+}; // class TCPSSTThroughputBenchmark
+
 } // namespace Sirikata
 
 #endif //_SIRIKATA_SST_BENCHMARK_HPP_
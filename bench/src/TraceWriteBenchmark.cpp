@@ -0,0 +1,188 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "TraceWriteBenchmark.hpp"
+#include <sirikata/core/trace/BatchedBuffer.hpp>
+#include <sirikata/core/trace/TraceFormat.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/options/Options.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace Sirikata {
+
+namespace {
+
+// Layout of a timestamp event, e.g. Trace::timestampMessage
+struct TimestampEvent {
+    Time sent;
+    uint64 uid;
+    uint32 path;
+    uint16 srcprt;
+    uint16 dstprt;
+};
+
+// Records a timestamp event exactly as Trace did with a BatchedBuffer: the
+// record header followed by the payload fields, in a single locked write
+void writeBatched(BatchedBuffer* buf, uint16 type_hint, TimestampEvent& evt) {
+    uint32 payload_size = sizeof(evt.sent) + sizeof(evt.uid) + sizeof(evt.path) + sizeof(evt.srcprt) + sizeof(evt.dstprt);
+    const uint32 num_data = 7;
+    BatchedBuffer::IOVec data_vec[num_data] = {
+        BatchedBuffer::IOVec(&payload_size, sizeof(payload_size)),
+        BatchedBuffer::IOVec(&type_hint, sizeof(type_hint)),
+        BatchedBuffer::IOVec(&evt.sent, sizeof(evt.sent)),
+        BatchedBuffer::IOVec(&evt.uid, sizeof(evt.uid)),
+        BatchedBuffer::IOVec(&evt.path, sizeof(evt.path)),
+        BatchedBuffer::IOVec(&evt.srcprt, sizeof(evt.srcprt)),
+        BatchedBuffer::IOVec(&evt.dstprt, sizeof(evt.dstprt))
+    };
+    buf->write(data_vec, num_data);
+}
+
+void writeChunked(Trace::ChunkedTraceBuffer* buf, uint16 type_hint, TimestampEvent& evt) {
+    const uint32 num_data = 5;
+    BatchedBuffer::IOVec data_vec[num_data] = {
+        BatchedBuffer::IOVec(&evt.sent, sizeof(evt.sent)),
+        BatchedBuffer::IOVec(&evt.uid, sizeof(evt.uid)),
+        BatchedBuffer::IOVec(&evt.path, sizeof(evt.path)),
+        BatchedBuffer::IOVec(&evt.srcprt, sizeof(evt.srcprt)),
+        BatchedBuffer::IOVec(&evt.dstprt, sizeof(evt.dstprt))
+    };
+    buf->write(type_hint, evt.sent, data_vec, num_data);
+}
+
+template<typename BufferType>
+void writerMain(BufferType* buf, void (*write)(BufferType*, uint16, TimestampEvent&), uint32 thread_id, uint32 events) {
+    TimestampEvent evt;
+    evt.path = 0;
+    evt.srcprt = 14000;
+    evt.dstprt = 14001;
+    for(uint32 i = 0; i < events; i++) {
+        evt.sent = Timer::now();
+        evt.uid = ((uint64)thread_id << 32) | i;
+        evt.path = i % 8;
+        write(buf, 0, evt);
+    }
+}
+
+// Runs writer threads against the buffer while storing it every 10ms, the
+// way Trace's storage thread does. Returns the time the writers took.
+template<typename BufferType>
+Duration runWriters(BufferType* buf, void (*write)(BufferType*, uint16, TimestampEvent&), uint32 nthreads, uint32 events, FILE* of, Duration* store_dur_out) {
+    Time start = Timer::now();
+    std::vector<Thread*> threads;
+    for(uint32 i = 0; i < nthreads; i++)
+        threads.push_back(
+            new Thread(
+                "TraceWriteBenchmark Writer",
+                std::tr1::bind(&writerMain<BufferType>, buf, write, i, events)
+            )
+        );
+
+    // Store until the writers finish
+    Duration store_dur = Duration::zero();
+    uint32 joined = 0;
+    while(joined < nthreads) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        Time store_start = Timer::now();
+        buf->store(of);
+        store_dur += Timer::now() - store_start;
+        while(joined < nthreads && threads[joined]->timed_join(boost::posix_time::milliseconds(0)))
+            joined++;
+    }
+    Duration write_dur = Timer::now() - start;
+
+    buf->flush();
+    Time store_start = Timer::now();
+    buf->store(of);
+    store_dur += Timer::now() - store_start;
+
+    for(uint32 i = 0; i < nthreads; i++)
+        delete threads[i];
+
+    *store_dur_out = store_dur;
+    return write_dur;
+}
+
+}
+
+TraceWriteBenchmark::TraceWriteBenchmark(const FinishedCallback& finished_cb, const String& param)
+        : Benchmark(finished_cb),
+          mForceStop(false)
+{
+    OptionValue* threads;
+    OptionValue* events;
+    OptionValue* output;
+    Sirikata::InitializeClassOptions ico("TraceWriteBenchmark",this,
+        threads=new OptionValue("threads","4",Sirikata::OptionValueType<uint32>(),"Number of threads recording events"),
+        events=new OptionValue("events","250000",Sirikata::OptionValueType<uint32>(),"Number of events recorded by each thread"),
+        output=new OptionValue("output","/dev/null",Sirikata::OptionValueType<String>(),"File the trace is stored to"),
+        NULL);
+
+    OptionSet* optionsSet = OptionSet::getOptions("TraceWriteBenchmark",this);
+    optionsSet->parse(param);
+
+    mThreads = threads->as<uint32>();
+    mEvents = events->as<uint32>();
+    mOutput = output->as<String>();
+}
+
+String TraceWriteBenchmark::name() {
+    return "trace-write";
+}
+
+void TraceWriteBenchmark::start() {
+    mForceStop = false;
+
+    FILE* of = fopen(mOutput.c_str(), "wb");
+    if (of == NULL) {
+        SILOG(benchmark,error,"Couldn't open " << mOutput << " for trace output");
+        notifyFinished();
+        return;
+    }
+
+    uint64 total_events = (uint64)mThreads * mEvents;
+
+    Duration batched_store_dur;
+    Duration batched_dur;
+    {
+        BatchedBuffer buf;
+        batched_dur = runWriters(&buf, &writeBatched, mThreads, mEvents, of, &batched_store_dur);
+    }
+
+    if (mForceStop) {
+        fclose(of);
+        return;
+    }
+
+    Duration chunked_store_dur;
+    Duration chunked_dur;
+    {
+        Trace::ChunkedTraceBuffer buf;
+        chunked_dur = runWriters(&buf, &writeChunked, mThreads, mEvents, of, &chunked_store_dur);
+    }
+    fclose(of);
+
+    if (mForceStop)
+        return;
+
+    SILOG(benchmark,info,
+          mThreads << " threads each recording " << mEvents << " timestamp events");
+    SILOG(benchmark,info,
+          "BatchedBuffer: " << batched_dur << " recording, "
+          << (batched_dur.toMicroseconds()*1000/float(total_events)) << "ns/event, "
+          << batched_store_dur << " storing");
+    SILOG(benchmark,info,
+          "ChunkedTraceBuffer: " << chunked_dur << " recording, "
+          << (chunked_dur.toMicroseconds()*1000/float(total_events)) << "ns/event, "
+          << chunked_store_dur << " storing");
+
+    notifyFinished();
+}
+
+void TraceWriteBenchmark::stop() {
+    mForceStop = true;
+}
+
+} // namespace Sirikata
@@ -0,0 +1,48 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_TRACE_WRITE_BENCHMARK_HPP_
+#define _SIRIKATA_TRACE_WRITE_BENCHMARK_HPP_
+
+#include "Benchmark.hpp"
+
+namespace Sirikata {
+
+/** Measures the cost of recording trace events from many threads at once,
+ *  as the space server's networking, forwarding and location threads do.
+ *  Each writer thread records timestamp events, the most common kind of
+ *  trace record, while a storage thread periodically writes out whatever has
+ *  been collected.
+ *
+ *  This compares the original BatchedBuffer, where every write takes a shared
+ *  recursive_mutex, with the ChunkedTraceBuffer, where each thread fills its
+ *  own chunks and records are put in time order by the storage thread.
+ */
+class TraceWriteBenchmark : public Benchmark {
+  public:
+    typedef std::tr1::function<void()> FinishedCallback;
+
+    static Benchmark* create(const FinishedCallback& finished_cb, const String& param) {
+        return new TraceWriteBenchmark(finished_cb, param);
+    }
+
+    TraceWriteBenchmark(const FinishedCallback& finished_cb, const String& param);
+
+    virtual String name();
+
+    virtual void start();
+    virtual void stop();
+
+  private:
+    bool mForceStop;
+
+    uint32 mThreads;
+    // Events recorded by each thread
+    uint32 mEvents;
+    String mOutput;
+}; // class TraceWriteBenchmark
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_TRACE_WRITE_BENCHMARK_HPP_
@@ -37,8 +37,23 @@
 #include "TimerMonotonicityBenchmark.hpp"
 #include "TCPSSTBenchmark.hpp"
 #include "UUIDSpeedBenchmark.hpp"
+#include "SSTBufferPoolBenchmark.hpp"
+#include "SSTLinkBenchmark.hpp"
+#include "SSTConnectStressBenchmark.hpp"
+#include "LocUpdateQueueBenchmark.hpp"
+#include "TraceWriteBenchmark.hpp"
+#include "ForwarderShardBenchmark.hpp"
+#include "MPSCQueueBenchmark.hpp"
+#include "OSegCacheReplayBenchmark.hpp"
+#include "SQLiteStorageBenchmark.hpp"
+#include "MeshSimplifierBenchmark.hpp"
+#include "HttpPipeliningBenchmark.hpp"
+#ifdef HAVE_BULLET
+#include "BulletPhysicsBenchmark.hpp"
+#endif
 
 #include <sirikata/core/util/DynamicLibrary.hpp>
+#include <sirikata/core/options/CommonOptions.hpp>
 
 using namespace Sirikata;
 
@@ -54,6 +69,10 @@ void runAll(BenchmarkRunner& runner, const BenchmarkList all_benchmarks) {
 int main(int argc, char** argv) {
     DynamicLibrary::Initialize();
 
+    // Some benchmarks, e.g. the SST ones, depend on the common options
+    InitOptions();
+    FakeParseOptions();
+
     BenchmarkFactory factory;
     BenchmarkList all_benchmarks;
 
@@ -68,9 +87,28 @@ int main(int argc, char** argv) {
     ADD_BENCHMARK(timer-monotonicity, TimerMonotonicityBenchmark::create);
 
     ADD_BENCHMARK(ping, SSTBenchmark::create);
+    ADD_BENCHMARK(tcpsst-throughput, TCPSSTThroughputBenchmark::create);
 
     ADD_BENCHMARK(uuid-create, UUIDSpeedBenchmark::create);
 
+    ADD_BENCHMARK(sst-buffer-pool, SSTBufferPoolBenchmark::create);
+    ADD_BENCHMARK(sst-link, SSTLinkBenchmark::create);
+    ADD_BENCHMARK(sst-connect-stress, SSTConnectStressBenchmark::create);
+
+    ADD_BENCHMARK(loc-update-queue, LocUpdateQueueBenchmark::create);
+
+    ADD_BENCHMARK(trace-write, TraceWriteBenchmark::create);
+
+    ADD_BENCHMARK(forwarder-shards, ForwarderShardBenchmark::create);
+    ADD_BENCHMARK(mpsc-queue, MPSCQueueBenchmark::create);
+    ADD_BENCHMARK(oseg-cache-replay, OSegCacheReplayBenchmark::create);
+    ADD_BENCHMARK(sqlite-storage, SQLiteStorageBenchmark::create);
+    ADD_BENCHMARK(mesh-simplifier, MeshSimplifierBenchmark::create);
+    ADD_BENCHMARK(http-pipelining, HttpPipeliningBenchmark::create);
+#ifdef HAVE_BULLET
+    ADD_BENCHMARK(bullet-physics, BulletPhysicsBenchmark::create);
+#endif
+
     BenchmarkRunner runner(factory, Duration::seconds(30.f));
 
 
@@ -159,6 +159,16 @@ int main (int argc, char** argv) {
         commander = Command::CommanderFactory::getSingleton().getConstructor(commander_type)(ctx, commander_options);
 
     Transfer::TransferMediator::getSingleton().registerContext(ctx);
+    if (commander) {
+        commander->registerCommand(
+            "oh.sst.stats",
+            std::tr1::bind(&ODPSST::ConnectionManager::commandConnectionStats, sstConnMgr, std::tr1::placeholders::_1, std::tr1::placeholders::_2, std::tr1::placeholders::_3)
+        );
+        commander->registerCommand(
+            "oh.ohsst.stats",
+            std::tr1::bind(&OHDPSST::ConnectionManager::commandConnectionStats, ohSstConnMgr, std::tr1::placeholders::_1, std::tr1::placeholders::_2, std::tr1::placeholders::_3)
+        );
+    }
 
 
     SpaceID mainSpace(GetOptionValue<UUID>(OPT_MAIN_SPACE));
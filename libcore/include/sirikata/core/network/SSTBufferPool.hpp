@@ -0,0 +1,335 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_LIBCORE_NETWORK_SST_BUFFER_POOL_HPP_
+#define _SIRIKATA_LIBCORE_NETWORK_SST_BUFFER_POOL_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata {
+namespace SST {
+
+class BufferPool;
+class BufferSizeClass;
+
+/** Header for a block of memory handed out by a BufferPool. The data for the
+ *  block immediately follows the header in memory. Blocks are reference
+ *  counted by the BufferSlices that point into them and go back to their
+ *  pool's free list (or get deleted if they were too large to pool) when the
+ *  last slice is released.
+ */
+class PooledBlock {
+private:
+    friend class BufferPool;
+    friend class BufferSizeClass;
+    friend class BufferSlice;
+
+    PooledBlock(BufferSizeClass* owner, uint32 capacity)
+     : mOwner(owner),
+       mNextFree(NULL),
+       mRefCount(0),
+       mCapacity(capacity)
+    {}
+
+    uint8* data() {
+        return reinterpret_cast<uint8*>(this + 1);
+    }
+
+    void ref() {
+        ++mRefCount;
+    }
+    // Defined below, after BufferPool
+    inline void unref();
+
+    // NULL for oversized blocks allocated directly from the heap
+    BufferSizeClass* mOwner;
+    PooledBlock* mNextFree;
+    AtomicValue<uint32> mRefCount;
+    uint32 mCapacity;
+};
+
+/** A reference counted view of a range of bytes in a PooledBlock. Copying a
+ *  slice just adds a reference to the underlying block, so StreamBuffers and
+ *  ChannelSegments can hold on to their data for retransmission without their
+ *  own allocation. This only removes allocations, not copies: the payload is
+ *  still copied into each protocol message that carries it, since generated
+ *  messages own their bytes fields.
+ */
+class BufferSlice {
+public:
+    BufferSlice()
+     : mBlock(NULL),
+       mData(NULL),
+       mLength(0)
+    {}
+
+    BufferSlice(const BufferSlice& rhs)
+     : mBlock(rhs.mBlock),
+       mData(rhs.mData),
+       mLength(rhs.mLength)
+    {
+        if (mBlock != NULL) mBlock->ref();
+    }
+
+    ~BufferSlice() {
+        release();
+    }
+
+    BufferSlice& operator=(const BufferSlice& rhs) {
+        if (rhs.mBlock != NULL) rhs.mBlock->ref();
+        release();
+        mBlock = rhs.mBlock;
+        mData = rhs.mData;
+        mLength = rhs.mLength;
+        return *this;
+    }
+
+    uint8* data() const { return mData; }
+    uint32 size() const { return mLength; }
+    bool empty() const { return mLength == 0; }
+
+    /** Get a view of a subrange of this slice. The new slice shares the same
+     *  underlying block.
+     */
+    BufferSlice slice(uint32 offset, uint32 len) const {
+        assert(offset + len <= mLength);
+        return BufferSlice(mBlock, mData + offset, len);
+    }
+
+    /** Shrink this slice to the given length, e.g. after allocating for the
+     *  worst case and then filling in less data.
+     */
+    void truncate(uint32 len) {
+        assert(len <= mLength);
+        mLength = len;
+    }
+
+private:
+    friend class BufferPool;
+
+    // Takes a new reference to block
+    BufferSlice(PooledBlock* block, uint8* data, uint32 len)
+     : mBlock(block),
+       mData(data),
+       mLength(len)
+    {
+        if (mBlock != NULL) mBlock->ref();
+    }
+
+    void release() {
+        if (mBlock != NULL) mBlock->unref();
+        mBlock = NULL;
+        mData = NULL;
+        mLength = 0;
+    }
+
+    PooledBlock* mBlock;
+    uint8* mData;
+    uint32 mLength;
+};
+
+/** A single size class in a BufferPool: a free list of equally sized blocks
+ *  carved out of larger slabs.
+ */
+class BufferSizeClass {
+public:
+    enum {
+        SLAB_BYTES = 64*1024
+    };
+
+    BufferSizeClass(uint32 block_size)
+     : blockSize(block_size),
+       freeList(NULL),
+       outstanding(0),
+       allocations(0),
+       orphaned(false)
+    {}
+
+    ~BufferSizeClass() {
+        for(uint32 i = 0; i < slabs.size(); i++)
+            delete[] slabs[i];
+    }
+
+    PooledBlock* pop() {
+        boost::mutex::scoped_lock lock(mutex);
+        if (freeList == NULL) grow();
+        PooledBlock* block = freeList;
+        freeList = block->mNextFree;
+        block->mNextFree = NULL;
+        outstanding++;
+        allocations++;
+        return block;
+    }
+
+    void push(PooledBlock* block) {
+        bool destroy = false;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            block->mNextFree = freeList;
+            freeList = block;
+            outstanding--;
+            destroy = (orphaned && outstanding == 0);
+        }
+        if (destroy) delete this;
+    }
+
+    // Called by the owning pool when it goes away. The size class is
+    // cleaned up immediately if no blocks are in use, otherwise when the
+    // last one is returned.
+    static void orphan(BufferSizeClass* sc) {
+        bool destroy = false;
+        {
+            boost::mutex::scoped_lock lock(sc->mutex);
+            sc->orphaned = true;
+            destroy = (sc->outstanding == 0);
+        }
+        if (destroy) delete sc;
+    }
+
+    // Carve a new slab into blocks. mutex must be held.
+    void grow() {
+        uint32 stride = sizeof(PooledBlock) + blockSize;
+        uint32 nblocks = std::max((uint32)(SLAB_BYTES / stride), (uint32)1);
+        uint8* slab = new uint8[nblocks * stride];
+        slabs.push_back(slab);
+        for(uint32 i = 0; i < nblocks; i++) {
+            PooledBlock* block = new (slab + i*stride) PooledBlock(this, blockSize);
+            block->mNextFree = freeList;
+            freeList = block;
+        }
+    }
+
+    boost::mutex mutex;
+    const uint32 blockSize;
+    PooledBlock* freeList;
+    std::vector<uint8*> slabs;
+    uint32 outstanding;
+    uint64 allocations;
+    bool orphaned;
+}; // class BufferSizeClass
+
+/** BufferPool is a slab allocator for the small, short-lived buffers SST uses
+ *  for segments. Blocks are grouped into a few size classes, each of which
+ *  carves blocks out of large slabs and keeps released blocks on a free list,
+ *  so steady-state allocation is just a free list pop under a per-class
+ *  lock. Requests larger than the largest size class fall back to the heap.
+ *
+ *  One pool is owned by each ConnectionManager (in its ConnectionVariables).
+ *  Slices may outlive the pool, e.g. if the application holds onto a Stream
+ *  after the ConnectionManager is gone, so the pool's storage is only freed
+ *  once the pool has been destroyed *and* all its blocks have been returned.
+ */
+class BufferPool {
+public:
+    struct Stats {
+        Stats()
+         : allocations(0),
+           slabs(0),
+           heapAllocations(0)
+        {}
+
+        uint64 allocations;
+        uint64 slabs;
+        uint64 heapAllocations;
+    };
+
+    BufferPool()
+     : mHeapAllocations(0)
+    {
+        for(uint32 i = 0; i < NumSizeClasses; i++)
+            mClasses[i] = new BufferSizeClass(SizeClassBytes(i));
+    }
+
+    ~BufferPool() {
+        for(uint32 i = 0; i < NumSizeClasses; i++)
+            BufferSizeClass::orphan(mClasses[i]);
+    }
+
+    /** Allocate a slice of exactly len bytes. The contents are
+     *  uninitialized.
+     */
+    BufferSlice allocate(uint32 len) {
+        PooledBlock* block = NULL;
+        BufferSizeClass* sc = sizeClassFor(len);
+        if (sc != NULL) {
+            block = sc->pop();
+        }
+        else {
+            uint8* mem = new uint8[sizeof(PooledBlock) + len];
+            block = new (mem) PooledBlock(NULL, len);
+            boost::mutex::scoped_lock lock(mHeapStatsMutex);
+            mHeapAllocations++;
+        }
+        return BufferSlice(block, block->data(), len);
+    }
+
+    /** Allocate a slice and fill it with a copy of the given data. */
+    BufferSlice copy(const void* data, uint32 len) {
+        BufferSlice result = allocate(len);
+        if (len > 0)
+            memcpy(result.data(), data, len);
+        return result;
+    }
+
+    Stats stats() {
+        Stats result;
+        for(uint32 i = 0; i < NumSizeClasses; i++) {
+            boost::mutex::scoped_lock lock(mClasses[i]->mutex);
+            result.allocations += mClasses[i]->allocations;
+            result.slabs += mClasses[i]->slabs.size();
+        }
+        boost::mutex::scoped_lock lock(mHeapStatsMutex);
+        result.heapAllocations = mHeapAllocations;
+        result.allocations += mHeapAllocations;
+        return result;
+    }
+
+private:
+    friend class PooledBlock;
+
+    // Size classes are 64 bytes << (2*i), i.e. 64, 256, 1024, 4096. 1024
+    // covers stream payloads and 4096 covers full channel segments.
+    enum {
+        NumSizeClasses = 4
+    };
+    static uint32 SizeClassBytes(uint32 idx) {
+        return 64 << (2*idx);
+    }
+
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+
+
+    BufferSizeClass* sizeClassFor(uint32 len) {
+        for(uint32 i = 0; i < NumSizeClasses; i++)
+            if (len <= mClasses[i]->blockSize) return mClasses[i];
+        return NULL;
+    }
+
+    static void releaseBlock(PooledBlock* block) {
+        if (block->mOwner == NULL) {
+            block->~PooledBlock();
+            delete[] reinterpret_cast<uint8*>(block);
+            return;
+        }
+        block->mOwner->push(block);
+    }
+
+    BufferSizeClass* mClasses[NumSizeClasses];
+
+    boost::mutex mHeapStatsMutex;
+    uint64 mHeapAllocations;
+}; // class BufferPool
+
+void PooledBlock::unref() {
+    if (--mRefCount == 0)
+        BufferPool::releaseBlock(this);
+}
+
+} // namespace SST
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LIBCORE_NETWORK_SST_BUFFER_POOL_HPP_
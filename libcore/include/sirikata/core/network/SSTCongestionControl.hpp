@@ -0,0 +1,307 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_LIBCORE_NETWORK_SST_CONGESTION_CONTROL_HPP_
+#define _SIRIKATA_LIBCORE_NETWORK_SST_CONGESTION_CONTROL_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <cmath>
+
+namespace Sirikata {
+namespace SST {
+
+#define SST_BASE_CWND 10
+#define SST_BASE_SSTHRESH 32768
+// Upper bound on the congestion window, in segments.
+#define SST_MAX_CWND 65535
+
+/** CongestionController decides how many segments a Connection may have
+ *  outstanding. The Connection reports acks, losses detected by fast
+ *  retransmit, and retransmission timeouts, and the controller adjusts its
+ *  window in response. Each Connection owns its own controller, created by
+ *  name (see create()) from the setting in its ConnectionManager.
+ *
+ *  Controllers are only accessed by the owning Connection, which serializes
+ *  calls to them.
+ */
+class SIRIKATA_EXPORT CongestionController {
+public:
+    CongestionController()
+     : mCwnd(SST_BASE_CWND),
+       mSSThresh(SST_BASE_SSTHRESH)
+    {}
+    virtual ~CongestionController() {}
+
+    /** Create a controller by name: "reno", "cubic" or "delay". Returns NULL
+     *  for unknown names.
+     */
+    static CongestionController* create(const String& name);
+
+    virtual const char* name() const = 0;
+
+    /** Current congestion window, in segments. */
+    uint32 cwnd() const { return mCwnd; }
+    uint32 ssthresh() const { return mSSThresh; }
+
+    /** Invoked when numAcked outstanding segments were acknowledged. rtt is
+     *  the round trip time sampled from the ack, or Duration::zero() if the
+     *  ack didn't provide a usable sample.
+     */
+    virtual void onAck(uint32 numAcked, const Duration& rtt) = 0;
+    /** Invoked when acks for later segments indicate a loss and the
+     *  Connection starts fast recovery. Only called once per recovery
+     *  period.
+     */
+    virtual void onFastRetransmit() = 0;
+    /** Invoked when the retransmission timer fires with segments still
+     *  outstanding.
+     */
+    virtual void onTimeout() = 0;
+
+protected:
+    void setCwnd(uint32 cwnd) {
+        mCwnd = std::min(std::max(cwnd, (uint32)1), (uint32)SST_MAX_CWND);
+    }
+
+    uint32 mCwnd;
+    uint32 mSSThresh;
+}; // class CongestionController
+
+/** Reno-style congestion control: exponential growth in slow start, roughly
+ *  one segment per window of acks after that, halving on losses. This is the
+ *  scheme SST has always used.
+ */
+class SIRIKATA_EXPORT RenoCongestionController : public CongestionController {
+public:
+    virtual const char* name() const { return "reno"; }
+
+    virtual void onAck(uint32 numAcked, const Duration& rtt) {
+        for(uint32 i = 0; i < numAcked; i++) {
+            if (mCwnd <= mSSThresh) {
+                // Slow start exponential growth, bump for every acked packet
+                setCwnd(mCwnd + 1);
+            }
+            else {
+                // regular growth
+                if (rand() % mCwnd == 0)
+                    setCwnd(mCwnd + 1);
+            }
+        }
+    }
+
+    virtual void onFastRetransmit() {
+        mSSThresh = std::max(mCwnd/2, (uint32)SST_BASE_CWND*2);
+        setCwnd(mSSThresh);
+    }
+
+    virtual void onTimeout() {
+        // This is a non-standard approach, but since timeouts are still the
+        // main indication of drops (fast retransmit only catches losses
+        // followed by enough acked segments), it balances between the two
+        // backoff approaches normally used. Normally on a retransmission
+        // timeout we would set ssthresh = cwnd / 2 and cwnd = base_cwnd, and
+        // only for triple duplicate acks would we do backoff of ssthresh =
+        // cwnd / 2 and cwnd = ssthresh. We need to have *some* indication of
+        // when to back off in which way, so we decide based on what kind of
+        // growth we're currently in -- we'll only fully back off if we detect
+        // a problem during slow start (but not the first one since that's
+        // expected to fail)
+        uint32 old_ssthresh = mSSThresh;
+        mSSThresh = std::max(mCwnd/2, (uint32)SST_BASE_CWND*2);
+        if (mCwnd >= old_ssthresh || old_ssthresh == SST_BASE_SSTHRESH) // linear growth, light back off
+            setCwnd(mSSThresh);
+        else // slow start exponential growth, aggressive back off
+            setCwnd(SST_BASE_CWND);
+    }
+}; // class RenoCongestionController
+
+/** CUBIC congestion control (RFC 8312). After a loss, the window grows along
+ *  a cubic function of the time since the loss, centered on the window size
+ *  at which the loss occurred. Growth is independent of RTT, which keeps long
+ *  RTT links (e.g. to object hosts) from being starved by short ones.
+ */
+class SIRIKATA_EXPORT CubicCongestionController : public CongestionController {
+public:
+    CubicCongestionController()
+     : mWindow(SST_BASE_CWND),
+       mWMax(0),
+       mK(0),
+       mOrigin(0),
+       mEpochStart(Time::null()),
+       mMinRTT(Duration::zero()),
+       mRenoWindow(0)
+    {}
+
+    virtual const char* name() const { return "cubic"; }
+
+    virtual void onAck(uint32 numAcked, const Duration& rtt) {
+        if (rtt > Duration::zero() && (mMinRTT == Duration::zero() || rtt < mMinRTT))
+            mMinRTT = rtt;
+
+        for(uint32 i = 0; i < numAcked; i++) {
+            if (mWindow < mSSThresh) {
+                mWindow += 1;
+                continue;
+            }
+
+            Time now = Timer::now();
+            if (mEpochStart == Time::null()) {
+                mEpochStart = now;
+                if (mWindow < mWMax) {
+                    mK = std::pow((mWMax - mWindow) / C, 1.0/3.0);
+                    mOrigin = mWMax;
+                }
+                else {
+                    mK = 0;
+                    mOrigin = mWindow;
+                }
+                mRenoWindow = mWindow;
+            }
+
+            double t = (now - mEpochStart + mMinRTT).toSeconds();
+            double target = mOrigin + C * std::pow(t - mK, 3.0);
+
+            // Stay at least as aggressive as Reno would be (the "TCP
+            // friendly" region), which matters on short RTT links where the
+            // cubic function grows slowly.
+            mRenoWindow += (3.0 * (1.0 - BETA) / (1.0 + BETA)) / mWindow;
+            target = std::max(target, mRenoWindow);
+
+            if (target > mWindow)
+                mWindow += std::min(target - mWindow, mWindow) / mWindow;
+            else
+                mWindow += 0.01 / mWindow;
+        }
+        setCwnd((uint32)mWindow);
+    }
+
+    virtual void onFastRetransmit() {
+        reduce();
+        mWindow = mSSThresh;
+        setCwnd(mSSThresh);
+    }
+
+    virtual void onTimeout() {
+        reduce();
+        mWindow = SST_BASE_CWND;
+        setCwnd(SST_BASE_CWND);
+    }
+
+private:
+    static const double C;
+    static const double BETA;
+
+    void reduce() {
+        mEpochStart = Time::null();
+        // Fast convergence: if we lost before reaching the previous maximum,
+        // another flow is probably taking bandwidth, so release some
+        // ourselves.
+        if (mWindow < mWMax)
+            mWMax = mWindow * (1.0 + BETA) / 2.0;
+        else
+            mWMax = mWindow;
+        mSSThresh = std::max((uint32)(mWindow * BETA), (uint32)SST_BASE_CWND*2);
+    }
+
+    // Unrounded congestion window
+    double mWindow;
+    // Window at the last loss
+    double mWMax;
+    // Time, in seconds, to grow from the post-loss window back to mWMax
+    double mK;
+    double mOrigin;
+    Time mEpochStart;
+    Duration mMinRTT;
+    // Estimate of the window Reno would have at this point
+    double mRenoWindow;
+}; // class CubicCongestionController
+
+/** Delay based congestion control in the style of TCP Vegas. Once per round
+ *  trip it compares the lowest RTT seen (the propagation delay) with the
+ *  current RTT to estimate how many of our segments are sitting in queues,
+ *  and adjusts the window to keep that number between ALPHA and BETA. This
+ *  keeps queues, and therefore latency, low on the LAN links between space
+ *  servers.
+ */
+class SIRIKATA_EXPORT DelayCongestionController : public CongestionController {
+public:
+    DelayCongestionController()
+     : mBaseRTT(Duration::zero()),
+       mRoundMinRTT(Duration::zero()),
+       mRoundAcks(0)
+    {}
+
+    virtual const char* name() const { return "delay"; }
+
+    virtual void onAck(uint32 numAcked, const Duration& rtt) {
+        if (rtt > Duration::zero()) {
+            if (mBaseRTT == Duration::zero() || rtt < mBaseRTT)
+                mBaseRTT = rtt;
+            if (mRoundMinRTT == Duration::zero() || rtt < mRoundMinRTT)
+                mRoundMinRTT = rtt;
+        }
+
+        mRoundAcks += numAcked;
+        if (mRoundAcks < mCwnd) {
+            // Without delay information yet, grow like slow start
+            if (mCwnd <= mSSThresh && mBaseRTT == Duration::zero())
+                setCwnd(mCwnd + numAcked);
+            return;
+        }
+
+        // One round trip's worth of acks, make a decision
+        mRoundAcks = 0;
+        if (mRoundMinRTT == Duration::zero()) return;
+
+        double queued = mCwnd * (1.0 - mBaseRTT.toSeconds() / mRoundMinRTT.toSeconds());
+        mRoundMinRTT = Duration::zero();
+
+        if (mCwnd <= mSSThresh) {
+            // Leave slow start as soon as queues start to build
+            if (queued > GAMMA) {
+                mSSThresh = std::max(mCwnd - 1, (uint32)SST_BASE_CWND);
+                setCwnd(mSSThresh);
+            }
+            else {
+                setCwnd(mCwnd * 2);
+            }
+        }
+        else if (queued < ALPHA) {
+            setCwnd(mCwnd + 1);
+        }
+        else if (queued > BETA) {
+            setCwnd(std::max(mCwnd - 1, (uint32)SST_BASE_CWND));
+        }
+    }
+
+    virtual void onFastRetransmit() {
+        mSSThresh = std::max(mCwnd*3/4, (uint32)SST_BASE_CWND*2);
+        setCwnd(mSSThresh);
+        mRoundAcks = 0;
+    }
+
+    virtual void onTimeout() {
+        mSSThresh = std::max(mCwnd/2, (uint32)SST_BASE_CWND*2);
+        setCwnd(SST_BASE_CWND);
+        mRoundAcks = 0;
+        mRoundMinRTT = Duration::zero();
+    }
+
+private:
+    // Target range for the number of segments queued in the network
+    static const double ALPHA;
+    static const double BETA;
+    // Threshold for leaving slow start
+    static const double GAMMA;
+
+    Duration mBaseRTT;
+    Duration mRoundMinRTT;
+    uint32 mRoundAcks;
+}; // class DelayCongestionController
+
+} // namespace SST
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LIBCORE_NETWORK_SST_CONGESTION_CONTROL_HPP_
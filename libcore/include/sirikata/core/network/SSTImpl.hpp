@@ -35,6 +35,8 @@
 #define SST_IMPL_HPP
 
 #include <sirikata/core/network/SSTDecls.hpp>
+#include <sirikata/core/network/SSTBufferPool.hpp>
+#include <sirikata/core/network/SSTCongestionControl.hpp>
 
 #include <sirikata/core/service/Service.hpp>
 #include <sirikata/core/util/Timer.hpp>
@@ -49,6 +51,7 @@
 #include <boost/asio.hpp> //htons, ntohs
 
 #include <sirikata/core/options/CommonOptions.hpp>
+#include <sirikata/core/command/Commander.hpp>
 
 #define SST_LOG(lvl,msg) SILOG(sst,lvl,msg);
 
@@ -138,6 +141,10 @@ template <class EndPointType>
 class ConnectionVariables {
 public:
 
+    ConnectionVariables()
+     : mFastRetransmit(true)
+    {}
+
     typedef std::tr1::shared_ptr<BaseDatagramLayer<EndPointType> > BaseDatagramLayerPtr;
     typedef CallbackTypes<EndPointType> CBTypes;
     typedef typename CBTypes::ConnectionReturnCallbackFunction ConnectionReturnCallbackFunction;
@@ -165,44 +172,114 @@ public:
 
     BaseDatagramLayerPtr getDatagramLayer(EndPointType& endPoint)
     {
-        if (sDatagramLayerMap.find(endPoint) != sDatagramLayerMap.end()) {
-            return sDatagramLayerMap[endPoint];
-        }
+        DatagramLayerShard& dshard = datagramLayerShard(endPoint);
+        boost::mutex::scoped_lock lock(dshard.mutex);
+        typename DatagramLayerMap::iterator it = dshard.datagramLayers.find(endPoint);
+        if (it != dshard.datagramLayers.end())
+            return it->second;
 
         return BaseDatagramLayerPtr();
     }
 
     void addDatagramLayer(EndPointType& endPoint, BaseDatagramLayerPtr datagramLayer)
     {
-        sDatagramLayerMap[endPoint] = datagramLayer;
+        DatagramLayerShard& dshard = datagramLayerShard(endPoint);
+        boost::mutex::scoped_lock lock(dshard.mutex);
+        dshard.datagramLayers[endPoint] = datagramLayer;
     }
 
     void removeDatagramLayer(EndPointType& endPoint, bool warn = false)
     {
-        typename std::tr1::unordered_map<EndPointType, BaseDatagramLayerPtr, typename EndPointType::Hasher >::iterator wherei = sDatagramLayerMap.find(endPoint);
-        if (wherei != sDatagramLayerMap.end()) {
-            sDatagramLayerMap.erase(wherei);
+        DatagramLayerShard& dshard = datagramLayerShard(endPoint);
+        boost::mutex::scoped_lock lock(dshard.mutex);
+        typename DatagramLayerMap::iterator wherei = dshard.datagramLayers.find(endPoint);
+        if (wherei != dshard.datagramLayers.end()) {
+            dshard.datagramLayers.erase(wherei);
         } else if (warn) {
             SILOG(sst,error,"FATAL: Invalidating BaseDatagramLayer that's invalid");
         }
     }
 
-private:
-    std::tr1::unordered_map<EndPointType, BaseDatagramLayerPtr, typename EndPointType::Hasher > sDatagramLayerMap;
-
-public:
     typedef std::tr1::unordered_map<EndPoint<EndPointType>, StreamReturnCallbackFunction, typename EndPoint<EndPointType>::Hasher> StreamReturnCallbackMap;
-    StreamReturnCallbackMap mStreamReturnCallbackMap;
-
     typedef std::tr1::unordered_map<EndPoint<EndPointType>, std::tr1::shared_ptr<Connection<EndPointType> >, typename EndPoint<EndPointType>::Hasher >  ConnectionMap;
-    ConnectionMap sConnectionMap;
-
     typedef std::tr1::unordered_map<EndPoint<EndPointType>, ConnectionReturnCallbackFunction, typename EndPoint<EndPointType>::Hasher>  ConnectionReturnCallbackMap;
-    ConnectionReturnCallbackMap sConnectionReturnCallbackMap;
 
-    StreamReturnCallbackMap  sListeningConnectionsCallbackMap;
-    Mutex sStaticMembersLock;
+    // The connection tables are all keyed by local endpoint and split into
+    // shards by the endpoint's hash, each with its own lock, so lookups,
+    // setup and teardown for different connections don't contend with each
+    // other. Everything for a given local endpoint is in the same shard, so a
+    // single lock covers updates across the tables. Never hold more than one
+    // shard lock at a time, and don't invoke callbacks or destroy Connections
+    // while holding one.
+    enum {
+        NUM_SHARDS = 32
+    };
+
+    struct ConnectionShard {
+        boost::mutex mutex;
+        ConnectionMap connections;
+        ConnectionReturnCallbackMap connectionReturnCallbacks;
+        StreamReturnCallbackMap listeningConnectionsCallbacks;
+        StreamReturnCallbackMap streamReturnCallbacks;
+    };
+
+    ConnectionShard& shard(const EndPoint<EndPointType>& ep) {
+        return mConnectionShards[shardIndex(ep.hash())];
+    }
+    ConnectionShard& shard(uint32 idx) {
+        return mConnectionShards[idx];
+    }
+
+    // Serializes allocation of channels (and the ports derived from them)
+    // for an endpoint, which otherwise races between the lookup of an unused
+    // port and the new Connection listening on it. Acquire before the shard
+    // lock.
+    boost::mutex& channelAllocationMutex(const EndPointType& ep) {
+        return mChannelAllocationMutexes[shardIndex(typename EndPointType::Hasher()(ep))];
+    }
+
+private:
+    static uint32 shardIndex(size_t hash) {
+        return (uint32)((hash ^ (hash >> 16)) % NUM_SHARDS);
+    }
+
+    typedef std::tr1::unordered_map<EndPointType, BaseDatagramLayerPtr, typename EndPointType::Hasher > DatagramLayerMap;
+    struct DatagramLayerShard {
+        boost::mutex mutex;
+        DatagramLayerMap datagramLayers;
+    };
+    DatagramLayerShard& datagramLayerShard(const EndPointType& ep) {
+        return mDatagramLayerShards[shardIndex(typename EndPointType::Hasher()(ep))];
+    }
 
+    ConnectionShard mConnectionShards[NUM_SHARDS];
+    DatagramLayerShard mDatagramLayerShards[NUM_SHARDS];
+    boost::mutex mChannelAllocationMutexes[NUM_SHARDS];
+
+public:
+
+    // Pool for segment data shared by all connections and streams managed by
+    // the owning ConnectionManager.
+    BufferPool mBufferPool;
+
+    // Whether connections retransmit segments as soon as acks for later
+    // segments indicate they were lost, rather than waiting for a timeout.
+    bool mFastRetransmit;
+
+    // Congestion control algorithm for new connections. If empty, the
+    // sst.congestion-control option is used.
+    String mCongestionControl;
+
+    CongestionController* createCongestionController() {
+        String cc = mCongestionControl.empty() ?
+            GetOptionValue<String>(OPT_SST_CONGESTION_CONTROL) : mCongestionControl;
+        CongestionController* result = CongestionController::create(cc);
+        if (result == NULL) {
+            SILOG(sst,error,"Unknown congestion control algorithm " << cc << ", using reno");
+            result = new RenoCongestionController();
+        }
+        return result;
+    }
 };
 
 // This is just a template definition. The real implementation of BaseDatagramLayer
@@ -302,26 +379,30 @@ class SIRIKATA_EXPORT BaseDatagramLayer
 class ChannelSegment {
 public:
 
-  uint8* mBuffer;
-  uint16 mBufferLength;
+  BufferSlice mBuffer;
   uint64 mChannelSequenceNumber;
   uint64 mAckSequenceNumber;
 
   Time mTransmitTime;
   Time mAckTime;
 
-  ChannelSegment( const void* data, int len, uint64 channelSeqNum, uint64 ackSequenceNum) :
-                                               mBufferLength(len),
+  // Number of segments sent after this one which have been acked while this
+  // one was still outstanding. Used to detect losses without waiting for a
+  // timeout.
+  uint32 mNumLaterAcks;
+  // Set once the segment is retransmitted, after which its acks are
+  // ambiguous and can't be used for RTT estimation.
+  bool mRetransmitted;
+
+  // The segment adopts the (pooled) buffer, no copy is made.
+  ChannelSegment( const BufferSlice& buffer, uint64 channelSeqNum, uint64 ackSequenceNum) :
+                                              mBuffer(buffer),
 					      mChannelSequenceNumber(channelSeqNum),
 					      mAckSequenceNumber(ackSequenceNum),
-					      mTransmitTime(Time::null()), mAckTime(Time::null())
+					      mTransmitTime(Time::null()), mAckTime(Time::null()),
+					      mNumLaterAcks(0),
+					      mRetransmitted(false)
   {
-    mBuffer = new uint8[len];
-    memcpy( mBuffer, (const uint8*) data, len);
-  }
-
-  ~ChannelSegment() {
-    delete [] mBuffer;
   }
 
   void setAckTime(Time& ackTime) {
@@ -330,8 +411,93 @@ public:
 
 };
 
-#define SST_BASE_CWND 10
-#define SST_BASE_SSTHRESH 32768
+// Number of later segments that must be acked before an outstanding segment
+// is considered lost and fast retransmitted.
+#define SST_DUPACK_THRESHOLD 3
+
+// Tracks the channel sequence numbers a Connection has recently received so
+// acks can carry a SACK-style range: the ack_sequence_number plus an
+// ack_count giving the number of consecutive sequence numbers, ending with
+// ack_sequence_number, that have been received. Peers that don't know about
+// ranges always send (and only look at) a count of 1.
+class ReceivedSequenceWindow {
+public:
+    // Ranges are capped at this many sequence numbers, which also bounds how
+    // much history we need to keep.
+    enum {
+        MAX_RANGE = 64
+    };
+
+    ReceivedSequenceWindow()
+     : mHighest(0),
+       mHistory(0)
+    {}
+
+    void insert(uint64 seqno) {
+        if (seqno > mHighest) {
+            uint64 shift = seqno - mHighest;
+            mHistory = (shift >= MAX_RANGE) ? 0 : (mHistory << shift);
+            if (mHighest != 0 && shift <= MAX_RANGE)
+                mHistory |= ((uint64)1 << (shift-1));
+            mHighest = seqno;
+        }
+        else if (seqno < mHighest && mHighest - seqno <= MAX_RANGE) {
+            mHistory |= ((uint64)1 << (mHighest - seqno - 1));
+        }
+    }
+
+    bool contains(uint64 seqno) const {
+        if (seqno == 0 || seqno > mHighest) return false;
+        if (seqno == mHighest) return true;
+        if (mHighest - seqno > MAX_RANGE) return false;
+        return (mHistory & ((uint64)1 << (mHighest - seqno - 1))) != 0;
+    }
+
+    // Get the length of the ack range ending at ack_seqno. ack_seqno itself
+    // is always included since we're acking it, whether or not it's been
+    // recorded yet.
+    uint32 ackCount(uint64 ack_seqno) const {
+        uint32 count = 1;
+        for(uint64 seqno = ack_seqno - 1; seqno > 0 && count < MAX_RANGE && contains(seqno); seqno--)
+            count++;
+        return count;
+    }
+
+private:
+    uint64 mHighest;
+    // Bit i indicates whether mHighest - 1 - i has been received.
+    uint64 mHistory;
+}; // class ReceivedSequenceWindow
+
+/** Snapshot of a Connection's congestion control and reliability state. */
+struct ConnectionStats {
+    ConnectionStats()
+     : cwnd(0),
+       ssthresh(0),
+       outstandingSegments(0),
+       queuedSegments(0),
+       rtt(Duration::zero()),
+       rto(Duration::zero()),
+       segmentsSent(0),
+       fastRetransmits(0),
+       timeouts(0)
+    {}
+
+    String congestionControl;
+    uint32 cwnd;
+    uint32 ssthresh;
+    uint32 outstandingSegments;
+    uint32 queuedSegments;
+    // Smoothed round trip time
+    Duration rtt;
+    Duration rto;
+    // Segments sent for the first time
+    uint64 segmentsSent;
+    uint64 fastRetransmits;
+    // Retransmission timeouts, each of which discards all outstanding
+    // segments
+    uint64 timeouts;
+};
 
 template <class EndPointType>
 class SIRIKATA_EXPORT Connection {
@@ -353,9 +519,10 @@ private:
   friend class ConnectionManager<EndPointType>;
   friend class BaseDatagramLayer<EndPointType>;
 
-  typedef std::tr1::unordered_map<EndPoint<EndPointType>, std::tr1::shared_ptr<Connection>, typename EndPoint<EndPointType>::Hasher >  ConnectionMap;
-  typedef std::tr1::unordered_map<EndPoint<EndPointType>, ConnectionReturnCallbackFunction, typename EndPoint<EndPointType>::Hasher>  ConnectionReturnCallbackMap;
-  typedef std::tr1::unordered_map<EndPoint<EndPointType>, StreamReturnCallbackFunction, typename EndPoint<EndPointType>::Hasher> StreamReturnCallbackMap;
+  typedef typename ConnectionVariables<EndPointType>::ConnectionMap ConnectionMap;
+  typedef typename ConnectionVariables<EndPointType>::ConnectionReturnCallbackMap ConnectionReturnCallbackMap;
+  typedef typename ConnectionVariables<EndPointType>::StreamReturnCallbackMap StreamReturnCallbackMap;
+  typedef typename ConnectionVariables<EndPointType>::ConnectionShard ConnectionShard;
 
   EndPoint<EndPointType> mLocalEndPoint;
   EndPoint<EndPointType> mRemoteEndPoint;
@@ -386,10 +553,28 @@ private:
   std::deque< std::tr1::shared_ptr<ChannelSegment> > mOutstandingSegments;
   boost::mutex mOutstandingSegmentsMutex;
 
-  uint16 mCwnd;
-  uint16 mSSThresh;
+  // Owned by this Connection. Only updated with mOutstandingSegmentsMutex
+  // held, and serviceConnection() and getStats() read it with that mutex
+  // held. sendData() only holds mQueueMutex and reads cwnd(), like
+  // mOutstandingSegments.size(), just to decide whether to schedule
+  // servicing, so a stale value only changes when servicing happens.
+  CongestionController* mCongestionController;
   int64 mRTOMicroseconds; // RTO in microseconds
   bool mFirstRTO;
+  Duration mSmoothedRTT;
+  uint64 mNumSegmentsSent;
+  uint64 mNumTimeouts;
+
+  // Fast recovery: after a fast retransmit, we back off the congestion window
+  // once and then hold it until everything outstanding at the time of the
+  // loss, up to mRecoveryPoint, has been acked.
+  bool mInFastRecovery;
+  uint64 mRecoveryPoint;
+  uint64 mNumFastRetransmits;
+
+  // Sequence numbers we've received, used to fill in ack ranges. Protected by
+  // mQueueMutex.
+  ReceivedSequenceWindow mReceivedSequences;
 
   boost::mutex mQueueMutex;
 
@@ -489,8 +674,13 @@ private:
       mState(CONNECTION_DISCONNECTED),
       mRemoteChannelID(0), mLocalChannelID(1), mTransmitSequenceNumber(1),
       mLastReceivedSequenceNumber(1),
-      mNumStreams(0), mCwnd(SST_BASE_CWND), mSSThresh(SST_BASE_SSTHRESH), mRTOMicroseconds(2000000),
-      mFirstRTO(true),  MAX_DATAGRAM_SIZE(1000), MAX_PAYLOAD_SIZE(1300),
+      mNumStreams(0),
+      mCongestionController(sstConnVars->createCongestionController()),
+      mRTOMicroseconds(2000000),
+      mFirstRTO(true), mSmoothedRTT(Duration::zero()),
+      mNumSegmentsSent(0), mNumTimeouts(0),
+      mInFastRecovery(false), mRecoveryPoint(0), mNumFastRetransmits(0),
+      MAX_DATAGRAM_SIZE(1000), MAX_PAYLOAD_SIZE(1300),
       MAX_QUEUED_SEGMENTS(3000),
       CC_ALPHA(0.8), mLastTransmitTime(Time::null()),
       mNumInitialRetransmissionAttempts(0),
@@ -538,6 +728,26 @@ private:
 				       buffer.size());
   }
 
+  // Fills in the ack range for an outgoing packet. mQueueMutex must be held.
+  void setAck(Sirikata::Protocol::SST::SSTChannelHeader& sstMsg, uint64 ack_seqno) {
+    sstMsg.set_ack_count(mReceivedSequences.ackCount(ack_seqno));
+    sstMsg.set_ack_sequence_number(ack_seqno);
+  }
+
+  // (Re)transmits a queued segment. mQueueMutex must be held.
+  void sendSegment(std::tr1::shared_ptr<ChannelSegment> segment, const Time& curTime) {
+    Sirikata::Protocol::SST::SSTChannelHeader sstMsg;
+    sstMsg.set_channel_id( mRemoteChannelID );
+    sstMsg.set_transmit_sequence_number(segment->mChannelSequenceNumber);
+    setAck(sstMsg, segment->mAckSequenceNumber);
+
+    sstMsg.set_payload(segment->mBuffer.data(), segment->mBuffer.size());
+
+    sendSSTChannelPacket(sstMsg);
+
+    segment->mTransmitTime = curTime;
+  }
+
   const Context* getContext() {
     return mDatagramLayer->context();
   }
@@ -605,27 +815,18 @@ private:
       // data. The correctness of the servicing depends on this since
       // you need to pass through the loop below at least once to
       // adjust some properties (e.g. sending mode).
-      assert( !mQueuedSegments.empty() && mOutstandingSegments.size() <= mCwnd);
+      assert( !mQueuedSegments.empty() && mOutstandingSegments.size() <= mCongestionController->cwnd());
 
-      for (int i = 0; (!mQueuedSegments.empty()) && mOutstandingSegments.size() <= mCwnd; i++) {
+      for (int i = 0; (!mQueuedSegments.empty()) && mOutstandingSegments.size() <= mCongestionController->cwnd(); i++) {
 	  std::tr1::shared_ptr<ChannelSegment> segment = mQueuedSegments.front();
 
-	  Sirikata::Protocol::SST::SSTChannelHeader sstMsg;
-	  sstMsg.set_channel_id( mRemoteChannelID );
-	  sstMsg.set_transmit_sequence_number(segment->mChannelSequenceNumber);
-	  sstMsg.set_ack_count(1);
-	  sstMsg.set_ack_sequence_number(segment->mAckSequenceNumber);
-
-	  sstMsg.set_payload(segment->mBuffer, segment->mBufferLength);
-
           /*printf("%s sending packet from data sending loop to %s \n",
                    mLocalEndPoint.endPoint.toString().c_str()
                    , mRemoteEndPoint.endPoint.toString().c_str());*/
 
-	  sendSSTChannelPacket(sstMsg);
-
-	  segment->mTransmitTime = curTime;
+	  sendSegment(segment, curTime);
 	  mOutstandingSegments.push_back(segment);
+	  mNumSegmentsSent++;
 
 	  mLastTransmitTime = curTime;
 
@@ -706,27 +907,8 @@ private:
         // Otherwise, adjust the congestion window if we have
         // oustanding packets left.
         if (mOutstandingSegments.size() > 0) {
-            // This is a non-standard approach, but since this is the only
-            // indication of drops we currently use, it balances between the two
-            // backoff approaches normally used. Normally on a retransmission
-            // timeout we would set ssthresh = cwnd / 2 and cwnd = base_cwnd
-            // on. However, we don't detect triple duplicate acks, where we
-            // would only do backoff of ssthresh = cwnd / 2 and cwnd =
-            // ssthresh. We need to have *some* indication of when to back off
-            // in which way, so we decide based on what kind of growth we're
-            // currently in -- we'll only fully back off if we detect a problem
-            // during slow start (but not the first one since that's expected to
-            // fail)
-            uint16 old_ssthresh = mSSThresh;
-            mSSThresh = std::max(mCwnd/2, SST_BASE_CWND*2);
-            if (mCwnd >= old_ssthresh || old_ssthresh == SST_BASE_SSTHRESH) {// linear growth, light back off
-                mCwnd = mSSThresh;
-                //SILOG(sst, insane, this << " RTO LINEAR - cwnd " << mCwnd << " ssthresh " << mSSThresh << "   state " << mState << " rto " << mRTOMicroseconds);
-            }
-            else {// slow start exponential growth, aggressive back off
-                mCwnd = SST_BASE_CWND;
-                //SILOG(sst, insane, this << " RTO SS - cwnd " << mCwnd << " ssthresh " << mSSThresh << "   state " << mState << " rto " << mRTOMicroseconds);
-            }
+            mCongestionController->onTimeout();
+            mNumTimeouts++;
 
             // Back off on the timeout as well since the congestion
             // could cause additional delays. It should recover
@@ -734,6 +916,9 @@ private:
             if (mRTOMicroseconds < 20000000)
                 mRTOMicroseconds *= 2;
 
+            // A timeout supersedes any fast recovery in progress.
+            mInFastRecovery = false;
+
             mOutstandingSegments.clear();
             // We can't just clear outstanding segments because we could have *a
             // lot* queued up, and we need to get back to the dropped data. This
@@ -804,11 +989,13 @@ private:
 			       StreamReturnCallbackFunction scb)
 
   {
-    boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
+    boost::mutex::scoped_lock alloc_lock(sstConnVars->channelAllocationMutex(localEndPoint.endPoint));
+    ConnectionShard& shard = sstConnVars->shard(localEndPoint);
+    boost::mutex::scoped_lock lock(shard.mutex);
 
-    ConnectionMap& connectionMap = sstConnVars->sConnectionMap;
+    ConnectionMap& connectionMap = shard.connections;
     if (connectionMap.find(localEndPoint) != connectionMap.end()) {
-      SST_LOG(warn, "sConnectionMap.find failed for " << localEndPoint.endPoint.toString() << "\n");
+      SST_LOG(warn, "Connection already exists for " << localEndPoint.endPoint.toString() << "\n");
 
       return false;
     }
@@ -822,9 +1009,10 @@ private:
                        new Connection(sstConnVars, localEndPoint, remoteEndPoint));
 
     connectionMap[localEndPoint] = conn;
-    sstConnVars->sConnectionReturnCallbackMap[localEndPoint] = cb;
+    shard.connectionReturnCallbacks[localEndPoint] = cb;
 
     lock.unlock();
+    alloc_lock.unlock();
 
     conn->setWeakThis(conn);
     conn->setState(CONNECTION_PENDING_CONNECT);
@@ -841,9 +1029,10 @@ private:
   static bool listen(ConnectionVariables<EndPointType>* sstConnVars, StreamReturnCallbackFunction cb, EndPoint<EndPointType> listeningEndPoint) {
       sstConnVars->getDatagramLayer(listeningEndPoint.endPoint)->listenOn(listeningEndPoint);
 
-    boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
+    ConnectionShard& shard = sstConnVars->shard(listeningEndPoint);
+    boost::mutex::scoped_lock lock(shard.mutex);
 
-    StreamReturnCallbackMap& listeningConnectionsCallbackMap = sstConnVars->sListeningConnectionsCallbackMap;
+    StreamReturnCallbackMap& listeningConnectionsCallbackMap = shard.listeningConnectionsCallbacks;
 
     if (listeningConnectionsCallbackMap.find(listeningEndPoint) != listeningConnectionsCallbackMap.end()){
       return false;
@@ -857,9 +1046,10 @@ private:
   static bool unlisten(ConnectionVariables<EndPointType>* sstConnVars, EndPoint<EndPointType> listeningEndPoint) {
     BaseDatagramLayer<EndPointType>::stopListening(sstConnVars, listeningEndPoint);
 
-    boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
+    ConnectionShard& shard = sstConnVars->shard(listeningEndPoint);
+    boost::mutex::scoped_lock lock(shard.mutex);
 
-    sstConnVars->sListeningConnectionsCallbackMap.erase(listeningEndPoint);
+    shard.listeningConnectionsCallbacks.erase(listeningEndPoint);
 
     return true;
   }
@@ -925,38 +1115,58 @@ private:
       return sendData(data, length, isAck, mLastReceivedSequenceNumber);
   }
 
+  uint64 sendDataWithAutoAck(const BufferSlice& data) {
+      return sendData(data, mLastReceivedSequenceNumber);
+  }
+
   // Explicit version, used when acking direct response to a packet
   uint64 sendData(const void* data, uint32 length, bool isAck, uint64 ack_seqno) {
+    // Acks go out immediately and never get stored, so only queued segments
+    // need a copy of the data.
+    if ( !isAck )
+      return sendData(mSSTConnVars->mBufferPool.copy(data, length), ack_seqno);
+
     boost::mutex::scoped_lock lock(mQueueMutex);
 
     assert(length <= MAX_PAYLOAD_SIZE);
 
     uint64 transmitSequenceNumber =  mTransmitSequenceNumber;
 
-    if ( isAck ) {
-      Sirikata::Protocol::SST::SSTChannelHeader sstMsg;
-      sstMsg.set_channel_id( mRemoteChannelID );
-      sstMsg.set_transmit_sequence_number(mTransmitSequenceNumber);
-      sstMsg.set_ack_count(1);
-      sstMsg.set_ack_sequence_number(ack_seqno);
+    Sirikata::Protocol::SST::SSTChannelHeader sstMsg;
+    sstMsg.set_channel_id( mRemoteChannelID );
+    sstMsg.set_transmit_sequence_number(mTransmitSequenceNumber);
+    setAck(sstMsg, ack_seqno);
 
-      sstMsg.set_payload(data, length);
+    sstMsg.set_payload(data, length);
 
-      sendSSTChannelPacket(sstMsg);
-    }
-    else {
-      if (mQueuedSegments.size() < MAX_QUEUED_SEGMENTS) {
-        mQueuedSegments.push_back( std::tr1::shared_ptr<ChannelSegment>(
-                                   new ChannelSegment(data, length, mTransmitSequenceNumber, ack_seqno) ) );
-        // Only service if we're going to be able to send
-        // immediately. Otherwise, we must already have outstanding
-        // packets waiting for a timeout, in which case this new
-        // packet will be dealt with as the existing servicing cycle
-        // completes.
-        if (mOutstandingSegments.size() <= mCwnd) {
-            mInSendingMode = true;
-            scheduleConnectionService();
-        }
+    sendSSTChannelPacket(sstMsg);
+
+    mTransmitSequenceNumber++;
+
+    return transmitSequenceNumber;
+  }
+
+  // Queues a segment for (reliable) transmission. The segment adopts the
+  // pooled buffer, which is kept for retransmissions until it's acked. It's
+  // copied into the channel header each time it's sent.
+  uint64 sendData(const BufferSlice& data, uint64 ack_seqno) {
+    boost::mutex::scoped_lock lock(mQueueMutex);
+
+    assert(data.size() <= MAX_PAYLOAD_SIZE);
+
+    uint64 transmitSequenceNumber =  mTransmitSequenceNumber;
+
+    if (mQueuedSegments.size() < MAX_QUEUED_SEGMENTS) {
+      mQueuedSegments.push_back( std::tr1::shared_ptr<ChannelSegment>(
+                                 new ChannelSegment(data, mTransmitSequenceNumber, ack_seqno) ) );
+      // Only service if we're going to be able to send
+      // immediately. Otherwise, we must already have outstanding
+      // packets waiting for a timeout, in which case this new
+      // packet will be dealt with as the existing servicing cycle
+      // completes.
+      if (mOutstandingSegments.size() <= mCongestionController->cwnd()) {
+          mInSendingMode = true;
+          scheduleConnectionService();
       }
     }
 
@@ -998,22 +1208,45 @@ private:
     return id;
   }
 
-  void markAcknowledgedPacket(uint64 receivedAckNum) {
+  // Handles the ack range (receivedAckNum - receivedAckCount, receivedAckNum]
+  // carried by a received packet.
+  void markAcknowledgedPacket(uint64 receivedAckNum, uint64 receivedAckCount) {
     boost::mutex::scoped_lock lock(mOutstandingSegmentsMutex);
 
+    if (receivedAckCount == 0) receivedAckCount = 1;
+    if (receivedAckCount > receivedAckNum) receivedAckCount = receivedAckNum;
+    uint64 ackRangeStart = receivedAckNum - receivedAckCount + 1;
+
+    const Time curTime = Timer::now();
+    uint32 numAcked = 0;
+    Duration rttSample = Duration::zero();
     for (std::deque< std::tr1::shared_ptr<ChannelSegment> >::iterator it = mOutstandingSegments.begin();
-         it != mOutstandingSegments.end(); it++)
+         it != mOutstandingSegments.end(); )
     {
         std::tr1::shared_ptr<ChannelSegment> segment = *it;
 
         if (!segment) {
-          mOutstandingSegments.erase(it);
-          it = mOutstandingSegments.begin();
+          it = mOutstandingSegments.erase(it);
           continue;
         }
 
-        if (segment->mChannelSequenceNumber == receivedAckNum) {
-          segment->mAckTime = Timer::now();
+        if (segment->mChannelSequenceNumber < ackRangeStart ||
+            segment->mChannelSequenceNumber > receivedAckNum)
+        {
+          it++;
+          continue;
+        }
+
+        segment->mAckTime = curTime;
+
+        // Only the packet that triggered this ack gives us an accurate RTT
+        // sample, and only if we haven't retransmitted it.
+        if (segment->mChannelSequenceNumber == receivedAckNum && !segment->mRetransmitted) {
+          rttSample = segment->mAckTime - segment->mTransmitTime;
+          if (mSmoothedRTT == Duration::zero())
+            mSmoothedRTT = rttSample;
+          else
+            mSmoothedRTT = mSmoothedRTT * CC_ALPHA + rttSample * (1.0-CC_ALPHA);
 
           if (mFirstRTO ) {
 	         mRTOMicroseconds = 10 * ((segment->mAckTime - segment->mTransmitTime).toMicroseconds()) ;
@@ -1023,27 +1256,64 @@ private:
             mRTOMicroseconds = CC_ALPHA * mRTOMicroseconds +
               (1.0-CC_ALPHA) * (segment->mAckTime - segment->mTransmitTime).toMicroseconds();
           }
+        }
 
-          mOutstandingSegments.erase(it);
+        it = mOutstandingSegments.erase(it);
+        numAcked++;
+    }
 
-          if (mCwnd <= mSSThresh) {
-              // Slow start exponential growth, bump for every acked packet
-              mCwnd += 1;
-          }
-          else {
-              // regular growth
-              if (rand() % mCwnd == 0)
-                  mCwnd += 1;
-          }
+    if (numAcked == 0) return;
 
-          // We freed up some space in the window. If we have
-          // something left to send, trigger servicing.
-          if (!mQueuedSegments.empty()) {
-              mInSendingMode = true;
-              scheduleConnectionService();
-          }
+    // During fast recovery the window stays where the loss put it.
+    if (!mInFastRecovery)
+        mCongestionController->onAck(numAcked, rttSample);
+
+    if (mInFastRecovery && receivedAckNum >= mRecoveryPoint)
+        mInFastRecovery = false;
+
+    detectLosses(receivedAckNum, numAcked, curTime);
+
+    // We freed up some space in the window. If we have
+    // something left to send, trigger servicing.
+    if (!mQueuedSegments.empty()) {
+        mInSendingMode = true;
+        scheduleConnectionService();
+    }
+  }
 
-          return;
+  // Called after numAcked segments, up to newestAcked, were acked. Any
+  // segments sent before them which are still outstanding were probably
+  // lost. Once enough later segments have been acked, retransmit them
+  // immediately instead of waiting for the timeout in
+  // serviceConnection. mOutstandingSegmentsMutex must be held.
+  void detectLosses(uint64 newestAcked, uint32 numAcked, const Time& curTime) {
+    if (!mSSTConnVars->mFastRetransmit) return;
+    // The connection request is retransmitted by serviceConnection.
+    if (mState == CONNECTION_PENDING_CONNECT) return;
+
+    boost::mutex::scoped_lock lock(mQueueMutex);
+
+    for (std::deque< std::tr1::shared_ptr<ChannelSegment> >::iterator it = mOutstandingSegments.begin();
+         it != mOutstandingSegments.end(); it++)
+    {
+        std::tr1::shared_ptr<ChannelSegment> segment = *it;
+        if (segment->mChannelSequenceNumber > newestAcked || segment->mRetransmitted)
+            continue;
+
+        segment->mNumLaterAcks += numAcked;
+        if (segment->mNumLaterAcks < SST_DUPACK_THRESHOLD)
+            continue;
+
+        sendSegment(segment, curTime);
+        segment->mRetransmitted = true;
+        mNumFastRetransmits++;
+
+        // Back off once per window of data and hold there until the recovery
+        // completes.
+        if (!mInFastRecovery) {
+            mCongestionController->onFastRetransmit();
+            mRecoveryPoint = mTransmitSequenceNumber - 1;
+            mInFastRecovery = true;
         }
     }
   }
@@ -1221,15 +1491,20 @@ private:
           // The datagram is all here, just deliver
           PartialPayloadMap::iterator it = mPartialReadDatagrams.find(received_stream_msg->lsid());
           if (it != mPartialReadDatagrams.end()) {
-              // Had previous partial packets
-              // FIXME this should be more efficient
-              std::string full_payload;
+              // Had previous partial packets. Reassemble them into a single
+              // pooled buffer with one copy per fragment.
+              uint32 payload_size = received_stream_msg->payload().size();
               for(PartialPayloadList::iterator pp_it = it->second.begin(); pp_it != it->second.end(); pp_it++)
-                  full_payload = full_payload + (*pp_it);
-              full_payload = full_payload + received_stream_msg->payload();
+                  payload_size += pp_it->size();
+              BufferSlice full_payload = mSSTConnVars->mBufferPool.allocate(payload_size);
+              uint32 payload_offset = 0;
+              for(PartialPayloadList::iterator pp_it = it->second.begin(); pp_it != it->second.end(); pp_it++) {
+                  memcpy(full_payload.data() + payload_offset, pp_it->data(), pp_it->size());
+                  payload_offset += pp_it->size();
+              }
+              memcpy(full_payload.data() + payload_offset, received_stream_msg->payload().data(), received_stream_msg->payload().size());
               mPartialReadDatagrams.erase(it);
-              uint8* payload = (uint8*) full_payload.data();
-              uint32 payload_size = full_payload.size();
+              uint8* payload = full_payload.data();
               for (uint32 i=0 ; i < datagramCallbacks.size(); i++) {
                   datagramCallbacks[i](payload, payload_size);;
               }
@@ -1251,8 +1526,7 @@ private:
     Sirikata::Protocol::SST::SSTChannelHeader sstMsg;
     sstMsg.set_channel_id( mRemoteChannelID );
     sstMsg.set_transmit_sequence_number(mTransmitSequenceNumber);
-    sstMsg.set_ack_count(1);
-    sstMsg.set_ack_sequence_number(received_channel_msg->transmit_sequence_number());
+    setAck(sstMsg, received_channel_msg->transmit_sequence_number());
 
     sendSSTChannelPacket(sstMsg);
 
@@ -1272,7 +1546,7 @@ private:
       uint64 ack_seqno = received_msg->transmit_sequence_number();
 
     uint64 receivedAckNum = received_msg->ack_sequence_number();
-    markAcknowledgedPacket(receivedAckNum);
+    markAcknowledgedPacket(receivedAckNum, received_msg->ack_count());
 
     bool handled = false;
     if (mState == CONNECTION_PENDING_CONNECT) {
@@ -1302,20 +1576,28 @@ private:
 
       sendData(received_payload, 0, false, ack_seqno);
 
-      boost::mutex::scoped_lock lock(mSSTConnVars->sStaticMembersLock.getMutex());
-
-      ConnectionReturnCallbackMap& connectionReturnCallbackMap = mSSTConnVars->sConnectionReturnCallbackMap;
-      ConnectionMap& connectionMap = mSSTConnVars->sConnectionMap;
-
-      if (connectionReturnCallbackMap.find(mLocalEndPoint) != connectionReturnCallbackMap.end())
+      ConnectionReturnCallbackFunction cb = NULL;
+      std::tr1::shared_ptr<Connection> conn;
       {
-        if (connectionMap.find(mLocalEndPoint) != connectionMap.end()) {
-          std::tr1::shared_ptr<Connection> conn = connectionMap[mLocalEndPoint];
+        ConnectionShard& shard = mSSTConnVars->shard(mLocalEndPoint);
+        boost::mutex::scoped_lock lock(shard.mutex);
 
-          connectionReturnCallbackMap[mLocalEndPoint] (SST_IMPL_SUCCESS, conn);
+        ConnectionReturnCallbackMap& connectionReturnCallbackMap = shard.connectionReturnCallbacks;
+        ConnectionMap& connectionMap = shard.connections;
+
+        typename ConnectionReturnCallbackMap::iterator cb_it = connectionReturnCallbackMap.find(mLocalEndPoint);
+        if (cb_it != connectionReturnCallbackMap.end())
+        {
+          typename ConnectionMap::iterator conn_it = connectionMap.find(mLocalEndPoint);
+          if (conn_it != connectionMap.end()) {
+            conn = conn_it->second;
+            cb = cb_it->second;
+          }
+          connectionReturnCallbackMap.erase(cb_it);
         }
-        connectionReturnCallbackMap.erase(mLocalEndPoint);
       }
+      if (cb)
+        cb(SST_IMPL_SUCCESS, conn);
 
       handled = true;
     }
@@ -1355,14 +1637,36 @@ private:
     // We can only update the received seqno that we're going to ack if we
     // actually *fully handled* the packet. This is important, e.g., if we
     // receive a data packet but it had data outside the receive window
-    if (handled)
+    if (handled) {
         mLastReceivedSequenceNumber = ack_seqno;
+
+        boost::mutex::scoped_lock lock(mQueueMutex);
+        mReceivedSequences.insert(ack_seqno);
+    }
   }
 
   uint64 getRTOMicroseconds() {
     return mRTOMicroseconds;
   }
 
+  ConnectionStats getStats() {
+    boost::mutex::scoped_lock lock(mOutstandingSegmentsMutex);
+    boost::mutex::scoped_lock queue_lock(mQueueMutex);
+
+    ConnectionStats stats;
+    stats.congestionControl = mCongestionController->name();
+    stats.cwnd = mCongestionController->cwnd();
+    stats.ssthresh = mCongestionController->ssthresh();
+    stats.outstandingSegments = mOutstandingSegments.size();
+    stats.queuedSegments = mQueuedSegments.size();
+    stats.rtt = mSmoothedRTT;
+    stats.rto = Duration::microseconds(mRTOMicroseconds);
+    stats.segmentsSent = mNumSegmentsSent;
+    stats.fastRetransmits = mNumFastRetransmits;
+    stats.timeouts = mNumTimeouts;
+    return stats;
+  }
+
   void eraseDisconnectedStream(Stream<EndPointType>* s) {
     mOutgoingSubstreamMap.erase(s->getLSID());
     mIncomingSubstreamMap.erase(s->getRemoteLSID());
@@ -1389,10 +1693,11 @@ private:
       //This is in contrast to the case where the connection got connected, but
       //the connection's root stream was unable to do so.
 
-       boost::mutex::scoped_lock lock(conn->mSSTConnVars->sStaticMembersLock.getMutex());
+       ConnectionShard& shard = conn->mSSTConnVars->shard(conn->localEndPoint());
+       boost::mutex::scoped_lock lock(shard.mutex);
        ConnectionReturnCallbackFunction cb = NULL;
 
-       ConnectionReturnCallbackMap& connectionReturnCallbackMap = conn->mSSTConnVars->sConnectionReturnCallbackMap;
+       ConnectionReturnCallbackMap& connectionReturnCallbackMap = shard.connectionReturnCallbacks;
        if (connectionReturnCallbackMap.find(conn->localEndPoint()) != connectionReturnCallbackMap.end()) {
          cb = connectionReturnCallbackMap[conn->localEndPoint()];
        }
@@ -1400,7 +1705,7 @@ private:
        std::tr1::shared_ptr<Connection>  failed_conn = conn;
 
        connectionReturnCallbackMap.erase(conn->localEndPoint());
-       conn->mSSTConnVars->sConnectionMap.erase(conn->localEndPoint());
+       shard.connections.erase(conn->localEndPoint());
 
        lock.unlock();
 
@@ -1415,7 +1720,7 @@ private:
 
    // This version should only be called by the destructor!
    void finalCleanup() {
-     boost::mutex::scoped_lock lock(mSSTConnVars->sStaticMembersLock.getMutex());
+     boost::mutex::scoped_lock lock(mSSTConnVars->shard(mLocalEndPoint).mutex);
 
      mDatagramLayer->unlisten(mLocalEndPoint);
 
@@ -1428,40 +1733,51 @@ private:
    }
 
    static void stopConnections(ConnectionVariables<EndPointType>* sstConnVars) {
-       // This just passes stop calls along to all the connections
-       boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
-       for(typename ConnectionMap::iterator it = sstConnVars->sConnectionMap.begin(); it != sstConnVars->sConnectionMap.end(); it++)
-           it->second->stop();
+       // This just passes stop calls along to all the connections. Collect
+       // them first so we aren't holding shard locks while they stop.
+       std::vector<ConnectionPtr> conns;
+       for(uint32 i = 0; i < ConnectionVariables<EndPointType>::NUM_SHARDS; i++) {
+           ConnectionShard& shard = sstConnVars->shard(i);
+           boost::mutex::scoped_lock lock(shard.mutex);
+           for(typename ConnectionMap::iterator it = shard.connections.begin(); it != shard.connections.end(); it++)
+               conns.push_back(it->second);
+       }
+       for(uint32 i = 0; i < conns.size(); i++)
+           conns[i]->stop();
    }
 
    static void closeConnections(ConnectionVariables<EndPointType>* sstConnVars) {
        // We have to be careful with this function. Because it is going to free
        // the connections, we have to make sure not to let them get freed where
-       // the deleter will modify sConnectionMap while we're still modifying it.
+       // the deleter will modify the connection maps while we're still
+       // modifying them.
        //
-       // Our approach is to just pick out the first connection, make a copy of
-       // its shared_ptr to make sure it doesn't get freed until we want it to,
-       // remove it from sConnectionMap, and then get rid of the shared_ptr to
-       // allow the connection to be freed.
+       // Our approach is to just pick out the first connection in each shard,
+       // make a copy of its shared_ptr to make sure it doesn't get freed until
+       // we want it to, remove it from the shard, and then get rid of the
+       // shared_ptr to allow the connection to be freed.
        //
-       // Note the careful locking. Connection::~Connection will acquire the
-       // sStaticMembersLock, so to avoid deadlocking we grab the shared_ptr,
+       // Note the careful locking. Connection::~Connection will acquire its
+       // shard's lock, so to avoid deadlocking we grab the shared_ptr,
        // remove it from the list and then only allow the Connection to be
        // destroyed after we've unlocked.
-       while(true) {
-           ConnectionPtr saved;
-           {
-               boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
-               if (sstConnVars->sConnectionMap.empty()) break;
-               ConnectionMap& connectionMap = sstConnVars->sConnectionMap;
-
-               saved = connectionMap.begin()->second;
-               connectionMap.erase(connectionMap.begin());
+       for(uint32 i = 0; i < ConnectionVariables<EndPointType>::NUM_SHARDS; i++) {
+           ConnectionShard& shard = sstConnVars->shard(i);
+           while(true) {
+               ConnectionPtr saved;
+               {
+                   boost::mutex::scoped_lock lock(shard.mutex);
+                   if (shard.connections.empty()) break;
+                   ConnectionMap& connectionMap = shard.connections;
+
+                   saved = connectionMap.begin()->second;
+                   connectionMap.erase(connectionMap.begin());
+               }
+               // Calling close makes sure we kill the check alive timer,
+               // which holds a shared_ptr.
+               saved->close(false);
+               saved.reset();
            }
-           // Calling close makes sure we kill the check alive timer,
-           // which holds a shared_ptr.
-           saved->close(false);
-           saved.reset();
        }
    }
 
@@ -1474,18 +1790,33 @@ private:
 
      uint8 channelID = received_msg->channel_id();
 
-     boost::mutex::scoped_lock lock(sstConnVars->sStaticMembersLock.getMutex());
+     std::tr1::shared_ptr<Connection<EndPointType> > conn;
+     StreamReturnCallbackFunction listeningCallback = NULL;
+     {
+       ConnectionShard& shard = sstConnVars->shard(localEndPoint);
+       boost::mutex::scoped_lock lock(shard.mutex);
+
+       typename ConnectionMap::iterator conn_it = shard.connections.find(localEndPoint);
+       if (conn_it != shard.connections.end()) {
+         conn = conn_it->second;
+       }
+       else if (channelID == 0) {
+         typename StreamReturnCallbackMap::iterator listen_it = shard.listeningConnectionsCallbacks.find(localEndPoint);
+         if (listen_it != shard.listeningConnectionsCallbacks.end())
+           listeningCallback = listen_it->second;
+       }
+     }
 
-     ConnectionMap& connectionMap = sstConnVars->sConnectionMap;
-     if (connectionMap.find(localEndPoint) != connectionMap.end()) {
+     if (conn) {
        if (channelID == 0) {
  	/*Someone's already connected at this port. Either don't reply or
  	  send back a request rejected message. */
 
         SST_LOG(info, "Someone's already connected at this port on object " << localEndPoint.endPoint.toString() << "\n");
+        // Nothing else has seen the message, so it's still ours to free
+        delete received_msg;
  	return;
        }
-       std::tr1::shared_ptr<Connection<EndPointType> > conn = connectionMap[localEndPoint];
 
        conn->receiveMessage(received_msg);
      }
@@ -1493,12 +1824,13 @@ private:
        /* it's a new channel request negotiation protocol
  	        packet ; allocate a new channel.*/
 
-       StreamReturnCallbackMap& listeningConnectionsCallbackMap = sstConnVars->sListeningConnectionsCallbackMap;
-       if (listeningConnectionsCallbackMap.find(localEndPoint) != listeningConnectionsCallbackMap.end()) {
+       if (listeningCallback) {
          uint32* received_payload = (uint32*) received_msg->payload().data();
 
          uint32 payload[2];
 
+         boost::mutex::scoped_lock alloc_lock(sstConnVars->channelAllocationMutex(localEndPoint.endPoint));
+
          uint32 availableChannel = sstConnVars->getAvailableChannel(localEndPoint.endPoint);
          payload[0] = htonl(availableChannel);
          uint32 availablePort = availableChannel; //availableChannel is picked from the same 16-bit
@@ -1512,9 +1844,14 @@ private:
                          new Connection(sstConnVars, newLocalEndPoint, remoteEndPoint));
 
 
-         conn->listenStream(newLocalEndPoint.port, listeningConnectionsCallbackMap[localEndPoint]);
+         conn->listenStream(newLocalEndPoint.port, listeningCallback);
          conn->setWeakThis(conn);
-         connectionMap[newLocalEndPoint] = conn;
+         {
+           ConnectionShard& newShard = sstConnVars->shard(newLocalEndPoint);
+           boost::mutex::scoped_lock lock(newShard.mutex);
+           newShard.connections[newLocalEndPoint] = conn;
+         }
+         alloc_lock.unlock();
 
          conn->setLocalChannelID(availableChannel);
          if (received_msg->payload().size()>=sizeof(uint32)) {
@@ -1537,6 +1874,7 @@ private:
    virtual ~Connection() {
        // Make sure we've fully cleaned up
        finalCleanup();
+       delete mCongestionController;
    }
 
 
@@ -1699,12 +2037,12 @@ private:
              remote end point.
   */
   virtual void close(bool force) {
-      boost::mutex::scoped_lock lock(mSSTConnVars->sStaticMembersLock.getMutex());
+      boost::mutex::scoped_lock lock(mSSTConnVars->shard(mLocalEndPoint).mutex);
       iClose(force);
   }
 
   /* Internal, non-locking implementation of close().
-     Lock mSSTConnVars->sStaticMembersLock before calling this function */
+     Lock mSSTConnVars->shard(mLocalEndPoint) before calling this function */
   virtual void iClose(bool force) {
       // We kill the checkAlive timer in cleanup() and in close()
       // because both paths appear to be possible to hit alone
@@ -1714,7 +2052,7 @@ private:
     /* (mState != CONNECTION_DISCONNECTED) implies close() wasnt called
        through the destructor. */
     if (force && mState != CONNECTION_DISCONNECTED) {
-      mSSTConnVars->sConnectionMap.erase(mLocalEndPoint);
+      mSSTConnVars->shard(mLocalEndPoint).connections.erase(mLocalEndPoint);
     }
 
     if (force) {
@@ -1751,28 +2089,20 @@ private:
 class StreamBuffer{
 public:
 
-  uint8* mBuffer;
+  BufferSlice mBuffer;
   uint32 mBufferLength;
   uint64 mOffset;
 
   Time mTransmitTime;
   Time mAckTime;
 
-  StreamBuffer(const uint8* data, uint32 len, uint64 offset) :
+  // The StreamBuffer adopts the (pooled) buffer, no copy is made.
+  StreamBuffer(const BufferSlice& data, uint64 offset) :
+    mBuffer(data),
+    mBufferLength(data.size()),
+    mOffset(offset),
     mTransmitTime(Time::null()), mAckTime(Time::null())
   {
-    mBuffer = new uint8[len+1];
-
-    if (len > 0) {
-      memcpy(mBuffer,data,len);
-    }
-
-    mBufferLength = len;
-    mOffset = offset;
-  }
-
-  ~StreamBuffer() {
-      delete []mBuffer;
   }
 
     // This doesn't check the data, just that the StreamBuffers
@@ -1993,12 +2323,16 @@ public:
           localEndPoint.port = bdl->getUnusedPort(localEndPoint.endPoint);
       }
 
-      StreamReturnCallbackMap& streamReturnCallbackMap = sstConnVars->mStreamReturnCallbackMap;
-      if (streamReturnCallbackMap.find(localEndPoint) != streamReturnCallbackMap.end()) {
-        return false;
-      }
+      {
+          typename ConnectionVariables<EndPointType>::ConnectionShard& shard = sstConnVars->shard(localEndPoint);
+          boost::mutex::scoped_lock lock(shard.mutex);
+          StreamReturnCallbackMap& streamReturnCallbackMap = shard.streamReturnCallbacks;
+          if (streamReturnCallbackMap.find(localEndPoint) != streamReturnCallbackMap.end()) {
+              return false;
+          }
 
-      streamReturnCallbackMap[localEndPoint] = cb;
+          streamReturnCallbackMap[localEndPoint] = cb;
+      }
 
       bool result = Connection<EndPointType>::createConnection(sstConnVars,
                                                                localEndPoint,
@@ -2074,7 +2408,7 @@ public:
       if (mCurrentQueueLength+len > MAX_QUEUE_LENGTH) {
 	return 0;
       }
-      mQueuedBuffers.push_back( std::tr1::shared_ptr<StreamBuffer>(new StreamBuffer(data, len, mNumBytesSent)) );
+      mQueuedBuffers.push_back( std::tr1::shared_ptr<StreamBuffer>(new StreamBuffer(mSSTConnVars->mBufferPool.copy(data, len), mNumBytesSent)) );
       mCurrentQueueLength += len;
       mNumBytesSent += len;
 
@@ -2094,7 +2428,7 @@ public:
 	  break;
 	}
 
-	mQueuedBuffers.push_back( std::tr1::shared_ptr<StreamBuffer>(new StreamBuffer(data+currOffset, buffLen, mNumBytesSent)) );
+	mQueuedBuffers.push_back( std::tr1::shared_ptr<StreamBuffer>(new StreamBuffer(mSSTConnVars->mBufferPool.copy(data+currOffset, buffLen), mNumBytesSent)) );
 	currOffset += buffLen;
 	mCurrentQueueLength += buffLen;
 	mNumBytesSent += buffLen;
@@ -2442,23 +2776,25 @@ private:
   }
 
   static void connectionCreated( int errCode, std::tr1::shared_ptr<Connection<EndPointType> > c) {
-    StreamReturnCallbackMap& streamReturnCallbackMap = c->mSSTConnVars->mStreamReturnCallbackMap;
-    assert(streamReturnCallbackMap.find(c->localEndPoint()) != streamReturnCallbackMap.end());
+    StreamReturnCallbackFunction cb;
+    {
+      typename ConnectionVariables<EndPointType>::ConnectionShard& shard = c->mSSTConnVars->shard(c->localEndPoint());
+      boost::mutex::scoped_lock lock(shard.mutex);
+      StreamReturnCallbackMap& streamReturnCallbackMap = shard.streamReturnCallbacks;
+      typename StreamReturnCallbackMap::iterator it = streamReturnCallbackMap.find(c->localEndPoint());
+      assert(it != streamReturnCallbackMap.end());
+      cb = it->second;
+      streamReturnCallbackMap.erase(it);
+    }
 
     if (errCode != SST_IMPL_SUCCESS) {
-
-      StreamReturnCallbackFunction cb = streamReturnCallbackMap[c->localEndPoint()];
-      streamReturnCallbackMap.erase(c->localEndPoint());
-
       cb(SST_IMPL_FAILURE, StreamPtr() );
 
       return;
     }
 
-    c->stream(streamReturnCallbackMap[c->localEndPoint()], NULL , 0,
+    c->stream(cb, NULL , 0,
 	      c->localEndPoint().port, c->remoteEndPoint().port);
-
-    streamReturnCallbackMap.erase(c->localEndPoint());
   }
 
   void serviceStreamNoReturn() {
@@ -2502,7 +2838,11 @@ private:
         std::tr1::shared_ptr<Connection<EndPointType> > conn = mConnection.lock();
         assert(conn);
 
-        mSSTConnVars->mStreamReturnCallbackMap.erase(conn->localEndPoint());
+        {
+          typename ConnectionVariables<EndPointType>::ConnectionShard& shard = mSSTConnVars->shard(conn->localEndPoint());
+          boost::mutex::scoped_lock lock(shard.mutex);
+          shard.streamReturnCallbacks.erase(conn->localEndPoint());
+        }
 
 	// If this is the root stream that failed to connect, close the
 	// connection associated with it as well.
@@ -2581,7 +2921,7 @@ private:
 	    break;
 	  }
 
-	  uint64 channelID = sendDataPacket(buffer->mBuffer,
+	  uint64 channelID = sendDataPacket(buffer->mBuffer.data(),
 					    buffer->mBufferLength,
 					    buffer->mOffset
 					    );
@@ -2990,11 +3330,13 @@ private:
 
     sstMsg.set_payload(data, len);
 
+    // PBJ only serializes to std::string, so the serialized message is copied
+    // into the pooled buffer the channel segment keeps for retransmissions.
     std::string buffer = serializePBJMessage(sstMsg);
 
     std::tr1::shared_ptr<Connection<EndPointType> > conn = mConnection.lock();
     assert(conn);
-    return conn->sendDataWithAutoAck(  buffer.data(), buffer.size(), false);
+    return conn->sendDataWithAutoAck( mSSTConnVars->mBufferPool.copy(buffer.data(), buffer.size()) );
   }
 
   // Reply packets should be in repsonse to other side initiating connection, so
@@ -3249,6 +3591,73 @@ public:
     return mSSTConnVars.getDatagramLayer(endPoint);
   }
 
+  // Pool backing segment buffers for all connections managed by this
+  // ConnectionManager.
+  BufferPool& bufferPool() {
+    return mSSTConnVars.mBufferPool;
+  }
+
+  // Enable or disable fast retransmission of segments which acks indicate
+  // were lost. Enabled by default.
+  void setFastRetransmit(bool enabled) {
+    mSSTConnVars.mFastRetransmit = enabled;
+  }
+
+  // Select the congestion control algorithm ("reno", "cubic" or "delay") for
+  // connections created from now on, overriding the sst.congestion-control
+  // option for this ConnectionManager.
+  void setCongestionControl(const String& cc) {
+    mSSTConnVars.mCongestionControl = cc;
+  }
+
+  typedef std::pair<EndPoint<EndPointType>, ConnectionStats> ConnectionStatsEntry;
+  typedef std::vector<ConnectionStatsEntry> ConnectionStatsList;
+  // Get stats for all active connections, keyed by their remote endpoint.
+  ConnectionStatsList getConnectionStats() {
+    std::vector<std::tr1::shared_ptr<Connection<EndPointType> > > conns;
+    for(uint32 i = 0; i < ConnectionVariables<EndPointType>::NUM_SHARDS; i++) {
+      typename ConnectionVariables<EndPointType>::ConnectionShard& shard = mSSTConnVars.shard(i);
+      boost::mutex::scoped_lock lock(shard.mutex);
+      for(typename ConnectionVariables<EndPointType>::ConnectionMap::iterator it = shard.connections.begin();
+          it != shard.connections.end(); it++)
+      {
+        if (it->second) conns.push_back(it->second);
+      }
+    }
+
+    ConnectionStatsList result;
+    for(uint32 i = 0; i < conns.size(); i++)
+      result.push_back(ConnectionStatsEntry(conns[i]->remoteEndPoint(), conns[i]->getStats()));
+    return result;
+  }
+
+  // Command handler which reports getConnectionStats(), e.g. for
+  // registering as space.sst.stats with a Commander.
+  void commandConnectionStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
+    Command::Result result = Command::EmptyResult();
+    result.put( String("connections"), Command::Array());
+    Command::Array& conns_ary = result.getArray("connections");
+
+    ConnectionStatsList stats = getConnectionStats();
+    for(uint32 i = 0; i < stats.size(); i++) {
+      const ConnectionStats& cs = stats[i].second;
+      conns_ary.push_back(Command::Object());
+      conns_ary.back().put("remote", stats[i].first.toString());
+      conns_ary.back().put("congestion-control", cs.congestionControl);
+      conns_ary.back().put("cwnd", cs.cwnd);
+      conns_ary.back().put("ssthresh", cs.ssthresh);
+      conns_ary.back().put("outstanding", cs.outstandingSegments);
+      conns_ary.back().put("queued", cs.queuedSegments);
+      conns_ary.back().put("rtt", cs.rtt.toString());
+      conns_ary.back().put("rto", cs.rto.toString());
+      conns_ary.back().put("sent", cs.segmentsSent);
+      conns_ary.back().put("fast-retransmits", cs.fastRetransmits);
+      conns_ary.back().put("timeouts", cs.timeouts);
+    }
+
+    cmdr->result(cmdid, result);
+  }
+
   bool listen(StreamReturnCallbackFunction cb, EndPoint <EndPointType> listeningEndPoint) {
     return Stream<EndPointType>::listen(&mSSTConnVars, cb, listeningEndPoint);
   }
@@ -46,6 +46,7 @@
 #define OPT_PID_FILE                    "pid-file"
 
 #define OPT_SST_DEFAULT_WINDOW_SIZE  "sst.default-window-size"
+#define OPT_SST_CONGESTION_CONTROL   "sst.congestion-control"
 
 #define STATS_TRACE_FILE     "stats.trace-filename"
 #define PROFILE                    "profile"
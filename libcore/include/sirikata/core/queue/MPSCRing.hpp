@@ -0,0 +1,163 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_QUEUE_MPSC_RING_HPP_
+#define _SIRIKATA_CORE_QUEUE_MPSC_RING_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <sirikata/core/util/Noncopyable.hpp>
+
+namespace Sirikata {
+
+/** A bounded queue with any number of producers and a single consumer, which
+ *  never takes a lock or allocates memory after construction. It's a ring of
+ *  slots, each tagged with a sequence number that says whether it's waiting
+ *  for a producer or holds a value for the consumer. Producers claim a slot by
+ *  advancing the tail with a compare-and-swap, fill it in, and then publish it
+ *  by bumping its sequence number. The consumer is the only one touching the
+ *  head, so it needs no atomic operations at all, and popBatch() takes
+ *  everything that's ready with a single memory barrier.
+ *
+ *  The head and tail are kept on separate cache lines so producers and the
+ *  consumer don't fight over them.
+ *
+ *  push() fails rather than waiting if the ring is full. pop() and popBatch()
+ *  must only ever be called from one thread at a time. T must be default
+ *  constructible and assignable. Values are reset to T() when popped.
+ */
+template <typename T>
+class MPSCRing : Noncopyable {
+public:
+    enum {
+        CacheLineSize = 64
+    };
+
+    /** Create a ring which can hold at least min_capacity items. The capacity
+     *  is rounded up to a power of two.
+     */
+    MPSCRing(uint32 min_capacity)
+     : mSlots(NULL),
+       mMask(0),
+       mTail(0),
+       mHead(0)
+    {
+        uint32 capacity = 2;
+        while(capacity < min_capacity)
+            capacity *= 2;
+        mMask = capacity - 1;
+        mSlots = new Slot[capacity];
+        for(uint32 i = 0; i < capacity; i++)
+            mSlots[i].seq = i;
+    }
+
+    ~MPSCRing() {
+        delete[] mSlots;
+    }
+
+    uint32 capacity() const {
+        return mMask + 1;
+    }
+
+    /** Add a value to the ring. May be called from any thread.
+     *  \returns true if the value was added, false if the ring was full
+     */
+    bool push(const T& value) {
+        uint32 pos = mTail;
+        while(true) {
+            uint32 seq = mSlots[pos & mMask].seq;
+            int32 diff = (int32)(seq - pos);
+            if (diff == 0) {
+                if (compare_and_swap(&mTail, pos, pos + 1))
+                    break;
+                pos = mTail;
+            }
+            else if (diff < 0) {
+                // The consumer hasn't freed this slot since the last time
+                // around the ring
+                return false;
+            }
+            else {
+                // Another producer got here first
+                pos = mTail;
+            }
+        }
+
+        Slot& slot = mSlots[pos & mMask];
+        slot.value = value;
+        // The atomic increment is a full barrier, so the consumer can't see
+        // the new sequence number before the value
+        SizedAtomicValue<sizeof(uint32)>::inc(&slot.seq);
+        return true;
+    }
+
+    /** Pop the value at the front of the ring. Only the consumer thread may
+     *  call this.
+     *  \returns true if a value was popped, false if the ring was empty
+     */
+    bool pop(T& out) {
+        return (popBatch(&out, 1) == 1);
+    }
+
+    /** Pop up to max_items values from the front of the ring into out. Only
+     *  the consumer thread may call this.
+     *  \returns the number of values popped
+     */
+    uint32 popBatch(T* out, uint32 max_items) {
+        uint32 head = mHead;
+        uint32 count = 0;
+        while(count < max_items && mSlots[(head + count) & mMask].seq == head + count + 1)
+            count++;
+        if (count == 0)
+            return 0;
+
+        // Don't read values until we've seen they were published...
+        memory_barrier();
+        for(uint32 i = 0; i < count; i++) {
+            Slot& slot = mSlots[(head + i) & mMask];
+            out[i] = slot.value;
+            slot.value = T();
+        }
+        // ...and don't hand slots back to producers until we're done with them
+        memory_barrier();
+        for(uint32 i = 0; i < count; i++)
+            mSlots[(head + i) & mMask].seq = head + i + capacity();
+
+        mHead = head + count;
+        return count;
+    }
+
+    /** Check whether the ring is empty. This is exact on the consumer thread,
+     *  but other threads may get a stale answer.
+     */
+    bool probablyEmpty() const {
+        uint32 head = mHead;
+        return (mSlots[head & mMask].seq != head + 1);
+    }
+
+    // Approximate number of items in the ring, including ones producers are
+    // still filling in
+    uint32 probableSize() const {
+        return mTail - mHead;
+    }
+
+private:
+    struct Slot {
+        volatile uint32 seq;
+        T value;
+    };
+
+    Slot* mSlots;
+    uint32 mMask;
+
+    char mPadBeforeTail[CacheLineSize];
+    volatile uint32 mTail;
+    char mPadBeforeHead[CacheLineSize - sizeof(uint32)];
+    volatile uint32 mHead;
+    char mPadAfterHead[CacheLineSize - sizeof(uint32)];
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_QUEUE_MPSC_RING_HPP_
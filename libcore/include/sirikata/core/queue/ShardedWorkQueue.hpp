@@ -0,0 +1,227 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_QUEUE_SHARDED_WORK_QUEUE_HPP_
+#define _SIRIKATA_CORE_QUEUE_SHARDED_WORK_QUEUE_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+#include <sirikata/core/util/Noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <deque>
+
+namespace Sirikata {
+
+/** Processes items on a pool of worker threads, keeping items with the same key
+ *  in order. Items are hashed by key into shards, each of which is a FIFO. A
+ *  shard with items waiting is put on the ready list of its home worker, and a
+ *  worker which runs out of ready shards steals them from the other workers.
+ *  Stealing happens a whole shard at a time and a shard is only ever run by
+ *  one worker at once, so items with the same key are handled in the order
+ *  they were pushed, and never concurrently.
+ *
+ *  The handler gets the index of the worker running it, which it can use to
+ *  keep per-worker state without locking.
+ *
+ *  push() may be called from any thread. Items pushed before start() are held
+ *  until the workers start. stop() handles all the items which have already
+ *  been pushed, then shuts down the workers, so nothing should be pushed
+ *  after stop() is called.
+ */
+template<typename Item>
+class ShardedWorkQueue : Noncopyable {
+public:
+    typedef std::tr1::function<void(Item&, uint32)> Handler;
+
+    enum {
+        DefaultShardsPerWorker = 16,
+        DefaultBatchSize = 64
+    };
+
+    ShardedWorkQueue(const String& name, uint32 nworkers, uint32 nshards, const Handler& handler, uint32 batch_size = DefaultBatchSize)
+     : mName(name),
+       mHandler(handler),
+       mBatchSize(std::max(batch_size, (uint32)1)),
+       mPendingShards(0),
+       mSleeping(0),
+       mStopping(false)
+    {
+        nworkers = std::max(nworkers, (uint32)1);
+        nshards = std::max(nshards, nworkers);
+        for(uint32 i = 0; i < nworkers; i++)
+            mWorkers.push_back(new Worker());
+        for(uint32 i = 0; i < nshards; i++)
+            mShards.push_back(new Shard(i % nworkers));
+    }
+
+    ~ShardedWorkQueue() {
+        stop();
+        for(uint32 i = 0; i < mWorkers.size(); i++)
+            delete mWorkers[i];
+        for(uint32 i = 0; i < mShards.size(); i++)
+            delete mShards[i];
+    }
+
+    uint32 numWorkers() const { return mWorkers.size(); }
+    uint32 numShards() const { return mShards.size(); }
+
+    void start() {
+        for(uint32 i = 0; i < mWorkers.size(); i++) {
+            if (mWorkers[i]->thread != NULL) continue;
+            mWorkers[i]->thread = new Thread(
+                mName,
+                std::tr1::bind(&ShardedWorkQueue::workerMain, this, i)
+            );
+        }
+    }
+
+    void stop() {
+        {
+            boost::lock_guard<boost::mutex> lck(mSleepMutex);
+            mStopping = true;
+            mWakeup.notify_all();
+        }
+        for(uint32 i = 0; i < mWorkers.size(); i++) {
+            if (mWorkers[i]->thread == NULL) continue;
+            mWorkers[i]->thread->join();
+            delete mWorkers[i]->thread;
+            mWorkers[i]->thread = NULL;
+        }
+    }
+
+    void push(uint32 key_hash, const Item& item) {
+        Shard* shard = mShards[key_hash % mShards.size()];
+        {
+            boost::lock_guard<boost::mutex> lck(shard->mutex);
+            shard->items.push_back(item);
+            // Already waiting on a ready list or being run by a worker, which
+            // will get to this item
+            if (shard->scheduled) return;
+            shard->scheduled = true;
+        }
+        makeReady(shard, shard->home);
+    }
+
+private:
+    struct Shard {
+        Shard(uint32 _home) : scheduled(false), home(_home) {}
+
+        boost::mutex mutex;
+        std::deque<Item> items;
+        // Whether the shard is on a ready list or being run
+        bool scheduled;
+        const uint32 home;
+    };
+
+    struct Worker {
+        Worker() : thread(NULL) {}
+
+        boost::mutex mutex;
+        std::deque<Shard*> ready;
+        Thread* thread;
+    };
+
+    void makeReady(Shard* shard, uint32 worker_idx) {
+        Worker* worker = mWorkers[worker_idx];
+        {
+            boost::lock_guard<boost::mutex> lck(worker->mutex);
+            worker->ready.push_back(shard);
+        }
+        // The increment is a full barrier, so either a worker going to sleep
+        // sees the new shard or we see that it's sleeping and wake it up.
+        ++mPendingShards;
+        if (mSleeping.read() > 0) {
+            boost::lock_guard<boost::mutex> lck(mSleepMutex);
+            mWakeup.notify_one();
+        }
+    }
+
+    // Get a ready shard, first from our own ready list and then by stealing
+    // from the back of the others' lists.
+    Shard* takeShard(uint32 worker_idx) {
+        for(uint32 i = 0; i < mWorkers.size(); i++) {
+            Worker* worker = mWorkers[(worker_idx + i) % mWorkers.size()];
+            boost::lock_guard<boost::mutex> lck(worker->mutex);
+            if (worker->ready.empty()) continue;
+            Shard* shard;
+            if (i == 0) {
+                shard = worker->ready.front();
+                worker->ready.pop_front();
+            }
+            else {
+                shard = worker->ready.back();
+                worker->ready.pop_back();
+            }
+            --mPendingShards;
+            return shard;
+        }
+        return NULL;
+    }
+
+    void runShard(Shard* shard, uint32 worker_idx, std::vector<Item>& batch) {
+        {
+            boost::lock_guard<boost::mutex> lck(shard->mutex);
+            uint32 count = std::min((uint32)shard->items.size(), mBatchSize);
+            batch.assign(shard->items.begin(), shard->items.begin() + count);
+            shard->items.erase(shard->items.begin(), shard->items.begin() + count);
+        }
+
+        for(uint32 i = 0; i < batch.size(); i++)
+            mHandler(batch[i], worker_idx);
+        batch.clear();
+
+        {
+            boost::lock_guard<boost::mutex> lck(shard->mutex);
+            if (shard->items.empty()) {
+                shard->scheduled = false;
+                return;
+            }
+        }
+        // More arrived or the batch didn't cover everything. Put it at the
+        // back of our own list so other shards get a turn, and so idle workers
+        // can steal it.
+        makeReady(shard, worker_idx);
+    }
+
+    void workerMain(uint32 worker_idx) {
+        std::vector<Item> batch;
+        batch.reserve(mBatchSize);
+        while(true) {
+            Shard* shard = takeShard(worker_idx);
+            if (shard != NULL) {
+                runShard(shard, worker_idx, batch);
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lck(mSleepMutex);
+            ++mSleeping;
+            while(mPendingShards.read() <= 0 && !mStopping)
+                mWakeup.wait(lck);
+            --mSleeping;
+            // Shards still being run by other workers will be finished by
+            // them, so we can leave as soon as nothing is waiting.
+            if (mStopping && mPendingShards.read() <= 0)
+                return;
+        }
+    }
+
+    const String mName;
+    Handler mHandler;
+    const uint32 mBatchSize;
+
+    std::vector<Worker*> mWorkers;
+    std::vector<Shard*> mShards;
+
+    AtomicValue<int32> mPendingShards;
+    AtomicValue<int32> mSleeping;
+    boost::mutex mSleepMutex;
+    boost::condition_variable mWakeup;
+    bool mStopping;
+};
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_QUEUE_SHARDED_WORK_QUEUE_HPP_
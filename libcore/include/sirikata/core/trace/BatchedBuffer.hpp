@@ -55,7 +55,7 @@ struct Batch {
     }
 };
 
-class BatchedBuffer {
+class SIRIKATA_EXPORT BatchedBuffer {
 public:
     struct IOVec {
         IOVec()
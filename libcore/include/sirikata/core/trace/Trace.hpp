@@ -37,7 +37,7 @@
 #include <sirikata/core/util/Thread.hpp>
 #include <sirikata/core/util/AtomicTypes.hpp>
 #include <sirikata/core/network/ObjectMessage.hpp>
-#include <sirikata/core/trace/BatchedBuffer.hpp>
+#include <sirikata/core/trace/TraceFormat.hpp>
 
 namespace Sirikata {
 namespace Trace {
@@ -91,6 +91,7 @@ struct Drops {
 #define OSegCacheResponseTag 23
 #define OSegLookupNotOnServerAnalysisTag 24
 #define OSegCumulativeTraceAnalysisTag   25
+#define OSegLookupBatchTag               26
 #define MessageTimestampTag 30
 #define MessageCreationTimestampTag 31
 
@@ -187,10 +188,12 @@ public:
     CREATE_TRACE_DECL(timestampMessage, const Time&t, uint64 packetId, MessagePath path);
 
 
-    // Helper to prepend framing (size and payload type hint)
-    void writeRecord(uint16 type_hint, BatchedBuffer::IOVec* data, uint32 iovcnt);
+    // Helper to prepend framing (size and payload type hint). The time is
+    // only used to index the chunk the record ends up in.
+    void writeRecord(uint16 type_hint, const Time& t, BatchedBuffer::IOVec* data, uint32 iovcnt);
 
-    // Helper to prepend framing (size and payload type hint)
+    // Helper to prepend framing (size and payload type hint). All trace
+    // messages have a t() field giving the time of the event.
     template<typename T>
     void writeRecord(uint16 type_hint, const T& pl) {
         if (mShuttingDown) return;
@@ -203,7 +206,7 @@ public:
         BatchedBuffer::IOVec data_vec[num_data] = {
             BatchedBuffer::IOVec(&(serialized_pl[0]), serialized_pl.size())
         };
-        writeRecord(type_hint, data_vec, num_data);
+        writeRecord(type_hint, pl.t(), data_vec, num_data);
     }
 
 
@@ -216,7 +219,7 @@ private:
     // Thread which flushes data to disk periodically
     void storageThread(const String& filename);
 
-    BatchedBuffer data;
+    ChunkedTraceBuffer data;
     bool mShuttingDown;
 
     Thread* mStorageThread;
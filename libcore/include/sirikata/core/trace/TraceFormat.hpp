@@ -0,0 +1,189 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRACE_TRACE_FORMAT_HPP_
+#define _SIRIKATA_CORE_TRACE_TRACE_FORMAT_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/trace/BatchedBuffer.hpp>
+#include <sirikata/core/queue/LockFreeQueue.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace Sirikata {
+namespace Trace {
+
+/** Trace files are made up of chunks of records followed by an index of all
+ *  the chunks:
+ *
+ *    FileHeader
+ *    ChunkHeader, records      (repeated for each chunk)
+ *    ChunkHeader[num_chunks]   (the index)
+ *    FileFooter
+ *
+ *  Each record is a RecordHeader followed by the record's payload, exactly as
+ *  in the older, unchunked trace files, which were just a sequence of
+ *  records. Each ChunkHeader summarizes the record types and time range in the
+ *  chunk so readers can skip chunks they aren't interested in, and the index
+ *  lets them do so without touching the chunks at all. If the writer didn't
+ *  shut down cleanly the index and footer will be missing, but the chunk
+ *  headers can still be found by walking the file. All values are stored in
+ *  host byte order.
+ */
+namespace Format {
+
+enum {
+    FileMagic = 0x43525453, // "STRC"
+    ChunkMagic = 0x4b4e4843, // "CHNK"
+    Version = 1,
+
+    // Type hints are tracked in a 128 bit mask. Hints which don't fit all map
+    // to the last bit.
+    TypeMaskBits = 128
+};
+
+struct FileHeader {
+    uint32 magic;
+    uint32 version;
+};
+
+struct ChunkHeader {
+    ChunkHeader();
+
+    // Record that a record with the given type and time is in the chunk
+    void add(uint16 type_hint, const Time& t, uint32 record_bytes);
+
+    bool hasType(uint16 type_hint) const;
+    // Returns true if any records might fall in the [start, end] time range
+    bool overlaps(const Time& start, const Time& end) const;
+
+    static uint32 typeBit(uint16 type_hint) {
+        return (type_hint < TypeMaskBits) ? type_hint : (TypeMaskBits-1);
+    }
+
+    uint32 magic;
+    uint32 records;
+    // Offset of the chunk's first record from the beginning of the file
+    uint64 offset;
+    // Size of the chunk's records, not including this header
+    uint64 size;
+    // Raw Time values of the earliest and latest records in the chunk
+    uint64 start_time;
+    uint64 end_time;
+    uint64 types[TypeMaskBits/64];
+};
+
+struct FileFooter {
+    uint64 index_offset;
+    uint32 num_chunks;
+    uint32 magic;
+};
+
+// The record header is packed and may be unaligned in the file, so we only
+// deal with its size. It is a uint32 payload size followed by a uint16 type
+// hint.
+enum {
+    RecordHeaderSize = sizeof(uint32) + sizeof(uint16)
+};
+
+} // namespace Format
+
+/** Collects trace records into chunks in memory, which a storage thread
+ *  periodically writes out to a file. Writers may be on any thread, and each
+ *  thread fills its own chunk so writers never contend with each other. Full
+ *  chunks are handed to the storage thread through a lock-free queue, and
+ *  store() merges the records from all the chunks it receives into time
+ *  order.
+ *
+ *  A thread that writes slowly could otherwise hold on to a partially filled
+ *  chunk indefinitely, so the storage thread should call handoff() before
+ *  each store() to collect chunks that have been filling for too long. Records
+ *  written by different calls to store() then overlap in time by at most that
+ *  age plus the time between calls. flush() hands over all the partially
+ *  filled chunks. finish() writes the chunk index and footer, after which
+ *  nothing more should be stored.
+ */
+class SIRIKATA_EXPORT ChunkedTraceBuffer {
+public:
+    typedef BatchedBuffer::IOVec IOVec;
+
+    enum {
+        DefaultChunkSize = 256*1024
+    };
+
+    ChunkedTraceBuffer(uint32 chunk_size = DefaultChunkSize);
+    ~ChunkedTraceBuffer();
+
+    // Add a record with the given type and time, made up of the data in iov
+    void write(uint16 type_hint, const Time& t, const IOVec* iov, uint32 iovcnt);
+
+    // Hand chunks that started filling at least max_age ago over to be
+    // stored, even if they aren't full. Safe to call while threads are
+    // writing.
+    void handoff(const Duration& max_age);
+    // Hand all the chunks currently being filled over to be stored.
+    void flush();
+
+    // Whether there are any chunks waiting to be stored
+    bool empty();
+
+    // Write completed chunks to the file, starting with the file header if
+    // this is the first data written.
+    void store(FILE* os);
+    // Write the chunk index and file footer.
+    void finish(FILE* os);
+
+private:
+    struct Chunk {
+        // When the chunk was created, used to hand off partial chunks that
+        // have been filling for too long
+        Time created;
+        Format::ChunkHeader header;
+        std::vector<uint8> data;
+        // Raw time and offset of each record, used to put records in order
+        // when they are stored
+        typedef std::pair<uint64, uint32> RecordInfo;
+        std::vector<RecordInfo> records;
+    };
+
+    // The chunk a thread is filling. The writing thread takes the chunk out
+    // while it appends to it, so handoff() can take it away at any other
+    // time without locking. Use takeChunk() and returnChunk() to access it.
+    struct ThreadBuffer {
+        ThreadBuffer() : filling(NULL) {}
+        volatile Chunk* volatile filling;
+    };
+    // Thread buffers are owned by mThreadBuffers, not by the thread, so their
+    // partial chunks outlive the thread and can be flushed later
+    static void noCleanup(ThreadBuffer*) {}
+
+    // Take the chunk out of a thread buffer, leaving it empty
+    static Chunk* takeChunk(ThreadBuffer* tb);
+    // Put a chunk back into an empty thread buffer. Returns false if another
+    // chunk was put there in the meantime.
+    static bool returnChunk(ThreadBuffer* tb, Chunk* chunk);
+
+    Chunk* newChunk() const;
+    // Append the record at offset in src to dest
+    void appendRecord(Chunk* dest, const Chunk* src, const Chunk::RecordInfo& record) const;
+    void writeChunk(FILE* os, Chunk* chunk);
+
+    const uint32 mChunkSize;
+
+    boost::thread_specific_ptr<ThreadBuffer> mThreadBuffer;
+    // Only locked when a thread writes for the first time and on handoff()
+    boost::mutex mThreadBuffersMutex;
+    std::vector<ThreadBuffer*> mThreadBuffers;
+
+    LockFreeQueue<Chunk*> mFullChunks;
+
+    // Only used by the thread calling store() and finish()
+    uint64 mFileOffset;
+    std::vector<Format::ChunkHeader> mIndex;
+};
+
+} // namespace Trace
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_TRACE_TRACE_FORMAT_HPP_
@@ -0,0 +1,92 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_TRACE_TRACE_READER_HPP_
+#define _SIRIKATA_CORE_TRACE_TRACE_READER_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/trace/TraceFormat.hpp>
+
+namespace boost {
+namespace interprocess {
+class file_mapping;
+class mapped_region;
+}
+}
+
+namespace Sirikata {
+namespace Trace {
+
+/** Reads records from a trace file by memory mapping it, so records can be
+ *  inspected in place without copying them. Readers can restrict the records
+ *  they see to a set of type hints and a time range, and chunks which can't
+ *  contain any matching records are skipped entirely.
+ *
+ *  Older trace files, which are just a sequence of records, are also
+ *  supported and are treated as a single chunk which may contain anything.
+ *  Note that the time range filter is only applied at the granularity of
+ *  chunks -- records outside the range can still be returned.
+ */
+class SIRIKATA_EXPORT TraceReader {
+public:
+    TraceReader(const String& filename);
+    ~TraceReader();
+
+    // Whether the file could be opened. Missing or empty files are treated as
+    // having no records.
+    bool valid() const { return mData != NULL; }
+    // Whether the file is in the chunked format, as opposed to an old,
+    // unchunked trace
+    bool chunked() const { return mChunked; }
+
+    uint32 numChunks() const { return mChunks.size(); }
+    const Format::ChunkHeader& chunk(uint32 idx) const { return mChunks[idx]; }
+
+    // Only return records with this type hint. Can be called multiple times to
+    // allow multiple types. By default all types are returned.
+    void filterType(uint16 type_hint);
+    // Only return records from chunks which overlap the given time range.
+    void filterTime(const Time& start, const Time& end);
+
+    /** Get the next record, or return false if there are no more.  The
+     *  payload points into the mapped file and is valid as long as the reader
+     *  is.
+     */
+    bool next(uint16* type_hint_out, const uint8** payload_out, uint32* size_out);
+
+private:
+    // Find the chunks, either from the index or by walking the file
+    void loadChunks();
+    // Fill in the chunks from the index, returning false if any of its entries
+    // are invalid
+    bool loadIndex(const Format::FileFooter& footer);
+    bool chunkMatches(const Format::ChunkHeader& chunk) const;
+    // Advance to the next chunk that may contain records we're interested in
+    bool nextChunk();
+
+    boost::interprocess::file_mapping* mFile;
+    boost::interprocess::mapped_region* mRegion;
+    const uint8* mData;
+    uint64 mSize;
+
+    bool mChunked;
+    std::vector<Format::ChunkHeader> mChunks;
+
+    bool mFilterTypes;
+    Format::ChunkHeader mTypes;
+    bool mFilterTime;
+    Time mStartTime;
+    Time mEndTime;
+
+    // Index of the next chunk to consider, and the offset of the next record
+    // and end of the chunk currently being read
+    uint32 mNextChunk;
+    uint64 mPos;
+    uint64 mChunkEnd;
+};
+
+} // namespace Trace
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_TRACE_TRACE_READER_HPP_
@@ -56,10 +56,14 @@ public:
 private:
 	typedef CachePolicy::Data *PolicyData;
 	typedef std::pair<CacheData, std::pair<PolicyData, cache_usize_type> > MapEntry;
-	typedef std::map<Fingerprint, MapEntry> MapClass;
+	// Only ever looked up by fingerprint, so a hash table is enough
+	typedef std::tr1::unordered_map<Fingerprint, MapEntry, Fingerprint::Hasher> MapClass;
 
 	MapClass mMap;
 	boost::shared_mutex mMapLock;
+	// Readers share mMapLock but still update the policy, so they also need
+	// this. Writers have exclusive access to both.
+	boost::mutex mPolicyLock;
 
 	CacheLayer *mOwner;
 	CachePolicy *mPolicy;
@@ -170,6 +174,7 @@ public:
 
 		/// Sets the use bit in the corresponding cache policy.
 		inline void use() {
+			boost::unique_lock<boost::mutex> policyLock(mCachemap->mPolicyLock);
 			mCachemap->mPolicy->use(getId(), getPolicyInfo(), getSize());
 		}
 	};
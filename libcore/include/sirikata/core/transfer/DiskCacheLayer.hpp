@@ -45,11 +45,7 @@
 namespace Sirikata {
 namespace Transfer {
 
-// should really be a config option.
-//#define NUM_WORKER_THREADS 10
-
-
-/// Disk Cache keeps track of what files are on disk, and manages a helper thread to retrieve it.
+/// Disk Cache keeps track of what files are on disk, and manages helper threads to retrieve them.
 class SIRIKATA_EXPORT DiskCacheLayer : public CacheLayer {
 public:
 	struct CacheData : public CacheEntry {
@@ -65,11 +61,21 @@ public:
 		}
 	};
 
+	static const uint32 DEFAULT_NUM_WORKERS = 4;
+
 private:
 
 	struct DiskRequest;
-	ThreadSafeQueue<std::tr1::shared_ptr<DiskRequest> > mRequestQueue; // must be initialized before the thread.
-	Thread *mWorkerThread;
+	typedef ThreadSafeQueue<std::tr1::shared_ptr<DiskRequest> > RequestQueue;
+
+	// Requests are sharded over the workers by fingerprint, so requests for
+	// different files proceed in parallel while those for the same file are
+	// handled in order.
+	struct Worker {
+		RequestQueue mRequestQueue; // must be initialized before the thread.
+		Thread *mThread;
+	};
+	std::vector<Worker*> mWorkers;
 
 	CacheMap mFiles;
 
@@ -89,12 +95,21 @@ private:
 
 	};
 
-	boost::mutex destroyLock;
-	boost::condition_variable destroyCV;
 	bool mCleaningUp; // do not delete any files.
 
+	void pushRequest(const std::tr1::shared_ptr<DiskRequest> &req) {
+		Worker *worker = mWorkers[Fingerprint::Hasher()(req->fileId) % mWorkers.size()];
+		worker->mRequestQueue.push(req);
+	}
+
+	// The index lets a warm start skip scanning the cache directory. It is
+	// only written on a clean shutdown and is removed once it's loaded, so it
+	// is never out of date.
+	bool loadIndex();
+	void saveIndex();
+
 public:
-	void workerThread(); // defined in DiskCache.cpp
+	void workerThread(Worker *worker); // defined in DiskCache.cpp
 	void unserialize(); // defined in DiskCache.cpp
 
 	void readDataFromDisk(const Fingerprint &fileId,
@@ -104,7 +119,7 @@ public:
 				new DiskRequest(DiskRequest::OPREAD, fileId, requestedRange));
 		req->finished = callback;
 
-		mRequestQueue.push(req);
+		pushRequest(req);
 	}
 
 	void serializeRanges(const RangeList &list, std::string &out) {
@@ -150,7 +165,7 @@ protected:
                     new DiskRequest(DiskRequest::OPWRITE, fileId, *data));
 		req->data = data;
 
-		mRequestQueue.push(req);
+		pushRequest(req);
 
 		CacheLayer::populateParentCaches(req->fileId, data);
 	}
@@ -161,7 +176,7 @@ protected:
 			std::string fileName = fileId.convertToHexString();
 			std::tr1::shared_ptr<DiskRequest> req
                             (new DiskRequest(DiskRequest::OPDELETE, fileId, Range(true)));
-                        mRequestQueue.push(req);
+                        pushRequest(req);
 		}
 		CacheData *toDelete = static_cast<CacheData*>(cacheLayerData);
 		delete toDelete;
@@ -169,18 +184,9 @@ protected:
 
 public:
 
-	DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext);
+	DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext, uint32 numWorkers = DEFAULT_NUM_WORKERS);
 
-	virtual ~DiskCacheLayer() {
-		std::tr1::shared_ptr<DiskRequest> req
-			(new DiskRequest(DiskRequest::OPEXIT, Fingerprint(), Range(true)));
-		boost::unique_lock<boost::mutex> sleep_cv(destroyLock);
-		mRequestQueue.push(req);
-		destroyCV.wait(sleep_cv); // we know the thread has terminated.
-
-		mCleaningUp = true; // don't allow destroyCacheEntry to delete files.
-		delete mWorkerThread;
-	}
+	virtual ~DiskCacheLayer(); // defined in DiskCache.cpp
 
 	virtual void purgeFromCache(const Fingerprint &fileId) {
 		CacheMap::write_iterator iter(mFiles);
@@ -54,6 +54,7 @@
 #include <sirikata/core/network/Asio.hpp>
 #include <sirikata/core/network/Address.hpp>
 #include <sirikata/core/transfer/TransferData.hpp>
+#include <sirikata/core/util/Timer.hpp>
 
 
 // This is a hack around a problem created by different packages
@@ -162,8 +163,6 @@ public:
         LAST_HEADER_CB mLastCallback;
         bool mHeaderComplete;
         bool mMessageComplete;
-        http_parser_settings mHttpSettings;
-        http_parser mHttpParser;
         bool mGzip;
         std::stringstream mCompressedStream;
         //
@@ -356,60 +355,147 @@ private:
         bool mHeaderComplete;
         Headers mHeaders;
     };
+    typedef std::tr1::shared_ptr<HttpRequest> HttpRequestPtr;
+    typedef std::deque<HttpRequestPtr> RequestQueueType;
 
-    //Holds a queue of requests to be made
-    typedef std::list<std::tr1::shared_ptr<HttpRequest> > RequestQueueType;
-    RequestQueueType mRequestQueue;
-    //Lock this to access mRequestQueue
-    boost::mutex mRequestQueueLock;
+    /*
+     * A persistent connection to a host. Requests assigned to it are kept in
+     * mInFlight in the order they are written, so responses, which HTTP/1.1
+     * requires to come back in the same order, can be matched to them. A
+     * single parser is used for the lifetime of the connection since a read
+     * may contain the end of one response and the start of the next.
+     *
+     * Everything except the parsing state is protected by mPoolLock. The
+     * parsing state is only touched by the single outstanding read.
+     */
+    class HttpConnection {
+    public:
+        HttpConnection(const Sirikata::Network::Address& _addr)
+         : addr(_addr), mConnected(false), mClosed(false), mWriting(false),
+           mCanPipeline(false), mNumSent(0), mIdleSince(Time::null()),
+           mReadBuffer(SOCKET_BUFFER_SIZE), mParseError(false), mPipelinable(false),
+           mCloseAfterResponse(false), mBytesUnaccounted(0)
+        {}
 
-    //TODO: should get these from settings
-    static const uint32 MAX_CONNECTIONS_PER_ENDPOINT = 8;
-    static const uint32 MAX_TOTAL_CONNECTIONS = 40;
-    static const uint32 SOCKET_BUFFER_SIZE = 10240;
+        const Sirikata::Network::Address addr;
 
+        friend class HttpManager;
+    protected:
+        std::tr1::shared_ptr<TCPSocket> mSocket;
+        bool mConnected;
+        bool mClosed;
+        bool mWriting;
+        // Set once the server has responded with HTTP/1.1 and hasn't asked us
+        // to close the connection, i.e. once we know pipelining is safe
+        bool mCanPipeline;
+        // Requests assigned to this connection. The first mNumSent have been
+        // written (or are being written) to the socket.
+        RequestQueueType mInFlight;
+        uint32 mNumSent;
+        Time mIdleSince;
+
+        // Parsing state
+        http_parser mHttpParser;
+        std::vector<unsigned char> mReadBuffer;
+        // Requests responses are being parsed for, copied from mInFlight
+        // before each parse, and the responses completed so far
+        std::vector<HttpRequestPtr> mParsing;
+        std::vector<std::tr1::shared_ptr<HttpResponse> > mCompleted;
+        std::tr1::shared_ptr<HttpResponse> mCurrentResponse;
+        bool mParseError;
+        // Whether the last response allows pipelining, copied to
+        // mCanPipeline once parsing is done
+        bool mPipelinable;
+        // Set when a response says the server will close the connection
+        bool mCloseAfterResponse;
+        // Bytes read since the last response completed
+        uint32 mBytesUnaccounted;
+    };
+    typedef std::tr1::shared_ptr<HttpConnection> HttpConnectionPtr;
+    typedef std::tr1::weak_ptr<HttpConnection> HttpConnectionWPtr;
+    typedef std::list<HttpConnectionPtr> ConnectionList;
+
+    // Requests waiting for a connection and open connections for one
+    // host:port pair
+    struct HostPool {
+        RequestQueueType queue;
+        ConnectionList connections;
+    };
+    typedef std::map<Sirikata::Network::Address, HostPool> HostPoolMap;
+    HostPoolMap mHostPools;
+    // processQueue hands out requests round robin over hosts, starting from
+    // this one, so a host with a long queue can't starve the others
+    Sirikata::Network::Address mNextHost;
     //Keeps track of the total number of connections currently open
     uint32 mNumTotalConnections;
+    //Lock this to access mHostPools, mNextHost, mNumTotalConnections or
+    //any connection's non-parsing state
+    boost::mutex mPoolLock;
 
-    //Keeps track of the number of connections open per host:port pair
-    typedef std::map<Sirikata::Network::Address, uint32> NumConnsType;
-    NumConnsType mNumConnsPerAddr;
-    //Lock this to access mNumTotalConnections or mNumConnsPerAddr
-    boost::mutex mNumConnsLock;
+    //TODO: should get these from settings
+    static const uint32 MAX_CONNECTIONS_PER_ENDPOINT = 8;
+    static const uint32 MAX_TOTAL_CONNECTIONS = 40;
+    static const uint32 MAX_PIPELINE_DEPTH = 4;
+    static const uint32 IDLE_TIMEOUT_SECONDS = 15;
+    static const uint32 MAX_TRIES = 10;
+    static const uint32 SOCKET_BUFFER_SIZE = 10240;
 
-    //Holds connections that are open but not being used
-    typedef std::map<Sirikata::Network::Address,
-        std::queue<std::tr1::shared_ptr<TCPSocket> > > RecycleBinType;
-    RecycleBinType mRecycleBin;
-    //Lock this to access mRecycleBin
-    boost::mutex mRecycleBinLock;
+    uint32 mMaxConnectionsPerHost;
+    uint32 mMaxPipelineDepth;
+    Duration mIdleTimeout;
 
     IOServicePool* mServicePool;
     TCPResolver* mResolver;
 
     http_parser_settings EMPTY_PARSER_SETTINGS;
+    http_parser_settings mResponseSettings;
+
+    typedef std::vector<std::pair<HttpRequestPtr, std::tr1::shared_ptr<HttpResponse> > > CompletedList;
+    struct FailedRequest {
+        FailedRequest(HttpRequestPtr _req, ERR_TYPE _type, const boost::system::error_code& _err)
+         : req(_req), type(_type), err(_err) {}
+        HttpRequestPtr req;
+        ERR_TYPE type;
+        boost::system::error_code err;
+    };
+    typedef std::vector<FailedRequest> FailedList;
 
     void processQueue();
 
-    void add_req(std::tr1::shared_ptr<HttpRequest> req);
-    void decrement_connection(const Sirikata::Network::Address& addr);
-    void write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req);
-
-    void handle_resolve(std::tr1::shared_ptr<HttpRequest> req, const boost::system::error_code& err,
+    void add_req(HttpRequestPtr req);
+
+    // All of these must be called with mPoolLock held
+    HttpConnectionPtr find_connection(HostPool& pool, HttpRequestPtr req);
+    HttpConnectionPtr open_connection(const Sirikata::Network::Address& addr, HostPool& pool);
+    bool close_idle_connection(const Sirikata::Network::Address& except);
+    void close_connection(HttpConnectionPtr conn);
+    void write_requests(HttpConnectionPtr conn);
+    void read_response(HttpConnectionPtr conn);
+    void became_idle(HttpConnectionPtr conn);
+    // Closes the connection and puts everything in flight on it back at the
+    // front of the host's queue. If failed is non-NULL, the first request is
+    // charged a try, and is added to failed with err if it has run out of
+    // them.
+    void fail_connection(HttpConnectionPtr conn, const boost::system::error_code& err, FailedList* failed);
+
+    void finish_requests(const CompletedList& completed, const FailedList& failed);
+    void handle_idle_timeout(HttpConnectionWPtr weak_conn);
+
+    void handle_resolve(HttpConnectionPtr conn, const boost::system::error_code& err,
             TCPResolver::iterator endpoint_iterator);
-    void handle_connect(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-            const boost::system::error_code& err, TCPResolver::iterator endpoint_iterator);
-    void handle_write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-            const boost::system::error_code& err, std::tr1::shared_ptr<boost::asio::streambuf> request_stream);
-    void handle_read(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-            std::tr1::shared_ptr<std::vector<unsigned char> > vecbuf, std::tr1::shared_ptr<HttpResponse> respPtr,
-            const boost::system::error_code& err, std::size_t bytes_transferred);
+    void handle_connect(HttpConnectionPtr conn, const boost::system::error_code& err,
+            TCPResolver::iterator endpoint_iterator);
+    void handle_write_request(HttpConnectionPtr conn, const boost::system::error_code& err,
+            std::tr1::shared_ptr<boost::asio::streambuf> request_stream);
+    void handle_read(HttpConnectionPtr conn, const boost::system::error_code& err, std::size_t bytes_transferred);
 
+    static int on_message_begin(http_parser *_);
     static int on_header_field(http_parser *_, const char *at, size_t len);
     static int on_header_value(http_parser *_, const char *at, size_t len);
     static int on_headers_complete(http_parser *_);
     static int on_body(http_parser *_, const char *at, size_t len);
     static int on_message_complete(http_parser *_);
+    static void finish_response(HttpConnection* conn);
 
     static int on_request_header_field(http_parser *_, const char *at, size_t len);
     static int on_request_header_value(http_parser *_, const char *at, size_t len);
@@ -424,7 +510,7 @@ private:
       , F_SKIPBODY = 1 << 5
       };
 
-    static void print_flags(std::tr1::shared_ptr<HttpResponse> resp);
+    static void print_flags(const http_parser& parser);
 
 public:
 
@@ -434,6 +520,16 @@ public:
     void postCallback(IOCallback cb, const char* tag);
     void postCallback(const Duration& waitFor, IOCallback cb, const char* tag);
 
+    /** Limits on how requests to a host are spread over connections. GETs are
+     *  pipelined, up to depth requests on one connection, once the server
+     *  has shown it supports HTTP/1.1 persistent connections. A depth of 1
+     *  disables pipelining. Changes only affect requests issued afterwards.
+     */
+    void setMaxConnectionsPerHost(uint32 max_conns);
+    void setMaxPipelineDepth(uint32 depth);
+    /** Connections that have been idle this long are closed. */
+    void setIdleTimeout(const Duration& timeout);
+
 };
 
 }
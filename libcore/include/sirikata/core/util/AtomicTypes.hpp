@@ -201,6 +201,28 @@ inline bool compare_and_swap(volatile Node*volatile *target, volatile Node *comp
 #endif
 }
 
+inline bool compare_and_swap(volatile uint32* target, uint32 comperand, uint32 exchange) {
+#ifdef _WIN32
+    return InterlockedCompareExchange((volatile LONG*)target, (LONG)exchange, (LONG)comperand)==(LONG)comperand;
+#elif defined(__APPLE__)
+    return OSAtomicCompareAndSwap32Barrier((int32_t)comperand, (int32_t)exchange, (volatile int32_t*)target);
+#else
+    return __sync_bool_compare_and_swap(target, comperand, exchange);
+#endif
+}
+
+/// Full memory barrier. Also keeps the compiler from moving loads and stores
+/// across it.
+inline void memory_barrier() {
+#ifdef _WIN32
+    MemoryBarrier();
+#elif defined(__APPLE__)
+    OSMemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
 #ifdef _WIN32
 #pragma warning( pop )
 #endif
@@ -15,6 +15,30 @@ SIRIKATA_FUNCTION_EXPORT String encodeURL(const String& orig);
 SIRIKATA_FUNCTION_EXPORT String decode(const String& orig);
 SIRIKATA_FUNCTION_EXPORT String decodeURL(const String& orig);
 
+/** Raw buffer versions of the codec for bulk data, e.g. network packets. They
+ *  work on whole 3 byte groups at a time, using tables which produce two
+ *  output characters per lookup, so there are no per-byte branches. The URL
+ *  safe alphabet uses '-' and '_' in place of '+' and '/'.
+ */
+enum Alphabet {
+    StandardAlphabet,
+    URLSafeAlphabet
+};
+
+// Number of bytes encode() will produce for len bytes of input
+SIRIKATA_FUNCTION_EXPORT size_t encodedLength(size_t len, bool padWithEquals);
+// Encode len bytes from src into dest, which must have room for
+// encodedLength(len, padWithEquals) bytes. Returns the number of bytes written.
+SIRIKATA_FUNCTION_EXPORT size_t encode(uint8* dest, const uint8* src, size_t len, Alphabet alphabet, bool padWithEquals);
+
+// Upper bound on the number of bytes decode() will produce for len bytes of
+// input
+SIRIKATA_FUNCTION_EXPORT size_t decodedLength(size_t len);
+// Decode len bytes from src into dest, accepting either alphabet and stopping
+// at the first '='. Returns false if any other invalid characters are found,
+// otherwise sets dest_len to the number of bytes written.
+SIRIKATA_FUNCTION_EXPORT bool decode(uint8* dest, size_t* dest_len, const uint8* src, size_t len);
+
 } // namespace Base64
 } // Sirikata
 
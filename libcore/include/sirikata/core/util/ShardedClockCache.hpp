@@ -0,0 +1,293 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_UTIL_SHARDED_CLOCK_CACHE_HPP_
+#define _SIRIKATA_CORE_UTIL_SHARDED_CLOCK_CACHE_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/SlotHashTable.hpp>
+#include <sirikata/core/util/Noncopyable.hpp>
+#include <sirikata/core/util/Timer.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata {
+
+/** A fixed size cache which many threads can use at once. Keys are hashed into
+ *  shards, each with its own lock and its own open-addressed table, so threads
+ *  only contend when they hit the same shard.
+ *
+ *  Each shard evicts with CLOCK: a hit just sets the entry's reference bit, and
+ *  when room is needed a hand sweeps the entries, clearing reference bits until
+ *  it finds one that hasn't been used since the last sweep. New keys also have
+ *  to pass a TinyLFU admission filter. Every access, hit or miss, is counted in
+ *  a small count-min sketch of recent key frequencies, and a new key only
+ *  replaces the CLOCK victim if it has been asked for more often. This keeps a
+ *  stream of one-off keys from flushing out the popular ones. The sketch is
+ *  halved periodically so it tracks recent popularity. Updates to keys which
+ *  are already cached always succeed.
+ */
+template<typename KeyType,
+    typename ValueType,
+    class HashType = std::tr1::hash<KeyType> >
+class ShardedClockCache : Noncopyable {
+public:
+    enum {
+        DefaultShards = 16
+    };
+
+    struct Stats {
+        Stats()
+         : hits(0), misses(0), inserts(0), updates(0),
+           evictions(0), rejections(0), contended(0), waitMicroseconds(0)
+        {}
+
+        uint64 hits;
+        uint64 misses;
+        // New keys stored and existing keys updated
+        uint64 inserts;
+        uint64 updates;
+        // Entries pushed out to make room, and new keys the admission filter
+        // turned away
+        uint64 evictions;
+        uint64 rejections;
+        // Operations which had to wait for a shard's lock, and how long they
+        // waited in total
+        uint64 contended;
+        uint64 waitMicroseconds;
+    };
+
+    /** Create a cache holding up to capacity entries, split across nshards
+     *  shards. nshards is rounded up to a power of two.
+     */
+    ShardedClockCache(uint32 capacity, uint32 nshards = DefaultShards)
+     : mShardBits(0)
+    {
+        while((1u << mShardBits) < nshards)
+            mShardBits++;
+        uint32 count = (1u << mShardBits);
+        uint32 per_shard = std::max((capacity + count - 1) / count, (uint32)1);
+        for(uint32 i = 0; i < count; i++)
+            mShards.push_back(new Shard(per_shard));
+    }
+
+    ~ShardedClockCache() {
+        for(uint32 i = 0; i < mShards.size(); i++)
+            delete mShards[i];
+    }
+
+    uint32 numShards() const { return mShards.size(); }
+    uint32 capacity() const { return mShards.size() * mShards[0]->capacity; }
+
+    /** Look up key, filling in value_out if it's found.
+     *  \returns true if key was found
+     */
+    bool get(const KeyType& key, ValueType* value_out) {
+        uint32 hash = mHasher(key);
+        Shard* shard = getShard(hash);
+        Lock lck(shard);
+        shard->recordAccess(hash);
+
+        typename Table::SlotID slot = shard->table.find(key);
+        if (slot == Table::InvalidSlot) {
+            shard->stats.misses++;
+            return false;
+        }
+        Entry& entry = shard->table.value(slot);
+        entry.referenced = true;
+        *value_out = entry.value;
+        shard->stats.hits++;
+        return true;
+    }
+
+    /** Store value for key. Existing entries are always updated, but new keys
+     *  may be turned away by the admission filter when the shard is full.
+     *  \returns true if the value was stored
+     */
+    bool insert(const KeyType& key, const ValueType& value) {
+        uint32 hash = mHasher(key);
+        Shard* shard = getShard(hash);
+        Lock lck(shard);
+
+        typename Table::SlotID slot = shard->table.find(key);
+        if (slot != Table::InvalidSlot) {
+            shard->table.value(slot).value = value;
+            shard->stats.updates++;
+            return true;
+        }
+
+        if (shard->table.size() >= shard->capacity) {
+            typename Table::SlotID victim = shard->findVictim();
+            if (shard->frequency(hash) <= shard->frequency(mHasher(shard->table.key(victim)))) {
+                shard->stats.rejections++;
+                return false;
+            }
+            shard->table.eraseSlot(victim);
+            shard->stats.evictions++;
+        }
+
+        slot = shard->table.insert(key);
+        Entry& entry = shard->table.value(slot);
+        entry.value = value;
+        entry.referenced = false;
+        shard->stats.inserts++;
+        return true;
+    }
+
+    /** Remove key from the cache.
+     *  \returns true if it was cached
+     */
+    bool remove(const KeyType& key) {
+        Shard* shard = getShard(mHasher(key));
+        Lock lck(shard);
+        return shard->table.erase(key);
+    }
+
+    // The number of entries currently cached. Shards are counted one at a
+    // time, so this is approximate if other threads are using the cache.
+    uint32 size() {
+        uint32 total = 0;
+        for(uint32 i = 0; i < mShards.size(); i++) {
+            Lock lck(mShards[i]);
+            total += mShards[i]->table.size();
+        }
+        return total;
+    }
+
+    // Get the statistics summed across all shards, optionally resetting them
+    Stats stats(bool reset = false) {
+        Stats total;
+        for(uint32 i = 0; i < mShards.size(); i++) {
+            Lock lck(mShards[i]);
+            const Stats& s = mShards[i]->stats;
+            total.hits += s.hits;
+            total.misses += s.misses;
+            total.inserts += s.inserts;
+            total.updates += s.updates;
+            total.evictions += s.evictions;
+            total.rejections += s.rejections;
+            total.contended += s.contended;
+            total.waitMicroseconds += s.waitMicroseconds;
+            if (reset) mShards[i]->stats = Stats();
+        }
+        return total;
+    }
+
+private:
+    struct Entry {
+        Entry() : referenced(false) {}
+        ValueType value;
+        // Set on each hit, cleared as the CLOCK hand passes
+        bool referenced;
+    };
+    typedef SlotHashTable<KeyType, Entry, HashType> Table;
+
+    enum {
+        // Rows in the frequency sketch, each indexed by a different hash
+        SketchDepth = 4,
+        // Counters saturate at this value
+        SketchMaxCount = 15,
+        // The sketch is halved after this many accesses per cache entry
+        SketchResetFactor = 10
+    };
+
+    struct Shard {
+        Shard(uint32 _capacity)
+         : capacity(_capacity),
+           hand(0),
+           accesses(0)
+        {
+            uint32 width = 16;
+            while(width < capacity * 2)
+                width *= 2;
+            sketchMask = width - 1;
+            sketch.resize(SketchDepth * width, 0);
+        }
+
+        // Row i of the sketch uses (hash + i * step), with a step that's
+        // always odd so the rows don't collide in the same way
+        uint32 sketchIndex(uint32 hash, uint32 row) const {
+            uint32 step = ((hash * 0x9E3779B1u) >> 16) | 1;
+            return row * (sketchMask + 1) + ((hash + row * step) & sketchMask);
+        }
+
+        void recordAccess(uint32 hash) {
+            for(uint32 row = 0; row < SketchDepth; row++) {
+                uint8& counter = sketch[sketchIndex(hash, row)];
+                if (counter < SketchMaxCount) counter++;
+            }
+            if (++accesses >= capacity * SketchResetFactor) {
+                for(uint32 i = 0; i < sketch.size(); i++)
+                    sketch[i] >>= 1;
+                accesses = 0;
+            }
+        }
+
+        uint32 frequency(uint32 hash) const {
+            uint32 result = SketchMaxCount;
+            for(uint32 row = 0; row < SketchDepth; row++)
+                result = std::min(result, (uint32)sketch[sketchIndex(hash, row)]);
+            return result;
+        }
+
+        // Advance the CLOCK hand to an entry which hasn't been referenced since
+        // the hand last passed it. Only called when the shard is full.
+        typename Table::SlotID findVictim() {
+            while(true) {
+                if (hand >= table.slotCount()) hand = 0;
+                typename Table::SlotID slot = hand++;
+                if (!table.valid(slot)) continue;
+                Entry& entry = table.value(slot);
+                if (!entry.referenced)
+                    return slot;
+                entry.referenced = false;
+            }
+        }
+
+        boost::mutex mutex;
+        Table table;
+        const uint32 capacity;
+        typename Table::SlotID hand;
+
+        std::vector<uint8> sketch;
+        uint32 sketchMask;
+        uint32 accesses;
+
+        Stats stats;
+    };
+
+    // Locks a shard, keeping track of how often and how long we have to wait
+    // for it.
+    class Lock {
+    public:
+        Lock(Shard* shard)
+         : mShard(shard)
+        {
+            if (mShard->mutex.try_lock()) return;
+            Time start = Timer::now();
+            mShard->mutex.lock();
+            mShard->stats.contended++;
+            mShard->stats.waitMicroseconds += (Timer::now() - start).toMicroseconds();
+        }
+        ~Lock() {
+            mShard->mutex.unlock();
+        }
+    private:
+        Shard* mShard;
+    };
+
+    // Use the high bits of the hash for the shard since the table in each
+    // shard uses the low bits
+    Shard* getShard(uint32 hash) {
+        if (mShardBits == 0) return mShards[0];
+        return mShards[(hash * 0x9E3779B1u) >> (32 - mShardBits)];
+    }
+
+    HashType mHasher;
+    uint32 mShardBits;
+    std::vector<Shard*> mShards;
+}; // class ShardedClockCache
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_UTIL_SHARDED_CLOCK_CACHE_HPP_
@@ -0,0 +1,181 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CORE_UTIL_SLOT_HASH_TABLE_HPP_
+#define _SIRIKATA_CORE_UTIL_SLOT_HASH_TABLE_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+
+namespace Sirikata {
+
+/** A flat, open-addressed hash table whose entries live in stable slots. Keys
+ *  map to slots through a linear probing index, and the key/value pairs
+ *  themselves are stored contiguously in a vector of slots, so walking all
+ *  entries is a linear scan and updating an entry doesn't allocate.
+ *
+ *  A SlotID remains valid until that entry is erased, regardless of other
+ *  insertions and removals, which lets callers collect SlotIDs (e.g. to sort
+ *  them) and then erase entries while walking that list. Note that the slots
+ *  vector may be reallocated by insert(), so references returned by value()
+ *  and key() are only valid until the next insert().
+ */
+template<typename KeyType,
+    typename ValueType,
+    class HashType = std::tr1::hash<KeyType> >
+class SlotHashTable {
+public:
+    typedef uint32 SlotID;
+    enum {
+        InvalidSlot = 0xFFFFFFFF
+    };
+
+    SlotHashTable()
+     : mSize(0),
+       mTombstones(0)
+    {
+        mBuckets.resize(MinBuckets, (uint32)EmptyBucket);
+    }
+
+    uint32 size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    /** Get the upper bound on SlotIDs, for iterating over all slots. Use
+     *  valid() to check if a slot is in use.
+     */
+    SlotID slotCount() const { return mSlots.size(); }
+    bool valid(SlotID slot) const { return mSlots[slot].used; }
+
+    const KeyType& key(SlotID slot) const { return mSlots[slot].key; }
+    ValueType& value(SlotID slot) { return mSlots[slot].value; }
+    const ValueType& value(SlotID slot) const { return mSlots[slot].value; }
+
+    /** Find the slot holding key, or InvalidSlot if it isn't in the table. */
+    SlotID find(const KeyType& key) const {
+        uint32 mask = mBuckets.size() - 1;
+        for(uint32 idx = mHasher(key) & mask; ; idx = (idx + 1) & mask) {
+            uint32 bucket = mBuckets[idx];
+            if (bucket == EmptyBucket)
+                return InvalidSlot;
+            if (bucket != TombstoneBucket && mSlots[bucket].key == key)
+                return bucket;
+        }
+    }
+
+    /** Find or insert key. New entries get a default constructed value. If
+     *  inserted is non-NULL it indicates whether a new entry was created.
+     */
+    SlotID insert(const KeyType& key, bool* inserted = NULL) {
+        SlotID existing = find(key);
+        if (existing != InvalidSlot) {
+            if (inserted != NULL) *inserted = false;
+            return existing;
+        }
+
+        // Keep the load, including tombstones, under 3/4
+        if ((mSize + mTombstones + 1) * 4 > mBuckets.size() * 3)
+            rehash( (mSize + 1) * 2 > mBuckets.size() ? mBuckets.size() * 2 : mBuckets.size() );
+
+        SlotID slot;
+        if (!mFreeSlots.empty()) {
+            slot = mFreeSlots.back();
+            mFreeSlots.pop_back();
+        }
+        else {
+            slot = mSlots.size();
+            mSlots.push_back(Slot());
+        }
+        Slot& s = mSlots[slot];
+        s.key = key;
+        s.value = ValueType();
+        s.used = true;
+
+        uint32 mask = mBuckets.size() - 1;
+        uint32 idx = mHasher(key) & mask;
+        while(mBuckets[idx] != EmptyBucket && mBuckets[idx] != TombstoneBucket)
+            idx = (idx + 1) & mask;
+        if (mBuckets[idx] == TombstoneBucket)
+            mTombstones--;
+        mBuckets[idx] = slot;
+        s.bucket = idx;
+        mSize++;
+
+        if (inserted != NULL) *inserted = true;
+        return slot;
+    }
+
+    void eraseSlot(SlotID slot) {
+        Slot& s = mSlots[slot];
+        assert(s.used);
+        mBuckets[s.bucket] = TombstoneBucket;
+        mTombstones++;
+        s.used = false;
+        // Release anything the value holds onto now rather than when the slot
+        // is reused
+        s.value = ValueType();
+        mFreeSlots.push_back(slot);
+        mSize--;
+    }
+
+    bool erase(const KeyType& key) {
+        SlotID slot = find(key);
+        if (slot == InvalidSlot) return false;
+        eraseSlot(slot);
+        return true;
+    }
+
+    void clear() {
+        mSlots.clear();
+        mFreeSlots.clear();
+        mBuckets.assign(MinBuckets, (uint32)EmptyBucket);
+        mSize = 0;
+        mTombstones = 0;
+    }
+
+private:
+    enum {
+        MinBuckets = 16,
+        EmptyBucket = 0xFFFFFFFF,
+        TombstoneBucket = 0xFFFFFFFE
+    };
+
+    struct Slot {
+        Slot()
+         : bucket(0),
+           used(false)
+        {}
+
+        KeyType key;
+        ValueType value;
+        uint32 bucket;
+        bool used;
+    };
+
+    // Rebuild the index with the given number of buckets, which must be a
+    // power of 2. Slots don't move, only the index is rebuilt, which also
+    // clears out tombstones.
+    void rehash(uint32 nbuckets) {
+        mBuckets.assign(nbuckets, (uint32)EmptyBucket);
+        mTombstones = 0;
+        uint32 mask = nbuckets - 1;
+        for(SlotID slot = 0; slot < mSlots.size(); slot++) {
+            if (!mSlots[slot].used) continue;
+            uint32 idx = mHasher(mSlots[slot].key) & mask;
+            while(mBuckets[idx] != EmptyBucket)
+                idx = (idx + 1) & mask;
+            mBuckets[idx] = slot;
+            mSlots[slot].bucket = idx;
+        }
+    }
+
+    HashType mHasher;
+    std::vector<Slot> mSlots;
+    std::vector<SlotID> mFreeSlots;
+    std::vector<uint32> mBuckets;
+    uint32 mSize;
+    uint32 mTombstones;
+}; // class SlotHashTable
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CORE_UTIL_SLOT_HASH_TABLE_HPP_
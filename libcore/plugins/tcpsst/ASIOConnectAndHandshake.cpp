@@ -63,7 +63,20 @@ using namespace boost::asio::ip;
                 break;
             }
         }
-        if (!memcmp(buffer->begin(),normalMode,sizeof(normalMode)-1/*not including null*/)) {
+        bool validHeader=!memcmp(buffer->begin(),normalMode,sizeof(normalMode)-1/*not including null*/);
+        // Servers which don't understand binary framing ignore the extension
+        // and will expect RFC 6455 frames, which we can't fall back to since
+        // packets may already be framed.
+        bool acceptedFraming=true;
+        if (validHeader&&connection->getStreamType()==Sirikata::Network::TCPStream::BINARY_LENGTH_DELIM) {
+            std::string header((const char*)buffer->begin(),whereHeaderEnds+1);
+            acceptedFraming=header.find(std::string("Sec-WebSocket-Extensions: ")+TCPStream::BINARY_FRAMING_EXTENSION())!=std::string::npos;
+        }
+        if (validHeader&&!acceptedFraming) {
+                connection->connectionFailedCallback(whichSocket,std::string("Server does not support binary framing"));
+                mFinishedCheckCount-=connection->numSockets();
+                mFinishedCheckCount-=1;
+        }else if (validHeader) {
             if (mFinishedCheckCount==(int)connection->numSockets()) {
                 mFirstReceivedHeader=*buffer;
             }
@@ -74,7 +87,7 @@ using namespace boost::asio::ip;
                 if (mFinishedCheckCount==0) {
                     connection->connectedCallback();
                 }
-                if (connection->getStreamType()==Sirikata::Network::TCPStream::RFC_6455) {
+                if (Sirikata::Network::TCPStream::usesRFC6455Handshake(connection->getStreamType())) {
                     ptrdiff_t diff = whereHeaderEnds+1;
                     MemoryReference mb(buffer->begin()+diff,bytes_received-diff);
                     MakeASIOReadBuffer(connection,whichSocket,mb, connection->getStreamType());
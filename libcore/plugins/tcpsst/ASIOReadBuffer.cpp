@@ -350,7 +350,7 @@ void ASIOReadBuffer::translateFixedBuffer(const MultiplexedSocketPtr &thus) {
             } else {
                 *(int*)mDataMask = 0;
             }
-        } else { // LENGTH_DELIM
+        } else { // LENGTH_DELIM or BINARY_LENGTH_DELIM
             mFirstFrame = mLastFrame = true; // Application packets can't span more than one protocol-level packet.
             *(int*)mDataMask = 0;
             packetHeaderLength= mFixedBufferPos-currentFixedBufferPos;
@@ -40,6 +40,8 @@
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
 #include "VariableLength.hpp"
+#include <sirikata/core/util/Base64.hpp>
+#include <boost/array.hpp>
 
 namespace Sirikata { namespace Network {
 
@@ -84,91 +86,42 @@ void BufferPrint(void * pointerkey, const char extension[16], const void * vbuf,
                 key.getArray().begin(),
                 UUID::static_size);
 }
-static uint32 conservativeBase64Size(size_t x) {
-    return (x+2)*4/3+6+x/64+(x%64?1:0);
-}
-static const uint8 _URL_SAFE_ALPHABET []= {
-        (uint8)'A', (uint8)'B', (uint8)'C', (uint8)'D', (uint8)'E', (uint8)'F', (uint8)'G',
-        (uint8)'H', (uint8)'I', (uint8)'J', (uint8)'K', (uint8)'L', (uint8)'M', (uint8)'N',
-        (uint8)'O', (uint8)'P', (uint8)'Q', (uint8)'R', (uint8)'S', (uint8)'T', (uint8)'U',
-        (uint8)'V', (uint8)'W', (uint8)'X', (uint8)'Y', (uint8)'Z',
-        (uint8)'a', (uint8)'b', (uint8)'c', (uint8)'d', (uint8)'e', (uint8)'f', (uint8)'g',
-        (uint8)'h', (uint8)'i', (uint8)'j', (uint8)'k', (uint8)'l', (uint8)'m', (uint8)'n',
-        (uint8)'o', (uint8)'p', (uint8)'q', (uint8)'r', (uint8)'s', (uint8)'t', (uint8)'u',
-        (uint8)'v', (uint8)'w', (uint8)'x', (uint8)'y', (uint8)'z',
-        (uint8)'0', (uint8)'1', (uint8)'2', (uint8)'3', (uint8)'4', (uint8)'5',
-        (uint8)'6', (uint8)'7', (uint8)'8', (uint8)'9', (uint8)'-', (uint8)'_'
-    };
-
-int translateBase64(uint8*destination, const uint8* source, int numSigBytes) {
-    uint32 source0=source[0];
-    uint32 source1=source[1];
-    uint32 source2=source[2];
-    uint32 inBuff =   ( numSigBytes > 0 ? ((source0 << 24) / 256) : 0 )
-                     | ( numSigBytes > 1 ? ((source1 << 24) / 65536) : 0 )
-                     | ( numSigBytes > 2 ? ((source2 << 24) / 65536/ 256) : 0 );
-
-    destination[ 0 ] = _URL_SAFE_ALPHABET[ (inBuff >> 18)        ];
-    destination[ 1 ] = _URL_SAFE_ALPHABET[ (inBuff >> 12) & 0x3f ];
-
-    switch( numSigBytes )
-    {
-      case 3:
-        destination[ 2 ] = _URL_SAFE_ALPHABET[ (inBuff >>  6) & 0x3f ];
-        destination[ 3 ] = _URL_SAFE_ALPHABET[ (inBuff      ) & 0x3f ];
-        return 4;
-      case 2:
-        destination[ 2 ] = _URL_SAFE_ALPHABET[ (inBuff >>  6) & 0x3f ];
-        destination[ 3 ] = '=';
-        return 4;
-
-      case 1:
-        destination[ 2 ] = '=';
-        destination[ 3 ] = '=';
-        return 4;
-
-      default:
-        return 0;
-    }   // end switch
-
-}
-
 Chunk* ASIOSocketWrapper::toBase64ZeroDelim(const MemoryReference&a, const MemoryReference&b, const MemoryReference&c, const MemoryReference*rawBytesToPrepend) {
     const MemoryReference*refs[3]; refs[0]=&a; refs[1]=&b; refs[2]=&c;
-    unsigned int datalen=0;
-    uint8 data[3];
-    Chunk * retval= new Chunk((rawBytesToPrepend?rawBytesToPrepend->size():0)+conservativeBase64Size(a.size()+b.size()+c.size())+2);
-    Chunk::iterator prependStart=retval->begin();
-    *(prependStart++)='\0';//frame start
+    size_t prependSize=(rawBytesToPrepend?rawBytesToPrepend->size():0);
+    Chunk * retval= new Chunk(1+prependSize+Base64::encodedLength(a.size()+b.size()+c.size(),true)+1);
+    uint8*out=&*retval->begin();
+    *(out++)='\0';//frame start
     if (rawBytesToPrepend) {
-        memcpy(&*prependStart,rawBytesToPrepend->data(),rawBytesToPrepend->size());
-        prependStart+=rawBytesToPrepend->size();
+        memcpy(out,rawBytesToPrepend->data(),prependSize);
+        out+=prependSize;
     }
-    size_t retvalSize=retval->size();
-    unsigned int curPlace=(unsigned int)(prependStart-retval->begin());
+    //groups of 3 bytes may span the references, so carry partial groups over
+    //to the next one and encode everything else directly
+    uint8 carry[3];
+    unsigned int carrylen=0;
     for (int i=0;i<3;++i) {
         const uint8*dat=(const uint8*)refs[i]->data();
-        uint32 size=refs[i]->size();
-        for (uint32 j=0;j<size;++j) {
-            data[datalen++]=dat[j];
-            if (datalen==3) {
-                if (retvalSize<=curPlace+5) {
-                    retval->resize(curPlace+5);
-                }
-                curPlace+=translateBase64(&*(retval->begin()+curPlace),data,datalen);
-                datalen=0;
+        size_t size=refs[i]->size();
+        while (carrylen&&size) {
+            carry[carrylen++]=*(dat++);
+            --size;
+            if (carrylen==3) {
+                out+=Base64::encode(out,carry,3,Base64::URLSafeAlphabet,true);
+                carrylen=0;
             }
         }
-    }
-    if (datalen) {
-        if (retvalSize<=curPlace+5) {
-            retval->resize(curPlace+5);
-            SILOG(tcpsst,error,"conservative size estimate incorrect");
+        size_t whole=size-size%3;
+        out+=Base64::encode(out,dat,whole,Base64::URLSafeAlphabet,true);
+        for (size_t j=whole;j<size;++j) {
+            carry[carrylen++]=dat[j];
         }
-        curPlace+=translateBase64(&*(retval->begin()+curPlace),data,datalen);
     }
-    (*retval)[curPlace]=0xff;//0xff DELIMITED
-    retval->resize(curPlace+1);
+    if (carrylen) {
+        out+=Base64::encode(out,carry,carrylen,Base64::URLSafeAlphabet,true);
+    }
+    *(out++)=0xff;//0xff DELIMITED
+    retval->resize(out-&*retval->begin());
     return retval;
 }
 
@@ -216,6 +169,9 @@ void ASIOSocketWrapper::sendManyDequeItems(const std::tr1::weak_ptr<MultiplexedS
         std::deque<TimestampedChunk> local_toSend;
         local_toSend.swap(mToSend);
         if (error )   {
+            for (std::deque<TimestampedChunk>::const_iterator i=local_toSend.begin(),ie=local_toSend.end();i!=ie;++i) {
+                delete i->chunk;
+            }
             triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
             SILOG(tcpsst,insane,"Socket disconnected...waiting for recv to trigger error condition\n");
         } else {
@@ -224,9 +180,9 @@ void ASIOSocketWrapper::sendManyDequeItems(const std::tr1::weak_ptr<MultiplexedS
                 finishedSendingChunk(*i);
                 size_t cursize=i->size();
                 total_size+=cursize;
-                if (cursize) {
+                if (i->chunk&&cursize) {
                     BufferPrint(this,".sec",&*i->chunk->begin(),cursize);
-                    TCPSSTLOG(this,"snd",&*i->begin(),i->size,error);
+                    TCPSSTLOG(this,"snd",&*i->chunk->begin(),cursize,error);
                 }
                 delete i->chunk;
             }
@@ -236,20 +192,37 @@ void ASIOSocketWrapper::sendManyDequeItems(const std::tr1::weak_ptr<MultiplexedS
         }
     }
 }
-#define ASIOSocketWrapperBuffer(pointer,size) boost::asio::buffer(pointer,(size))
 
+boost::asio::const_buffer ASIOSocketWrapper::writeHeader(const MultiplexedSocketPtr&parentMultiSocket, const TimestampedChunk&toSend, size_t pos) {
+    uint8*header=&mHeaderBuffer[pos];
+    unsigned int headerSize=constructFrameHeader(parentMultiSocket->getStreamType(),toSend.stream,toSend.payload.size(),header);
+    assert(headerSize==toSend.headerSize);
+    return boost::asio::const_buffer(header,headerSize);
+}
 
-void ASIOSocketWrapper::sendToWire(const MultiplexedSocketPtr&parentMultiSocket, TimestampedChunk toSend) {
+void ASIOSocketWrapper::sendToWire(const MultiplexedSocketPtr&parentMultiSocket, const TimestampedChunk&toSend) {
     //sending a single chunk is a straightforward call directly to asio
     mToSend.resize(0);
     mToSend.push_back(toSend);
-    BufferPrint(this,".buw",&*toSend.chunk->begin(),toSend.size());
     mOutstandingDataParent=parentMultiSocket;//keep parent alive until send finishes
 
-    boost::asio::async_write(*mSocket,
-                             boost::asio::buffer(&*toSend.chunk->begin(),toSend.size()),
-                             boost::asio::transfer_at_least(toSend.size()),
-                             mSendManyDequeItems);
+    if (toSend.chunk) {
+        BufferPrint(this,".buw",&*toSend.chunk->begin(),toSend.size());
+        boost::asio::async_write(*mSocket,
+                                 boost::asio::buffer(&*toSend.chunk->begin(),toSend.size()),
+                                 boost::asio::transfer_at_least(toSend.size()),
+                                 mSendManyDequeItems);
+    }else {
+        if (mHeaderBuffer.size()<MAX_FRAME_HEADER_SIZE)
+            mHeaderBuffer.resize(MAX_FRAME_HEADER_SIZE);
+        boost::array<boost::asio::const_buffer,2> bufs;
+        bufs[0]=writeHeader(parentMultiSocket,toSend,0);
+        bufs[1]=boost::asio::const_buffer(toSend.payload.data(),toSend.payload.size());
+        boost::asio::async_write(*mSocket,
+                                 bufs,
+                                 boost::asio::transfer_at_least(toSend.size()),
+                                 mSendManyDequeItems);
+    }
 }
 void ASIOSocketWrapper::bindFunctions(const MultiplexedSocketPtr&parent) {
     mStrand = parent->getStrand();
@@ -265,15 +238,32 @@ void ASIOSocketWrapper::bindFunctions(const MultiplexedSocketPtr&parent) {
         );
 }
 void ASIOSocketWrapper::sendToWire(const MultiplexedSocketPtr&parentMultiSocket, std::deque<TimestampedChunk>&input_toSend){
-    std::vector<boost::asio::mutable_buffer> bufs;
+    //headers must all fit before any buffers point into mHeaderBuffer
+    size_t header_size=0;
+    for (std::deque<TimestampedChunk>::const_iterator i=input_toSend.begin(),ie=input_toSend.end();i!=ie;++i) {
+        header_size+=i->headerSize;
+    }
+    if (mHeaderBuffer.size()<header_size)
+        mHeaderBuffer.resize(std::max(header_size,mHeaderBuffer.size()*2));
+
+    std::vector<boost::asio::const_buffer> bufs;
+    bufs.reserve(input_toSend.size()*2);
     size_t total_size=0;
+    size_t header_pos=0;
     for (std::deque<TimestampedChunk>::const_iterator i=input_toSend.begin(),ie=input_toSend.end();i!=ie;++i) {
-        size_t cursize=i->chunk->size();
-        bufs.push_back(boost::asio::buffer(&*i->chunk->begin(),cursize));
-        total_size+=cursize;
-        if( cursize) {
-            BufferPrint(this,".buw",&*i->chunk->begin(),cursize);
+        size_t cursize=i->size();
+        if (i->chunk) {
+            bufs.push_back(boost::asio::buffer(&*i->chunk->begin(),cursize));
+            if( cursize) {
+                BufferPrint(this,".buw",&*i->chunk->begin(),cursize);
+            }
+        }else {
+            bufs.push_back(writeHeader(parentMultiSocket,*i,header_pos));
+            header_pos+=i->headerSize;
+            if (!i->payload.empty())
+                bufs.push_back(boost::asio::const_buffer(i->payload.data(),i->payload.size()));
         }
+        total_size+=cursize;
     }
     mToSend.swap(input_toSend);
     mOutstandingDataParent=parentMultiSocket;//keep parent alive until send finishes
@@ -367,15 +357,24 @@ bool ASIOSocketWrapper::canSend(size_t dataSize) const{
     return mSendQueue.getResourceMonitor().filledSize()+dataSize<=(size_t)mSendQueue.getResourceMonitor().maxSize();
 }
 bool ASIOSocketWrapper::rawSend(const MultiplexedSocketPtr&parentMultiSocket, Chunk * chunk, bool force) {
-    bool retval=true;
     TCPSSTLOG(this,"raw",&*chunk->begin(),chunk->size(),false);
+    return queueOrSend(parentMultiSocket,TimestampedChunk(chunk),force);
+}
+bool ASIOSocketWrapper::rawSend(const MultiplexedSocketPtr&parentMultiSocket, const Stream::StreamID&sid, const SST::BufferSlice&payload, bool force) {
+    TCPSSTLOG(this,"raw",payload.data(),payload.size(),false);
+    return queueOrSend(parentMultiSocket,
+                       TimestampedChunk(sid,payload,frameHeaderSize(parentMultiSocket->getStreamType(),sid,payload.size())),
+                       force);
+}
+bool ASIOSocketWrapper::queueOrSend(const MultiplexedSocketPtr&parentMultiSocket, const TimestampedChunk&toSend, bool force) {
+    bool retval=true;
     uint32 current_status=++mSendingStatus;
     if (current_status==1) {//we are teh chosen thread
         mSendingStatus+=(ASYNCHRONOUS_SEND_FLAG-1);//committed to be the sender thread
-        sendToWire(parentMultiSocket, chunk);
+        sendToWire(parentMultiSocket, toSend);
     }else {//if someone else is possibly sending a packet
         //push the packet on the queue
-        retval=mSendQueue.push(chunk, force);
+        retval=mSendQueue.push(toSend, force);
         current_status=--mSendingStatus;
         if (retval) {
             //the packet is out of our hands now...
@@ -386,6 +385,58 @@ bool ASIOSocketWrapper::rawSend(const MultiplexedSocketPtr&parentMultiSocket, Ch
     }
     return retval;
 }
+unsigned int ASIOSocketWrapper::frameHeaderSize(TCPStream::StreamType type, const Stream::StreamID&sid, size_t payloadSize) {
+    unsigned int streamIdLength=sid.serializedSize();
+    size_t totalSize=payloadSize+streamIdLength;
+    switch (type) {
+      case TCPStream::RFC_6455:
+        return streamIdLength+(totalSize<=125?2:(totalSize<=65535?4:10));
+      case TCPStream::LENGTH_DELIM:
+      case TCPStream::BINARY_LENGTH_DELIM:
+      default:
+        return streamIdLength+VariableLength((uint32)totalSize).serializedSize();
+    }
+}
+unsigned int ASIOSocketWrapper::constructFrameHeader(TCPStream::StreamType type, const Stream::StreamID&sid, size_t payloadSize, uint8*destination) {
+    unsigned int streamIdLength=sid.serializedSize();
+    size_t totalSize=payloadSize+streamIdLength;
+    unsigned int packetHeaderLength;
+    switch (type) {
+      case TCPStream::RFC_6455: {
+        packetHeaderLength = 2;
+        destination[0] = 0x80 | 0x02 ; // Flags = FIN/Unfragmented, Opcode = 2: binary data
+        if (totalSize <= 125) {
+          destination[1] = totalSize;
+        } else if (totalSize <= 65535) {
+          destination[1] = 126;
+          destination[2] = (totalSize >> 8);
+          destination[3] = (totalSize & 0xff);
+          packetHeaderLength += 2;
+        } else {
+          // why do they jump from 16-bit to 64-bit
+          destination[1] = 127;
+          destination[2] = 0;
+          destination[3] = 0;
+          destination[4] = 0;
+          destination[5] = 0;
+          destination[6] = (totalSize >> 24);
+          destination[7] = ((totalSize >> 16) & 0xff);
+          destination[8] = ((totalSize >> 8) & 0xff);
+          destination[9] = (totalSize & 0xff);
+          packetHeaderLength += 8;
+        }
+      } break;
+      case TCPStream::LENGTH_DELIM:
+      case TCPStream::BINARY_LENGTH_DELIM:
+      default: {
+        VariableLength packetLength=VariableLength((uint32)totalSize);
+        packetHeaderLength=packetLength.serialize(destination,VariableLength::MAX_SERIALIZED_LENGTH);
+      } break;
+    }
+    unsigned int successLengthNeeded=sid.serialize(destination+packetHeaderLength,Stream::StreamID::MAX_SERIALIZED_LENGTH);
+    assert(successLengthNeeded==streamIdLength);
+    return packetHeaderLength+successLengthNeeded;
+}
 Chunk*ASIOSocketWrapper::constructControlPacket(const MultiplexedSocketPtr &thus, TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid){
     const unsigned int max_size=16;
     switch (thus->getStreamType()) {
@@ -425,6 +476,7 @@ Chunk*ASIOSocketWrapper::constructControlPacket(const MultiplexedSocketPtr &thus
         return new Chunk(dataStream, dataStream + size + cur);
       } break;
       case TCPStream::LENGTH_DELIM:
+      case TCPStream::BINARY_LENGTH_DELIM:
       default: {
         uint8 dataStream[max_size+VariableLength::MAX_SERIALIZED_LENGTH+Stream::StreamID::MAX_SERIALIZED_LENGTH];
         unsigned int size=max_size;
@@ -447,8 +499,7 @@ Chunk*ASIOSocketWrapper::constructControlPacket(const MultiplexedSocketPtr &thus
     }
 }
 Chunk* ASIOSocketWrapper::constructPing(const MultiplexedSocketPtr& thus, MemoryReference data, bool isPong) {
-    assert (thus->getStreamType() != TCPStream::LENGTH_DELIM &&
-            thus->getStreamType() != TCPStream::BASE64_ZERODELIM);
+    assert (thus->getStreamType() == TCPStream::RFC_6455);
     assert (data.length() <= 125);
     Chunk *chunk = new Chunk(2 + data.length());
     (*chunk)[0] = 0x80 | (isPong ? 0x0a : 0x09);
@@ -492,13 +543,14 @@ void ASIOSocketWrapper::sendServerProtocolHeader(const MultiplexedSocketPtr& thu
     header << "HTTP/1.1 101 Web Socket Protocol Handshake\r\n";
     header << "Upgrade: WebSocket\r\n";
     header << "Connection: Upgrade\r\n";
-    if (thus->getStreamType() == TCPStream::RFC_6455) {
+    if (TCPStream::usesRFC6455Handshake(thus->getStreamType())) {
         header << "Access-Control-Allow-Origin: " << origin << "\r\n";
         header << "Location: ws://" << host << resource_name << "\r\n";
         header << "Sec-WebSocket-Accept: " << response << "\r\n";
         if (sendSubProtocol)
             header << "Sec-WebSocket-Protocol: " << subprotocol << "\r\n";
-//        header << "Sec-WebSocket-Extensions: -\r\n";
+        if (thus->getStreamType() == TCPStream::BINARY_LENGTH_DELIM)
+            header << "Sec-WebSocket-Extensions: " << TCPStream::BINARY_FRAMING_EXTENSION() << "\r\n";
         header << "\r\n";
     } else {
         header << "Sec-WebSocket-Origin: " << origin << "\r\n";
@@ -532,18 +584,20 @@ void ASIOSocketWrapper::sendProtocolHeader(const MultiplexedSocketPtr&parentMult
 
         header << "Origin: " << address.getHostName() << "\r\n";
 
-        if (parentMultiSocket->getStreamType()!= TCPStream::RFC_6455) {
+        if (!TCPStream::usesRFC6455Handshake(parentMultiSocket->getStreamType())) {
             header << "Sec-WebSocket-Key1: x!|6 j9  U 1 guf  36Y04  |   4\r\n";
             header << "Sec-WebSocket-Key2: 3   59   2 E4   _11  x80      \r\n";
         }else {
             header << "Sec-WebSocket-Version: 13\r\n";
             header << "Sec-WebSocket-Key: MTIzNDU2Nzg5MGFiY2RlZg==\r\n";
+            if (parentMultiSocket->getStreamType() == TCPStream::BINARY_LENGTH_DELIM)
+                header << "Sec-WebSocket-Extensions: " << TCPStream::BINARY_FRAMING_EXTENSION() << "\r\n";
         }
         header << "Sec-WebSocket-Protocol: "
                << (parentMultiSocket->getStreamType()==TCPStream::BASE64_ZERODELIM?"wssst":"sst")
                << numConnections << "\r\n";
         header << "\r\n";
-        if (parentMultiSocket->getStreamType()!= TCPStream::RFC_6455) {
+        if (!TCPStream::usesRFC6455Handshake(parentMultiSocket->getStreamType())) {
             header << "abcdefgh";
         }
 
@@ -34,6 +34,7 @@
 #include <sirikata/core/util/Time.hpp>
 #include <sirikata/core/util/EWA.hpp>
 #include <sirikata/core/network/IOStrand.hpp>
+#include <sirikata/core/network/SSTBufferPool.hpp>
 
 #define SEND_LATENCY_EWA_ALPHA .10f
 
@@ -55,17 +56,32 @@ class ASIOSocketWrapper {
      */
     AtomicValue<uint32> mSendingStatus;
 
+public:
+    enum {
+        ///largest framing and stream ID header constructFrameHeader may write
+        MAX_FRAME_HEADER_SIZE=10+Stream::StreamID::MAX_SERIALIZED_LENGTH
+    };
+private:
+    /**
+     * A packet waiting to be sent. Either chunk holds the exact bytes to put on the wire, or payload
+     * holds the data for stream and its framing header is written into mHeaderBuffer just before it is
+     * handed to asio, so the payload goes out without being copied again.
+     */
     struct TimestampedChunk {
         TimestampedChunk()
-         : chunk(NULL), time(Time::null())
+         : chunk(NULL), headerSize(0), time(Time::null())
         {}
 
         TimestampedChunk(Chunk* _c)
-         : chunk(_c), time(Time::local())
+         : chunk(_c), headerSize(0), time(Time::local())
+        {}
+
+        TimestampedChunk(const Stream::StreamID& _stream, const SST::BufferSlice& _payload, unsigned int _headerSize)
+         : chunk(NULL), stream(_stream), payload(_payload), headerSize(_headerSize), time(Time::local())
         {}
 
         uint32 size() const {
-            return chunk->size();
+            return chunk ? chunk->size() : headerSize+payload.size();
         }
 
         Duration sinceCreation() const {
@@ -73,6 +89,9 @@ class ASIOSocketWrapper {
         }
 
         Chunk* chunk;
+        Stream::StreamID stream;
+        SST::BufferSlice payload;
+        unsigned int headerSize;
         Time time;
     };
 
@@ -89,6 +108,14 @@ class ASIOSocketWrapper {
 
     std::vector<Stream::StreamID> mPausedSendStreams;
     std::deque<TimestampedChunk> mToSend;
+    /**
+     * Header space for the write in progress. Only one write is outstanding per socket, so each write
+     * carves its headers from the start of the buffer and it only grows when a write needs more header
+     * space than any before it.
+     */
+    std::vector<uint8> mHeaderBuffer;
+    /// Writes the header for a payload packet at pos in mHeaderBuffer and returns its buffer
+    boost::asio::const_buffer writeHeader(const MultiplexedSocketPtr&parentMultiSocket, const TimestampedChunk&toSend, size_t pos);
     std::tr1::weak_ptr<MultiplexedSocket>mParent;
     std::tr1::shared_ptr<MultiplexedSocket>mOutstandingDataParent;
     /** Call this any time a chunk finishes being sent so statistics can be collected. */
@@ -114,7 +141,7 @@ class ASIOSocketWrapper {
 /**
  * When there's a single packet to be sent to the network, mSocket->async_send is simply called upon the Chunk to be sent
  */
-    void sendToWire(const MultiplexedSocketPtr&parentMultiSocket, TimestampedChunk toSend);
+    void sendToWire(const MultiplexedSocketPtr&parentMultiSocket, const TimestampedChunk&toSend);
 
 /**
  *  This function sends a while queue of packets to the network
@@ -133,6 +160,9 @@ class ASIOSocketWrapper {
  */
     void retryQueuedSend(const MultiplexedSocketPtr&parentMultiSocket, uint32 current_status);
 
+    /// Sends toSend directly if no other send is in progress, otherwise queues it
+    bool queueOrSend(const MultiplexedSocketPtr&parentMultiSocket, const TimestampedChunk&toSend, bool force);
+
 public:
 
     ASIOSocketWrapper(TCPSocket* socket,uint32 queuedBufferSize,uint32 sendBufferSize, const MultiplexedSocketPtr&parent)
@@ -214,7 +244,19 @@ public:
      *              policy indicates no more space is available.
      */
     bool rawSend(const MultiplexedSocketPtr&parentMultiSocket, Chunk * chunk, bool force);
+    /**
+     * Sends payload on stream sid, framing it according to the parent's stream type. The payload is
+     * referenced, not copied, until it has been written to the socket.
+     */
+    bool rawSend(const MultiplexedSocketPtr&parentMultiSocket, const Stream::StreamID&sid, const SST::BufferSlice&payload, bool force);
     bool canSend(size_t dataSize)const;
+    /**
+     * Writes the framing and stream ID that go in front of a payloadSize byte packet on stream sid into
+     * destination, which must have room for MAX_FRAME_HEADER_SIZE bytes. Only valid for the binary stream
+     * types. Returns the number of bytes written, which matches frameHeaderSize.
+     */
+    static unsigned int constructFrameHeader(TCPStream::StreamType type, const Stream::StreamID&sid, size_t payloadSize, uint8*destination);
+    static unsigned int frameHeaderSize(TCPStream::StreamType type, const Stream::StreamID&sid, size_t payloadSize);
     static Chunk*constructControlPacket(const MultiplexedSocketPtr&parentMultiSocket, TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid);
     /**
      * Sends a WebSocket ping/pong with the passed data.
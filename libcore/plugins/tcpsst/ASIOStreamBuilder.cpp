@@ -274,6 +274,10 @@ void ASIOStreamBuilder::buildStream(TcpSstHeaderArray *buffer,
         }
         reply_str = Base64::encode(shasumbytes,true);
         streamType = TCPStream::RFC_6455;
+        // Sirikata clients may ask to skip WebSocket framing
+        if (headers.find("sec-websocket-extensions") != headers.end() &&
+            headers["sec-websocket-extensions"].find(TCPStream::BINARY_FRAMING_EXTENSION()) != std::string::npos)
+            streamType = TCPStream::BINARY_LENGTH_DELIM;
     } else {
         SILOG(tcpsst,warning,"Unsupported Websocket Version " << wsversion);
         // FIXME: Send 400 Bad Request with "Sec-WebSocket-Version: 13" to tell clients to renegotiate an older version.
@@ -151,28 +151,36 @@ size_t MultiplexedSocket::leastBusyStream(size_t favored) {
     return retval;
 }
 
-float MultiplexedSocket::dropChance(const Chunk*data,size_t whichStream) {
+float MultiplexedSocket::dropChance(const RawRequest&data,size_t whichStream) {
     return .25;
 }
 
 bool MultiplexedSocket::sendBytesNow(const MultiplexedSocketPtr& thus,const RawRequest&data, bool force) {
-    TCPSSTLOG(this,"sendnow",&*data.data->begin(),data.data->size(),false);
+    TCPSSTLOG(this,"sendnow",data.bytes(),data.size(),false);
     TCPSSTLOG(this,"sendnow","\n",1,false);
     static Stream::StreamID::Hasher hasher;
     if (data.originStream==Stream::StreamID()) {
         unsigned int socket_size=(unsigned int)thus->mSockets.size();
         for(unsigned int i=1;i<socket_size;++i) {
-            thus->mSockets[i].rawSend(thus,new Chunk(*data.data),true);
+            if (data.data)
+                thus->mSockets[i].rawSend(thus,new Chunk(*data.data),true);
+            else
+                thus->mSockets[i].rawSend(thus,data.originStream,data.payload,true);
         }
-        thus->mSockets[0].rawSend(thus,data.data,true);
+        if (data.data)
+            thus->mSockets[0].rawSend(thus,data.data,true);
+        else
+            thus->mSockets[0].rawSend(thus,data.originStream,data.payload,true);
         return true;
     }else {
         size_t whichStream=hasher(data.originStream)%thus->mSockets.size();
         if (data.unordered) {
             whichStream=thus->leastBusyStream(whichStream);
         }
-        if (data.unreliable==false||rand()/(float)RAND_MAX>thus->dropChance(data.data,whichStream)) {
-            return thus->mSockets[whichStream].rawSend(thus,data.data,force);
+        if (data.unreliable==false||rand()/(float)RAND_MAX>thus->dropChance(data,whichStream)) {
+            if (data.data)
+                return thus->mSockets[whichStream].rawSend(thus,data.data,force);
+            return thus->mSockets[whichStream].rawSend(thus,data.originStream,data.payload,force);
         }else {
             return true;
         }
@@ -214,12 +222,12 @@ bool MultiplexedSocket::sendBytes(const MultiplexedSocketPtr& thus,const RawRequ
             }else if(thus->mSocketConnectionPhase==DISCONNECTED) {
                 //retval=false;
                 //FIXME is this the correct thing to do?
-                TCPSSTLOG(this,"sendnvr",&*data.data->begin(),data.data->size(),false);
+                TCPSSTLOG(this,"sendnvr",data.bytes(),data.size(),false);
                 TCPSSTLOG(this,"sendnvr","\n",1,false);
             }else {
                 //with the connectionMutex acquired, no socket is allowed to be in the mSocketConnectionPhase
                 assert(thus->mSocketConnectionPhase==PRECONNECTION);
-                TCPSSTLOG(this,"sendl8r",&*data.data->begin(),data.data->size(),false);
+                TCPSSTLOG(this,"sendl8r",data.bytes(),data.size(),false);
                 TCPSSTLOG(this,"sendl8r","\n",1,false);
                 if (thus->mNewRequests==NULL) {
                     thus->mNewRequests=new SizedThreadSafeQueue<RawRequest>(SizedResourceMonitor(maxQueueSize));
@@ -37,6 +37,7 @@
 #include <boost/thread.hpp>
 #include "TCPSSTDecls.hpp"
 #include "TCPStream.hpp"
+#include <sirikata/core/network/SSTBufferPool.hpp>
 
 namespace Sirikata {
 namespace Network {
@@ -47,15 +48,27 @@ class ASIOSocketWrapper;
 class MultiplexedSocket:public SelfWeakPtr<MultiplexedSocket>, public SerializationCheck {
 public:
     friend class ASIOReadBuffer;
+    /**
+     * A packet to send. Either data holds the exact bytes to put on the wire, including framing, or it is
+     * NULL and payload holds the bytes for originStream, which the socket frames when it writes them.
+     */
     class RawRequest {
     public:
+        RawRequest() : data(NULL) {}
         bool unordered;
         bool unreliable;
         Stream::StreamID originStream;
         Chunk * data;
+        SST::BufferSlice payload;
 
         uint32 size() const {
-            return data->size();
+            return data ? data->size() : payload.size();
+        }
+        // The bytes to send, from whichever of data and payload is set
+        const uint8* bytes() const {
+            if (data)
+                return data->empty() ? NULL : &*data->begin();
+            return payload.data();
         }
     };
     enum SocketConnectionPhase{
@@ -99,6 +112,8 @@ private:
     CallbackMap mCallbacks;
     ///Whether the streams are zero delimited and in a base64 encoding (useful for interaction with web sockets)
     TCPStream::StreamType mStreamType;
+    ///payload buffers for packets sent on this connection's streams
+    SST::BufferPool mSendPool;
     ///a map from StreamID to count of number of acked close requests--to avoid any unordered packets coming in
     std::tr1::unordered_map<Stream::StreamID,unsigned int,Stream::StreamID::Hasher>mAckedClosingStreams;
     ///a set of StreamIDs to hold the streams that were requested closed but have not been acknowledged, to prevent received packets triggering NewStream callbacks as if a new ID were received
@@ -124,7 +139,7 @@ private:
      * (due to busy queues, etc).
      * \returns drop chance which must be less than 1.0 and greater or equal to 0.0
      */
-    float dropChance(const Chunk*data,size_t whichStream);
+    float dropChance(const RawRequest&data,size_t whichStream);
     /**
      *  sends bytes to the network directly.
      *  assumes that the mSocketConnectionPhase in the CONNECTED state
@@ -151,6 +166,8 @@ public:
     }
     ///public io service accessor for new stream construction
     IOStrand* getStrand() {return mIO;}
+    ///pool that payloads for sendBytes should be allocated from
+    SST::BufferPool& getSendPool() {return mSendPool;}
 
     /**
      * Sends a packet telling the other side that this stream is closed (or alternatively if its a closeAck that the close request was received and no further packets for that
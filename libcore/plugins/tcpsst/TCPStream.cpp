@@ -214,81 +214,28 @@ bool TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, St
             bytes_copied+=frag_size;
             offset=toBeSent.data->size();
         }
-        } else {
-        uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
-        unsigned int streamIdLength=StreamID::MAX_SERIALIZED_LENGTH;
-        unsigned int successLengthNeeded=toBeSent.originStream.serialize(serializedStreamId,streamIdLength);
-        assert(successLengthNeeded<=streamIdLength);
-        streamIdLength=successLengthNeeded;
-        size_t totalSize=firstChunk.size()+secondChunk.size();
-        totalSize+=streamIdLength;
-        uint8 packetHeader[12];
-        unsigned int packetHeaderLength = 2;
-        packetHeader[0] = 0x80 | 0x02 ; // Flags = FIN/Unfragmented, Opcode = 2: binary data
-        if (totalSize <= 125) {
-          packetHeader[1] = totalSize;
-        } else if (totalSize <= 65535) {
-          packetHeader[1] = 126;
-          packetHeader[2] = (totalSize >> 8);
-          packetHeader[3] = (totalSize & 0xff);
-          packetHeaderLength += 2;
-        } else {
-          // why do they jump from 16-bit to 64-bit
-          packetHeader[1] = 127;
-          packetHeader[2] = 0;
-          packetHeader[3] = 0;
-          packetHeader[4] = 0;
-          packetHeader[5] = 0;
-          packetHeader[6] = (totalSize >> 24);
-          packetHeader[7] = ((totalSize >> 16) & 0xff);
-          packetHeader[8] = ((totalSize >> 8) & 0xff);
-          packetHeader[9] = (totalSize & 0xff);
-          packetHeaderLength += 8;
-        }
-        //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data. totalSize = size of streamID + size of data and
-        //packetHeaderLength = the length of the length component of the packet
-        toBeSent.data=new Chunk(totalSize+packetHeaderLength);
-
-        uint8 *outputBuffer=&(*toBeSent.data)[0];
-        std::memcpy(outputBuffer,packetHeader,packetHeaderLength);
-        std::memcpy(outputBuffer+packetHeaderLength,serializedStreamId,streamIdLength);
-        if (firstChunk.size()) {
-            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength],
-                        firstChunk.data(),
-                        firstChunk.size());
-        }
-        if (secondChunk.size()) {
-            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength+firstChunk.size()],
-                        secondChunk.data(),
-                        secondChunk.size());
-        }
-      } break;
+        break;
+      }
+      //otherwise fall through, the socket writes the RFC 6455 framing in front of the payload
       case LENGTH_DELIM:
+      case BINARY_LENGTH_DELIM:
       default: {
-        uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
-        unsigned int streamIdLength=StreamID::MAX_SERIALIZED_LENGTH;
-        unsigned int successLengthNeeded=toBeSent.originStream.serialize(serializedStreamId,streamIdLength);
-        assert(successLengthNeeded<=streamIdLength);
-        streamIdLength=successLengthNeeded;
+        //copy the data once into a pooled buffer, which is referenced until it has been written to the
+        //socket. The socket writes the framing and stream ID when it sends the packet.
+        MultiplexedSocketPtr socket_copy = mSocket;
+        if (socket_copy.get() == NULL) {
+            SILOG(tcpsst,debug,"printing to closed stream id "<<getID().read());
+            return false;
+        }
         size_t totalSize=firstChunk.size()+secondChunk.size();
-        totalSize+=streamIdLength;
-        VariableLength packetLength=VariableLength(totalSize);
-        uint8 packetLengthSerialized[VariableLength::MAX_SERIALIZED_LENGTH];
-        unsigned int packetHeaderLength=packetLength.serialize(packetLengthSerialized,VariableLength::MAX_SERIALIZED_LENGTH);
-        //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data. totalSize = size of streamID + size of data and
-        //packetHeaderLength = the length of the length component of the packet
-        toBeSent.data=new Chunk(totalSize+packetHeaderLength);
-
-        uint8 *outputBuffer=&(*toBeSent.data)[0];
-        std::memcpy(outputBuffer,packetLengthSerialized,packetHeaderLength);
-        std::memcpy(outputBuffer+packetHeaderLength,serializedStreamId,streamIdLength);
+        toBeSent.payload=socket_copy->getSendPool().allocate(totalSize);
         if (firstChunk.size()) {
-            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength],
+            std::memcpy(toBeSent.payload.data(),
                         firstChunk.data(),
                         firstChunk.size());
         }
         if (secondChunk.size()) {
-            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength+firstChunk.size()],
+            std::memcpy(toBeSent.payload.data()+firstChunk.size(),
                         secondChunk.data(),
                         secondChunk.size());
         }
@@ -362,6 +309,7 @@ TCPStream::TCPStream(IOStrand* io,OptionSet*options):mSendStatus(new AtomicValue
     OptionValue *noDelay=options->referenceOption("no-delay");
     OptionValue *base64=options->referenceOption("base64");
     OptionValue *oldLengthDelim=options->referenceOption("websocket-draft-76");
+    OptionValue *binaryFraming=options->referenceOption("binary-framing");
     OptionValue *fragmentPackets=options->referenceOption("test-fragment-packet-level");
     if (fragmentPackets->as<int>()!=-1) {
         sFragmentPackets = fragmentPackets->as<int>();
@@ -373,7 +321,12 @@ TCPStream::TCPStream(IOStrand* io,OptionSet*options):mSendStatus(new AtomicValue
     mKernelSendBufferSize=kernelSendBufferSize->as<unsigned int>();
     mKernelReceiveBufferSize=kernelReceiveBufferSize->as<unsigned int>();
     mNoDelay=noDelay->as<bool>();
-    mStreamType=oldLengthDelim->as<bool>() ? TCPStream::LENGTH_DELIM : TCPStream::RFC_6455;
+    if (oldLengthDelim->as<bool>())
+        mStreamType=TCPStream::LENGTH_DELIM;
+    else if (binaryFraming->as<bool>())
+        mStreamType=TCPStream::BINARY_LENGTH_DELIM;
+    else
+        mStreamType=TCPStream::RFC_6455;
 }
 
 TCPStream::TCPStream(IOStrand* io,unsigned char numSimultSockets,unsigned int sendBufferSize,bool noDelay, StreamType streamType, unsigned int kernelSendBufferSize,unsigned int kernelReceiveBufferSize):mSendStatus(new AtomicValue<int>(0)) {
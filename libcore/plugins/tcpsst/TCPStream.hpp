@@ -109,8 +109,20 @@ public:
         UNKNOWN,
         BASE64_ZERODELIM,
         LENGTH_DELIM,
-        RFC_6455
+        RFC_6455,
+        // VariableLength prefixed packets, like LENGTH_DELIM, but negotiated
+        // with an RFC 6455 handshake. Only Sirikata peers understand it, so it
+        // is only used when the client asks for it and the server agrees.
+        BINARY_LENGTH_DELIM
     };
+    // Whether the stream type starts with an RFC 6455 handshake
+    static bool usesRFC6455Handshake(StreamType type) {
+        return (type == RFC_6455 || type == BINARY_LENGTH_DELIM);
+    }
+    // WebSocket extension used to negotiate BINARY_LENGTH_DELIM
+    static const char* BINARY_FRAMING_EXTENSION() {
+        return "sst-binary-framing";
+    }
     //if !=0 and type is RFC_6455, arbitrarily fragment packets 2 indicates more aggressive testing of fragmentation than 1 (testing option)
     static int sFragmentPackets;
 private:
@@ -50,6 +50,7 @@ static OptionSet*optionParser(const String&str) {
     OptionValue *noDelay=new OptionValue("no-delay","false",OptionValueType<bool>(),"Whether the no-delay option is set on the socket");
     OptionValue *zeroDelim=new OptionValue("base64","false",OptionValueType<bool>(),"True if the stream should be base64 (eg javascript compat)");
     OptionValue *oldWebsocket=new OptionValue("websocket-draft-76","false",OptionValueType<bool>(),"True if the stream should be websocket draft-76. False for RFC 6455");
+    OptionValue *binaryFraming=new OptionValue("binary-framing","false",OptionValueType<bool>(),"True if outgoing streams should ask for length prefixed binary packets instead of RFC 6455 frames. Only Sirikata servers accept this and connecting to any other server fails, so it is off by default and should only be enabled for links between Sirikata servers, e.g. with --spacestreamoptions.");
     OptionValue *testFragmentPackets=new OptionValue("test-fragment-packet-level","-1",OptionValueType<int>(),"1 if packets should be fragmented at regular intervals in order to test the browser fragmentation. 2 if packets should be aggressively fragmented. 0 to explicitly disable fragmentation of packets. Option affects option globally for the duration of the run.");
 
     InitializeClassOptions("tcpsstoptions",numSockets,
@@ -59,6 +60,7 @@ static OptionSet*optionParser(const String&str) {
                      noDelay,
                      zeroDelim,
                      oldWebsocket,
+                     binaryFraming,
                      kSendBufferSize,
                      kReceiveBufferSize,
                      testFragmentPackets,
@@ -0,0 +1,28 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/network/SSTCongestionControl.hpp>
+
+namespace Sirikata {
+namespace SST {
+
+CongestionController* CongestionController::create(const String& name) {
+    if (name == "reno")
+        return new RenoCongestionController();
+    else if (name == "cubic")
+        return new CubicCongestionController();
+    else if (name == "delay" || name == "vegas")
+        return new DelayCongestionController();
+    return NULL;
+}
+
+const double CubicCongestionController::C = 0.4;
+const double CubicCongestionController::BETA = 0.7;
+
+const double DelayCongestionController::ALPHA = 2.0;
+const double DelayCongestionController::BETA = 4.0;
+const double DelayCongestionController::GAMMA = 1.0;
+
+} // namespace SST
+} // namespace Sirikata
@@ -49,6 +49,14 @@ namespace Trace {
 
 OptionValue* Trace::mLogMessage;
 
+namespace {
+// How often the storage thread writes out data and the longest a partially
+// filled chunk can wait before being written. Together they bound how far
+// out of order records from different threads can end up in the file.
+const Duration STORAGE_PERIOD = Duration::seconds(1);
+const Duration MAX_CHUNK_AGE = Duration::seconds(2);
+}
+
 #define TRACE_MESSAGE_NAME                  "trace-message"
 
 void Trace::InitOptions() {
@@ -83,6 +91,10 @@ void Trace::storageThread(const String& filename) {
     FILE* of = NULL;
 
     while( !mFinishStorage.read() ) {
+        // Threads that trace rarely may never fill a chunk, so also write out
+        // chunks that have been filling for a while
+        data.handoff(MAX_CHUNK_AGE);
+
         // Open the file in the loop so we never open the file if we never dump
         // any trace data
         if (of == NULL && !data.empty())
@@ -93,11 +105,15 @@ void Trace::storageThread(const String& filename) {
             fflush(of);
         }
 
-        Timer::sleep(Duration::seconds(1));
+        Timer::sleep(STORAGE_PERIOD);
     }
 
+    // The chunks flushed at shutdown may be the first data we see
+    if (of == NULL && !data.empty())
+        of = fopen(filename.c_str(), "wb");
+
     if (of != NULL) {
-        data.store(of);
+        data.finish(of);
         fflush(of);
 #if SIRIKATA_PLATFORM == SIRIKATA_PLATFORM_WINDOWS
         FlushFileBuffers((HANDLE) _get_osfhandle(_fileno(of)));
@@ -108,22 +124,8 @@ void Trace::storageThread(const String& filename) {
     }
 }
 
-void Trace::writeRecord(uint16 type_hint, BatchedBuffer::IOVec* data_orig, uint32 iovcnt) {
-    assert(iovcnt < 30);
-
-    BatchedBuffer::IOVec data_vec[32];
-
-    uint32 total_size = 0;
-    for(uint32 i = 0; i < iovcnt; i++)
-        total_size += data_orig[i].len;
-
-
-    data_vec[0] = BatchedBuffer::IOVec(&total_size, sizeof(total_size));
-    data_vec[1] = BatchedBuffer::IOVec(&type_hint, sizeof(type_hint));
-    for(uint32 i = 0; i < iovcnt; i++)
-        data_vec[i+2] = data_orig[i];
-
-    data.write(data_vec, iovcnt+2);
+void Trace::writeRecord(uint16 type_hint, const Time& t, BatchedBuffer::IOVec* data_vec, uint32 iovcnt) {
+    data.write(type_hint, t, data_vec, iovcnt);
 }
 
 
@@ -152,7 +154,7 @@ CREATE_TRACE_DEF(Trace, timestampMessageCreation, mLogMessage, const Time&sent,
         BatchedBuffer::IOVec(&srcprt, sizeof(srcprt)),
         BatchedBuffer::IOVec(&dstprt, sizeof(dstprt)),
     };
-    writeRecord(MessageCreationTimestampTag, data_vec, num_data);
+    writeRecord(MessageCreationTimestampTag, sent, data_vec, num_data);
 }
 
 CREATE_TRACE_DEF(Trace, timestampMessage, mLogMessage, const Time&sent, uint64 uid, MessagePath path) {
@@ -164,7 +166,7 @@ CREATE_TRACE_DEF(Trace, timestampMessage, mLogMessage, const Time&sent, uint64 u
         BatchedBuffer::IOVec(&uid, sizeof(uid)),
         BatchedBuffer::IOVec(&path, sizeof(path)),
     };
-    writeRecord(MessageTimestampTag, data_vec, num_data);
+    writeRecord(MessageTimestampTag, sent, data_vec, num_data);
 }
 
 } // namespace Trace
@@ -0,0 +1,240 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/trace/TraceFormat.hpp>
+#include <sirikata/core/util/Timer.hpp>
+
+namespace Sirikata {
+namespace Trace {
+
+namespace Format {
+
+ChunkHeader::ChunkHeader()
+ : magic(ChunkMagic),
+   records(0),
+   offset(0),
+   size(0),
+   start_time(0),
+   end_time(0)
+{
+    memset(types, 0, sizeof(types));
+}
+
+void ChunkHeader::add(uint16 type_hint, const Time& t, uint32 record_bytes) {
+    if (records == 0 || t.raw() < start_time)
+        start_time = t.raw();
+    if (records == 0 || t.raw() > end_time)
+        end_time = t.raw();
+    uint32 bit = typeBit(type_hint);
+    types[bit / 64] |= ((uint64)1 << (bit % 64));
+    records++;
+    size += record_bytes;
+}
+
+bool ChunkHeader::hasType(uint16 type_hint) const {
+    uint32 bit = typeBit(type_hint);
+    return (types[bit / 64] & ((uint64)1 << (bit % 64))) != 0;
+}
+
+bool ChunkHeader::overlaps(const Time& start, const Time& end) const {
+    return !(end.raw() < start_time || start.raw() > end_time);
+}
+
+} // namespace Format
+
+
+namespace {
+// A record in one of the chunks being stored
+struct RecordRef {
+    uint64 time;
+    uint32 chunk;
+    uint32 index;
+
+    bool operator<(const RecordRef& rhs) const {
+        return time < rhs.time;
+    }
+};
+}
+
+ChunkedTraceBuffer::ChunkedTraceBuffer(uint32 chunk_size)
+ : mChunkSize(chunk_size),
+   mThreadBuffer(&ChunkedTraceBuffer::noCleanup),
+   mFileOffset(0)
+{
+}
+
+ChunkedTraceBuffer::~ChunkedTraceBuffer() {
+    for(uint32 i = 0; i < mThreadBuffers.size(); i++) {
+        delete takeChunk(mThreadBuffers[i]);
+        delete mThreadBuffers[i];
+    }
+    Chunk* chunk = NULL;
+    while(mFullChunks.pop(chunk))
+        delete chunk;
+}
+
+ChunkedTraceBuffer::Chunk* ChunkedTraceBuffer::takeChunk(ThreadBuffer* tb) {
+    volatile Chunk* chunk;
+    do {
+        chunk = tb->filling;
+    } while(!compare_and_swap(&tb->filling, chunk, (volatile Chunk*)NULL));
+    return (Chunk*)chunk;
+}
+
+bool ChunkedTraceBuffer::returnChunk(ThreadBuffer* tb, Chunk* chunk) {
+    return compare_and_swap(&tb->filling, (volatile Chunk*)NULL, (volatile Chunk*)chunk);
+}
+
+ChunkedTraceBuffer::Chunk* ChunkedTraceBuffer::newChunk() const {
+    Chunk* chunk = new Chunk();
+    chunk->created = Timer::now();
+    chunk->data.reserve(mChunkSize);
+    return chunk;
+}
+
+void ChunkedTraceBuffer::write(uint16 type_hint, const Time& t, const IOVec* iov, uint32 iovcnt) {
+    ThreadBuffer* tb = mThreadBuffer.get();
+    if (tb == NULL) {
+        tb = new ThreadBuffer();
+        mThreadBuffer.reset(tb);
+        boost::lock_guard<boost::mutex> lck(mThreadBuffersMutex);
+        mThreadBuffers.push_back(tb);
+    }
+    // If handoff() took our chunk, start a new one
+    Chunk* chunk = takeChunk(tb);
+    if (chunk == NULL)
+        chunk = newChunk();
+
+    uint32 payload_size = 0;
+    for(uint32 i = 0; i < iovcnt; i++)
+        payload_size += iov[i].len;
+    uint32 record_size = Format::RecordHeaderSize + payload_size;
+
+    std::vector<uint8>& data = chunk->data;
+    uint32 pos = data.size();
+    chunk->records.push_back(Chunk::RecordInfo(t.raw(), pos));
+    data.resize(pos + record_size);
+    memcpy(&data[pos], &payload_size, sizeof(payload_size));
+    pos += sizeof(payload_size);
+    memcpy(&data[pos], &type_hint, sizeof(type_hint));
+    pos += sizeof(type_hint);
+    for(uint32 i = 0; i < iovcnt; i++) {
+        if (iov[i].len == 0) continue;
+        memcpy(&data[pos], iov[i].base, iov[i].len);
+        pos += iov[i].len;
+    }
+
+    // Records are never split across chunks, so a chunk can overflow by up
+    // to one record. If handoff() put back the chunk it had taken while we
+    // were filling a new one, ours gets stored instead.
+    if (data.size() >= mChunkSize || !returnChunk(tb, chunk))
+        mFullChunks.push(chunk);
+}
+
+void ChunkedTraceBuffer::handoff(const Duration& max_age) {
+    Time now = Timer::now();
+    boost::lock_guard<boost::mutex> lck(mThreadBuffersMutex);
+
+    for(uint32 i = 0; i < mThreadBuffers.size(); i++) {
+        Chunk* chunk = takeChunk(mThreadBuffers[i]);
+        if (chunk == NULL) continue;
+        // If the thread started a new chunk while we held this one, they're
+        // both partial but this one has to go somewhere
+        if (now - chunk->created >= max_age || !returnChunk(mThreadBuffers[i], chunk))
+            mFullChunks.push(chunk);
+    }
+}
+
+void ChunkedTraceBuffer::flush() {
+    handoff(Duration::zero());
+}
+
+bool ChunkedTraceBuffer::empty() {
+    return mFullChunks.probablyEmpty();
+}
+
+void ChunkedTraceBuffer::appendRecord(Chunk* dest, const Chunk* src, const Chunk::RecordInfo& record) const {
+    uint32 payload_size;
+    uint16 type_hint;
+    memcpy(&payload_size, &src->data[record.second], sizeof(payload_size));
+    memcpy(&type_hint, &src->data[record.second + sizeof(payload_size)], sizeof(type_hint));
+    uint32 record_size = Format::RecordHeaderSize + payload_size;
+
+    dest->data.insert(dest->data.end(), src->data.begin() + record.second, src->data.begin() + record.second + record_size);
+    dest->header.add(type_hint, Time(record.first), record_size);
+}
+
+void ChunkedTraceBuffer::writeChunk(FILE* os, Chunk* chunk) {
+    chunk->header.offset = mFileOffset + sizeof(Format::ChunkHeader);
+    fwrite((void*)&chunk->header, sizeof(Format::ChunkHeader), 1, os);
+    fwrite((void*)&(chunk->data[0]), 1, chunk->data.size(), os);
+    mFileOffset += sizeof(Format::ChunkHeader) + chunk->data.size();
+    mIndex.push_back(chunk->header);
+}
+
+void ChunkedTraceBuffer::store(FILE* os) {
+    std::vector<Chunk*> chunks;
+    Chunk* popped = NULL;
+    while(mFullChunks.pop(popped))
+        chunks.push_back(popped);
+
+    if (mFileOffset == 0) {
+        Format::FileHeader fh;
+        fh.magic = Format::FileMagic;
+        fh.version = Format::Version;
+        fwrite((void*)&fh, sizeof(fh), 1, os);
+        mFileOffset += sizeof(fh);
+    }
+
+    if (chunks.empty()) return;
+
+    // Each chunk came from a single thread, so chunks from different threads
+    // overlap in time. Merge all their records into time order, keeping the
+    // order each thread wrote them in for records with the same time.
+    std::vector<RecordRef> records;
+    for(uint32 c = 0; c < chunks.size(); c++) {
+        for(uint32 r = 0; r < chunks[c]->records.size(); r++) {
+            RecordRef ref;
+            ref.time = chunks[c]->records[r].first;
+            ref.chunk = c;
+            ref.index = r;
+            records.push_back(ref);
+        }
+    }
+    std::stable_sort(records.begin(), records.end());
+
+    Chunk* out = newChunk();
+    for(uint32 i = 0; i < records.size(); i++) {
+        const Chunk* src = chunks[records[i].chunk];
+        appendRecord(out, src, src->records[records[i].index]);
+        if (out->data.size() >= mChunkSize) {
+            writeChunk(os, out);
+            out->header = Format::ChunkHeader();
+            out->data.clear();
+        }
+    }
+    if (!out->data.empty())
+        writeChunk(os, out);
+    delete out;
+
+    for(uint32 c = 0; c < chunks.size(); c++)
+        delete chunks[c];
+}
+
+void ChunkedTraceBuffer::finish(FILE* os) {
+    store(os);
+
+    Format::FileFooter footer;
+    footer.index_offset = mFileOffset;
+    footer.num_chunks = mIndex.size();
+    footer.magic = Format::FileMagic;
+
+    if (!mIndex.empty())
+        fwrite((void*)&mIndex[0], sizeof(Format::ChunkHeader), mIndex.size(), os);
+    fwrite((void*)&footer, sizeof(footer), 1, os);
+}
+
+} // namespace Trace
+} // namespace Sirikata
@@ -0,0 +1,194 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <sirikata/core/util/Standard.hh>
+#include <sirikata/core/trace/TraceReader.hpp>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace Sirikata {
+namespace Trace {
+
+TraceReader::TraceReader(const String& filename)
+ : mFile(NULL),
+   mRegion(NULL),
+   mData(NULL),
+   mSize(0),
+   mChunked(false),
+   mFilterTypes(false),
+   mFilterTime(false),
+   mStartTime(Time::null()),
+   mEndTime(Time::null()),
+   mNextChunk(0),
+   mPos(0),
+   mChunkEnd(0)
+{
+    try {
+        mFile = new boost::interprocess::file_mapping(filename.c_str(), boost::interprocess::read_only);
+        mRegion = new boost::interprocess::mapped_region(*mFile, boost::interprocess::read_only);
+        mData = (const uint8*)mRegion->get_address();
+        mSize = mRegion->get_size();
+    }
+    catch(boost::interprocess::interprocess_exception& e) {
+        // Missing and empty files both end up here, and are treated as empty
+        // traces.
+        SILOG(trace, detailed, "Couldn't map trace file " << filename << ": " << e.what());
+        delete mRegion;
+        mRegion = NULL;
+        delete mFile;
+        mFile = NULL;
+        mData = NULL;
+        mSize = 0;
+        return;
+    }
+
+    loadChunks();
+}
+
+TraceReader::~TraceReader() {
+    delete mRegion;
+    delete mFile;
+}
+
+void TraceReader::loadChunks() {
+    Format::FileHeader fh;
+    if (mSize < sizeof(fh)) return;
+    memcpy(&fh, mData, sizeof(fh));
+
+    if (fh.magic != Format::FileMagic) {
+        // Old trace without any chunks. Treat it as a single chunk that might
+        // contain anything.
+        Format::ChunkHeader all;
+        all.offset = 0;
+        all.size = mSize;
+        all.start_time = 0;
+        all.end_time = (uint64)-1;
+        memset(all.types, 0xFF, sizeof(all.types));
+        mChunks.push_back(all);
+        return;
+    }
+    mChunked = true;
+
+    if (fh.version != Format::Version) {
+        SILOG(trace, error, "Unknown trace file version " << fh.version);
+        return;
+    }
+
+    // Use the index if the file was finished cleanly
+    Format::FileFooter footer;
+    if (mSize >= sizeof(fh) + sizeof(footer)) {
+        memcpy(&footer, mData + mSize - sizeof(footer), sizeof(footer));
+        uint64 index_size = (uint64)footer.num_chunks * sizeof(Format::ChunkHeader);
+        if (footer.magic == Format::FileMagic &&
+            footer.index_offset >= sizeof(fh) &&
+            footer.index_offset <= mSize - sizeof(footer) &&
+            mSize - sizeof(footer) - footer.index_offset == index_size) {
+            if (loadIndex(footer))
+                return;
+            SILOG(trace, warning, "Invalid trace index, searching for chunks instead");
+            mChunks.clear();
+        }
+    }
+
+    // Otherwise, walk the chunk headers. The last chunk may have been cut off.
+    uint64 pos = sizeof(fh);
+    while(pos + sizeof(Format::ChunkHeader) <= mSize) {
+        Format::ChunkHeader chunk;
+        memcpy(&chunk, mData + pos, sizeof(chunk));
+        if (chunk.magic != Format::ChunkMagic || chunk.offset != pos + sizeof(chunk))
+            break;
+        if (chunk.offset + chunk.size > mSize)
+            chunk.size = mSize - chunk.offset;
+        mChunks.push_back(chunk);
+        pos = chunk.offset + chunk.size;
+    }
+}
+
+bool TraceReader::loadIndex(const Format::FileFooter& footer) {
+    // Check each entry the same way walking the file checks chunk headers, so
+    // a corrupt index can't point reads outside the file. Chunks come before
+    // the index, in order and without overlapping.
+    uint64 pos = sizeof(Format::FileHeader);
+    for(uint32 i = 0; i < footer.num_chunks; i++) {
+        Format::ChunkHeader chunk;
+        memcpy(&chunk, mData + footer.index_offset + (uint64)i * sizeof(chunk), sizeof(chunk));
+        if (chunk.magic != Format::ChunkMagic ||
+            chunk.offset < pos + sizeof(chunk) ||
+            chunk.offset > footer.index_offset ||
+            chunk.size > footer.index_offset - chunk.offset)
+            return false;
+        mChunks.push_back(chunk);
+        pos = chunk.offset + chunk.size;
+    }
+    return true;
+}
+
+void TraceReader::filterType(uint16 type_hint) {
+    mFilterTypes = true;
+    uint32 bit = Format::ChunkHeader::typeBit(type_hint);
+    mTypes.types[bit / 64] |= ((uint64)1 << (bit % 64));
+}
+
+void TraceReader::filterTime(const Time& start, const Time& end) {
+    mFilterTime = true;
+    mStartTime = start;
+    mEndTime = end;
+}
+
+bool TraceReader::chunkMatches(const Format::ChunkHeader& chunk) const {
+    if (mFilterTime && !chunk.overlaps(mStartTime, mEndTime))
+        return false;
+    if (mFilterTypes) {
+        bool any = false;
+        for(uint32 i = 0; i < Format::TypeMaskBits/64; i++)
+            any = any || ((chunk.types[i] & mTypes.types[i]) != 0);
+        if (!any) return false;
+    }
+    return true;
+}
+
+bool TraceReader::nextChunk() {
+    while(mNextChunk < mChunks.size()) {
+        const Format::ChunkHeader& chunk = mChunks[mNextChunk];
+        mNextChunk++;
+        if (!chunkMatches(chunk)) continue;
+        mPos = chunk.offset;
+        mChunkEnd = chunk.offset + chunk.size;
+        return true;
+    }
+    return false;
+}
+
+bool TraceReader::next(uint16* type_hint_out, const uint8** payload_out, uint32* size_out) {
+    while(true) {
+        if (mPos + Format::RecordHeaderSize > mChunkEnd) {
+            if (!nextChunk()) return false;
+            continue;
+        }
+
+        uint32 payload_size;
+        uint16 type_hint;
+        memcpy(&payload_size, mData + mPos, sizeof(payload_size));
+        memcpy(&type_hint, mData + mPos + sizeof(payload_size), sizeof(type_hint));
+        uint64 payload_pos = mPos + Format::RecordHeaderSize;
+        if (payload_pos + payload_size > mChunkEnd) {
+            // Truncated record, nothing more to read from this chunk
+            mPos = mChunkEnd;
+            continue;
+        }
+        mPos = payload_pos + payload_size;
+
+        if (mFilterTypes && !mTypes.hasType(type_hint))
+            continue;
+
+        *type_hint_out = type_hint;
+        *payload_out = mData + payload_pos;
+        *size_out = payload_size;
+        return true;
+    }
+}
+
+} // namespace Trace
+} // namespace Sirikata
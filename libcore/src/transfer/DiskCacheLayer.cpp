@@ -38,6 +38,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 
 #ifndef _WIN32
 #ifdef __APPLE__
@@ -83,6 +84,8 @@ namespace Transfer {
 
 static const char *PARTIAL_SUFFIX = ".part";
 static const char *RANGES_SUFFIX = ".ranges";
+static const char *INDEX_FILE = "index";
+static const char *INDEX_HEADER = "sirikata-disk-cache-index 1";
 
 namespace {
 
@@ -175,9 +178,62 @@ cache_usize_type sizeFromDirentry(const std::string &name, dirent *ent, bool &is
 
 #endif
 
+// Reads or writes exactly length bytes at offset, returning false on an error
+// or if the file is too short. Positioned I/O lets the workers share nothing
+// but the file.
+bool readFully(int fd, cache_usize_type offset, unsigned char *buf, cache_usize_type length) {
+#ifdef _WIN32
+	if (lseek(fd, offset, SEEK_SET) != (cache_ssize_type)offset) {
+		return false;
+	}
+#endif
+	while (length > 0) {
+#ifndef _WIN32
+		ssize_t nread = pread(fd, buf, (size_t)length, (off_t)offset);
+		if (nread < 0 && errno == EINTR) {
+			continue;
+		}
+#else
+		int nread = read(fd, buf, (unsigned int)length);
+#endif
+		if (nread <= 0) {
+			return false;
+		}
+		buf += nread;
+		offset += nread;
+		length -= nread;
+	}
+	return true;
+}
+
+bool writeFully(int fd, cache_usize_type offset, const unsigned char *buf, cache_usize_type length) {
+#ifdef _WIN32
+	if (lseek(fd, offset, SEEK_SET) != (cache_ssize_type)offset) {
+		return false;
+	}
+#endif
+	while (length > 0) {
+#ifndef _WIN32
+		ssize_t nwritten = pwrite(fd, buf, (size_t)length, (off_t)offset);
+		if (nwritten < 0 && errno == EINTR) {
+			continue;
+		}
+#else
+		int nwritten = write(fd, buf, (unsigned int)length);
+#endif
+		if (nwritten <= 0) {
+			return false;
+		}
+		buf += nwritten;
+		offset += nwritten;
+		length -= nwritten;
+	}
+	return true;
+}
+
 } // anon namespace.
 
-DiskCacheLayer::DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext)
+DiskCacheLayer::DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext, uint32 numWorkers)
  : CacheLayer(tryNext),
    mFiles(NULL, policy),
    mPrefix(),
@@ -189,7 +245,13 @@ DiskCacheLayer::DiskCacheLayer(CachePolicy *policy, const std::string &prefix, C
         mPrefix += '/';
 
     mFiles.setOwner(this);
-    mWorkerThread=new Thread("DiskCacheLayer", std::tr1::bind(&DiskCacheLayer::workerThread, this));
+    if (numWorkers == 0)
+        numWorkers = 1;
+    for(uint32 i = 0; i < numWorkers; i++) {
+        Worker *worker = new Worker;
+        worker->mThread = new Thread("DiskCacheLayer", std::tr1::bind(&DiskCacheLayer::workerThread, this, worker));
+        mWorkers.push_back(worker);
+    }
     try {
         unserialize();
     } catch (...) {
@@ -198,11 +260,30 @@ DiskCacheLayer::DiskCacheLayer(CachePolicy *policy, const std::string &prefix, C
     }
 }
 
-void DiskCacheLayer::workerThread() {
+DiskCacheLayer::~DiskCacheLayer() {
+	// Each worker finishes what's already queued, including writes, before exiting.
+	for (std::vector<Worker*>::iterator it = mWorkers.begin(); it != mWorkers.end(); ++it) {
+		std::tr1::shared_ptr<DiskRequest> req
+			(new DiskRequest(DiskRequest::OPEXIT, Fingerprint(), Range(true)));
+		(*it)->mRequestQueue.push(req);
+	}
+	for (std::vector<Worker*>::iterator it = mWorkers.begin(); it != mWorkers.end(); ++it) {
+		(*it)->mThread->join();
+		delete (*it)->mThread;
+		delete *it;
+	}
+	mWorkers.clear();
+
+	saveIndex();
+
+	mCleaningUp = true; // don't allow destroyCacheEntry to delete files.
+}
+
+void DiskCacheLayer::workerThread(Worker *worker) {
 	while (true) {
 		std::tr1::shared_ptr<DiskRequest> req;
 
-		mRequestQueue.blockingPop(req);
+		worker->mRequestQueue.blockingPop(req);
 		if (req->op == DiskRequest::OPEXIT) {
 			break;
 		} else if (req->op == DiskRequest::OPWRITE) {
@@ -235,8 +316,12 @@ void DiskCacheLayer::workerThread() {
 					"for writing; reason: " << errno);
 				continue;
 			}
-			lseek(fd, req->data->startbyte(), SEEK_SET);
-			write(fd, req->data->data(), (size_t)req->data->length());
+			if (!writeFully(fd, req->data->startbyte(), req->data->data(), req->data->length())) {
+				SILOG(transfer,error, "Failed to write " << fileId <<
+					"; reason: " << errno);
+				close(fd);
+				continue;
+			}
 			cache_usize_type diskUsage;
 			{
 				struct stat64 st;
@@ -299,7 +384,7 @@ void DiskCacheLayer::workerThread() {
 			int fd = open(filePath.c_str(), O_RDONLY|DEFAULT_OPEN_OPTIONS);
 			if (fd < 0) {
 				SILOG(transfer,error, "Failed to open " << fileId <<
-					"for writing; reason: " << errno);
+					" for reading; reason: " << errno);
 				CacheLayer::getData(req->fileId, req->toRead, req->finished);
 				continue;
 			}
@@ -309,18 +394,16 @@ void DiskCacheLayer::workerThread() {
 					req->toRead.setLength(st.st_size - req->toRead.startbyte(), true);
 				}
 			}
-			if (req->toRead.startbyte() != 0) {
-				// FIXME: may not work with 64-bit files?
-				if (lseek(fd, req->toRead.startbyte(), SEEK_SET) != (cache_ssize_type)req->toRead.startbyte()) {
-					SILOG(transfer,error, "Failed to seek in " << fileId <<
-						"to byte "<<req->toRead.startbyte()<<"; reason: " << errno);
-					CacheLayer::getData(req->fileId, req->toRead, req->finished);
-					continue;
-				}
-			}
 			MutableDenseDataPtr datum(new DenseData(req->toRead));
-			read(fd, datum->writableData(), (size_t)req->toRead.length());
+			bool success = readFully(fd, req->toRead.startbyte(), datum->writableData(), req->toRead.length());
 			close(fd);
+			if (!success) {
+				SILOG(transfer,error, "Failed to read " << fileId <<
+					" bytes " << req->toRead.startbyte() << " to " << req->toRead.endbyte() <<
+					"; reason: " << errno);
+				CacheLayer::getData(req->fileId, req->toRead, req->finished);
+				continue;
+			}
 
 			CacheLayer::populateParentCaches(req->fileId, datum);
 			SparseData data;
@@ -336,10 +419,6 @@ void DiskCacheLayer::workerThread() {
 			unlink(partialPath.c_str());
 		}
 	}
-	{
-		boost::unique_lock<boost::mutex> wake_cv(destroyLock);
-		destroyCV.notify_one();
-	}
 }
 
 void DiskCacheLayer::unserialize() {
@@ -367,6 +446,10 @@ void DiskCacheLayer::unserialize() {
 		++slash;
 	}
 
+	if (loadIndex()) {
+		return;
+	}
+
 	DIR *mydir = opendir (mPrefix.c_str());
 	if(mydir) {
 		dirent *myentry;
@@ -456,5 +539,99 @@ void DiskCacheLayer::unserialize() {
 	}
 }
 
+bool DiskCacheLayer::loadIndex() {
+	std::string indexPath = mPrefix + INDEX_FILE;
+	std::ifstream fp (indexPath.c_str(), std::ios_base::in | std::ios_base::binary);
+	if (!fp) {
+		return false;
+	}
+	std::string header;
+	std::getline(fp, header);
+	if (header != INDEX_HEADER) {
+		fp.close();
+		unlink(indexPath.c_str());
+		return false;
+	}
+
+	{
+		CacheMap::write_iterator writer (mFiles);
+		std::string line;
+		while (std::getline(fp, line)) {
+			std::istringstream entry(line);
+			std::string fingerprintName;
+			cache_usize_type totalLength = 0;
+			entry >> fingerprintName >> totalLength;
+			if (!entry) {
+				continue;
+			}
+
+			Fingerprint fprint;
+			try {
+				fprint = SHA256::convertFromHex(fingerprintName);
+			} catch (std::invalid_argument) {
+				continue;
+			}
+			if (writer.find(fprint)) {
+				continue;
+			}
+
+			CacheData *cdata = new CacheData();
+			unserializeRanges(cdata->mRanges, entry);
+
+			if (!mFiles.alloc(totalLength, writer)) {
+				// Same as when scanning: the cache must have shrunk.
+				delete cdata;
+				std::string filePath = mPrefix + fingerprintName;
+				unlink(filePath.c_str());
+				unlink((filePath + PARTIAL_SUFFIX).c_str());
+				unlink((filePath + RANGES_SUFFIX).c_str());
+				continue;
+			}
+			if (writer.insert(fprint, totalLength)) {
+				*writer = cdata;
+				writer.use();
+			} else {
+				delete cdata;
+			}
+		}
+	}
+	fp.close();
+
+	// The cache changes from here on, so the index is only good for this run.
+	unlink(indexPath.c_str());
+	SILOG(transfer,detailed,"Loaded disk cache index from " << indexPath);
+	return true;
+}
+
+void DiskCacheLayer::saveIndex() {
+	std::string indexPath = mPrefix + INDEX_FILE;
+	std::string indexTempPath = indexPath + ".temp";
+	{
+		std::ofstream fp (indexTempPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		if (!fp) {
+			SILOG(transfer,error, "Failed to open " << indexTempPath << " for writing the cache index");
+			return;
+		}
+		fp << INDEX_HEADER << "\n";
+
+		CacheMap::read_iterator iter(mFiles);
+		while (iter.iterate()) {
+			const CacheData *cdata = static_cast<const CacheData*>(*iter);
+			std::string rangesStr;
+			serializeRanges(cdata->mRanges, rangesStr);
+			fp << iter.getId().convertToHexString() << " " << iter.getSize() << " " << rangesStr << "\n";
+		}
+
+		fp.close();
+		if (fp.fail()) {
+			SILOG(transfer,error, "Failed to write the cache index to " << indexTempPath);
+			unlink(indexTempPath.c_str());
+			return;
+		}
+	}
+	// Like ranges files, write then rename so a partial index is never read.
+	rename(indexTempPath.c_str(), indexPath.c_str());
+}
+
 }
 }
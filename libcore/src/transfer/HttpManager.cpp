@@ -37,6 +37,7 @@
 #include <liboauthcpp/liboauthcpp.h>
 
 #include <boost/lexical_cast.hpp>
+#include <set>
 #include <sirikata/core/util/UUID.hpp>
 
 AUTO_SINGLETON_INSTANCE(Sirikata::Transfer::HttpManager);
@@ -52,7 +53,12 @@ void HttpManager::destroy() {
 }
 
 HttpManager::HttpManager()
-    : mNumTotalConnections(0) {
+    : mNextHost(Network::Address::null()),
+      mNumTotalConnections(0),
+      mMaxConnectionsPerHost(MAX_CONNECTIONS_PER_ENDPOINT),
+      mMaxPipelineDepth(MAX_PIPELINE_DEPTH),
+      mIdleTimeout(Duration::seconds((float64)IDLE_TIMEOUT_SECONDS))
+{
 
     EMPTY_PARSER_SETTINGS.on_message_begin = 0;
     EMPTY_PARSER_SETTINGS.on_header_field = 0;
@@ -65,6 +71,15 @@ HttpManager::HttpManager()
     EMPTY_PARSER_SETTINGS.on_headers_complete = 0;
     EMPTY_PARSER_SETTINGS.on_message_complete = 0;
 
+    //All connections parse responses with the same callbacks
+    mResponseSettings = EMPTY_PARSER_SETTINGS;
+    mResponseSettings.on_message_begin = &HttpManager::on_message_begin;
+    mResponseSettings.on_header_field = &HttpManager::on_header_field;
+    mResponseSettings.on_header_value = &HttpManager::on_header_value;
+    mResponseSettings.on_body = &HttpManager::on_body;
+    mResponseSettings.on_headers_complete = &HttpManager::on_headers_complete;
+    mResponseSettings.on_message_complete = &HttpManager::on_message_complete;
+
     //Making a single thread IOService to handle requests
     mServicePool = new IOServicePool("HttpManager", 2);
 
@@ -84,13 +99,25 @@ HttpManager::~HttpManager() {
     mResolver->cancel();
     delete mResolver;
 
+    //Open connections always have a read outstanding and idle ones have a
+    //timeout pending, so close them and stop the IOService rather than
+    //waiting for it to run out of work
+    {
+        boost::unique_lock<boost::mutex> lock(mPoolLock);
+        for (HostPoolMap::iterator pool_it = mHostPools.begin(); pool_it != mHostPools.end(); pool_it++) {
+            ConnectionList conns = pool_it->second.connections;
+            for (ConnectionList::iterator it = conns.begin(); it != conns.end(); it++)
+                close_connection(*it);
+        }
+    }
+    mServicePool->service()->stop();
+
     //Stop the IOService and make sure its thread exist
     mServicePool->join();
 
     //Clean up any data we still have to make sure anything
     //referencing the service pool is dead
-    mRequestQueue.clear();
-    mRecycleBin.clear();
+    mHostPools.clear();
 
     //Delete dummy worker and service pool
     mServicePool->stopWork();
@@ -105,6 +132,21 @@ void HttpManager::postCallback(const Duration& waitFor, IOCallback cb, const cha
     mServicePool->service()->post(waitFor, cb, tag);
 }
 
+void HttpManager::setMaxConnectionsPerHost(uint32 max_conns) {
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+    mMaxConnectionsPerHost = std::max(max_conns, (uint32)1);
+}
+
+void HttpManager::setMaxPipelineDepth(uint32 depth) {
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+    mMaxPipelineDepth = std::max(depth, (uint32)1);
+}
+
+void HttpManager::setIdleTimeout(const Duration& timeout) {
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+    mIdleTimeout = timeout;
+}
+
 String HttpManager::methodAsString(HTTP_METHOD m) {
     switch(m) {
       case HEAD: return "HEAD";
@@ -309,254 +351,402 @@ void HttpManager::postMultipartForm(
 
 
 void HttpManager::processQueue() {
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+
     SILOG(transfer, insane, "processQueue called, mNumTotalConnections = "
-            << mNumTotalConnections << " and recycle bin size = " << mRecycleBin.size()
-            << " and size of hosts = " << mNumConnsPerAddr.size()
-            << " and request queue size = " << mRequestQueue.size());
-
-    boost::unique_lock<boost::mutex> lockQueue(mRequestQueueLock);
-    boost::unique_lock<boost::mutex> lockNumConns(mNumConnsLock, boost::defer_lock);
-
-    for (RequestQueueType::iterator req = mRequestQueue.begin(); req != mRequestQueue.end(); ) {
-
-        std::tr1::shared_ptr<TCPSocket> sock;
-
-        //First check the recycle bin to see if there's a connection already open we can use
-        boost::unique_lock<boost::mutex> lockRB(mRecycleBinLock); {
-            RecycleBinType::iterator findRec = mRecycleBin.find((*req)->addr);
-            if (findRec != mRecycleBin.end()) {
-                sock = findRec->second.front();
-                findRec->second.pop();
-                if (findRec->second.size() == 0) {
-                    mRecycleBin.erase(findRec);
-                }
-            }
+            << mNumTotalConnections << " and number of hosts = " << mHostPools.size());
+
+    //Requests assigned to the same connection go out in a single write
+    std::set<HttpConnectionPtr> assigned;
+
+    //Hand out one request per host per pass, so no host can take all the
+    //connections while others are waiting
+    bool progress = true;
+    while (progress && !mHostPools.empty()) {
+        progress = false;
+        HostPoolMap::iterator it = mHostPools.lower_bound(mNextHost);
+        for (uint32 i = 0, nhosts = mHostPools.size(); i < nhosts; i++, it++) {
+            if (it == mHostPools.end())
+                it = mHostPools.begin();
+
+            HostPool& pool = it->second;
+            if (pool.queue.empty())
+                continue;
+
+            HttpConnectionPtr conn = find_connection(pool, pool.queue.front());
+            if (!conn)
+                continue;
+
+            conn->mInFlight.push_back(pool.queue.front());
+            pool.queue.pop_front();
+            assigned.insert(conn);
+            progress = true;
         }
-        lockRB.unlock();
+    }
 
-        if (sock) {
-            //SILOG(transfer, debug, "Reusing a connection for " << (*req)->addr.toString());
-            write_request(sock, *req);
-            req = mRequestQueue.erase(req);
-        } else {
+    for (std::set<HttpConnectionPtr>::iterator it = assigned.begin(); it != assigned.end(); it++)
+        write_requests(*it);
 
-            lockNumConns.lock(); {
-                //If nothing in the recycle bin, let's see if we can open a new connection
-                if (mNumTotalConnections < MAX_TOTAL_CONNECTIONS) {
-                    NumConnsType::iterator findNumC = mNumConnsPerAddr.find((*req)->addr);
-                    if (mNumTotalConnections < MAX_TOTAL_CONNECTIONS &&
-                            (findNumC == mNumConnsPerAddr.end() || findNumC->second < MAX_CONNECTIONS_PER_ENDPOINT)) {
-
-                        //We are safe to open a new connection, but increase counts first
-                        mNumTotalConnections++;
-                        if (findNumC == mNumConnsPerAddr.end()) {
-                           mNumConnsPerAddr[(*req)->addr] = 1;
-                        } else {
-                            mNumConnsPerAddr[(*req)->addr] = findNumC->second + 1;
-                        }
-
-                        //SILOG(transfer, debug, "Creating a new connection for " << (*req)->addr.toString());
-                        TCPResolver::query query((*req)->addr.getHostName(), (*req)->addr.getService(), Network::TCPResolver::query::all_matching);
-                        mResolver->async_resolve(query, boost::bind(&HttpManager::handle_resolve, this, *req,
-                                                boost::asio::placeholders::error, boost::asio::placeholders::iterator));
+    //Drop hosts we're done with and start from the next host next time
+    for (HostPoolMap::iterator it = mHostPools.begin(); it != mHostPools.end(); ) {
+        if (it->second.queue.empty() && it->second.connections.empty())
+            mHostPools.erase(it++);
+        else
+            it++;
+    }
+    HostPoolMap::iterator next = mHostPools.upper_bound(mNextHost);
+    if (next == mHostPools.end())
+        next = mHostPools.begin();
+    if (next != mHostPools.end())
+        mNextHost = next->first;
+}
+
+HttpManager::HttpConnectionPtr HttpManager::find_connection(HostPool& pool, HttpRequestPtr req) {
+    //Prefer an idle connection, then a new one. Pipelined requests have to
+    //wait for everything ahead of them, so only pipeline once we can't open
+    //any more connections.
+    HttpConnectionPtr pipelined;
+    for (ConnectionList::iterator it = pool.connections.begin(); it != pool.connections.end(); it++) {
+        HttpConnectionPtr conn = *it;
+        if (conn->mInFlight.empty())
+            return conn;
+
+        //Only GETs are pipelined, and never behind other methods
+        if (req->method != GET || conn->mInFlight.back()->method != GET ||
+            !conn->mCanPipeline || conn->mInFlight.size() >= mMaxPipelineDepth)
+            continue;
+        if (!pipelined || conn->mInFlight.size() < pipelined->mInFlight.size())
+            pipelined = conn;
+    }
 
-                        req = mRequestQueue.erase(req);
-                    } else {
-                        //No available recycled connections, can't open a new one, so do nothing
-                        req++;
-                    }
-                } else {
-                    //No available recycled connections, can't open a new one, so do nothing
-                    req++;
-                }
-            } lockNumConns.unlock();
-        }
+    if (pool.connections.size() < mMaxConnectionsPerHost) {
+        //If we're out of connections, make room by closing another host's
+        //idle connection, but only if we can't make progress otherwise
+        if (mNumTotalConnections < MAX_TOTAL_CONNECTIONS ||
+            (!pipelined && close_idle_connection(req->addr)))
+            return open_connection(req->addr, pool);
     }
 
-    lockQueue.unlock();
+    return pipelined;
 }
 
-void HttpManager::decrement_connection(const Sirikata::Network::Address& addr) {
-    //SILOG(transfer, debug, "Reducing number of connections by 1 for " << addr.toString());
-    boost::unique_lock<boost::mutex> lockNumConns(mNumConnsLock); {
-        mNumTotalConnections--;
-        NumConnsType::iterator findNumC = mNumConnsPerAddr.find(addr);
-        if (findNumC != mNumConnsPerAddr.end()) {
-            if (findNumC->second == 1) {
-                mNumConnsPerAddr.erase(findNumC);
-            } else {
-                mNumConnsPerAddr[addr] = findNumC->second - 1;
-            }
+HttpManager::HttpConnectionPtr HttpManager::open_connection(const Sirikata::Network::Address& addr, HostPool& pool) {
+    //SILOG(transfer, debug, "Creating a new connection for " << addr.toString());
+    HttpConnectionPtr conn(new HttpConnection(addr));
+
+    //The connection's parser is used for every response on it
+    http_parser_init(&(conn->mHttpParser), HTTP_RESPONSE);
+    /*
+     * http-parser library uses this void * parameter to callbacks for user-defined data
+     * Store a pointer to the HttpConnection object so we can access it during static callbacks
+     */
+    conn->mHttpParser.data = static_cast<void *>(conn.get());
+
+    pool.connections.push_back(conn);
+    mNumTotalConnections++;
+
+    TCPResolver::query query(addr.getHostName(), addr.getService(), Network::TCPResolver::query::all_matching);
+    mResolver->async_resolve(query, boost::bind(&HttpManager::handle_resolve, this, conn,
+                                                boost::asio::placeholders::error, boost::asio::placeholders::iterator));
+    return conn;
+}
+
+bool HttpManager::close_idle_connection(const Sirikata::Network::Address& except) {
+    HttpConnectionPtr oldest;
+    for (HostPoolMap::iterator pool_it = mHostPools.begin(); pool_it != mHostPools.end(); pool_it++) {
+        if (pool_it->first == except)
+            continue;
+        ConnectionList& conns = pool_it->second.connections;
+        for (ConnectionList::iterator it = conns.begin(); it != conns.end(); it++) {
+            if ((*it)->mInFlight.empty() && (!oldest || (*it)->mIdleSince < oldest->mIdleSince))
+                oldest = *it;
         }
     }
-    lockNumConns.unlock();
+
+    if (!oldest)
+        return false;
+    close_connection(oldest);
+    return true;
 }
 
-void HttpManager::add_req(std::tr1::shared_ptr<HttpRequest> req) {
-    boost::unique_lock<boost::mutex> lockQueue(mRequestQueueLock);
-    mRequestQueue.push_back(req);
-    lockQueue.unlock();
+void HttpManager::close_connection(HttpConnectionPtr conn) {
+    if (conn->mClosed)
+        return;
+
+    conn->mClosed = true;
+    if (conn->mSocket) {
+        boost::system::error_code ec;
+        conn->mSocket->close(ec);
+    }
+
+    //The host's pool can't have been removed since the connection is in it
+    mHostPools[conn->addr].connections.remove(conn);
+    mNumTotalConnections--;
 }
 
-void HttpManager::handle_resolve(std::tr1::shared_ptr<HttpRequest> req, const boost::system::error_code& err,
-        TCPResolver::iterator endpoint_iterator) {
-    if (!err) {
-        TCPEndPoint endpoint = *endpoint_iterator;
-        std::tr1::shared_ptr<TCPSocket> socket(new TCPSocket(*(mServicePool->service())));
-        socket->async_connect(endpoint, boost::bind(
-                &HttpManager::handle_connect, this, socket, req,
-                boost::asio::placeholders::error, ++endpoint_iterator));
-    } else {
-        SILOG(transfer, error, "Failed to resolve hostname. Error = " << err.message());
-        decrement_connection(req->addr);
+void HttpManager::fail_connection(HttpConnectionPtr conn, const boost::system::error_code& err, FailedList* failed) {
+    RequestQueueType requeue;
+    requeue.swap(conn->mInFlight);
+    conn->mNumSent = 0;
+    close_connection(conn);
 
+    if (failed != NULL && !requeue.empty()) {
+        HttpRequestPtr req = requeue.front();
         req->mNumTries++;
-        if (req->mNumTries > 10) {
-            //This means this connection has gotten an error over 10 times. Let's stop trying
+        if (req->mNumTries > MAX_TRIES) {
+            //This means this request has gotten an error over 10 times. Let's stop trying
             //TODO: this should probably be configurable
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost::asio::error::host_not_found);
-        } else {
-            add_req(req);
+            failed->push_back(FailedRequest(req, BOOST_ERROR, err));
+            requeue.pop_front();
         }
-
-        add_req(req);
-        processQueue();
     }
+
+    //Retry in the same order, ahead of anything that was issued later
+    RequestQueueType& queue = mHostPools[conn->addr].queue;
+    queue.insert(queue.begin(), requeue.begin(), requeue.end());
 }
 
-void HttpManager::write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req) {
-    std::tr1::shared_ptr<boost::asio::streambuf> request_ptr(new boost::asio::streambuf());
-    std::ostream request_stream(request_ptr.get());
-    request_stream << req->req;
-    boost::asio::async_write(*socket, *request_ptr, boost::bind(
-            &HttpManager::handle_write_request, this, socket, req,
-            boost::asio::placeholders::error, request_ptr));
+void HttpManager::add_req(HttpRequestPtr req) {
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+    mHostPools[req->addr].queue.push_back(req);
 }
 
-void HttpManager::handle_connect(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-        const boost::system::error_code& err, TCPResolver::iterator endpoint_iterator) {
+void HttpManager::handle_resolve(HttpConnectionPtr conn, const boost::system::error_code& err,
+        TCPResolver::iterator endpoint_iterator) {
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+    if (conn->mClosed)
+        return;
+
     if (!err) {
-        write_request(socket, req);
-    } else if (endpoint_iterator != TCPResolver::iterator()) {
-        socket->close();
         TCPEndPoint endpoint = *endpoint_iterator;
-        socket->async_connect(endpoint, boost::bind(
-                &HttpManager::handle_connect, this, socket, req,
+        conn->mSocket.reset(new TCPSocket(*(mServicePool->service())));
+        conn->mSocket->async_connect(endpoint, boost::bind(
+                &HttpManager::handle_connect, this, conn,
                 boost::asio::placeholders::error, ++endpoint_iterator));
-    } else {
-        SILOG(transfer, error, "Failed to connect. Error = " << err.message());
-        decrement_connection(req->addr);
+        return;
+    }
 
-        req->mNumTries++;
-        if (req->mNumTries > 10) {
-            //This means this connection has gotten an error over 10 times. Let's stop trying
-            //TODO: this should probably be configurable
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost::asio::error::host_unreachable);
-        } else {
-            add_req(req);
-        }
+    SILOG(transfer, error, "Failed to resolve hostname. Error = " << err.message());
+    FailedList failed;
+    fail_connection(conn, boost::asio::error::host_not_found, &failed);
+    lock.unlock();
 
-        processQueue();
-    }
+    finish_requests(CompletedList(), failed);
+    processQueue();
 }
 
-void HttpManager::handle_write_request(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-        const boost::system::error_code& err, std::tr1::shared_ptr<boost::asio::streambuf> request_stream) {
+void HttpManager::handle_connect(HttpConnectionPtr conn, const boost::system::error_code& err,
+        TCPResolver::iterator endpoint_iterator) {
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+    if (conn->mClosed)
+        return;
 
-    if (err) {
-        socket->close();
-        SILOG(transfer, error, "Failed to write. Error = " << err.message());
-        decrement_connection(req->addr);
-        add_req(req);
-        processQueue();
+    if (!err) {
+        conn->mConnected = true;
+        //Always keep a read outstanding so we notice the server closing the
+        //connection even while it's idle
+        read_response(conn);
+        write_requests(conn);
         return;
     }
 
-    //Create a new response object
-    std::tr1::shared_ptr<HttpResponse> respPtr(new HttpResponse());
-    respPtr->mBytesSent = req->req.size();
+    if (endpoint_iterator != TCPResolver::iterator()) {
+        boost::system::error_code ec;
+        conn->mSocket->close(ec);
+        TCPEndPoint endpoint = *endpoint_iterator;
+        conn->mSocket->async_connect(endpoint, boost::bind(
+                &HttpManager::handle_connect, this, conn,
+                boost::asio::placeholders::error, ++endpoint_iterator));
+        return;
+    }
 
-    //Initiate an empty DenseData
-    std::tr1::shared_ptr<DenseData> emptyData(new DenseData(Range(true)));
-    respPtr->mData = emptyData;
+    SILOG(transfer, error, "Failed to connect. Error = " << err.message());
+    FailedList failed;
+    fail_connection(conn, boost::asio::error::host_unreachable, &failed);
+    lock.unlock();
 
-    //Initialize http parser settings callbacks
-    respPtr->mHttpSettings = EMPTY_PARSER_SETTINGS;
-    respPtr->mHttpSettings.on_header_field = &HttpManager::on_header_field;
-    respPtr->mHttpSettings.on_header_value = &HttpManager::on_header_value;
-    respPtr->mHttpSettings.on_body = &HttpManager::on_body;
-    respPtr->mHttpSettings.on_headers_complete = &HttpManager::on_headers_complete;
-    respPtr->mHttpSettings.on_message_complete = &HttpManager::on_message_complete;
+    finish_requests(CompletedList(), failed);
+    processQueue();
+}
 
-    //Initialize the parser for parsing a response
-    http_parser_init(&(respPtr->mHttpParser), HTTP_RESPONSE);
+void HttpManager::write_requests(HttpConnectionPtr conn) {
+    if (conn->mClosed || !conn->mConnected || conn->mWriting || conn->mNumSent == conn->mInFlight.size())
+        return;
 
-    /*
-     * http-parser library uses this void * parameter to callbacks for user-defined data
-     * Store a pointer to the HttpResponse object so we can access it during static callbacks
-     */
-    respPtr->mHttpParser.data = static_cast<void *>(respPtr.get());
+    //Everything not yet sent goes out in one write. Requests count as sent as
+    //soon as the write starts since their responses can arrive before
+    //handle_write_request runs.
+    std::tr1::shared_ptr<boost::asio::streambuf> request_ptr(new boost::asio::streambuf());
+    std::ostream request_stream(request_ptr.get());
+    for (; conn->mNumSent < conn->mInFlight.size(); conn->mNumSent++)
+        request_stream << conn->mInFlight[conn->mNumSent]->req;
+
+    conn->mWriting = true;
+    boost::asio::async_write(*(conn->mSocket), *request_ptr, boost::bind(
+            &HttpManager::handle_write_request, this, conn,
+            boost::asio::placeholders::error, request_ptr));
+}
 
-    //Create a buffer for receiving from socket
-    std::tr1::shared_ptr<std::vector<unsigned char> > vecbuf(new std::vector<unsigned char>(SOCKET_BUFFER_SIZE));
+void HttpManager::handle_write_request(HttpConnectionPtr conn, const boost::system::error_code& err,
+        std::tr1::shared_ptr<boost::asio::streambuf> request_stream) {
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+    if (conn->mClosed)
+        return;
+
+    conn->mWriting = false;
+    if (!err) {
+        //Send anything that was pipelined while we were writing
+        write_requests(conn);
+        return;
+    }
+
+    SILOG(transfer, error, "Failed to write. Error = " << err.message());
+    FailedList failed;
+    fail_connection(conn, err, &failed);
+    lock.unlock();
+
+    finish_requests(CompletedList(), failed);
+    processQueue();
+}
 
-    //Read some data
-    socket->async_read_some(boost::asio::buffer(*vecbuf), boost::bind(
-            &HttpManager::handle_read, this, socket, req, vecbuf, respPtr,
+void HttpManager::read_response(HttpConnectionPtr conn) {
+    conn->mSocket->async_read_some(boost::asio::buffer(conn->mReadBuffer), boost::bind(
+            &HttpManager::handle_read, this, conn,
             boost::asio::placeholders::error,
             boost::asio::placeholders::bytes_transferred));
 }
 
-void HttpManager::handle_read(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::shared_ptr<HttpRequest> req,
-        std::tr1::shared_ptr<std::vector<unsigned char> > vecbuf, std::tr1::shared_ptr<HttpResponse> respPtr,
-        const boost::system::error_code& err, std::size_t bytes_transferred) {
+void HttpManager::handle_read(HttpConnectionPtr conn, const boost::system::error_code& err, std::size_t bytes_transferred) {
 
     SILOG(transfer, insane, "handle_read triggered with bytes_transferred = " << bytes_transferred << " EOF? "
             << (err == boost::asio::error::eof ? "Y" : "N"));
 
-    if ((err || bytes_transferred == 0) && err != boost::asio::error::eof) {
-        SILOG(transfer, error, "Failed to write. Error = " << err.message());
-        socket->close();
-        decrement_connection(req->addr);
-        add_req(req);
-        processQueue();
-        return;
-    }
+    CompletedList completed;
+    FailedList failed;
 
-    respPtr->mBytesReceived += bytes_transferred;
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+    if (conn->mClosed)
+        return;
 
-    //Parse the data we just got back from the socket
-    size_t nparsed = http_parser_execute(&(respPtr->mHttpParser), &(respPtr->mHttpSettings),
-            (const char *)(&((*vecbuf)[0])), bytes_transferred);
+    bool eof = (err == boost::asio::error::eof);
+    if (err && !eof) {
+        SILOG(transfer, error, "Failed to read. Error = " << err.message());
+        fail_connection(conn, err, &failed);
+        lock.unlock();
 
-    boost::system::error_code ec;
-    if (nparsed != bytes_transferred) {
-        SILOG(transfer, warning, "Failed to parse http response. nparsed=" << nparsed << " while bytes_transferred=" << bytes_transferred);
-        req->cb(std::tr1::shared_ptr<HttpResponse>(), RESPONSE_PARSING_FAILED, ec);
-        socket->close();
-        decrement_connection(req->addr);
+        finish_requests(completed, failed);
         processQueue();
         return;
     }
 
-    if (err == boost::asio::error::eof && bytes_transferred != 0) {
-        //Pass 0 as fourth parameter to parser to tell it that we got EOF
-        size_t nparsed = http_parser_execute(&(respPtr->mHttpParser), &(respPtr->mHttpSettings),
-                (const char *)(&((*vecbuf)[0])), 0);
-        if (nparsed != 0) {
+    //Requests are only removed from mInFlight here or when the connection is
+    //closed, so the ones that have been sent stay put while we parse without
+    //holding the lock
+    conn->mParsing.assign(conn->mInFlight.begin(), conn->mInFlight.begin() + conn->mNumSent);
+    lock.unlock();
+
+    //Parse the data we just got back from the socket. This may finish any
+    //number of responses.
+    conn->mCompleted.clear();
+    conn->mBytesUnaccounted += bytes_transferred;
+    const char* data = (const char*)(&(conn->mReadBuffer[0]));
+    bool parse_failed = false;
+    if (bytes_transferred > 0) {
+        size_t nparsed = http_parser_execute(&(conn->mHttpParser), &mResponseSettings, data, bytes_transferred);
+        if (nparsed != bytes_transferred || conn->mParseError) {
+            SILOG(transfer, warning, "Failed to parse http response. nparsed=" << nparsed << " while bytes_transferred=" << bytes_transferred);
+            parse_failed = true;
+        }
+    }
+    if (eof && !parse_failed) {
+        //Pass 0 as the length to tell the parser that we got EOF, which
+        //finishes responses that are terminated by closing the connection
+        size_t nparsed = http_parser_execute(&(conn->mHttpParser), &mResponseSettings, data, 0);
+        if (nparsed != 0 || conn->mParseError) {
             SILOG(transfer, warning, "Failed to parse http response when giving EOF. nparsed=" << nparsed);
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), RESPONSE_PARSING_FAILED, ec);
-            socket->close();
-            decrement_connection(req->addr);
-            processQueue();
-            return;
+            parse_failed = true;
         }
+    }
+
+    lock.lock();
+    if (conn->mClosed)
+        return;
 
+    for (uint32 i = 0; i < conn->mCompleted.size(); i++) {
+        completed.push_back(std::make_pair(conn->mInFlight.front(), conn->mCompleted[i]));
+        conn->mInFlight.pop_front();
+        conn->mNumSent--;
     }
+    if (!conn->mCompleted.empty())
+        conn->mCanPipeline = conn->mPipelinable;
+    conn->mCompleted.clear();
+    conn->mParsing.clear();
+
+    bool closed = true;
+    if (conn->mCloseAfterResponse) {
+        //The server told us it's closing the connection, so anything else
+        //we sent on it will never get a response and goes elsewhere
+        fail_connection(conn, boost::asio::error::eof, NULL);
+    } else if (parse_failed) {
+        //Like a failure to parse a request, this isn't worth retrying
+        if (!conn->mInFlight.empty()) {
+            failed.push_back(FailedRequest(conn->mInFlight.front(), RESPONSE_PARSING_FAILED, boost::system::error_code()));
+            conn->mInFlight.pop_front();
+            conn->mNumSent--;
+        }
+        fail_connection(conn, boost::asio::error::eof, NULL);
+    } else if (eof) {
+        //An idle connection closing is normal, but hanging up on requests
+        //we've sent counts against them
+        if (conn->mNumSent > 0)
+            SILOG(transfer, warning, "EOF while waiting for responses, so connection is broken");
+        fail_connection(conn, boost::asio::error::eof, (conn->mNumSent > 0 ? &failed : NULL));
+    } else {
+        closed = false;
+        if (conn->mInFlight.empty())
+            became_idle(conn);
+        read_response(conn);
+    }
+    lock.unlock();
+
+    if (!completed.empty() || !failed.empty())
+        finish_requests(completed, failed);
+    //Finished responses free up room on the connection and closed ones let
+    //us open new connections
+    if (!completed.empty() || closed)
+        processQueue();
+}
+
+void HttpManager::became_idle(HttpConnectionPtr conn) {
+    conn->mIdleSince = Timer::now();
+    postCallback(
+        mIdleTimeout,
+        std::tr1::bind(&HttpManager::handle_idle_timeout, this, HttpConnectionWPtr(conn)),
+        "HttpManager::handle_idle_timeout"
+    );
+}
+
+void HttpManager::handle_idle_timeout(HttpConnectionWPtr weak_conn) {
+    HttpConnectionPtr conn = weak_conn.lock();
+    if (!conn)
+        return;
+
+    boost::unique_lock<boost::mutex> lock(mPoolLock);
+    //The connection may have been used, and even become idle again, since
+    //this timeout was set
+    if (conn->mClosed || !conn->mInFlight.empty() || Timer::now() - conn->mIdleSince < mIdleTimeout)
+        return;
 
-    if ((req->method == HEAD && respPtr->mHeaderComplete) ||
-        ((req->method == GET || req->method == POST) && respPtr->mMessageComplete)) {
-        //We're done
+    SILOG(transfer, detailed, "Closing idle connection to " << conn->addr.toString());
+    close_connection(conn);
+}
+
+void HttpManager::finish_requests(const CompletedList& completed, const FailedList& failed) {
+    boost::system::error_code ec;
+
+    for (CompletedList::const_iterator it = completed.begin(); it != completed.end(); it++) {
+        HttpRequestPtr req = it->first;
+        std::tr1::shared_ptr<HttpResponse> respPtr = it->second;
 
         //If we didn't get any body data, erase the DenseData pointer
         if (respPtr->mData->length() == 0) {
@@ -586,47 +776,39 @@ void HttpManager::handle_read(std::tr1::shared_ptr<TCPSocket> socket, std::tr1::
         } else {
             req->cb(respPtr, SUCCESS, ec);
         }
+    }
 
-        //If this is Connection: Close or we reached EOF, then close connection, otherwise recycle
-        if ((respPtr->mHttpParser.flags & F_CONNECTION_CLOSE) || err == boost::asio::error::eof) {
-            socket->close();
-            decrement_connection(req->addr);
-        } else {
-            boost::unique_lock<boost::mutex> lockRB(mRecycleBinLock);
-            mRecycleBin[req->addr].push(socket);
-            lockRB.unlock();
-        }
-        processQueue();
-
-    } else if(err == boost::asio::error::eof || bytes_transferred == 0) {
-        SILOG(transfer, warning, "EOF was true or bytes_transferred==0 and the parser wasn't finished, so connection is broken");
-        socket->close();
-        decrement_connection(req->addr);
+    for (FailedList::const_iterator it = failed.begin(); it != failed.end(); it++)
+        it->req->cb(std::tr1::shared_ptr<HttpResponse>(), it->type, it->err);
+}
 
-        req->mNumTries++;
-        if (req->mNumTries > 10) {
-            //This means this connection has gotten an error over 10 times. Let's stop trying
-            //TODO: this should probably be configurable
-            req->cb(std::tr1::shared_ptr<HttpResponse>(), BOOST_ERROR, boost::asio::error::eof);
-        } else {
-            add_req(req);
-        }
+int HttpManager::on_message_begin(http_parser* _) {
+    HttpConnection* conn = static_cast<HttpConnection*>(_->data);
 
-        processQueue();
-        return;
-    } else {
-        //Read some more data
-        socket->async_read_some(boost::asio::buffer(*vecbuf), boost::bind(
-                &HttpManager::handle_read, this, socket, req, vecbuf, respPtr,
-                boost::asio::placeholders::error,
-                boost::asio::placeholders::bytes_transferred));
+    //A response to something we didn't send, or after the server said it
+    //was done with this connection
+    if (conn->mCompleted.size() >= conn->mParsing.size() || conn->mCloseAfterResponse) {
+        conn->mParseError = true;
+        return 1;
     }
 
+    //Create a new response object for the next request in line
+    HttpRequestPtr req = conn->mParsing[conn->mCompleted.size()];
+    std::tr1::shared_ptr<HttpResponse> respPtr(new HttpResponse());
+    respPtr->mBytesSent = req->req.size();
+
+    //Initiate an empty DenseData
+    std::tr1::shared_ptr<DenseData> emptyData(new DenseData(Range(true)));
+    respPtr->mData = emptyData;
+
+    conn->mCurrentResponse = respPtr;
+    return 0;
 }
 
 int HttpManager::on_headers_complete(http_parser* _) {
     //SILOG(transfer, debug, "headers complete. content length = " << _->content_length);
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpConnection* conn = static_cast<HttpConnection*>(_->data);
+    HttpResponse* curResponse = conn->mCurrentResponse.get();
     curResponse->mContentLength = _->content_length;
     curResponse->mStatusCode = _->status_code;
 
@@ -642,11 +824,18 @@ int HttpManager::on_headers_complete(http_parser* _) {
     }
 
     curResponse->mHeaderComplete = true;
+
+    //A response to HEAD is done here. Returning 1 tells the parser there's
+    //no body, whatever the headers say, so it doesn't eat the next response.
+    if (conn->mParsing[conn->mCompleted.size()]->method == HEAD) {
+        finish_response(conn);
+        return 1;
+    }
     return 0;
 }
 
 int HttpManager::on_header_field(http_parser* _, const char* at, size_t len) {
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpResponse* curResponse = static_cast<HttpConnection*>(_->data)->mCurrentResponse.get();
 
     //See http-parser documentation for why this is necessary
     switch (curResponse->mLastCallback) {
@@ -670,7 +859,7 @@ int HttpManager::on_header_field(http_parser* _, const char* at, size_t len) {
 
 int HttpManager::on_header_value(http_parser* _, const char* at, size_t len) {
     //SILOG(transfer, debug, "on_header_value called");
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpResponse* curResponse = static_cast<HttpConnection*>(_->data)->mCurrentResponse.get();
 
     //See http-parser documentation for why this is necessary
     switch(curResponse->mLastCallback) {
@@ -754,7 +943,7 @@ int HttpManager::on_request_header_value(http_parser* _, const char* at, size_t
 
 int HttpManager::on_body(http_parser* _, const char* at, size_t len) {
     //SILOG(transfer, debug, "on_body called with length = " << len);
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpResponse* curResponse = static_cast<HttpConnection*>(_->data)->mCurrentResponse.get();
 
     if(curResponse->mGzip) {
         //Gzip encoding, so pass this buffer through a decoder
@@ -769,7 +958,12 @@ int HttpManager::on_body(http_parser* _, const char* at, size_t len) {
 
 int HttpManager::on_message_complete(http_parser* _) {
     //SILOG(transfer, debug, "message complete. content length = " << _->content_length);
-    HttpResponse* curResponse = static_cast<HttpResponse*>(_->data);
+    HttpConnection* conn = static_cast<HttpConnection*>(_->data);
+    HttpResponse* curResponse = conn->mCurrentResponse.get();
+
+    //Already finished when its headers completed, i.e. a response to HEAD
+    if (curResponse == NULL)
+        return 0;
 
     if(curResponse->mGzip) {
         std::stringstream decompressed;
@@ -783,11 +977,28 @@ int HttpManager::on_message_complete(http_parser* _) {
     }
 
     curResponse->mMessageComplete = true;
+    finish_response(conn);
     return 0;
 }
 
-void HttpManager::print_flags(std::tr1::shared_ptr<HttpResponse> resp) {
-    char flags = resp->mHttpParser.flags;
+void HttpManager::finish_response(HttpConnection* conn) {
+    //Persistent connections are the default in HTTP/1.1, and we only pipeline
+    //to servers that speak it
+    const http_parser& parser = conn->mHttpParser;
+    bool http11 = parser.http_major > 1 || (parser.http_major == 1 && parser.http_minor >= 1);
+    bool close = (parser.flags & F_CONNECTION_CLOSE) || (!http11 && !(parser.flags & F_CONNECTION_KEEP_ALIVE));
+    conn->mPipelinable = http11 && !close;
+    conn->mCloseAfterResponse = close;
+
+    conn->mCurrentResponse->mBytesReceived = conn->mBytesUnaccounted;
+    conn->mBytesUnaccounted = 0;
+
+    conn->mCompleted.push_back(conn->mCurrentResponse);
+    conn->mCurrentResponse.reset();
+}
+
+void HttpManager::print_flags(const http_parser& parser) {
+    char flags = parser.flags;
     SILOG(transfer, detailed, "Flags are: "
             << (flags & F_CHUNKED ? "F_CHUNKED " : "")
             << (flags & F_CONNECTION_KEEP_ALIVE ? "F_CONNECTION_KEEP_ALIVE " : "")
@@ -795,8 +1006,6 @@ void HttpManager::print_flags(std::tr1::shared_ptr<HttpResponse> resp) {
             << (flags & F_TRAILING ? "F_TRAILING " : "")
             << (flags & F_UPGRADE ? "F_UPGRADE " : "")
             << (flags & F_SKIPBODY ? "F_SKIPBODY " : "")
-            << (resp->mMessageComplete ? "MESSAGE_COMPLETE " : "")
-            << (resp->mHeaderComplete ? "HEADER_COMPLETE " : "")
             );
 }
 
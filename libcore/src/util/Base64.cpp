@@ -5,7 +5,6 @@
 
 #include <sirikata/core/util/Standard.hh>
 #include <sirikata/core/util/Base64.hpp>
-#include <boost/archive/iterators/base64_from_binary.hpp>
 #include <boost/archive/iterators/binary_from_base64.hpp>
 #include <boost/archive/iterators/transform_width.hpp>
 #include <iterator>
@@ -13,38 +12,142 @@
 namespace Sirikata {
 namespace Base64 {
 
+namespace {
+
+const char* sAlphabets[2] = {
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+};
+
+enum {
+    InvalidChar = 0xFF,
+    PadChar = 0xFE
+};
+
+// Lookup tables, filled in once at startup. Encoding looks up 12 bits at a
+// time, giving the pair of characters for them in output order.
+struct Tables {
+    Tables() {
+        for(uint32 a = 0; a < 2; a++) {
+            for(uint32 i = 0; i < 4096; i++) {
+                pairs[a][i][0] = sAlphabets[a][i >> 6];
+                pairs[a][i][1] = sAlphabets[a][i & 0x3F];
+            }
+        }
+
+        memset(values, InvalidChar, sizeof(values));
+        for(uint32 a = 0; a < 2; a++)
+            for(uint32 i = 0; i < 64; i++)
+                values[(uint8)sAlphabets[a][i]] = i;
+        values[(uint8)'='] = PadChar;
+    }
+
+    uint8 pairs[2][4096][2];
+    uint8 values[256];
+};
+Tables sTables;
+
+}
+
+size_t encodedLength(size_t len, bool padWithEquals) {
+    if (padWithEquals)
+        return (len + 2) / 3 * 4;
+    return (len * 4 + 2) / 3;
+}
+
+size_t encode(uint8* dest, const uint8* src, size_t len, Alphabet alphabet, bool padWithEquals) {
+    const uint8 (*pairs)[2] = sTables.pairs[alphabet];
+    uint8* out = dest;
+
+    size_t full = len - (len % 3);
+    for(size_t i = 0; i < full; i += 3) {
+        uint32 group = (src[i] << 16) | (src[i+1] << 8) | src[i+2];
+        memcpy(out, pairs[group >> 12], 2);
+        memcpy(out + 2, pairs[group & 0xFFF], 2);
+        out += 4;
+    }
+
+    size_t remaining = len - full;
+    if (remaining > 0) {
+        const char* chars = sAlphabets[alphabet];
+        uint32 group = (src[full] << 16) | (remaining > 1 ? (src[full+1] << 8) : 0);
+        *(out++) = chars[group >> 18];
+        *(out++) = chars[(group >> 12) & 0x3F];
+        if (remaining > 1)
+            *(out++) = chars[(group >> 6) & 0x3F];
+        if (padWithEquals) {
+            if (remaining == 1)
+                *(out++) = '=';
+            *(out++) = '=';
+        }
+    }
+
+    return out - dest;
+}
+
+size_t decodedLength(size_t len) {
+    return len / 4 * 3 + 2;
+}
+
+bool decode(uint8* dest, size_t* dest_len, const uint8* src, size_t len) {
+    const uint8* values = sTables.values;
+    uint8* out = dest;
+
+    size_t i = 0;
+    for(; i + 4 <= len; i += 4) {
+        uint32 a = values[src[i]], b = values[src[i+1]], c = values[src[i+2]], d = values[src[i+3]];
+        // Both invalid and padding characters have their high bit set, so
+        // one check covers the common case of a full group
+        if ((a | b | c | d) & 0x80) break;
+        uint32 group = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = (uint8)(group >> 16);
+        out[1] = (uint8)(group >> 8);
+        out[2] = (uint8)group;
+        out += 3;
+    }
+
+    // The last, partial group
+    uint32 group = 0, nchars = 0;
+    for(; i < len; i++) {
+        uint8 val = values[src[i]];
+        if (val == PadChar) break;
+        if (val == InvalidChar) return false;
+        group = (group << 6) | val;
+        nchars++;
+        if (nchars == 4) {
+            out[0] = (uint8)(group >> 16);
+            out[1] = (uint8)(group >> 8);
+            out[2] = (uint8)group;
+            out += 3;
+            group = 0;
+            nchars = 0;
+        }
+    }
+    if (nchars == 1) return false;
+    if (nchars >= 2) {
+        group <<= 6 * (4 - nchars);
+        *(out++) = (uint8)(group >> 16);
+        if (nchars == 3)
+            *(out++) = (uint8)(group >> 8);
+    }
+
+    *dest_len = out - dest;
+    return true;
+}
+
 String encode(const String& orig, bool padWithEqual) {
-    using namespace boost::archive::iterators;
-    typedef base64_from_binary< transform_width< const char *, 6, 8 > > base64_text;
-    size_t origSize = orig.size();
-    std::stringstream os;
-    std::copy(
-        base64_text(orig.data()),
-        base64_text(orig.data() + origSize),
-        std::ostream_iterator<char>(os)
-    );
-    origSize%=3;
-    if (origSize==1)
-        os<<'='<<'=';
-    if (origSize==2)
-        os<<'=';
-    return os.str();
+    String result(encodedLength(orig.size(), padWithEqual), '\0');
+    if (!result.empty())
+        encode((uint8*)&result[0], (const uint8*)orig.data(), orig.size(), StandardAlphabet, padWithEqual);
+    return result;
 }
 
 String encodeURL(const String& orig) {
-    // To properly encode, we need to buffer the end of the string so that the
-    // number of bits works out.  Append = until we get a total number of bits
-    // divisible by 8.
-    String data_part = encode(orig,false);
-    // We get back encoded_bytes * 6 bits.
-    uint32 nbits = data_part.size() * 6;
-    // We need it to be divisible by 8.
-    uint32 extra_bits = nbits % 8;
-    while(extra_bits % 8 != 0) {
-        data_part += "%3D";
-        extra_bits += 6;
-    }
-    return data_part;
+    // encode() used to pad with '=' whether or not it was asked to, so this
+    // has always produced plain '=' padding rather than %3D. Data URIs and
+    // scripts depend on the exact output, so keep it that way. decodeURL()
+    // still accepts either.
+    return encode(orig, true);
 }
 
 String decode(const String& orig) {
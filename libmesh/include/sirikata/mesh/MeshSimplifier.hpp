@@ -73,9 +73,15 @@ private:
 
   } QSlimStruct;
 
+  uint32 mNumThreads;
 
 public:
 
+  /** \param num_threads number of threads to simplify independent submeshes
+   *  with, including the calling thread. 0 uses one per core.
+   */
+  MeshSimplifier(uint32 num_threads = 0);
+
   void simplify(Mesh::MeshdataPtr agg_mesh, int32 numFacesLeft);
 
 
@@ -35,6 +35,11 @@
 #include <boost/functional/hash.hpp>
 
 #include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <functional>
+#include <queue>
 #ifdef _WIN32
 #include <float.h>
 #else
@@ -61,39 +66,35 @@ public:
   {
   }
 
-  size_t hash() const {
-      size_t seed = 0;
+  // Fills out with the indices in ascending order. This is used for hashing
+  // and comparison, so avoid allocating.
+  void sortedIndices(uint32 out[3]) const {
+    out[0] = idx1; out[1] = idx2; out[2] = idx3;
+    if (out[0] > out[1]) std::swap(out[0], out[1]);
+    if (out[1] > out[2]) std::swap(out[1], out[2]);
+    if (out[0] > out[1]) std::swap(out[0], out[1]);
+  }
 
-      std::vector<uint32> sortedIndices;
-      sortedIndices.push_back(idx1);
-      sortedIndices.push_back(idx2);
-      sortedIndices.push_back(idx3);
-      std::sort(sortedIndices.begin(), sortedIndices.end());
+  size_t hash() const {
+      uint32 sorted[3];
+      sortedIndices(sorted);
 
-      seed = 0;
-      boost::hash_combine(seed, sortedIndices[0]);
-      boost::hash_combine(seed, sortedIndices[1]);
-      boost::hash_combine(seed, sortedIndices[2]);
+      size_t seed = 0;
+      boost::hash_combine(seed, sorted[0]);
+      boost::hash_combine(seed, sorted[1]);
+      boost::hash_combine(seed, sorted[2]);
 
       return seed;
   }
 
   bool operator==(const IndexedFaceContainer&other) const {
-    std::vector<uint32> sortedIndices;
-    sortedIndices.push_back(idx1);
-    sortedIndices.push_back(idx2);
-    sortedIndices.push_back(idx3);
-    std::sort(sortedIndices.begin(), sortedIndices.end());
-
-    std::vector<uint32> sortedIndices2;
-    sortedIndices2.push_back(other.idx1);
-    sortedIndices2.push_back(other.idx2);
-    sortedIndices2.push_back(other.idx3);
-    std::sort(sortedIndices2.begin(), sortedIndices2.end());
-
-    return (sortedIndices[0] == sortedIndices2[0]
-            && sortedIndices[1] == sortedIndices2[1]
-            && sortedIndices[2] == sortedIndices2[2] );
+    uint32 sorted[3], otherSorted[3];
+    sortedIndices(sorted);
+    other.sortedIndices(otherSorted);
+
+    return (sorted[0] == otherSorted[0]
+            && sorted[1] == otherSorted[1]
+            && sorted[2] == otherSorted[2] );
   }
 
   class Hasher{
@@ -211,83 +212,6 @@ public:
 
 };
 
-class GeomPairContainer {
-public:
-  uint32 mGeomIdx;
-  uint32 mVertexIdx1;
-  uint32 mVertexIdx2;
-  float64 mCost;
-  Vector3f mReplacementVector;
-
-  void init(uint32 g, uint32 v1, uint32 v2) {
-    mGeomIdx = g;
-    mVertexIdx1 = v1;
-    mVertexIdx2 = v2;
-
-    if (mVertexIdx1 > mVertexIdx2) {
-      uint32 temp = mVertexIdx1;
-      mVertexIdx1 = mVertexIdx2;
-      mVertexIdx2 = temp;
-    }
-
-    mCost = 0;
-  }
-
-  GeomPairContainer(uint32 g, uint32 v1, uint32 v2) {
-    init(g,v1,v2);
-  }
-
-  GeomPairContainer(uint32 g, uint32 v1, uint32 v2, float64 cost)  {
-    init(g,v1,v2);
-    mCost = cost;
-  }
-
-  GeomPairContainer() {
-    mGeomIdx = mVertexIdx1 = mVertexIdx2 = 0;
-    mCost = 0;
-  }
-
-  size_t hash() const {
-      size_t seed = 0;
-      boost::hash_combine(seed, mGeomIdx);
-      boost::hash_combine(seed, mVertexIdx1);
-      boost::hash_combine(seed, mVertexIdx2);
-
-      return seed;
-  }
-
-  bool operator==(const GeomPairContainer&other)const {
-    return mGeomIdx==other.mGeomIdx && mVertexIdx1==other.mVertexIdx1 && mVertexIdx2==other.mVertexIdx2;
-  }
-
-  bool operator<(const GeomPairContainer&other) const {
-
-    if (*this == other) return false;
-
-    if (mCost == other.mCost) {
-      if (mGeomIdx == other.mGeomIdx) {
-        if (mVertexIdx1 == other.mVertexIdx1) {
-          assert(mVertexIdx2 != other.mVertexIdx2);
-          return mVertexIdx2 < other.mVertexIdx2;
-        }
-
-        return mVertexIdx1 < other.mVertexIdx1;
-      }
-
-      return mGeomIdx < other.mGeomIdx;
-    }
-
-    return mCost < other.mCost;
-  }
-
-  class Hasher{
-  public:
-        size_t operator() (const GeomPairContainer& g) const {
-            return g.hash();
-        }
-  };
-
-};
 bool custom_isnan (double data) {
 #ifdef _WIN32
     return _isnan(data);
@@ -358,693 +282,723 @@ bool optimize(Matrix4x4d& Q, const Vector3f& v11, const Vector3f& v21, Vector3f&
     return true;
 }
 
-void computeCosts(Mesh::MeshdataPtr agg_mesh,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, Matrix4x4d> >& submeshPositionQs,
-                  std::set<GeomPairContainer>& vertexPairs,
-                  std::tr1::unordered_map<GeomPairContainer, float64, GeomPairContainer::Hasher>& pairPriorities,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> > >& submeshNeighborVertices,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::vector<uint32> > >& vertexToFacesMap,
-                  std::tr1::unordered_map<GeomPairContainer, uint32, GeomPairContainer::Hasher>& pairFrequency
-                 )
-{
+float64 quadricCost(const Matrix4x4d& Q, const Vector3f& v) {
+    Vector4d vbar4f (v.x, v.y, v.z, 1);
+    float64 cost = vbar4f[0]*vbar4f[0]*Q(0,0) + 2*vbar4f[0]*vbar4f[1]*Q(0,1) + 2*vbar4f[0]*vbar4f[2]*Q(0,2) + 2*vbar4f[0]*Q(0,3)
+      + vbar4f[1]*vbar4f[1]*Q(1,1) + 2*vbar4f[1]*vbar4f[2]*Q(1,2) + 2*vbar4f[1]*Q(1,3)
+      + vbar4f[2]*vbar4f[2]*Q(2,2) + 2*vbar4f[2]*Q(2,3)
+      + Q(3,3);
+    return (cost < 0.0) ? -cost : cost;
+}
+
+Matrix4x4d planeQuadric(const Vector3d& normal, const Vector3d& point) {
+    float64 A = normal[0];
+    float64 B = normal[1];
+    float64 C = normal[2];
+    float64 D = -(normal.dot(point));
+
+    return Matrix4x4d( Vector4d(A*A, A*B, A*C, A*D),
+                       Vector4d(A*B, B*B, B*C, B*D),
+                       Vector4d(A*C, B*C, C*C, C*D),
+                       Vector4d(A*D, B*D, C*D, D*D), Matrix4x4d::ROWS() );
+}
+
+// Key for an unordered pair of vertices within one submesh.
+inline uint64 vertexPairKey(uint32 v1, uint32 v2) {
+    if (v1 > v2) std::swap(v1, v2);
+    return (((uint64)v1) << 32) | v2;
+}
 
-  for (uint32 i = 0;  i < agg_mesh->geometry.size(); i++) {
+/** A candidate edge collapse in a submesh's heap. Candidates aren't removed
+ *  when their cost changes. Instead a new candidate is pushed with a newer
+ *  version for the vertex pair and the old one is discarded when it reaches
+ *  the top of the heap.
+ */
+class CollapseCandidate {
+public:
+  float64 mCost;
+  // mVertexIdx1 < mVertexIdx2. mVertexIdx2 is collapsed into mVertexIdx1.
+  uint32 mVertexIdx1;
+  uint32 mVertexIdx2;
+  uint32 mVersion;
+  Vector3f mReplacementVector;
 
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
-    std::tr1::unordered_map<uint32, Matrix4x4d>& positionQs = submeshPositionQs[i];
-    std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> >& neighborVertices = submeshNeighborVertices[i];
-    std::tr1::unordered_map<uint32, std::vector<uint32> >& submeshVertexToFacesMap = vertexToFacesMap[i];
+  CollapseCandidate(float64 cost, uint32 v1, uint32 v2, uint32 version, const Vector3f& replacement)
+   : mCost(cost), mVertexIdx1(std::min(v1, v2)), mVertexIdx2(std::max(v1, v2)),
+     mVersion(version), mReplacementVector(replacement)
+  {
+  }
 
-    for (uint32 j = 0; j < curGeometry.positions.size(); j++) {
-      
-      if (neighborVertices.find(j) == neighborVertices.end()) continue;
+  bool cheaperThan(const CollapseCandidate& other) const {
+    if (mCost == other.mCost) {
+      if (mVertexIdx1 == other.mVertexIdx1)
+        return mVertexIdx2 < other.mVertexIdx2;
+      return mVertexIdx1 < other.mVertexIdx1;
+    }
+    return mCost < other.mCost;
+  }
 
-      const Vector3f& position = curGeometry.positions[j];
+  // std heaps keep the largest element on top, so order by decreasing cost.
+  class Compare {
+  public:
+    bool operator()(const CollapseCandidate& lhs, const CollapseCandidate& rhs) const {
+      return rhs.cheaperThan(lhs);
+    }
+  };
+};
 
-      Matrix4x4d Q = positionQs[j];
+/** An edge collapse performed while simplifying a submesh, in the order they
+ *  were performed.
+ */
+class CollapseRecord {
+public:
+  float64 mCost;
+  uint32 mTargetIdx;
+  uint32 mSourceIdx;
+  Vector3f mReplacementVector;
+  // Number of faces in the submesh (not counting instances) which became
+  // degenerate.
+  uint32 mFacesRemoved;
+  // False if the source was only remapped to the target because they were
+  // already at the same position.
+  bool mCollapsed;
+
+  CollapseRecord()
+   : mCost(0), mTargetIdx(0), mSourceIdx(0), mFacesRemoved(0), mCollapsed(false)
+  {
+  }
+};
 
-      std::tr1::unordered_set<uint32>& neighbors = neighborVertices[j];
+/** Simplifies a single SubMeshGeometry. Each submesh has its own vertices and
+ *  quadrics, so submeshes can be simplified independently and in parallel.
+ *  Per-vertex data is kept in arrays indexed by the vertex index.
+ *
+ *  A submesh is simplified in three steps:
+ *   1. prepare() merges vertices at duplicate positions, finds faces and
+ *      neighbors, and accumulates quadrics over all instances of the submesh.
+ *   2. computeCollapses() runs the greedy collapse until no candidates are
+ *      left, recording each collapse and its cost.
+ *   3. apply() performs the first n of those collapses on the geometry.
+ *  This lets the caller choose how many collapses to take from each submesh
+ *  by merging their costs, giving the same result as running a single greedy
+ *  collapse over all the submeshes.
+ */
+class SubmeshSimplifier {
+public:
+  SubmeshSimplifier()
+   : mGeometry(NULL), mInstanceCount(0), mFaceCount(0)
+  {
+  }
 
-      for (std::tr1::unordered_set<uint32>::iterator neighbor_it = neighbors.begin(); neighbor_it != neighbors.end(); neighbor_it++) {
-        uint32 neighbor = *neighbor_it;
+  void prepare(SubMeshGeometry* geometry, const std::vector<Matrix4x4d>& transforms);
+  void computeCollapses();
+  void apply(uint32 numCollapses);
+
+  uint32 instanceCount() const { return mInstanceCount; }
+  // Number of non-degenerate faces in one instance of the submesh
+  uint32 faceCount() const { return mFaceCount; }
+  uint32 numCollapses() const { return mCollapses.size(); }
+  const CollapseRecord& collapse(uint32 idx) const { return mCollapses[idx]; }
+
+private:
+  uint32 findMappedVertex(uint32 idx);
+  void addNeighbor(uint32 idx, uint32 neighbor);
+  void addBoundaryConstraint(const Matrix4x4d& transform, const Vector3d& normal,
+                             const Vector3d& org, const Vector3d& dest,
+                             uint32 idx1, uint32 idx2);
+
+  CollapseCandidate computeCandidate(uint32 idx, uint32 neighbor, uint32 version);
+  void computeInitialCosts();
+  // Recompute the costs of pairs with the target after the source has been
+  // collapsed into it.
+  void computeCosts(uint32 sourceIdx, uint32 targetIdx);
+  void collapse(const CollapseCandidate& top);
+  void rebuildGeometry();
+
+  SubMeshGeometry* mGeometry;
+  uint32 mInstanceCount;
+  uint32 mFaceCount;
+
+  // Working copy of positions, updated as vertices are collapsed
+  std::vector<Vector3f> mPositions;
+  std::vector<Matrix4x4d> mQuadrics;
+  // Vertices map to themselves until they're collapsed into another vertex.
+  std::vector<uint32> mVertexMapping;
+  // Maps each vertex to the first vertex with the same position, and from that
+  // first vertex to the others
+  std::vector<uint32> mMapToFirstIndex;
+  std::vector<std::vector<uint32> > mDuplicateIndices;
+  std::vector<std::vector<uint32> > mNeighborVertices;
+  std::vector<std::vector<uint32> > mVertexToFaces;
+  std::vector<IndexedFaceContainer> mFaces;
+
+  std::vector<CollapseCandidate> mHeap;
+  // Current version of each vertex pair's candidate
+  std::tr1::unordered_map<uint64, uint32> mPairVersions;
+
+  std::vector<CollapseRecord> mCollapses;
+};
 
-        bool neighbor_edgeVertex = (submeshVertexToFacesMap[neighbor].size() == 1);
+uint32 SubmeshSimplifier::findMappedVertex(uint32 idx) {
+  uint32 root = idx;
+  while (mVertexMapping[root] != root)
+    root = mVertexMapping[root];
 
-        Vector3f best;
-        
-        const Vector3f& neighborPosition = curGeometry.positions[neighbor];
-        Matrix4x4d Q = positionQs[j] + positionQs[neighbor];
+  // Path compression
+  while (mVertexMapping[idx] != root) {
+    uint32 next = mVertexMapping[idx];
+    mVertexMapping[idx] = root;
+    idx = next;
+  }
 
-        optimize(Q, position, neighborPosition, best);
-        
-        Vector4d vbar4f (best.x, best.y, best.z, 1);
+  return root;
+}
 
-        float64 cost = vbar4f[0]*vbar4f[0]*Q(0,0) + 2*vbar4f[0]*vbar4f[1]*Q(0,1) + 2*vbar4f[0]*vbar4f[2]*Q(0,2) + 2*vbar4f[0]*Q(0,3)
-          + vbar4f[1]*vbar4f[1]*Q(1,1) + 2*vbar4f[1]*vbar4f[2]*Q(1,2) + 2*vbar4f[1]*Q(1,3)
-          + vbar4f[2]*vbar4f[2]*Q(2,2) + 2*vbar4f[2]*Q(2,3)
-          + Q(3,3);
-        cost = (cost < 0.0) ? -cost : cost;
-        
-        uint32 idx1 = j, idx2 = neighbor;
-        if (best == position) {
-          uint32 temp = idx1;
-          idx1 = idx2;
-          idx2 = temp;
-        }
+void SubmeshSimplifier::addNeighbor(uint32 idx, uint32 neighbor) {
+  std::vector<uint32>& neighbors = mNeighborVertices[idx];
+  if (std::find(neighbors.begin(), neighbors.end(), neighbor) == neighbors.end())
+    neighbors.push_back(neighbor);
+}
+
+//Handle boundary edges adding the perpendicular constraint plane.
+void SubmeshSimplifier::addBoundaryConstraint(const Matrix4x4d& transform, const Vector3d& normal,
+                                              const Vector3d& org, const Vector3d& dest,
+                                              uint32 idx1, uint32 idx2)
+{
+  Vector3d e = dest - org;
+  Vector3d constraint = e.cross(normal);
+  constraint = constraint.normal();
 
-        GeomPairContainer gpc(i, idx1, idx2);
+  Matrix4x4d Qmat = planeQuadric(constraint, org);
+  Qmat*=e.lengthSquared();
 
-        //Insert this cost as the cost of the edge if the edge hasnt been inserted 
-        //before or if this cost is less than the previously computed cost.
-        if (pairPriorities[gpc] == -1 || (pairPriorities[gpc] != -1 && cost < pairPriorities[gpc]) ) { 
-          gpc.mCost = pairPriorities[gpc];
-          vertexPairs.erase(gpc);
+  Qmat=transform.transpose()*Qmat*transform;
+  mQuadrics[idx1]+=Qmat;
+  mQuadrics[idx2]+=Qmat;
+}
+
+void SubmeshSimplifier::prepare(SubMeshGeometry* geometry, const std::vector<Matrix4x4d>& transforms) {
+  mGeometry = geometry;
+  mInstanceCount = transforms.size();
 
-          gpc.mReplacementVector = best;
+  SubMeshGeometry& curGeometry = *geometry;
+  uint32 numVertices = curGeometry.positions.size();
+  mPositions = curGeometry.positions;
 
-          gpc.mCost = cost;
-          pairPriorities[gpc] = gpc.mCost;
-          vertexPairs.insert(gpc);
+  /* Make every index in prims specification point to the earliest occurrence of the corresponding position vector */
+  mMapToFirstIndex.assign(numVertices, (uint32)-1);
+  mDuplicateIndices.assign(numVertices, std::vector<uint32>());
+  {
+    std::tr1::unordered_map<Vector3f, uint32, Vector3f::Hasher> firstPositionMap;
+    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
+      SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
+
+      for (uint32 k = 0; k+2 < primitive.indices.size(); k+=3) {
+        for (uint32 c = 0; c < 3; c++) {
+          uint32 idx = primitive.indices[k+c];
+          if (mMapToFirstIndex[idx] != (uint32)-1) continue;
+
+          std::pair<std::tr1::unordered_map<Vector3f, uint32, Vector3f::Hasher>::iterator, bool> inserted =
+              firstPositionMap.insert(std::make_pair(mPositions[idx], idx));
+          uint32 firstIdx = inserted.first->second;
+          mMapToFirstIndex[idx] = firstIdx;
+          if (firstIdx != idx)
+            mDuplicateIndices[firstIdx].push_back(idx);
         }
       }
     }
   }
-}
+  for (uint32 j = 0; j < numVertices; j++) {
+    if (mMapToFirstIndex[j] == (uint32)-1)
+      mMapToFirstIndex[j] = j;
+  }
 
-inline uint32 findMappedVertex(std::tr1::unordered_map<int, int>& vertexMapping, uint32 idx) {
-  uint32 startIdx = idx;
+  /* Identify the non-unique faces in the geometry. Find the neighbors of each vertex. */
+  mNeighborVertices.assign(numVertices, std::vector<uint32>());
+  mVertexToFaces.assign(numVertices, std::vector<uint32>());
+  std::tr1::unordered_map<uint64, uint32> pairFrequency;
+  {
+    std::tr1::unordered_set<IndexedFaceContainer, IndexedFaceContainer::Hasher> duplicateFaces;
+    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
+      SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
 
-  int countIter = 0;
-  while (vertexMapping.find(idx) != vertexMapping.end()) {
-    countIter++;
-    if ((int)idx == vertexMapping[idx]) {
-      break;
-    }
-    idx = vertexMapping[idx];
-  }
+      for (uint32 k = 0; k+2 < primitive.indices.size(); k+=3) {
+        uint32 idx = mMapToFirstIndex[primitive.indices[k]];
+        uint32 idx2 = mMapToFirstIndex[primitive.indices[k+1]];
+        uint32 idx3 = mMapToFirstIndex[primitive.indices[k+2]];
 
-  if (countIter > 1) {
-    vertexMapping[startIdx] = idx;
-  }
+        if (idx == idx2 || idx == idx3 || idx2 == idx3)
+          continue;
 
-  return idx;
-}
+        IndexedFaceContainer origface(idx, idx2, idx3);
+        uint32 faceIndex = mFaces.size();
+        mFaces.push_back(origface);
 
-void computeCosts(Mesh::MeshdataPtr agg_mesh, uint32 geomIdx, uint32 sourcePositionIdx, uint32 targetPositionIdx,
-                  std::tr1::unordered_map<int, int>& vertexMapping,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, Matrix4x4d> >& submeshPositionQs,
-                  std::set<GeomPairContainer>& vertexPairs,
-                  std::tr1::unordered_map<GeomPairContainer, float64, GeomPairContainer::Hasher>& pairPriorities,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> > >& submeshNeighborVertices,
-                  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::vector<uint32> > >& vertexToFacesMap,
-                  std::tr1::unordered_map<GeomPairContainer, uint32, GeomPairContainer::Hasher>& pairFrequency
-                  )
-{
-  
-  SubMeshGeometry& curGeometry = agg_mesh->geometry[geomIdx];
-  std::tr1::unordered_map<uint32, Matrix4x4d>& positionQs = submeshPositionQs[geomIdx];
-  std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> >& neighborVertices = submeshNeighborVertices[geomIdx];
-  std::tr1::unordered_map<uint32, std::vector<uint32> >& submeshVertexToFacesMap = vertexToFacesMap[geomIdx];
+        mVertexToFaces[idx].push_back(faceIndex);
+        mVertexToFaces[idx2].push_back(faceIndex);
+        mVertexToFaces[idx3].push_back(faceIndex);
 
-  targetPositionIdx = findMappedVertex(vertexMapping, targetPositionIdx);
+        if (!duplicateFaces.insert(origface).second) continue;
 
-  const Vector3f& position = curGeometry.positions[targetPositionIdx];
+        addNeighbor(idx, idx2);
+        addNeighbor(idx, idx3);
+        addNeighbor(idx2, idx);
+        addNeighbor(idx2, idx3);
+        addNeighbor(idx3, idx);
+        addNeighbor(idx3, idx2);
 
-  std::tr1::unordered_set<uint32>& neighbors = neighborVertices[targetPositionIdx];
+        pairFrequency[vertexPairKey(idx, idx2)]++;
+        pairFrequency[vertexPairKey(idx2, idx3)]++;
+        pairFrequency[vertexPairKey(idx, idx3)]++;
+      }
+    }
+  }
+  mFaceCount = mFaces.size();
 
+  /* Accumulate the quadrics of each vertex over all instances of this submesh */
+  mQuadrics.assign(numVertices, Matrix4x4d());
+  for (uint32 t = 0; t < transforms.size(); t++) {
+    const Matrix4x4d& transform = transforms[t];
 
-  for (std::tr1::unordered_set<uint32>::iterator neighbor_it = neighbors.begin(); neighbor_it != neighbors.end(); neighbor_it++) {   
-    uint32 neighborIdx = *neighbor_it;
+    for (uint32 f = 0; f < mFaces.size(); f++) {
+      uint32 idx = mFaces[f].idx1;
+      uint32 idx2 = mFaces[f].idx2;
+      uint32 idx3 = mFaces[f].idx3;
 
-    neighborIdx = findMappedVertex(vertexMapping, neighborIdx);
+      Vector3d orig_pos1 (mPositions[idx].x, mPositions[idx].y, mPositions[idx].z);
+      Vector3d orig_pos2 (mPositions[idx2].x, mPositions[idx2].y, mPositions[idx2].z);
+      Vector3d orig_pos3 (mPositions[idx3].x, mPositions[idx3].y, mPositions[idx3].z);
 
-    if (neighborIdx == targetPositionIdx) continue;
+      Vector3d pos1 = transform * orig_pos1;
+      Vector3d pos2 = transform * orig_pos2;
+      Vector3d pos3 = transform * orig_pos3;
 
-    uint32 idx1 = targetPositionIdx;
-    uint32 idx2 = neighborIdx;
+      Vector3d normal = (pos2 - pos1).cross(pos3-pos1);
+      normal = normal.normal();
 
-    float64 cost = 0;        
-    const Vector3f& neighborPosition = curGeometry.positions[neighborIdx];
-    Matrix4x4d Q = positionQs[targetPositionIdx] + positionQs[neighborIdx];
+      Matrix4x4d Qmat = planeQuadric(normal, pos1);
+      Qmat = transform.transpose() * Qmat * transform;
 
-    Vector3f best;
-    optimize(Q, position, neighborPosition, best);
+      float64 face_area = (pos1-pos2).cross(pos1-pos3).length() * ((double)0.5);
+      Qmat *= face_area;
 
-    Vector4d vbar4f (best.x, best.y, best.z, 1);
-    cost = vbar4f[0]*vbar4f[0]*Q(0,0) + 2*vbar4f[0]*vbar4f[1]*Q(0,1) + 2*vbar4f[0]*vbar4f[2]*Q(0,2) + 2*vbar4f[0]*Q(0,3)
-            + vbar4f[1]*vbar4f[1]*Q(1,1) + 2*vbar4f[1]*vbar4f[2]*Q(1,2) + 2*vbar4f[1]*Q(1,3)
-            + vbar4f[2]*vbar4f[2]*Q(2,2) + 2*vbar4f[2]*Q(2,3)
-            + Q(3,3);
-    cost = (cost < 0.0) ? -cost : cost;
+      mQuadrics[idx] += Qmat;
+      mQuadrics[idx2] += Qmat;
+      mQuadrics[idx3] += Qmat;
 
-    if (best == position) {
-      uint32 temp = idx1;
-      idx1 = idx2;
-      idx2 = temp;
+      if (pairFrequency[vertexPairKey(idx, idx2)] == 1)
+        addBoundaryConstraint(transform, normal, pos1, pos2, idx, idx2);
+      if (pairFrequency[vertexPairKey(idx3, idx2)] == 1)
+        addBoundaryConstraint(transform, normal, pos3, pos2, idx3, idx2);
+      if (pairFrequency[vertexPairKey(idx, idx3)] == 1)
+        addBoundaryConstraint(transform, normal, pos1, pos3, idx, idx3);
     }
-
-    //Remove the previous vertex pair that existed before one vertex collapsed.
-    GeomPairContainer gpc(geomIdx, sourcePositionIdx, neighborIdx);
-    gpc.mCost = pairPriorities[gpc];
-    vertexPairs.erase(gpc);
-    gpc = GeomPairContainer(geomIdx, neighborIdx, sourcePositionIdx);
-    gpc.mCost = pairPriorities[gpc];
-    vertexPairs.erase(gpc);
-    
-    //Insert this vertex pair with the new cost, but first remove this pair if it already exists, then re-insert it.
-    gpc = GeomPairContainer(geomIdx, idx1, idx2);
-    gpc.mCost = pairPriorities[gpc];
-    vertexPairs.erase(gpc);
-    gpc = GeomPairContainer(geomIdx, idx2, idx1);
-    gpc.mCost = pairPriorities[gpc];
-    vertexPairs.erase(gpc);        
-
-    gpc = GeomPairContainer(geomIdx, idx1, idx2);
-    gpc.mCost = pairPriorities[gpc];
-
-    gpc.mCost = cost;
-    gpc.mReplacementVector = best;
-    pairPriorities[gpc] = gpc.mCost;
-
-    vertexPairs.insert(gpc); 
   }
+
+  mVertexMapping.resize(numVertices);
+  for (uint32 j = 0; j < numVertices; j++)
+    mVertexMapping[j] = j;
 }
 
-void MeshSimplifier::simplify(Mesh::MeshdataPtr agg_mesh, int32 targetFaces) {
-  std::tr1::unordered_map<uint32, uint32> submeshInstanceCount;
+CollapseCandidate SubmeshSimplifier::computeCandidate(uint32 idx, uint32 neighbor, uint32 version) {
+  Matrix4x4d Q = mQuadrics[idx] + mQuadrics[neighbor];
 
-  int countFaces = 0;
-  uint32 geoinst_idx;
-  Matrix4x4f geoinst_pos_xform;
-  Meshdata::GeometryInstanceIterator geoinst_it = agg_mesh->getGeometryInstanceIterator();
+  Vector3f best;
+  optimize(Q, mPositions[idx], mPositions[neighbor], best);
 
-  std::set<GeomPairContainer> vertexPairs;
-  std::tr1::unordered_map<GeomPairContainer, float64, GeomPairContainer::Hasher> pairPriorities;
-  std::tr1::unordered_map<GeomPairContainer, uint32, GeomPairContainer::Hasher> pairFrequency; 
+  return CollapseCandidate(quadricCost(Q, best), idx, neighbor, version, best);
+}
 
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, Matrix4x4d> > submeshPositionQs;
+void SubmeshSimplifier::computeInitialCosts() {
+  // Each pair is seen from both of its vertices. Keep the cheaper of the two.
+  std::tr1::unordered_map<uint64, uint32> candidateIndices;
 
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> > > submeshNeighborVertices;
+  for (uint32 j = 0; j < mNeighborVertices.size(); j++) {
+    std::vector<uint32>& neighbors = mNeighborVertices[j];
 
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> > > submeshDuplicateIndices; 
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, uint32> > submeshMapToFirstIndex;
+    for (uint32 n = 0; n < neighbors.size(); n++) {
+      CollapseCandidate candidate = computeCandidate(j, neighbors[n], 1);
 
-  bool meshChangedDuringPreprocess = false;
-  
+      std::pair<std::tr1::unordered_map<uint64, uint32>::iterator, bool> inserted =
+          candidateIndices.insert(std::make_pair(vertexPairKey(j, neighbors[n]), (uint32)mHeap.size()));
+      if (inserted.second)
+        mHeap.push_back(candidate);
+      else if (candidate.mCost < mHeap[inserted.first->second].mCost)
+        mHeap[inserted.first->second] = candidate;
+    }
+  }
 
-  /* Make every index in prims specification point to the earliest occurrence of the corresponding position vector */
-  for (uint32 i = 0; i < agg_mesh->geometry.size(); i++) {
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
+  for (std::tr1::unordered_map<uint64, uint32>::iterator it = candidateIndices.begin(); it != candidateIndices.end(); it++)
+    mPairVersions[it->first] = 1;
 
-    std::tr1::unordered_map<Vector3f, uint32, Vector3f::Hasher> firstPositionMap;
+  std::make_heap(mHeap.begin(), mHeap.end(), CollapseCandidate::Compare());
+}
 
-    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
-      SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
+void SubmeshSimplifier::computeCosts(uint32 sourceIdx, uint32 targetIdx) {
+  std::vector<uint32>& neighbors = mNeighborVertices[targetIdx];
 
-      for (uint32 k = 0; k+2 < primitive.indices.size(); k+=3) {
-        unsigned short idx = primitive.indices[k];
-        unsigned short idx2 = primitive.indices[k+1];
-        unsigned short idx3 = primitive.indices[k+2];
+  for (uint32 n = 0; n < neighbors.size(); n++) {
+    uint32 neighborIdx = neighbors[n];
 
-        Vector3f& pos1 = curGeometry.positions[idx];
-        Vector3f& pos2 = curGeometry.positions[idx2];
-        Vector3f& pos3 = curGeometry.positions[idx3];       
+    //Invalidate the pair that existed before the source collapsed.
+    std::tr1::unordered_map<uint64, uint32>::iterator old_it = mPairVersions.find(vertexPairKey(sourceIdx, neighborIdx));
+    if (old_it != mPairVersions.end())
+      old_it->second++;
 
-        if (firstPositionMap.find(pos1) == firstPositionMap.end()) {
-          firstPositionMap[pos1] = idx;
-          submeshMapToFirstIndex[i][idx] = idx;
-        }
-        else {
-          uint32 firstIdx = firstPositionMap[pos1];
-          if (idx != firstIdx) {
-            submeshDuplicateIndices[i][firstIdx].insert(idx);
-            submeshMapToFirstIndex[i][idx] = firstIdx;
-          }
-        }
-
-        if (firstPositionMap.find(pos2) == firstPositionMap.end()) {
-          firstPositionMap[pos2] = idx2;
-          submeshMapToFirstIndex[i][idx2] = idx2;
-        }
-        else {
-           uint32 firstIdx = firstPositionMap[pos2];
-           if (idx2 != firstIdx) {
-             submeshDuplicateIndices[i][firstIdx].insert(idx2);
-             submeshMapToFirstIndex[i][idx2] = firstIdx;
-           }
-        }
+    //Replace the candidate for this pair with one using the new cost.
+    uint32& version = mPairVersions[vertexPairKey(targetIdx, neighborIdx)];
+    version++;
+    mHeap.push_back(computeCandidate(targetIdx, neighborIdx, version));
+    std::push_heap(mHeap.begin(), mHeap.end(), CollapseCandidate::Compare());
+  }
+}
 
-        if (firstPositionMap.find(pos3) == firstPositionMap.end()) {
-          firstPositionMap[pos3] = idx3;
-          submeshMapToFirstIndex[i][idx3] = idx3;
-        }
-        else {
-          uint32 firstIdx = firstPositionMap[pos3];
-          if (idx3 != firstIdx) {
-            submeshDuplicateIndices[i][firstIdx].insert(idx3);
-            submeshMapToFirstIndex[i][idx3] = firstIdx;
-          }
-        }
+void SubmeshSimplifier::collapse(const CollapseCandidate& top) {
+  uint32 targetIdx = top.mVertexIdx1;
+  uint32 sourceIdx = top.mVertexIdx2;
+
+  CollapseRecord record;
+  record.mCost = top.mCost;
+  record.mTargetIdx = targetIdx;
+  record.mSourceIdx = sourceIdx;
+  record.mReplacementVector = top.mReplacementVector;
+
+  mVertexMapping[sourceIdx] = targetIdx;
+
+  //Collapse vertex at sourceIdx into targetIdx.
+  if (mPositions[targetIdx] != mPositions[sourceIdx]) {
+    record.mCollapsed = true;
+
+    //count how many faces get invalidated and degenerate because of this edge collapse.
+    std::vector<uint32>& sourceFaces = mVertexToFaces[sourceIdx];
+    std::vector<uint32>& targetFaces = mVertexToFaces[targetIdx];
+    for (uint32 f = 0; f < sourceFaces.size(); f++) {
+      IndexedFaceContainer& ifc = mFaces[sourceFaces[f]];
+      if (!ifc.valid) continue;
+
+      uint32 vidx = findMappedVertex(ifc.idx1);
+      uint32 vidx2 = findMappedVertex(ifc.idx2);
+      uint32 vidx3 = findMappedVertex(ifc.idx3);
+
+      if (vidx == vidx2 || vidx2 == vidx3 || vidx == vidx3) {
+        //degenerate face; invalidate it.
+        ifc.valid = false;
+        record.mFacesRemoved++;
+      }
+      else {
+        //add this face to the faces of the target vertex.
+        targetFaces.push_back(sourceFaces[f]);
       }
     }
+    std::vector<uint32>().swap(sourceFaces);
+
+    //Now update the neighbors of the target vertex and its quadric matrix. The
+    //neighbors are kept mapped and unique so they don't grow with every
+    //collapse.
+    std::vector<uint32>& sourceNeighbors = mNeighborVertices[sourceIdx];
+    std::vector<uint32>& targetNeighbors = mNeighborVertices[targetIdx];
+    targetNeighbors.insert(targetNeighbors.end(), sourceNeighbors.begin(), sourceNeighbors.end());
+    std::vector<uint32>().swap(sourceNeighbors);
+    for (uint32 n = 0; n < targetNeighbors.size(); n++)
+      targetNeighbors[n] = findMappedVertex(targetNeighbors[n]);
+    std::sort(targetNeighbors.begin(), targetNeighbors.end());
+    targetNeighbors.erase(std::unique(targetNeighbors.begin(), targetNeighbors.end()), targetNeighbors.end());
+    targetNeighbors.erase(std::remove(targetNeighbors.begin(), targetNeighbors.end(), targetIdx), targetNeighbors.end());
+
+    mQuadrics[targetIdx] += mQuadrics[sourceIdx];
+    mPositions[targetIdx] = top.mReplacementVector;
+
+    //Finally recompute the costs of the neighbors.
+    computeCosts(sourceIdx, targetIdx);
   }
 
-  std::tr1::unordered_map<uint32, std::vector<IndexedFaceContainer> > geomFacesList;
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::vector<uint32> > > vertexToFacesMap;
-
-  /* Identify the non-unique faces in the geometry. Insert the vertex pairs */
-  for (uint32 i = 0; i < agg_mesh->geometry.size(); i++) {
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
+  mCollapses.push_back(record);
+}
 
-    std::tr1::unordered_map<uint32, std::tr1::unordered_set<uint32> >& neighborVertices = submeshNeighborVertices[i];
-    std::tr1::unordered_map<uint32, std::vector<uint32> >& geomsVertexToFacesMap = vertexToFacesMap[i];
-    std::vector<IndexedFaceContainer>& facesList = geomFacesList[i];
+void SubmeshSimplifier::computeCollapses() {
+  computeInitialCosts();
 
-    std::tr1::unordered_map<uint32, Matrix4x4d>& positionQs = submeshPositionQs[i];
+  //Do the actual edge collapses.
+  while (!mHeap.empty()) {
+    std::pop_heap(mHeap.begin(), mHeap.end(), CollapseCandidate::Compare());
+    CollapseCandidate top = mHeap.back();
+    mHeap.pop_back();
+
+    // Skip candidates which have been replaced, or whose vertices have been
+    // collapsed into others since they were computed.
+    if (mPairVersions[vertexPairKey(top.mVertexIdx1, top.mVertexIdx2)] != top.mVersion)
+      continue;
+    if (findMappedVertex(top.mVertexIdx1) != top.mVertexIdx1 ||
+        findMappedVertex(top.mVertexIdx2) != top.mVertexIdx2)
+      continue;
+
+    collapse(top);
+  }
 
-    std::tr1::unordered_set<IndexedFaceContainer, IndexedFaceContainer::Hasher> duplicateFaces;
-    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
-        SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
+  // Only the list of collapses is needed from here on.
+  std::vector<Vector3f>().swap(mPositions);
+  std::vector<Matrix4x4d>().swap(mQuadrics);
+  std::vector<uint32>().swap(mMapToFirstIndex);
+  std::vector<std::vector<uint32> >().swap(mNeighborVertices);
+  std::vector<std::vector<uint32> >().swap(mVertexToFaces);
+  std::vector<IndexedFaceContainer>().swap(mFaces);
+  std::vector<CollapseCandidate>().swap(mHeap);
+  mPairVersions.clear();
+}
 
-        for (uint32 k = 0; k+2 < primitive.indices.size(); k+=3) {
-          unsigned short idx = primitive.indices[k];
-          unsigned short idx2 = primitive.indices[k+1];
-          unsigned short idx3 = primitive.indices[k+2];
+void SubmeshSimplifier::apply(uint32 numCollapses) {
+  SubMeshGeometry& curGeometry = *mGeometry;
 
-          idx = submeshMapToFirstIndex[i][idx];
-          idx2 = submeshMapToFirstIndex[i][idx2];
-          idx3 = submeshMapToFirstIndex[i][idx3];
+  for (uint32 j = 0; j < mVertexMapping.size(); j++)
+    mVertexMapping[j] = j;
 
-          if (idx == idx2 || idx == idx3 || idx2 == idx3)
-            continue;
+  for (uint32 c = 0; c < numCollapses; c++) {
+    const CollapseRecord& record = mCollapses[c];
 
-          Vector3f& pos1 = curGeometry.positions[idx];
-          Vector3f& pos2 = curGeometry.positions[idx2];
-          Vector3f& pos3 = curGeometry.positions[idx3];
+    mVertexMapping[record.mSourceIdx] = record.mTargetIdx;
+    std::vector<uint32>& sourceDuplicates = mDuplicateIndices[record.mSourceIdx];
+    for (uint32 d = 0; d < sourceDuplicates.size(); d++)
+      mVertexMapping[sourceDuplicates[d]] = record.mTargetIdx;
 
-          IndexedFaceContainer origface(idx, idx2, idx3);
-          uint32 faceIndex = facesList.size();
-          facesList.push_back(origface);
+    if (!record.mCollapsed) continue;
 
-          geomsVertexToFacesMap[idx].push_back(faceIndex);
-          geomsVertexToFacesMap[idx2].push_back(faceIndex);
-          geomsVertexToFacesMap[idx3].push_back(faceIndex);
+    curGeometry.positions[record.mTargetIdx] = record.mReplacementVector;
+    std::vector<uint32>& targetDuplicates = mDuplicateIndices[record.mTargetIdx];
+    for (uint32 d = 0; d < targetDuplicates.size(); d++)
+      curGeometry.positions[targetDuplicates[d]] = record.mReplacementVector;
+  }
 
-          if (duplicateFaces.find(origface) != duplicateFaces.end()) continue;
+  rebuildGeometry();
+}
 
-          GeomPairContainer gpc1(i, idx, idx2, -1);
-          GeomPairContainer gpc2(i, idx2, idx3, -1);
-          GeomPairContainer gpc3(i, idx, idx3, -1);
+void SubmeshSimplifier::rebuildGeometry() {
+  SubMeshGeometry& curGeometry = *mGeometry;
 
-          neighborVertices[idx].insert(idx2);
-          neighborVertices[idx].insert(idx3);
-          neighborVertices[idx2].insert(idx);
-          neighborVertices[idx2].insert(idx3);
-          neighborVertices[idx3].insert(idx);
-          neighborVertices[idx3].insert(idx2);
+  //Now adjust the primitives to point to the new indexes of the submesh geometry vertices.
+  std::vector<std::vector<unsigned short> > newIndices(curGeometry.primitives.size());
 
-          vertexPairs.insert(gpc1);
-          pairPriorities[gpc1] = -1;
-          pairFrequency[gpc1]++;
+  std::vector<Sirikata::Vector3f> positions;
+  std::vector<Sirikata::Vector3f> normals;
+  std::vector<SubMeshGeometry::TextureSet> texUVs;
 
-          vertexPairs.insert(gpc2);
-          pairPriorities[gpc2] = -1;
-          pairFrequency[gpc2]++;
+  for (uint32 j = 0; j < curGeometry.texUVs.size(); j++) {
+    SubMeshGeometry::TextureSet ts;
+    ts.stride = curGeometry.texUVs[j].stride;
+    texUVs.push_back(ts);
+  }
 
-          vertexPairs.insert(gpc3);
-          pairPriorities[gpc3] = -1;
-          pairFrequency[gpc3]++;
+  //Create new indices from all the non-degenerate faces.
+  uint32 counter = 0;
+  for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
+    if (curGeometry.primitives[j].primitiveType != SubMeshGeometry::Primitive::TRIANGLES) continue;
 
-          duplicateFaces.insert(origface);
-        }
-    }
-  }
+    std::vector<unsigned short>& indices = newIndices[j];
 
+    for (uint32 k = 0; k+2 < curGeometry.primitives[j].indices.size(); k+=3) {
+      uint32 vidx[3];
+      for (uint32 c = 0; c < 3; c++)
+        vidx[c] = findMappedVertex(curGeometry.primitives[j].indices[k+c]);
 
+      Vector3f pos1 = curGeometry.positions[vidx[0]];
+      Vector3f pos2 = curGeometry.positions[vidx[1]];
+      Vector3f pos3 = curGeometry.positions[vidx[2]];
 
-  //Find the list of instances associated with each submesh
-  countFaces = 0;
-  
-  while( geoinst_it.next(&geoinst_idx, &geoinst_pos_xform) ) {
-    const GeometryInstance& geomInstance = agg_mesh->instances[geoinst_idx];
-    Matrix4x4f geoinst_pos_xform_transpose = geoinst_pos_xform.transpose();
-    Matrix4x4d transform;
-    for (int row=0; row<4; row++) {
-      for (int col=0; col<4; col++) {
-        transform(row,col) = geoinst_pos_xform(row,col);        
-      }
-    } 
-    
-    int geomIdx = geomInstance.geometryIndex;
-    submeshInstanceCount[geomIdx]++;
+      if (pos1 == pos2 || pos2 == pos3 || pos1 == pos3) continue;
 
+      indices.push_back(counter);
+      indices.push_back(counter+1);
+      indices.push_back(counter+2);
+      counter += 3;
 
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[geomIdx];
-    std::tr1::unordered_map<uint32, Matrix4x4d>& positionQs = submeshPositionQs[geomIdx];
+      positions.push_back(pos1);
+      positions.push_back(pos2);
+      positions.push_back(pos3);
 
-    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
-      SubMeshGeometry::Primitive& primitive = curGeometry.primitives[j];
+      for (uint32 c = 0; c < 3; c++) {
+        uint32 idx = vidx[c];
 
-      for (uint32 k = 0; k+2 < primitive.indices.size(); k+=3) {
-        unsigned short idx = primitive.indices[k];
-        unsigned short idx2 = primitive.indices[k+1];
-        unsigned short idx3 = primitive.indices[k+2];
-
-        idx = submeshMapToFirstIndex[geomIdx][idx];
-        idx2 = submeshMapToFirstIndex[geomIdx][idx2];
-        idx3 = submeshMapToFirstIndex[geomIdx][idx3];
-
-        if (idx == idx2 || idx == idx3 || idx2 == idx3) continue;
-        countFaces++;
-
-        Vector3d orig_pos1 (curGeometry.positions[idx].x, curGeometry.positions[idx].y,
-                           curGeometry.positions[idx].z);
-        Vector3d orig_pos2 (curGeometry.positions[idx2].x, curGeometry.positions[idx2].y,
-                            curGeometry.positions[idx2].z);
-        Vector3d orig_pos3 (curGeometry.positions[idx3].x, curGeometry.positions[idx3].y,
-                            curGeometry.positions[idx3].z);                
-
-        Vector3d pos1 = transform * orig_pos1;
-        Vector3d pos2 = transform * orig_pos2;
-        Vector3d pos3 = transform * orig_pos3;
-        
-        Vector3d normal = (pos2 - pos1).cross(pos3-pos1);
-        normal = normal.normal();
-        float64 A = normal[0];
-        float64 B = normal[1];
-        float64 C = normal[2];
-        float64 D = -(normal.dot(pos1));
-
-        Matrix4x4d Qmat ( Vector4d(A*A, A*B, A*C, A*D),
-                          Vector4d(A*B, B*B, B*C, B*D),
-                          Vector4d(A*C, B*C, C*C, C*D),
-                          Vector4d(A*D, B*D, C*D, D*D), Matrix4x4d::ROWS() );
-        
-        Qmat = transform.transpose() * Qmat * transform;
-
-        float64 face_area = (pos1-pos2).cross(pos1-pos3).length() * ((double)0.5);
-        Qmat *= face_area;
-
-        positionQs[idx] += Qmat;
-        positionQs[idx2] += Qmat;
-        positionQs[idx3] += Qmat;
-
-        GeomPairContainer gpc1(geomIdx, idx, idx2, -1);
-        GeomPairContainer gpc2(geomIdx, idx3, idx2, -1);
-        GeomPairContainer gpc3(geomIdx, idx, idx3, -1);
-
-        //Handle boundary edges adding the perpendicular constraint plane.
-        //Implementation could be much much better though.
-        if (pairFrequency[gpc1] == 1) {
-          Vector3d org = pos1, dest = pos2;
-          Vector3d e = dest - org;
-          Vector3d constraint = e.cross(normal);
-          constraint = constraint.normal();
-
-          float64 A = constraint[0];
-          float64 B = constraint[1];
-          float64 C = constraint[2];
-          float64 D = -(constraint.dot(org));
-
-          Matrix4x4d Qmat ( Vector4d(A*A, A*B, A*C, A*D),
-                          Vector4d(A*B, B*B, B*C, B*D),
-                          Vector4d(A*C, B*C, C*C, C*D),
-                          Vector4d(A*D, B*D, C*D, D*D), Matrix4x4d::ROWS() );
-          //Qmat*=100.0;
-          Qmat*=e.lengthSquared();
-
-          Qmat=transform.transpose()*Qmat*transform; 
-          positionQs[idx]+=Qmat;
-          positionQs[idx2]+=Qmat;
-        }
-        if (pairFrequency[gpc2] == 1) {
-          Vector3d org = pos3, dest = pos2;
-          Vector3d e = dest - org;
-          Vector3d constraint = e.cross(normal);
-          constraint = constraint.normal();
-
-          float64 A = constraint[0];
-          float64 B = constraint[1];
-          float64 C = constraint[2];
-          float64 D = -(constraint.dot(org));
-
-          Matrix4x4d Qmat ( Vector4d(A*A, A*B, A*C, A*D),
-                          Vector4d(A*B, B*B, B*C, B*D),
-                          Vector4d(A*C, B*C, C*C, C*D),
-                          Vector4d(A*D, B*D, C*D, D*D), Matrix4x4d::ROWS() );
-          //Qmat*=100.0;
-          Qmat*=e.lengthSquared();
-
-          Qmat=transform.transpose()*Qmat*transform;
-          positionQs[idx3]+=Qmat;
-          positionQs[idx2]+=Qmat;
+        if (idx < curGeometry.normals.size())
+          normals.push_back(curGeometry.normals[idx]);
 
+        for (uint32 t = 0; t < curGeometry.texUVs.size(); t++) {
+          unsigned int stride = curGeometry.texUVs[t].stride;
+          if (stride*idx < curGeometry.texUVs[t].uvs.size()) {
+            uint32 idxuv = stride * idx;
+            while ( idxuv < stride*idx+stride){
+              texUVs[t].uvs.push_back(curGeometry.texUVs[t].uvs[idxuv]);
+              idxuv++;
+            }
+          }
         }
-        if (pairFrequency[gpc3] == 1) {
-          Vector3d org = pos1, dest = pos3;
-          Vector3d e = dest - org;
-          Vector3d constraint = e.cross(normal);
-          constraint = constraint.normal();
-
-          float64 A = constraint[0];
-          float64 B = constraint[1];
-          float64 C = constraint[2];
-          float64 D = -(constraint.dot(org));
-
-          Matrix4x4d Qmat ( Vector4d(A*A, A*B, A*C, A*D),
-                          Vector4d(A*B, B*B, B*C, B*D),
-                          Vector4d(A*C, B*C, C*C, C*D),
-                          Vector4d(A*D, B*D, C*D, D*D), Matrix4x4d::ROWS() );
-          //Qmat*=100.0;
-          Qmat*=e.lengthSquared();
-
-          Qmat=transform.transpose()*Qmat*transform;
-          positionQs[idx]+=Qmat;
-          positionQs[idx3]+=Qmat;
-        } 
       }
     }
   }
 
-  //targetFaces = countFaces/2.0;
-  SIMPLIFY_LOG(warn, "countFaces = " << countFaces);
-  SIMPLIFY_LOG(warn, "targetFaces = " << targetFaces);
-  if (targetFaces < countFaces) {
-      SIMPLIFY_LOG(warn, "targetFaces < countFaces: Simplification needed");
-      computeCosts(agg_mesh, submeshPositionQs, vertexPairs, pairPriorities, submeshNeighborVertices, vertexToFacesMap, pairFrequency);
-  }
-  else if (!meshChangedDuringPreprocess) {
-    return;
-  }
-
-  std::tr1::unordered_map<int, std::tr1::unordered_map<int,int>  > vertexMapping1;
-
-  //Do the actual edge collapses.
-  while (countFaces > targetFaces && vertexPairs.size() > 0) {
-    GeomPairContainer top = *(vertexPairs.begin());   
-
-    int i = top.mGeomIdx;
-    uint32 targetIdx = top.mVertexIdx1;
-    uint32 sourceIdx = top.mVertexIdx2;
+  curGeometry.positions = positions;
+  curGeometry.normals = normals;
+  curGeometry.texUVs = texUVs;
 
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
-    std::tr1::unordered_map<int, int>& vertexMapping = vertexMapping1[i];
-
-    targetIdx = findMappedVertex(vertexMapping, targetIdx);
-    sourceIdx = findMappedVertex(vertexMapping, sourceIdx);
+  //Now set the new indices.
+  for (uint32 j = 0 ; j < curGeometry.primitives.size() ; j++)
+    curGeometry.primitives[j].indices.swap(newIndices[j]);
+}
 
-    Vector3f& targetPos = curGeometry.positions[targetIdx];
-    Vector3f& sourcePos = curGeometry.positions[sourceIdx];
+namespace {
 
-    vertexMapping[sourceIdx] = targetIdx;
-    assert( submeshMapToFirstIndex[i][sourceIdx] == sourceIdx);
+// Hands out submeshes to worker threads, largest first.
+class SubmeshWorkQueue {
+public:
+  typedef std::tr1::function<void(uint32)> WorkFunc;
 
-    for (std::tr1::unordered_set<uint32>::iterator dup_it = submeshDuplicateIndices[i][sourceIdx].begin();
-           dup_it != submeshDuplicateIndices[i][sourceIdx].end(); dup_it++)
-    {
-        vertexMapping[*dup_it] = targetIdx;
-    }
+  SubmeshWorkQueue(const std::vector<uint32>& order, const WorkFunc& work)
+   : mOrder(order), mNext(0), mWork(work)
+  {
+  }
 
-    //Collapse vertex at sourceIdx into targetIdx.
-    if (targetIdx != sourceIdx && targetPos != sourcePos) {
-      
-      std::tr1::unordered_map<uint32, std::vector<uint32> >& geomsVertexToFacesMap = vertexToFacesMap[i];
-      std::vector<uint32>& ifcVector = geomsVertexToFacesMap[sourceIdx];
-      std::vector<IndexedFaceContainer>& facesList = geomFacesList[i];
-
-      //count how many faces get invalidated and degenerate because of this edge collapse.
-      for (uint32 ifcVectorIdx = 0; ifcVectorIdx < ifcVector.size(); ifcVectorIdx++) {
-        uint32 faceIndex = ifcVector[ifcVectorIdx];
-        IndexedFaceContainer& ifc = facesList[faceIndex];
-
-        if (!ifc.valid) continue;
-
-        unsigned short vidx = ifc.idx1;
-        unsigned short vidx2 = ifc.idx2;
-        unsigned short vidx3 = ifc.idx3;
-
-        vidx = findMappedVertex(vertexMapping, vidx);
-        vidx2 = findMappedVertex(vertexMapping, vidx2);
-        vidx3 = findMappedVertex(vertexMapping, vidx3);
-
-        if (vidx == vidx2 || vidx2 == vidx3 || vidx == vidx3) {
-          //degenerate face; invalidate it.
-          countFaces -= submeshInstanceCount[i];
-            
-          ifc.valid = false;
-        }
-        else {
-          //add this face to the neighbors of the target vertex.
-          geomsVertexToFacesMap[targetIdx].push_back(faceIndex);
-        }
-      }
-      //done invalidating degenerate faces.
-
-      //Now update the neighbors of the target vertex and its quadric matrix.
-      std::tr1::unordered_set<uint32>& sourceNeighborVertices =  submeshNeighborVertices[i][sourceIdx];
-      std::tr1::unordered_set<uint32>& targetNeighborVertices =  submeshNeighborVertices[i][targetIdx];
-      std::tr1::unordered_map<uint32, Matrix4x4d>& positionQs = submeshPositionQs[i];
-      for (std::tr1::unordered_set<uint32>::iterator neighbor_it = sourceNeighborVertices.begin();
-           neighbor_it != sourceNeighborVertices.end(); neighbor_it++)
+  void run() {
+    while(true) {
+      uint32 idx;
       {
-        uint32 neighborIdx = *neighbor_it;
-
-        if (neighborIdx != targetIdx) {
-          targetNeighborVertices.insert(neighborIdx);
-        }
+        boost::mutex::scoped_lock lock(mMutex);
+        if (mNext >= mOrder.size()) return;
+        idx = mOrder[mNext++];
       }
+      mWork(idx);
+    }
+  }
 
-      positionQs[ targetIdx ] += positionQs[sourceIdx];
+private:
+  const std::vector<uint32>& mOrder;
+  boost::mutex mMutex;
+  uint32 mNext;
+  WorkFunc mWork;
+};
 
-      curGeometry.positions[targetIdx] = top.mReplacementVector;
-      for (std::tr1::unordered_set<uint32>::iterator dup_it = submeshDuplicateIndices[i][targetIdx].begin();
-           dup_it != submeshDuplicateIndices[i][targetIdx].end(); dup_it++)
-      {
-        curGeometry.positions[*dup_it] = top.mReplacementVector;
-      }
+// Runs work on each of the submeshes in order using up to num_threads threads,
+// including the calling thread. Returns once all of them are done.
+void runOnSubmeshes(const std::vector<uint32>& order, uint32 num_threads, const SubmeshWorkQueue::WorkFunc& work) {
+  SubmeshWorkQueue queue(order, work);
 
-      //Finally recompute the costs of the neighbors.
-      computeCosts(agg_mesh, i, sourceIdx, targetIdx, vertexMapping,
-                   submeshPositionQs, vertexPairs, pairPriorities, submeshNeighborVertices,
-                   vertexToFacesMap, pairFrequency);  
-    }
+  std::vector<Thread*> threads;
+  for (uint32 i = 1; i < std::min(num_threads, (uint32)order.size()); i++)
+    threads.push_back(new Thread("MeshSimplifier Worker", std::tr1::bind(&SubmeshWorkQueue::run, &queue)));
 
-    vertexPairs.erase(top);
-    pairPriorities.erase(top);
+  queue.run();
 
+  for (uint32 i = 0; i < threads.size(); i++) {
+    threads[i]->join();
+    delete threads[i];
   }
+}
 
+void prepareSubmesh(std::vector<SubmeshSimplifier>* submeshes, Mesh::MeshdataPtr agg_mesh,
+                    const std::vector<std::vector<Matrix4x4d> >* transforms, uint32 idx)
+{
+  (*submeshes)[idx].prepare(&agg_mesh->geometry[idx], (*transforms)[idx]);
+}
 
-  //Now adjust the primitives to point to the new indexes of the submesh geometry vertices.
-  std::tr1::unordered_map<uint32, std::tr1::unordered_map<uint32, std::vector<unsigned short> > > newIndices;
+void computeSubmeshCollapses(std::vector<SubmeshSimplifier>* submeshes, uint32 idx) {
+  (*submeshes)[idx].computeCollapses();
+}
 
-  //First create new indices from all the non-degenerate faces.
-  for (uint32 i = 0; i < agg_mesh->geometry.size(); i++) {
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
+void applySubmeshCollapses(std::vector<SubmeshSimplifier>* submeshes, const std::vector<uint32>* numCollapses, uint32 idx) {
+  (*submeshes)[idx].apply((*numCollapses)[idx]);
+}
 
-    std::tr1::unordered_map<int, int>& vertexMapping = vertexMapping1[i];
+class BySize {
+public:
+  BySize(const std::vector<uint64>& sizes) : mSizes(sizes) {}
+  bool operator()(uint32 lhs, uint32 rhs) const {
+    return mSizes[lhs] > mSizes[rhs];
+  }
+private:
+  const std::vector<uint64>& mSizes;
+};
 
-    std::vector<Sirikata::Vector3f> positions;
-    std::vector<Sirikata::Vector3f> normals;
-    std::vector<SubMeshGeometry::TextureSet> texUVs;
+} // namespace
 
-    for (uint32 j = 0; j < curGeometry.texUVs.size(); j++) {
-      SubMeshGeometry::TextureSet ts;
-      ts.stride = curGeometry.texUVs[j].stride;
-      texUVs.push_back(ts);
-    }
+MeshSimplifier::MeshSimplifier(uint32 num_threads)
+ : mNumThreads(num_threads)
+{
+  if (mNumThreads == 0)
+    mNumThreads = std::max(Thread::hardware_concurrency(), (unsigned)1);
+}
 
-    uint32 counter = 0;
-    for (uint32 j = 0; j < curGeometry.primitives.size(); j++) {
-      if (curGeometry.primitives[j].primitiveType != SubMeshGeometry::Primitive::TRIANGLES) continue;
-
-      std::vector<unsigned short>& indices = newIndices[i][j];
-
-      for (uint32 k = 0; k+2 < curGeometry.primitives[j].indices.size(); k+=3) {
-        unsigned short idx = curGeometry.primitives[j].indices[k];
-        unsigned short idx2 = curGeometry.primitives[j].indices[k+1];
-        unsigned short idx3 = curGeometry.primitives[j].indices[k+2];
-
-        idx = findMappedVertex(vertexMapping, idx);
-        idx2 = findMappedVertex(vertexMapping, idx2);
-        idx3 = findMappedVertex(vertexMapping, idx3);
-
-        Vector3f pos1 = curGeometry.positions[idx];
-        Vector3f pos2 = curGeometry.positions[idx2];
-        Vector3f pos3 = curGeometry.positions[idx3];
-
-        if (pos1 != pos2 && pos2 != pos3 && pos1 != pos3) { 
-          indices.push_back(counter);
-          indices.push_back(counter+1);
-          indices.push_back(counter+2);
-          counter += 3;
-
-          positions.push_back(pos1);
-          positions.push_back(pos2);
-          positions.push_back(pos3);
-
-          if (idx < curGeometry.normals.size())
-            normals.push_back(curGeometry.normals[idx]);
-          if (idx2 < curGeometry.normals.size())
-            normals.push_back(curGeometry.normals[idx2]);
-          if (idx3 < curGeometry.normals.size())
-            normals.push_back(curGeometry.normals[idx3]);
-
-          ///////////////////////////////////////////////////////
-          for (uint32 k = 0; k < curGeometry.texUVs.size(); k++) {
-            unsigned int stride = curGeometry.texUVs[k].stride;
-            if (stride*idx < curGeometry.texUVs[k].uvs.size()) {
-              uint32 idxuv = stride * idx;
-              while ( idxuv < stride*idx+stride){
-                texUVs[k].uvs.push_back(curGeometry.texUVs[k].uvs[idxuv]);
-                idxuv++;
-              }
-            }
-          }
+void MeshSimplifier::simplify(Mesh::MeshdataPtr agg_mesh, int32 targetFaces) {
+  using std::tr1::placeholders::_1;
 
-          //////////////////////////////////////////////////////
-          for (uint32 k = 0; k < curGeometry.texUVs.size(); k++) {
-            unsigned int stride = curGeometry.texUVs[k].stride;
-            if (stride*idx2 < curGeometry.texUVs[k].uvs.size()) {
-              uint32 idxuv = stride * idx2;
-              while ( idxuv < stride*idx2+stride){
-                texUVs[k].uvs.push_back(curGeometry.texUVs[k].uvs[idxuv]);
-                idxuv++;
-              }
-            }
-          }
+  uint32 numGeometries = agg_mesh->geometry.size();
 
-          //////////////////////////////////////////////////////
-          for (uint32 k = 0; k < curGeometry.texUVs.size(); k++) {
-            unsigned int stride = curGeometry.texUVs[k].stride;
-            if (stride*idx3 < curGeometry.texUVs[k].uvs.size()) {
-              uint32 idxuv = stride * idx3;
-              while ( idxuv < stride*idx3+stride){
-                texUVs[k].uvs.push_back(curGeometry.texUVs[k].uvs[idxuv]);
-                idxuv++;
-              }
-            }
-          }
- 
-          /////////////////////////////////////////////////////
-        }
+  //Find the list of instances associated with each submesh
+  std::vector<std::vector<Matrix4x4d> > submeshTransforms(numGeometries);
+  uint32 geoinst_idx;
+  Matrix4x4f geoinst_pos_xform;
+  Meshdata::GeometryInstanceIterator geoinst_it = agg_mesh->getGeometryInstanceIterator();
+  while( geoinst_it.next(&geoinst_idx, &geoinst_pos_xform) ) {
+    const GeometryInstance& geomInstance = agg_mesh->instances[geoinst_idx];
+    Matrix4x4d transform;
+    for (int row=0; row<4; row++) {
+      for (int col=0; col<4; col++) {
+        transform(row,col) = geoinst_pos_xform(row,col);
       }
     }
+    submeshTransforms[geomInstance.geometryIndex].push_back(transform);
+  }
+
+  // Submeshes are processed largest first so one big submesh doesn't end up
+  // running alone at the end.
+  std::vector<uint64> submeshSizes(numGeometries, 0);
+  for (uint32 i = 0; i < numGeometries; i++) {
+    const SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
+    for (uint32 j = 0; j < curGeometry.primitives.size(); j++)
+      submeshSizes[i] += curGeometry.primitives[j].indices.size();
+  }
+  std::vector<uint32> order(numGeometries);
+  for (uint32 i = 0; i < numGeometries; i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), BySize(submeshSizes));
+
+  std::vector<SubmeshSimplifier> submeshes(numGeometries);
+  runOnSubmeshes(order, mNumThreads,
+      std::tr1::bind(&prepareSubmesh, &submeshes, agg_mesh, &submeshTransforms, _1));
 
+  int64 countFaces = 0;
+  for (uint32 i = 0; i < numGeometries; i++)
+    countFaces += (int64)submeshes[i].faceCount() * submeshes[i].instanceCount();
 
-    curGeometry.positions = positions;
-    curGeometry.normals = normals;
-    curGeometry.texUVs = texUVs;
+  SIMPLIFY_LOG(warn, "countFaces = " << countFaces);
+  SIMPLIFY_LOG(warn, "targetFaces = " << targetFaces);
+  if (targetFaces >= countFaces)
+    return;
+  SIMPLIFY_LOG(warn, "targetFaces < countFaces: Simplification needed");
+
+  runOnSubmeshes(order, mNumThreads,
+      std::tr1::bind(&computeSubmeshCollapses, &submeshes, _1));
+
+  // Take collapses from the submeshes cheapest first until there are few enough
+  // faces left. Collapses in one submesh don't affect the costs in others, so
+  // this picks the same collapses as a single queue over all submeshes would.
+  typedef std::pair<float64, uint32> NextCollapse;
+  std::priority_queue<NextCollapse, std::vector<NextCollapse>, std::greater<NextCollapse> > nextCollapses;
+  for (uint32 i = 0; i < numGeometries; i++) {
+    if (submeshes[i].numCollapses() > 0)
+      nextCollapses.push(NextCollapse(submeshes[i].collapse(0).mCost, i));
   }
 
-  //Now set the new indices.
-  for (uint32 i = 0; i < agg_mesh->geometry.size(); i++) {
-    SubMeshGeometry& curGeometry = agg_mesh->geometry[i];
+  std::vector<uint32> numCollapses(numGeometries, 0);
+  while (countFaces > targetFaces && !nextCollapses.empty()) {
+    uint32 i = nextCollapses.top().second;
+    nextCollapses.pop();
 
-    for (uint32 j = 0 ; j < curGeometry.primitives.size() ; j++) {
-      curGeometry.primitives[j].indices = newIndices[i][j];
-    }
+    countFaces -= (int64)submeshes[i].collapse(numCollapses[i]).mFacesRemoved * submeshes[i].instanceCount();
+    numCollapses[i]++;
+
+    if (numCollapses[i] < submeshes[i].numCollapses())
+      nextCollapses.push(NextCollapse(submeshes[i].collapse(numCollapses[i]).mCost, i));
   }
+
+  runOnSubmeshes(order, mNumThreads,
+      std::tr1::bind(&applySubmeshCollapses, &submeshes, &numCollapses, _1));
 }
 
 }
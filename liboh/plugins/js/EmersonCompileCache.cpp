@@ -0,0 +1,206 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "EmersonCompileCache.hpp"
+#include "JSLogging.hpp"
+#include <sirikata/core/util/Paths.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+namespace Sirikata {
+namespace JS {
+
+namespace {
+// Bump this whenever the on disk format changes or the compiler changes in a
+// way the version numbers won't reflect.
+const char* CACHE_FORMAT_VERSION = "1";
+const char* CACHE_FILE_MAGIC = "emersoncache";
+}
+
+EmersonCompileCache::EmersonCompileCache(const String& dir, uint32 max_memory_entries)
+ : mDir(dir),
+   mMaxMemoryEntries(std::max(max_memory_entries, (uint32)1))
+{
+}
+
+EmersonCompileCache::Key EmersonCompileCache::key(const String& em_source) {
+    // The compiler is built along with everything else, so the build's
+    // version and revision identify it.
+    static const String version =
+        String(CACHE_FORMAT_VERSION) + " " + SIRIKATA_VERSION + " " + SIRIKATA_GIT_REVISION;
+
+    String keyed;
+    keyed.reserve(version.size() + 1 + em_source.size());
+    keyed.append(version);
+    keyed.push_back('\0');
+    keyed.append(em_source);
+    return SHA256::computeDigest(keyed);
+}
+
+EmersonCompileCache::EntryPtr EmersonCompileCache::lookup(const Key& key) {
+    {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        MemoryMap::iterator it = mEntries.find(key);
+        if (it != mEntries.end()) {
+            mLRU.splice(mLRU.begin(), mLRU, it->second.lruPos);
+            mStats.memoryHits++;
+            return it->second.entry;
+        }
+    }
+
+    // Don't hold the lock while hitting the disk. If two threads race to load
+    // the same entry, both just insert the same data.
+    EntryPtr entry = readFromDisk(key);
+
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    if (entry) {
+        mStats.diskHits++;
+        insertInMemory(key, entry);
+    }
+    else {
+        mStats.misses++;
+    }
+    return entry;
+}
+
+void EmersonCompileCache::store(const Key& key, const String& js, const LineMap& line_map) {
+    Entry* raw_entry = new Entry();
+    raw_entry->js = js;
+    raw_entry->lineMap = line_map;
+    EntryPtr entry(raw_entry);
+
+    {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mStats.stores++;
+        insertInMemory(key, entry);
+    }
+
+    writeToDisk(key, *entry);
+}
+
+EmersonCompileCache::Stats EmersonCompileCache::stats() {
+    boost::lock_guard<boost::mutex> lck(mMutex);
+    return mStats;
+}
+
+void EmersonCompileCache::insertInMemory(const Key& key, EntryPtr entry) {
+    MemoryMap::iterator it = mEntries.find(key);
+    if (it != mEntries.end()) {
+        it->second.entry = entry;
+        mLRU.splice(mLRU.begin(), mLRU, it->second.lruPos);
+        return;
+    }
+
+    mLRU.push_front(key);
+    MemoryEntry& mem_entry = mEntries[key];
+    mem_entry.entry = entry;
+    mem_entry.lruPos = mLRU.begin();
+
+    while(mEntries.size() > mMaxMemoryEntries) {
+        mEntries.erase(mLRU.back());
+        mLRU.pop_back();
+    }
+}
+
+String EmersonCompileCache::pathFor(const Key& key) const {
+    // Spread entries over subdirectories so none of them grows too large
+    String hex = key.convertToHexString();
+    return (boost::filesystem::path(mDir) / hex.substr(0, 2) / (hex + ".js")).string();
+}
+
+EmersonCompileCache::EntryPtr EmersonCompileCache::readFromDisk(const Key& key) const {
+    if (mDir.empty()) return EntryPtr();
+
+    // Files look like:
+    //   emersoncache <format version>
+    //   <number of line map entries>
+    //   <js line> <emerson line>    (repeated)
+    //   <length of js>
+    //   <js>
+    std::ifstream fp(pathFor(key).c_str(), std::ios::in | std::ios::binary);
+    if (!fp) return EntryPtr();
+
+    String magic, version;
+    fp >> magic >> version;
+    if (!fp || magic != CACHE_FILE_MAGIC || version != CACHE_FORMAT_VERSION)
+        return EntryPtr();
+
+    Entry* entry = new Entry();
+    EntryPtr result(entry);
+
+    uint32 nlines = 0;
+    fp >> nlines;
+    for(uint32 i = 0; i < nlines && fp; i++) {
+        int js_line, em_line;
+        fp >> js_line >> em_line;
+        entry->lineMap[js_line] = em_line;
+    }
+
+    uint32 js_size = 0;
+    fp >> js_size;
+    // Skip the newline ending the size
+    fp.get();
+    if (!fp) return EntryPtr();
+
+    entry->js.resize(js_size);
+    if (js_size > 0)
+        fp.read(&(entry->js[0]), js_size);
+    if ((uint32)fp.gcount() != js_size && js_size > 0) {
+        JSLOG(detailed, "Ignoring truncated compile cache entry " << pathFor(key));
+        return EntryPtr();
+    }
+
+    return result;
+}
+
+void EmersonCompileCache::writeToDisk(const Key& key, const Entry& entry) const {
+    if (mDir.empty()) return;
+
+    boost::filesystem::path final_path(pathFor(key));
+    // The temporary file is in the same directory as the final one so the
+    // rename can't cross file systems and is atomic.
+    boost::filesystem::path temp_path = final_path.parent_path() / Path::GetTempFilename("emerson-compile-cache");
+
+    try {
+        boost::filesystem::create_directories(final_path.parent_path());
+    } catch (boost::filesystem::filesystem_error) {
+        JSLOG(detailed, "Unable to create compile cache directory " << final_path.parent_path().string());
+        return;
+    }
+
+    bool written = false;
+    {
+        std::ofstream fp(temp_path.string().c_str(), std::ios::out | std::ios::binary);
+        if (fp) {
+            fp << CACHE_FILE_MAGIC << ' ' << CACHE_FORMAT_VERSION << '\n';
+            fp << entry.lineMap.size() << '\n';
+            for(LineMap::const_iterator it = entry.lineMap.begin(); it != entry.lineMap.end(); it++)
+                fp << it->first << ' ' << it->second << '\n';
+            fp << entry.js.size() << '\n';
+            fp.write(entry.js.data(), entry.js.size());
+            written = fp.good();
+        }
+    }
+
+    try {
+        if (written)
+            boost::filesystem::rename(temp_path, final_path);
+        else
+            JSLOG(detailed, "Unable to write compile cache entry " << temp_path.string());
+    } catch (boost::filesystem::filesystem_error) {
+        // Some platforms won't rename over an existing file. Either way,
+        // another writer already stored the same content.
+        written = false;
+    }
+
+    if (!written) {
+        try {
+            boost::filesystem::remove(temp_path);
+        } catch (boost::filesystem::filesystem_error) {
+        }
+    }
+}
+
+} // namespace JS
+} // namespace Sirikata
@@ -0,0 +1,98 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_JS_EMERSON_COMPILE_CACHE_HPP_
+#define _SIRIKATA_JS_EMERSON_COMPILE_CACHE_HPP_
+
+#include <sirikata/oh/Platform.hpp>
+#include <sirikata/core/util/Sha256.hpp>
+#include <sirikata/core/util/Noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <list>
+
+namespace Sirikata {
+namespace JS {
+
+/** Caches the JavaScript the Emerson compiler generates, keyed by a hash of
+ *  the Emerson source and the compiler version. Because entries are addressed
+ *  by content, the same library imported from different paths, by different
+ *  scripts or by different object hosts all share one entry, and there's no
+ *  need to check modification times: changing the source or upgrading the
+ *  compiler just produces a different key.
+ *
+ *  Recently used entries are kept in memory, with least recently used ones
+ *  evicted past a fixed count. Every entry is also written to a directory on
+ *  disk, which may be shared by any number of object host processes. Files are
+ *  written to a temporary name and renamed into place, so readers never see a
+ *  partial entry.
+ *
+ *  Safe to use from multiple threads.
+ */
+class EmersonCompileCache : Noncopyable {
+public:
+    typedef SHA256 Key;
+    // The same as EmersonLineMap, which we avoid to keep ANTLR out of this
+    // header: maps generated JS lines to Emerson source lines.
+    typedef std::map<int, int> LineMap;
+
+    struct Entry {
+        String js;
+        LineMap lineMap;
+    };
+    typedef std::tr1::shared_ptr<const Entry> EntryPtr;
+
+    struct Stats {
+        Stats() : memoryHits(0), diskHits(0), misses(0), stores(0) {}
+        uint64 memoryHits;
+        uint64 diskHits;
+        uint64 misses;
+        uint64 stores;
+    };
+
+    /** \param dir directory for on disk entries, or empty to only cache in
+     *         memory
+     *  \param max_memory_entries number of entries to keep in memory
+     */
+    EmersonCompileCache(const String& dir, uint32 max_memory_entries);
+
+    // Get the key for a piece of Emerson source
+    static Key key(const String& em_source);
+
+    // Look up compiled JS, first in memory and then on disk. Returns an empty
+    // pointer on a miss.
+    EntryPtr lookup(const Key& key);
+    // Store newly compiled JS, in memory and on disk.
+    void store(const Key& key, const String& js, const LineMap& line_map);
+
+    Stats stats();
+
+private:
+    String pathFor(const Key& key) const;
+    EntryPtr readFromDisk(const Key& key) const;
+    void writeToDisk(const Key& key, const Entry& entry) const;
+    // Must be called with mMutex held
+    void insertInMemory(const Key& key, EntryPtr entry);
+
+    const String mDir;
+    const uint32 mMaxMemoryEntries;
+
+    typedef std::list<Key> LRUList;
+    struct MemoryEntry {
+        EntryPtr entry;
+        LRUList::iterator lruPos;
+    };
+    typedef std::tr1::unordered_map<Key, MemoryEntry, Key::Hasher> MemoryMap;
+
+    boost::mutex mMutex;
+    MemoryMap mEntries;
+    // Most recently used at the front
+    LRUList mLRU;
+    Stats mStats;
+};
+
+} // namespace JS
+} // namespace Sirikata
+
+#endif //_SIRIKATA_JS_EMERSON_COMPILE_CACHE_HPP_
@@ -1171,21 +1171,26 @@ void EmersonScript::iHandleScriptCommRead(
 
     Sirikata::JS::Protocol::JSMessage jsMsg;
     Sirikata::JS::Protocol::JSFieldValue jsFieldVal;
-    bool isJSMsg   = jsMsg.ParseFromString(payload);
-    if (! isJSMsg)
-        isJSMsg = jsMsg.ParseFromArray(payload.data(),payload.size());
-
+    bool isBinary = JSSerializer::isBinaryMessage(payload);
+    bool isJSMsg = false;
     bool isJSField = false;
-    if (!isJSMsg)
+    if (!isBinary)
     {
-        isJSField = jsFieldVal.ParseFromString(payload);
-        if (!isJSField)
-            isJSField = jsFieldVal.ParseFromArray(payload.data(), payload.size());
+        isJSMsg = jsMsg.ParseFromString(payload);
+        if (! isJSMsg)
+            isJSMsg = jsMsg.ParseFromArray(payload.data(),payload.size());
+
+        if (!isJSMsg)
+        {
+            isJSField = jsFieldVal.ParseFromString(payload);
+            if (!isJSField)
+                isJSField = jsFieldVal.ParseFromArray(payload.data(), payload.size());
+        }
     }
 
-    //if can't decode the payload as a jsmessage or
+    //if can't decode the payload as a binary message, a jsmessage or
     //a jsfieldval, then return false;
-    if (!(isJSMsg || isJSField))
+    if (!(isBinary || isJSMsg || isJSField))
         return;
 
     if (isStopped()) {
@@ -1238,7 +1243,12 @@ void EmersonScript::iHandleScriptCommRead(
             std::vector< v8::Persistent<v8::Object> > visiblesToMakeWeak;
 
             v8::Handle<v8::Value> msgVal;
-            if (isJSMsg)
+            if (isBinary)
+            {
+                msgVal = JSSerializer::deserializeBinary(this, payload,
+                    deserializeWorks);
+            }
+            else if (isJSMsg)
             {
                 //try to decode as object.
                 msgVal = JSSerializer::deserializeObject( this, jsMsg,
@@ -1395,21 +1405,26 @@ void EmersonScript::processSandboxMessage(
     Sirikata::JS::Protocol::JSMessage jsMsg;
     Sirikata::JS::Protocol::JSFieldValue jsFieldVal;
 
-    bool isJSMsg   = jsMsg.ParseFromString(payload);
-    if (! isJSMsg)
-        isJSMsg = jsMsg.ParseFromArray(payload.data(),payload.size());
-
+    bool isBinary = JSSerializer::isBinaryMessage(payload);
+    bool isJSMsg = false;
     bool isJSField = false;
-    if (!isJSMsg)
+    if (!isBinary)
     {
-        isJSField = jsFieldVal.ParseFromString(payload);
-        if (!isJSField)
-            isJSField = jsFieldVal.ParseFromArray(payload.data(), payload.size());
+        isJSMsg = jsMsg.ParseFromString(payload);
+        if (! isJSMsg)
+            isJSMsg = jsMsg.ParseFromArray(payload.data(),payload.size());
+
+        if (!isJSMsg)
+        {
+            isJSField = jsFieldVal.ParseFromString(payload);
+            if (!isJSField)
+                isJSField = jsFieldVal.ParseFromArray(payload.data(), payload.size());
+        }
     }
 
-    //if can't decode the payload as a jsmessage or
+    //if can't decode the payload as a binary message, a jsmessage or
     //a jsfieldval, then return false;
-    if (!(isJSMsg || isJSField))
+    if (!(isBinary || isJSMsg || isJSField))
         return;
 
 
@@ -1422,7 +1437,12 @@ void EmersonScript::processSandboxMessage(
 
     bool deserializeWorks = false;
     v8::Handle<v8::Value> msgVal;
-    if (isJSMsg)
+    if (isBinary)
+    {
+        msgVal = JSSerializer::deserializeBinary(this, payload,
+            deserializeWorks);
+    }
+    else if (isJSMsg)
     {
         //try to decode as object.
         msgVal = JSSerializer::deserializeObject( this, jsMsg,
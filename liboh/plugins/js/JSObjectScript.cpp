@@ -37,6 +37,7 @@
 #include "JSObjectScript.hpp"
 #include "JSLogging.hpp"
 #include "JSObjectScriptManager.hpp"
+#include "EmersonCompileCache.hpp"
 
 #include "JSSerializer.hpp"
 #include <string>
@@ -1356,7 +1357,7 @@ v8::Handle<v8::Context> JSObjectScript::getCurrentV8Context()
 
 
 
-v8::Handle<v8::Value> JSObjectScript::internalEval(const String& em_script_str, v8::ScriptOrigin* em_script_name, bool is_emerson, bool return_exc, const String& cache_path)
+v8::Handle<v8::Value> JSObjectScript::internalEval(const String& em_script_str, v8::ScriptOrigin* em_script_name, bool is_emerson, bool return_exc, bool cache_compiled)
 {
     JSSCRIPT_SERIAL_CHECK();
     v8::HandleScope handle_scope;
@@ -1392,7 +1393,21 @@ v8::Handle<v8::Value> JSObjectScript::internalEval(const String& em_script_str,
 
         JSLOG(insane, " Input Emerson script = \n" <<em_script_str_new);
 
-        try {
+        EmersonCompileCache* compile_cache =
+            (cache_compiled && mManager != NULL) ? mManager->compileCache() : NULL;
+        EmersonCompileCache::Key cache_key;
+        EmersonCompileCache::EntryPtr cached;
+        if (compile_cache != NULL) {
+            cache_key = EmersonCompileCache::key(em_script_str_new);
+            cached = compile_cache->lookup(cache_key);
+        }
+
+        if (cached) {
+            JSLOG(insane, " Using cached compiled JS script = \n" << cached->js);
+            source = v8::String::New(cached->js.c_str(), cached->js.size());
+            lineMap = cached->lineMap;
+        }
+        else try {
             int em_compile_err = 0;
             v8::String::Utf8Value parent_script_name(em_script_name->ResourceName());
 
@@ -1408,40 +1423,8 @@ v8::Handle<v8::Value> JSObjectScript::internalEval(const String& em_script_str,
                 JSLOG(insane, " Compiled JS script = \n" <<js_script_str);
                 source = v8::String::New(js_script_str.c_str());
 
-                // Save the compiled file as a cache
-                if (!cache_path.empty()) {
-                    // This needs to be atomic -- dump in a temp file and then
-                    // rename it.
-                    String temp_cache_path = Path::Get(Path::DIR_TEMP, Path::GetTempFilename("emerson-js-cache"));
-                    bool copied = false;
-                    {
-                        std::stringstream js_script_stream(js_script_str);
-                        std::ofstream temp_cache_file(temp_cache_path.c_str());
-                        if (temp_cache_file.fail()) {
-                          JSLOG(detailed, "Unable to create temporary file to save compiled emerson: " << temp_cache_path);
-                        }
-                        else {
-                            std::streamsize ncopied = boost::iostreams::copy(js_script_stream, temp_cache_file);
-                            if (ncopied == (std::streamsize)js_script_str.size()) copied = true;
-                        }
-                    }
-                    // And finally try to rename. We wrap this in
-                    // try/catch because either one could throw an
-                    // exception (permissions errors, someone else got
-                    // a file in there between our remove and rename,
-                    // etc).
-                    if (copied) {
-                        try {
-                            // Make sure we have the directories
-                            boost::filesystem::create_directories( boost::filesystem::path(cache_path).parent_path() );
-                            boost::filesystem::remove(cache_path);
-                            boost::filesystem::rename(temp_cache_path, cache_path);
-                        } catch (boost::filesystem::filesystem_error) {
-                            // Just give up, somebody else has cached it
-                            // or we're just not going to be able to.
-                        }
-                    }
-                }
+                if (compile_cache != NULL)
+                    compile_cache->store(cache_key, js_script_str, lineMap);
             }
             else
             {
@@ -1520,11 +1503,11 @@ v8::Handle<v8::Value> JSObjectScript::internalEval(const String& em_script_str,
 
 
 
-v8::Handle<v8::Value> JSObjectScript::protectedEval(const String& em_script_str, v8::ScriptOrigin* em_script_name, const EvalContext& new_ctx, bool return_exc, const String& cache_path, bool isJS)
+v8::Handle<v8::Value> JSObjectScript::protectedEval(const String& em_script_str, v8::ScriptOrigin* em_script_name, const EvalContext& new_ctx, bool return_exc, bool cache_compiled, bool isJS)
 {
     JSSCRIPT_SERIAL_CHECK();
     ScopedEvalContext sec(this, new_ctx);
-    return internalEval(em_script_str, em_script_name, !isJS, return_exc, cache_path);
+    return internalEval(em_script_str, em_script_name, !isJS, return_exc, cache_compiled);
 }
 
 
@@ -1833,57 +1816,17 @@ v8::Handle<v8::Value> JSObjectScript::absoluteImport(const boost::filesystem::pa
 
     JSLOG(detailed, " Performing import on absolute path: " << full_filename.string());
 
-    // Now try to read in and run the file. We want to avoid having to compile
-    // the file, so we use a cache of precompiled versions of the file
-    // if it's not javascript.
-    //
-    // We try to read both files, but we try the cached file first. That way,
-    // the worst that happens if the file gets replaced/updated is that we read
-    // the cached version before and the mtimes will cause us to ignore the
-    // cached script.
-    //
-    // The location of the cached file needs to be handled carefully. We place
-    // the cache under a temporary directory, isolate these files in their own
-    // subdirectory, "emerson_cache", and we use an *absolute* path (with the
-    // root path, e.g. / or C:/, removed) to generate the location within that
-    // directory, ensuring that there aren't any conflicts due to multiple
-    // import base paths.
-    boost::filesystem::path cache_dir(Path::Get(Path::DIR_TEMP, "emerson_cache"));
-    String cached_js_file =
-        (cache_dir /
-            boost::filesystem::complete(full_filename.parent_path()).relative_path() /
-            (full_filename.filename()
-#if BOOST_FILESYSTEM_VERSION>=3
-             .string()
-#endif
-             + ".js.cache")).string();
-    String cached_contents;
-    int64 cached_mtime;
-    bool got_cached_js = false;
-    // Only actually try to get the cached version if its not JS
-    if (!isJS)
-        got_cached_js = read_file_contents(cached_js_file, cached_contents, &cached_mtime);
-    // Grab the original. TODO(ewencp) We could probably avoid actually reading
-    // the file by allowing read_file_contents to bail early when the cache
-    // validity check passes, but its not worth bothering with right now since
-    // these scripts are relatively small and it makes read_file_contents more
-    // complicated.
+    // Now try to read in and run the file. Imports are where the same Emerson
+    // gets compiled over and over (every object imports std/library.em), so
+    // ask for the compiled code to be cached. The cache is keyed by the
+    // contents of the file, so it doesn't matter which path it was imported
+    // from or whether it changed since it was last compiled.
     std::string contents;
     int64 source_mtime;
     bool read_success = read_file_contents(full_filename.string(), contents, &source_mtime);
     if (!read_success)
         return v8::ThrowException( v8::Exception::Error(v8::String::New("Couldn't open file for import.")) );
 
-    // If we did get valid cached data, set thin
-    if (got_cached_js && cached_mtime > source_mtime) {
-        // Make the contents we execute the cached JS
-        contents = cached_contents;
-        // Cached data is JS, no need to recompile
-        isJS = true;
-        // And don't try to re-cache data we got out of the cache
-        cached_js_file = "";
-    }
-
     // Setup eval context information
     EvalContext& ctx = mEvalContextStack.top();
     EvalContext new_ctx(ctx);
@@ -1895,7 +1838,7 @@ v8::Handle<v8::Value> JSObjectScript::absoluteImport(const boost::filesystem::pa
     mImportedFiles[jscont->getContextID()].insert( full_filename.string() );
 
     // Eval
-    v8::Handle<v8::Value> returner = protectedEval(contents, &origin, new_ctx, false, cached_js_file, isJS);
+    v8::Handle<v8::Value> returner = protectedEval(contents, &origin, new_ctx, false, !isJS, isJS);
     return  handle_scope.Close(returner);
 }
 
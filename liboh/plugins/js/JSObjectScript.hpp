@@ -372,7 +372,7 @@ protected:
     // code but which should report errors to the user.
     void printExceptionToScript(const String& exc);
 
-    v8::Handle<v8::Value> protectedEval(const String& em_script_str, v8::ScriptOrigin* em_script_name, const EvalContext& new_ctx, bool return_exc = false, const String& cache_path = "", bool isJS=false);
+    v8::Handle<v8::Value> protectedEval(const String& em_script_str, v8::ScriptOrigin* em_script_name, const EvalContext& new_ctx, bool return_exc = false, bool cache_compiled = false, bool isJS=false);
 
 
     // is_emerson controls whether this is compiled as emerson or
@@ -384,8 +384,10 @@ protected:
     //         necessary if there is no JS caller higher on the
     //         stack. Otherwise, V8 gets stuck with an uncaught
     //         exception and fails on future V8 calls.
-    // \param cache_path if non-empty, cache compiled results to the given file
-    v8::Handle<v8::Value> internalEval( const String& em_script_str, v8::ScriptOrigin* em_script_name, bool is_emerson, bool return_exc = false, const String& cache_path = "");
+    // \param cache_compiled if true, look for the compiled Emerson in the
+    //        manager's compile cache and add it there after compiling. Only
+    //        worth it for code that gets evaluated repeatedly, like imports.
+    v8::Handle<v8::Value> internalEval( const String& em_script_str, v8::ScriptOrigin* em_script_name, bool is_emerson, bool return_exc = false, bool cache_compiled = false);
 
 
     //Takes the context from the top value of context stack and returns it.  If
@@ -43,6 +43,7 @@
 #include "JSObjects/JSUtilObj.hpp"
 #include "JSObjects/JSTimer.hpp"
 #include "JSSerializer.hpp"
+#include "EmersonCompileCache.hpp"
 
 
 #include "JSObjects/JSPresence.hpp"
@@ -82,7 +83,8 @@ JSObjectScriptManager::JSObjectScriptManager(ObjectHostContext* ctx, const Sirik
    mParsingWork(NULL),
    mParsingThread(NULL),
    mModelParser(NULL),
-   mModelFilter(NULL)
+   mModelFilter(NULL),
+   mCompileCache(NULL)
 {
     // In emheadless we run without an ObjectHostContext
     if (mContext != NULL) {
@@ -114,6 +116,9 @@ JSObjectScriptManager::JSObjectScriptManager(ObjectHostContext* ctx, const Sirik
     OptionValue* import_paths;
     OptionValue* v8_flags_opt;
     OptionValue* emer_resource_max;
+    OptionValue* binary_messages;
+    OptionValue* compile_cache_dir;
+    OptionValue* compile_cache_entries;
     InitializeClassOptions(
         "jsobjectscriptmanager",this,
         // Default value allows us to use std libs in the build tree, starting
@@ -133,12 +138,22 @@ JSObjectScriptManager::JSObjectScriptManager(ObjectHostContext* ctx, const Sirik
         import_paths = new OptionValue("import-paths","",OptionValueType<std::list<String> >(),"Comma separated list of paths to import files from, searched in order for the requested import."),
         v8_flags_opt = new OptionValue("v8-flags", "", OptionValueType<String>(), "Flags to pass on to v8, e.g. for profiling."),
         emer_resource_max = new OptionValue("emer-resource-max","100000000",OptionValueType<int>(),"int32: how many cycles to allow to run in one pass of event loop before throwing resource error in Emerson."),
+        binary_messages = new OptionValue("binary-messages","true",OptionValueType<bool>(),"If true, serialize messages with the compact binary encoding.  Set to false when talking to object hosts which only understand the PBJ encoding.  Both encodings are always accepted."),
+        compile_cache_dir = new OptionValue("compile-cache-dir", Path::Placeholders::DIR_TEMP + "/emerson_compile_cache", OptionValueType<String>(), "Directory to cache compiled Emerson in, shared by all object hosts using it. If empty, compiled Emerson is only cached in memory."),
+        compile_cache_entries = new OptionValue("compile-cache-entries", "512", OptionValueType<uint32>(), "Number of compiled Emerson scripts to keep in memory."),
         NULL
     );
 
     mOptions = OptionSet::getOptions("jsobjectscriptmanager",this);
     mOptions->parse(arguments);
 
+    JSSerializer::setBinaryEncoding(binary_messages->as<bool>());
+
+    String cache_dir = compile_cache_dir->as<String>();
+    if (!cache_dir.empty())
+        cache_dir = Path::SubstitutePlaceholders(cache_dir);
+    mCompileCache = new EmersonCompileCache(cache_dir, compile_cache_entries->as<uint32>());
+
     String v8_flags = v8_flags_opt->as<String>();
     if (!v8_flags.empty()) {
         v8::V8::SetFlagsFromString(v8_flags.c_str(), v8_flags.size());
@@ -660,6 +675,8 @@ JSObjectScriptManager::~JSObjectScriptManager()
         delete mModelFilter;
         delete mModelParser;
     }
+
+    delete mCompileCache;
 }
 
 
@@ -54,6 +54,7 @@ namespace JS {
 
 class JSObjectScript;
 class JSCtx;
+class EmersonCompileCache;
 class SIRIKATA_SCRIPTING_JS_EXPORT JSObjectScriptManager
     : public ObjectScriptManager,
       public Mesh::ParserService
@@ -71,6 +72,9 @@ public:
 
     OptionSet* getOptions() const { return mOptions; }
 
+    // Compiled Emerson, shared by all scripts
+    EmersonCompileCache* compileCache() const { return mCompileCache; }
+
 
 
 
@@ -124,6 +128,8 @@ private:
     ModelsSystem* mModelParser;
     Mesh::Filter* mModelFilter;
 
+    EmersonCompileCache* mCompileCache;
+
     // ParserService Implementation
     virtual Mesh::ParseMeshTaskHandle parseMesh(const Transfer::RemoteFileMetadata& metadata, const Transfer::Fingerprint& fp, Transfer::DenseDataPtr data, bool isAggregate, ParseMeshCallback cb);
 
@@ -515,6 +515,17 @@ v8::Handle<v8::Value> JSContextStruct::deserialize(const String& toDeserialize)
     CHECK_EMERSON_SCRIPT_ERROR(emerScript,deserialize,jsObjScript);
 
 
+    if (JSSerializer::isBinaryMessage(toDeserialize))
+    {
+        bool deserializedSuccess = false;
+        v8::Handle<v8::Value> returner = JSSerializer::deserializeBinary(emerScript, toDeserialize, deserializedSuccess);
+
+        if (!deserializedSuccess)
+            return v8::ThrowException( v8::Exception::Error(v8::String::New("Error could not deserialize object")));
+
+        return handle_scope.Close(returner);
+    }
+
     Sirikata::JS::Protocol::JSMessage js_msg;
     bool parsed = js_msg.ParseFromString(toDeserialize);
 
@@ -153,6 +153,9 @@ void JSSerializer::serializePresence(v8::Local<v8::Object> jsPresence, Sirikata:
 
 std::string JSSerializer::serializeMessage(v8::Local<v8::Value> v8Val, int32 toStamp)
 {
+    if (sBinaryEncoding)
+        return serializeBinary(v8Val);
+
     ObjectVec allObjs;
     Sirikata::JS::Protocol::JSFieldValue jsfield;
     v8::HandleScope handleScope;
@@ -283,6 +286,40 @@ std::vector<String> getOwnPropertyNames(v8::Local<v8::Object> obj) {
 }
 
 
+//Returns true if v8Obj is one of our native objects (visible, presence,
+//system), which are serialized specially, filling in typeIdString with its type
+//if it has one.
+bool getInternalTypeId(v8::Handle<v8::Object> v8Obj, std::string& typeIdString)
+{
+    if (v8Obj->InternalFieldCount() <= 0)
+        return false;
+
+    v8::Local<v8::Value> typeidVal = v8Obj->GetInternalField(TYPEID_FIELD);
+    if (typeidVal.IsEmpty() || typeidVal->IsNull() || typeidVal->IsUndefined())
+        return false;
+
+    v8::Local<v8::External> wrapped  = v8::Local<v8::External>::Cast(typeidVal);
+    std::string* typeId = static_cast<std::string*>(wrapped->Value());
+    if (typeId != NULL)
+        typeIdString = *typeId;
+    return true;
+}
+
+//Filters out fields which refer to native code.  See comment in
+//serializeObjectInternal.
+bool isNativeFunction(v8::Handle<v8::Value> prop_val)
+{
+    if (!prop_val->IsFunction())
+        return false;
+
+    v8::Local<v8::Function> v8Func = v8::Local<v8::Function>::Cast(prop_val);
+    INLINE_STR_CONV(v8Func->ToString(),cStrMsgBody2, "error decoding string in isNativeFunction");
+
+    return ((cStrMsgBody2.find("{ [native code] }") != String::npos) &&
+        (cStrMsgBody2 != FUNCTION_CONSTRUCTOR_TEXT));
+}
+
+
 void JSSerializer::annotateObject(ObjectVec& objVec, v8::Handle<v8::Object> v8Obj,int32 toStampWith)
 {
     //don't annotate any of the special objects that we have.  Can't form loops
@@ -313,34 +350,22 @@ void JSSerializer::serializeObjectInternal(v8::Local<v8::Value> v8Val, Sirikata:
     }
 
 
-    if(v8Obj->InternalFieldCount() > 0)
+    std::string typeIdString;
+    if (getInternalTypeId(v8Obj, typeIdString))
     {
-        v8::Local<v8::Value> typeidVal = v8Obj->GetInternalField(TYPEID_FIELD);
-        if (!typeidVal.IsEmpty())
+        if (typeIdString == VISIBLE_TYPEID_STRING)
         {
-            if(!typeidVal->IsNull() && !typeidVal->IsUndefined())
-            {
-                v8::Local<v8::External> wrapped  = v8::Local<v8::External>::Cast(typeidVal);
-                void* ptr = wrapped->Value();
-                std::string* typeId = static_cast<std::string*>(ptr);
-                if(typeId == NULL) return;
-
-                std::string typeIdString = *typeId;
-                if (typeIdString == VISIBLE_TYPEID_STRING)
-                {
-                    serializeVisible(v8Obj, jsmessage,toStampWith,objVec);
-                }
-                else if (typeIdString == SYSTEM_TYPEID_STRING)
-                {
-                    serializeSystem(v8Obj, jsmessage,toStampWith,objVec);
-                }
-                else if (typeIdString == PRESENCE_TYPEID_STRING)
-                {
-                    serializePresence(v8Obj, jsmessage,toStampWith,objVec);
-                }
-                return;
-            }
+            serializeVisible(v8Obj, jsmessage,toStampWith,objVec);
+        }
+        else if (typeIdString == SYSTEM_TYPEID_STRING)
+        {
+            serializeSystem(v8Obj, jsmessage,toStampWith,objVec);
+        }
+        else if (typeIdString == PRESENCE_TYPEID_STRING)
+        {
+            serializePresence(v8Obj, jsmessage,toStampWith,objVec);
         }
+        return;
     }
 
 
@@ -369,17 +394,8 @@ void JSSerializer::serializeObjectInternal(v8::Local<v8::Value> v8Val, Sirikata:
          * this would be seamless (e.g. vec3) and sometimes would require
          * 'simplification' (e.g. Presence).
          */
-        if(prop_val->IsFunction())
-        {
-            v8::Local<v8::Function> v8Func = v8::Local<v8::Function>::Cast(prop_val);
-            INLINE_STR_CONV(v8Func->ToString(),cStrMsgBody2, "error decoding string in serializeObjectInternal");
-
-            if ((cStrMsgBody2.find("{ [native code] }") != String::npos) &&
-                (cStrMsgBody2 != FUNCTION_CONSTRUCTOR_TEXT))
-            {
-                continue;
-            }
-        }
+        if (isNativeFunction(prop_val))
+            continue;
 
         Sirikata::JS::Protocol::IJSField jsf = jsmessage.add_fields();
         Sirikata::JS::Protocol::IJSFieldValue jsf_value = jsf.mutable_value();
@@ -771,6 +787,25 @@ bool JSSerializer::deserializeObjectInternal( EmersonScript* emerScript, Sirikat
 }
 
 
+//Recreates a serialized function from its text.  Function constructors are
+//native code, so they have to be looked up instead.
+v8::Handle<v8::Function> JSSerializer::functionFromText(EmersonScript* emerScript, const String& funcText)
+{
+    if (funcText != FUNCTION_CONSTRUCTOR_TEXT)
+        return emerScript->functionValue(funcText);
+
+    v8::Local<v8::Function> tmpFun = emerScript->functionValue("function(){}");
+    if ((tmpFun->Has(v8::String::New("constructor"))) &&
+        (tmpFun->Get(v8::String::New("constructor"))->IsFunction()))
+    {
+        return v8::Handle<v8::Function>::Cast(tmpFun->Get(v8::String::New("constructor")));
+    }
+
+    JSLOG(error, "Error setting the constructor of an object.  Setting to dummy constructor.");
+    return tmpFun;
+}
+
+
 //Note: can return val where val.IsEmpty is true, which means that we should
 //treat this val as a looped pointer.  In this case, returns id to loop to in toLoopTo.
 v8::Handle<v8::Value> JSSerializer::deserializeFieldValue(EmersonScript* emerScript,
@@ -808,23 +843,7 @@ v8::Handle<v8::Value> JSSerializer::deserializeFieldValue(EmersonScript* emerScr
         //we're dealing with a function
         if (internal_js_message.has_f_value())
         {
-            v8::Handle<v8::Function>intFuncObj;
-            if (internal_js_message.f_value() == FUNCTION_CONSTRUCTOR_TEXT)
-            {
-                v8::Local<v8::Function> tmpFun = emerScript->functionValue("function(){}");
-                if ((tmpFun->Has(v8::String::New("constructor"))) &&
-                    (tmpFun->Get(v8::String::New("constructor"))->IsFunction()))
-                {
-                    intFuncObj = v8::Handle<v8::Function>::Cast(tmpFun->Get(v8::String::New("constructor")));
-                }
-                else
-                {
-                    JSLOG(error, "Error setting the constructor of an object.  Setting to dummy constructor.");
-                    intFuncObj = tmpFun;
-                }
-            }
-            else
-                intFuncObj = emerScript->functionValue(internal_js_message.f_value());
+            v8::Handle<v8::Function>intFuncObj = functionFromText(emerScript, internal_js_message.f_value());
 
             v8::Handle<v8::Object> tmpObjer = v8::Handle<v8::Object>::Cast(intFuncObj);
             JSSerializer::deserializeObjectInternal(emerScript, internal_js_message, tmpObjer,labeledObjs,toFixUp);
@@ -880,5 +899,668 @@ v8::Handle<v8::Value> JSSerializer::deserializeFieldValue(EmersonScript* emerScr
 }
 
 
+
+/*
+  Binary encoding
+
+  A message is the marker byte and version, followed by a single value.  Each
+  value starts with a one byte tag.  Integers are written as varints (int32s
+  zigzag encoded first), doubles as their 8 byte IEEE representation (little
+  endian), and strings as a varint length followed by their UTF-8 bytes.
+
+  Objects, arrays, functions and the root object are written as a shape
+  followed by the value of each field in the shape.  A shape is the list of
+  field names in an object.  The first time a shape is used it is written out
+  in full, preceded by a 0, and after that it's referred to by its index + 1.
+  Messages frequently contain many objects with the same layout, e.g. arrays of
+  vectors, so this saves both writing and parsing the names again.
+
+  Every object-like value is numbered in the order it's first written, and
+  later references to it are written as a BinaryBackRef to that number.  This
+  handles both shared objects and cycles.
+ */
+namespace {
+
+enum BinaryTag {
+    BinaryUndefined = 1,
+    BinaryNull,
+    BinaryTrue,
+    BinaryFalse,
+    BinaryInt32,
+    BinaryUint32,
+    BinaryDouble,
+    BinaryString,
+    BinaryObject,
+    BinaryArray,
+    // Function text, then its shape and fields unless it's the Function
+    // constructor
+    BinaryFunction,
+    // The Object prototype.  It's restored as a new object with the same
+    // fields rather than modifying the receiver's Object prototype.
+    BinaryRootObject,
+    BinaryBackRef,
+    // A visible or presence, written as its SpaceObjectReference
+    BinaryVisible,
+    BinarySystem
+};
+
+uint64 doubleToBits(float64 val)
+{
+    uint64 bits;
+    memcpy(&bits, &val, sizeof(bits));
+    return bits;
+}
+
+float64 bitsToDouble(uint64 bits)
+{
+    float64 val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+} // namespace
+
+
+class JSSerializer::BinaryEncoder
+{
+public:
+    BinaryEncoder()
+    {
+        mBuffer.reserve(InitialBufferSize);
+        writeByte(JSSERIALIZER_BINARY_MARKER);
+        writeByte(JSSERIALIZER_BINARY_VERSION);
+        mRootObject = v8::Object::New()->GetPrototype();
+    }
+
+    String& buffer() { return mBuffer; }
+
+    void encodeValue(v8::Handle<v8::Value> val)
+    {
+        if (val->IsFunction())
+        {
+            v8::Handle<v8::Object> v8Obj = val->ToObject();
+            if (writeBackReference(v8Obj))
+                return;
+
+            INLINE_STR_CONV(v8::Handle<v8::Function>::Cast(v8Obj)->ToString(), funcTextStr, "error decoding string when serializing function.");
+            writeByte(BinaryFunction);
+            writeString(funcTextStr);
+            if (funcTextStr != FUNCTION_CONSTRUCTOR_TEXT)
+                encodeFields(v8Obj);
+        }
+        else if (val->IsArray())
+        {
+            v8::Handle<v8::Object> v8Obj = val->ToObject();
+            if (writeBackReference(v8Obj))
+                return;
+            writeByte(BinaryArray);
+            encodeFields(v8Obj);
+        }
+        else if (val->IsNull())
+            writeByte(BinaryNull);
+        else if (val->IsUndefined())
+            writeByte(BinaryUndefined);
+        else if (val->IsObject())
+        {
+            v8::Handle<v8::Object> v8Obj = val->ToObject();
+            if (writeBackReference(v8Obj))
+                return;
+
+            if (val->Equals(mRootObject))
+            {
+                writeByte(BinaryRootObject);
+                encodeFields(v8Obj);
+            }
+            else
+                encodeObject(v8Obj);
+        }
+        else if (val->IsInt32())
+        {
+            int32 i_value = val->Int32Value();
+            writeByte(BinaryInt32);
+            writeVarint(((uint32)i_value << 1) ^ (uint32)(i_value >> 31));
+        }
+        else if (val->IsUint32())
+        {
+            writeByte(BinaryUint32);
+            writeVarint(val->Uint32Value());
+        }
+        else if (val->IsString())
+        {
+            writeByte(BinaryString);
+            writeString(v8::Handle<v8::String>::Cast(val));
+        }
+        else if (val->IsNumber())
+        {
+            writeByte(BinaryDouble);
+            uint64 bits = doubleToBits(val->NumberValue());
+            for(int i = 0; i < 8; i++)
+                writeByte((uint8)(bits >> (8*i)));
+        }
+        else if (val->IsBoolean())
+            writeByte(val->BooleanValue() ? BinaryTrue : BinaryFalse);
+        else
+        {
+            // The PBJ encoding leaves values it can't handle empty, which
+            // deserialize as undefined.
+            JSLOG(error, "Unhandled type of value in binary serialization, sending undefined.");
+            writeByte(BinaryUndefined);
+        }
+    }
+
+private:
+    enum {
+        InitialBufferSize = 256
+    };
+
+    void writeByte(uint8 b)
+    {
+        mBuffer.push_back((char)b);
+    }
+
+    void writeVarint(uint32 val)
+    {
+        while(val >= 0x80)
+        {
+            writeByte((uint8)(val | 0x80));
+            val >>= 7;
+        }
+        writeByte((uint8)val);
+    }
+
+    void writeString(const String& str)
+    {
+        writeVarint(str.size());
+        mBuffer.append(str);
+    }
+
+    // Writes the UTF-8 straight into the buffer
+    void writeString(v8::Handle<v8::String> str)
+    {
+        int len = str->Utf8Length();
+        writeVarint(len);
+        String::size_type pos = mBuffer.size();
+        mBuffer.resize(pos + len);
+        if (len > 0)
+            str->WriteUtf8(&mBuffer[pos], len);
+    }
+
+    // If v8Obj has already been written, writes a reference to it and returns
+    // true.  Otherwise gives it the next object number.
+    bool writeBackReference(v8::Handle<v8::Object> v8Obj)
+    {
+        int hash = v8Obj->GetIdentityHash();
+        std::pair<ObjectIndex::iterator, ObjectIndex::iterator> range = mObjectIndex.equal_range(hash);
+        for(ObjectIndex::iterator it = range.first; it != range.second; it++)
+        {
+            if (mObjects[it->second] == v8Obj)
+            {
+                writeByte(BinaryBackRef);
+                writeVarint(it->second);
+                return true;
+            }
+        }
+
+        mObjectIndex.insert(std::make_pair(hash, (uint32)mObjects.size()));
+        mObjects.push_back(v8Obj);
+        return false;
+    }
+
+    void encodeObject(v8::Handle<v8::Object> v8Obj)
+    {
+        std::string typeIdString;
+        if (!getInternalTypeId(v8Obj, typeIdString))
+        {
+            writeByte(BinaryObject);
+            encodeFields(v8Obj);
+            return;
+        }
+
+        std::string err_msg;
+        if (typeIdString == VISIBLE_TYPEID_STRING || typeIdString == PRESENCE_TYPEID_STRING)
+        {
+            JSPositionListener* jspl = decodeJSPosListener(v8Obj, err_msg);
+            if (jspl != NULL)
+            {
+                writeByte(BinaryVisible);
+                writeString(jspl->getSporef().toString());
+                return;
+            }
+            SILOG(js, error, "Could not decode visible in binary serialization: " + err_msg);
+        }
+        else if (typeIdString == SYSTEM_TYPEID_STRING)
+        {
+            writeByte(BinarySystem);
+            return;
+        }
+
+        // Anything else we can't send comes through as an empty object, as in
+        // the PBJ encoding.
+        writeByte(BinaryObject);
+        writeShape(std::vector<String>());
+    }
+
+    void encodeFields(v8::Handle<v8::Object> v8Obj)
+    {
+        std::vector<String> properties = getOwnPropertyNames(v8::Local<v8::Object>::New(v8Obj));
+
+        std::vector<String> names;
+        std::vector<v8::Handle<v8::Value> > values;
+        names.reserve(properties.size());
+        values.reserve(properties.size());
+        for(std::vector<String>::size_type i = 0; i < properties.size(); i++)
+        {
+            v8::Local<v8::Value> prop_val;
+            if (properties[i] == JSSERIALIZER_PROTOTYPE_NAME)
+                prop_val = v8Obj->GetPrototype();
+            else
+                prop_val = v8Obj->Get( v8::String::New(properties[i].c_str(), properties[i].size()) );
+
+            if (isNativeFunction(prop_val))
+                continue;
+
+            names.push_back(properties[i]);
+            values.push_back(prop_val);
+        }
+
+        writeShape(names);
+        for(std::vector<v8::Handle<v8::Value> >::size_type i = 0; i < values.size(); i++)
+            encodeValue(values[i]);
+    }
+
+    void writeShape(const std::vector<String>& names)
+    {
+        // Names are length prefixed so no two lists of names share a key
+        String key;
+        for(std::vector<String>::size_type i = 0; i < names.size(); i++)
+        {
+            uint32 len = names[i].size();
+            key.append((const char*)&len, sizeof(len));
+            key.append(names[i]);
+        }
+
+        ShapeMap::iterator it = mShapes.find(key);
+        if (it != mShapes.end())
+        {
+            writeVarint(it->second + 1);
+            return;
+        }
+
+        uint32 shape_id = mShapes.size();
+        mShapes[key] = shape_id;
+        writeVarint(0);
+        writeVarint(names.size());
+        for(std::vector<String>::size_type i = 0; i < names.size(); i++)
+            writeString(names[i]);
+    }
+
+    typedef std::tr1::unordered_multimap<int, uint32> ObjectIndex;
+    typedef std::tr1::unordered_map<String, uint32> ShapeMap;
+
+    String mBuffer;
+    v8::Handle<v8::Value> mRootObject;
+    // Objects already written, indexed by their identity hashes
+    ObjectVec mObjects;
+    ObjectIndex mObjectIndex;
+    ShapeMap mShapes;
+};
+
+
+class JSSerializer::BinaryDecoder
+{
+public:
+    BinaryDecoder(EmersonScript* emerScript, const String& payload)
+     : mEmerScript(emerScript),
+       mPos((const uint8*)payload.data() + 2),
+       mEnd((const uint8*)payload.data() + payload.size())
+    {}
+
+    bool decode(v8::Handle<v8::Value>* out)
+    {
+        if (!decodeValue(out))
+            return false;
+
+        // Prototypes which referred back to objects that were still being
+        // decoded, applied now that those objects are complete.
+        for(std::vector<PrototypeFixup>::size_type i = 0; i < mPrototypeFixups.size(); i++)
+            applyPrototype(mPrototypeFixups[i].first, mPrototypeFixups[i].second);
+
+        return (mPos == mEnd);
+    }
+
+private:
+    struct Shape {
+        Shape() : prototypeIndex(-1) {}
+        std::vector<v8::Handle<v8::String> > names;
+        int32 prototypeIndex;
+    };
+    typedef std::pair<v8::Handle<v8::Object>, v8::Handle<v8::Value> > PrototypeFixup;
+
+    bool readByte(uint8* out)
+    {
+        if (mPos >= mEnd) return false;
+        *out = *mPos++;
+        return true;
+    }
+
+    bool readVarint(uint32* out)
+    {
+        uint32 result = 0;
+        for(uint32 shift = 0; shift < 35; shift += 7)
+        {
+            uint8 b;
+            if (!readByte(&b)) return false;
+            result |= (uint32)(b & 0x7F) << shift;
+            if ((b & 0x80) == 0)
+            {
+                *out = result;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool readStringBytes(const char** data_out, uint32* len_out)
+    {
+        uint32 len;
+        if (!readVarint(&len) || len > (uint32)(mEnd - mPos))
+            return false;
+        *data_out = (const char*)mPos;
+        *len_out = len;
+        mPos += len;
+        return true;
+    }
+
+    void registerObject(v8::Handle<v8::Object> obj)
+    {
+        mObjects.push_back(obj);
+    }
+
+    bool decodeValue(v8::Handle<v8::Value>* out, bool* isBackRef = NULL)
+    {
+        if (isBackRef != NULL)
+            *isBackRef = false;
+
+        uint8 tag;
+        if (!readByte(&tag))
+            return false;
+
+        switch(tag)
+        {
+          case BinaryUndefined:
+            *out = v8::Undefined();
+            return true;
+          case BinaryNull:
+            *out = v8::Null();
+            return true;
+          case BinaryTrue:
+            *out = v8::Boolean::New(true);
+            return true;
+          case BinaryFalse:
+            *out = v8::Boolean::New(false);
+            return true;
+          case BinaryInt32:
+            {
+                uint32 zigzag;
+                if (!readVarint(&zigzag)) return false;
+                *out = v8::Integer::New((int32)((zigzag >> 1) ^ (~(zigzag & 1) + 1)));
+                return true;
+            }
+          case BinaryUint32:
+            {
+                uint32 val;
+                if (!readVarint(&val)) return false;
+                *out = v8::Integer::NewFromUnsigned(val);
+                return true;
+            }
+          case BinaryDouble:
+            {
+                if (mEnd - mPos < 8) return false;
+                uint64 bits = 0;
+                for(int i = 0; i < 8; i++)
+                    bits |= (uint64)mPos[i] << (8*i);
+                mPos += 8;
+                *out = v8::Number::New(bitsToDouble(bits));
+                return true;
+            }
+          case BinaryString:
+            {
+                const char* data;
+                uint32 len;
+                if (!readStringBytes(&data, &len)) return false;
+                *out = v8::String::New(data, len);
+                return true;
+            }
+          case BinaryObject:
+            {
+                v8::Handle<v8::Object> obj = v8::Object::New();
+                registerObject(obj);
+                *out = obj;
+                return decodeFields(obj);
+            }
+          case BinaryArray:
+            {
+                v8::Handle<v8::Object> obj = v8::Array::New();
+                registerObject(obj);
+                *out = obj;
+                return decodeFields(obj);
+            }
+          case BinaryRootObject:
+            {
+                v8::Handle<v8::Object> obj = v8::Object::New();
+                registerObject(obj);
+                mRootObjects.push_back(obj);
+                *out = obj;
+                return decodeFields(obj);
+            }
+          case BinaryFunction:
+            {
+                const char* data;
+                uint32 len;
+                if (!readStringBytes(&data, &len) || mEmerScript == NULL)
+                    return false;
+                String funcText(data, len);
+                v8::Handle<v8::Function> func = functionFromText(mEmerScript, funcText);
+                registerObject(func);
+                *out = func;
+                if (funcText == FUNCTION_CONSTRUCTOR_TEXT)
+                    return true;
+                return decodeFields(func);
+            }
+          case BinaryVisible:
+            {
+                const char* data;
+                uint32 len;
+                if (!readStringBytes(&data, &len) || mEmerScript == NULL)
+                    return false;
+                v8::Handle<v8::Object> vis = mEmerScript->createVisibleWeakPersistent(
+                    SpaceObjectReference(String(data, len)), JSVisibleDataPtr());
+                registerObject(vis);
+                *out = vis;
+                return true;
+            }
+          case BinarySystem:
+            {
+                v8::Handle<v8::Object> obj = v8::Object::New();
+                obj->Set(v8::String::New("builtin"), v8::String::New("[object system]"));
+                registerObject(obj);
+                *out = obj;
+                return true;
+            }
+          case BinaryBackRef:
+            {
+                uint32 idx;
+                if (!readVarint(&idx) || idx >= mObjects.size())
+                    return false;
+                *out = mObjects[idx];
+                if (isBackRef != NULL)
+                    *isBackRef = true;
+                return true;
+            }
+          default:
+            return false;
+        }
+    }
+
+    bool readShape(uint32* shape_out)
+    {
+        uint32 shape_ref;
+        if (!readVarint(&shape_ref))
+            return false;
+        if (shape_ref > 0)
+        {
+            if (shape_ref > mShapes.size())
+                return false;
+            *shape_out = shape_ref - 1;
+            return true;
+        }
+
+        uint32 nfields;
+        // Each name takes at least one byte
+        if (!readVarint(&nfields) || nfields > (uint32)(mEnd - mPos))
+            return false;
+
+        Shape shape;
+        shape.names.reserve(nfields);
+        for(uint32 i = 0; i < nfields; i++)
+        {
+            const char* data;
+            uint32 len;
+            if (!readStringBytes(&data, &len))
+                return false;
+            if (String(data, len) == JSSERIALIZER_PROTOTYPE_NAME)
+                shape.prototypeIndex = i;
+            // Field names are used over and over, so make them symbols
+            shape.names.push_back(v8::String::NewSymbol(data, len));
+        }
+        *shape_out = mShapes.size();
+        mShapes.push_back(shape);
+        return true;
+    }
+
+    bool decodeFields(v8::Handle<v8::Object> obj)
+    {
+        uint32 shape_idx;
+        if (!readShape(&shape_idx))
+            return false;
+
+        // Decoding field values can add shapes and move mShapes around, so
+        // always index into it rather than holding onto the Shape
+        int32 nfields = mShapes[shape_idx].names.size();
+        int32 prototypeIndex = mShapes[shape_idx].prototypeIndex;
+        for(int32 i = 0; i < nfields; i++)
+        {
+            v8::Handle<v8::Value> val;
+            bool isBackRef;
+            if (!decodeValue(&val, &isBackRef))
+                return false;
+
+            if (i != prototypeIndex)
+                obj->Set(mShapes[shape_idx].names[i], val);
+            else if (isBackRef)
+                mPrototypeFixups.push_back(PrototypeFixup(obj, val));
+            else
+                applyPrototype(obj, val);
+        }
+        return true;
+    }
+
+    bool isRootObject(v8::Handle<v8::Object> obj)
+    {
+        for(ObjectVec::size_type i = 0; i < mRootObjects.size(); i++)
+            if (mRootObjects[i] == obj) return true;
+        return false;
+    }
+
+    // Matches JSSerializer::setPrototype: the stand in for the root object
+    // becomes the prototype, but the fields of any other prototype are copied.
+    void applyPrototype(v8::Handle<v8::Object> obj, v8::Handle<v8::Value> proto)
+    {
+        if (proto->IsUndefined() || proto->IsNull())
+            return;
+
+        if (!proto->IsObject())
+            obj->SetPrototype(proto);
+        else if (isRootObject(proto->ToObject()))
+            obj->SetPrototype(proto);
+        else
+            shallowCopyFields(obj, proto->ToObject());
+    }
+
+    EmersonScript* mEmerScript;
+    const uint8* mPos;
+    const uint8* mEnd;
+
+    std::vector<Shape> mShapes;
+    ObjectVec mObjects;
+    ObjectVec mRootObjects;
+    std::vector<PrototypeFixup> mPrototypeFixups;
+};
+
+
+bool JSSerializer::sBinaryEncoding = true;
+
+void JSSerializer::setBinaryEncoding(bool enabled)
+{
+    sBinaryEncoding = enabled;
+}
+
+bool JSSerializer::binaryEncoding()
+{
+    return sBinaryEncoding;
+}
+
+bool JSSerializer::isBinaryMessage(const String& payload)
+{
+    return (payload.size() >= 2 && (uint8)payload[0] == JSSERIALIZER_BINARY_MARKER);
+}
+
+std::string JSSerializer::serializeBinary(v8::Handle<v8::Value> v8Val)
+{
+    v8::HandleScope handleScope;
+    BinaryEncoder encoder;
+    encoder.encodeValue(v8Val);
+
+    std::string serialized;
+    serialized.swap(encoder.buffer());
+    return serialized;
+}
+
+v8::Handle<v8::Value> JSSerializer::deserializeBinary(EmersonScript* emerScript, const String& payload, bool& deserializeSuccessful)
+{
+    deserializeSuccessful = false;
+    if (! v8::Context::InContext())
+    {
+        JSLOG(error, "Error when deserializing.  Am not inside a v8 context.  Aborting.");
+        return v8::Undefined();
+    }
+
+    if (!isBinaryMessage(payload))
+    {
+        JSLOG(error, "Error when deserializing.  Message isn't in the binary encoding.");
+        return v8::Undefined();
+    }
+
+    uint8 version = (uint8)payload[1];
+    if (version != JSSERIALIZER_BINARY_VERSION)
+    {
+        JSLOG(error, "Error when deserializing.  Unknown binary encoding version " << (uint32)version << ".");
+        return v8::Undefined();
+    }
+
+    v8::HandleScope handle_scope;
+    BinaryDecoder decoder(emerScript, payload);
+    v8::Handle<v8::Value> returner;
+    if (!decoder.decode(&returner))
+    {
+        JSLOG(error, "Error when deserializing.  Binary message was malformed.");
+        return handle_scope.Close(v8::Undefined());
+    }
+
+    deserializeSuccessful = true;
+    return handle_scope.Close(returner);
+}
+
+
 } //end namespace js
 } //end namespace sirikata
@@ -27,6 +27,12 @@ const static char* JSSERIALIZER_PROTOTYPE_NAME= "this";
 
 const static char* FUNCTION_CONSTRUCTOR_TEXT = "function Function() { [native code] }";
 
+//Messages in the binary encoding start with a zero byte, which can never start
+//a PBJ encoded message since field number 0 isn't valid, followed by the
+//version of the encoding.
+const static uint8 JSSERIALIZER_BINARY_MARKER  = 0;
+const static uint8 JSSERIALIZER_BINARY_VERSION = 1;
+
 typedef std::vector<v8::Handle<v8::Object > > ObjectVec;
 typedef ObjectVec::iterator ObjectVecIter;
 
@@ -88,6 +94,18 @@ class JSSerializer
         Sirikata::JS::Protocol::JSFieldValue jsvalue, ObjectMap& labeledObjs,FixupMap& toFixUp,
         int32& toLoopTo);
 
+    static v8::Handle<v8::Function> functionFromText(EmersonScript* emerScript, const String& funcText);
+
+    // The binary encoding. Values are written directly into one buffer as
+    // tagged values, objects already written are found through a table keyed
+    // by their identity hashes instead of being marked with hidden values, and
+    // the field names of each distinct object layout are only written once
+    // per message.
+    class BinaryEncoder;
+    class BinaryDecoder;
+    static std::string serializeBinary(v8::Handle<v8::Value> v8Val);
+    static bool sBinaryEncoding;
+
 
 public:
     
@@ -95,10 +113,21 @@ public:
     static std::string serializeObject(v8::Local<v8::Value> v8Val,int32 toStamp = 0);
     static std::string serializeMessage(v8::Local<v8::Value> v8Val, int32 toStamp=0);
 
+    //Whether serializeMessage uses the binary encoding or PBJ.  Either
+    //encoding can always be deserialized, so this only needs to be turned off
+    //to talk to older object hosts.
+    static void setBinaryEncoding(bool enabled);
+    static bool binaryEncoding();
+
+    //Whether a serialized message uses the binary encoding rather than PBJ.
+    static bool isBinaryMessage(const String& payload);
+
     //both of these must be called from within a v8 context
     static v8::Handle<v8::Value> deserializeMessage( EmersonScript* emerScript, Sirikata::JS::Protocol::JSFieldValue jsfieldval,bool& deserializeSuccessful);
     //both of these must be called from within a v8 context
     static v8::Handle<v8::Object> deserializeObject( EmersonScript* emerScript, Sirikata::JS::Protocol::JSMessage jsmessage,bool& deserializeSuccessful);
+    //must be called from within a v8 context
+    static v8::Handle<v8::Value> deserializeBinary( EmersonScript* emerScript, const String& payload,bool& deserializeSuccessful);
 };
 
 }}//end namespaces
@@ -0,0 +1,166 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+// Times the Emerson compilation work done when starting up a number of
+// objects which all import the same scripts, e.g. the standard library, with
+// and without the compile cache. Each object "imports" every .em file found
+// under the given directory.
+
+#include "../EmersonCompileCache.hpp"
+#include "../emerson/EmersonUtil.h"
+#include "../emerson/Util.h"
+#include <sirikata/core/util/Timer.hpp>
+#include <sirikata/core/util/Paths.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace Sirikata;
+using namespace Sirikata::JS;
+
+namespace {
+
+struct CompileFailed {};
+
+void handleRecognitionError(struct ANTLR3_BASE_RECOGNIZER_struct* recognizer, pANTLR3_UINT8* tokenNames) {
+    throw CompileFailed();
+}
+
+struct Script {
+    String name;
+    String source;
+};
+typedef std::vector<Script> ScriptList;
+
+void findScripts(const boost::filesystem::path& dir, ScriptList* scripts) {
+    for(boost::filesystem::recursive_directory_iterator it(dir), end; it != end; it++) {
+        if (!boost::filesystem::is_regular_file(it->status()) || it->path().extension() != ".em")
+            continue;
+
+        std::ifstream fp(it->path().string().c_str(), std::ios::in | std::ios::binary);
+        std::stringstream contents;
+        contents << fp.rdbuf();
+
+        Script script;
+        script.name = it->path().string();
+        script.source = contents.str();
+        // Match internalEval, which always ensures a trailing newline
+        if (script.source.empty() || script.source[script.source.size()-1] != '\n')
+            script.source.push_back('\n');
+        scripts->push_back(script);
+    }
+}
+
+// Compile a script, returning false if it doesn't compile
+bool compile(const Script& script, String* js_out, EmersonLineMap* line_map) {
+    int err = 0;
+    try {
+        return EmersonUtil::emerson_compile(script.name, script.source.c_str(), *js_out, err, handleRecognitionError, line_map);
+    }
+    catch(CompileFailed) {
+        return false;
+    }
+}
+
+// Import every script, going through the cache if there is one. Returns the
+// number of bytes of JS produced so the work can't be skipped.
+uint64 importAll(const ScriptList& scripts, EmersonCompileCache* cache) {
+    uint64 total = 0;
+    for(ScriptList::const_iterator it = scripts.begin(); it != scripts.end(); it++) {
+        EmersonCompileCache::Key key;
+        if (cache != NULL) {
+            key = EmersonCompileCache::key(it->source);
+            EmersonCompileCache::EntryPtr entry = cache->lookup(key);
+            if (entry) {
+                total += entry->js.size();
+                continue;
+            }
+        }
+
+        String js;
+        EmersonLineMap line_map;
+        if (!compile(*it, &js, &line_map)) continue;
+        if (cache != NULL)
+            cache->store(key, js, line_map);
+        total += js.size();
+    }
+    return total;
+}
+
+void report(const String& name, uint32 nobjects, Duration dur) {
+    std::cout << name << ": "
+              << (dur.toMicroseconds() / 1000.0) << " ms total, "
+              << (dur.toMicroseconds() / 1000.0 / nobjects) << " ms per object"
+              << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cout << "Usage: emcompilebench scripts_dir [num_objects]" << std::endl;
+        return 1;
+    }
+
+    uint32 nobjects = 20;
+    if (argc > 2)
+        nobjects = std::max(atoi(argv[2]), 1);
+
+    ScriptList scripts;
+    findScripts(argv[1], &scripts);
+    if (scripts.empty()) {
+        std::cout << "No Emerson scripts found under " << argv[1] << std::endl;
+        return 1;
+    }
+
+    emerson_init();
+
+    uint64 nbytes = 0;
+    for(ScriptList::iterator it = scripts.begin(); it != scripts.end(); it++)
+        nbytes += it->source.size();
+    std::cout << scripts.size() << " scripts, " << nbytes << " bytes of Emerson, "
+              << nobjects << " objects" << std::endl;
+
+    String cache_dir = Path::Get(Path::DIR_TEMP, Path::GetTempFilename("emcompilebench"));
+
+    // Every object compiles everything itself
+    Time start = Timer::now();
+    for(uint32 i = 0; i < nobjects; i++)
+        importAll(scripts, NULL);
+    report("uncached", nobjects, Timer::now() - start);
+
+    // One object host starting with an empty cache: the first object
+    // compiles and writes the disk cache, the rest hit in memory
+    EmersonCompileCache shared_cache(cache_dir, 512);
+    start = Timer::now();
+    for(uint32 i = 0; i < nobjects; i++)
+        importAll(scripts, &shared_cache);
+    report("cold cache", nobjects, Timer::now() - start);
+
+    // Everything is already in memory
+    start = Timer::now();
+    for(uint32 i = 0; i < nobjects; i++)
+        importAll(scripts, &shared_cache);
+    report("warm memory cache", nobjects, Timer::now() - start);
+
+    // Every object starts in a fresh object host which finds the compiled
+    // scripts on disk
+    start = Timer::now();
+    for(uint32 i = 0; i < nobjects; i++) {
+        EmersonCompileCache fresh_cache(cache_dir, 512);
+        importAll(scripts, &fresh_cache);
+    }
+    report("disk cache only", nobjects, Timer::now() - start);
+
+    try {
+        boost::filesystem::remove_all(cache_dir);
+    } catch (boost::filesystem::filesystem_error) {
+    }
+
+    return 0;
+}
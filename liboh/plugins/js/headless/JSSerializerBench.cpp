@@ -0,0 +1,122 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+// Times serializing and deserializing a few representative Emerson messages
+// with the PBJ encoding and the binary encoding. Only plain data is used, so
+// no EmersonScript is needed to deserialize.
+
+#include "../JSSerializer.hpp"
+#include <sirikata/core/util/Timer.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace Sirikata;
+using namespace Sirikata::JS;
+
+namespace {
+
+struct Workload {
+    const char* name;
+    const char* source;
+};
+
+const Workload workloads[] = {
+    { "small",
+      "({ type: 'move', seq: 17, pos: { x: 1.5, y: -2.25, z: 3 }, vel: { x: 0, y: 0, z: 0.5 } })" },
+    { "records",
+      "(function() { var r = []; for(var i = 0; i < 100; i++) r.push({ id: i, name: 'object' + i, pos: [i*0.5, i, -i], visible: (i % 2 == 0) }); return { records: r }; })()" },
+    { "shared",
+      "(function() { var a = { name: 'a' }; var b = { name: 'b', peer: a }; var nodes = []; for(var i = 0; i < 20; i++) nodes.push({ idx: i, left: a, right: b }); return { nodes: nodes, first: a }; })()" }
+};
+
+v8::Handle<v8::Value> run(const char* source) {
+    return v8::Script::Compile(v8::String::New(source))->Run();
+}
+
+v8::Handle<v8::Value> roundTrip(v8::Handle<v8::Value> serialized_val, bool* success) {
+    String serialized = JSSerializer::serializeMessage(v8::Local<v8::Value>::New(serialized_val));
+    if (JSSerializer::isBinaryMessage(serialized))
+        return JSSerializer::deserializeBinary(NULL, serialized, *success);
+
+    Sirikata::JS::Protocol::JSFieldValue jsfieldval;
+    if (!jsfieldval.ParseFromString(serialized)) {
+        *success = false;
+        return v8::Undefined();
+    }
+    return JSSerializer::deserializeMessage(NULL, jsfieldval, *success);
+}
+
+void runWorkload(const Workload& workload, bool binary, uint32 iterations) {
+    v8::HandleScope handle_scope;
+    JSSerializer::setBinaryEncoding(binary);
+
+    v8::Handle<v8::Value> msg = run(workload.source);
+    v8::Handle<v8::Function> same = v8::Handle<v8::Function>::Cast(
+        run("(function(a, b) { return JSON.stringify(a) == JSON.stringify(b); })")
+    );
+
+    // Check the message survives the trip intact before timing anything
+    bool success = false;
+    v8::Handle<v8::Value> args[2];
+    args[0] = msg;
+    args[1] = roundTrip(msg, &success);
+    v8::Handle<v8::Value> matches;
+    if (success)
+        matches = same->Call(v8::Context::GetCurrent()->Global(), 2, args);
+    if (matches.IsEmpty() || !matches->BooleanValue()) {
+        std::cout << workload.name << " (" << (binary ? "binary" : "pbj") << "): round trip doesn't match the original" << std::endl;
+        return;
+    }
+
+    String serialized;
+    Time start = Timer::now();
+    for(uint32 i = 0; i < iterations; i++) {
+        v8::HandleScope iter_scope;
+        serialized = JSSerializer::serializeMessage(v8::Local<v8::Value>::New(msg));
+    }
+    Duration serialize_dur = Timer::now() - start;
+
+    start = Timer::now();
+    for(uint32 i = 0; i < iterations; i++) {
+        v8::HandleScope iter_scope;
+        if (binary) {
+            JSSerializer::deserializeBinary(NULL, serialized, success);
+        }
+        else {
+            Sirikata::JS::Protocol::JSFieldValue jsfieldval;
+            jsfieldval.ParseFromString(serialized);
+            JSSerializer::deserializeMessage(NULL, jsfieldval, success);
+        }
+    }
+    Duration deserialize_dur = Timer::now() - start;
+
+    std::cout << workload.name << " (" << (binary ? "binary" : "pbj") << "): "
+              << serialized.size() << " bytes, "
+              << (serialize_dur.toMicroseconds() / (float64)iterations) << " us to serialize, "
+              << (deserialize_dur.toMicroseconds() / (float64)iterations) << " us to deserialize"
+              << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint32 iterations = 10000;
+    if (argc > 1)
+        iterations = std::max(atoi(argv[1]), 1);
+
+    v8::HandleScope handle_scope;
+    v8::Persistent<v8::Context> context = v8::Context::New();
+    {
+        v8::Context::Scope context_scope(context);
+        for(uint32 i = 0; i < sizeof(workloads)/sizeof(workloads[0]); i++) {
+            runWorkload(workloads[i], false, iterations);
+            runWorkload(workloads[i], true, iterations);
+        }
+    }
+    context.Dispose();
+
+    return 0;
+}
@@ -44,6 +44,9 @@ static void InitPluginOptions() {
     Sirikata::InitializeClassOptions ico("sqlitestorage",NULL,
         new Sirikata::OptionValue("db", "storage.db", Sirikata::OptionValueType<String>(), "Database file to store data to."),
         new Sirikata::OptionValue("lease-duration", "30s", Sirikata::OptionValueType<Duration>(), "Duration to register leases for. Longer times require less overhead, but also mean longer delays if an object or object host dies without cleaning up."),
+        new Sirikata::OptionValue("wal", "true", Sirikata::OptionValueType<bool>(), "Use SQLite's write-ahead log. Commits are much cheaper, and only lose data on power loss, not on crashes."),
+        new Sirikata::OptionValue("group-commit-latency", "0s", Sirikata::OptionValueType<Duration>(), "How long to wait for transactions from other objects so they can be committed together. Increases throughput when many objects commit frequently, at the cost of latency."),
+        new Sirikata::OptionValue("max-group-commit", "64", Sirikata::OptionValueType<uint32>(), "Maximum number of transactions to commit together."),
         NULL);
 
     Sirikata::InitializeClassOptions icop("sqlitepersistedset",NULL,
@@ -61,8 +64,11 @@ static OH::Storage* createSQLiteStorage(ObjectHostContext* ctx, const String& ar
 
     String db = optionsSet->referenceOption("db")->as<String>();
     Duration lease_duration = optionsSet->referenceOption("lease-duration")->as<Duration>();
+    bool wal = optionsSet->referenceOption("wal")->as<bool>();
+    Duration group_commit_latency = optionsSet->referenceOption("group-commit-latency")->as<Duration>();
+    uint32 max_group_commit = optionsSet->referenceOption("max-group-commit")->as<uint32>();
 
-    return new OH::SQLiteStorage(ctx, db, lease_duration);
+    return new OH::SQLiteStorage(ctx, db, lease_duration, wal, group_commit_latency, max_group_commit);
 }
 
 static OH::PersistedObjectSet* createSQLitePersistedObjectSet(ObjectHostContext* ctx, const String& args) {
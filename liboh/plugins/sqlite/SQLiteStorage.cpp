@@ -87,7 +87,11 @@ SQLiteStorage::StorageAction& SQLiteStorage::StorageAction::operator=(const Stor
     return *this;
 }
 
-Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Bucket& bucket, ReadSet* rs) {
+Storage::Result SQLiteStorage::StorageAction::execute(SQLiteStorage* storage, const Bucket& bucket, ReadSet* rs) {
+    SQLiteDBPtr db = storage->mDB;
+    // Statements only hold pointers to these while they're executing
+    String bucket_id = bucket.rawHexData();
+
     Result result = SUCCESS;
     switch(type) {
 
@@ -96,52 +100,48 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
       case Read:
       case Compare:
           {
-              String value_query = "SELECT value FROM ";
-              value_query += "\"" TABLE_NAME "\"";
-              value_query += " WHERE object == \'" + bucket.rawHexData() + "\' AND key == ?";
+              sqlite3_stmt* value_query_stmt = storage->getStatement(ReadValueStatement);
+              if (value_query_stmt == NULL) return TRANSACTION_ERROR;
+
               int rc;
-              char* remain;
-              sqlite3_stmt* value_query_stmt;
               bool newStep = true;
-              rc = sqlite3_prepare_v2(db->db(), value_query.c_str(), -1, &value_query_stmt, (const char**)&remain);
               bool success = true;
-              success = success && !checkSQLiteError(db, rc, "Error preparing value query statement");
+              rc = sqlite3_bind_text(value_query_stmt, 1, bucket_id.c_str(), (int)bucket_id.size(), SQLITE_STATIC);
+              success = success && !checkSQLiteError(db, rc, "Error binding object to value query statement");
               if (rc==SQLITE_OK) {
-                  rc = sqlite3_bind_text(value_query_stmt, 1, key.c_str(), (int)key.size(), SQLITE_TRANSIENT);
+                  rc = sqlite3_bind_text(value_query_stmt, 2, key.c_str(), (int)key.size(), SQLITE_STATIC);
                   success = success && !checkSQLiteError(db, rc, "Error binding key name to value query statement");
-                  if (rc==SQLITE_OK) {
-                      int step_rc = sqlite3_step(value_query_stmt);
-                      while(step_rc == SQLITE_ROW) {
-                          newStep = false;
-                          if (type == Read) {
-                              (*rs)[key] = String(
-                                  (const char*)sqlite3_column_text(value_query_stmt, 0),
-                                  sqlite3_column_bytes(value_query_stmt, 0)
-                              );
-                          }
-                          else if (type == Compare) {
-                              assert(value != NULL);
-                              String db_val(
-                                  (const char*)sqlite3_column_text(value_query_stmt, 0),
-                                  sqlite3_column_bytes(value_query_stmt, 0)
-                              );
-                              success = success && (db_val == *value);
-                          }
-                          step_rc = sqlite3_step(value_query_stmt);
+              }
+              if (rc==SQLITE_OK) {
+                  int step_rc = sqlite3_step(value_query_stmt);
+                  while(step_rc == SQLITE_ROW) {
+                      newStep = false;
+                      if (type == Read) {
+                          (*rs)[key] = String(
+                              (const char*)sqlite3_column_text(value_query_stmt, 0),
+                              sqlite3_column_bytes(value_query_stmt, 0)
+                          );
                       }
-                      if (step_rc != SQLITE_DONE) {
-                          // reset the statement so it'll clean up properly
-                          rc = sqlite3_reset(value_query_stmt);
-                          success = success && !checkSQLiteError(db, rc, "Error finalizing value query statement");
-                          // Make sure we notify of temporary failures in case
-                          // retrying is worth it
-                          if (step_rc == SQLITE_LOCKED || step_rc == SQLITE_BUSY)
-                              result = LOCK_ERROR;
+                      else if (type == Compare) {
+                          assert(value != NULL);
+                          String db_val(
+                              (const char*)sqlite3_column_text(value_query_stmt, 0),
+                              sqlite3_column_bytes(value_query_stmt, 0)
+                          );
+                          success = success && (db_val == *value);
                       }
+                      step_rc = sqlite3_step(value_query_stmt);
                   }
+                  // Make sure we notify of temporary failures in case
+                  // retrying is worth it
+                  if (step_rc == SQLITE_LOCKED || step_rc == SQLITE_BUSY)
+                      result = LOCK_ERROR;
               }
-              rc = sqlite3_finalize(value_query_stmt);
-              success = success && !checkSQLiteError(db, rc, "Error finalizing value query statement");
+              // Reset so the statement is ready for reuse. This also reports
+              // any error from the last step.
+              rc = sqlite3_reset(value_query_stmt);
+              success = success && !checkSQLiteError(db, rc, "Error resetting value query statement");
+              sqlite3_clear_bindings(value_query_stmt);
 
               if (newStep) { // no rows were found, key is missing
                   success = false;
@@ -159,57 +159,52 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
 
       case ReadRange:
           {
-              String value_query = "SELECT key, value FROM ";
-              value_query += "\"" TABLE_NAME "\"";
-              value_query += " WHERE object == \'" + bucket.rawHexData() + "\' AND key BETWEEN ? AND ?";
+              sqlite3_stmt* value_query_stmt = storage->getStatement(ReadRangeStatement);
+              if (value_query_stmt == NULL) return TRANSACTION_ERROR;
 
               int rc;
-              char* remain;
-              sqlite3_stmt* value_query_stmt;
-              rc = sqlite3_prepare_v2(db->db(), value_query.c_str(), -1, &value_query_stmt, (const char**)&remain);
               bool success = true;
-              success = success && !checkSQLiteError(db, rc, "Error preparing value query statement");
-              if (rc==SQLITE_OK){
-                  rc = sqlite3_bind_text(value_query_stmt, 1, key.c_str(), (int)key.size(), SQLITE_TRANSIENT);
+              rc = sqlite3_bind_text(value_query_stmt, 1, bucket_id.c_str(), (int)bucket_id.size(), SQLITE_STATIC);
+              success = success && !checkSQLiteError(db, rc, "Error binding object to value query statement");
+              if (rc==SQLITE_OK) {
+                  rc = sqlite3_bind_text(value_query_stmt, 2, key.c_str(), (int)key.size(), SQLITE_STATIC);
                   success = success && !checkSQLiteError(db, rc, "Error binding start key to value query statement");
-                  rc = sqlite3_bind_text(value_query_stmt, 2, keyEnd.c_str(), (int)keyEnd.size(), SQLITE_TRANSIENT);
+              }
+              if (rc==SQLITE_OK) {
+                  rc = sqlite3_bind_text(value_query_stmt, 3, keyEnd.c_str(), (int)keyEnd.size(), SQLITE_STATIC);
                   success = success && !checkSQLiteError(db, rc, "Error binding finish key to value query statement");
-                  if (rc==SQLITE_OK) {
-                      int step_rc = sqlite3_step(value_query_stmt);
-                      int nread = 0;
-                      while(step_rc == SQLITE_ROW) {
-                          nread++;
-                          String key(
-                              (const char*)sqlite3_column_text(value_query_stmt, 0),
-                              sqlite3_column_bytes(value_query_stmt, 0)
-                          );
-                          String value(
-                              (const char*)sqlite3_column_text(value_query_stmt, 1),
-                              sqlite3_column_bytes(value_query_stmt, 1)
-                          );
-                          (*rs)[key] = value;
-                          step_rc = sqlite3_step(value_query_stmt);
-                      }
-                      if (nread == 0) {
-                          success = false;
-                          // No message here because this is ok -- it just
-                          // indicates to the user that there were no elements
-                          // in the range requested.
-                          // SILOG(sqlite-storage, error, "RangeRead found 0 keys in range");
-                      }
-                      if (step_rc != SQLITE_DONE) {
-                          // reset the statement so it'll clean up properly
-                          rc = sqlite3_reset(value_query_stmt);
-                          success = success && !checkSQLiteError(db, rc, "Error finalizing value query statement");
-                          // Make sure we notify of temporary failures in case
-                          // retrying is worth it
-                          if (step_rc == SQLITE_LOCKED || step_rc == SQLITE_BUSY)
-                              result = LOCK_ERROR;
-                      }
+              }
+              if (rc==SQLITE_OK) {
+                  int step_rc = sqlite3_step(value_query_stmt);
+                  int nread = 0;
+                  while(step_rc == SQLITE_ROW) {
+                      nread++;
+                      String key(
+                          (const char*)sqlite3_column_text(value_query_stmt, 0),
+                          sqlite3_column_bytes(value_query_stmt, 0)
+                      );
+                      String value(
+                          (const char*)sqlite3_column_text(value_query_stmt, 1),
+                          sqlite3_column_bytes(value_query_stmt, 1)
+                      );
+                      (*rs)[key] = value;
+                      step_rc = sqlite3_step(value_query_stmt);
+                  }
+                  if (nread == 0) {
+                      success = false;
+                      // No message here because this is ok -- it just
+                      // indicates to the user that there were no elements
+                      // in the range requested.
+                      // SILOG(sqlite-storage, error, "RangeRead found 0 keys in range");
                   }
+                  // Make sure we notify of temporary failures in case
+                  // retrying is worth it
+                  if (step_rc == SQLITE_LOCKED || step_rc == SQLITE_BUSY)
+                      result = LOCK_ERROR;
               }
-              rc = sqlite3_finalize(value_query_stmt);
-              success = success && !checkSQLiteError(db, rc, "Error finalizing value query statement");
+              rc = sqlite3_reset(value_query_stmt);
+              success = success && !checkSQLiteError(db, rc, "Error resetting value query statement");
+              sqlite3_clear_bindings(value_query_stmt);
               // If no other error condition is indicated yet, mark transaction
               // error for failures
               if (!success && result == SUCCESS)
@@ -223,38 +218,25 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
               // Erase and write use different statements, but the rest is the
               // same since it just needs to execute and check for success.
               int rc;
-              char* remain;
-
-              String value_insert;
-              if (type == Write) {
-                  value_insert = "INSERT OR REPLACE INTO ";
-                  value_insert += "\"" TABLE_NAME "\"";
-                  value_insert += " (object, key, value) VALUES(\'" + bucket.rawHexData() + "\', ?, ?)";
-              }
-              else if (type == Erase) {
-                  value_insert = "DELETE FROM ";
-                  value_insert += "\"" TABLE_NAME "\"";
-                  value_insert += " WHERE object = \'" + bucket.rawHexData() + "\' AND key = ?";
-              }
 
-              sqlite3_stmt* value_insert_stmt;
-              rc = sqlite3_prepare_v2(db->db(), value_insert.c_str(), -1, &value_insert_stmt, (const char**)&remain);
+              sqlite3_stmt* value_insert_stmt = storage->getStatement(type == Write ? WriteValueStatement : EraseValueStatement);
+              if (value_insert_stmt == NULL) return TRANSACTION_ERROR;
               bool success = true;
-              success = success && !checkSQLiteError(db, rc, "Error preparing value insert statement");
 
-              rc = sqlite3_bind_text(value_insert_stmt, 1, key.c_str(), (int)key.size(), SQLITE_TRANSIENT);
+              rc = sqlite3_bind_text(value_insert_stmt, 1, bucket_id.c_str(), (int)bucket_id.size(), SQLITE_STATIC);
+              success = success && !checkSQLiteError(db, rc, "Error binding object to value insert statement");
+              rc = sqlite3_bind_text(value_insert_stmt, 2, key.c_str(), (int)key.size(), SQLITE_STATIC);
               success = success && !checkSQLiteError(db, rc, "Error binding key name to value insert statement");
               if (rc==SQLITE_OK) {
                   if (type == Write) {
                       assert(value != NULL);
-                      rc = sqlite3_bind_blob(value_insert_stmt, 2, value->c_str(), (int)value->size(), SQLITE_TRANSIENT);
+                      rc = sqlite3_bind_blob(value_insert_stmt, 3, value->c_str(), (int)value->size(), SQLITE_STATIC);
                       success = success && !checkSQLiteError(db, rc, "Error binding value to value insert statement");
                   }
               }
 
               int step_rc = sqlite3_step(value_insert_stmt);
               if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE) {
-                  sqlite3_reset(value_insert_stmt); // allow this to be cleaned up
                   success = false;
                   // Make sure we notify of temporary failures in case
                   // retrying is worth it
@@ -285,8 +267,9 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
                   }
               }
 
-              rc = sqlite3_finalize(value_insert_stmt);
-              success = success && !checkSQLiteError(db, rc, "Error finalizing value insert statement");
+              // Errors from the step were handled above, so only reset here
+              sqlite3_reset(value_insert_stmt);
+              sqlite3_clear_bindings(value_insert_stmt);
 
               // If no other error condition is indicated yet, mark transaction
               // error for failures
@@ -297,32 +280,29 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
 
       case EraseRange:
           {
-              String value_delete = "DELETE FROM ";
-              value_delete += "\"" TABLE_NAME "\"";
-              value_delete += " WHERE object = \'" + bucket.rawHexData() + "\' AND key BETWEEN ? AND ?";
+              sqlite3_stmt* value_delete_stmt = storage->getStatement(EraseRangeStatement);
+              if (value_delete_stmt == NULL) return TRANSACTION_ERROR;
 
               int rc;
-              char* remain;
-              sqlite3_stmt* value_delete_stmt;
-              rc = sqlite3_prepare_v2(db->db(), value_delete.c_str(), -1, &value_delete_stmt, (const char**)&remain);
               bool success = true;
-              success = success && !checkSQLiteError(db, rc, "Error preparing value delete statement");
 
-              rc = sqlite3_bind_text(value_delete_stmt, 1, key.c_str(), (int)key.size(), SQLITE_TRANSIENT);
+              rc = sqlite3_bind_text(value_delete_stmt, 1, bucket_id.c_str(), (int)bucket_id.size(), SQLITE_STATIC);
+              success = success && !checkSQLiteError(db, rc, "Error binding object to value delete statement");
+              rc = sqlite3_bind_text(value_delete_stmt, 2, key.c_str(), (int)key.size(), SQLITE_STATIC);
               success = success && !checkSQLiteError(db, rc, "Error binding start key to value delete statement");
-              rc = sqlite3_bind_text(value_delete_stmt, 2, keyEnd.c_str(), (int)keyEnd.size(), SQLITE_TRANSIENT);
+              rc = sqlite3_bind_text(value_delete_stmt, 3, keyEnd.c_str(), (int)keyEnd.size(), SQLITE_STATIC);
               success = success && !checkSQLiteError(db, rc, "Error binding finish key to value delete statement");
 
               int step_rc = sqlite3_step(value_delete_stmt);
               if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE) {
-                  sqlite3_reset(value_delete_stmt); // allow this to be cleaned up
                   // Make sure we notify of temporary failures in case
                   // retrying is worth it
                   if (step_rc == SQLITE_LOCKED || step_rc == SQLITE_BUSY)
                       result = LOCK_ERROR;
               }
-              rc = sqlite3_finalize(value_delete_stmt);
-              success = success && !checkSQLiteError(db, rc, "Error finalizing value delete statement");
+              rc = sqlite3_reset(value_delete_stmt);
+              success = success && !checkSQLiteError(db, rc, "Error resetting value delete statement");
+              sqlite3_clear_bindings(value_delete_stmt);
 
               // If no other error condition is indicated yet, mark transaction
               // error for failures
@@ -339,12 +319,12 @@ Storage::Result SQLiteStorage::StorageAction::execute(SQLiteDBPtr db, const Buck
     return result;
 }
 
-Storage::Result SQLiteStorage::StorageAction::executeWithRetry(SQLiteDBPtr db, const Bucket& bucket, ReadSet* rs, int32 retries, const Duration& retry_wait) {
+Storage::Result SQLiteStorage::StorageAction::executeWithRetry(SQLiteStorage* storage, const Bucket& bucket, ReadSet* rs, int32 retries, const Duration& retry_wait) {
     Storage::Result res = LOCK_ERROR;
     for(int32 i = 0; i < retries && res == LOCK_ERROR; i++) {
         if (i != 0) Timer::sleep(retry_wait);
 
-        res = execute(db, bucket, rs);
+        res = execute(storage, bucket, rs);
     }
 
     if (res == LOCK_ERROR)
@@ -352,7 +332,7 @@ Storage::Result SQLiteStorage::StorageAction::executeWithRetry(SQLiteDBPtr db, c
     return res;
 }
 
-SQLiteStorage::SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const Duration& lease_duration)
+SQLiteStorage::SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const Duration& lease_duration, bool wal, const Duration& group_commit_latency, uint32 max_group_commit)
  : mContext(ctx),
    mDBFilename(dbpath),
    mDB(),
@@ -364,13 +344,17 @@ SQLiteStorage::SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const
    // address, etc.
    mSQLClientID(UUID::random().rawHexData()),
    mLeaseDuration(lease_duration),
+   mWAL(wal),
    mTransactionQueue(std::tr1::bind(&SQLiteStorage::postProcessTransactions, this)),
-   mMaxCoalescedTransactions(5),
+   mMaxCoalescedTransactions(std::max(max_group_commit, (uint32)1)),
+   mGroupCommitLatency(group_commit_latency),
    mRetrySleepDuration(Duration::milliseconds(25)),
    mNormalOpRetries(20),
    mLeaseOpRetries(100),
    mRenewTimer()
 {
+    for(int i = 0; i < NumStatementTypes; i++)
+        mStatements[i] = NULL;
 }
 
 SQLiteStorage::~SQLiteStorage()
@@ -426,65 +410,114 @@ void SQLiteStorage::initDB() {
     rc = sqlite3_finalize(table_create_stmt);
     success = success && !checkSQLiteError(db, rc, "Error finalizing table create statement");
 
+    if (success && mWAL) {
+        // With write-ahead logging commits just append to the log instead of
+        // rewriting the database and journal, and readers don't block
+        // writers. Only syncing at checkpoints (synchronous=NORMAL) is still
+        // safe against the object host crashing, just not against power loss.
+        char* err_msg = NULL;
+        rc = sqlite3_exec(db->db(), "PRAGMA journal_mode=WAL", NULL, NULL, &err_msg);
+        std::pair<bool, String> res = SQLite::check_sql_error(db->db(), rc, &err_msg, "Error enabling write-ahead logging");
+        if (res.first)
+            SILOG(sqlite-storage, warning, res.second);
+        else {
+            rc = sqlite3_exec(db->db(), "PRAGMA synchronous=NORMAL", NULL, NULL, &err_msg);
+            res = SQLite::check_sql_error(db->db(), rc, &err_msg, "Error setting synchronous mode");
+            if (res.first)
+                SILOG(sqlite-storage, warning, res.second);
+        }
+    }
+
     if (!success)
         mDB.reset();
 }
 
-bool SQLiteStorage::sqlBeginTransaction() {
-    String begin = "BEGIN DEFERRED TRANSACTION";
+sqlite3_stmt* SQLiteStorage::getStatement(StatementType type) {
+    if (mStatements[type] != NULL)
+        return mStatements[type];
+    if (!mDB)
+        return NULL;
 
-    int rc;
-    char* remain;
-    sqlite3_stmt* begin_stmt;
-    bool success = true;
-
-    rc = sqlite3_prepare_v2(mDB->db(), begin.c_str(), -1, &begin_stmt, (const char**)&remain);
-    success = success && !checkSQLiteError(mDB, rc, "Error preparing begin transaction statement");
+    const char* sql = NULL;
+    switch(type) {
+      case ReadValueStatement:
+        sql = "SELECT value FROM \"" TABLE_NAME "\" WHERE object == ? AND key == ?";
+        break;
+      case ReadRangeStatement:
+        sql = "SELECT key, value FROM \"" TABLE_NAME "\" WHERE object == ? AND key BETWEEN ? AND ?";
+        break;
+      case WriteValueStatement:
+        sql = "INSERT OR REPLACE INTO \"" TABLE_NAME "\" (object, key, value) VALUES(?, ?, ?)";
+        break;
+      case EraseValueStatement:
+        sql = "DELETE FROM \"" TABLE_NAME "\" WHERE object = ? AND key = ?";
+        break;
+      case EraseRangeStatement:
+        sql = "DELETE FROM \"" TABLE_NAME "\" WHERE object = ? AND key BETWEEN ? AND ?";
+        break;
+      case CountRangeStatement:
+        sql = "SELECT COUNT(*) FROM \"" TABLE_NAME "\" WHERE object = ? AND key BETWEEN ? AND ?";
+        break;
+      case BeginStatement:
+        sql = "BEGIN DEFERRED TRANSACTION";
+        break;
+      case CommitStatement:
+        sql = "COMMIT TRANSACTION";
+        break;
+      case RollbackStatement:
+        sql = "ROLLBACK TRANSACTION";
+        break;
+      default:
+        return NULL;
+    }
 
-    rc = sqlite3_step(begin_stmt);
-    success = success && !checkSQLiteError(mDB, rc, "Error executing begin statement");
-    rc = sqlite3_finalize(begin_stmt);
-    success = success && !checkSQLiteError(mDB, rc, "Error finalizing begin statement");
+    sqlite3_stmt* stmt = NULL;
+    int rc = sqlite3_prepare_v2(mDB->db(), sql, -1, &stmt, NULL);
+    if (checkSQLiteError(mDB, rc, String("Error preparing statement: ") + sql)) {
+        if (stmt != NULL) sqlite3_finalize(stmt);
+        return NULL;
+    }
 
-    return success;
+    mStatements[type] = stmt;
+    return stmt;
 }
 
-bool SQLiteStorage::sqlRollback() {
-    String rollback = "ROLLBACK TRANSACTION";
+void SQLiteStorage::finalizeStatements() {
+    // Don't leave transactions waiting on a group commit timer, they'd
+    // need the statements again
+    processTransactions();
 
-    int rc;
-    char* remain;
-    sqlite3_stmt* rollback_stmt;
-    bool success = true;
+    for(int i = 0; i < NumStatementTypes; i++) {
+        if (mStatements[i] != NULL) {
+            sqlite3_finalize(mStatements[i]);
+            mStatements[i] = NULL;
+        }
+    }
+}
 
-    rc = sqlite3_prepare_v2(mDB->db(), rollback.c_str(), -1, &rollback_stmt, (const char**)&remain);
-    success = success && !checkSQLiteError(mDB, rc, "Error preparing rollback transaction statement");
+bool SQLiteStorage::executeControlStatement(StatementType type, const String& desc) {
+    sqlite3_stmt* stmt = getStatement(type);
+    if (stmt == NULL) return false;
 
-    rc = sqlite3_step(rollback_stmt);
-    success = success && !checkSQLiteError(mDB, rc, "Error executing rollback statement");
-    rc = sqlite3_finalize(rollback_stmt);
-    success = success && !checkSQLiteError(mDB, rc, "Error finalizing rollback statement");
+    bool success = true;
+    int rc = sqlite3_step(stmt);
+    success = success && !checkSQLiteError(mDB, rc, "Error executing " + desc + " statement");
+    rc = sqlite3_reset(stmt);
+    success = success && !checkSQLiteError(mDB, rc, "Error resetting " + desc + " statement");
 
     return success;
 }
 
-bool SQLiteStorage::sqlCommit() {
-    String commit = "COMMIT TRANSACTION";
-
-    int rc;
-    char* remain;
-    sqlite3_stmt* commit_stmt;
-    bool success = true;
-
-    rc = sqlite3_prepare_v2(mDB->db(), commit.c_str(), -1, &commit_stmt, (const char**)&remain);
-    success = success && !checkSQLiteError(mDB, rc, "Error preparing commit transaction statement");
+bool SQLiteStorage::sqlBeginTransaction() {
+    return executeControlStatement(BeginStatement, "begin");
+}
 
-    rc = sqlite3_step(commit_stmt);
-    success = success && !checkSQLiteError(mDB, rc, "Error executing commit statement");
-    rc = sqlite3_finalize(commit_stmt);
-    success = success && !checkSQLiteError(mDB, rc, "Error finalizing commit statement");
+bool SQLiteStorage::sqlRollback() {
+    return executeControlStatement(RollbackStatement, "rollback");
+}
 
-    return success;
+bool SQLiteStorage::sqlCommit() {
+    return executeControlStatement(CommitStatement, "commit");
 }
 
 void SQLiteStorage::stop() {
@@ -496,6 +529,13 @@ void SQLiteStorage::stop() {
     // other thread, where we don't know that stop has been called.
     mRenewTimer.reset();
 
+    // Prepared statements have to be cleaned up by the IO thread, after any
+    // remaining transactions have been processed
+    mIOService->post(
+        std::tr1::bind(&SQLiteStorage::finalizeStatements, this),
+        "SQLiteStorage::finalizeStatements"
+    );
+
     delete mWork;
     mWork = NULL;
     mThread->join();
@@ -563,6 +603,18 @@ void SQLiteStorage::commitTransaction(const Bucket& bucket, const CommitCallback
 }
 
 void SQLiteStorage::postProcessTransactions() {
+    // With group commit, wait a bit for other buckets to queue up their
+    // transactions so they can all share one SQLite transaction, and one sync
+    // to disk.
+    if (mGroupCommitLatency > Duration::zero()) {
+        mIOService->post(
+            mGroupCommitLatency,
+            std::tr1::bind(&SQLiteStorage::processTransactions, this),
+            "SQLiteStorage::processTransactions"
+        );
+        return;
+    }
+
     mIOService->post(
         std::tr1::bind(&SQLiteStorage::processTransactions, this),
         "SQLiteStorage::processTransactions"
@@ -674,7 +726,7 @@ Storage::Result SQLiteStorage::executeCommit(const Bucket& bucket, Transaction*
     // and return the error.
     Result result = acquireLease(bucket);
     for (Transaction::iterator it = trans->begin(); (result == SUCCESS) && it != trans->end(); it++) {
-        result = (*it).executeWithRetry(mDB, bucket, rs, mNormalOpRetries, mRetrySleepDuration);
+        result = (*it).executeWithRetry(this, bucket, rs, mNormalOpRetries, mRetrySleepDuration);
     }
 
     if (rs->empty() || (result != SUCCESS)) {
@@ -718,7 +770,7 @@ Storage::Result SQLiteStorage::acquireLease(const Bucket& bucket) {
         StorageAction sa;
         sa.type = StorageAction::Read;
         sa.key = LEASE_KEY;
-        result = sa.executeWithRetry(mDB, bucket, &lease_rs, mLeaseOpRetries, mRetrySleepDuration);
+        result = sa.executeWithRetry(this, bucket, &lease_rs, mLeaseOpRetries, mRetrySleepDuration);
     }
 
     // Decide the next course of action based on whether the lease key
@@ -760,7 +812,7 @@ Storage::Result SQLiteStorage::acquireLease(const Bucket& bucket) {
         sa.key = LEASE_KEY;
         sa.value = new String(getLeaseString());
         ReadSet no_rs;
-        result = sa.executeWithRetry(mDB, bucket, &no_rs, mLeaseOpRetries, mRetrySleepDuration);
+        result = sa.executeWithRetry(this, bucket, &no_rs, mLeaseOpRetries, mRetrySleepDuration);
 
         // If we succeeded here, we got the lease, otherwise we failed
         // and need to give up.
@@ -799,7 +851,7 @@ void SQLiteStorage::renewLease(const Bucket& bucket) {
         StorageAction sa;
         sa.type = StorageAction::Read;
         sa.key = LEASE_KEY;
-        result = sa.executeWithRetry(mDB, bucket, &lease_rs, mLeaseOpRetries, mRetrySleepDuration);
+        result = sa.executeWithRetry(this, bucket, &lease_rs, mLeaseOpRetries, mRetrySleepDuration);
     }
 
     // Nothing in there or database was busy? releaseLease was called and
@@ -829,7 +881,7 @@ void SQLiteStorage::renewLease(const Bucket& bucket) {
         sa.key = LEASE_KEY;
         sa.value = new String(getLeaseString());
         ReadSet no_rs;
-        result = sa.executeWithRetry(mDB, bucket, &no_rs, mLeaseOpRetries, mRetrySleepDuration);
+        result = sa.executeWithRetry(this, bucket, &no_rs, mLeaseOpRetries, mRetrySleepDuration);
     }
 
     // If we failed to write the new key, give up. This really shouldn't happen.
@@ -855,6 +907,10 @@ void SQLiteStorage::releaseLease(const Bucket& bucket) {
     // clear it if necessary. We need to wrap this in a SQLite transaction
     // ourselves since it happens on its own.
 
+    // Commit anything for the bucket still waiting for its group first, or it
+    // would take the lease right back.
+    processTransactions();
+
     Result result = SUCCESS;
     if (!sqlBeginTransaction())
         result = LOCK_ERROR;
@@ -865,7 +921,7 @@ void SQLiteStorage::releaseLease(const Bucket& bucket) {
         StorageAction sa;
         sa.type = StorageAction::Read;
         sa.key = LEASE_KEY;
-        result = sa.executeWithRetry(mDB, bucket, &lease_rs, mLeaseOpRetries, mRetrySleepDuration);
+        result = sa.executeWithRetry(this, bucket, &lease_rs, mLeaseOpRetries, mRetrySleepDuration);
     }
 
     // Nothing in there or database was busy? Nothing to do, although it might
@@ -900,7 +956,7 @@ void SQLiteStorage::releaseLease(const Bucket& bucket) {
         sa.type = StorageAction::Erase;
         sa.key = LEASE_KEY;
         ReadSet no_rs;
-        result = sa.executeWithRetry(mDB, bucket, &no_rs, mLeaseOpRetries, mRetrySleepDuration);
+        result = sa.executeWithRetry(this, bucket, &no_rs, mLeaseOpRetries, mRetrySleepDuration);
     }
 
     if (result != SUCCESS) {
@@ -1036,43 +1092,45 @@ bool SQLiteStorage::rangeErase(const Bucket& bucket, const Key& start, const Key
 
 bool SQLiteStorage::count(const Bucket& bucket, const Key& start, const Key& finish, const CountCallback& cb, const String& timestamp) {
     // FIXME doesn't fit into transactions...
-    String value_count = "SELECT COUNT(*) FROM ";
-    value_count += "\"" TABLE_NAME "\"";
-    value_count += " WHERE object = \'" + bucket.rawHexData() + "\' AND key BETWEEN ? AND ?";
-
     mIOService->post(
-        std::tr1::bind(&SQLiteStorage::executeCount, this, value_count, start, finish, cb),
+        std::tr1::bind(&SQLiteStorage::executeCount, this, bucket, start, finish, cb),
         "SQLiteStorage::executeCount"
     );
     return true;
 }
 
-void SQLiteStorage::executeCount(const String value_count, const Key& start, const Key& finish, CountCallback cb)
+void SQLiteStorage::executeCount(const Bucket& bucket, const Key& start, const Key& finish, CountCallback cb)
 {
+    // Counts bypass the transaction queue, so commit anything still waiting
+    // for its group to fill up first. Otherwise a count could miss writes
+    // committed before it was requested.
+    processTransactions();
+
     bool success = true;
     int32 count = 0;
 
-	int rc;
-    char* remain;
-    sqlite3_stmt* value_count_stmt;
-    rc = sqlite3_prepare_v2(mDB->db(), value_count.c_str(), -1, &value_count_stmt, (const char**)&remain);
-    success = success && !checkSQLiteError(mDB, rc, "Error preparing value count statement");
-
-    if (rc==SQLITE_OK) {
-    	rc = sqlite3_bind_text(value_count_stmt, 1, start.c_str(), (int)start.size(), SQLITE_TRANSIENT);
-    	success = success && !checkSQLiteError(mDB, rc, "Error binding start key to value count statement");
-    	rc = sqlite3_bind_text(value_count_stmt, 2, finish.c_str(), (int)finish.size(), SQLITE_TRANSIENT);
-    	success = success && !checkSQLiteError(mDB, rc, "Error binding finish key to value count statement");
-    	if (rc==SQLITE_OK) {
-    		int step_rc = sqlite3_step(value_count_stmt);
-    		count = sqlite3_column_int(value_count_stmt, 0);
-    		if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE && step_rc != SQLITE_ROW)
-    			sqlite3_reset(value_count_stmt); // allow this to be cleaned up
-    	}
+    String bucket_id = bucket.rawHexData();
+    int rc;
+    sqlite3_stmt* value_count_stmt = getStatement(CountRangeStatement);
+    success = (value_count_stmt != NULL);
+
+    if (success) {
+        rc = sqlite3_bind_text(value_count_stmt, 1, bucket_id.c_str(), (int)bucket_id.size(), SQLITE_STATIC);
+        success = success && !checkSQLiteError(mDB, rc, "Error binding object to value count statement");
+        rc = sqlite3_bind_text(value_count_stmt, 2, start.c_str(), (int)start.size(), SQLITE_STATIC);
+        success = success && !checkSQLiteError(mDB, rc, "Error binding start key to value count statement");
+        rc = sqlite3_bind_text(value_count_stmt, 3, finish.c_str(), (int)finish.size(), SQLITE_STATIC);
+        success = success && !checkSQLiteError(mDB, rc, "Error binding finish key to value count statement");
+        if (success) {
+            int step_rc = sqlite3_step(value_count_stmt);
+            if (step_rc == SQLITE_ROW)
+                count = sqlite3_column_int(value_count_stmt, 0);
+        }
 
+        rc = sqlite3_reset(value_count_stmt);
+        success = success && !checkSQLiteError(mDB, rc, "Error resetting value count statement");
+        sqlite3_clear_bindings(value_count_stmt);
     }
-    rc = sqlite3_finalize(value_count_stmt);
-    success = success && !checkSQLiteError(mDB, rc, "Error finalizing value delete statement");
 
     if (cb) {
         Result result = (success ? SUCCESS : TRANSACTION_ERROR);
@@ -45,7 +45,14 @@ class FileStorageEvent;
 class SQLiteStorage : public Storage
 {
 public:
-    SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const Duration& lease_duration);
+    /** \param wal use SQLite's write-ahead log instead of a rollback journal
+     *  \param group_commit_latency how long to wait for more transactions to
+     *         arrive before committing, so more of them can share one SQLite
+     *         transaction. Zero commits as soon as possible.
+     *  \param max_group_commit maximum number of transactions to combine into
+     *         one SQLite transaction
+     */
+    SQLiteStorage(ObjectHostContext* ctx, const String& dbpath, const Duration& lease_duration, bool wal, const Duration& group_commit_latency, uint32 max_group_commit);
     ~SQLiteStorage();
 
     virtual void start();
@@ -86,13 +93,14 @@ private:
 
         StorageAction& operator=(const StorageAction& rhs);
 
-        // Executes this action. Assumes the owning SQLiteStorage has setup the transaction.
-        Result execute(SQLiteDBPtr db, const Bucket& bucket, ReadSet* rs);
+        // Executes this action using the storage's prepared statements. Assumes
+        // the owning SQLiteStorage has setup the transaction.
+        Result execute(SQLiteStorage* storage, const Bucket& bucket, ReadSet* rs);
 
         // Executes this action, retrying the given number of times if there's a
         // temporary failure to lock the database. Assumes the owning
         // SQLiteStorage has setup the transaction.
-        Result executeWithRetry(SQLiteDBPtr db, const Bucket& bucket, ReadSet* rs, int32 retries, const Duration& retry_wait);
+        Result executeWithRetry(SQLiteStorage* storage, const Bucket& bucket, ReadSet* rs, int32 retries, const Duration& retry_wait);
 
         // Bucket is implicit, passed into execute
         Type type;
@@ -129,6 +137,29 @@ private:
     // all sqlite requests on the db ptr come from the same thread.
     void initDB();
 
+    // Statements are prepared the first time they're needed and then reset and
+    // reused. The bucket is a parameter so each one serves all buckets.
+    enum StatementType {
+        ReadValueStatement,
+        ReadRangeStatement,
+        WriteValueStatement,
+        EraseValueStatement,
+        EraseRangeStatement,
+        CountRangeStatement,
+        BeginStatement,
+        CommitStatement,
+        RollbackStatement,
+        NumStatementTypes
+    };
+    // Get a prepared statement, or NULL if it couldn't be prepared. Must be
+    // called from the IO thread.
+    sqlite3_stmt* getStatement(StatementType type);
+    // Finalize all prepared statements. Runs on the IO thread during stop().
+    void finalizeStatements();
+    // Executes one of the statements which take no parameters and return no
+    // data, e.g. begin and commit
+    bool executeControlStatement(StatementType type, const String& desc);
+
     // Gets the current transaction or creates one. Also can return whether the
     // transaction was just created, e.g. to tell whether an operation is an
     // implicit transaction.
@@ -145,7 +176,7 @@ private:
     // rollback/retrying.
     Result executeCommit(const Bucket& bucket, Transaction* trans, CommitCallback cb, ReadSet** read_set_out);
 
-    void executeCount(const String value_count, const Key& start, const Key& finish, CountCallback cb);
+    void executeCount(const Bucket& bucket, const Key& start, const Key& finish, CountCallback cb);
 
     // A few helper methods that wrap sql operations.
     bool sqlBeginTransaction();
@@ -178,6 +209,7 @@ private:
     BucketTransactions mTransactions;
     String mDBFilename;
     SQLiteDBPtr mDB;
+    sqlite3_stmt* mStatements[NumStatementTypes];
 
     // FIXME because we don't have proper multithreaded support in cppoh, we
     // need to allocate our own thread dedicated to IO
@@ -189,13 +221,18 @@ private:
     // those are used to separate the client ID and timestamp
     const String mSQLClientID;
     const Duration mLeaseDuration;
+    const bool mWAL;
 
     TransactionQueue mTransactionQueue;
     // Maximum transactions to combine into a single transaction in the
     // underlying database. TODO(ewencp) this should probably be dynamic, should
     // increase/decrease based on success/failure and avoid latency getting too
-    // hight. Right now we just have a reasonable, but small, number.
+    // hight.
     uint32 mMaxCoalescedTransactions;
+    // How long to let transactions accumulate before processing them once the
+    // queue becomes non-empty. Each batch costs one commit, so this trades
+    // commit latency for throughput when many buckets are committing.
+    const Duration mGroupCommitLatency;
 
     // Amount of time to sleep between retries. Shouldn't be too big or you can
     // back up all storage, but should be long enough that transient errors such
@@ -59,7 +59,15 @@ public:
     CoordinateSegmentation(SpaceContext* ctx);
     virtual ~CoordinateSegmentation();
 
+    typedef std::tr1::function<void(ServerID)> LookupCallback;
+
     virtual ServerID lookup(const Vector3f& pos) = 0;
+    /** Asynchronous version of lookup(pos). The default implementation just
+     *  calls lookup(pos), so cb is invoked before this returns.
+     *  Implementations that may have to wait on the network can invoke cb
+     *  later instead, on the main strand.
+     */
+    virtual void lookup(const Vector3f& pos, const LookupCallback& cb);
     virtual BoundingBoxList serverRegion(const ServerID& server)  = 0;
     virtual BoundingBox3f region()  = 0;
     virtual uint32 numServers()  = 0;
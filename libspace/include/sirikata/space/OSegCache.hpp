@@ -46,7 +46,7 @@ namespace Sirikata
       virtual ~OSegCache() {}
 
       virtual void insert(const UUID& uuid, const OSegEntry& sID) = 0;
-      virtual const OSegEntry& get(const UUID& uuid)              = 0;
+      virtual OSegEntry get(const UUID& uuid)                     = 0;
       virtual void remove(const UUID& uuid)                       = 0;
   };
 
@@ -166,6 +166,17 @@ public:
 
       
     virtual OSegEntry lookup(const UUID& obj_id) = 0;
+    /** Look up a group of objects at once. results is filled in with an entry
+     *  for each object, which is null if the result will be delivered later
+     *  through the lookup listener, just as for lookup(). The default just
+     *  calls lookup() for each object; implementations which can resolve many
+     *  objects with a single request should override it.
+     */
+    virtual void lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results) {
+        results->resize(obj_ids.size());
+        for(uint32 i = 0; i < obj_ids.size(); i++)
+            (*results)[i] = lookup(obj_ids[i]);
+    }
     virtual OSegEntry cacheLookup(const UUID& obj_id) = 0;
     virtual void migrateObject(const UUID& obj_id, const OSegEntry& new_server_id) = 0;
     virtual void addNewObject(const UUID& obj_id, float radius) = 0;
@@ -326,6 +326,67 @@ int CraqObjectSegmentation::getPushback()
       return CraqEntry::null();
 
 
+    OSegLookupTraceToken* traceToken = NULL;
+    CraqEntry localReturn = lookupLocally(obj_id, &traceToken);
+    if (localReturn.notNull())
+      return localReturn;
+
+    ++mOSegQueueLen;
+    traceToken->osegQLenPostQuery = mOSegQueueLen;
+    oStrand->post(
+        boost::bind(&CraqObjectSegmentation::beginCraqLookup,this,obj_id, traceToken),
+        "CraqObjectSegmentation::beginCraqLookup"
+    );
+
+    return CraqEntry::null();
+  }
+
+  void CraqObjectSegmentation::lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results)
+  {
+    results->assign(obj_ids.size(), CraqEntry::null());
+    if (mStopping)
+      return;
+
+    // Everything that has to go to CRAQ is handed to the oseg strand with a
+    // single post, rather than one per object
+    CraqLookupBatch* batch = NULL;
+    for (uint32 i = 0; i < obj_ids.size(); i++)
+    {
+      OSegLookupTraceToken* traceToken = NULL;
+      CraqEntry localReturn = lookupLocally(obj_ids[i], &traceToken);
+      if (localReturn.notNull())
+      {
+        (*results)[i] = localReturn;
+        continue;
+      }
+
+      if (batch == NULL)
+        batch = new CraqLookupBatch();
+      ++mOSegQueueLen;
+      traceToken->osegQLenPostQuery = mOSegQueueLen;
+      batch->push_back(std::make_pair(obj_ids[i], traceToken));
+    }
+
+    if (batch != NULL)
+    {
+      oStrand->post(
+          boost::bind(&CraqObjectSegmentation::beginCraqLookupBatch,this,batch),
+          "CraqObjectSegmentation::beginCraqLookupBatch"
+      );
+    }
+  }
+
+  void CraqObjectSegmentation::beginCraqLookupBatch(CraqLookupBatch* batch)
+  {
+    for (CraqLookupBatch::iterator it = batch->begin(); it != batch->end(); it++)
+      beginCraqLookup(it->first, it->second);
+    delete batch;
+  }
+
+  //Checks everything that can be answered without going to CRAQ. If that's
+  //not enough, returns null and a trace token for the CRAQ lookup.
+  CraqEntry CraqObjectSegmentation::lookupLocally(const UUID& obj_id, OSegLookupTraceToken** traceTokenOut)
+  {
     OSegLookupTraceToken* traceToken = new OSegLookupTraceToken(obj_id,shouldLog());
     traceToken->stamp(OSegLookupTraceToken::OSEG_TRACE_INITIAL_LOOKUP_TIME);
 
@@ -374,13 +435,7 @@ int CraqObjectSegmentation::getPushback()
 
     traceToken->stamp(OSegLookupTraceToken::OSEG_TRACE_CHECK_CACHE_LOCAL_END);
 
-    ++mOSegQueueLen;
-    traceToken->osegQLenPostQuery = mOSegQueueLen;
-    oStrand->post(
-        boost::bind(&CraqObjectSegmentation::beginCraqLookup,this,obj_id, traceToken),
-        "CraqObjectSegmentation::beginCraqLookup"
-    );
-
+    *traceTokenOut = traceToken;
     return CraqEntry::null();
   }
 
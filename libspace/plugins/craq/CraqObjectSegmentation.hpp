@@ -174,7 +174,10 @@ class CraqObjectSegmentation : public ObjectSegmentation
     OSegCache* mCraqCache;
     //end building for the cache
 
+    CraqEntry lookupLocally(const UUID& obj_id, OSegLookupTraceToken** traceTokenOut);
     void beginCraqLookup(const UUID& obj_id, OSegLookupTraceToken* traceToken);
+    typedef std::vector< std::pair<UUID, OSegLookupTraceToken*> > CraqLookupBatch;
+    void beginCraqLookupBatch(CraqLookupBatch* batch);
     void callOsegLookupCompleted(const UUID& obj_id, const CraqEntry& sID, OSegLookupTraceToken* traceToken);
 
       bool shouldLog();
@@ -187,6 +190,7 @@ class CraqObjectSegmentation : public ObjectSegmentation
 
       virtual ~CraqObjectSegmentation();
       virtual OSegEntry lookup(const UUID& obj_id);
+      virtual void lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results);
       virtual OSegEntry cacheLookup(const UUID& obj_id);
       virtual void migrateObject(const UUID& obj_id, const OSegEntry& new_server_id);
       virtual void addNewObject(const UUID& obj_id, float radius);
@@ -59,6 +59,23 @@ OSegEntry LocalObjectSegmentation::lookup(const UUID& obj_id) {
     return it->second;
 }
 
+void LocalObjectSegmentation::lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results) {
+    results->resize(obj_ids.size());
+    uint32 missing = 0;
+    for(uint32 i = 0; i < obj_ids.size(); i++) {
+        OSegMap::const_iterator it = mOSeg.find(obj_ids[i]);
+        if (it == mOSeg.end()) {
+            (*results)[i] = OSegEntry::null();
+            missing++;
+        }
+        else {
+            (*results)[i] = it->second;
+        }
+    }
+    if (missing > 0)
+        LOCALOSEG_LOG(warn, "Couldn't find " << missing << " of " << obj_ids.size() << " object OSegEntries in LocalObjectSegmentation.");
+}
+
 void LocalObjectSegmentation::addNewObject(const UUID& obj_id, float radius)
 {
     OSegWriteListener::OSegAddNewStatus status = OSegWriteListener::SUCCESS;
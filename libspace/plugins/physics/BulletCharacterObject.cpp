@@ -46,7 +46,7 @@ float32 BulletCharacterObject::mass() {
     return 0.f;
 }
 
-void BulletCharacterObject::load(Mesh::MeshdataPtr mesh) {
+void BulletCharacterObject::load(BulletShapeDataPtr shape) {
     LocationInfo& locinfo = mParent->info(mID);
 
     Vector3f objPosition = mParent->currentPosition(mID);
@@ -62,7 +62,7 @@ void BulletCharacterObject::load(Mesh::MeshdataPtr mesh) {
 
     // Currently only support spheres, TODO(ewencp) we might want to support
     // capsules instead.
-    mCollisionShape = computeCollisionShape(mID, mBBox, BULLET_OBJECT_TREATMENT_CHARACTER, Mesh::MeshdataPtr());
+    mCollisionShape = computeCollisionShape(mID, mBBox, BulletShapeDataPtr());
     mGhostObject->setCollisionShape(mCollisionShape);
     mGhostObject->setCollisionFlags(btCollisionObject::CF_CHARACTER_OBJECT);
 
@@ -81,13 +81,13 @@ void BulletCharacterObject::load(Mesh::MeshdataPtr mesh) {
     mParent->dynamicsWorld()->addAction(mCharacter);
 
     mParent->addTickObject(mID);
-    mParent->addDeactivateableObject(mID);
+    mParent->addDeactivateableObject(mID, mGhostObject);
 }
 
 void BulletCharacterObject::unload() {
     if (mCharacter) {
         mParent->removeTickObject(mID);
-        mParent->removeDeactivateableObject(mID);
+        mParent->removeDeactivateableObject(mGhostObject);
 
         mParent->dynamicsWorld()->removeAction(mCharacter);
         mParent->dynamicsWorld()->removeCollisionObject(mGhostObject);
@@ -159,11 +159,6 @@ void BulletCharacterObject::postTick(const Time& t) {
     }
 }
 
-void BulletCharacterObject::deactivationTick(const Time& t) {
-    if (mGhostObject != NULL && !mGhostObject->isActive())
-        mParent->updateObjectFromDeactivation(mID);
-}
-
 bool BulletCharacterObject::applyRequestedLocation(const TimedMotionVector3f& loc, uint64 epoch) {
     applyForcedLocation(loc, epoch);
     return true;
@@ -28,11 +28,10 @@ public:
     virtual bulletObjBBox bbox();
     virtual float32 mass();
 
-    virtual void load(Mesh::MeshdataPtr mesh);
+    virtual void load(BulletShapeDataPtr shape);
     virtual void unload();
     virtual void preTick(const Time& t);
     virtual void postTick(const Time& t);
-    virtual void deactivationTick(const Time& t);
 
 
     virtual bool applyRequestedLocation(const TimedMotionVector3f& loc, uint64 epoch);
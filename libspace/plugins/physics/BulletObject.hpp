@@ -30,11 +30,13 @@ public:
     virtual bulletObjBBox bbox() = 0;
     virtual float32 mass() = 0;
 
-    /** After the mesh has been downloaded and parsed (or immediately if no mesh
-     *  is required), this loads the object into the simulation. This should
-     *  setup any Bullet state and start the physical simulation on the object.
+    /** After the collision data has been computed from the mesh (or
+     *  immediately if no mesh is required), this loads the object into the
+     *  simulation. This should setup any Bullet state and start the physical
+     *  simulation on the object. shape is NULL if no mesh is required or it
+     *  couldn't be loaded. It may be shared with other objects.
      */
-    virtual void load(Mesh::MeshdataPtr mesh) = 0;
+    virtual void load(BulletShapeDataPtr shape) = 0;
 
     /** Unload the object from the simulation.
      */
@@ -53,12 +55,6 @@ public:
      */
     virtual void internalTick(const Time& t) {}
 
-    /** Check this object for deactivation. Implementations should call
-     *  BulletPhysicsService::updateObjectFromDeactivation if the object has
-     *  been deactivated.
-     */
-    virtual void deactivationTick(const Time& t) {}
-
 
 
     /** Try to apply the requested position to this object, updating
@@ -91,8 +87,10 @@ public:
 
 protected:
 
-    // Helper for computing the collision
-    btCollisionShape* computeCollisionShape(const UUID& id, bulletObjBBox shape_type, bulletObjTreatment treatment, Mesh::MeshdataPtr retrievedMesh);
+    // Helper for computing the collision shape. Falls back to a sphere if
+    // shape_data is NULL. The returned shape may refer to shape_data, so it
+    // must be deleted before shape_data is released.
+    btCollisionShape* computeCollisionShape(const UUID& id, bulletObjBBox shape_type, BulletShapeDataPtr shape_data);
 
     BulletPhysicsService* mParent;
 }; // class BulletObject
@@ -0,0 +1,200 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "BulletParallelDynamicsWorld.hpp"
+#include <algorithm>
+
+namespace Sirikata {
+
+class BulletParallelDynamicsWorld::IslandCollector : public btSimulationIslandManager::IslandCallback {
+public:
+    IslandCollector(BulletParallelDynamicsWorld* world)
+     : mWorld(world)
+    {}
+
+    virtual void ProcessIsland(btCollisionObject** bodies, int numBodies, btPersistentManifold** manifolds, int numManifolds, int islandId) {
+        // Only awake islands are processed
+        mWorld->mStepAwake.insert(mWorld->mStepAwake.end(), bodies, bodies + numBodies);
+
+        // Islands without contacts have nothing to solve
+        if (numManifolds == 0)
+            return;
+
+        TaskList& tasks = mWorld->mTasks;
+        if (tasks.empty() || tasks.back().numBodies >= MIN_TASK_BODIES) {
+            Task task;
+            task.firstBody = mWorld->mTaskBodies.size();
+            task.numBodies = 0;
+            task.firstManifold = mWorld->mTaskManifolds.size();
+            task.numManifolds = 0;
+            tasks.push_back(task);
+        }
+        mWorld->mTaskBodies.insert(mWorld->mTaskBodies.end(), bodies, bodies + numBodies);
+        mWorld->mTaskManifolds.insert(mWorld->mTaskManifolds.end(), manifolds, manifolds + numManifolds);
+        tasks.back().numBodies += numBodies;
+        tasks.back().numManifolds += numManifolds;
+    }
+
+private:
+    BulletParallelDynamicsWorld* mWorld;
+};
+
+
+BulletParallelDynamicsWorld::BulletParallelDynamicsWorld(btDispatcher* dispatcher, btBroadphaseInterface* broadphase, btConstraintSolver* solver, btCollisionConfiguration* config, uint32 num_threads)
+ : btDiscreteDynamicsWorld(dispatcher, broadphase, solver, config),
+   mSolverInfo(NULL),
+   mNextTask(0),
+   mGeneration(0),
+   mPendingWorkers(0),
+   mShutdown(false)
+{
+    if (num_threads == 0)
+        num_threads = std::max(Thread::hardware_concurrency(), (unsigned)1);
+
+    // The solvers keep per-step scratch data, so each thread needs its own.
+    for(uint32 i = 0; i < num_threads; i++)
+        mSolvers.push_back(new btSequentialImpulseConstraintSolver());
+    // The stepping thread does its share of the work, so it gets solver 0 and
+    // we only need workers for the rest.
+    for(uint32 i = 1; i < num_threads; i++) {
+        mWorkers.push_back(
+            new Thread("BulletParallelDynamicsWorld Worker", std::tr1::bind(&BulletParallelDynamicsWorld::workerMain, this, i))
+        );
+    }
+}
+
+BulletParallelDynamicsWorld::~BulletParallelDynamicsWorld() {
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mShutdown = true;
+    }
+    mWorkCond.notify_all();
+    for(uint32 i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->join();
+        delete mWorkers[i];
+    }
+    mWorkers.clear();
+
+    for(uint32 i = 0; i < mSolvers.size(); i++)
+        delete mSolvers[i];
+    mSolvers.clear();
+}
+
+void BulletParallelDynamicsWorld::removeRigidBody(btRigidBody* body) {
+    removeCollisionObject(body);
+}
+
+void BulletParallelDynamicsWorld::removeCollisionObject(btCollisionObject* obj) {
+    mAwake.erase(std::remove(mAwake.begin(), mAwake.end(), obj), mAwake.end());
+    mDeactivated.erase(std::remove(mDeactivated.begin(), mDeactivated.end(), obj), mDeactivated.end());
+
+    btRigidBody* body = btRigidBody::upcast(obj);
+    if (body != NULL)
+        btDiscreteDynamicsWorld::removeRigidBody(body);
+    else
+        btCollisionWorld::removeCollisionObject(obj);
+}
+
+void BulletParallelDynamicsWorld::getDeactivated(std::vector<btCollisionObject*>* deactivated) {
+    deactivated->clear();
+    deactivated->swap(mDeactivated);
+}
+
+void BulletParallelDynamicsWorld::updateAwake() {
+    // Bullet only deactivates whole islands while building them, and
+    // sleeping islands are skipped when they're processed, so anything
+    // that was awake last step and is now inactive just fell asleep.
+    for(uint32 i = 0; i < mAwake.size(); i++) {
+        if (!mAwake[i]->isActive())
+            mDeactivated.push_back(mAwake[i]);
+    }
+    mAwake.swap(mStepAwake);
+}
+
+void BulletParallelDynamicsWorld::solveConstraints(btContactSolverInfo& solverInfo) {
+    mStepAwake.clear();
+
+    if (getNumConstraints() > 0) {
+        btDiscreteDynamicsWorld::solveConstraints(solverInfo);
+
+        for(int i = 0; i < m_collisionObjects.size(); i++) {
+            btCollisionObject* obj = m_collisionObjects[i];
+            if (!obj->isStaticOrKinematicObject() && obj->isActive())
+                mStepAwake.push_back(obj);
+        }
+        updateAwake();
+        return;
+    }
+
+    mTaskBodies.clear();
+    mTaskManifolds.clear();
+    mTasks.clear();
+    IslandCollector collector(this);
+    getSimulationIslandManager()->buildAndProcessIslands(getCollisionWorld()->getDispatcher(), getCollisionWorld(), &collector);
+    updateAwake();
+
+    if (mTasks.empty())
+        return;
+
+    // Start the biggest tasks first so a big island picked up at the end
+    // doesn't leave the other threads idle.
+    std::sort(mTasks.begin(), mTasks.end());
+    mSolverInfo = &solverInfo;
+    mNextTask = 0;
+
+    if (mWorkers.empty() || mTasks.size() == 1) {
+        solveTasks(0);
+        return;
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mPendingWorkers = mWorkers.size();
+        mGeneration++;
+    }
+    mWorkCond.notify_all();
+
+    solveTasks(0);
+
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    while(mPendingWorkers > 0)
+        mDoneCond.wait(lock);
+}
+
+void BulletParallelDynamicsWorld::solveTasks(uint32 idx) {
+    btSequentialImpulseConstraintSolver* solver = mSolvers[idx];
+    for(uint32 t = mNextTask++; t < mTasks.size(); t = mNextTask++) {
+        const Task& task = mTasks[t];
+        // Tasks share static bodies, but the solver only reads those. The
+        // sequential impulse solver doesn't use the stack allocator and debug
+        // drawers aren't thread safe, so neither is passed in.
+        solver->solveGroup(
+            &mTaskBodies[task.firstBody], task.numBodies,
+            &mTaskManifolds[task.firstManifold], task.numManifolds,
+            NULL, 0,
+            *mSolverInfo, NULL, NULL, getDispatcher()
+        );
+    }
+}
+
+void BulletParallelDynamicsWorld::workerMain(uint32 idx) {
+    uint64 seen_generation = 0;
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    while(true) {
+        while(!mShutdown && mGeneration == seen_generation)
+            mWorkCond.wait(lock);
+        if (mShutdown)
+            break;
+        seen_generation = mGeneration;
+
+        lock.unlock();
+        solveTasks(idx);
+        lock.lock();
+
+        if (--mPendingWorkers == 0)
+            mDoneCond.notify_one();
+    }
+}
+
+} // namespace Sirikata
@@ -0,0 +1,114 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_BULLET_PHYSICS_PARALLEL_DYNAMICS_WORLD_HPP_
+#define _SIRIKATA_BULLET_PHYSICS_PARALLEL_DYNAMICS_WORLD_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <sirikata/core/util/AtomicTypes.hpp>
+
+#include "btBulletDynamicsCommon.h"
+
+namespace Sirikata {
+
+/** A btDiscreteDynamicsWorld which solves contact constraints for separate
+ *  simulation islands in parallel. Objects in different islands don't touch,
+ *  so their constraints are independent and each island can be solved by its
+ *  own btSequentialImpulseConstraintSolver. Islands are solved by a pool of
+ *  worker threads together with the thread calling stepSimulation, which
+ *  waits for all of them before integrating, so everything else, including
+ *  motion state and tick callbacks, still happens on the calling thread.
+ *
+ *  Worlds with typed constraints (joints) fall back to the serial solver,
+ *  since a constraint may tie together bodies the island manager would
+ *  otherwise split up.
+ *
+ *  This also tracks which objects Bullet puts to sleep, so they can be
+ *  handled when it happens instead of by polling every object.
+ */
+class BulletParallelDynamicsWorld : public btDiscreteDynamicsWorld {
+public:
+    /** Create a world. solver is only used when falling back to serial
+     *  solving. If num_threads is 0, one thread per core is used. Worker
+     *  threads are started immediately and run until the world is destroyed.
+     */
+    BulletParallelDynamicsWorld(btDispatcher* dispatcher, btBroadphaseInterface* broadphase, btConstraintSolver* solver, btCollisionConfiguration* config, uint32 num_threads = 0);
+    virtual ~BulletParallelDynamicsWorld();
+
+    // Number of threads solving islands, including the stepping thread
+    uint32 numThreads() const { return mSolvers.size(); }
+
+    virtual void removeRigidBody(btRigidBody* body);
+    virtual void removeCollisionObject(btCollisionObject* obj);
+
+    /** Get the objects which have been put to sleep since the last call.
+     *  Objects are only reported once per deactivation, and objects removed
+     *  from the world before the call aren't reported.
+     */
+    void getDeactivated(std::vector<btCollisionObject*>* deactivated);
+
+protected:
+    virtual void solveConstraints(btContactSolverInfo& solverInfo);
+
+private:
+    // A set of islands solved together, covering
+    // mTaskBodies[firstBody, firstBody+numBodies) and
+    // mTaskManifolds[firstManifold, firstManifold+numManifolds).
+    struct Task {
+        uint32 firstBody;
+        uint32 numBodies;
+        uint32 firstManifold;
+        uint32 numManifolds;
+
+        uint32 cost() const { return numBodies + numManifolds; }
+        bool operator<(const Task& rhs) const { return cost() > rhs.cost(); }
+    };
+    typedef std::vector<Task> TaskList;
+
+    class IslandCollector;
+
+    // Small islands are batched together until they have at least this many
+    // bodies, solving each one on its own has too much overhead.
+    static const uint32 MIN_TASK_BODIES = 32;
+
+    // Look for objects that fell asleep since the last step and make
+    // mStepAwake the new list of awake objects.
+    void updateAwake();
+
+    void workerMain(uint32 idx);
+    // Solve tasks until none are left. Runs in all threads.
+    void solveTasks(uint32 idx);
+
+    std::vector<btSequentialImpulseConstraintSolver*> mSolvers;
+    std::vector<Thread*> mWorkers;
+
+    // Work for the current step, only modified while workers are idle
+    btContactSolverInfo* mSolverInfo;
+    std::vector<btCollisionObject*> mTaskBodies;
+    std::vector<btPersistentManifold*> mTaskManifolds;
+    TaskList mTasks;
+    AtomicValue<uint32> mNextTask;
+
+    // Workers wait for mGeneration to change, which starts a new step, and
+    // signal mDoneCond when mPendingWorkers drops to 0.
+    boost::mutex mMutex;
+    boost::condition_variable mWorkCond;
+    boost::condition_variable mDoneCond;
+    uint64 mGeneration;
+    uint32 mPendingWorkers;
+    bool mShutdown;
+
+    // Objects that were awake during the last step and ones that have fallen
+    // asleep but haven't been collected yet.
+    std::vector<btCollisionObject*> mAwake;
+    std::vector<btCollisionObject*> mDeactivated;
+    // Scratch list for the objects awake in the current step, swapped into
+    // mAwake so neither list is reallocated every step.
+    std::vector<btCollisionObject*> mStepAwake;
+}; // class BulletParallelDynamicsWorld
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_BULLET_PHYSICS_PARALLEL_DYNAMICS_WORLD_HPP_
@@ -34,6 +34,7 @@
 #include "BulletObject.hpp"
 #include "BulletRigidBodyObject.hpp"
 #include "BulletCharacterObject.hpp"
+#include "BulletShapeCache.hpp"
 #include <sirikata/core/trace/Trace.hpp>
 #include <sirikata/mesh/CompositeFilter.hpp>
 
@@ -53,22 +54,24 @@ void bulletPhysicsInternalTickCallback(btDynamicsWorld *world, btScalar timeStep
 }
 }
 
-BulletPhysicsService::BulletPhysicsService(SpaceContext* ctx, LocationUpdatePolicy* update_policy)
+BulletPhysicsService::BulletPhysicsService(SpaceContext* ctx, LocationUpdatePolicy* update_policy, uint32 num_threads)
  : LocationService(ctx, update_policy),
    mUpdateIteration(0),
-   mParsingStrand( ctx->ioService->createStrand("BulletPhysicsService Parsing") )
+   mParsingStrand( ctx->ioService->createStrand("BulletPhysicsService Parsing") ),
+   mShapeCache(NULL),
+   mSimGeneration(0)
 {
 
     mBroadphase = new btDbvtBroadphase();
     collisionConfiguration = new btDefaultCollisionConfiguration();
     dispatcher = new btCollisionDispatcher(collisionConfiguration);
     solver = new btSequentialImpulseConstraintSolver;
-    mDynamicsWorld = new btDiscreteDynamicsWorld(dispatcher, mBroadphase, solver, collisionConfiguration);
+    mDynamicsWorld = new BulletParallelDynamicsWorld(dispatcher, mBroadphase, solver, collisionConfiguration, num_threads);
+    BULLETLOG(detailed, "Solving simulation islands with " << mDynamicsWorld->numThreads() << " threads");
     mDynamicsWorld->setInternalTickCallback(bulletPhysicsInternalTickCallback, (void*)this);
     mDynamicsWorld->setGravity(btVector3(0,-9.8,0));
 
     mLastTime = mContext->simTime();
-    mLastDeactivationTime = mContext->simTime();
 
     mModelsSystem = ModelsSystemFactory::getSingleton().getConstructor("any")("");
     try {
@@ -91,6 +94,11 @@ BulletPhysicsService::BulletPhysicsService(SpaceContext* ctx, LocationUpdatePoli
     mTransferMediator = &(Transfer::TransferMediator::getSingleton());
     mTransferPool = mTransferMediator->registerClient<Transfer::AggregatedTransferPool>("BulletPhysics");
 
+    mShapeCache = new BulletShapeCache(
+        mContext,
+        std::tr1::bind(&BulletPhysicsService::getMesh, this, _1, _2)
+    );
+
     BULLETLOG(detailed, "Service Loaded");
 }
 
@@ -108,6 +116,8 @@ BulletPhysicsService::~BulletPhysicsService() {
     delete collisionConfiguration;
     delete mBroadphase;
 
+    delete mShapeCache;
+
     delete mModelFilter;
     delete mModelsSystem;
     delete mParsingStrand;
@@ -152,27 +162,24 @@ void BulletPhysicsService::service() {
         locinfo.simObject->postTick(now);
     }
 
-    // Check for deactivated objects. Unfortunately there isn't a way to get
-    // this information from bullet at the time deactivation, so we need to poll
-    // for it
-    static Duration deactivation_check_interval(Duration::seconds(1));
-    if (now - mLastDeactivationTime > deactivation_check_interval) {
-        for(UUIDSet::iterator id_it = mDeactivateableObjects.begin(); id_it != mDeactivateableObjects.end(); id_it++) {
-            const UUID& locobj = *id_it;
-            LocationInfo& locinfo = mLocations[locobj];
-            assert(locinfo.simObject != NULL);
-            locinfo.simObject->deactivationTick(now);
-        }
-        mLastDeactivationTime = now;
+    // Handle objects that were put to sleep during this step
+    mDynamicsWorld->getDeactivated(&mDeactivated);
+    for(DeactivatedList::iterator obj_it = mDeactivated.begin(); obj_it != mDeactivated.end(); obj_it++) {
+        DeactivateableObjectMap::iterator it = mDeactivateableObjects.find(*obj_it);
+        if (it != mDeactivateableObjects.end())
+            updateObjectFromDeactivation(it->second);
     }
 
-    // Process location updates
-    for(UUIDSet::iterator i = physicsUpdates.begin(); i != physicsUpdates.end(); i++) {
+    // Process location updates. Swap out the pending updates first, so any
+    // updates generated by listeners are kept for the next tick instead of
+    // modifying the set we're iterating over.
+    physicsUpdates.swap(mNotifyingUpdates);
+    for(UUIDSet::iterator i = mNotifyingUpdates.begin(); i != mNotifyingUpdates.end(); i++) {
         LocationMap::iterator it = mLocations.find(*i);
         if(it != mLocations.end())
             notifyLocalLocationUpdated(*i, it->second.aggregate, it->second.props.location() );
     }
-    physicsUpdates.clear();
+    mNotifyingUpdates.clear();
 
     // See note at declaration of mUpdateIteration. The fastest possible update
     // rate depends on this constant (10) and the LocationService target tick
@@ -294,21 +301,21 @@ void BulletPhysicsService::setOrientation(const UUID& uuid, const TimedMotionQua
     notifyLocalOrientationUpdated( uuid, locinfo.aggregate, neworient );
 }
 
-void BulletPhysicsService::getMesh(const Transfer::URI meshURI, const UUID uuid, MeshdataParsedCallback cb) {
+void BulletPhysicsService::getMesh(const Transfer::URI meshURI, MeshdataParsedCallback cb) {
     Transfer::ResourceDownloadTaskPtr dl = Transfer::ResourceDownloadTask::construct(
         Transfer::URI(meshURI), mTransferPool, 1.0,
         // Ideally parsing wouldn't need to be serialized, but something about
         // getting callbacks from multiple threads and parsing simultaneously is
         // causing a crash
         mParsingStrand->wrap(
-            std::tr1::bind(&BulletPhysicsService::getMeshCallback, this, _1, _2, _3, cb)
+            std::tr1::bind(&BulletPhysicsService::getMeshCallback, this, meshURI, _1, _2, _3, cb)
         )
     );
-    mMeshDownloads[uuid] = dl;
+    mMeshDownloads[meshURI] = dl;
     dl->start();
 }
 
-void BulletPhysicsService::getMeshCallback(Transfer::ResourceDownloadTaskPtr taskptr, Transfer::TransferRequestPtr request, Transfer::DenseDataPtr response, MeshdataParsedCallback cb) {
+void BulletPhysicsService::getMeshCallback(const Transfer::URI meshURI, Transfer::ResourceDownloadTaskPtr taskptr, Transfer::TransferRequestPtr request, Transfer::DenseDataPtr response, MeshdataParsedCallback cb) {
     // This callback can come in on a separate thread (e.g. from a tranfer
     // thread) so make sure we get it back on the main thread.
     if (request && response) {
@@ -324,13 +331,18 @@ void BulletPhysicsService::getMeshCallback(Transfer::ResourceDownloadTaskPtr tas
             assert(output_data->single());
             mesh = std::tr1::dynamic_pointer_cast<Meshdata>(output_data->get());
         }
-        mContext->mainStrand->post(std::tr1::bind(cb, mesh), "BulletPhysicsService::getMeshCallback");
+        mContext->mainStrand->post(std::tr1::bind(&BulletPhysicsService::handleMeshRetrieved, this, meshURI, mesh, cb), "BulletPhysicsService::getMeshCallback");
     }
     else {
-        mContext->mainStrand->post(std::tr1::bind(cb, MeshdataPtr()), "BulletPhysicsService::getMeshCallback");
+        mContext->mainStrand->post(std::tr1::bind(&BulletPhysicsService::handleMeshRetrieved, this, meshURI, MeshdataPtr(), cb), "BulletPhysicsService::getMeshCallback");
     }
 }
 
+void BulletPhysicsService::handleMeshRetrieved(const Transfer::URI meshURI, MeshdataPtr mesh, MeshdataParsedCallback cb) {
+    mMeshDownloads.erase(meshURI);
+    cb(mesh);
+}
+
   void BulletPhysicsService::addLocalObject(const UUID& uuid, const TimedMotionVector3f& loc, const TimedMotionQuaternion& orient, const AggregateBoundingInfo& bnds, const String& msh, const String& phy, const String& query_data) {
     LocationMap::iterator it = mLocations.find(uuid);
 
@@ -407,6 +419,8 @@ void BulletPhysicsService::updatePhysicsWorld(const UUID& uuid) {
         delete locinfo.simObject;
         locinfo.simObject = NULL;
     }
+    // Any collision data still on its way is for the old settings
+    locinfo.simGeneration = ++mSimGeneration;
 
     // And then proceed to add the new simulated object into bullet
     switch(objTreatment) {
@@ -433,29 +447,38 @@ void BulletPhysicsService::updatePhysicsWorld(const UUID& uuid) {
     // treatment != ignore (see above check) && bounds != sphere.
     if (locinfo.simObject->bbox() == BULLET_OBJECT_BOUNDS_SPHERE) {
         // Invoke directly since we have all the data we need
-        updatePhysicsWorldWithMesh(uuid, MeshdataPtr());
+        updatePhysicsWorldWithShape(uuid, locinfo.simGeneration, BulletShapeDataPtr());
     }
     else {
-        getMesh(msh, uuid,
-            std::tr1::bind(&BulletPhysicsService::updatePhysicsWorldWithMesh, this, uuid, _1)
+        // Objects with the same mesh share the collision data, which is
+        // only downloaded and computed for the first one. This may invoke
+        // the callback immediately.
+        mShapeCache->getShape(
+            msh, BulletShapeData::typeFor(locinfo.simObject->bbox(), locinfo.simObject->treatment()),
+            std::tr1::bind(&BulletPhysicsService::updatePhysicsWorldWithShape, this, uuid, locinfo.simGeneration, _1)
         );
     }
 }
 
-void BulletPhysicsService::updatePhysicsWorldWithMesh(const UUID& uuid, MeshdataPtr retrievedMesh) {
+void BulletPhysicsService::updatePhysicsWorldWithShape(const UUID& uuid, uint64 generation, BulletShapeDataPtr shape) {
     LocationMap::iterator it = mLocations.find(uuid);
     // It's possible it has already disconnected. TODO(ewencp) we
     // should clear the download instead of waiting for it to finish,
-    // but this works for now. Actually, we should also make sure that
-    // the data still matches (we could change physics to A, change it
-    // to B, have them processed async, finish B, then finish A,
-    // resulting in simulation that doesn't match the settings in the
-    // locinfo).
+    // but this works for now.
     if (it == mLocations.end()) return;
 
     LocationInfo& locinfo = it->second;
-
-    locinfo.simObject->load(retrievedMesh);
+    // Or its physics settings may have changed to ignore it
+    if (locinfo.simObject == NULL) return;
+    // Or changed to something else since this data was requested (we could
+    // change physics to A, change it to B, have them processed async, finish
+    // B, then finish A). The current object already has its own request, and
+    // loading this data as well would load it twice, possibly with the wrong
+    // type of shape.
+    if (locinfo.simGeneration != generation) return;
+    assert(!shape || shape->type() == BulletShapeData::typeFor(locinfo.simObject->bbox(), locinfo.simObject->treatment()));
+
+    locinfo.simObject->load(shape);
 }
 
 // Helper for cleaning up a LocationInfo before removing it
@@ -515,11 +538,11 @@ void BulletPhysicsService::removeInternalTickObject(const UUID& uuid) {
         mInternalTickObjects.erase(dynamic_obj_it);
 }
 
-void BulletPhysicsService::addDeactivateableObject(const UUID& uuid) {
-    mDeactivateableObjects.insert(uuid);
+void BulletPhysicsService::addDeactivateableObject(const UUID& uuid, btCollisionObject* obj) {
+    mDeactivateableObjects[obj] = uuid;
 }
-void BulletPhysicsService::removeDeactivateableObject(const UUID& uuid) {
-    UUIDSet::iterator dynamic_obj_it = mDeactivateableObjects.find(uuid);
+void BulletPhysicsService::removeDeactivateableObject(btCollisionObject* obj) {
+    DeactivateableObjectMap::iterator dynamic_obj_it = mDeactivateableObjects.find(obj);
     if (dynamic_obj_it != mDeactivateableObjects.end())
         mDeactivateableObjects.erase(dynamic_obj_it);
 }
@@ -979,6 +1002,8 @@ void BulletPhysicsService::commandProperties(const Command::Command& cmd, Comman
     result.put("objects.local_count", local_count);
     result.put("objects.aggregate_count", aggregate_count);
     result.put("objects.local_aggregate_count", local_aggregate_count);
+    result.put("collision_shapes.cached", mShapeCache->size());
+    result.put("simulation.threads", mDynamicsWorld->numThreads());
 
     cmdr->result(cmdid, result);
 }
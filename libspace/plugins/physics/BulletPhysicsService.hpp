@@ -45,16 +45,22 @@
 #include <sirikata/mesh/Meshdata.hpp>
 
 #include "Defs.hpp"
+#include "BulletParallelDynamicsWorld.hpp"
 
 namespace Sirikata {
 
+class BulletShapeCache;
+
 using namespace Mesh;
 /** Standard location service, which functions entirely based on location
  *  updates from objects and other spaces servers.
  */
 class BulletPhysicsService : public LocationService {
 public:
-    BulletPhysicsService(SpaceContext* ctx, LocationUpdatePolicy* update_policy);
+    /** Create a physics service. num_threads threads are used to step the
+     *  simulation, or one per core if it is 0.
+     */
+    BulletPhysicsService(SpaceContext* ctx, LocationUpdatePolicy* update_policy, uint32 num_threads = 0);
     virtual ~BulletPhysicsService();
 
     virtual bool contains(const UUID& uuid) const;
@@ -112,16 +118,16 @@ public:
 
 
     typedef std::tr1::function<void(MeshdataPtr)> MeshdataParsedCallback;
-    void getMesh(const Transfer::URI meshURI, const UUID uuid, MeshdataParsedCallback cb);
+    void getMesh(const Transfer::URI meshURI, MeshdataParsedCallback cb);
     // The last two get set in this callback, indicating that the
     // transfer finished (whether or not it was successful) and the
     // resulting data.
-    void getMeshCallback(Transfer::ResourceDownloadTaskPtr taskptr, Transfer::TransferRequestPtr request, Transfer::DenseDataPtr response, MeshdataParsedCallback cb);
+    void getMeshCallback(const Transfer::URI meshURI, Transfer::ResourceDownloadTaskPtr taskptr, Transfer::TransferRequestPtr request, Transfer::DenseDataPtr response, MeshdataParsedCallback cb);
 
     LocationInfo& info(const UUID& uuid);
     const LocationInfo& info(const UUID& uuid) const;
 
-    btDiscreteDynamicsWorld* dynamicsWorld() { return mDynamicsWorld; }
+    BulletParallelDynamicsWorld* dynamicsWorld() { return mDynamicsWorld; }
     btBroadphaseInterface* broadphase() { return mBroadphase; }
 
     // Objects that want callbacks for each tick, e.g. for grabbing updates that
@@ -132,9 +138,10 @@ public:
     // velocity
     void addInternalTickObject(const UUID& uuid);
     void removeInternalTickObject(const UUID& uuid);
-    // Objects that want deactivation check callbacks
-    void addDeactivateableObject(const UUID& uuid);
-    void removeDeactivateableObject(const UUID& uuid);
+    // Objects that need updates when Bullet deactivates them. obj is the
+    // object's representation in the dynamics world.
+    void addDeactivateableObject(const UUID& uuid, btCollisionObject* obj);
+    void removeDeactivateableObject(btCollisionObject* obj);
 
     // Add an update for this object, i.e. it was detected that it moved
     void addUpdate(const UUID& uuid);
@@ -155,11 +162,19 @@ protected:
     // Which objects have dynamic physical simulation and need to be
     // sanity checked at each tick.
     UUIDSet mInternalTickObjects;
-    // Objects that need to be checked for deactivation
-    UUIDSet mDeactivateableObjects;
+    // Objects that need updates on deactivation, indexed by their collision
+    // objects since that's how the dynamics world reports them.
+    typedef std::tr1::unordered_map<btCollisionObject*, UUID> DeactivateableObjectMap;
+    DeactivateableObjectMap mDeactivateableObjects;
+    // Scratch list for collecting deactivated objects each tick
+    typedef std::vector<btCollisionObject*> DeactivatedList;
+    DeactivatedList mDeactivated;
     // Objects which have outstanding updates to location information
-    // from the physics engine.
+    // from the physics engine. These are swapped into mNotifyingUpdates while
+    // listeners are notified, so updates made during notification are
+    // buffered for the next tick.
     UUIDSet physicsUpdates;
+    UUIDSet mNotifyingUpdates;
     // TODO(ewencp) This is kind of a hack. If we generate updates too quickly
     // we can overwhelm the client and the networking, making it hard for more
     // recent updates to get out. This is common for bullet since it is
@@ -168,15 +183,22 @@ protected:
     // for updates to reach the OH.
     uint32 mUpdateIteration;
 
-    typedef std::tr1::unordered_map<UUID, Transfer::ResourceDownloadTaskPtr, UUID::Hasher> MeshDownloadMap;
+    // Outstanding mesh downloads. BulletShapeCache only requests each mesh
+    // once at a time, so they're indexed by URI.
+    typedef std::tr1::unordered_map<Transfer::URI, Transfer::ResourceDownloadTaskPtr, Transfer::URI::Hasher> MeshDownloadMap;
     MeshDownloadMap mMeshDownloads;
 
 private:
 
     void updatePhysicsWorld(const UUID& uuid);
-    // This continues the work of updatePhysicsWorld once the mesh has
-    // been retrieved.
-    void updatePhysicsWorldWithMesh(const UUID& uuid, MeshdataPtr retrievedMesh);
+    // This continues the work of updatePhysicsWorld once the collision data
+    // has been computed from the mesh.
+    // generation is the object's simGeneration when the data was requested,
+    // if it's changed since then the data is stale.
+    void updatePhysicsWorldWithShape(const UUID& uuid, uint64 generation, BulletShapeDataPtr shape);
+
+    // Finishes getMesh on the main strand
+    void handleMeshRetrieved(const Transfer::URI meshURI, MeshdataPtr mesh, MeshdataParsedCallback cb);
 
     // Helper for cleaning up a LocationInfo before removing it
     void cleanupLocationInfo(LocationInfo& locinfo);
@@ -187,11 +209,9 @@ private:
     btDefaultCollisionConfiguration* collisionConfiguration;
     btCollisionDispatcher* dispatcher;
     btSequentialImpulseConstraintSolver* solver;
-    btDiscreteDynamicsWorld* mDynamicsWorld;
+    BulletParallelDynamicsWorld* mDynamicsWorld;
 
     Time mLastTime;
-    // Track last time we checked deactivation state
-    Time mLastDeactivationTime;
 
     //load meshes to create appropriate bounding volumes
     ModelsSystem* mModelsSystem;
@@ -200,6 +220,11 @@ private:
     Transfer::TransferMediator *mTransferMediator;
     Transfer::TransferPoolPtr mTransferPool;
     Network::IOStrand* mParsingStrand;
+    // Collision data shared by objects with the same mesh
+    BulletShapeCache* mShapeCache;
+    // Last simGeneration given to an object. Shared by all objects so it
+    // isn't reused if an object is removed and added again.
+    uint64 mSimGeneration;
 }; // class BulletPhysicsService
 
 } // namespace Sirikata
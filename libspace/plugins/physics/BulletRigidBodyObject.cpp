@@ -73,8 +73,9 @@ BulletRigidBodyObject::~BulletRigidBodyObject() {
     removeRigidBody();
 }
 
-void BulletRigidBodyObject::load(MeshdataPtr retrievedMesh) {
-    mObjShape = computeCollisionShape(mID, mBBox, mTreatment, retrievedMesh);
+void BulletRigidBodyObject::load(BulletShapeDataPtr shape) {
+    mShapeData = shape;
+    mObjShape = computeCollisionShape(mID, mBBox, mShapeData);
     assert(mObjShape != NULL);
     addRigidBody();
 }
@@ -124,7 +125,7 @@ void BulletRigidBodyObject::addRigidBody() {
     // And if its dynamic, make sure its in our list of objects to
     // track for sanity checking
     mParent->addInternalTickObject(mID);
-    mParent->addDeactivateableObject(mID);
+    mParent->addDeactivateableObject(mID, mObjRigidBody);
 }
 
 void BulletRigidBodyObject::unload() {
@@ -134,16 +135,17 @@ void BulletRigidBodyObject::unload() {
 void BulletRigidBodyObject::removeRigidBody() {
     if (mObjRigidBody) {
         mParent->dynamicsWorld()->removeRigidBody(mObjRigidBody);
+        mParent->removeDeactivateableObject(mObjRigidBody);
 
         delete mObjShape;
         mObjShape = NULL;
+        mShapeData.reset();
         delete mObjMotionState;
         mObjMotionState = NULL;
         delete mObjRigidBody;
         mObjRigidBody = NULL;
 
         mParent->removeInternalTickObject(mID);
-        mParent->removeDeactivateableObject(mID);
     }
 }
 
@@ -207,11 +209,6 @@ void BulletRigidBodyObject::internalTick(const Time& t) {
     capAngularVelocity(mObjRigidBody, 4*3.14159);
 }
 
-void BulletRigidBodyObject::deactivationTick(const Time& t) {
-    if (mObjRigidBody != NULL && !mObjRigidBody->isActive())
-        mParent->updateObjectFromDeactivation(mID);
-}
-
 
 bool BulletRigidBodyObject::applyRequestedLocation(const TimedMotionVector3f& loc, uint64 epoch) {
     // We can move any dynamic objects, but we'll require that static objects
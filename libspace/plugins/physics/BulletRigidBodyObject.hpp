@@ -25,10 +25,9 @@ public:
     virtual bulletObjBBox bbox() { return mBBox; }
     virtual float32 mass() { return mMass; }
 
-    virtual void load(Mesh::MeshdataPtr mesh);
+    virtual void load(BulletShapeDataPtr shape);
     virtual void unload();
     virtual void internalTick(const Time& t);
-    virtual void deactivationTick(const Time& t);
 
 
     virtual bool applyRequestedLocation(const TimedMotionVector3f& loc, uint64 epoch);
@@ -53,6 +52,8 @@ private:
     float32 mMass;
     // And then some implementation data:
     btCollisionShape* mObjShape;
+    // Shared data mObjShape may refer to
+    BulletShapeDataPtr mShapeData;
     SirikataMotionState* mObjMotionState;
     btRigidBody* mObjRigidBody;
 
@@ -0,0 +1,274 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "BulletShapeCache.hpp"
+
+#include "BulletCollision/CollisionShapes/btShapeHull.h"
+#include "BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h"
+
+#include <sirikata/mesh/Bounds.hpp>
+
+namespace Sirikata {
+
+BulletShapeData::Type BulletShapeData::typeFor(bulletObjBBox shape_type, bulletObjTreatment treatment) {
+    assert(shape_type != BULLET_OBJECT_BOUNDS_SPHERE);
+    if (shape_type == BULLET_OBJECT_BOUNDS_ENTIRE_OBJECT)
+        return BOX;
+
+    // Per-triangle. If the object is static, we can use the full mesh (a
+    // BVH). If it's dynamic, we need to simplify to a convex hull since we
+    // *can't* collide to btBvhTriangleMeshShapes.
+    switch(treatment) {
+      case BULLET_OBJECT_TREATMENT_STATIC:
+        return TRIANGLE_MESH;
+      case BULLET_OBJECT_TREATMENT_DYNAMIC:
+      case BULLET_OBJECT_TREATMENT_LINEAR_DYNAMIC:
+      case BULLET_OBJECT_TREATMENT_VERTICAL_DYNAMIC:
+        return CONVEX_HULL;
+      case BULLET_OBJECT_TREATMENT_IGNORE:
+      case BULLET_OBJECT_TREATMENT_CHARACTER:
+        assert(false && "Shouldn't be computing per-triangle collision shape for 'ignore' or 'character' treatments");
+        break;
+      default:
+        assert(false && "Unhandled treatment type when building per-triangle collision shape");
+        break;
+    }
+    return CONVEX_HULL;
+}
+
+BulletShapeData::BulletShapeData(Type type, Mesh::MeshdataPtr mesh)
+ : mType(type),
+   mHalfExtents(0, 0, 0),
+   mTriangles(NULL),
+   mTriangleShape(NULL)
+{
+    /***Let's now find the bounding box for the entire object, which is needed for re-scaling purposes.
+	* Supposedly the system scales every mesh down to a unit sphere and then scales up by the scale factor
+	* from the scene file. We try to emulate this behavior here, but this should really be on the CDN side
+	* (we retrieve the precomputed bounding box as well as the mesh) ***/
+    BoundingBox3f3f bbox;
+    double mesh_rad;
+    Mesh::ComputeBounds(mesh, &bbox, &mesh_rad);
+
+    BULLETLOG(detailed, "bbox: " << bbox);
+
+    if (mType == BOX) {
+        Vector3f diff = bbox.max() - bbox.min();
+        mHalfExtents = btVector3(fabs(diff.x/2/mesh_rad), fabs(diff.y/2/mesh_rad), fabs(diff.z/2/mesh_rad));
+        return;
+    }
+
+    // The raw mesh data is scaled down to unit size, instantiate() scales it
+    // up to the requested size.
+    Matrix4x4f scale_to_unit = Matrix4x4f::scale(1.f/mesh_rad);
+    Mesh::Meshdata::GeometryInstanceIterator geoIter = mesh->getGeometryInstanceIterator();
+    //we need to pass the triangles to Bullet
+    btTriangleMesh* meshToConstruct = new btTriangleMesh(false, false);
+    //loop through the instances, applying the new transformations to vertices
+    //and adding them to the Bullet mesh
+    uint32 indexInstance;
+    Matrix4x4f transformInstance;
+    std::vector<int> gIndices;
+    std::vector<Vector3f> gVertices;
+    while(geoIter.next(&indexInstance, &transformInstance)) {
+        // Note: Scale to unit *after* transforming the
+        // instanced geometry to its location --
+        // scale_to_unit is applied to the mesh as a whole!
+        transformInstance = scale_to_unit * transformInstance;
+        const Mesh::GeometryInstance* geoInst = &(mesh->instances[indexInstance]);
+        const Mesh::SubMeshGeometry* subGeom = &(mesh->geometry[geoInst->geometryIndex]);
+
+        gVertices.clear();
+        for(unsigned int j=0; j < subGeom->positions.size(); j++)
+            gVertices.push_back(transformInstance * subGeom->positions[j]);
+
+        for(unsigned int i = 0; i < subGeom->primitives.size(); i++) {
+            gIndices.clear();
+            for(unsigned int j=0; j < subGeom->primitives[i].indices.size(); j++)
+                gIndices.push_back((int)(subGeom->primitives[i].indices[j]));
+
+            // Note the condition on the loop. Sometimes we get lists with weird
+            // setups, e.g. only 2 indices, so we need to make sure all 3 indices
+            // we'll use are in range.
+            for(unsigned int j=0; j+2 < gIndices.size(); j+=3) {
+                meshToConstruct->addTriangle(
+                    btVector3( gVertices[gIndices[j]].x, gVertices[gIndices[j]].y, gVertices[gIndices[j]].z ),
+                    btVector3( gVertices[gIndices[j+1]].x, gVertices[gIndices[j+1]].y, gVertices[gIndices[j+1]].z ),
+                    btVector3( gVertices[gIndices[j+2]].x, gVertices[gIndices[j+2]].y, gVertices[gIndices[j+2]].z )
+                );
+            }
+        }
+    }
+    BULLETLOG(detailed, "bounds radius: " << mesh_rad);
+    BULLETLOG(detailed, "Num of triangles in mesh: " << meshToConstruct->getNumTriangles());
+
+    if (mType == TRIANGLE_MESH) {
+        mTriangles = meshToConstruct;
+        mTriangleShape = new btBvhTriangleMeshShape(mTriangles, true);
+        return;
+    }
+
+    assert(mType == CONVEX_HULL);
+    btConvexShape* tmpConvexShape = new btConvexTriangleMeshShape(meshToConstruct);
+
+    BULLETLOG(detailed, "Building simplified convex hull for dynamic per-triangle collisions");
+    BULLETLOG(detailed, " original numTriangles = " << meshToConstruct->getNumTriangles());
+
+    //create a hull approximation
+    btShapeHull* hull = new btShapeHull(tmpConvexShape);
+    btScalar margin = tmpConvexShape->getMargin();
+    hull->buildHull(margin);
+
+    BULLETLOG(detailed, " new numTriangles = " << hull->numTriangles());
+    BULLETLOG(detailed, " new numIndices = " << hull->numIndices());
+    BULLETLOG(detailed, " new numVertices = " << hull->numVertices());
+
+    for (int32 i = 0; i < hull->numVertices(); i++)
+        mHullPoints.push_back(hull->getVertexPointer()[i]);
+
+    delete hull;
+    delete tmpConvexShape;
+    delete meshToConstruct;
+}
+
+BulletShapeData::~BulletShapeData() {
+    delete mTriangleShape;
+    delete mTriangles;
+}
+
+btCollisionShape* BulletShapeData::instantiate(float32 radius) const {
+    btVector3 scale(radius, radius, radius);
+    switch(mType) {
+      case BOX:
+        return new btBoxShape(mHalfExtents * radius);
+      case TRIANGLE_MESH:
+        // Shares the BVH instead of copying it
+        return new btScaledBvhTriangleMeshShape(mTriangleShape, scale);
+      case CONVEX_HULL:
+        {
+            // Hulls are small enough that a copy per object is cheap
+            btConvexHullShape* shape = new btConvexHullShape();
+            for(int i = 0; i < mHullPoints.size(); i++)
+                shape->addPoint(mHullPoints[i]);
+            shape->setLocalScaling(scale);
+            return shape;
+        }
+    }
+    return NULL;
+}
+
+
+
+BulletShapeCache::BulletShapeCache(SpaceContext* ctx, const MeshFetcher& fetcher)
+ : mContext(ctx),
+   mFetcher(fetcher),
+   mPruneSize(MIN_PRUNE_SIZE),
+   mBuildPool(new Network::IOServicePool("BulletShapeCache Build", NUM_BUILD_THREADS))
+{
+    mBuildPool->startWork();
+    mBuildPool->run();
+}
+
+BulletShapeCache::~BulletShapeCache() {
+    mBuildPool->stopWork();
+    mBuildPool->join();
+    delete mBuildPool;
+}
+
+void BulletShapeCache::getShape(const Transfer::URI& mesh, BulletShapeData::Type type, const ShapeCallback& cb) {
+    ShapeKey key(mesh, type);
+    ShapeMap::iterator it = mShapes.find(key);
+    if (it != mShapes.end()) {
+        if (!it->second.waiting.empty()) {
+            it->second.waiting.push_back(cb);
+            return;
+        }
+        BulletShapeDataPtr shape = it->second.shape.lock();
+        if (shape) {
+            cb(shape);
+            return;
+        }
+        // Everybody that was using it has been unloaded, so we need to
+        // compute it again.
+    }
+    else {
+        pruneExpired();
+        it = mShapes.insert(ShapeMap::value_type(key, ShapeEntry())).first;
+    }
+    it->second.waiting.push_back(cb);
+
+    // Different types of shapes for the same mesh only need one download
+    MeshRequestMap::iterator mesh_it = mMeshRequests.find(mesh);
+    if (mesh_it != mMeshRequests.end()) {
+        mesh_it->second.push_back(type);
+        return;
+    }
+    mMeshRequests[mesh].push_back(type);
+    mFetcher(mesh, std::tr1::bind(&BulletShapeCache::handleMeshRetrieved, this, mesh, std::tr1::placeholders::_1));
+}
+
+void BulletShapeCache::pruneExpired() {
+    if (mShapes.size() < mPruneSize) return;
+
+    for(ShapeMap::iterator it = mShapes.begin(); it != mShapes.end(); ) {
+        // Entries still being computed have an empty shape but aren't
+        // expired
+        if (it->second.waiting.empty() && it->second.shape.expired())
+            mShapes.erase(it++);
+        else
+            it++;
+    }
+    mPruneSize = std::max((uint32)MIN_PRUNE_SIZE, (uint32)mShapes.size() * 2);
+}
+
+void BulletShapeCache::handleMeshRetrieved(const Transfer::URI& uri, Mesh::MeshdataPtr mesh) {
+    MeshRequestMap::iterator mesh_it = mMeshRequests.find(uri);
+    assert(mesh_it != mMeshRequests.end());
+    ShapeTypeList types;
+    types.swap(mesh_it->second);
+    mMeshRequests.erase(mesh_it);
+
+    for(ShapeTypeList::iterator type_it = types.begin(); type_it != types.end(); type_it++) {
+        ShapeKey key(uri, *type_it);
+        if (!mesh) {
+            BULLETLOG(error, "Couldn't retrieve mesh " << uri << " for collision shape");
+            finishShape(key, BulletShapeDataPtr());
+            continue;
+        }
+        mBuildPool->service()->post(
+            std::tr1::bind(&BulletShapeCache::buildShape, this, key, mesh),
+            "BulletShapeCache::buildShape"
+        );
+    }
+}
+
+void BulletShapeCache::buildShape(const ShapeKey& key, Mesh::MeshdataPtr mesh) {
+    BulletShapeData* data = new BulletShapeData(key.second, mesh);
+    mContext->mainStrand->post(
+        std::tr1::bind(&BulletShapeCache::handleShapeBuilt, this, key, data),
+        "BulletShapeCache::handleShapeBuilt"
+    );
+}
+
+void BulletShapeCache::handleShapeBuilt(const ShapeKey& key, BulletShapeData* data) {
+    finishShape(key, BulletShapeDataPtr(data));
+}
+
+void BulletShapeCache::finishShape(const ShapeKey& key, BulletShapeDataPtr shape) {
+    ShapeMap::iterator it = mShapes.find(key);
+    assert(it != mShapes.end());
+
+    ShapeCallbackList waiting;
+    waiting.swap(it->second.waiting);
+    // Failures aren't cached so the download is retried next time
+    if (shape)
+        it->second.shape = shape;
+    else
+        mShapes.erase(it);
+
+    for(ShapeCallbackList::iterator cb_it = waiting.begin(); cb_it != waiting.end(); cb_it++)
+        (*cb_it)(shape);
+}
+
+} // namespace Sirikata
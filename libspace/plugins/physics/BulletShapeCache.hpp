@@ -0,0 +1,138 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_BULLET_PHYSICS_SHAPE_CACHE_HPP_
+#define _SIRIKATA_BULLET_PHYSICS_SHAPE_CACHE_HPP_
+
+#include "Defs.hpp"
+#include <sirikata/space/SpaceContext.hpp>
+#include <sirikata/core/network/IOServicePool.hpp>
+#include <sirikata/core/transfer/URI.hpp>
+
+#include "btBulletDynamicsCommon.h"
+
+namespace Sirikata {
+
+/** Collision data computed from a mesh, which can be shared by every object
+ *  using that mesh. Everything is stored at unit scale, each object creates
+ *  its own lightweight shape scaled to its size with instantiate().
+ */
+class BulletShapeData {
+public:
+    BT_DECLARE_ALIGNED_ALLOCATOR();
+
+    enum Type {
+        // Bounding box of the entire mesh
+        BOX,
+        // Full triangle mesh in a BVH, only usable for static objects
+        TRIANGLE_MESH,
+        // Convex hull of the mesh, for dynamic objects
+        CONVEX_HULL
+    };
+    // Get the type of data needed for the given bounds and treatment. Only
+    // valid for bounds that need a mesh, i.e. not spheres.
+    static Type typeFor(bulletObjBBox shape_type, bulletObjTreatment treatment);
+
+    /** Compute the collision data for mesh. This can be expensive, so it
+     *  shouldn't be done on the main strand.
+     */
+    BulletShapeData(Type type, Mesh::MeshdataPtr mesh);
+    ~BulletShapeData();
+
+    Type type() const { return mType; }
+
+    /** Create a new collision shape from this data, scaled up to the given
+     *  radius. The caller owns the returned shape, but it may refer to this
+     *  data so it must be deleted before this data is.
+     */
+    btCollisionShape* instantiate(float32 radius) const;
+
+private:
+    BulletShapeData();
+    BulletShapeData(const BulletShapeData&);
+
+    Type mType;
+    // BOX
+    btVector3 mHalfExtents;
+    // TRIANGLE_MESH
+    btTriangleMesh* mTriangles;
+    btBvhTriangleMeshShape* mTriangleShape;
+    // CONVEX_HULL
+    btAlignedObjectArray<btVector3> mHullPoints;
+}; // class BulletShapeData
+
+
+/** Shares collision data between objects with the same mesh. Meshes are
+ *  downloaded and parsed once per URI and collision data is computed once per
+ *  URI and type of data, on a separate pool of threads. Entries are
+ *  reference counted and their data is freed when the last object using them
+ *  is unloaded. The unused entries are pruned as new ones are added.
+ *
+ *  Must only be used from the main strand.
+ */
+class BulletShapeCache {
+public:
+    typedef std::tr1::function<void(BulletShapeDataPtr)> ShapeCallback;
+    typedef std::tr1::function<void(Mesh::MeshdataPtr)> MeshCallback;
+    typedef std::tr1::function<void(const Transfer::URI&, MeshCallback)> MeshFetcher;
+
+    // Mesh is retrieved with fetcher, which should invoke its callback on
+    // the main strand.
+    BulletShapeCache(SpaceContext* ctx, const MeshFetcher& fetcher);
+    ~BulletShapeCache();
+
+    /** Get collision data for the given mesh. cb is invoked immediately if
+     *  the data is already available, otherwise it is invoked later on the
+     *  main strand. If the mesh can't be retrieved, cb gets a NULL pointer.
+     */
+    void getShape(const Transfer::URI& mesh, BulletShapeData::Type type, const ShapeCallback& cb);
+
+    // Number of cached entries, including ones that are still being computed
+    // and ones that are no longer in use but haven't been pruned yet.
+    uint32 size() const { return mShapes.size(); }
+
+private:
+    typedef std::pair<Transfer::URI, BulletShapeData::Type> ShapeKey;
+    typedef std::vector<ShapeCallback> ShapeCallbackList;
+    struct ShapeEntry {
+        std::tr1::weak_ptr<BulletShapeData> shape;
+        // Requests waiting for the shape to be computed. Non-empty exactly
+        // when the shape is being computed.
+        ShapeCallbackList waiting;
+    };
+    typedef std::map<ShapeKey, ShapeEntry> ShapeMap;
+
+    // Requests for shapes waiting on the same mesh download
+    typedef std::vector<BulletShapeData::Type> ShapeTypeList;
+    typedef std::tr1::unordered_map<Transfer::URI, ShapeTypeList, Transfer::URI::Hasher> MeshRequestMap;
+
+    // Number of threads computing collision data.
+    static const uint32 NUM_BUILD_THREADS = 2;
+    // Entries which are no longer in use aren't pruned until there are at
+    // least this many
+    static const uint32 MIN_PRUNE_SIZE = 64;
+
+    // Remove entries for shapes nobody is using anymore, if the cache has
+    // grown enough since the last time.
+    void pruneExpired();
+
+    void handleMeshRetrieved(const Transfer::URI& uri, Mesh::MeshdataPtr mesh);
+    // Runs in the build pool
+    void buildShape(const ShapeKey& key, Mesh::MeshdataPtr mesh);
+    void handleShapeBuilt(const ShapeKey& key, BulletShapeData* data);
+    void finishShape(const ShapeKey& key, BulletShapeDataPtr shape);
+
+    SpaceContext* mContext;
+    MeshFetcher mFetcher;
+    ShapeMap mShapes;
+    // Prune once mShapes reaches this size, so pruning is amortized over
+    // the insertions in between.
+    uint32 mPruneSize;
+    MeshRequestMap mMeshRequests;
+    Network::IOServicePool* mBuildPool;
+}; // class BulletShapeCache
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_BULLET_PHYSICS_SHAPE_CACHE_HPP_
@@ -18,6 +18,8 @@ namespace Sirikata {
 class SirikataMotionState;
 class BulletObject;
 class BulletPhysicsService;
+class BulletShapeData;
+typedef std::tr1::shared_ptr<BulletShapeData> BulletShapeDataPtr;
 
 //FIXME Enums for manual treatment of objects and bboxes
 //IGNORE = Bullet shouldn't know about this object
@@ -66,7 +68,8 @@ struct LocationInfo {
      : props(),
        local(),
        aggregate(),
-       simObject(NULL)
+       simObject(NULL),
+       simGeneration(0)
     {}
 
     // Regular location info that we need to maintain for all objects
@@ -82,6 +85,9 @@ struct LocationInfo {
     bool aggregate;
 
     BulletObject* simObject;
+    // Identifies the current simObject so collision data requested for an
+    // older one can be recognized and dropped
+    uint64 simGeneration;
 };
 
 } // namespace Sirikata
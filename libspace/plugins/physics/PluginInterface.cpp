@@ -31,21 +31,33 @@
  */
 
 #include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/options/Options.hpp>
 #include <sirikata/space/LocationService.hpp>
 
 #include "BulletPhysicsService.hpp"
 //#include "AlwaysLocationUpdatePolicy.hpp"
 
+#define OPT_NUM_THREADS "threads"
+
 static int space_bulletphysics_plugin_refcount = 0;
 
 namespace Sirikata {
 
 static void InitPluginOptions() {
     //InitAlwaysLocationUpdatePolicyOptions();
+    Sirikata::InitializeClassOptions ico("space_bulletphysics", NULL,
+        new OptionValue(OPT_NUM_THREADS, "0", Sirikata::OptionValueType<uint32>(), "Number of threads used to step the simulation. 0 uses one thread per core."),
+        NULL);
 }
 
 static LocationService* createStandardLoc(SpaceContext* ctx, LocationUpdatePolicy* update_policy, const String& args) {
-    return new BulletPhysicsService(ctx, update_policy);
+    OptionSet* optionsSet = OptionSet::getOptions("space_bulletphysics",NULL);
+    optionsSet->parse(args);
+
+    return new BulletPhysicsService(
+        ctx, update_policy,
+        optionsSet->referenceOption(OPT_NUM_THREADS)->as<uint32>()
+    );
 }
 
 //static LocationUpdatePolicy* createAlwaysPolicy(const String& args) {
@@ -46,6 +46,10 @@ static void InitPluginOptions() {
         new OptionValue("prefix","",Sirikata::OptionValueType<String>(),"Prefix for redis keys, allowing you to provide 'namespaces' so multiple spaces can share the same redis database."),
         new OptionValue("ttl","60s",Sirikata::OptionValueType<Duration>(),"Duration for keys to remain valid in Redis before they are automatically removed in case of dead nodes. This is a tradeoff between having to refresh entries and how long it takes before an object identifier can be reclaimed after a server crashes."),
         new OptionValue("transactions","true",Sirikata::OptionValueType<bool>(),"If false, disables transactions. This isn't really safe as you can fail between commands and get keys stuck, but it allows running against older versions of Redis. Since this isn't safe, transactions are turned on by default."),
+        new OptionValue("lookup-batch-size","64",Sirikata::OptionValueType<uint32>(),"Maximum number of object lookups coalesced into a single MGET."),
+        new OptionValue("lookup-batch-window","1ms",Sirikata::OptionValueType<Duration>(),"How long a lookup may wait for others to batch with before it is sent. With 0, lookups are only batched while the limit on requests in flight is reached."),
+        new OptionValue("refresh-batch-size","256",Sirikata::OptionValueType<uint32>(),"Maximum number of key TTL refreshes pipelined together in a batch."),
+        new OptionValue("max-in-flight","16",Sirikata::OptionValueType<uint32>(),"Maximum number of batches of requests outstanding to Redis at once. Refreshes use at most half of these."),
         NULL
     );
 }
@@ -59,8 +63,12 @@ static ObjectSegmentation* createRedisOSeg(SpaceContext* ctx, Network::IOStrand*
     String redis_prefix = optionsSet->referenceOption("prefix")->as<String>();
     Duration redis_ttl = optionsSet->referenceOption("ttl")->as<Duration>();
     bool redis_has_transactions = optionsSet->referenceOption("transactions")->as<bool>();
+    uint32 lookup_batch_size = optionsSet->referenceOption("lookup-batch-size")->as<uint32>();
+    Duration lookup_batch_window = optionsSet->referenceOption("lookup-batch-window")->as<Duration>();
+    uint32 refresh_batch_size = optionsSet->referenceOption("refresh-batch-size")->as<uint32>();
+    uint32 max_in_flight = optionsSet->referenceOption("max-in-flight")->as<uint32>();
 
-    return new RedisObjectSegmentation(ctx, oseg_strand, cseg, cache, redis_host, redis_port, redis_prefix, redis_ttl, redis_has_transactions);
+    return new RedisObjectSegmentation(ctx, oseg_strand, cseg, cache, redis_host, redis_port, redis_prefix, redis_ttl, redis_has_transactions, lookup_batch_size, lookup_batch_window, refresh_batch_size, max_in_flight);
 }
 
 } // namespace Sirikata
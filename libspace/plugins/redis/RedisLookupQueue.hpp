@@ -0,0 +1,125 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_REDIS_LOOKUP_QUEUE_HPP_
+#define _SIRIKATA_REDIS_LOOKUP_QUEUE_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/UUID.hpp>
+#include <hiredis/hiredis.h>
+#include <deque>
+
+namespace Sirikata {
+
+/** OSeg lookups waiting to be sent to Redis as MGET batches, and the handling
+ *  of the replies to those batches. Sending the requests is left to the
+ *  caller, so this only needs replies and doesn't depend on a live
+ *  connection. Not thread safe.
+ */
+class RedisLookupQueue {
+public:
+    typedef std::tr1::function<void(const UUID&, const String&)> FoundCallback;
+    typedef std::tr1::function<void(const UUID&)> FailedCallback;
+
+    /** Create a queue which hands out batches of up to batch_size lookups.
+     *  Lookups lost to a disconnection are retried on up to max_retries
+     *  reconnections in a row before being failed.
+     */
+    RedisLookupQueue(uint32 batch_size, uint32 max_retries)
+     : mBatchSize(std::max(batch_size, (uint32)1)),
+       mMaxRetries(max_retries),
+       mRetries(0)
+    {}
+
+    bool empty() const { return mPending.empty(); }
+    uint32 size() const { return mPending.size(); }
+    // Number of full batches waiting to be sent
+    uint32 fullBatches() const { return mPending.size() / mBatchSize; }
+
+    void push(const UUID& obj) { mPending.push_back(obj); }
+
+    /** Take the next batch of lookups to send. Returns false, leaving objs
+     *  untouched, if nothing is pending or, unless flush_partial is true, if
+     *  there isn't a full batch yet.
+     */
+    bool takeBatch(bool flush_partial, std::vector<UUID>* objs) {
+        if (mPending.empty() || (!flush_partial && mPending.size() < mBatchSize))
+            return false;
+        uint32 count = std::min((uint32)mPending.size(), mBatchSize);
+        objs->assign(mPending.begin(), mPending.begin() + count);
+        mPending.erase(mPending.begin(), mPending.begin() + count);
+        return true;
+    }
+
+    /** Handle the reply to an MGET for objs. found is invoked for each object
+     *  with a value and failed for each one without, or for all of them if
+     *  Redis returned an error. A NULL reply means the connection was lost
+     *  before the reply arrived, so the lookups are put back at the head of
+     *  the queue to be retried once we've reconnected. Returns false if the
+     *  connection was lost.
+     */
+    bool handleReply(const std::vector<UUID>& objs, const redisReply* reply, const FoundCallback& found, const FailedCallback& failed) {
+        if (reply == NULL) {
+            SILOG(redis_oseg, error, "Lost connection when reading " << objs.size() << " objects, requeuing them");
+            mPending.insert(mPending.begin(), objs.begin(), objs.end());
+            return false;
+        }
+
+        // Anything else means we got through to the server
+        mRetries = 0;
+
+        if (reply->type == REDIS_REPLY_ARRAY && reply->elements == objs.size()) {
+            for(uint32 i = 0; i < objs.size(); i++) {
+                const redisReply* elem = reply->element[i];
+                if (elem->type == REDIS_REPLY_STRING) {
+                    found(objs[i], String(elem->str, elem->len));
+                }
+                else {
+                    if (elem->type != REDIS_REPLY_NIL)
+                        SILOG(redis_oseg, error, "Unexpected redis reply type when reading object " << objs[i].toString() << ": " << elem->type);
+                    failed(objs[i]);
+                }
+            }
+            return true;
+        }
+
+        if (reply->type == REDIS_REPLY_ERROR)
+            SILOG(redis_oseg, error, "Redis error when reading " << objs.size() << " objects: " << String(reply->str, reply->len));
+        else
+            SILOG(redis_oseg, error, "Unexpected redis reply when reading " << objs.size() << " objects: type " << reply->type);
+        for(uint32 i = 0; i < objs.size(); i++)
+            failed(objs[i]);
+        return true;
+    }
+
+    /** Note that we're about to reconnect to retry the pending lookups.
+     *  Returns false if max_retries reconnections in a row have already
+     *  failed to get any reply, in which case all the pending lookups are
+     *  failed instead and the count starts over.
+     */
+    bool retry(const FailedCallback& failed) {
+        if (mRetries >= mMaxRetries) {
+            SILOG(redis_oseg, error, "Giving up on " << mPending.size() << " lookups after " << mRetries << " reconnections");
+            mRetries = 0;
+            std::deque<UUID> pending;
+            pending.swap(mPending);
+            for(std::deque<UUID>::iterator it = pending.begin(); it != pending.end(); it++)
+                failed(*it);
+            return false;
+        }
+        mRetries++;
+        return true;
+    }
+
+private:
+    std::deque<UUID> mPending;
+    const uint32 mBatchSize;
+    const uint32 mMaxRetries;
+    // Reconnections since we last got a reply
+    uint32 mRetries;
+}; // class RedisLookupQueue
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_REDIS_LOOKUP_QUEUE_HPP_
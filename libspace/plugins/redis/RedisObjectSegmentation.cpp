@@ -34,6 +34,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/lambda/lambda.hpp>
 #include <boost/lexical_cast.hpp>
+#include <sirikata/core/util/Timer.hpp>
 
 #define REDISOSEG_LOG(lvl,msg) SILOG(redis_oseg, lvl, msg)
 
@@ -41,6 +42,11 @@ namespace Sirikata {
 
 namespace {
 
+// Delay before reconnecting when lookups were cut off by a disconnection, and
+// the number of reconnections to try before failing them.
+const Duration LOOKUP_RECONNECT_DELAY = Duration::seconds(1);
+const uint32 MAX_LOOKUP_RECONNECTS = 3;
+
 void globalRedisConnectHandler(const redisAsyncContext *c) {
     REDISOSEG_LOG(insane, "Connected.");
 }
@@ -114,31 +120,33 @@ struct RedisObjectMigratedOperationInfo {
     uint8 refcount;
 };
 
-void globalRedisLookupObjectReadFinished(redisAsyncContext* c, void* _reply, void* privdata) {
-    redisReply *reply = (redisReply*)_reply;
-    RedisObjectOperationInfo* wi = (RedisObjectOperationInfo*)privdata;
+// State tracking for a batch of requests, e.g. a single MGET for many lookups
+// or a pipelined group of EXPIREs.
+struct RedisBatchInfo {
+    RedisBatchInfo(RedisObjectSegmentation* _oseg, RedisObjectSegmentation::BatchType _type)
+     : oseg(_oseg), type(_type), started(Timer::now()), refcount(0), failures(0), connected(true)
+    {}
 
-    if (reply == NULL) {
-        REDISOSEG_LOG(error, "Unknown redis error when reading object " << wi->obj.toString());
-    }
-    else if (reply->type == REDIS_REPLY_ERROR) {
-        REDISOSEG_LOG(error, "Redis error when reading object " << wi->obj.toString() << ": " << String(reply->str, reply->len));
-        wi->oseg->failReadObject(wi->obj);
-    }
-    else if (reply->type == REDIS_REPLY_NIL) {
-        REDISOSEG_LOG(error, "Redis got nil when reading object.");
-        wi->oseg->failReadObject(wi->obj);
-    }
-    else if (reply->type == REDIS_REPLY_STRING) {
-        wi->oseg->finishReadObject(wi->obj, String(reply->str, reply->len));
-    }
-    else {
-        REDISOSEG_LOG(error, "Unexpected redis reply type when reading object " << wi->obj.toString() << ": " << reply->type);
-    }
+    RedisObjectSegmentation* oseg;
+    RedisObjectSegmentation::BatchType type;
+    Time started;
+    // Objects in the batch
+    std::vector<UUID> objs;
+
+    // Number of replies still expected
+    uint32 refcount;
+    uint32 failures;
+    bool connected;
+};
 
-    delete wi;
-}
+void globalRedisLookupBatchFinished(redisAsyncContext* c, void* _reply, void* privdata) {
+    redisReply *reply = (redisReply*)_reply;
+    RedisBatchInfo* bi = (RedisBatchInfo*)privdata;
 
+    bi->connected = bi->oseg->finishLookupBatch(bi->objs, reply);
+    bi->oseg->finishBatch(bi->type, bi->started, bi->objs.size(), bi->connected);
+    delete bi;
+}
 
 void globalRedisAddNewObjectWriteFinished(redisAsyncContext* c, void* _reply, void* privdata) {
     redisReply *reply = (redisReply*)_reply;
@@ -351,56 +359,46 @@ void globalRedisDeleteFinished(redisAsyncContext* c, void* _reply, void* privdat
     delete wi;
 }
 
-void globalRedisRefreshObjectTimeoutWriteFinished(redisAsyncContext* c, void* _reply, void* privdata) {
+void globalRedisRefreshBatchFinished(redisAsyncContext* c, void* _reply, void* privdata) {
     redisReply *reply = (redisReply*)_reply;
-    RedisObjectOperationInfo* wi = (RedisObjectOperationInfo*)privdata;
+    RedisBatchInfo* bi = (RedisBatchInfo*)privdata;
 
-    wi->refcount--;
-    // If we've already indicated a result, we can't go back. We haven't issued
-    // a callback, but this just keeps track of whether we even can give a valid
-    // callback anymore/should report any more issues.
-    if (wi->completed) {
-        wi->checkDestroy();
-        return;
-    }
+    bi->refcount--;
 
     if (reply == NULL) {
-        REDISOSEG_LOG(error, "Unknown redis error when refreshing object timeout " << wi->obj.toString());
-        wi->completed = true;
+        bi->connected = false;
+        bi->failures++;
     }
     else if (reply->type == REDIS_REPLY_ERROR) {
-        REDISOSEG_LOG(error, "Redis error when refreshing object timeout " << wi->obj.toString() << ": " << String(reply->str, reply->len));
-        wi->completed = true;
+        REDISOSEG_LOG(detailed, "Redis error when refreshing object timeouts: " << String(reply->str, reply->len));
+        bi->failures++;
     }
     else if (reply->type == REDIS_REPLY_STATUS) {
-        String reply_str(reply->str, reply->len);
-        if (reply_str == String("OK")) {
-            // Should just be the OK from the SET for old versions of Redis,
-            // safe to ignore and wait for the EXPIRE reply
-        }
-        else {
-            REDISOSEG_LOG(error, "Redis got unexpected or bad status reply when refreshing object timeout " <<  wi->obj.toString() << ": " << reply_str);
-            wi->completed = true;
-        }
+        // Should just be the OK from the MSET for old versions of Redis, safe
+        // to ignore and wait for the EXPIRE replies
+        if (String(reply->str, reply->len) != String("OK"))
+            bi->failures++;
     }
     else if (reply->type == REDIS_REPLY_INTEGER) {
-        if (reply->integer != 1) {
-            REDISOSEG_LOG(error, "Redis error when refreshing object timeout " << wi->obj.toString() << ", got incorrect return value: " << reply->integer);
-            wi->completed = true;
-        }
-        // Otherwise succeeded
+        // EXPIRE returns 0 if the key no longer exists
+        if (reply->integer != 1)
+            bi->failures++;
     }
     else {
-        REDISOSEG_LOG(error, "Unexpected redis reply type when refreshing object timeout " << wi->obj.toString() << ": " << reply->type);
-        wi->completed = true;
+        bi->failures++;
     }
 
-    wi->checkDestroy();
+    if (bi->refcount > 0) return;
+
+    if (bi->failures > 0)
+        REDISOSEG_LOG(error, "Failed to refresh timeouts for " << bi->failures << " of " << bi->objs.size() << " objects");
+    bi->oseg->finishBatch(bi->type, bi->started, bi->objs.size(), bi->connected);
+    delete bi;
 }
 
 } // namespace
 
-RedisObjectSegmentation::RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, Duration key_ttl, bool redis_has_transactions)
+RedisObjectSegmentation::RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, Duration key_ttl, bool redis_has_transactions, uint32 lookup_batch_size, Duration lookup_batch_window, uint32 refresh_batch_size, uint32 max_in_flight)
  : ObjectSegmentation(con, o_strand),
    mCSeg(cseg),
    mCache(cache),
@@ -413,6 +411,14 @@ RedisObjectSegmentation::RedisObjectSegmentation(SpaceContext* con, Network::IOS
    mRedisFD(NULL),
    mReading(false),
    mWriting(false),
+   mLookupBatchWindow(lookup_batch_window),
+   mRefreshBatchSize(std::max(refresh_batch_size, (uint32)1)),
+   mMaxInFlightBatches(std::max(max_in_flight, (uint32)1)),
+   mPendingLookups(lookup_batch_size, MAX_LOOKUP_RECONNECTS),
+   mLookupFlushScheduled(false),
+   mLookupReconnectScheduled(false),
+   mInFlightBatches(0),
+   mRefreshThrottled(false),
    mExpiryTimer(
        Network::IOTimer::create(
            con->mainStrand,
@@ -420,6 +426,9 @@ RedisObjectSegmentation::RedisObjectSegmentation(SpaceContext* con, Network::IOS
        )
    )
 {
+    String prefix = String("space.server") + boost::lexical_cast<String>(con->id()) + ".oseg.redis_";
+    mTimeSeriesBatchLatencyNames[LookupBatch] = prefix + "lookup_batch_latency";
+    mTimeSeriesBatchLatencyNames[RefreshBatch] = prefix + "refresh_batch_latency";
 }
 
 RedisObjectSegmentation::~RedisObjectSegmentation() {
@@ -434,6 +443,19 @@ void RedisObjectSegmentation::start() {
 void RedisObjectSegmentation::stop() {
     mExpiryTimer->cancel();
     ObjectSegmentation::stop();
+
+    Lock lck(mMutex);
+    const char* batch_names[NumBatchTypes] = { "Lookup", "Refresh" };
+    for(int i = 0; i < NumBatchTypes; i++) {
+        const BatchStats& stats = mBatchStats[i];
+        if (stats.batches == 0) continue;
+        REDISOSEG_LOG(info,
+            batch_names[i] << " batches: " << stats.batches << ", "
+            << stats.ops << " objects, "
+            << (stats.ops / (float)stats.batches) << " objects/batch, "
+            << "mean latency " << (stats.totalLatency / stats.batches) << ", "
+            << "max latency " << stats.maxLatency);
+    }
 }
 
 void RedisObjectSegmentation::connect() {
@@ -444,6 +466,7 @@ void RedisObjectSegmentation::connect() {
         REDISOSEG_LOG(error, "Failed to connect to redis: " << mRedisContext->errstr);
         redisAsyncDisconnect(mRedisContext);
         mRedisContext = NULL;
+        return;
     } else {
         REDISOSEG_LOG(insane, "Optimistically connected to redis.");
     }
@@ -584,17 +607,176 @@ OSegEntry RedisObjectSegmentation::lookup(const UUID& obj_id) {
     OSegMap::const_iterator it = mOSeg.find(obj_id);
     if (it != mOSeg.end()) return it->second;
 
-    // Otherwise, kick off the lookup process and return null
+    // Otherwise, queue up the lookup and return null. Lookups are coalesced
+    // into MGETs, which go out when a batch fills up or when the oldest
+    // pending lookup has waited for the batching window.
     if (mStopping) return OSegEntry::null();
-    RedisObjectOperationInfo* ri = new RedisObjectOperationInfo(this, obj_id);
     ensureConnected();
     {
         Lock lck(mMutex);
-        redisAsyncCommand(mRedisContext, globalRedisLookupObjectReadFinished, ri, "GET %s%s", mRedisPrefix.c_str(), obj_id.toString().c_str());
+        mPendingLookups.push(obj_id);
+        queuedLookups();
     }
     return OSegEntry::null();
 }
 
+void RedisObjectSegmentation::lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results) {
+    results->resize(obj_ids.size());
+    uint32 misses = 0;
+    for(uint32 i = 0; i < obj_ids.size(); i++) {
+        OSegMap::const_iterator it = mOSeg.find(obj_ids[i]);
+        if (it != mOSeg.end()) {
+            (*results)[i] = it->second;
+        }
+        else {
+            (*results)[i] = OSegEntry::null();
+            misses++;
+        }
+    }
+    if (misses == 0 || mStopping) return;
+
+    // Queue all the misses under a single lock so they go out together
+    ensureConnected();
+    Lock lck(mMutex);
+    for(uint32 i = 0; i < obj_ids.size(); i++) {
+        if ((*results)[i].isNull())
+            mPendingLookups.push(obj_ids[i]);
+    }
+    queuedLookups();
+}
+
+void RedisObjectSegmentation::queuedLookups() {
+    if (mLookupBatchWindow == Duration::zero()) {
+        // No waiting, but lookups still get batched up if they arrive
+        // while we're at the limit of requests in flight
+        issueLookupBatches(true);
+    }
+    else {
+        issueLookupBatches(false);
+        if (!mPendingLookups.empty() && !mLookupFlushScheduled) {
+            mLookupFlushScheduled = true;
+            oStrand->post(
+                mLookupBatchWindow,
+                std::tr1::bind(&RedisObjectSegmentation::flushLookupBatch, this),
+                "RedisObjectSegmentation::flushLookupBatch"
+            );
+        }
+    }
+}
+
+void RedisObjectSegmentation::flushLookupBatch() {
+    Lock lck(mMutex);
+    mLookupFlushScheduled = false;
+    if (mStopping) return;
+    issueLookupBatches(true);
+}
+
+void RedisObjectSegmentation::scheduleLookupReconnect() {
+    if (mStopping || mLookupReconnectScheduled) return;
+    mLookupReconnectScheduled = true;
+    oStrand->post(
+        LOOKUP_RECONNECT_DELAY,
+        std::tr1::bind(&RedisObjectSegmentation::reconnectLookups, this),
+        "RedisObjectSegmentation::reconnectLookups"
+    );
+}
+
+void RedisObjectSegmentation::reconnectLookups() {
+    Lock lck(mMutex);
+    mLookupReconnectScheduled = false;
+    if (mStopping || mPendingLookups.empty()) return;
+
+    if (!mPendingLookups.retry(std::tr1::bind(&RedisObjectSegmentation::failReadObject, this, std::tr1::placeholders::_1)))
+        return;
+    ensureConnected();
+    issueLookupBatches(true);
+}
+
+void RedisObjectSegmentation::issueLookupBatches(bool flush_partial) {
+    if (mPendingLookups.empty()) return;
+    // Lookups wait for the connection to come back rather than failing
+    // immediately
+    if (mRedisContext == NULL) {
+        scheduleLookupReconnect();
+        return;
+    }
+
+    while(mInFlightBatches < mMaxInFlightBatches) {
+        RedisBatchInfo* bi = new RedisBatchInfo(this, LookupBatch);
+        if (!mPendingLookups.takeBatch(flush_partial, &bi->objs)) {
+            delete bi;
+            break;
+        }
+        uint32 count = bi->objs.size();
+
+        std::vector<String> keys(count);
+        std::vector<const char*> argv(count+1);
+        std::vector<size_t> argvlen(count+1);
+        argv[0] = "MGET";
+        argvlen[0] = 4;
+        for(uint32 i = 0; i < count; i++) {
+            keys[i] = mRedisPrefix + bi->objs[i].toString();
+            argv[i+1] = keys[i].c_str();
+            argvlen[i+1] = keys[i].size();
+        }
+        REDISOSEG_LOG(insane, "MGET " << count << " objects");
+        bi->refcount++;
+        mInFlightBatches++;
+        redisAsyncCommandArgv(mRedisContext, globalRedisLookupBatchFinished, bi, argv.size(), &argv[0], &argvlen[0]);
+    }
+}
+
+void RedisObjectSegmentation::finishBatch(BatchType type, Time started, uint32 ops, bool connected) {
+    Duration latency = Timer::now() - started;
+
+    Lock lck(mMutex);
+    assert(mInFlightBatches > 0);
+    mInFlightBatches--;
+
+    BatchStats& stats = mBatchStats[type];
+    stats.batches++;
+    stats.ops += ops;
+    stats.totalLatency += latency;
+    if (latency > stats.maxLatency) stats.maxLatency = latency;
+    mContext->timeSeries->report(mTimeSeriesBatchLatencyNames[type], latency.toMicroseconds() / 1000.0);
+
+    if (mStopping) return;
+    // Lookups cut off by the disconnection were requeued, retry them once
+    // we've reconnected.
+    if (!connected) {
+        if (!mPendingLookups.empty())
+            scheduleLookupReconnect();
+        return;
+    }
+
+    // Lookups are on the forwarding path, so they get the free slot first.
+    // Anything still pending has already waited, so don't hold it back.
+    issueLookupBatches(true);
+    if (mRefreshThrottled) {
+        mRefreshThrottled = false;
+        mContext->mainStrand->post(
+            std::tr1::bind(&RedisObjectSegmentation::processExpiredObjects, this),
+            "RedisObjectSegmentation::processExpiredObjects"
+        );
+    }
+}
+
+int RedisObjectSegmentation::getPushback() {
+    // Let the lookup queue know when we're backed up by more than a few
+    // batches worth of lookups that can't be sent yet
+    Lock lck(mMutex);
+    return mPendingLookups.fullBatches();
+}
+
+bool RedisObjectSegmentation::finishLookupBatch(const std::vector<UUID>& objs, redisReply* reply) {
+    Lock lck(mMutex);
+    return mPendingLookups.handleReply(
+        objs, reply,
+        std::tr1::bind(&RedisObjectSegmentation::finishReadObject, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2),
+        std::tr1::bind(&RedisObjectSegmentation::failReadObject, this, std::tr1::placeholders::_1)
+    );
+}
+
 void RedisObjectSegmentation::finishReadObject(const UUID& obj_id, const String& data_str) {
     REDISOSEG_LOG(detailed, "Finished reading OSEG entry for object " << obj_id.toString());
     if (mStopping) return;
@@ -702,15 +884,15 @@ void RedisObjectSegmentation::addMigratedObject(const UUID& obj_id, float radius
         Lock lck(mMutex);
         if (mRedisHasTransactions) {
             wi->refcount++;
-            redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "MULTI");
+            redisAsyncCommand(mRedisContext, globalRedisAddMigratedObjectWriteFinished, wi, "MULTI");
         }
         wi->refcount++;
         redisAsyncCommand(mRedisContext, globalRedisAddMigratedObjectWriteFinished, wi, "SET %s%s %b", mRedisPrefix.c_str(), obj_id_str.c_str(), valstr.c_str(), valstr.size());
         wi->refcount++;
-        redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "EXPIRE %s%s %d", mRedisPrefix.c_str(), obj_id_str.c_str(), (int32)mRedisKeyTTL.seconds());
+        redisAsyncCommand(mRedisContext, globalRedisAddMigratedObjectWriteFinished, wi, "EXPIRE %s%s %d", mRedisPrefix.c_str(), obj_id_str.c_str(), (int32)mRedisKeyTTL.seconds());
         if (mRedisHasTransactions) {
             wi->refcount++;
-            redisAsyncCommand(mRedisContext, globalRedisAddNewObjectWriteFinished, wi, "EXEC");
+            redisAsyncCommand(mRedisContext, globalRedisAddMigratedObjectWriteFinished, wi, "EXEC");
         }
     }
 }
@@ -828,49 +1010,91 @@ void RedisObjectSegmentation::startTimeoutHandler() {
 }
 
 void RedisObjectSegmentation::processExpiredObjects() {
+    if (mStopping) return;
+
+    // Refreshes use at most half the slots for requests in flight, leaving
+    // room for lookups
+    uint32 max_refresh_in_flight = std::max(mMaxInFlightBatches / 2, (uint32)1);
+
     Time tnow = mContext->simTime();
+    Time new_expiry = tnow + (mRedisKeyTTL/2);
     ObjectTimeoutsByExpiration& by_expiry = mTimeouts.get<expires_tag>();
+    std::vector<UUID> batch;
     while(!by_expiry.empty() &&
         tnow > by_expiry.begin()->expires) {
-        refreshObjectTimeout(by_expiry.begin()->objid);
-        // Don't delete, just update the timeout for the next update
-        Time new_expiry = mContext->simTime() + (mRedisKeyTTL/2);
-        by_expiry.modify_key(by_expiry.begin(), boost::lambda::_1=new_expiry);
+        {
+            Lock lck(mMutex);
+            if (mInFlightBatches >= max_refresh_in_flight) {
+                // Pick up where we left off when a batch finishes
+                mRefreshThrottled = true;
+                return;
+            }
+        }
+
+        batch.clear();
+        while(batch.size() < mRefreshBatchSize &&
+            !by_expiry.empty() && tnow > by_expiry.begin()->expires) {
+            batch.push_back(by_expiry.begin()->objid);
+            // Don't delete, just update the timeout for the next update
+            by_expiry.modify_key(by_expiry.begin(), boost::lambda::_1=new_expiry);
+        }
+        refreshObjectTimeouts(batch);
     }
     startTimeoutHandler();
 }
 
-void RedisObjectSegmentation::refreshObjectTimeout(const UUID& obj_id) {
+void RedisObjectSegmentation::refreshObjectTimeouts(const std::vector<UUID>& objs) {
     if (mStopping) return;
 
-    assert(mOSeg.find(obj_id) != mOSeg.end());
-
-    RedisObjectOperationInfo* wi = new RedisObjectOperationInfo(this, obj_id);
+    RedisBatchInfo* bi = new RedisBatchInfo(this, RefreshBatch);
+    bi->objs = objs;
     ensureConnected();
-    REDISOSEG_LOG(insane, "Refreshing timeout for " << obj_id);
-    {
-        String obj_id_str = obj_id.toString();
-        // Note: currently we're keeping compatibility with Redis 1.2. This means
-        // that there aren't hashes on the server. Instead, we create and parse them
-        // ourselves. This isn't so bad since they are all fixed format anyway.
-        std::ostringstream os;
-        os << mContext->id() << ":" << mOSeg[obj_id].radius();
-        String valstr = os.str();
+    REDISOSEG_LOG(insane, "Refreshing timeouts for " << objs.size() << " objects");
 
-        Lock lck(mMutex);
-        // If we're on older versions of redis, then just setting EXPIRE again
-        // isn't enough -- the TTL wasn't reset if they already had one. Not
-        // sure exactly which versions this is on, for now use whether it has
-        // transactions or not as an indicator. Since they won't have
-        // transactions anyway, this code and the completion handler can be a
-        // bit simpler
-        if (!mRedisHasTransactions) {
-            wi->refcount++;
-            redisAsyncCommand(mRedisContext, globalRedisRefreshObjectTimeoutWriteFinished, wi, "SET %s%s %b", mRedisPrefix.c_str(), obj_id_str.c_str(), valstr.c_str(), valstr.size());
+    std::vector<String> keys(objs.size());
+    for(uint32 i = 0; i < objs.size(); i++) {
+        assert(mOSeg.find(objs[i]) != mOSeg.end());
+        keys[i] = mRedisPrefix + objs[i].toString();
+    }
+
+    // If we're on older versions of redis, then just setting EXPIRE again
+    // isn't enough -- the TTL wasn't reset if they already had one. Not sure
+    // exactly which versions this is on, for now use whether it has
+    // transactions or not as an indicator. In that case, all the values are
+    // reset with a single MSET before the EXPIREs.
+    std::vector<String> values;
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+    if (!mRedisHasTransactions) {
+        // Note: currently we're keeping compatibility with Redis 1.2. This
+        // means that there aren't hashes on the server. Instead, we create and
+        // parse them ourselves. This isn't so bad since they are all fixed
+        // format anyway.
+        values.resize(objs.size());
+        argv.push_back("MSET");
+        argvlen.push_back(4);
+        for(uint32 i = 0; i < objs.size(); i++) {
+            std::ostringstream os;
+            os << mContext->id() << ":" << mOSeg[objs[i]].radius();
+            values[i] = os.str();
+            argv.push_back(keys[i].c_str());
+            argvlen.push_back(keys[i].size());
+            argv.push_back(values[i].c_str());
+            argvlen.push_back(values[i].size());
         }
-        wi->refcount++;
-        redisAsyncCommand(mRedisContext, globalRedisRefreshObjectTimeoutWriteFinished, wi, "EXPIRE %s%s %d", mRedisPrefix.c_str(), obj_id_str.c_str(), (int32)mRedisKeyTTL.seconds());
     }
+
+    Lock lck(mMutex);
+    mInFlightBatches++;
+    // Take all the references up front so early replies can't complete the
+    // batch
+    bi->refcount = objs.size() + (mRedisHasTransactions ? 0 : 1);
+    if (!mRedisHasTransactions)
+        redisAsyncCommandArgv(mRedisContext, globalRedisRefreshBatchFinished, bi, argv.size(), &argv[0], &argvlen[0]);
+    // hiredis buffers these up and writes them out together, so the whole
+    // batch is pipelined
+    for(uint32 i = 0; i < objs.size(); i++)
+        redisAsyncCommand(mRedisContext, globalRedisRefreshBatchFinished, bi, "EXPIRE %b %d", keys[i].c_str(), keys[i].size(), (int32)mRedisKeyTTL.seconds());
 }
 
 } // namespace Sirikata
@@ -35,6 +35,7 @@
 
 #include <sirikata/space/ObjectSegmentation.hpp>
 #include <hiredis/async.h>
+#include "RedisLookupQueue.hpp"
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/member.hpp>
@@ -47,7 +48,7 @@ namespace Sirikata {
 
 class RedisObjectSegmentation : public ObjectSegmentation {
 public:
-    RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, Duration redis_ttl, bool redis_has_transactions);
+    RedisObjectSegmentation(SpaceContext* con, Network::IOStrand* o_strand, CoordinateSegmentation* cseg, OSegCache* cache, const String& redis_host, uint32 redis_port, const String& redis_prefix, Duration redis_ttl, bool redis_has_transactions, uint32 lookup_batch_size, Duration lookup_batch_window, uint32 refresh_batch_size, uint32 max_in_flight);
     ~RedisObjectSegmentation();
 
     virtual void start();
@@ -55,6 +56,7 @@ public:
 
     virtual OSegEntry cacheLookup(const UUID& obj_id);
     virtual OSegEntry lookup(const UUID& obj_id);
+    virtual void lookupBatch(const std::vector<UUID>& obj_ids, std::vector<OSegEntry>* results);
 
     virtual void addNewObject(const UUID& obj_id, float radius);
     virtual void addMigratedObject(const UUID& obj_id, float radius, ServerID idServerAckTo, bool);
@@ -63,6 +65,8 @@ public:
     virtual bool clearToMigrate(const UUID& obj_id);
     virtual void migrateObject(const UUID& obj_id, const OSegEntry& new_server_id);
 
+    virtual int getPushback();
+
     virtual void handleMigrateMessageAck(const Sirikata::Protocol::OSeg::MigrateMessageAcknowledge& msg);
     virtual void handleUpdateOSegMessage(const Sirikata::Protocol::OSeg::UpdateOSegMessage& update_oseg_msg);
 
@@ -81,6 +85,21 @@ public:
     void failReadObject(const UUID& obj_id);
     void finishWriteNewObject(const UUID& obj_id, OSegWriteListener::OSegAddNewStatus);
     void finishWriteMigratedObject(const UUID& obj_id, ServerID ackTo);
+    // Handle the reply to an MGET for objs, see
+    // RedisLookupQueue::handleReply. Returns false if the connection was lost.
+    bool finishLookupBatch(const std::vector<UUID>& objs, redisReply* reply);
+
+    // Requests to Redis are grouped into batches: lookups are coalesced into
+    // MGETs and TTL refreshes are pipelined together.
+    enum BatchType {
+        LookupBatch = 0,
+        RefreshBatch = 1,
+        NumBatchTypes = 2
+    };
+    // Invoked when all replies for a batch have been received. If connected is
+    // false, the connection has been lost and no new requests should be
+    // issued.
+    void finishBatch(BatchType type, Time started, uint32 ops, bool connected);
 
 private:
     void connect();
@@ -96,11 +115,26 @@ private:
     void cacheAndNotifyNewObject(const UUID& obj_id, OSegWriteListener::OSegAddNewStatus);
     void cacheAndAckMigration(const UUID& obj_id, ServerID ackTo);
 
+    // Issue MGETs for pending lookups while there's room for more requests
+    // in flight. Partial batches are only sent if flush_partial is true. Must
+    // be called with mMutex held.
+    void issueLookupBatches(bool flush_partial);
+    // Issue requests for newly queued lookups, or schedule a flush if we're
+    // waiting for a batch to fill up. Must hold mMutex.
+    void queuedLookups();
+    // Invoked once the batching window for the oldest pending lookup has
+    // passed
+    void flushLookupBatch();
+    // Schedule a reconnection to retry lookups after losing the
+    // connection. Must hold mMutex.
+    void scheduleLookupReconnect();
+    void reconnectLookups();
+
     // Schedule an object to be refreshed in .5 TTL to keep it's key alive
     void scheduleObjectRefresh(const UUID& obj_id);
     void startTimeoutHandler();
     void processExpiredObjects();
-    void refreshObjectTimeout(const UUID& obj_id);
+    void refreshObjectTimeouts(const std::vector<UUID>& objs);
 
     CoordinateSegmentation* mCSeg;
     OSegCache* mCache;
@@ -129,6 +163,36 @@ private:
     typedef boost::lock_guard<Mutex> Lock;
     Mutex mMutex;
 
+    // Batching parameters
+    Duration mLookupBatchWindow;
+    uint32 mRefreshBatchSize;
+    uint32 mMaxInFlightBatches;
+
+    // Batching state. Lookups and completions happen on different threads, so
+    // these are protected by mMutex.
+    RedisLookupQueue mPendingLookups;
+    bool mLookupFlushScheduled;
+    bool mLookupReconnectScheduled;
+    uint32 mInFlightBatches;
+    // Set when TTL refreshes were deferred because too many requests were in
+    // flight, so they can be restarted as soon as a batch finishes
+    bool mRefreshThrottled;
+
+    struct BatchStats {
+        BatchStats()
+         : batches(0),
+           ops(0),
+           totalLatency(Duration::zero()),
+           maxLatency(Duration::zero())
+        {}
+        uint64 batches;
+        uint64 ops;
+        Duration totalLatency;
+        Duration maxLatency;
+    };
+    BatchStats mBatchStats[NumBatchTypes];
+    String mTimeSeriesBatchLatencyNames[NumBatchTypes];
+
 
     // Track objects that need timeouts refreshed in redis
     struct ObjectTimeout {
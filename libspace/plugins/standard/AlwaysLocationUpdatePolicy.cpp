@@ -44,6 +44,8 @@ namespace Sirikata {
 void InitAlwaysLocationUpdatePolicyOptions() {
     Sirikata::InitializeClassOptions ico(ALWAYS_POLICY_OPTIONS, NULL,
         new OptionValue(LOC_MAX_PER_RESULT, "5", Sirikata::OptionValueType<uint32>(), "Maximum number of loc updates to report in each result message."),
+        new OptionValue(LOC_DELTA_UPDATES, "true", Sirikata::OptionValueType<bool>(), "If true, loc updates only include the parts of an object's state that changed since the last update sent to the subscriber."),
+        new OptionValue(LOC_UPDATE_ORDER, "solid-angle", Sirikata::OptionValueType<String>(), "Order in which queued loc updates are sent when a subscriber is backed up: staleness (oldest first) or solid-angle (largest and oldest first, for subscribers with a position)."),
         NULL);
 }
 
@@ -68,6 +70,11 @@ AlwaysLocationUpdatePolicy::AlwaysLocationUpdatePolicy(SpaceContext* ctx, const
 {
     OptionSet* optionsSet = OptionSet::getOptions(ALWAYS_POLICY_OPTIONS,NULL);
     optionsSet->parse(args);
+
+    String order = GetOptionValue<String>(ALWAYS_POLICY_OPTIONS, LOC_UPDATE_ORDER);
+    if (order != "solid-angle" && order != "staleness")
+        SILOG(always_loc,error,"Unknown loc update order " << order << ", using staleness");
+    mOrderBySolidAngle = (order == "solid-angle");
 }
 
 AlwaysLocationUpdatePolicy::~AlwaysLocationUpdatePolicy() {
@@ -305,6 +312,9 @@ void AlwaysLocationUpdatePolicy::objectLocSubstreamCallback(int x, ODPSST::Strea
     else {
         SILOG(always_loc,error,"Failed multiple times to open loc update substream.");
         //mObjectSubscriptions.decrementOutstandingMessageCount(dest);
+        // The subscriber may now be missing parts of the state we only sent
+        // deltas for, so make the next updates send everything.
+        numOutstandingMessageCount->lastSent.clear();
         delete msg;
     }
 }
@@ -340,6 +350,8 @@ void AlwaysLocationUpdatePolicy::ohLocSubstreamCallback(int x, OHDPSST::StreamPt
     else {
         //mOHSubscriptions.decrementOutstandingMessageCount(dest);
         SILOG(always_loc,error,"Failed multiple times to open loc update substream.");
+        // See objectLocSubstreamCallback
+        numOutstandingMessageCount->lastSent.clear();
         delete msg;
     }
 }
@@ -376,6 +388,22 @@ bool AlwaysLocationUpdatePolicy::isSelfSubscriber(const ServerID& sid, const UUI
     return false;
 }
 
+bool AlwaysLocationUpdatePolicy::subscriberPosition(const UUID& sid, Vector3f* pos_out) {
+    if (!mLocService->contains(sid)) return false;
+    *pos_out = mLocService->currentPosition(sid);
+    return true;
+}
+
+bool AlwaysLocationUpdatePolicy::subscriberPosition(const OHDP::NodeID& sid, Vector3f* pos_out) {
+    // Object hosts are observing on behalf of many objects, so there's no
+    // single position to prioritize by
+    return false;
+}
+
+bool AlwaysLocationUpdatePolicy::subscriberPosition(const ServerID& sid, Vector3f* pos_out) {
+    return false;
+}
+
 bool AlwaysLocationUpdatePolicy::trySend(const UUID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount)
 {
     std::string bluMsg = serializePBJMessage(blu);
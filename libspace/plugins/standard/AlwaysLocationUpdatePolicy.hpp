@@ -35,11 +35,14 @@
 
 #include <sirikata/space/LocationService.hpp>
 #include <sirikata/core/options/CommonOptions.hpp>
+#include <sirikata/core/util/SlotHashTable.hpp>
 
 #include "Protocol_Loc.pbj.hpp"
 
 #define ALWAYS_POLICY_OPTIONS      "always_location_update_policy"
 #define LOC_MAX_PER_RESULT         "loc.max-per-result"
+#define LOC_DELTA_UPDATES          "loc.delta-updates"
+#define LOC_UPDATE_ORDER           "loc.update-order"
 
 namespace Sirikata {
 
@@ -98,14 +101,47 @@ private:
     void reportStats();
 
 
+    // Bits identifying the parts of an object's state that changed, so we can
+    // send only those parts to subscribers.
+    enum UpdatePart {
+        LocationPart = 0x01,
+        OrientationPart = 0x02,
+        BoundsPart = 0x04,
+        MeshPart = 0x08,
+        PhysicsPart = 0x10,
+        QueryDataPart = 0x20,
+        AllParts = 0x3F
+    };
+
+    // A queued update for an object. Only the small, frequently changing
+    // parts of the object's state are stored here, keeping entries compact;
+    // mesh, physics and query data are only marked as dirty and looked up
+    // when the update is sent.
     struct UpdateInfo {
+        UpdateInfo()
+         : dirty(0)
+        {}
+
         uint64 epoch;
         TimedMotionVector3f location;
         TimedMotionQuaternion orientation;
         AggregateBoundingInfo bounds;
+        // When this update was queued, for prioritizing stale updates
+        Time queued;
+        // UpdateParts modified since this update was queued. location,
+        // orientation and bounds always hold the current state.
+        uint32 dirty;
+    };
+    typedef SlotHashTable<UUID, UpdateInfo, UUID::Hasher> UpdateTable;
+
+    // The state of an object as of the last update shipped to a
+    // subscriber. Location and orientation aren't kept since they change with
+    // nearly every update anyway.
+    struct SentState {
+        uint64 epoch;
+        AggregateBoundingInfo bounds;
         String mesh;
         String physics;
-        String query_data;
     };
 
     typedef std::set<UUID> UUIDSet;
@@ -135,7 +171,12 @@ private:
         ObjectIndexesMap objectIndexes;
         // Information about each object that we need to create and send an
         // update about
-        std::map<UUID, UpdateInfo> outstandingUpdates;
+        UpdateTable outstandingUpdates;
+        // State last sent for each object, used to send only the parts that
+        // changed. If an object is missing (new subscriptions, or after we
+        // may have lost an update) the next update carries the full state.
+        typedef std::tr1::unordered_map<UUID, SentState, UUID::Hasher> SentStateMap;
+        SentStateMap lastSent;
 
         // Indicates that there are no subscriptions for this object left,
         // allowing us to clear out its entry
@@ -518,14 +559,17 @@ private:
                         // completely remove the object as being tracked if we
                         // hit no indices marked as still tracking
                         indexes_it->second.erase(*index_id);
-                        if (indexes_it->second.empty())
+                        if (indexes_it->second.empty()) {
                             sub_it->second->objectIndexes.erase(indexes_it);
+                            sub_it->second->lastSent.erase(uuid);
+                        }
                     }
                     else {
                         // Otherwise, we have one implicit index we're
                         // tracking. This call is enough to remove it since we
                         // can only have 1 subscription to it
                         sub_it->second->objectIndexes.erase(indexes_it);
+                        sub_it->second->lastSent.erase(uuid);
                     }
                 }
             }
@@ -599,34 +643,135 @@ private:
             if (sub_info->objectIndexes.find(uuid) == sub_info->objectIndexes.end()) return; // XXX FIXME
             assert(sub_info->objectIndexes.find(uuid) != sub_info->objectIndexes.end());
 
-            if (sub_info->outstandingUpdates.find(uuid) == sub_info->outstandingUpdates.end()) {
-                UpdateInfo new_ui;
-                new_ui.epoch = locservice->epoch(uuid);
-                new_ui.location = locservice->location(uuid);
-                new_ui.bounds = locservice->bounds(uuid);
-                new_ui.mesh = locservice->mesh(uuid);
-                new_ui.orientation = locservice->orientation(uuid);
-                new_ui.physics = locservice->physics(uuid);
-                // Don't bother copying possibly big data if not necessary
-                if (send_all_data)
-                    new_ui.query_data = locservice->queryData(uuid);
-                sub_info->outstandingUpdates[uuid] = new_ui;
+            bool inserted = false;
+            typename UpdateTable::SlotID slot = sub_info->outstandingUpdates.insert(uuid, &inserted);
+            UpdateInfo& ui = sub_info->outstandingUpdates.value(slot);
+            if (inserted) {
+                ui.epoch = locservice->epoch(uuid);
+                ui.location = locservice->location(uuid);
+                ui.bounds = locservice->bounds(uuid);
+                ui.orientation = locservice->orientation(uuid);
+                ui.queued = locservice->context()->recentSimTime();
             }
-            else
-                UpdateInfo& ui = sub_info->outstandingUpdates[uuid];
-
 
-            UpdateInfo& ui = sub_info->outstandingUpdates[uuid];
-            if (fup)
+            if (fup) {
                 fup(ui);
+            }
+            else {
+                // Forced update, e.g. for a new subscription, so send
+                // everything.
+                ui.dirty = AllParts;
+                sub_info->lastSent.erase(uuid);
+            }
         }
 
-        static void setUILocation(UpdateInfo& ui, const TimedMotionVector3f& newval) {ui.location = newval; }
-        static void setUIOrientation(UpdateInfo& ui, const TimedMotionQuaternion& newval) { ui.orientation = newval; }
-        static void setUIBounds(UpdateInfo& ui, const AggregateBoundingInfo& newval) { ui.bounds = newval; }
-        static void setUIMesh(UpdateInfo& ui, const String& newval) {ui.mesh = newval;}
-        static void setUIPhysics(UpdateInfo& ui, const String& newval) {ui.physics = newval;}
-        static void setUIQueryData(UpdateInfo& ui, const String& newval) {ui.query_data = newval;}
+        static void setUILocation(UpdateInfo& ui, const TimedMotionVector3f& newval) {ui.location = newval; ui.dirty |= LocationPart; }
+        static void setUIOrientation(UpdateInfo& ui, const TimedMotionQuaternion& newval) { ui.orientation = newval; ui.dirty |= OrientationPart; }
+        static void setUIBounds(UpdateInfo& ui, const AggregateBoundingInfo& newval) { ui.bounds = newval; ui.dirty |= BoundsPart; }
+        static void setUIMesh(UpdateInfo& ui) { ui.dirty |= MeshPart; }
+        static void setUIPhysics(UpdateInfo& ui) { ui.dirty |= PhysicsPart; }
+        static void setUIQueryData(UpdateInfo& ui) { ui.dirty |= QueryDataPart; }
+
+        // Determine which parts of an update need to be sent and fill in the
+        // state the subscriber will have once it gets them. Without delta
+        // updates, or if we don't know what the subscriber has (including
+        // after an epoch change), that's everything. Otherwise it's the parts
+        // that were modified, skipping ones that were set back to the value
+        // the subscriber already has.
+        uint32 prepareUpdate(SubscriberInfo* sub_info, const UUID& uuid, const UpdateInfo& ui, bool delta_updates, LocationService* locservice, SentState* sent) {
+            uint32 parts = AllParts;
+            bool known = false;
+            if (delta_updates) {
+                typename SubscriberInfo::SentStateMap::iterator sent_it = sub_info->lastSent.find(uuid);
+                if (sent_it != sub_info->lastSent.end() && sent_it->second.epoch == ui.epoch) {
+                    *sent = sent_it->second;
+                    parts = ui.dirty;
+                    known = true;
+                }
+            }
+            sent->epoch = ui.epoch;
+
+            if (parts & BoundsPart) {
+                AggregateBoundingInfo bounds = ui.bounds;
+                if (known && bounds == sent->bounds)
+                    parts &= ~BoundsPart;
+                else
+                    sent->bounds = bounds;
+            }
+
+            // Objects can be removed while updates are queued, leaving
+            // nothing to look up
+            if (!locservice->contains(uuid))
+                return parts & (LocationPart | OrientationPart | BoundsPart);
+
+            if (parts & MeshPart) {
+                const String& mesh = locservice->mesh(uuid);
+                if (known && mesh == sent->mesh)
+                    parts &= ~MeshPart;
+                else
+                    sent->mesh = mesh;
+            }
+            if (parts & PhysicsPart) {
+                const String& physics = locservice->physics(uuid);
+                if (known && physics == sent->physics)
+                    parts &= ~PhysicsPart;
+                else
+                    sent->physics = physics;
+            }
+            if (!send_all_data)
+                parts &= ~QueryDataPart;
+            return parts;
+        }
+
+        // Order the slots of queued updates so that, if we can only send
+        // capacity of them right now, the most important go first. Importance
+        // is how long the update has been waiting, scaled by the solid angle
+        // the object covers for subscribers that have a position.
+        void orderUpdates(const SubscriberType& sid, SubscriberInfo* sub_info, uint32 capacity, std::vector<typename UpdateTable::SlotID>* order) {
+            UpdateTable& updates = sub_info->outstandingUpdates;
+            order->clear();
+            order->reserve(updates.size());
+            for(typename UpdateTable::SlotID slot = 0; slot < updates.slotCount(); slot++)
+                if (updates.valid(slot)) order->push_back(slot);
+
+            if (order->size() <= capacity) return;
+
+            Vector3f observer;
+            bool by_solid_angle = parent->mOrderBySolidAngle && parent->subscriberPosition(sid, &observer);
+            Time now = parent->mLocService->context()->recentSimTime();
+
+            typedef std::pair<float32, typename UpdateTable::SlotID> ScoredSlot;
+            std::vector<ScoredSlot> scored;
+            scored.reserve(order->size());
+            for(uint32 i = 0; i < order->size(); i++) {
+                const UpdateInfo& ui = updates.value((*order)[i]);
+                float32 score = 1.f + std::max((float32)(now - ui.queued).seconds(), 0.f);
+                if (by_solid_angle) {
+                    // r^2/d^2 orders objects the same as their solid angle
+                    // and is much cheaper to compute. The floor keeps tiny
+                    // or distant objects from starving completely.
+                    float32 radius = std::max(ui.bounds.fullRadius(), 0.f);
+                    float32 dist2 = std::max((ui.location.position(now) - observer).lengthSquared(), 1.f);
+                    score *= std::max(radius * radius / dist2, 1e-6f);
+                }
+                // Negated so the default ordering puts the highest scores first
+                scored.push_back(ScoredSlot(-score, (*order)[i]));
+            }
+            std::partial_sort(scored.begin(), scored.begin() + capacity, scored.end());
+            for(uint32 i = 0; i < scored.size(); i++)
+                (*order)[i] = scored[i].second;
+        }
+
+        // Record the updates in a batch as delivered to the subscriber and
+        // remove them from the queue.
+        void commitBatch(SubscriberInfo* sub_info, std::vector<typename UpdateTable::SlotID>* slots, std::vector<SentState>* sent) {
+            for(uint32 i = 0; i < slots->size(); i++) {
+                sub_info->lastSent[sub_info->outstandingUpdates.key((*slots)[i])] = (*sent)[i];
+                sub_info->outstandingUpdates.eraseSlot((*slots)[i]);
+            }
+            slots->clear();
+            sent->clear();
+        }
 
         void locationUpdated(const UUID& uuid, const TimedMotionVector3f& newval, LocationService* locservice) {
             propertyUpdated(
@@ -652,14 +797,14 @@ private:
         void meshUpdated(const UUID& uuid, const String& newval, LocationService* locservice) {
             propertyUpdated(
                 uuid, locservice,
-                std::tr1::bind(&setUIMesh, std::tr1::placeholders::_1, newval)
+                std::tr1::bind(&setUIMesh, std::tr1::placeholders::_1)
             );
         }
 
         void physicsUpdated(const UUID& uuid, const String& newval, LocationService* locservice) {
             propertyUpdated(
                 uuid, locservice,
-                std::tr1::bind(&setUIPhysics, std::tr1::placeholders::_1, newval)
+                std::tr1::bind(&setUIPhysics, std::tr1::placeholders::_1)
             );
         }
 
@@ -669,17 +814,116 @@ private:
 
             propertyUpdated(
                 uuid, locservice,
-                std::tr1::bind(&setUIQueryData, std::tr1::placeholders::_1, newval)
+                std::tr1::bind(&setUIQueryData, std::tr1::placeholders::_1)
             );
         }
 
 
+        // Build and send bulk updates for the queued updates in the given
+        // order, stopping once too many messages are outstanding. Updates
+        // that are sent are removed from the queue.
+        void shipUpdates(const SubscriberType& sid, const SubscriberInfoPtr& sub_info, const std::vector<typename UpdateTable::SlotID>& order, uint32 max_updates, bool delta_updates, uint32 outstanding_message_soft_limit, uint32 outstanding_message_hard_limit) {
+            UpdateTable& updates = sub_info->outstandingUpdates;
+            LocationService* locservice = parent->mLocService;
+
+            Sirikata::Protocol::Loc::BulkLocationUpdate bulk_update;
+            // Updates in bulk_update, to be committed once it's sent
+            std::vector<typename UpdateTable::SlotID> batch_slots;
+            std::vector<SentState> batch_sent;
+
+            bool send_failed = false;
+            for(typename std::vector<typename UpdateTable::SlotID>::const_iterator slot_it = order.begin();
+                numOutstandingMessages(sub_info) < outstanding_message_soft_limit && slot_it != order.end();
+                slot_it++)
+            {
+                const UUID& uuid = updates.key(*slot_it);
+                const UpdateInfo& ui = updates.value(*slot_it);
+
+                Sirikata::Protocol::Loc::ILocationUpdate update = bulk_update.add_update();
+                update.set_object(uuid);
+
+                //write and update sequence number
+                update.set_seqno( (*(sub_info->seqnoPtr)) ++ );
+
+                if (parent->isSelfSubscriber(sid, uuid))
+                    update.set_epoch(ui.epoch);
+
+                // If we're tracking indexes (tree replication), add the
+                // list in
+                typename ObjectIndexesMap::iterator obj_ind_it = sub_info->objectIndexes.find(uuid);
+                if (obj_ind_it != sub_info->objectIndexes.end()) {
+                    for (typename ProxIndexSet::iterator prox_idx_it = obj_ind_it->second.begin(); prox_idx_it != obj_ind_it->second.end(); prox_idx_it++)
+                        update.add_index_id((uint32)*prox_idx_it);
+                }
+
+                batch_slots.push_back(*slot_it);
+                batch_sent.push_back(SentState());
+                uint32 parts = prepareUpdate(sub_info.get(), uuid, ui, delta_updates, locservice, &batch_sent.back());
+
+                if (parts & LocationPart) {
+                    Sirikata::Protocol::ITimedMotionVector location = update.mutable_location();
+                    location.set_t(ui.location.updateTime());
+                    location.set_position(ui.location.position());
+
+                    location.set_velocity(ui.location.velocity());
+                }
+
+                if (parts & OrientationPart) {
+                    Sirikata::Protocol::ITimedMotionQuaternion orientation = update.mutable_orientation();
+                    orientation.set_t(ui.orientation.updateTime());
+                    orientation.set_position(ui.orientation.position());
+                    orientation.set_velocity(ui.orientation.velocity());
+                }
+
+                if (parts & BoundsPart) {
+                    Sirikata::Protocol::IAggregateBoundingInfo msg_bounds = update.mutable_aggregate_bounds();
+                    msg_bounds.set_center_offset(ui.bounds.centerOffset);
+                    msg_bounds.set_center_bounds_radius(ui.bounds.centerBoundsRadius);
+                    msg_bounds.set_max_object_size(ui.bounds.maxObjectRadius);
+                }
+
+                if (parts & MeshPart)
+                    update.set_mesh(batch_sent.back().mesh);
+                if (parts & PhysicsPart)
+                    update.set_physics(batch_sent.back().physics);
+                // Don't bother copying possibly big data if not necessary
+                if (parts & QueryDataPart)
+                    update.set_query_data(locservice->queryData(uuid));
+
+                // If we hit the limit for this update, try to send it out
+                if (bulk_update.update_size() > (int32)max_updates) {
+                    bool sent = parent->trySend(sid, bulk_update, sub_info);
+                    if (!sent) {
+                        send_failed = true;
+                        break;
+                    }
+                    else {
+                        bulk_update = Sirikata::Protocol::Loc::BulkLocationUpdate(); // clear it out
+                        commitBatch(sub_info.get(), &batch_slots, &batch_sent);
+                        sent_count++;
+                    }
+                }
+            }
+
+            // Try to send the last few if necessary/possible
+            if (numOutstandingMessages(sub_info) < outstanding_message_hard_limit && !send_failed && bulk_update.update_size() > 0) {
+                bool sent = parent->trySend(sid, bulk_update, sub_info);
+                if (sent) {
+                    commitBatch(sub_info.get(), &batch_slots, &batch_sent);
+                    sent_count++;
+                }
+            }
+        }
+
         void service() {
             uint32 max_updates = GetOptionValue<uint32>(ALWAYS_POLICY_OPTIONS, LOC_MAX_PER_RESULT);
+            bool delta_updates = GetOptionValue<bool>(ALWAYS_POLICY_OPTIONS, LOC_DELTA_UPDATES);
             const uint32 outstanding_message_hard_limit = 64;
             const uint32 outstanding_message_soft_limit = 25;
 
             std::list<SubscriberType> to_delete;
+            // Reused across subscribers to avoid reallocating
+            std::vector<typename UpdateTable::SlotID> order;
 
             for(typename SubscriberMap::iterator server_it = mSubscriptions.begin(); server_it != mSubscriptions.end(); server_it++) {
                 SubscriberType sid = server_it->first;
@@ -697,80 +941,15 @@ private:
                     continue;
                 }
 
-                Sirikata::Protocol::Loc::BulkLocationUpdate bulk_update;
-
-                bool send_failed = false;
-                std::map<UUID, UpdateInfo>::iterator last_shipped = sub_info->outstandingUpdates.begin();
-                for(std::map<UUID, UpdateInfo>::iterator up_it = sub_info->outstandingUpdates.begin();
-                    numOutstandingMessages(sub_info) < outstanding_message_soft_limit && up_it != sub_info->outstandingUpdates.end();
-                    up_it++)
-                {
-                    Sirikata::Protocol::Loc::ILocationUpdate update = bulk_update.add_update();
-                    update.set_object(up_it->first);
-
-                    //write and update sequence number
-                    update.set_seqno( (*(sub_info->seqnoPtr)) ++ );
-
-                    if (parent->isSelfSubscriber(sid, up_it->first))
-                        update.set_epoch(up_it->second.epoch);
-
-                    // If we're tracking indexes (tree replication), add the
-                    // list in
-                    typename ObjectIndexesMap::iterator obj_ind_it = sub_info->objectIndexes.find(up_it->first);
-                    if (obj_ind_it != sub_info->objectIndexes.end()) {
-                        for (typename ProxIndexSet::iterator prox_idx_it = obj_ind_it->second.begin(); prox_idx_it != obj_ind_it->second.end(); prox_idx_it++)
-                            update.add_index_id((uint32)*prox_idx_it);
-                    }
-
-                    Sirikata::Protocol::ITimedMotionVector location = update.mutable_location();
-                    location.set_t(up_it->second.location.updateTime());
-                    location.set_position(up_it->second.location.position());
-
-                    location.set_velocity(up_it->second.location.velocity());
-
-                    Sirikata::Protocol::ITimedMotionQuaternion orientation = update.mutable_orientation();
-                    orientation.set_t(up_it->second.orientation.updateTime());
-                    orientation.set_position(up_it->second.orientation.position());
-                    orientation.set_velocity(up_it->second.orientation.velocity());
-
-                    Sirikata::Protocol::IAggregateBoundingInfo msg_bounds = update.mutable_aggregate_bounds();
-                    msg_bounds.set_center_offset(up_it->second.bounds.centerOffset);
-                    msg_bounds.set_center_bounds_radius(up_it->second.bounds.centerBoundsRadius);
-                    msg_bounds.set_max_object_size(up_it->second.bounds.maxObjectRadius);
-
-                    update.set_mesh(up_it->second.mesh);
-                    update.set_physics(up_it->second.physics);
-                    // Don't bother copying possibly big data if not necessary
-                    if (send_all_data)
-                        update.set_query_data(up_it->second.query_data);
-
-                    // If we hit the limit for this update, try to send it out
-                    if (bulk_update.update_size() > (int32)max_updates) {
-                        bool sent = parent->trySend(sid, bulk_update, sub_info);
-                        if (!sent) {
-                            send_failed = true;
-                            break;
-                        }
-                        else {
-                            bulk_update = Sirikata::Protocol::Loc::BulkLocationUpdate(); // clear it out
-                            last_shipped = up_it;
-                            sent_count++;
-                        }
-                    }
-                }
-
-                // Try to send the last few if necessary/possible
-                if (numOutstandingMessages(sub_info) < outstanding_message_hard_limit && !send_failed && bulk_update.update_size() > 0) {
-                    bool sent = parent->trySend(sid, bulk_update, sub_info);
-                    if (sent) {
-                        last_shipped = sub_info->outstandingUpdates.end();
-                        sent_count++;
-                    }
+                UpdateTable& updates = sub_info->outstandingUpdates;
+                long available_messages = (long)outstanding_message_soft_limit - numOutstandingMessages(sub_info);
+                if (!updates.empty() && available_messages > 0) {
+                    // If we're backed up, make sure what we can send now are
+                    // the most important updates.
+                    orderUpdates(sid, sub_info.get(), available_messages * (max_updates + 1), &order);
+                    shipUpdates(sid, sub_info, order, max_updates, delta_updates, outstanding_message_soft_limit, outstanding_message_hard_limit);
                 }
 
-                // Finally clear out any entries successfully sent out
-                sub_info->outstandingUpdates.erase( sub_info->outstandingUpdates.begin(), last_shipped);
-
                 if (sub_info->noSubscriptionsLeft() && sub_info->outstandingUpdates.empty()) {
                     sub_info.reset();
                     to_delete.push_back(sid);
@@ -796,6 +975,12 @@ private:
     bool isSelfSubscriber(const OHDP::NodeID& sid, const UUID& observed);
     bool isSelfSubscriber(const ServerID& sid, const UUID& observed);
 
+    // Get the current position of a subscriber, if it has one, for
+    // prioritizing updates.
+    bool subscriberPosition(const UUID& sid, Vector3f* pos_out);
+    bool subscriberPosition(const OHDP::NodeID& sid, Vector3f* pos_out);
+    bool subscriberPosition(const ServerID& sid, Vector3f* pos_out);
+
     bool trySend(const UUID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount);
     bool trySend(const OHDP::NodeID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount);
     bool trySend(const ServerID& dest, const Sirikata::Protocol::Loc::BulkLocationUpdate& blu, const SubscriberInfoPtr& numOutstandingMessageCount);
@@ -816,6 +1001,10 @@ private:
     const String mTimeSeriesObjectUpdatesName;
     AtomicValue<uint32> mObjectUpdatesPerSecond;
 
+    // Whether backed up updates are prioritized by the solid angle objects
+    // cover for the subscriber, in addition to how long they've waited
+    bool mOrderBySolidAngle;
+
     typedef SubscriberIndex<ServerID> ServerSubscriberIndex;
     ServerSubscriberIndex mServerSubscriptions;
 
@@ -46,6 +46,10 @@ CoordinateSegmentation::~CoordinateSegmentation() {
     delete mServiceStage;
 }
 
+void CoordinateSegmentation::lookup(const Vector3f& pos, const LookupCallback& cb) {
+    cb(lookup(pos));
+}
+
 void CoordinateSegmentation::addListener(Listener* listener) {
     assert (mListeners.find(listener) == mListeners.end());
     mListeners.insert(listener);
@@ -152,6 +152,19 @@ CREATE_TRACE_DEF(SpaceTrace, osegCacheResponse, mLogOSeg, const Time &t, const S
     mTrace->writeRecord(OSegCacheResponseTag, rec);
 }
 
+CREATE_TRACE_DEF(SpaceTrace, osegLookupBatch, mLogOSeg, const Time &t, const ServerID& sID, uint32 objects, uint32 messages, const Duration& queue_delay, uint32 outstanding)
+{
+    Sirikata::Trace::OSeg::LookupBatch rec;
+    rec.set_t(t);
+    rec.set_server(sID);
+    rec.set_objects(objects);
+    rec.set_messages(messages);
+    rec.set_queue_delay(queue_delay);
+    rec.set_outstanding(outstanding);
+
+    mTrace->writeRecord(OSegLookupBatchTag, rec);
+}
+
 
 CREATE_TRACE_DEF(SpaceTrace, objectSegmentationLookupNotOnServerRequest, mLogOSeg, const Time& t, const UUID& obj_id, const ServerID &sID_lookerupper)
 {
@@ -355,13 +355,25 @@ bool Object::locationMessage(const std::string& payload) {
     for(int32 idx = 0; idx < contents.update_size(); idx++) {
         Sirikata::Protocol::Loc::LocationUpdate update = contents.update(idx);
 
+        KnownLocation& known = mKnownLocations[update.object()];
+
+        uint64 seqno = (update.has_seqno() ? update.seqno() : 0);
+        if (seqno < known.seqno)
+            continue;
+        known.seqno = seqno;
+
+        // Only the parts that changed are included, everything else keeps
+        // its last known value.
+        if (!update.has_location())
+            continue;
+
         Sirikata::Protocol::TimedMotionVector update_loc = update.location();
-        TimedMotionVector3f loc(update_loc.t(), MotionVector3f(update_loc.position(), update_loc.velocity()));
+        known.location = TimedMotionVector3f(update_loc.t(), MotionVector3f(update_loc.position(), update_loc.velocity()));
 
         CONTEXT_OHTRACE(objectLoc,
             mID,
             update.object(),
-            loc
+            known.location
         );
 
         // FIXME do something with the data
@@ -386,6 +398,8 @@ bool Object::proximityMessage(const std::string& payload) {
             Sirikata::Protocol::Prox::ObjectAddition addition = update.addition(aidx);
 
             TimedMotionVector3f loc(addition.location().t(), MotionVector3f(addition.location().position(), addition.location().velocity()));
+            // Additions carry the full state
+            mKnownLocations[addition.object()].location = loc;
 
             CONTEXT_OHTRACE(prox,
                 mID,
@@ -400,6 +414,7 @@ bool Object::proximityMessage(const std::string& payload) {
 
         for(int32 ridx = 0; ridx < update.removal_size(); ridx++) {
             Sirikata::Protocol::Prox::ObjectRemoval removal = update.removal(ridx);
+            mKnownLocations.erase(removal.object());
 
             CONTEXT_OHTRACE(prox,
                 mID,
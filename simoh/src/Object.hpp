@@ -198,6 +198,22 @@ private:
 
     Network::IOTimerPtr mLocUpdateTimer;
 
+    // Last known location of each object in our proximity results. Loc
+    // updates may only carry the parts of an object's state that changed, so
+    // we need to keep the rest around ourselves. They can also arrive out of
+    // order since each batch uses its own substream, so we track the seqno of
+    // the newest update applied and ignore older ones.
+    struct KnownLocation {
+        KnownLocation()
+         : seqno(0)
+        {}
+
+        uint64 seqno;
+        TimedMotionVector3f location;
+    };
+    typedef std::map<UUID, KnownLocation> KnownLocationMap;
+    KnownLocationMap mKnownLocations;
+
     ODP::DelegateService* mDelegateODPService;
     BaseDatagramLayerPtr mSSTDatagramLayer;
 }; // class Object
@@ -0,0 +1,148 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "CSegLookupCache.hpp"
+#include <algorithm>
+
+namespace Sirikata {
+
+namespace {
+
+struct CenterLess {
+    CenterLess(uint32 _axis) : axis(_axis) {}
+
+    template<typename EntryType>
+    bool operator()(const EntryType& lhs, const EntryType& rhs) const {
+        return lhs.bbox.center()[axis] < rhs.bbox.center()[axis];
+    }
+
+    uint32 axis;
+};
+
+} // namespace
+
+CSegLookupCache::CSegLookupCache()
+ : mDirty(false),
+   mNextSeqno(0)
+{
+}
+
+ServerID CSegLookupCache::lookup(const Vector3f& pos) {
+    if (mDirty)
+        rebuild();
+    if (mNodes.empty())
+        return NullServerID;
+
+    ServerID result = NullServerID;
+    uint64 result_seqno = 0;
+
+    uint32 stack[64];
+    uint32 stack_size = 0;
+    stack[stack_size++] = 0;
+    while(stack_size > 0) {
+        const Node& node = mNodes[stack[--stack_size]];
+        if (!node.bbox.contains(pos))
+            continue;
+
+        if (node.count == 0) {
+            uint32 self = &node - &mNodes[0];
+            stack[stack_size++] = node.right;
+            stack[stack_size++] = self + 1;
+            continue;
+        }
+
+        for(uint32 i = node.first; i < node.first + node.count; i++) {
+            const Entry& entry = mEntries[i];
+            if (entry.bbox.contains(pos) &&
+                (result == NullServerID || entry.seqno < result_seqno))
+            {
+                result = entry.sid;
+                result_seqno = entry.seqno;
+            }
+        }
+    }
+
+    return result;
+}
+
+void CSegLookupCache::insert(const BoundingBox3f& bbox, ServerID sid) {
+    // An identical region may already be cached, e.g. if two lookups missed
+    // at the same time. Keep the original so ties still go to the oldest.
+    for(EntryList::iterator it = mEntries.begin(); it != mEntries.end(); it++) {
+        if (it->bbox == bbox && it->sid == sid)
+            return;
+    }
+
+    invalidate(bbox);
+    mEntries.push_back(Entry(bbox, sid, mNextSeqno++));
+    mDirty = true;
+}
+
+uint32 CSegLookupCache::invalidate(const BoundingBox3f& bbox) {
+    uint32 removed = 0;
+    for(uint32 i = 0; i < mEntries.size(); ) {
+        if (mEntries[i].bbox.intersects(bbox)) {
+            mEntries[i] = mEntries.back();
+            mEntries.pop_back();
+            removed++;
+        }
+        else {
+            i++;
+        }
+    }
+    if (removed > 0)
+        mDirty = true;
+    return removed;
+}
+
+void CSegLookupCache::clear() {
+    mEntries.clear();
+    mNodes.clear();
+    mDirty = false;
+}
+
+void CSegLookupCache::rebuild() {
+    mNodes.clear();
+    mDirty = false;
+    if (mEntries.empty())
+        return;
+    mNodes.reserve(2 * (mEntries.size() / MAX_LEAF_SIZE + 1));
+    build(0, mEntries.size());
+}
+
+void CSegLookupCache::build(uint32 begin, uint32 end) {
+    uint32 node_idx = mNodes.size();
+    mNodes.push_back(Node());
+
+    BoundingBox3f bounds = mEntries[begin].bbox;
+    for(uint32 i = begin+1; i < end; i++)
+        bounds.mergeIn(mEntries[i].bbox);
+    mNodes[node_idx].bbox = bounds;
+
+    if (end - begin <= MAX_LEAF_SIZE) {
+        mNodes[node_idx].first = begin;
+        mNodes[node_idx].count = end - begin;
+        mNodes[node_idx].right = 0;
+        return;
+    }
+
+    // Split at the median center along the longest axis. Median splits keep
+    // the tree balanced, so its depth stays logarithmic and the traversal
+    // stack in lookup() can't overflow.
+    Vector3f across = bounds.across();
+    uint32 axis = 0;
+    if (across.y > across[axis]) axis = 1;
+    if (across.z > across[axis]) axis = 2;
+
+    uint32 mid = begin + (end - begin) / 2;
+    std::nth_element(mEntries.begin() + begin, mEntries.begin() + mid, mEntries.begin() + end, CenterLess(axis));
+
+    mNodes[node_idx].first = 0;
+    mNodes[node_idx].count = 0;
+    build(begin, mid);
+    mNodes[node_idx].right = mNodes.size();
+    build(mid, end);
+}
+
+} // namespace Sirikata
@@ -0,0 +1,89 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_CSEG_LOOKUP_CACHE_HPP_
+#define _SIRIKATA_CSEG_LOOKUP_CACHE_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/BoundingBox.hpp>
+
+namespace Sirikata {
+
+/** Caches the regions returned by CSeg lookups so positions inside them can be
+ *  resolved without asking the CSeg server again. Regions are leaves of the
+ *  CSeg BSP tree, so they don't overlap. They're kept in a bounding volume
+ *  hierarchy which is rebuilt lazily on the first lookup after the set of
+ *  regions changes. Changes only happen on cache misses and segmentation
+ *  changes, which are rare compared to lookups.
+ *
+ *  Not thread safe, callers must provide their own locking.
+ */
+class CSegLookupCache {
+public:
+    CSegLookupCache();
+
+    /** Find the server for a position.
+     *  \returns the server whose cached region contains pos, or NullServerID
+     *  if no cached region contains it. If pos is on the boundary of several
+     *  regions, the one that was cached first wins.
+     */
+    ServerID lookup(const Vector3f& pos);
+
+    /** Cache a region. Any cached regions it overlaps are out of date and are
+     *  removed.
+     */
+    void insert(const BoundingBox3f& bbox, ServerID sid);
+
+    /** Remove all cached regions overlapping bbox. Regions that only touch it
+     *  are kept.
+     *  \returns the number of regions removed
+     */
+    uint32 invalidate(const BoundingBox3f& bbox);
+
+    void clear();
+
+    uint32 size() const {
+        return mEntries.size();
+    }
+
+private:
+    struct Entry {
+        Entry(const BoundingBox3f& _bbox, ServerID _sid, uint64 _seqno)
+         : bbox(_bbox), sid(_sid), seqno(_seqno)
+        {}
+
+        BoundingBox3f bbox;
+        ServerID sid;
+        // Order of insertion, for breaking ties on region boundaries
+        uint64 seqno;
+    };
+    typedef std::vector<Entry> EntryList;
+
+    // Nodes are stored in depth first order, so the left child of an interior
+    // node always directly follows it and only the right child needs an index.
+    struct Node {
+        BoundingBox3f bbox;
+        // Leaves cover mEntries[first, first+count), interior nodes have
+        // count == 0.
+        uint32 first;
+        uint32 count;
+        uint32 right;
+    };
+    typedef std::vector<Node> NodeList;
+
+    // Leaves hold at most this many regions, which are checked linearly.
+    static const uint32 MAX_LEAF_SIZE = 4;
+
+    void rebuild();
+    void build(uint32 begin, uint32 end);
+
+    EntryList mEntries;
+    NodeList mNodes;
+    bool mDirty;
+    uint64 mNextSeqno;
+}; // class CSegLookupCache
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CSEG_LOOKUP_CACHE_HPP_
@@ -71,7 +71,11 @@ CoordinateSegmentationClient::CoordinateSegmentationClient(SpaceContext* ctx, co
   : CoordinateSegmentation(ctx),  mBSPTreeValid(false),
     mAvailableServersCount(0), mTopLevelRegion(NULL),
     mIOService(new Network::IOService("CoordinationSegmentationClient")),
-    mSidMap(sidmap), mLeaseExpiryTime(Timer::now() + Duration::milliseconds(60000.0))
+    mSidMap(sidmap), mLeaseExpiryTime(Timer::now() + Duration::milliseconds(60000.0)),
+    mLookupPool(new Network::IOServicePool("CoordinateSegmentationClient Lookups", 1)),
+    mLookupBatchScheduled(false),
+    mLookupErrors(0),
+    mChangeInvalidations(0)
 {
   mTopLevelRegion.mBoundingBox = BoundingBox3f( Vector3f(0,0,0), Vector3f(0,0,0));
   mCSEGHost = GetOptionValue<String>("cseg-service-host");
@@ -85,6 +89,16 @@ CoordinateSegmentationClient::CoordinateSegmentationClient(SpaceContext* ctx, co
       )
     );
   }
+
+  mLookupPool->startWork();
+  mLookupPool->run();
+
+  if (mContext->commander()) {
+    mContext->commander()->registerCommand(
+      "space.cseg.lookup.stats",
+      std::tr1::bind(&CoordinateSegmentationClient::commandLookupStats, this, _1, _2, _3)
+    );
+  }
 }
 
 
@@ -109,11 +123,8 @@ void CoordinateSegmentationClient::accept_handler() {
 
   mSocket->close();
 
-  boost::mutex::scoped_lock lock(mCacheMutex);
-  mLookupCache.clear();
-  mTopLevelRegion.destroy();
-  mServerRegionCache.clear();
-  lock.unlock();
+  Sirikata::Protocol::CSeg::ChangeMessage changeMessage = csegMessage.change_message();
+  csegChangeMessage(&changeMessage);
 
   std::map<ServerID, SegmentationInfo> segmentationInfoMap;
 
@@ -140,7 +151,12 @@ void CoordinateSegmentationClient::accept_handler() {
 }
 
 CoordinateSegmentationClient::~CoordinateSegmentationClient() {
+  if (mContext->commander())
+    mContext->commander()->unregisterCommand("space.cseg.lookup.stats");
 
+  mLookupPool->stopWork();
+  mLookupPool->join();
+  delete mLookupPool;
 }
 
 void CoordinateSegmentationClient::sendSegmentationListenMessage(const Address4& my_addr) {
@@ -223,23 +239,93 @@ boost::shared_ptr<TCPSocket> CoordinateSegmentationClient::getLeasedSocket() {
 }
 
 ServerID CoordinateSegmentationClient::lookup(const Vector3f& pos)  {
+  Time started = Timer::now();
+  ServerID retval = NullServerID;
+  {
+    boost::mutex::scoped_lock cachelock(mCacheMutex);
+    retval = mLookupCache.lookup(pos);
+  }
+  if (retval != NullServerID) {
+    recordLookup(true, Timer::now() - started);
+    return retval;
+  }
+
+  if (!requestLookup(pos, &retval)) {
+    assert(false);
+    return 0;
+  }
+  recordLookup(false, Timer::now() - started);
+
+  return retval;
+}
+
+void CoordinateSegmentationClient::lookup(const Vector3f& pos, const LookupCallback& cb) {
+  Time started = Timer::now();
+  ServerID cached = NullServerID;
   {
     boost::mutex::scoped_lock cachelock(mCacheMutex);
+    cached = mLookupCache.lookup(pos);
+  }
+  if (cached != NullServerID) {
+    recordLookup(true, Timer::now() - started);
+    cb(cached);
+    return;
+  }
 
-    for (uint32 i=0 ; i<mLookupCache.size(); i++) {
-      if (mLookupCache[i].bbox.contains(pos)) {
+  boost::mutex::scoped_lock lock(mPendingLookupsMutex);
+  mPendingLookups.push_back(PendingLookup(pos, cb, started));
+  // A batch that is already scheduled will pick this one up too
+  if (!mLookupBatchScheduled) {
+    mLookupBatchScheduled = true;
+    mLookupPool->service()->post(
+      std::tr1::bind(&CoordinateSegmentationClient::processPendingLookups, this),
+      "CoordinateSegmentationClient::processPendingLookups"
+    );
+  }
+}
 
-        assert(mLookupCache[i].sid >= 1 && mLookupCache[i].sid <= 5);
+void CoordinateSegmentationClient::processPendingLookups() {
+  PendingLookupListPtr batch(new PendingLookupList());
+  {
+    boost::mutex::scoped_lock lock(mPendingLookupsMutex);
+    batch->swap(mPendingLookups);
+    mLookupBatchScheduled = false;
+  }
 
-        //std::cout << "pos=" << pos   <<" , mLookupCache[i].sid: " << mLookupCache[i].sid << "\n";
-        //fflush(stdout);
+  for(PendingLookupList::iterator it = batch->begin(); it != batch->end(); it++) {
+    // Nearby lookups tend to arrive together, so the region returned for an
+    // earlier lookup in the batch often answers this one.
+    {
+      boost::mutex::scoped_lock cachelock(mCacheMutex);
+      it->result = mLookupCache.lookup(it->pos);
+    }
+    if (it->result != NullServerID) {
+      recordLookup(true, Timer::now() - it->started);
+      continue;
+    }
 
-        return mLookupCache[i].sid;
-      }
+    if (!requestLookup(it->pos, &it->result)) {
+      // Reports NullServerID. Don't keep retrying the rest of the batch
+      // against a server we just failed to connect to.
+      boost::mutex::scoped_lock statslock(mStatsMutex);
+      mLookupErrors += (batch->end() - it);
+      break;
     }
+    recordLookup(false, Timer::now() - it->started);
   }
 
+  mContext->mainStrand->post(
+    std::tr1::bind(&CoordinateSegmentationClient::dispatchLookupResults, this, batch),
+    "CoordinateSegmentationClient::dispatchLookupResults"
+  );
+}
+
+void CoordinateSegmentationClient::dispatchLookupResults(PendingLookupListPtr results) {
+  for(PendingLookupList::iterator it = results->begin(); it != results->end(); it++)
+    it->cb(it->result);
+}
 
+bool CoordinateSegmentationClient::requestLookup(const Vector3f& pos, ServerID* result) {
   Sirikata::Protocol::CSeg::CSegMessage csegMessage;
 
   csegMessage.mutable_lookup_request_message().set_x(pos.x);
@@ -249,10 +335,8 @@ ServerID CoordinateSegmentationClient::lookup(const Vector3f& pos)  {
   boost::mutex::scoped_lock scopedLock(mMutex);
   boost::shared_ptr<TCPSocket> socket = getLeasedSocket();
 
-  if (socket == boost::shared_ptr<TCPSocket>()) {
-    assert(false);
-    return 0;
-  }
+  if (socket == boost::shared_ptr<TCPSocket>())
+    return false;
 
   writeCSEGMessage(socket, csegMessage);
 
@@ -263,12 +347,78 @@ ServerID CoordinateSegmentationClient::lookup(const Vector3f& pos)  {
   if (retval != 0 && csegMessage.lookup_response_message().has_server_bbox()) {
     boost::mutex::scoped_lock cachelock(mCacheMutex);
 
-    mLookupCache.push_back( LookupCacheEntry(retval, csegMessage.lookup_response_message().server_bbox()) );
+    mLookupCache.insert(csegMessage.lookup_response_message().server_bbox(), retval);
   }
 
   CSEG_LOG(info, "Lookup : " << pos << " : " << retval);
 
-  return retval;
+  *result = retval;
+  return true;
+}
+
+CoordinateSegmentationClient::LatencyHistogram::LatencyHistogram()
+ : count(0)
+{
+  for(uint32 i = 0; i < NUM_LATENCY_BUCKETS; i++)
+    buckets[i] = 0;
+}
+
+void CoordinateSegmentationClient::LatencyHistogram::sample(const Duration& latency) {
+  int64 us = latency.toMicroseconds();
+  uint32 bucket = 0;
+  while(bucket < NUM_LATENCY_BUCKETS-1 && us >= ((int64)2 << bucket))
+    bucket++;
+  buckets[bucket]++;
+  count++;
+}
+
+void CoordinateSegmentationClient::recordLookup(bool hit, const Duration& latency) {
+  boost::mutex::scoped_lock statslock(mStatsMutex);
+  if (hit)
+    mCacheHitLatency.sample(latency);
+  else
+    mCacheMissLatency.sample(latency);
+}
+
+namespace {
+void reportLatencyHistogram(Command::Result& result, const String& path, const uint64* buckets, uint32 num_buckets)
+{
+  result.put(path, Command::Array());
+  Command::Array& items = result.getArray(path);
+  for(uint32 i = 0; i < num_buckets; i++) {
+    if (buckets[i] == 0) continue;
+    Command::Object bucket;
+    // Upper bound of the bucket, the last one has none
+    if (i < num_buckets-1)
+      bucket["below_us"] = ((int64)2 << i);
+    bucket["count"] = buckets[i];
+    items.push_back(bucket);
+  }
+}
+}
+
+void CoordinateSegmentationClient::commandLookupStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid) {
+  Command::Result result = Command::EmptyResult();
+
+  {
+    boost::mutex::scoped_lock cachelock(mCacheMutex);
+    result.put("cache.regions", mLookupCache.size());
+  }
+  {
+    boost::mutex::scoped_lock lock(mPendingLookupsMutex);
+    result.put("pending", mPendingLookups.size());
+  }
+  {
+    boost::mutex::scoped_lock statslock(mStatsMutex);
+    result.put("hits", mCacheHitLatency.count);
+    result.put("misses", mCacheMissLatency.count);
+    result.put("errors", mLookupErrors);
+    result.put("change_invalidations", mChangeInvalidations);
+    reportLatencyHistogram(result, "latency.hit", mCacheHitLatency.buckets, NUM_LATENCY_BUCKETS);
+    reportLatencyHistogram(result, "latency.miss", mCacheMissLatency.buckets, NUM_LATENCY_BUCKETS);
+  }
+
+  cmdr->result(cmdid, result);
 }
 
 BoundingBoxList CoordinateSegmentationClient::serverRegion(const ServerID& server)
@@ -439,7 +589,36 @@ void CoordinateSegmentationClient::receiveMessage(Message* msg) {
 }
 
 void CoordinateSegmentationClient::csegChangeMessage(Sirikata::Protocol::CSeg::ChangeMessage* ccMsg) {
+  // Only the regions that changed are listed. Cached regions overlapping them
+  // are out of date, but everything else is still valid.
+  uint32 invalidated = 0;
+  boost::mutex::scoped_lock cachelock(mCacheMutex);
+  for (int i=0; i < ccMsg->region_size(); i++) {
+    ServerID id = ccMsg->region(i).id();
+    BoundingBox3f bounds = ccMsg->region(i).bounds();
+
+    invalidated += mLookupCache.invalidate(bounds);
+    mLookupCache.insert(bounds, id);
+
+    // Any server that had part of this region has a different region now
+    mServerRegionCache.erase(id);
+    for (std::map<ServerID, BoundingBoxList>::iterator it = mServerRegionCache.begin();
+         it != mServerRegionCache.end(); )
+    {
+      bool overlaps = false;
+      for (uint32 j = 0; j < it->second.size() && !overlaps; j++)
+        overlaps = it->second[j].intersects(bounds);
+      if (overlaps)
+        mServerRegionCache.erase(it++);
+      else
+        it++;
+    }
+  }
+  mTopLevelRegion.destroy();
+  cachelock.unlock();
 
+  boost::mutex::scoped_lock statslock(mStatsMutex);
+  mChangeInvalidations += invalidated;
 }
 
 void CoordinateSegmentationClient::migrationHint( std::vector<ServerLoadInfo>& svrLoadInfo ) {
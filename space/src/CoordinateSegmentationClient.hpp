@@ -38,9 +38,12 @@
 #include <sirikata/core/util/Platform.hpp>
 #include <sirikata/core/network/Asio.hpp>
 #include <sirikata/core/network/Address4.hpp>
+#include <sirikata/core/network/IOServicePool.hpp>
+#include <sirikata/core/command/Commander.hpp>
 #include <sirikata/space/CoordinateSegmentation.hpp>
 #include <sirikata/space/SegmentedRegion.hpp>
 
+#include "CSegLookupCache.hpp"
 #include "Protocol_CSeg.pbj.hpp"
 
 
@@ -50,7 +53,15 @@ typedef boost::asio::ip::tcp tcp;
 
 class ServerIDMap;
 
-/** Distributed BSP-tree based implementation of CoordinateSegmentation. */
+/** Distributed BSP-tree based implementation of CoordinateSegmentation.
+ *
+ *  Lookups are answered from a cache of the regions returned by earlier
+ *  lookups when possible. Misses have to go to the CSeg server. The
+ *  synchronous lookup blocks the caller for the round trip, the asynchronous
+ *  version queues the request for a separate thread which handles all the
+ *  queued misses together and delivers their results to the main strand in
+ *  one batch.
+ */
 class CoordinateSegmentationClient : public CoordinateSegmentation {
 public:
     CoordinateSegmentationClient(SpaceContext* ctx, const BoundingBox3f& region, const Vector3ui32& perdim,
@@ -58,6 +69,7 @@ public:
     virtual ~CoordinateSegmentationClient();
 
     virtual ServerID lookup(const Vector3f& pos) ;
+    virtual void lookup(const Vector3f& pos, const LookupCallback& cb);
     virtual BoundingBoxList serverRegion(const ServerID& server) ;
     virtual BoundingBox3f region() ;
     virtual uint32 numServers() ;
@@ -81,19 +93,8 @@ private:
 
     Trace::Trace* mTrace;
 
-    typedef struct LookupCacheEntry {
-      LookupCacheEntry(ServerID sid, const BoundingBox3f& bbox) {
-        this->bbox = bbox;
-        this->sid = sid;
-      }
-
-      BoundingBox3f bbox;
-      ServerID sid;
-
-    } LookupCacheEntry;
-
     boost::mutex mCacheMutex;
-    std::vector<LookupCacheEntry> mLookupCache;
+    CSegLookupCache mLookupCache;
     uint16 mAvailableServersCount;
     std::map<ServerID, BoundingBoxList> mServerRegionCache;
     SegmentedRegion mTopLevelRegion;
@@ -111,6 +112,54 @@ private:
     String mCSEGHost;
     String mCSEGPort;
 
+    // Asynchronous lookups that missed the cache, waiting for the lookup
+    // thread.
+    struct PendingLookup {
+      PendingLookup(const Vector3f& _pos, const LookupCallback& _cb, const Time& _started)
+       : pos(_pos), cb(_cb), started(_started), result(NullServerID)
+      {}
+
+      Vector3f pos;
+      LookupCallback cb;
+      Time started;
+      ServerID result;
+    };
+    typedef std::vector<PendingLookup> PendingLookupList;
+    typedef std::tr1::shared_ptr<PendingLookupList> PendingLookupListPtr;
+
+    Network::IOServicePool* mLookupPool;
+    boost::mutex mPendingLookupsMutex;
+    PendingLookupList mPendingLookups;
+    bool mLookupBatchScheduled;
+
+    // Runs on the lookup thread, resolving everything in mPendingLookups.
+    void processPendingLookups();
+    // Runs on the main strand, delivering the results of a batch.
+    void dispatchLookupResults(PendingLookupListPtr results);
+    // Ask the CSeg server for pos and cache the region in the
+    // response. Returns false if the server couldn't be reached.
+    bool requestLookup(const Vector3f& pos, ServerID* result);
+
+    // Lookup latency histograms. Bucket 0 counts latencies under 2us, bucket
+    // i counts latencies in [2^i, 2^(i+1)) us and the last bucket also counts
+    // everything longer.
+    static const uint32 NUM_LATENCY_BUCKETS = 24;
+    struct LatencyHistogram {
+      LatencyHistogram();
+      void sample(const Duration& latency);
+
+      uint64 count;
+      uint64 buckets[NUM_LATENCY_BUCKETS];
+    };
+    boost::mutex mStatsMutex;
+    LatencyHistogram mCacheHitLatency;
+    LatencyHistogram mCacheMissLatency;
+    uint64 mLookupErrors;
+    uint64 mChangeInvalidations;
+
+    void recordLookup(bool hit, const Duration& latency);
+    void commandLookupStats(const Command::Command& cmd, Command::Commander* cmdr, Command::CommandID cmdid);
+
     void handleSelfLookup(ServerID my_sid, Address4 my_addr);
 
     void startAccepting();
@@ -110,12 +110,18 @@ Forwarder::Forwarder(SpaceContext* ctx)
              mOSegLookups(NULL),
              mUniqueConnIDs(0),
              mServiceIDSource(0),
+             mRouteShards(NULL),
              mServerWeightPoller(
                  ctx->mainStrand,
                  std::tr1::bind(&Forwarder::updateServerWeights, this),
                  "Forwarder::updateServerWeights",
                  Duration::milliseconds((int64)10)),
-             mReceivedMessages(Sirikata::SizedResourceMonitor(GetOptionValue<uint32>(FORWARDER_RECEIVE_QUEUE_SIZE))),
+             // The queue size limits the total bytes of messages waiting, so
+             // the ring can't fill up before that limit is hit.
+             mReceivedMessages(GetOptionValue<uint32>(FORWARDER_RECEIVE_QUEUE_SIZE)),
+             mReceivedMessagesSize(GetOptionValue<uint32>(FORWARDER_RECEIVE_QUEUE_SIZE)),
+             mReceivedMessagesScheduled(0),
+             mReceivedMessagesPaused(false),
              mTimeSeriesPoller(
                  ctx->mainStrand,
                  std::tr1::bind(&Forwarder::reportStats, this),
@@ -130,6 +136,18 @@ Forwarder::Forwarder(SpaceContext* ctx)
     mNullServerIDOSegCallback=std::tr1::bind(&Forwarder::routeObjectMessageToServerNoReturn, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2,std::tr1::placeholders:: _3, NullServerID);
     mOutgoingMessages = new ForwarderServiceQueue(mContext->id(), GetOptionValue<uint32>(FORWARDER_SEND_QUEUE_SIZE), (ForwarderServiceQueue::Listener*)this);
 
+    uint32 route_threads = GetOptionValue<uint32>(FORWARDER_ROUTE_THREADS);
+    if (route_threads > 0) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        mRouteShards = new ShardedWorkQueue<ShardedRoute>(
+            "Forwarder Routing",
+            route_threads, route_threads * ShardedWorkQueue<ShardedRoute>::DefaultShardsPerWorker,
+            std::tr1::bind(&Forwarder::routeShardedMessage, this, _1, _2)
+        );
+        mShardODPRouters.resize(route_threads);
+    }
+
     // Messages destined for objects are subscribed to here so we can easily pick them
     // out and decide whether they can be delivered directly or need forwarding
     this->registerMessageRecipient(SERVER_PORT_OBJECT_MESSAGE_ROUTING, this);
@@ -145,6 +163,10 @@ Forwarder::Forwarder(SpaceContext* ctx)
   //Don't need to do anything special for destructor
   Forwarder::~Forwarder()
   {
+      // Finish routing anything handed to the workers while we can still
+      // queue it.
+      delete mRouteShards;
+
       // We don't need to delete these because they are added to
       // mOutgoingMessages as a service queue, so they will be deleted there.
       mODPRouters.clear();
@@ -166,7 +188,8 @@ void Forwarder::initialize(ObjectSegmentation* oseg, ServerMessageQueue* smq, Se
 {
     addODPServerMessageService(loc);
 
-    mOSegLookups = new OSegLookupQueue(mContext->mainStrand, oseg);
+    mOSegLookups = new OSegLookupQueue(mContext, mContext->mainStrand, oseg);
+    mOSegLookups->setAvailableCallback(std::tr1::bind(&Forwarder::osegLookupsAvailable, this));
     mServerMessageQueue = smq;
     mServerMessageReceiver = smr;
 }
@@ -194,6 +217,8 @@ void Forwarder::handleObjectMessageLoop(Sirikata::Protocol::Object::ObjectMessag
 
 // Service Implementation
 void Forwarder::start() {
+    if (mRouteShards != NULL)
+        mRouteShards->start();
     mServerWeightPoller.start();
     mTimeSeriesPoller.start();
 }
@@ -538,17 +563,62 @@ bool Forwarder::tryCacheForward(Sirikata::Protocol::Object::ObjectMessage* msg)
     if (destserver.server() == mContext->id())
         return false;
 
+    if (mRouteShards != NULL) {
+        mRouteShards->push(UUID::Hasher()(msg->dest_object()), ShardedRoute(msg, destserver));
+        return true;
+    }
+
     // Use normal routing mechanism if we have a non-local dest
     bool send_success = routeObjectMessageToServer(msg, destserver, OSegLookupQueue::ResolvedFromCache, NullServerID);
     return true; // If we got here, the cache was successful, we just dropped it.
 }
 
+void Forwarder::routeShardedMessage(ShardedRoute& route, uint32 worker) {
+    ODPRouterMap& routers = mShardODPRouters[worker];
+    ODPFlowScheduler* flow_sched = NULL;
+    ODPRouterMap::iterator odp_it = routers.find(route.dest.server());
+    if (odp_it != routers.end()) {
+        flow_sched = odp_it->second;
+    }
+    else {
+        flow_sched = getODPFlowScheduler(route.dest.server());
+        routers[route.dest.server()] = flow_sched;
+    }
+
+    (void) routeObjectMessageToServer(route.msg, route.dest, OSegLookupQueue::ResolvedFromCache, NullServerID, flow_sched);
+}
+
+ODPFlowScheduler* Forwarder::getODPFlowScheduler(ServerID dest_server) {
+    // We try to look up the ODPFlowScheduler efficiently first, and only
+    // prePush if we fail to find it.
+    {
+        boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
+        ODPRouterMap::iterator odp_it = mODPRouters.find(dest_server);
+        if (odp_it != mODPRouters.end())
+            return odp_it->second;
+    }
+    // Will force allocation of ODPFlowScheduler if its not there already
+    boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
+    mOutgoingMessages->prePush(dest_server);
+    return mODPRouters[dest_server];
+}
+
 void Forwarder::routeObjectMessageToServerNoReturn(Sirikata::Protocol::Object::ObjectMessage* obj_msg, const OSegEntry &dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom) {
     (void) routeObjectMessageToServer(obj_msg, dest_serv, resolved_from, forwardFrom);
 }
 
-bool Forwarder::routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMessage* obj_msg, const OSegEntry &dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom)
+bool Forwarder::routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMessage* obj_msg, const OSegEntry &dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom, ODPFlowScheduler* flow_sched)
 {
+    // The lookup timed out or the OSeg couldn't find the object, so there's
+    // nowhere to send it
+    if (resolved_from == OSegLookupQueue::ResolveFailed) {
+        mDroppedPerSecond++;
+        TIMESTAMP(obj_msg, Trace::DROPPED_DURING_FORWARDING);
+        TRACE_DROP(DROPPED_DURING_FORWARDING_ROUTING);
+        delete obj_msg;
+        return false;
+    }
+
     Trace::MessagePath mp = (resolved_from == OSegLookupQueue::ResolvedFromCache)
         ? Trace::OSEG_CACHE_LOOKUP_FINISHED
         : Trace::OSEG_SERVER_LOOKUP_FINISHED;
@@ -573,23 +643,8 @@ bool Forwarder::routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMes
   TIMESTAMP(obj_msg, Trace::SPACE_TO_SPACE_ENQUEUED);
 
   // And then we can actually push
-  // We try to look up the ODPFlowScheduler efficiently first, and only prePush
-  // if we fail to find it.
-  ODPFlowScheduler* flow_sched = NULL;
-  {
-      boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
-      ODPRouterMap::iterator odp_it = mODPRouters.find(dest_serv.server());
-      if (odp_it != mODPRouters.end())
-          flow_sched = odp_it->second;
-  }
-  if (flow_sched == NULL) {
-      // Will force allocation of ODPFlowScheduler if its not there already
-      {
-          boost::lock_guard<boost::recursive_mutex> lck(mODPRouterMapMutex);
-          mOutgoingMessages->prePush(dest_serv.server());
-          flow_sched = mODPRouters[dest_serv.server()];
-      }
-  }
+  if (flow_sched == NULL)
+      flow_sched = getODPFlowScheduler(dest_serv.server());
 
   OSegEntry source_object_data(OSegEntry::null());//FIXME: do we want mandatory lookup for nonlocal guys?! = mOSegLookups->cacheLookup(obj_msg->source_object());
   if (source_object_data.isNull()) {
@@ -696,26 +751,34 @@ void Forwarder::serverMessageReceived(Message* msg) {
         delete obj_msg;
     }
 
-    bool got_empty;
-    bool push_success;
-    {
-        // FIXME currently we force everything that's not an ODP message to be
-        // pushed into the queue, even if it's overflowing. Various code
-        // (e.g. at least proximity) currently relies on no server-to-server
-        // drops to behave properly. A reliability layer would be a better
-        // solution, but this works for now...
-        bool force_push = (msg->dest_port() != SERVER_PORT_OBJECT_MESSAGE_ROUTING);
-        boost::lock_guard<boost::mutex> lock(mReceivedMessagesMutex);
-        got_empty = mReceivedMessages.probablyEmpty();
-        push_success = mReceivedMessages.push(msg, force_push);
+    // FIXME currently we force everything that's not an ODP message to be
+    // delivered, even if the queue is overflowing. Various code (e.g. at least
+    // proximity) currently relies on no server-to-server drops to behave
+    // properly. A reliability layer would be a better solution, but this works
+    // for now... These messages are rare, so they skip the bounded ring and
+    // are posted to the main strand directly.
+    if (msg->dest_port() != SERVER_PORT_OBJECT_MESSAGE_ROUTING) {
+        mContext->mainStrand->post(
+            std::tr1::bind(&Forwarder::dispatchReceivedServerMessage, this, msg),
+            "Forwarder::dispatchReceivedServerMessage"
+        );
+        return;
+    }
+
+    bool push_success = mReceivedMessagesSize.preIncrement(msg, false);
+    if (push_success) {
+        push_success = mReceivedMessages.push(msg);
+        if (!push_success)
+            mReceivedMessagesSize.postDecrement(msg);
     }
 
     if (!push_success) {
         SILOG(forwarder,debug,"Unhandled drop in Forwarder. Received messages queue is overflowing.");
         delete msg;
+        return;
     }
 
-    if (got_empty && push_success)
+    if (compare_and_swap(&mReceivedMessagesScheduled, 0, 1))
         scheduleProcessReceivedServerMessages();
 }
 
@@ -729,25 +792,43 @@ void Forwarder::scheduleProcessReceivedServerMessages() {
 void Forwarder::processReceivedServerMessages() {
 #define MAX_RECEIVED_MESSAGES_PROCESSED 20 // need a better way to decide this
 
+    // These messages already missed the OSeg cache, so they'd just be rejected
+    // while the lookup queue is full. Leave them in the ring until there's
+    // room, keeping the scheduled flag set so nobody else reschedules us.
+    if (mOSegLookups->full()) {
+        mReceivedMessagesPaused = true;
+        return;
+    }
+
     // First, pull out messages we're going to process in this round
-    uint32 pulled = 0;
     Message* messages[MAX_RECEIVED_MESSAGES_PROCESSED];
-    bool got_empty;
-    {
-        boost::lock_guard<boost::mutex> lock(mReceivedMessagesMutex);
-        while(!mReceivedMessages.probablyEmpty() && pulled < MAX_RECEIVED_MESSAGES_PROCESSED) {
-            bool popped = mReceivedMessages.pop( messages[pulled] );
-            if (!popped) break;
-            pulled++;
-        }
-        got_empty = mReceivedMessages.probablyEmpty();
-    }
+    uint32 pulled = mReceivedMessages.popBatch(messages, MAX_RECEIVED_MESSAGES_PROCESSED);
+    for(uint32 i = 0; i < pulled; i++)
+        mReceivedMessagesSize.postDecrement(messages[i]);
 
     for(uint32 i = 0; i < pulled; i++)
         ServerMessageDispatcher::dispatchMessage(messages[i]);
 
-    if (!got_empty)
+    if (!mReceivedMessages.probablyEmpty()) {
+        scheduleProcessReceivedServerMessages();
+        return;
+    }
+    // Clear the flag, then check again in case a message was pushed after we
+    // looked but saw the flag still set.
+    mReceivedMessagesScheduled = 0;
+    memory_barrier();
+    if (!mReceivedMessages.probablyEmpty() && compare_and_swap(&mReceivedMessagesScheduled, 0, 1))
         scheduleProcessReceivedServerMessages();
 }
 
+void Forwarder::dispatchReceivedServerMessage(Message* msg) {
+    ServerMessageDispatcher::dispatchMessage(msg);
+}
+
+void Forwarder::osegLookupsAvailable() {
+    if (!mReceivedMessagesPaused) return;
+    mReceivedMessagesPaused = false;
+    scheduleProcessReceivedServerMessages();
+}
+
 } //end namespace
@@ -52,6 +52,8 @@
 
 #include <sirikata/core/queue/SizedThreadSafeQueue.hpp>
 #include <sirikata/core/queue/ThreadSafeQueueWithNotification.hpp>
+#include <sirikata/core/queue/ShardedWorkQueue.hpp>
+#include <sirikata/core/queue/MPSCRing.hpp>
 
 namespace Sirikata
 {
@@ -124,14 +126,34 @@ private:
     typedef std::tr1::unordered_map<ServerID, ODPFlowScheduler*> ODPRouterMap;
     boost::recursive_mutex mODPRouterMapMutex;
     ODPRouterMap mODPRouters;
+    // Messages which hit in the OSeg cache can be routed to their
+    // ODPFlowScheduler on a pool of worker threads instead of the thread they
+    // arrived on. They are sharded by destination object, so messages to an
+    // object stay in order. Each worker caches ODPFlowSchedulers so it doesn't
+    // need mODPRouterMapMutex; they are never removed, so the cache can't go
+    // stale. NULL if routing is done on the receiving thread.
+    struct ShardedRoute {
+        ShardedRoute(Sirikata::Protocol::Object::ObjectMessage* _msg, const OSegEntry& _dest)
+         : msg(_msg), dest(_dest)
+        {}
+
+        Sirikata::Protocol::Object::ObjectMessage* msg;
+        OSegEntry dest;
+    };
+    ShardedWorkQueue<ShardedRoute>* mRouteShards;
+    std::vector<ODPRouterMap> mShardODPRouters;
     Poller mServerWeightPoller; // For updating ServerMessageQueue, remote
                                 // ServerMessageReceiver with per-server weights
 
-    // Note: This is kinda stupid, but we need to protect this thread safe queue
-    // with another lock because we don't have a sized thread safe queue with
-    // notification.
-    boost::mutex mReceivedMessagesMutex;
-    Sirikata::SizedThreadSafeQueue<Message*> mReceivedMessages;
+    // Object messages from other servers waiting for the main strand. Only the
+    // main strand pops, so this is a lock-free ring, with the total size of
+    // the messages limited separately. mReceivedMessagesScheduled is set while
+    // a handler is posted to drain it. Draining pauses while the OSeg lookup
+    // queue is full, leaving mReceivedMessagesScheduled set until it has room.
+    Sirikata::MPSCRing<Message*> mReceivedMessages;
+    Sirikata::SizedResourceMonitor mReceivedMessagesSize;
+    volatile uint32 mReceivedMessagesScheduled;
+    bool mReceivedMessagesPaused;
 
     Poller mTimeSeriesPoller;
     Time mLastStatsTime;
@@ -208,7 +230,11 @@ private:
     // This version is provided if you already know which server the message should be sent to
     void routeObjectMessageToServerNoReturn(Sirikata::Protocol::Object::ObjectMessage* msg, const OSegEntry& dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom = NullServerID);
     WARN_UNUSED
-    bool routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMessage* msg, const OSegEntry& dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom = NullServerID);
+    bool routeObjectMessageToServer(Sirikata::Protocol::Object::ObjectMessage* msg, const OSegEntry& dest_serv, OSegLookupQueue::ResolvedFrom resolved_from, ServerID forwardFrom = NullServerID, ODPFlowScheduler* flow_sched = NULL);
+    // Handler for mRouteShards, run on one of its workers
+    void routeShardedMessage(ShardedRoute& route, uint32 worker);
+    // Find the ODPFlowScheduler for the server, creating it if necessary
+    ODPFlowScheduler* getODPFlowScheduler(ServerID dest_server);
 
     // Dispatches a message destined for the space server itself
     void dispatchMessage(Sirikata::Protocol::Object::ObjectMessage* msg) const;
@@ -226,6 +252,9 @@ private:
 
     void scheduleProcessReceivedServerMessages();
     void processReceivedServerMessages();
+    // Invoked by the OSeg lookup queue when it has room for more lookups
+    void osegLookupsAvailable();
+    void dispatchReceivedServerMessage(Message* msg);
 
     // ForwarderServiceQueue::Listener Interface (passed on to ServerMessageQueue)
     virtual void forwarderServiceMessageReady(ServerID dest_server);
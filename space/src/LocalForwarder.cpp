@@ -50,31 +50,33 @@ LocalForwarder::LocalForwarder(SpaceContext* ctx)
 }
 
 void LocalForwarder::addActiveConnection(ObjectConnection* conn) {
-    boost::lock_guard<boost::mutex> lock(mMutex);
+    Stripe& stripe = getStripe(conn->id());
+    boost::lock_guard<boost::mutex> lock(stripe.mutex);
 
-
-    assert(mActiveConnections.find(conn->id()) == mActiveConnections.end());
-    mActiveConnections[conn->id()] = conn;
+    assert(stripe.connections.find(conn->id()) == stripe.connections.end());
+    stripe.connections[conn->id()] = conn;
 }
 
 void LocalForwarder::removeActiveConnection(const UUID& objid) {
-    boost::lock_guard<boost::mutex> lock(mMutex);
+    Stripe& stripe = getStripe(objid);
+    boost::lock_guard<boost::mutex> lock(stripe.mutex);
 
-    ObjectConnectionMap::iterator it = mActiveConnections.find(objid);
-    if (it == mActiveConnections.end())
+    ObjectConnectionMap::iterator it = stripe.connections.find(objid);
+    if (it == stripe.connections.end())
         return;
 
-    mActiveConnections.erase(it);
+    stripe.connections.erase(it);
 }
 
 bool LocalForwarder::tryForward(Sirikata::Protocol::Object::ObjectMessage* msg) {
     ObjectConnection* conn = NULL;
     {
-        boost::lock_guard<boost::mutex> lock(mMutex);
+        Stripe& stripe = getStripe(msg->dest_object());
+        boost::lock_guard<boost::mutex> lock(stripe.mutex);
 
         // Destination connection must exist and be enabled
-        ObjectConnectionMap::iterator it = mActiveConnections.find(msg->dest_object());
-        if (it == mActiveConnections.end())
+        ObjectConnectionMap::iterator it = stripe.connections.find(msg->dest_object());
+        if (it == stripe.connections.end())
             return false;
 
         conn = it->second;
@@ -84,8 +86,8 @@ bool LocalForwarder::tryForward(Sirikata::Protocol::Object::ObjectMessage* msg)
         // have the source object...).
         // We only sanity check the source object when we're sure we're going to be able to
         // ship it.
-        //ObjectConnectionMap::iterator src_it = mActiveConnections.find(msg->source_object());
-        //if (src_it == mActiveConnections.end())
+        //ObjectConnectionMap::iterator src_it = stripe.connections.find(msg->source_object());
+        //if (src_it == stripe.connections.end())
         //    return false;
     }
 
@@ -77,9 +77,22 @@ class LocalForwarder : public PollingService {
 
     typedef std::tr1::unordered_map<UUID, ObjectConnection*, UUID::Hasher> ObjectConnectionMap;
 
+    // Connections are split into stripes by object ID, each with its own
+    // lock, so networking threads forwarding to different objects rarely
+    // contend with each other
+    enum {
+        NumStripes = 16
+    };
+    struct Stripe {
+        boost::mutex mutex;
+        ObjectConnectionMap connections;
+    };
+    Stripe& getStripe(const UUID& objid) {
+        return mStripes[objid.hash() % NumStripes];
+    }
+
     SpaceContext* mContext;
-    ObjectConnectionMap mActiveConnections;
-    boost::mutex mMutex;
+    Stripe mStripes[NumStripes];
     // Stats, reported as x per second
     Time mLastStatsTime;
     const String mTimeSeriesForwardedName;
@@ -32,48 +32,24 @@
 
 #include "OSegLookupQueue.hpp"
 #include <sirikata/space/ObjectSegmentation.hpp>
+#include <sirikata/space/Trace.hpp>
 #include "Options.hpp"
 #include <sirikata/core/options/CommonOptions.hpp>
 
 namespace Sirikata {
 
-// OSegLookupList Implementation
-
-size_t OSegLookupQueue::OSegLookupList::ByteSize() const{
-    return mTotalSize;
-}
-
-size_t OSegLookupQueue::OSegLookupList::size()const {
-    return OSegLookupVector::size();
-}
-
-OSegLookupQueue::OSegLookup& OSegLookupQueue::OSegLookupList::operator[](size_t where) {
-    return OSegLookupVector::operator[](where);
-}
-
-void OSegLookupQueue::OSegLookupList::push_back(const OSegLookup& lu) {
-    mTotalSize += lu.size;
-    OSegLookupVector::push_back(lu);
-}
-
-OSegLookupQueue::OSegLookupList::iterator OSegLookupQueue::OSegLookupList::begin(){
-    return OSegLookupVector::begin();
-}
-
-OSegLookupQueue::OSegLookupList::iterator OSegLookupQueue::OSegLookupList::end(){
-    return OSegLookupVector::end();
-}
-
-
-// OSegLookupQueue Implementation
-
-
-OSegLookupQueue::OSegLookupQueue(Network::IOStrand* net_strand, ObjectSegmentation* oseg)
- : mNetworkStrand(net_strand),
+OSegLookupQueue::OSegLookupQueue(SpaceContext* ctx, Network::IOStrand* net_strand, ObjectSegmentation* oseg)
+ : mContext(ctx),
+   mNetworkStrand(net_strand),
    mOSeg(oseg),
-   mTotalSize(0)
+   mLookups(GetOptionValue<uint32>(OSEG_LOOKUP_QUEUE_SIZE), GetOptionValue<uint32>(OSEG_LOOKUP_QUEUE_BYTES)),
+   mLookupTimeout(GetOptionValue<Duration>(OSEG_LOOKUP_TIMEOUT)),
+   mTimeoutCheckScheduled(false),
+   mBatchStarted(Time::null()),
+   mBatchFlushScheduled(false)
 {
-    mMaxLookups = GetOptionValue<uint32>(OSEG_LOOKUP_QUEUE_SIZE);
+    mMaxBatchSize = std::max(GetOptionValue<uint32>(OSEG_LOOKUP_BATCH_SIZE), (uint32)1);
+    mBatchWindow = GetOptionValue<Duration>(OSEG_LOOKUP_BATCH_WINDOW);
     mOSeg->setLookupListener(this);
 }
 
@@ -82,24 +58,26 @@ OSegEntry OSegLookupQueue::cacheLookup(const UUID& destid) const {
     return mOSeg->cacheLookup(destid);
 }
 
+bool OSegLookupQueue::full() {
+    return mLookups.full();
+}
+
 bool OSegLookupQueue::lookup(Sirikata::Protocol::Object::ObjectMessage* msg, const LookupCallback& cb)
 {
   UUID dest_obj = msg->dest_object();
   size_t cursize = msg->ByteSize();
 
+  OSegLookup lu;
+  lu.msg = msg;
+  lu.cb = cb;
+  lu.size = cursize;
+
   //if already looking up, do not call lookup on mOSeg;
-  LookupMap::const_iterator it = mLookups.find(dest_obj);
-  if (it != mLookups.end())
+  if (mLookups.contains(dest_obj))
   {
-    //we are already looking up the object.  Just add it to mLookups
-    // And if we do, stick it on a list and wait
-    mTotalSize += cursize;
-    OSegLookup lu;
-    lu.msg = msg;
-    lu.cb = cb;
-    lu.size = cursize;
-    mLookups[dest_obj].push_back(lu);
-    return true;
+    //we are already looking up the object.  Just add it to mLookups, as long
+    //as we aren't holding too much data already
+    return mLookups.append(dest_obj, lu);
   }
 
   //if get a cache hit from oseg, do not return;
@@ -111,7 +89,7 @@ bool OSegLookupQueue::lookup(Sirikata::Protocol::Object::ObjectMessage* msg, con
   }
 
   //if did not get a cache hit, check if have enough room to add it;
-  if (mLookups.size() > mMaxLookups)
+  if (full())
     return false;
 
   //FIXME: hardcoded here
@@ -120,24 +98,71 @@ bool OSegLookupQueue::lookup(Sirikata::Protocol::Object::ObjectMessage* msg, con
   if (mOSeg->getPushback() > MAX_OSEG_PUSHBACK_PARAMETER)
       return false;
 
-  //  otherwise, do full oseg lookup;
-  destServer = mOSeg->lookup(dest_obj);
-  // If we already have a server, handle the callback right away
-  if (destServer.notNull()) {
-    cb(msg, destServer, ResolvedFromCache);
-    return true;
-  }
-
-  // And if we do, stick it on a list and wait
-  mTotalSize += cursize;
-  OSegLookup lu;
-  lu.msg = msg;
-  lu.cb = cb;
-  lu.size = cursize;
-  mLookups[dest_obj].push_back(lu);
+  // Otherwise, wait for a full OSeg lookup. Further lookups for the same
+  // object will wait with this one.
+  mLookups.start(dest_obj, lu, mContext->simTime());
+  queueLookup(dest_obj);
+  scheduleTimeoutCheck();
   return true;
 }
 
+void OSegLookupQueue::queueLookup(const UUID& id) {
+    if (mBatch.empty())
+        mBatchStarted = mContext->simTime();
+    mBatch.push_back(id);
+
+    if (mBatch.size() >= mMaxBatchSize) {
+        flushBatch();
+        return;
+    }
+
+    if (mBatchFlushScheduled) return;
+    mBatchFlushScheduled = true;
+    if (mBatchWindow == Duration::zero()) {
+        mNetworkStrand->post(
+            std::tr1::bind(&OSegLookupQueue::handleScheduledFlush, this),
+            "OSegLookupQueue::handleScheduledFlush"
+        );
+    }
+    else {
+        mNetworkStrand->post(
+            mBatchWindow,
+            std::tr1::bind(&OSegLookupQueue::handleScheduledFlush, this),
+            "OSegLookupQueue::handleScheduledFlush"
+        );
+    }
+}
+
+void OSegLookupQueue::handleScheduledFlush() {
+    mBatchFlushScheduled = false;
+    flushBatch();
+}
+
+void OSegLookupQueue::flushBatch() {
+    if (mBatch.empty()) return;
+
+    // Callbacks may queue more lookups, so work from our own copy
+    std::vector<UUID> ids;
+    ids.swap(mBatch);
+    Time flushed = mContext->simTime();
+    Duration queue_delay = flushed - mBatchStarted;
+
+    std::vector<OSegEntry> results;
+    mOSeg->lookupBatch(ids, &results);
+
+    uint32 messages = 0;
+    for(uint32 i = 0; i < ids.size(); i++) {
+        if (!mLookups.contains(ids[i])) continue;
+        messages += mLookups.messages(ids[i]);
+        // If we already have a server, handle the callbacks right away
+        if (results[i].notNull())
+            completeLookups(ids[i], results[i], ResolvedFromCache);
+    }
+
+    CONTEXT_SPACETRACE_NO_TIME(osegLookupBatch, flushed, mContext->id(), ids.size(), messages, queue_delay, mLookups.size());
+    checkAvailable();
+}
+
 void OSegLookupQueue::osegLookupCompleted(const UUID& id, const OSegEntry& dest) {
     mNetworkStrand->post(
         std::tr1::bind(&OSegLookupQueue::handleLookupCompleted, this, id, dest),
@@ -146,17 +171,56 @@ void OSegLookupQueue::osegLookupCompleted(const UUID& id, const OSegEntry& dest)
 }
 
 void OSegLookupQueue::handleLookupCompleted(const UUID& id, const OSegEntry& dest) {
-    //Now sending messages that we had saved up from oseg lookup calls.
-    LookupMap::iterator iterQueueMap = mLookups.find(id);
-    if (iterQueueMap == mLookups.end())
+    //Now sending messages that we had saved up from oseg lookup calls. The
+    //OSeg reports lookups it couldn't resolve with a null entry.
+    completeLookups(id, dest, dest.notNull() ? ResolvedFromServer : ResolveFailed);
+    checkAvailable();
+}
+
+void OSegLookupQueue::completeLookups(const UUID& id, const OSegEntry& dest, ResolvedFrom resolved_from) {
+    // Take the list out of the table first so callbacks can safely start new
+    // lookups
+    LookupTable::LookupList lookups;
+    if (!mLookups.take(id, &lookups))
         return;
 
-    for (int s=0; s < (signed) ((iterQueueMap->second).size()); ++ s) {
-        const OSegLookup& lu = (iterQueueMap->second[s]);
-        mTotalSize -= lu.size;
-        lu.cb(lu.msg, dest, ResolvedFromServer);
+    for (uint32 s = 0; s < lookups.size(); ++s) {
+        const OSegLookup& lu = lookups[s];
+        lu.cb(lu.msg, dest, resolved_from);
+    }
+}
+
+void OSegLookupQueue::scheduleTimeoutCheck() {
+    if (mTimeoutCheckScheduled) return;
+    mTimeoutCheckScheduled = true;
+    // Checking every half timeout means lookups fail at most 1.5 timeouts
+    // after they started
+    mNetworkStrand->post(
+        mLookupTimeout / 2,
+        std::tr1::bind(&OSegLookupQueue::handleTimeoutCheck, this),
+        "OSegLookupQueue::handleTimeoutCheck"
+    );
+}
+
+void OSegLookupQueue::handleTimeoutCheck() {
+    mTimeoutCheckScheduled = false;
+
+    std::vector<UUID> expired;
+    mLookups.expired(mContext->simTime() - mLookupTimeout, &expired);
+    if (!expired.empty()) {
+        SILOG(oseg, warn, "Giving up on " << expired.size() << " OSeg lookups after " << mLookupTimeout);
+        for(uint32 i = 0; i < expired.size(); i++)
+            completeLookups(expired[i], OSegEntry::null(), ResolveFailed);
+        checkAvailable();
     }
-    mLookups.erase(iterQueueMap);
+
+    if (!mLookups.empty())
+        scheduleTimeoutCheck();
+}
+
+void OSegLookupQueue::checkAvailable() {
+    if (mLookups.available() && mAvailableCallback)
+        mAvailableCallback();
 }
 
 } // namespace Sirikata
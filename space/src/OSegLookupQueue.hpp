@@ -36,20 +36,32 @@
 #include <sirikata/core/util/Platform.hpp>
 #include <sirikata/space/ServerMessage.hpp>
 #include <sirikata/space/ObjectSegmentation.hpp>
+#include <sirikata/space/SpaceContext.hpp>
+#include "OSegLookupTable.hpp"
 
 namespace Sirikata {
 
 /** OSegLookupQueue manages outstanding OSeg lookups.  Lookups are submitted
  *  and either accepted and we commit to finishing them or rejected immediately.
- *  The user can specify a policy for how these rejections occur, e.g. based
- *  on a total number of outstanding lookups, a total number of bytes in messages
- *  for outstanding lookups, etc.
+ *  Lookups are rejected when too many objects are being looked up or too many
+ *  bytes of messages are waiting on them.
+ *
+ *  Concurrent lookups for the same object are coalesced into one OSeg lookup,
+ *  and new lookups are collected into batches which are handed to the OSeg
+ *  together. A batch is issued once it fills up or, at the latest, after the
+ *  batching window has passed. With no window, a batch collects the lookups
+ *  made by everything already queued on the strand.
+ *
+ *  Lookups the OSeg doesn't answer within the lookup timeout, or which it
+ *  answers without a server, fail. Their callbacks get a null OSegEntry and
+ *  ResolveFailed, and they stop counting against the limits.
  */
 class OSegLookupQueue : public OSegLookupListener {
 public:
     enum ResolvedFrom {
         ResolvedFromCache,
-        ResolvedFromServer
+        ResolvedFromServer,
+        ResolveFailed
     };
 
     /** Callback type for lookups, taking the message the lookup was performed on, the
@@ -57,6 +69,10 @@ public:
      *  If you need additional information it must be curried via bind().
      */
     typedef std::tr1::function<void(Sirikata::Protocol::Object::ObjectMessage*, const OSegEntry&, ResolvedFrom)> LookupCallback;
+    /** Callback invoked when the queue has room again after full() returned
+     *  true or a lookup was rejected.
+     */
+    typedef std::tr1::function<void()> AvailableCallback;
 
 private:
     struct OSegLookup {
@@ -65,44 +81,54 @@ private:
         uint32 size;
     };
 
-    /** A normal vector of OSegLookups except it also maintains the
-     *  total size of all its elements.
-     */
-    class OSegLookupList : protected std::vector<OSegLookup> {
-        typedef std::vector<OSegLookup> OSegLookupVector;
-        size_t mTotalSize;
-    public:
-        size_t ByteSize() const;
-        size_t size() const;
-        OSegLookup& operator[] (size_t where);
-        void push_back(const OSegLookup& lu);
-        OSegLookupVector::iterator begin();
-        OSegLookupVector::iterator end();
-    };
-
-    typedef std::tr1::unordered_map<UUID, OSegLookupList, UUID::Hasher> LookupMap;
+    typedef OSegLookupTable<OSegLookup> LookupTable;
 
 
+    SpaceContext* mContext;
     Network::IOStrand* mNetworkStrand;
     ObjectSegmentation* mOSeg; // The OSeg that does the heavy lifting
 
-    LookupMap mLookups; // Map of object id being queried -> msgs destined for that object
-    int32 mTotalSize; // Total # bytes associated with outstanding lookups
-    uint32 mMaxLookups; // Total number of unique OSeg lookups (i.e. number of
-                        // UUIDs, not number of requests).
+    // Messages waiting on lookups, limited by the total number of unique OSeg
+    // lookups (i.e. number of UUIDs, not number of requests) and bytes of
+    // messages
+    LookupTable mLookups;
+    Duration mLookupTimeout;
+    bool mTimeoutCheckScheduled;
+
+    // New lookups which haven't been handed to the OSeg yet
+    std::vector<UUID> mBatch;
+    Time mBatchStarted; // When the first lookup in mBatch was queued
+    uint32 mMaxBatchSize;
+    Duration mBatchWindow;
+    bool mBatchFlushScheduled;
+
+    AvailableCallback mAvailableCallback;
 
     /* OSegLookupListener Interface */
     virtual void osegLookupCompleted(const UUID& id, const OSegEntry& dest);
     /* Main thread handler for lookups. */
     void handleLookupCompleted(const UUID& id, const OSegEntry& dest);
+
+    // Add a new lookup to the batch, issuing it if it's full
+    void queueLookup(const UUID& id);
+    void handleScheduledFlush();
+    // Hand the current batch to the OSeg
+    void flushBatch();
+    // Invoke the callbacks for all the messages waiting on a lookup
+    void completeLookups(const UUID& id, const OSegEntry& dest, ResolvedFrom resolved_from);
+    // Fail lookups which have been outstanding longer than the lookup timeout
+    void scheduleTimeoutCheck();
+    void handleTimeoutCheck();
+    void checkAvailable();
 public:
     /** Create an OSegLookupQueue which uses the specified ObjectSegmentation to resolve queries and
      *  the specified predicate to determine if new lookups are accepted.
+     *  \param ctx the SpaceContext, used for tracing
      *  \param net_strand the strand used for networking, i.e. the one which should handle lookup
      *                    results
      *  \param oseg the ObjectSegmentation which resolves queries
      */
-    OSegLookupQueue(Network::IOStrand* net_strand, ObjectSegmentation* oseg);
+    OSegLookupQueue(SpaceContext* ctx, Network::IOStrand* net_strand, ObjectSegmentation* oseg);
 
     virtual ~OSegLookupQueue() {}
 
@@ -120,6 +146,16 @@ public:
      *  \returns true if the lookup was accepted, false if it was rejected (due to the push predicate).
      */
     bool lookup(Sirikata::Protocol::Object::ObjectMessage* msg, const LookupCallback& cb);
+
+    /** Check whether the queue is full, i.e. whether lookups which miss the
+     *  cache will be rejected. If it is, the available callback will be
+     *  invoked once there's room again, so callers can hold on to messages
+     *  instead of having them dropped.
+     */
+    bool full();
+    void setAvailableCallback(const AvailableCallback& cb) {
+        mAvailableCallback = cb;
+    }
 };
 
 } // namespace Sirikata
@@ -0,0 +1,158 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_OSEG_LOOKUP_TABLE_HPP_
+#define _SIRIKATA_OSEG_LOOKUP_TABLE_HPP_
+
+#include <sirikata/core/util/Platform.hpp>
+#include <sirikata/core/util/UUID.hpp>
+#include <sirikata/core/util/Time.hpp>
+#include <deque>
+
+namespace Sirikata {
+
+/** Bookkeeping for the lookups an OSegLookupQueue is waiting on: the lookups
+ *  waiting on each object, the limits on how many objects and bytes may be
+ *  outstanding, when each object's lookup was started so ones the OSeg never
+ *  answers can be given up on, and whether somebody was told we're full and
+ *  is owed a notification once there's room again. It doesn't know anything
+ *  about the OSeg or strands, so it can be tested on its own. LookupType must
+ *  have a size member holding the bytes it accounts for. Not thread safe.
+ */
+template<typename LookupType>
+class OSegLookupTable {
+public:
+    typedef std::vector<LookupType> LookupList;
+
+    OSegLookupTable(uint32 max_lookups, uint32 max_bytes)
+     : mMaxLookups(max_lookups),
+       mMaxBytes(max_bytes),
+       mBytes(0),
+       mBlocked(false)
+    {}
+
+    // Number of objects being looked up
+    uint32 size() const { return mLookups.size(); }
+    bool empty() const { return mLookups.empty(); }
+    // Total bytes of all the lookups waiting
+    uint32 byteSize() const { return mBytes; }
+    bool contains(const UUID& id) const { return mLookups.find(id) != mLookups.end(); }
+    // Number of lookups waiting on an object
+    uint32 messages(const UUID& id) const {
+        typename LookupMap::const_iterator it = mLookups.find(id);
+        return (it == mLookups.end() ? 0 : it->second.lookups.size());
+    }
+
+    /** Check whether a lookup for a new object would be rejected. If it
+     *  would, available() will return true once there's room again.
+     */
+    bool full() {
+        if (!overLimits())
+            return false;
+        mBlocked = true;
+        return true;
+    }
+
+    /** Add a lookup for an object which is already being looked up. Returns
+     *  false, and like full() arranges for available() to report when
+     *  there's room, if it would put us over the byte limit.
+     */
+    bool append(const UUID& id, const LookupType& lu) {
+        typename LookupMap::iterator it = mLookups.find(id);
+        assert(it != mLookups.end());
+        if (mBytes + lu.size > mMaxBytes) {
+            mBlocked = true;
+            return false;
+        }
+        mBytes += lu.size;
+        it->second.lookups.push_back(lu);
+        return true;
+    }
+
+    /** Start looking up an object at time t. The caller should have checked
+     *  full() and that the object isn't already being looked up.
+     */
+    void start(const UUID& id, const LookupType& lu, const Time& t) {
+        assert(!contains(id));
+        Entry& entry = mLookups[id];
+        entry.started = t;
+        entry.lookups.push_back(lu);
+        mBytes += lu.size;
+        mStarted.push_back(StartedLookup(id, t));
+    }
+
+    /** Remove all the lookups waiting on an object, returning them in
+     *  lookups. Returns false if the object wasn't being looked up.
+     */
+    bool take(const UUID& id, LookupList* lookups) {
+        typename LookupMap::iterator it = mLookups.find(id);
+        if (it == mLookups.end())
+            return false;
+        lookups->clear();
+        lookups->swap(it->second.lookups);
+        for(uint32 i = 0; i < lookups->size(); i++)
+            mBytes -= (*lookups)[i].size;
+        mLookups.erase(it);
+        // Nothing left to expire
+        if (mLookups.empty())
+            mStarted.clear();
+        return true;
+    }
+
+    /** Get the objects whose lookups were started before the given time and
+     *  are still outstanding, oldest first. They're still in the table, so
+     *  they should be removed with take().
+     */
+    void expired(const Time& before, std::vector<UUID>* ids) {
+        ids->clear();
+        while(!mStarted.empty() && mStarted.front().second < before) {
+            const StartedLookup& started = mStarted.front();
+            // Skip lookups which have finished, including ones for objects
+            // which have since been looked up again
+            typename LookupMap::const_iterator it = mLookups.find(started.first);
+            if (it != mLookups.end() && it->second.started == started.second)
+                ids->push_back(started.first);
+            mStarted.pop_front();
+        }
+    }
+
+    /** Returns true, once, if full() returned true or a lookup was rejected
+     *  and there's now room again.
+     */
+    bool available() {
+        if (!mBlocked || overLimits())
+            return false;
+        mBlocked = false;
+        return true;
+    }
+
+private:
+    struct Entry {
+        Entry() : started(Time::null()) {}
+
+        Time started;
+        LookupList lookups;
+    };
+    typedef std::tr1::unordered_map<UUID, Entry, UUID::Hasher> LookupMap;
+    typedef std::pair<UUID, Time> StartedLookup;
+
+    bool overLimits() const {
+        return (mLookups.size() >= mMaxLookups || mBytes >= mMaxBytes);
+    }
+
+    const uint32 mMaxLookups;
+    const uint32 mMaxBytes;
+
+    LookupMap mLookups;
+    uint32 mBytes;
+    // Objects in the order their lookups were started, used to find ones
+    // which have been waiting too long
+    std::deque<StartedLookup> mStarted;
+    // Set when we've reported we're full, so we owe a notification
+    bool mBlocked;
+}; // class OSegLookupTable
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_OSEG_LOOKUP_TABLE_HPP_
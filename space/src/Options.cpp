@@ -63,6 +63,7 @@ void InitSpaceOptions() {
         .addOption(new OptionValue(SERVER_ODP_FLOW_SCHEDULER, "region", Sirikata::OptionValueType<String>(), "The type of ODPFlowScheduler to use for routing."))
         .addOption(new OptionValue(FORWARDER_RECEIVE_QUEUE_SIZE, "16384", Sirikata::OptionValueType<uint32>(), "The type of ODPFlowScheduler to use for routing."))
         .addOption(new OptionValue(FORWARDER_SEND_QUEUE_SIZE, "65536", Sirikata::OptionValueType<uint32>(), "The type of ODPFlowScheduler to use for routing."))
+        .addOption(new OptionValue(FORWARDER_ROUTE_THREADS, "0", Sirikata::OptionValueType<uint32>(), "Number of worker threads used to route messages which hit in the OSeg cache. Messages to the same object are still routed in order. 0 routes them on the thread they arrive on."))
 
         .addOption(new OptionValue(NETWORK_TYPE, "tcp", Sirikata::OptionValueType<String>(), "The networking subsystem to use."))
 
@@ -70,16 +71,21 @@ void InitSpaceOptions() {
         .addOption(new OptionValue(OSEG_OPTIONS,"",Sirikata::OptionValueType<String>(),"Specifies arguments to OSeg."))
 
         .addOption(new OptionValue(OSEG_LOOKUP_QUEUE_SIZE, "2000", Sirikata::OptionValueType<uint32>(), "Number of new lookups you can have on oseg lookup queue."))
+        .addOption(new OptionValue(OSEG_LOOKUP_QUEUE_BYTES, "8388608", Sirikata::OptionValueType<uint32>(), "Total size of messages which can be waiting for oseg lookups."))
+        .addOption(new OptionValue(OSEG_LOOKUP_BATCH_SIZE, "64", Sirikata::OptionValueType<uint32>(), "Maximum number of objects looked up in a single batch by the oseg lookup queue."))
+        .addOption(new OptionValue(OSEG_LOOKUP_BATCH_WINDOW, "0s", Sirikata::OptionValueType<Duration>(), "Longest time a new oseg lookup waits for its batch to fill up. With 0, lookups are batched with others made before the main strand gets back to them."))
+        .addOption(new OptionValue(OSEG_LOOKUP_TIMEOUT, "10s", Sirikata::OptionValueType<Duration>(), "How long to wait for the OSeg to answer a lookup before dropping the messages waiting on it."))
 
         .addOption(new OptionValue(OSEG_CACHE_SIZE, "200", Sirikata::OptionValueType<uint32>(), "Maximum number of entries in the OSeg cache."))
 
-        .addOption(new OptionValue(CACHE_SELECTOR,CACHE_TYPE_ORIGINAL_LRU,Sirikata::OptionValueType<String>(),"Which caching algorithm to use."))
+        .addOption(new OptionValue(CACHE_SELECTOR,CACHE_TYPE_ORIGINAL_LRU,Sirikata::OptionValueType<String>(),"Which caching algorithm to use: cache_originallru, cache_communication or cache_sharded."))
 
          .addOption(new OptionValue(CACHE_COMM_SCALING,"1.0",Sirikata::OptionValueType<double>(),"What the communication falloff function scaling factor is."))
          .addOption(new OptionValue("send-capacity-overestimate","80000",Sirikata::OptionValueType<double>(),"How much to overestimate send capacity when queue is not blocked."))
          .addOption(new OptionValue("receive-capacity-overestimate","1",Sirikata::OptionValueType<double>(),"How much to overestimate recv capacity when queue is not blocked."))
         .addOption(new OptionValue(OSEG_CACHE_CLEAN_GROUP_SIZE, "25", Sirikata::OptionValueType<uint32>(), "Number of items to remove from the OSeg cache when it reaches the maximum size."))
         .addOption(new OptionValue(OSEG_CACHE_ENTRY_LIFETIME, "8s", Sirikata::OptionValueType<Duration>(), "Maximum lifetime for an OSeg cache entry."))
+        .addOption(new OptionValue(OSEG_CACHE_SHARDS, "16", Sirikata::OptionValueType<uint32>(), "Number of independently locked shards in the sharded OSeg cache."))
 
         .addOption(new OptionValue(CSEG, "uniform", Sirikata::OptionValueType<String>(), "Type of Coordinate Segmentation implementation to use."))
         .addOption(new OptionValue("cseg-service-host", "meru00", Sirikata::OptionValueType<String>(), "Hostname of machine running the CSEG service (running with --cseg=distributed)"))
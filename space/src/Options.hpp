@@ -60,18 +60,25 @@
 #define OSEG_CACHE_SIZE              "oseg-cache-size"
 #define OSEG_CACHE_CLEAN_GROUP_SIZE  "oseg-cache-clean-group-size"
 #define OSEG_CACHE_ENTRY_LIFETIME    "oseg-cache-entry-lifetime"
+#define OSEG_CACHE_SHARDS            "oseg-cache-shards"
 
 #define CACHE_SELECTOR              "oseg-cache-selector"
 #define CACHE_TYPE_COMMUNICATION    "cache_communication"
 #define CACHE_TYPE_ORIGINAL_LRU     "cache_originallru"
+#define CACHE_TYPE_SHARDED          "cache_sharded"
 
 
 #define CACHE_COMM_SCALING          "oseg-cache-scaling"
 
 #define FORWARDER_SEND_QUEUE_SIZE "forwarder.send-queue-size"
 #define FORWARDER_RECEIVE_QUEUE_SIZE "forwarder.receive-queue-size"
+#define FORWARDER_ROUTE_THREADS "forwarder.route-threads"
 
 #define OSEG_LOOKUP_QUEUE_SIZE     "oseg_lookup_queue_size"
+#define OSEG_LOOKUP_QUEUE_BYTES    "oseg_lookup_queue_bytes"
+#define OSEG_LOOKUP_BATCH_SIZE     "oseg_lookup_batch_size"
+#define OSEG_LOOKUP_BATCH_WINDOW   "oseg_lookup_batch_window"
+#define OSEG_LOOKUP_TIMEOUT        "oseg_lookup_timeout"
 
 #define OPT_PROX                   "prox"
 #define OPT_PROX_OPTIONS           "prox-options"
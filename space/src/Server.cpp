@@ -94,7 +94,8 @@ Server::Server(SpaceContext* ctx, Authenticator* auth, Forwarder* forwarder, Loc
    mMigrationSendRunning(false),
    mShutdownRequested(false),
    mObjectHostConnectionManager(NULL),
-   mRouteObjectMessage(Sirikata::SizedResourceMonitor(GetOptionValue<size_t>("route-object-message-buffer"))),
+   mRouteObjectMessage(GetOptionValue<size_t>("route-object-message-buffer")),
+   mRouteObjectMessageScheduled(0),
    mTimeSeriesObjects(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".objects")
 {
     using std::tr1::placeholders::_1;
@@ -389,19 +390,13 @@ bool Server::onObjectHostMessageReceived(const ObjectHostConnectionID& conn_id,
     // 5. Otherwise, we're going to have to ship this to the main thread, either
     // for handling session messages, messages to the space, or to make a
     // routing decision.
-    bool hit_empty;
-    bool push_for_processing_success;
-    {
-        boost::lock_guard<boost::mutex> lock(mRouteObjectMessageMutex);
-        hit_empty = (mRouteObjectMessage.probablyEmpty());
-        push_for_processing_success = mRouteObjectMessage.push(ConnectionIDObjectMessagePair(conn_id,obj_msg),false);
-    }
+    bool push_for_processing_success = mRouteObjectMessage.push(ConnectionIDObjectMessagePair(conn_id,obj_msg));
     if (!push_for_processing_success) {
         TIMESTAMP(obj_msg, Trace::SPACE_DROPPED_AT_MAIN_STRAND_CROSSING);
         TRACE_DROP(SPACE_DROPPED_AT_MAIN_STRAND_CROSSING);
         delete obj_msg;
     } else {
-        if (hit_empty)
+        if (compare_and_swap(&mRouteObjectMessageScheduled, 0, 1))
             scheduleObjectHostMessageRouting();
     }
 
@@ -438,22 +433,24 @@ void Server::scheduleObjectHostMessageRouting() {
 void Server::handleObjectHostMessageRouting() {
 #define MAX_OH_MESSAGES_HANDLED 100
 
-    for(uint32 i = 0; i < MAX_OH_MESSAGES_HANDLED; i++)
-        if (!handleSingleObjectHostMessageRouting())
-            break;
+    ConnectionIDObjectMessagePair handled[MAX_OH_MESSAGES_HANDLED];
+    uint32 nhandled = mRouteObjectMessage.popBatch(handled, MAX_OH_MESSAGES_HANDLED);
+    for(uint32 i = 0; i < nhandled; i++)
+        handleSingleObjectHostMessageRouting(handled[i]);
 
-    {
-        boost::lock_guard<boost::mutex> lock(mRouteObjectMessageMutex);
-        if (!mRouteObjectMessage.probablyEmpty())
-            scheduleObjectHostMessageRouting();
+    if (!mRouteObjectMessage.probablyEmpty()) {
+        scheduleObjectHostMessageRouting();
+        return;
     }
+    // Clear the flag, then check again in case a message was pushed after we
+    // looked but saw the flag still set.
+    mRouteObjectMessageScheduled = 0;
+    memory_barrier();
+    if (!mRouteObjectMessage.probablyEmpty() && compare_and_swap(&mRouteObjectMessageScheduled, 0, 1))
+        scheduleObjectHostMessageRouting();
 }
 
-bool Server::handleSingleObjectHostMessageRouting() {
-    ConnectionIDObjectMessagePair front(ObjectHostConnectionID(),NULL);
-    if (!mRouteObjectMessage.pop(front))
-        return false;
-
+void Server::handleSingleObjectHostMessageRouting(const ConnectionIDObjectMessagePair& front) {
     UUID source_object = front.obj_msg->source_object();
 
     // OHDP (object host <-> space server communication) piggy backs on ODP
@@ -467,7 +464,7 @@ bool Server::handleSingleObjectHostMessageRouting() {
         UUID dest_object = front.obj_msg->dest_object();
         if (dest_object != ohdp_ID) {
             delete front.obj_msg;
-            return true;
+            return;
         }
 
         // We need to translate identifiers. The space identifiers are ignored
@@ -484,7 +481,7 @@ bool Server::handleSingleObjectHostMessageRouting() {
         );
         delete front.obj_msg;
 
-        return true;
+        return;
     }
 
     // If we don't have a connection for the source object, we can't do anything with it.
@@ -511,13 +508,13 @@ bool Server::handleSingleObjectHostMessageRouting() {
 
         delete front.obj_msg;
 
-        return true;
+        return;
     }
 
 
     // Finally, if we've passed all these tests, then everything looks good and we can route it
     mForwarder->routeObjectHostMessage(front.obj_msg);
-    return true;
+    return;
 }
 
 // Handle Session messages from an object
@@ -1100,15 +1097,27 @@ void Server::handleMigrationEvent(const UUID& obj_id) {
 
     if (mOSeg->clearToMigrate(obj_id)) //needs to check whether migration to this server has finished before can begin migrating to another server.
     {
-        ObjectConnection* obj_conn = mObjects[obj_id];
-
         Vector3f obj_pos = mLocationService->currentPosition(obj_id);
-        ServerID new_server_id = mCSeg->lookup(obj_pos);
+        // CSeg may need a round trip to its server, so the migration starts
+        // once the lookup completes
+        mCSeg->lookup(
+            obj_pos,
+            std::tr1::bind(&Server::handleMigrationLookup, this, obj_id, std::tr1::placeholders::_1)
+        );
+    }
+}
+
+void Server::handleMigrationLookup(const UUID& obj_id, ServerID new_server_id) {
+    // The object may have disconnected or started migrating while the lookup
+    // was outstanding
+    if (mObjects.find(obj_id) != mObjects.end() && mOSeg->clearToMigrate(obj_id))
+    {
+        ObjectConnection* obj_conn = mObjects[obj_id];
 
         // FIXME should be this
         //assert(new_server_id != mContext->id());
         // but I'm getting inconsistencies, so we have to just trust CSeg to have the final say
-        if (new_server_id != mContext->id()) {
+        if (new_server_id != NullServerID && new_server_id != mContext->id()) {
 
             SPACE_LOG(detailed,"Starting migration of " << obj_id.toString() << " from " << mContext->id() << " to " << new_server_id);
 
@@ -40,6 +40,7 @@
 #include <sirikata/space/ObjectHostConnectionManager.hpp>
 #include <sirikata/core/service/Service.hpp>
 #include <sirikata/core/queue/SizedThreadSafeQueue.hpp>
+#include <sirikata/core/queue/MPSCRing.hpp>
 
 #include <sirikata/core/util/MotionVector.hpp>
 #include <sirikata/core/util/AggregateBoundingInfo.hpp>
@@ -126,6 +127,8 @@ private:
 
     // Handle a migration event generated by the MigrationMonitor
     void handleMigrationEvent(const UUID& objid);
+    // Continues handleMigrationEvent once CSeg has found the destination
+    void handleMigrationLookup(const UUID& objid, ServerID new_server_id);
 
     // Starts the process of trying to send migration messages, or continues one if it's already running.
     void startSendMigrationMessages();
@@ -150,10 +153,11 @@ private:
     // Schedule main thread to handle oh message routing
     void scheduleObjectHostMessageRouting();
     void handleObjectHostMessageRouting();
-    // Perform forwarding for a message on the front of mRouteObjectMessage from the object host which
+    struct ConnectionIDObjectMessagePair;
+    // Perform forwarding for a message popped from mRouteObjectMessage from the object host which
     // couldn't be forwarded directly by the networking code
     // (i.e. needs routing to another node)
-    bool handleSingleObjectHostMessageRouting();
+    void handleSingleObjectHostMessageRouting(const ConnectionIDObjectMessagePair& front);
 
     // Handle Session messages from an object
     void handleSessionMessage(const ObjectHostConnectionID& oh_conn_id, Sirikata::Protocol::Object::ObjectMessage* msg);
@@ -276,19 +280,23 @@ private:
     struct ConnectionIDObjectMessagePair{
         ObjectHostConnectionID conn_id;
         Sirikata::Protocol::Object::ObjectMessage* obj_msg;
+        ConnectionIDObjectMessagePair()
+         : obj_msg(NULL)
+        {}
         ConnectionIDObjectMessagePair(ObjectHostConnectionID conn_id, Sirikata::Protocol::Object::ObjectMessage*msg) {
             this->conn_id=conn_id;
             this->obj_msg=msg;
         }
-        size_t size() const{
-            return 1;
-        }
     };
 
-    // FIXME Another place where needing a size queue and notifications causes
-    // double locking...
+    // Guards mDisconnectingObjects
     boost::mutex mRouteObjectMessageMutex;
-    Sirikata::SizedThreadSafeQueue<ConnectionIDObjectMessagePair>mRouteObjectMessage;
+    // Messages from the networking threads waiting for routing in the main
+    // strand. Only the main strand pops, so this can be a lock-free ring.
+    // mRouteObjectMessageScheduled is set while a handler is posted to drain
+    // it.
+    Sirikata::MPSCRing<ConnectionIDObjectMessagePair> mRouteObjectMessage;
+    volatile uint32 mRouteObjectMessageScheduled;
 
     // TimeSeries identifiers. Must include the ServerID for uniqueness, so we
     // cache them so TimeSeries reports are fast
@@ -50,6 +50,7 @@ public:
     UniformCoordinateSegmentation(SpaceContext* ctx, const BoundingBox3f& region, const Vector3ui32& perdim);
     virtual ~UniformCoordinateSegmentation();
 
+    using CoordinateSegmentation::lookup;
     virtual ServerID lookup(const Vector3f& pos) ;
     virtual BoundingBoxList serverRegion(const ServerID& server) ;
     virtual BoundingBox3f region() ;
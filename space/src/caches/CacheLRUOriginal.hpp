@@ -91,7 +91,7 @@ namespace Sirikata
     virtual ~CacheLRUOriginal();
 
     virtual void insert(const UUID& uuid, const OSegEntry& sID);
-    virtual const OSegEntry& get(const UUID& uuid);
+    virtual OSegEntry get(const UUID& uuid);
     virtual void remove(const UUID& uuid);
   };
 }
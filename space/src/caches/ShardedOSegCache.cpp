@@ -0,0 +1,65 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include "ShardedOSegCache.hpp"
+#include <boost/lexical_cast.hpp>
+
+#define SHARDEDOSEGCACHE_LOG(lvl,msg) SILOG(oseg_cache, lvl, msg)
+
+namespace Sirikata {
+
+ShardedOSegCache::ShardedOSegCache(SpaceContext* ctx, uint32 capacity, uint32 shards, const Duration& entry_lifetime)
+ : PollingService(ctx->mainStrand, "ShardedOSegCache Poll", Duration::seconds((int64)1), ctx, "Sharded OSeg Cache"),
+   mContext(ctx),
+   mCache(capacity, shards),
+   mEntryLifetime(entry_lifetime),
+   mTimeSeriesHitRateName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".oseg.cache_hit_rate"),
+   mTimeSeriesContendedName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".oseg.cache_contended"),
+   mTimeSeriesWaitName(String("space.server") + boost::lexical_cast<String>(ctx->id()) + ".oseg.cache_wait")
+{
+}
+
+ShardedOSegCache::~ShardedOSegCache() {
+    RecordCache::Stats stats = mCache.stats();
+    SHARDEDOSEGCACHE_LOG(debug, "hits: " << stats.hits << "  misses: " << stats.misses << "  evictions: " << stats.evictions << "  rejections: " << stats.rejections << "  contended: " << stats.contended);
+}
+
+void ShardedOSegCache::insert(const UUID& uuid, const OSegEntry& sID) {
+    mCache.insert(uuid, Record(sID, mContext->recentSimTime()));
+}
+
+OSegEntry ShardedOSegCache::get(const UUID& uuid) {
+    Record rec;
+    if (!mCache.get(uuid, &rec))
+        return OSegEntry::null();
+
+    if (mContext->recentSimTime() - rec.inserted > mEntryLifetime) {
+        mCache.remove(uuid);
+        return OSegEntry::null();
+    }
+    return rec.entry;
+}
+
+void ShardedOSegCache::remove(const UUID& uuid) {
+    mCache.remove(uuid);
+}
+
+void ShardedOSegCache::poll() {
+    RecordCache::Stats stats = mCache.stats();
+    uint64 hits = stats.hits - mLastStats.hits;
+    uint64 lookups = hits + (stats.misses - mLastStats.misses);
+    uint64 contended = stats.contended - mLastStats.contended;
+    uint64 wait_us = stats.waitMicroseconds - mLastStats.waitMicroseconds;
+    mLastStats = stats;
+    if (lookups == 0) return;
+
+    mContext->timeSeries->report(mTimeSeriesHitRateName, (float64)hits / lookups);
+    mContext->timeSeries->report(mTimeSeriesContendedName, (float64)contended / lookups);
+    // Average wait, in milliseconds, for operations which couldn't get a
+    // shard's lock right away
+    if (contended > 0)
+        mContext->timeSeries->report(mTimeSeriesWaitName, wait_us / 1000.0 / contended);
+}
+
+} // namespace Sirikata
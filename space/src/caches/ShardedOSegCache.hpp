@@ -0,0 +1,60 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#ifndef _SIRIKATA_SHARDED_OSEG_CACHE_HPP_
+#define _SIRIKATA_SHARDED_OSEG_CACHE_HPP_
+
+#include <sirikata/space/OSegCache.hpp>
+#include <sirikata/space/SpaceContext.hpp>
+#include <sirikata/core/service/PollingService.hpp>
+#include <sirikata/core/util/ShardedClockCache.hpp>
+
+namespace Sirikata {
+
+/** An OSegCache built for lookups from many threads at once. Entries are
+ *  spread over independently locked shards of a ShardedClockCache, which uses
+ *  CLOCK eviction with a TinyLFU admission filter, so a burst of lookups for
+ *  objects that are rarely used again doesn't push out the popular
+ *  destinations. Like CacheLRUOriginal, entries expire after a fixed lifetime.
+ *
+ *  Hit rate and lock contention are reported to the time series once a second.
+ */
+class ShardedOSegCache : public OSegCache, public PollingService {
+public:
+    ShardedOSegCache(SpaceContext* ctx, uint32 capacity, uint32 shards, const Duration& entry_lifetime);
+    virtual ~ShardedOSegCache();
+
+    virtual void insert(const UUID& uuid, const OSegEntry& sID);
+    virtual OSegEntry get(const UUID& uuid);
+    virtual void remove(const UUID& uuid);
+
+private:
+    struct Record {
+        Record() : entry(OSegEntry::null()), inserted(Time::null()) {}
+        Record(const OSegEntry& _entry, const Time& _inserted)
+         : entry(_entry), inserted(_inserted)
+        {}
+
+        OSegEntry entry;
+        Time inserted;
+    };
+    typedef ShardedClockCache<UUID, Record, UUID::Hasher> RecordCache;
+
+    // PollingService Interface
+    virtual void poll();
+
+    SpaceContext* mContext;
+    RecordCache mCache;
+    Duration mEntryLifetime;
+    // Totals as of the last poll, to report changes since then
+    RecordCache::Stats mLastStats;
+
+    const String mTimeSeriesHitRateName;
+    const String mTimeSeriesContendedName;
+    const String mTimeSeriesWaitName;
+}; // class ShardedOSegCache
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_SHARDED_OSEG_CACHE_HPP_
@@ -66,6 +66,7 @@
 #include <sirikata/space/ObjectSegmentation.hpp>
 #include "caches/CommunicationCache.hpp"
 #include "caches/CacheLRUOriginal.hpp"
+#include "caches/ShardedOSegCache.hpp"
 
 #include <sirikata/space/SpaceContext.hpp>
 #include <sirikata/mesh/Filter.hpp>
@@ -191,6 +192,16 @@ int main(int argc, char** argv) {
         commander = Command::CommanderFactory::getSingleton().getConstructor(commander_type)(space_context, commander_options);
 
     Transfer::TransferMediator::getSingleton().registerContext(space_context);
+    if (commander) {
+        commander->registerCommand(
+            "space.sst.stats",
+            std::tr1::bind(&ODPSST::ConnectionManager::commandConnectionStats, sstConnMgr, std::tr1::placeholders::_1, std::tr1::placeholders::_2, std::tr1::placeholders::_3)
+        );
+        commander->registerCommand(
+            "space.ohsst.stats",
+            std::tr1::bind(&OHDPSST::ConnectionManager::commandConnectionStats, ohSstConnMgr, std::tr1::placeholders::_1, std::tr1::placeholders::_2, std::tr1::placeholders::_3)
+        );
+    }
 
 
     Sirikata::SpaceNetwork* gNetwork = NULL;
@@ -269,6 +280,8 @@ int main(int argc, char** argv) {
 
     // OSeg Cache
     OSegCache* oseg_cache = NULL;
+    // Set if the cache needs to be started and stopped with the other services
+    Service* oseg_cache_service = NULL;
     std::string cacheSelector = GetOptionValue<String>(CACHE_SELECTOR);
     uint32 cacheSize = GetOptionValue<uint32>(OSEG_CACHE_SIZE);
     if (cacheSelector == CACHE_TYPE_COMMUNICATION) {
@@ -280,6 +293,13 @@ int main(int argc, char** argv) {
         Duration entryLifetime = GetOptionValue<Duration>(OSEG_CACHE_ENTRY_LIFETIME);
         oseg_cache = new CacheLRUOriginal(space_context, cacheSize, cacheCleanGroupSize, entryLifetime);
     }
+    else if (cacheSelector == CACHE_TYPE_SHARDED) {
+        uint32 cacheShards = GetOptionValue<uint32>(OSEG_CACHE_SHARDS);
+        Duration entryLifetime = GetOptionValue<Duration>(OSEG_CACHE_ENTRY_LIFETIME);
+        ShardedOSegCache* sharded_cache = new ShardedOSegCache(space_context, cacheSize, cacheShards, entryLifetime);
+        oseg_cache_service = sharded_cache;
+        oseg_cache = sharded_cache;
+    }
     else {
         std::cout<<"\n\nUNKNOWN CACHE TYPE SELECTED.  Please re-try.\n\n";
         std::cout.flush();
@@ -371,6 +391,8 @@ int main(int argc, char** argv) {
     space_context->add(cseg);
     space_context->add(loc_service);
     space_context->add(oseg);
+    if (oseg_cache_service != NULL)
+        space_context->add(oseg_cache_service);
     space_context->add(loadMonitor);
     space_context->add(sstConnMgr);
     space_context->add(ohSstConnMgr);
@@ -0,0 +1,190 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include "../../../analysis/src/ParallelAnalysis.hpp"
+#include <boost/thread/mutex.hpp>
+
+class ParallelAnalysisTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::uint32 uint32;
+    typedef Sirikata::uint64 uint64;
+
+    struct Record {
+        Record(uint64 _uid, uint32 _run, uint32 _seq) : uid(_uid), run(_run), seq(_seq) {}
+
+        uint64 uid;
+        uint32 run;
+        uint32 seq;
+    };
+    typedef Sirikata::SortMergeJoin<Record> Join;
+
+    // Groups handed to the join callback, collected per partition and then
+    // combined once the join finishes
+    std::vector<std::vector<Join::Group> > mGroups;
+    boost::mutex mMutex;
+    std::vector<uint32> mTasks;
+
+    void collectGroup(uint32 partition, const Join::Group& group) {
+        TS_ASSERT(partition < mGroups.size());
+        if (partition >= mGroups.size()) return;
+        mGroups[partition].push_back(group);
+    }
+    // Runs the join and returns every group it produced ordered by uid
+    std::vector<Join::Group> runJoin(Join& join) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+
+        mGroups.clear();
+        mGroups.resize(join.numPartitions());
+        join.sort();
+        join.join(std::tr1::bind(&ParallelAnalysisTest::collectGroup, this, _1, _2));
+
+        std::vector<Join::Group> all;
+        for(uint32 p = 0; p < mGroups.size(); p++)
+            all.insert(all.end(), mGroups[p].begin(), mGroups[p].end());
+        std::sort(all.begin(), all.end(), GroupLess());
+        return all;
+    }
+    struct GroupLess {
+        bool operator()(const Join::Group& lhs, const Join::Group& rhs) const {
+            return lhs[0].uid < rhs[0].uid;
+        }
+    };
+
+    void recordTask(uint32 idx) {
+        boost::lock_guard<boost::mutex> lck(mMutex);
+        mTasks.push_back(idx);
+    }
+    std::vector<uint32> runParallelFor(uint32 count, uint32 nthreads) {
+        using std::tr1::placeholders::_1;
+        mTasks.clear();
+        Sirikata::ParallelFor(count, std::tr1::bind(&ParallelAnalysisTest::recordTask, this, _1), nthreads);
+        std::sort(mTasks.begin(), mTasks.end());
+        return mTasks;
+    }
+
+public:
+    void testParallelForEmpty() {
+        TS_ASSERT(runParallelFor(0, 4).empty());
+        TS_ASSERT(runParallelFor(0, 1).empty());
+    }
+
+    void testParallelForRunsEachTaskOnce() {
+        uint32 nthreads[] = { 1, 3, 8 };
+        for(uint32 t = 0; t < 3; t++) {
+            std::vector<uint32> tasks = runParallelFor(100, nthreads[t]);
+            TS_ASSERT_EQUALS(tasks.size(), (size_t)100);
+            for(uint32 i = 0; i < tasks.size(); i++)
+                TS_ASSERT_EQUALS(tasks[i], i);
+        }
+    }
+
+    void testParallelForMoreThreadsThanTasks() {
+        std::vector<uint32> tasks = runParallelFor(3, 16);
+        TS_ASSERT_EQUALS(tasks.size(), (size_t)3);
+        for(uint32 i = 0; i < tasks.size(); i++)
+            TS_ASSERT_EQUALS(tasks[i], i);
+    }
+
+    void testJoinEmpty() {
+        // No runs at all
+        Join none(0, 4);
+        TS_ASSERT(runJoin(none).empty());
+
+        // Runs with no records
+        Join empty(3, 4);
+        TS_ASSERT(runJoin(empty).empty());
+
+        // Only some runs with records
+        Join some(3, 4);
+        some.run(1).push_back(Record(5, 1, 0));
+        std::vector<Join::Group> groups = runJoin(some);
+        TS_ASSERT_EQUALS(groups.size(), (size_t)1);
+        TS_ASSERT_EQUALS(groups[0].size(), (size_t)1);
+        TS_ASSERT_EQUALS(groups[0][0].uid, (uint64)5);
+    }
+
+    void testJoinDuplicateKeys() {
+        Join join(3, 4);
+        // The same uid several times within a run and across runs, added out
+        // of order
+        join.run(0).push_back(Record(7, 0, 0));
+        join.run(0).push_back(Record(3, 0, 1));
+        join.run(0).push_back(Record(7, 0, 2));
+        join.run(1).push_back(Record(7, 1, 0));
+        join.run(2).push_back(Record(3, 2, 0));
+        join.run(2).push_back(Record(7, 2, 1));
+        join.run(2).push_back(Record(7, 2, 2));
+
+        std::vector<Join::Group> groups = runJoin(join);
+        TS_ASSERT_EQUALS(groups.size(), (size_t)2);
+        if (groups.size() != 2) return;
+
+        TS_ASSERT_EQUALS(groups[0].size(), (size_t)2);
+        TS_ASSERT_EQUALS(groups[1].size(), (size_t)5);
+
+        // Ordered by run, then by the order they were added
+        uint32 runs[] = { 0, 0, 1, 2, 2 };
+        uint32 seqs[] = { 0, 2, 0, 1, 2 };
+        for(uint32 i = 0; i < groups[1].size(); i++) {
+            TS_ASSERT_EQUALS(groups[1][i].uid, (uint64)7);
+            TS_ASSERT_EQUALS(groups[1][i].run, runs[i]);
+            TS_ASSERT_EQUALS(groups[1][i].seq, seqs[i]);
+        }
+    }
+
+    void testJoinManyPartitions() {
+        // Enough distinct and repeated uids that they're split over many
+        // partitions. Each uid should still come out as exactly one group.
+        const uint32 nruns = 5, nuids = 2000;
+        Join join(nruns, 8);
+        for(uint32 r = 0; r < nruns; r++)
+            for(uint32 u = 0; u < nuids; u++)
+                if ((u + r) % 3 != 0)
+                    join.run(r).push_back(Record(nuids - u, r, u));
+
+        std::vector<Join::Group> groups = runJoin(join);
+        TS_ASSERT_EQUALS(groups.size(), (size_t)nuids);
+        for(uint32 g = 0; g < groups.size(); g++) {
+            uint64 uid = groups[g][0].uid;
+            TS_ASSERT_EQUALS(uid, (uint64)(g + 1));
+            uint32 expected = 0;
+            for(uint32 r = 0; r < nruns; r++)
+                if ((nuids - uid + r) % 3 != 0) expected++;
+            TS_ASSERT_EQUALS(groups[g].size(), (size_t)expected);
+            for(uint32 i = 0; i < groups[g].size(); i++)
+                TS_ASSERT_EQUALS(groups[g][i].uid, uid);
+        }
+    }
+
+    void testJoinMoreThreadsThanRecords() {
+        Join join(2, 16);
+        join.run(0).push_back(Record(2, 0, 0));
+        join.run(1).push_back(Record(1, 1, 0));
+        join.run(1).push_back(Record(2, 1, 1));
+
+        std::vector<Join::Group> groups = runJoin(join);
+        TS_ASSERT_EQUALS(groups.size(), (size_t)2);
+        if (groups.size() != 2) return;
+        TS_ASSERT_EQUALS(groups[0].size(), (size_t)1);
+        TS_ASSERT_EQUALS(groups[1].size(), (size_t)2);
+    }
+
+    void testJoinClearAndReuse() {
+        Join join(2, 4);
+        join.run(0).push_back(Record(1, 0, 0));
+        join.run(1).push_back(Record(1, 1, 0));
+        TS_ASSERT_EQUALS(runJoin(join).size(), (size_t)1);
+
+        join.clear();
+        TS_ASSERT(join.run(0).empty());
+        TS_ASSERT(join.run(1).empty());
+        join.run(1).push_back(Record(4, 1, 0));
+        std::vector<Join::Group> groups = runJoin(join);
+        TS_ASSERT_EQUALS(groups.size(), (size_t)1);
+        if (groups.size() != 1) return;
+        TS_ASSERT_EQUALS(groups[0][0].uid, (uint64)4);
+    }
+};
@@ -0,0 +1,135 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/util/Base64.hpp>
+
+class Base64Test : public CxxTest::TestSuite
+{
+    typedef Sirikata::String String;
+    typedef Sirikata::uint8 uint8;
+
+    // Encode with the raw buffer interface
+    String encodeRaw(const String& orig, Sirikata::Base64::Alphabet alphabet, bool pad) {
+        String result(Sirikata::Base64::encodedLength(orig.size(), pad) + 1, '\0');
+        size_t len = Sirikata::Base64::encode((uint8*)&result[0], (const uint8*)orig.data(), orig.size(), alphabet, pad);
+        TS_ASSERT_EQUALS(len, Sirikata::Base64::encodedLength(orig.size(), pad));
+        result.resize(len);
+        return result;
+    }
+    // Decode with the raw buffer interface, returning false if it fails
+    bool decodeRaw(const String& encoded, String* result) {
+        result->assign(Sirikata::Base64::decodedLength(encoded.size()) + 1, '\0');
+        size_t len = 0;
+        if (!Sirikata::Base64::decode((uint8*)&(*result)[0], &len, (const uint8*)encoded.data(), encoded.size()))
+            return false;
+        TS_ASSERT(len <= Sirikata::Base64::decodedLength(encoded.size()));
+        result->resize(len);
+        return true;
+    }
+
+public:
+    void testKnownValues() {
+        // RFC 4648 test vectors
+        const char* plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+        const char* padded[] = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+        const char* unpadded[] = { "", "Zg", "Zm8", "Zm9v", "Zm9vYg", "Zm9vYmE", "Zm9vYmFy" };
+        for(int i = 0; i < 7; i++) {
+            TS_ASSERT_EQUALS(Sirikata::Base64::encode(String(plain[i]), true), String(padded[i]));
+            TS_ASSERT_EQUALS(Sirikata::Base64::encode(String(plain[i]), false), String(unpadded[i]));
+        }
+    }
+
+    void testRoundTripLengths() {
+        // Every remainder, including inputs with no full group, for every
+        // combination of alphabet and padding
+        for(int len = 0; len <= 5; len++) {
+            String orig;
+            for(int i = 0; i < len; i++)
+                orig.push_back((char)(0xF0 + i*3));
+            for(int alphabet = 0; alphabet < 2; alphabet++) {
+                for(int pad = 0; pad < 2; pad++) {
+                    String encoded = encodeRaw(orig, (Sirikata::Base64::Alphabet)alphabet, pad != 0);
+                    String decoded;
+                    TS_ASSERT(decodeRaw(encoded, &decoded));
+                    TS_ASSERT_EQUALS(decoded, orig);
+                }
+            }
+        }
+    }
+
+    void testAlphabets() {
+        // 0xFB 0xFF encodes to characters 62 and 63, the only ones which
+        // differ between the alphabets
+        String orig("\xFB\xFF\xBF", 3);
+        TS_ASSERT_EQUALS(encodeRaw(orig, Sirikata::Base64::StandardAlphabet, true), String("+/+/"));
+        TS_ASSERT_EQUALS(encodeRaw(orig, Sirikata::Base64::URLSafeAlphabet, true), String("-_-_"));
+
+        // Decoding accepts either
+        String decoded;
+        TS_ASSERT(decodeRaw("+/+/", &decoded));
+        TS_ASSERT_EQUALS(decoded, orig);
+        TS_ASSERT(decodeRaw("-_-_", &decoded));
+        TS_ASSERT_EQUALS(decoded, orig);
+        TS_ASSERT(decodeRaw("+_-/", &decoded));
+        TS_ASSERT_EQUALS(decoded, orig);
+    }
+
+    void testDecodePadding() {
+        String decoded;
+        TS_ASSERT(decodeRaw("Zm9vYg==", &decoded));
+        TS_ASSERT_EQUALS(decoded, String("foob"));
+        TS_ASSERT(decodeRaw("Zm9vYg", &decoded));
+        TS_ASSERT_EQUALS(decoded, String("foob"));
+        TS_ASSERT(decodeRaw("Zm9vYmE=", &decoded));
+        TS_ASSERT_EQUALS(decoded, String("fooba"));
+        TS_ASSERT(decodeRaw("Zm9vYmE", &decoded));
+        TS_ASSERT_EQUALS(decoded, String("fooba"));
+        // Decoding stops at the first '='
+        TS_ASSERT(decodeRaw("Zg==Zm9v", &decoded));
+        TS_ASSERT_EQUALS(decoded, String("f"));
+    }
+
+    void testDecodeInvalid() {
+        String decoded;
+        // In a full group
+        TS_ASSERT(!decodeRaw("Zm9v*m9v", &decoded));
+        // In the last, partial group
+        TS_ASSERT(!decodeRaw("Zm9vY!", &decoded));
+        TS_ASSERT(!decodeRaw("Zm9v Yg", &decoded));
+        TS_ASSERT(!decodeRaw(String("Zm\0v", 4), &decoded));
+    }
+
+    void testDecodeSingleTrailingChar() {
+        // One leftover character only carries 6 bits, which isn't a byte
+        String decoded;
+        TS_ASSERT(!decodeRaw("Z", &decoded));
+        TS_ASSERT(!decodeRaw("Zm9vY", &decoded));
+        TS_ASSERT(!decodeRaw("Zm9vY=", &decoded));
+    }
+
+    void testLengths() {
+        size_t padded[] = { 0, 4, 4, 4, 8, 8, 8 };
+        size_t unpadded[] = { 0, 2, 3, 4, 6, 7, 8 };
+        for(size_t len = 0; len < 7; len++) {
+            TS_ASSERT_EQUALS(Sirikata::Base64::encodedLength(len, true), padded[len]);
+            TS_ASSERT_EQUALS(Sirikata::Base64::encodedLength(len, false), unpadded[len]);
+        }
+        // decodedLength is an upper bound for both padded and unpadded input
+        for(size_t len = 0; len < 7; len++) {
+            TS_ASSERT(Sirikata::Base64::decodedLength(padded[len]) >= len);
+            TS_ASSERT(Sirikata::Base64::decodedLength(unpadded[len]) >= len);
+        }
+    }
+
+    void testEncodeURL() {
+        // Data URIs and scripts depend on this exact output, which has always
+        // been padded with plain '='
+        TS_ASSERT_EQUALS(Sirikata::Base64::encodeURL(String("")), String(""));
+        TS_ASSERT_EQUALS(Sirikata::Base64::encodeURL(String("f")), String("Zg=="));
+        TS_ASSERT_EQUALS(Sirikata::Base64::encodeURL(String("fo")), String("Zm8="));
+        TS_ASSERT_EQUALS(Sirikata::Base64::encodeURL(String("foo")), String("Zm9v"));
+        TS_ASSERT_EQUALS(Sirikata::Base64::encodeURL(String("foob")), String("Zm9vYg=="));
+    }
+};
@@ -0,0 +1,104 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/queue/MPSCRing.hpp>
+#include <sirikata/core/util/Thread.hpp>
+
+using namespace Sirikata;
+
+class MPSCRingTest : public CxxTest::TestSuite
+{
+    typedef MPSCRing<uint32> Ring;
+
+    enum {
+        NumProducers = 4,
+        ItemsPerProducer = 100000
+    };
+
+    // Values are the producer index in the top byte and a sequence number in
+    // the rest. Full rings are retried, so nothing is lost.
+    static void produce(Ring* ring, uint32 producer) {
+        for(uint32 i = 0; i < ItemsPerProducer; i++) {
+            uint32 val = (producer << 24) | i;
+            while(!ring->push(val))
+                Thread::yield();
+        }
+    }
+
+public:
+    void testCapacity() {
+        Ring ring(5);
+        TS_ASSERT_EQUALS(ring.capacity(), 8);
+        TS_ASSERT(ring.probablyEmpty());
+
+        for(uint32 i = 0; i < 8; i++)
+            TS_ASSERT(ring.push(i));
+        TS_ASSERT(!ring.push(8));
+        TS_ASSERT_EQUALS(ring.probableSize(), 8);
+
+        uint32 val;
+        TS_ASSERT(ring.pop(val));
+        TS_ASSERT_EQUALS(val, 0);
+        // Freed slot can be reused
+        TS_ASSERT(ring.push(8));
+        TS_ASSERT(!ring.push(9));
+    }
+
+    void testWrapAround() {
+        Ring ring(4);
+        uint32 next_push = 0, next_pop = 0;
+        uint32 batch[3];
+        // Enough rounds to go around the ring many times with the head and
+        // tail at different offsets
+        for(uint32 round = 0; round < 100; round++) {
+            while(ring.push(next_push))
+                next_push++;
+            uint32 popped = ring.popBatch(batch, 3);
+            TS_ASSERT_EQUALS(popped, 3);
+            for(uint32 i = 0; i < popped; i++)
+                TS_ASSERT_EQUALS(batch[i], next_pop++);
+        }
+        uint32 val;
+        while(ring.pop(val))
+            TS_ASSERT_EQUALS(val, next_pop++);
+        TS_ASSERT_EQUALS(next_pop, next_push);
+        TS_ASSERT(ring.probablyEmpty());
+    }
+
+    void testMultipleProducers() {
+        Ring ring(64);
+        std::vector<Thread*> producers;
+        for(uint32 p = 0; p < NumProducers; p++)
+            producers.push_back(new Thread("MPSCRingTest Producer", std::tr1::bind(&MPSCRingTest::produce, &ring, p)));
+
+        // Each producer's values must come out in the order it pushed them
+        std::vector<uint32> next(NumProducers, 0);
+        uint32 total = 0;
+        uint32 batch[16];
+        while(total < NumProducers * ItemsPerProducer) {
+            uint32 popped = ring.popBatch(batch, 16);
+            if (popped == 0) {
+                Thread::yield();
+                continue;
+            }
+            for(uint32 i = 0; i < popped; i++) {
+                uint32 producer = batch[i] >> 24;
+                uint32 seq = batch[i] & 0xFFFFFF;
+                TS_ASSERT(producer < NumProducers);
+                if (producer >= NumProducers) continue;
+                TS_ASSERT_EQUALS(seq, next[producer]);
+                next[producer] = seq + 1;
+            }
+            total += popped;
+        }
+
+        for(uint32 p = 0; p < NumProducers; p++) {
+            producers[p]->join();
+            delete producers[p];
+            TS_ASSERT_EQUALS(next[p], (uint32)ItemsPerProducer);
+        }
+        TS_ASSERT(ring.probablyEmpty());
+    }
+};
@@ -61,7 +61,8 @@ public:
     Service(Context* ctx)
      : mContext(ctx),
        mDelay(Duration::zero()),
-       mDropRate(0)
+       mDropRate(0),
+       mMaxOutstandingPackets(0)
     {}
 
     // src, src port, dst, dst port, data*, data size
@@ -0,0 +1,69 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/network/SSTImpl.hpp>
+
+class SSTAckWindowTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::SST::ReceivedSequenceWindow ReceivedSequenceWindow;
+    typedef Sirikata::uint32 uint32;
+    typedef Sirikata::uint64 uint64;
+public:
+
+    void testEmpty() {
+        ReceivedSequenceWindow w;
+        TS_ASSERT(!w.contains(0));
+        TS_ASSERT(!w.contains(1));
+        // The acked sequence number is always part of the range
+        TS_ASSERT_EQUALS(w.ackCount(1), (uint32)1);
+    }
+
+    void testContiguous() {
+        ReceivedSequenceWindow w;
+        for(uint64 i = 1; i <= 10; i++)
+            w.insert(i);
+        TS_ASSERT_EQUALS(w.ackCount(10), (uint32)10);
+        TS_ASSERT_EQUALS(w.ackCount(5), (uint32)5);
+        TS_ASSERT_EQUALS(w.ackCount(11), (uint32)11);
+    }
+
+    void testGap() {
+        ReceivedSequenceWindow w;
+        for(uint64 i = 1; i <= 10; i++)
+            if (i != 7) w.insert(i);
+        TS_ASSERT(!w.contains(7));
+        TS_ASSERT_EQUALS(w.ackCount(10), (uint32)3);
+        TS_ASSERT_EQUALS(w.ackCount(6), (uint32)6);
+        // Filling the hole extends the range
+        w.insert(7);
+        TS_ASSERT_EQUALS(w.ackCount(10), (uint32)10);
+    }
+
+    void testOutOfOrder() {
+        ReceivedSequenceWindow w;
+        uint64 order[] = { 3, 1, 5, 2, 4 };
+        for(uint32 i = 0; i < 5; i++)
+            w.insert(order[i]);
+        for(uint64 i = 1; i <= 5; i++)
+            TS_ASSERT(w.contains(i));
+        TS_ASSERT_EQUALS(w.ackCount(5), (uint32)5);
+        // Duplicates don't change anything
+        w.insert(3);
+        TS_ASSERT_EQUALS(w.ackCount(5), (uint32)5);
+    }
+
+    void testLimit() {
+        ReceivedSequenceWindow w;
+        for(uint64 i = 1; i <= 200; i++)
+            w.insert(i);
+        TS_ASSERT_EQUALS(w.ackCount(200), (uint32)ReceivedSequenceWindow::MAX_RANGE);
+        // Anything older than the window is forgotten
+        TS_ASSERT(!w.contains(200 - ReceivedSequenceWindow::MAX_RANGE - 1));
+        // Jumps further than the window forget everything before
+        w.insert(300);
+        TS_ASSERT(!w.contains(200));
+        TS_ASSERT_EQUALS(w.ackCount(300), (uint32)1);
+    }
+};
@@ -0,0 +1,60 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/network/SSTBufferPool.hpp>
+
+class SSTBufferPoolTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::SST::BufferPool BufferPool;
+    typedef Sirikata::SST::BufferSlice BufferSlice;
+public:
+
+    void testCopy() {
+        BufferPool pool;
+        BufferSlice s = pool.copy("payload", 7);
+        TS_ASSERT_EQUALS(s.size(), 7);
+        TS_ASSERT_EQUALS(memcmp(s.data(), "payload", 7), 0);
+    }
+
+    void testSubslicesShareData() {
+        BufferPool pool;
+        BufferSlice s = pool.copy("payload", 7);
+        BufferSlice sub = s.slice(3, 4);
+        TS_ASSERT_EQUALS(sub.size(), 4);
+        TS_ASSERT_EQUALS(sub.data(), s.data() + 3);
+
+        // Dropping the original keeps the block alive for the subslice
+        s = BufferSlice();
+        TS_ASSERT_EQUALS(memcmp(sub.data(), "load", 4), 0);
+    }
+
+    void testBlocksAreReused() {
+        BufferPool pool;
+        for(int i = 0; i < 10000; i++) {
+            BufferSlice s = pool.allocate(1000);
+            TS_ASSERT(s.data() != NULL);
+        }
+        // Everything was released immediately, so a single slab suffices
+        TS_ASSERT_EQUALS(pool.stats().slabs, 1);
+        TS_ASSERT_EQUALS(pool.stats().allocations, 10000);
+    }
+
+    void testOversizedFallsBackToHeap() {
+        BufferPool pool;
+        BufferSlice s = pool.allocate(1024*1024);
+        TS_ASSERT_EQUALS(s.size(), 1024*1024);
+        TS_ASSERT_EQUALS(pool.stats().heapAllocations, 1);
+        TS_ASSERT_EQUALS(pool.stats().slabs, 0);
+    }
+
+    void testSliceOutlivesPool() {
+        BufferSlice s;
+        {
+            BufferPool pool;
+            s = pool.copy("payload", 7);
+        }
+        TS_ASSERT_EQUALS(memcmp(s.data(), "payload", 7), 0);
+    }
+};
@@ -0,0 +1,79 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/network/SSTCongestionControl.hpp>
+
+class SSTCongestionControlTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::SST::CongestionController CongestionController;
+    typedef Sirikata::Duration Duration;
+public:
+
+    void testCreate() {
+        const char* names[] = { "reno", "cubic", "delay" };
+        for(int i = 0; i < 3; i++) {
+            CongestionController* cc = CongestionController::create(names[i]);
+            TS_ASSERT(cc != NULL);
+            if (cc == NULL) continue;
+            TS_ASSERT_EQUALS(Sirikata::String(cc->name()), Sirikata::String(names[i]));
+            TS_ASSERT_EQUALS(cc->cwnd(), (Sirikata::uint32)SST_BASE_CWND);
+            delete cc;
+        }
+        TS_ASSERT(CongestionController::create("bogus") == NULL);
+    }
+
+    void testRenoSlowStart() {
+        CongestionController* cc = CongestionController::create("reno");
+        cc->onAck(10, Duration::milliseconds(10));
+        TS_ASSERT_EQUALS(cc->cwnd(), (Sirikata::uint32)SST_BASE_CWND + 10);
+        delete cc;
+    }
+
+    void testRenoFastRetransmitHalves() {
+        CongestionController* cc = CongestionController::create("reno");
+        cc->onAck(90, Duration::milliseconds(10));
+        TS_ASSERT_EQUALS(cc->cwnd(), 100);
+        cc->onFastRetransmit();
+        TS_ASSERT_EQUALS(cc->cwnd(), 50);
+        TS_ASSERT_EQUALS(cc->ssthresh(), 50);
+        delete cc;
+    }
+
+    void testCubicBacksOffLessThanReno() {
+        CongestionController* cc = CongestionController::create("cubic");
+        cc->onAck(90, Duration::milliseconds(10));
+        TS_ASSERT_EQUALS(cc->cwnd(), 100);
+        cc->onFastRetransmit();
+        TS_ASSERT_EQUALS(cc->cwnd(), 70);
+        // And grows back after that
+        cc->onAck(200, Duration::milliseconds(10));
+        TS_ASSERT(cc->cwnd() > 70);
+        delete cc;
+    }
+
+    void testTimeoutResets() {
+        const char* names[] = { "cubic", "delay" };
+        for(int i = 0; i < 2; i++) {
+            CongestionController* cc = CongestionController::create(names[i]);
+            cc->onAck(90, Duration::milliseconds(10));
+            cc->onTimeout();
+            TS_ASSERT_EQUALS(cc->cwnd(), (Sirikata::uint32)SST_BASE_CWND);
+            delete cc;
+        }
+    }
+
+    void testDelayBacksOffWhenQueuing() {
+        CongestionController* cc = CongestionController::create("delay");
+        // Grow with a steady RTT
+        for(int i = 0; i < 3; i++)
+            cc->onAck(cc->cwnd(), Duration::milliseconds(10));
+        Sirikata::uint32 steady = cc->cwnd();
+        // RTT doubling means about half the window is sitting in queues
+        for(int i = 0; i < 5; i++)
+            cc->onAck(cc->cwnd(), Duration::milliseconds(20));
+        TS_ASSERT(cc->cwnd() < steady);
+        delete cc;
+    }
+};
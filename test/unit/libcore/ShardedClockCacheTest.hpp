@@ -0,0 +1,124 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/util/ShardedClockCache.hpp>
+#include <sirikata/core/util/Thread.hpp>
+
+class ShardedClockCacheTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::uint32 uint32;
+    typedef Sirikata::ShardedClockCache<uint32, uint32> IntCache;
+
+    static void hammer(IntCache* cache, uint32 first, uint32* found_out) {
+        uint32 found = 0;
+        for(uint32 round = 0; round < 100; round++) {
+            for(uint32 i = first; i < first + 100; i++) {
+                uint32 val;
+                if (cache->get(i, &val)) {
+                    TS_ASSERT_EQUALS(val, i * 2);
+                    found++;
+                }
+                else {
+                    cache->insert(i, i * 2);
+                }
+            }
+        }
+        *found_out = found;
+    }
+
+public:
+    void testInsertGetRemove() {
+        IntCache cache(100, 4);
+        TS_ASSERT_EQUALS(cache.numShards(), 4);
+        uint32 val = 0;
+        TS_ASSERT(!cache.get(1, &val));
+
+        TS_ASSERT(cache.insert(1, 10));
+        TS_ASSERT(cache.get(1, &val));
+        TS_ASSERT_EQUALS(val, 10);
+
+        TS_ASSERT(cache.insert(1, 11));
+        TS_ASSERT(cache.get(1, &val));
+        TS_ASSERT_EQUALS(val, 11);
+
+        TS_ASSERT(cache.remove(1));
+        TS_ASSERT(!cache.remove(1));
+        TS_ASSERT(!cache.get(1, &val));
+
+        IntCache::Stats stats = cache.stats();
+        TS_ASSERT_EQUALS(stats.hits, 2);
+        TS_ASSERT_EQUALS(stats.misses, 2);
+        TS_ASSERT_EQUALS(stats.inserts, 1);
+        TS_ASSERT_EQUALS(stats.updates, 1);
+    }
+
+    void testCapacityBound() {
+        // A single shard makes the capacity exact
+        IntCache cache(50, 1);
+        for(uint32 i = 0; i < 1000; i++) {
+            uint32 val;
+            // Look each key up twice first so new keys are more popular than
+            // the ones already cached and get admitted
+            cache.get(i, &val);
+            cache.get(i, &val);
+            cache.insert(i, i);
+            TS_ASSERT(cache.size() <= 50);
+        }
+        TS_ASSERT_EQUALS(cache.size(), 50);
+        TS_ASSERT(cache.stats().evictions > 0);
+    }
+
+    void testAdmissionKeepsPopular() {
+        IntCache cache(100, 1);
+        uint32 val;
+        for(uint32 round = 0; round < 5; round++) {
+            for(uint32 i = 0; i < 100; i++) {
+                if (!cache.get(i, &val))
+                    cache.insert(i, i);
+            }
+        }
+        // A scan of keys seen only once shouldn't push out the popular ones.
+        // The frequency sketch is approximate, so allow a few to be lost.
+        for(uint32 i = 1000; i < 1300; i++) {
+            if (!cache.get(i, &val))
+                cache.insert(i, i);
+        }
+        uint32 kept = 0;
+        for(uint32 i = 0; i < 100; i++) {
+            if (cache.get(i, &val)) kept++;
+        }
+        TS_ASSERT(kept >= 90);
+        TS_ASSERT(cache.stats().rejections > 0);
+    }
+
+    void testUpdateWhenFull() {
+        IntCache cache(4, 1);
+        for(uint32 i = 0; i < 4; i++)
+            TS_ASSERT(cache.insert(i, i));
+        // Updates never go through admission
+        TS_ASSERT(cache.insert(2, 20));
+        uint32 val;
+        TS_ASSERT(cache.get(2, &val));
+        TS_ASSERT_EQUALS(val, 20);
+    }
+
+    void testConcurrent() {
+        IntCache cache(1000, 8);
+        uint32 found[4];
+        std::vector<Sirikata::Thread*> threads;
+        for(uint32 t = 0; t < 4; t++) {
+            // Threads overlap in the keys they use
+            threads.push_back(new Sirikata::Thread("ShardedClockCacheTest", std::tr1::bind(&ShardedClockCacheTest::hammer, &cache, t * 50, &found[t])));
+        }
+        for(uint32 t = 0; t < threads.size(); t++) {
+            threads[t]->join();
+            delete threads[t];
+        }
+        for(uint32 t = 0; t < 4; t++)
+            TS_ASSERT(found[t] > 0);
+        IntCache::Stats stats = cache.stats();
+        TS_ASSERT_EQUALS(stats.hits + stats.misses, 4 * 100 * 100);
+    }
+};
@@ -0,0 +1,106 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/queue/ShardedWorkQueue.hpp>
+
+using namespace Sirikata;
+
+class ShardedWorkQueueTest : public CxxTest::TestSuite
+{
+    typedef std::pair<uint32, uint32> Item; // key, sequence number
+    typedef ShardedWorkQueue<Item> Queue;
+
+    enum {
+        NumKeys = 50,
+        ItemsPerKey = 2000
+    };
+
+    // Only touched by the worker running the key's shard, so no locking is
+    // needed if the queue keeps its promises
+    std::vector<uint32> mNextSeq;
+    std::vector<uint32> mOutOfOrder;
+    AtomicValue<uint32> mHandled;
+    std::vector<uint32> mWorkerCounts;
+    boost::mutex mWorkerCountsMutex;
+
+    void handle(Item& item, uint32 worker) {
+        if (item.second != mNextSeq[item.first])
+            mOutOfOrder[item.first]++;
+        mNextSeq[item.first] = item.second + 1;
+        ++mHandled;
+
+        boost::lock_guard<boost::mutex> lck(mWorkerCountsMutex);
+        mWorkerCounts[worker]++;
+    }
+
+    // Pushes every other key starting at first_key. A hash_scale of 0 puts
+    // all the keys in the same shard.
+    static void pushKeys(Queue* queue, uint32 first_key, uint32 hash_scale) {
+        for(uint32 seq = 0; seq < ItemsPerKey; seq++)
+            for(uint32 key = first_key; key < NumKeys; key += 2)
+                queue->push(key * hash_scale, Item(key, seq));
+    }
+
+    void reset(uint32 nworkers) {
+        mNextSeq.assign(NumKeys, 0);
+        mOutOfOrder.assign(NumKeys, 0);
+        mHandled = 0;
+        mWorkerCounts.assign(nworkers, 0);
+    }
+
+    void checkAllInOrder() {
+        TS_ASSERT_EQUALS(mHandled.read(), (uint32)(NumKeys * ItemsPerKey));
+        for(uint32 key = 0; key < NumKeys; key++) {
+            TS_ASSERT_EQUALS(mOutOfOrder[key], 0);
+            TS_ASSERT_EQUALS(mNextSeq[key], (uint32)ItemsPerKey);
+        }
+    }
+
+public:
+    void testSingleWorker() {
+        reset(1);
+        Queue queue("ShardedWorkQueueTest", 1, 4, std::tr1::bind(&ShardedWorkQueueTest::handle, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+        // Items pushed before starting are held until the workers start
+        pushKeys(&queue, 0, 1);
+        pushKeys(&queue, 1, 1);
+        TS_ASSERT_EQUALS(mHandled.read(), 0);
+        queue.start();
+        queue.stop();
+        checkAllInOrder();
+    }
+
+    void testOrderedAcrossWorkers() {
+        reset(4);
+        // Fewer shards than keys, so keys share shards
+        Queue queue("ShardedWorkQueueTest", 4, 16, std::tr1::bind(&ShardedWorkQueueTest::handle, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2), 8);
+        queue.start();
+        Thread even("ShardedWorkQueueTest even", std::tr1::bind(&ShardedWorkQueueTest::pushKeys, &queue, 0, 1));
+        Thread odd("ShardedWorkQueueTest odd", std::tr1::bind(&ShardedWorkQueueTest::pushKeys, &queue, 1, 1));
+        even.join();
+        odd.join();
+        // stop() drains everything that was pushed
+        queue.stop();
+        checkAllInOrder();
+    }
+
+    void testStealing() {
+        reset(4);
+        // All the work lands in one shard, and with batches of one item it goes
+        // back on a ready list after every item where any worker can steal
+        // it. It must still only run on one worker at a time.
+        Queue queue("ShardedWorkQueueTest", 4, 1, std::tr1::bind(&ShardedWorkQueueTest::handle, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2), 1);
+        // There's always at least one shard per worker
+        TS_ASSERT_EQUALS(queue.numShards(), 4);
+        pushKeys(&queue, 0, 0);
+        pushKeys(&queue, 1, 0);
+        queue.start();
+        queue.stop();
+        checkAllInOrder();
+        uint32 total = 0;
+        for(uint32 i = 0; i < mWorkerCounts.size(); i++)
+            total += mWorkerCounts[i];
+        TS_ASSERT_EQUALS(total, (uint32)(NumKeys * ItemsPerKey));
+    }
+};
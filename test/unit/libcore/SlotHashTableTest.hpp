@@ -0,0 +1,94 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/util/SlotHashTable.hpp>
+
+class SlotHashTableTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::SlotHashTable<Sirikata::uint32, Sirikata::uint32> IntTable;
+    typedef IntTable::SlotID SlotID;
+public:
+
+    void testInsertFind() {
+        IntTable table;
+        TS_ASSERT(table.empty());
+        TS_ASSERT_EQUALS(table.find(1), (SlotID)IntTable::InvalidSlot);
+
+        bool inserted = false;
+        SlotID slot = table.insert(1, &inserted);
+        TS_ASSERT(inserted);
+        table.value(slot) = 10;
+
+        SlotID again = table.insert(1, &inserted);
+        TS_ASSERT(!inserted);
+        TS_ASSERT_EQUALS(again, slot);
+        TS_ASSERT_EQUALS(table.value(again), 10);
+        TS_ASSERT_EQUALS(table.find(1), slot);
+        TS_ASSERT_EQUALS(table.size(), 1);
+    }
+
+    void testSlotsStableAcrossGrowth() {
+        IntTable table;
+        std::vector<SlotID> slots;
+        for(Sirikata::uint32 i = 0; i < 1000; i++) {
+            slots.push_back(table.insert(i));
+            table.value(slots.back()) = i * 2;
+        }
+        TS_ASSERT_EQUALS(table.size(), 1000);
+        for(Sirikata::uint32 i = 0; i < 1000; i++) {
+            TS_ASSERT_EQUALS(table.find(i), slots[i]);
+            TS_ASSERT_EQUALS(table.key(slots[i]), i);
+            TS_ASSERT_EQUALS(table.value(slots[i]), i * 2);
+        }
+    }
+
+    void testEraseAndReuse() {
+        IntTable table;
+        for(Sirikata::uint32 i = 0; i < 100; i++)
+            table.insert(i);
+        SlotID erased = table.find(50);
+        table.eraseSlot(erased);
+        TS_ASSERT(!table.valid(erased));
+        TS_ASSERT(table.erase(51));
+        TS_ASSERT(!table.erase(51));
+        TS_ASSERT_EQUALS(table.size(), 98);
+        TS_ASSERT_EQUALS(table.find(50), (SlotID)IntTable::InvalidSlot);
+        // Entries probed past the erased ones are still found
+        for(Sirikata::uint32 i = 0; i < 100; i++) {
+            if (i == 50 || i == 51) continue;
+            TS_ASSERT(table.find(i) != (SlotID)IntTable::InvalidSlot);
+        }
+
+        // New entries reuse freed slots and get fresh values
+        SlotID reused = table.insert(1000);
+        TS_ASSERT(table.slotCount() == 100);
+        TS_ASSERT_EQUALS(table.value(reused), 0);
+    }
+
+    void testChurn() {
+        // Lots of inserts and erases leave tombstones that must be cleaned
+        // out without losing entries
+        IntTable table;
+        for(Sirikata::uint32 round = 0; round < 50; round++) {
+            for(Sirikata::uint32 i = 0; i < 20; i++)
+                table.insert(round * 100 + i);
+            for(Sirikata::uint32 i = 0; i < 20; i++)
+                if (i % 2 == 0) table.erase(round * 100 + i);
+        }
+        TS_ASSERT_EQUALS(table.size(), 500);
+        Sirikata::uint32 live = 0;
+        for(SlotID slot = 0; slot < table.slotCount(); slot++) {
+            if (!table.valid(slot)) continue;
+            live++;
+            TS_ASSERT_EQUALS(table.key(slot) % 2, 1);
+            TS_ASSERT_EQUALS(table.find(table.key(slot)), slot);
+        }
+        TS_ASSERT_EQUALS(live, 500);
+
+        table.clear();
+        TS_ASSERT(table.empty());
+        TS_ASSERT_EQUALS(table.find(1), (SlotID)IntTable::InvalidSlot);
+    }
+};
@@ -0,0 +1,236 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include <sirikata/core/trace/TraceReader.hpp>
+#include <sirikata/core/util/Thread.hpp>
+#include <cstdio>
+
+using namespace Sirikata;
+
+class TraceReaderTest : public CxxTest::TestSuite
+{
+    typedef Trace::ChunkedTraceBuffer::IOVec IOVec;
+
+    static const char* filename() { return "trace_reader_test.bin"; }
+
+    // Writes 50 records, each a uint32 counter, with types cycling through
+    // 0-2 and times from 1000 to 1049. Small chunks give 5 chunks of 10
+    // records each.
+    void writeTrace(bool finish) {
+        Trace::ChunkedTraceBuffer buf(100);
+        FILE* of = fopen(filename(), "wb");
+        for(uint32 i = 0; i < 50; i++) {
+            IOVec iov(&i, sizeof(i));
+            buf.write(i % 3, Time::microseconds(1000 + i), &iov, 1);
+            if (i == 20) buf.store(of);
+        }
+        buf.flush();
+        if (finish)
+            buf.finish(of);
+        else
+            buf.store(of);
+        fclose(of);
+    }
+
+    void checkTrace(bool chunked) {
+        Trace::TraceReader all(filename());
+        TS_ASSERT(all.valid());
+        TS_ASSERT_EQUALS(all.chunked(), chunked);
+        uint16 type_hint;
+        const uint8* payload;
+        uint32 size;
+        uint32 count = 0;
+        while(all.next(&type_hint, &payload, &size)) {
+            uint32 val;
+            TS_ASSERT_EQUALS(size, sizeof(val));
+            memcpy(&val, payload, sizeof(val));
+            TS_ASSERT_EQUALS(val, count);
+            TS_ASSERT_EQUALS(type_hint, count % 3);
+            count++;
+        }
+        TS_ASSERT_EQUALS(count, 50);
+
+        Trace::TraceReader typed(filename());
+        typed.filterType(1);
+        count = 0;
+        while(typed.next(&type_hint, &payload, &size)) {
+            TS_ASSERT_EQUALS(type_hint, 1);
+            count++;
+        }
+        TS_ASSERT_EQUALS(count, 17);
+    }
+
+public:
+    void tearDown() {
+        remove(filename());
+    }
+
+    void testIndexed() {
+        writeTrace(true);
+        checkTrace(true);
+
+        Trace::TraceReader reader(filename());
+        TS_ASSERT_EQUALS(reader.numChunks(), 5);
+        // Only the last chunk covers this range
+        reader.filterTime(Time::microseconds(1045), Time::microseconds(2000));
+        uint16 type_hint;
+        const uint8* payload;
+        uint32 size;
+        uint32 count = 0;
+        while(reader.next(&type_hint, &payload, &size))
+            count++;
+        TS_ASSERT_EQUALS(count, 10);
+    }
+
+    void testMissingIndex() {
+        // Without a clean shutdown there's no index, so chunks are found by
+        // walking the file
+        writeTrace(false);
+        checkTrace(true);
+        Trace::TraceReader reader(filename());
+        TS_ASSERT_EQUALS(reader.numChunks(), 5);
+    }
+
+    // Overwrites the index entry for one chunk with chunk
+    void corruptIndex(uint32 idx, const Trace::Format::ChunkHeader& chunk) {
+        FILE* f = fopen(filename(), "r+b");
+        Trace::Format::FileFooter footer;
+        fseek(f, -(long)sizeof(footer), SEEK_END);
+        TS_ASSERT_EQUALS(fread(&footer, sizeof(footer), 1, f), (size_t)1);
+        fseek(f, (long)(footer.index_offset + idx * sizeof(chunk)), SEEK_SET);
+        fwrite(&chunk, sizeof(chunk), 1, f);
+        fclose(f);
+    }
+
+    void testInvalidIndex() {
+        // Index entries which point past the index, overlap other chunks or
+        // aren't chunk headers at all are ignored in favor of walking the
+        // file
+        writeTrace(true);
+        Trace::Format::ChunkHeader bad;
+        bad.offset = 1000000;
+        bad.size = 100;
+        corruptIndex(2, bad);
+        checkTrace(true);
+        TS_ASSERT_EQUALS(Trace::TraceReader(filename()).numChunks(), 5);
+
+        writeTrace(true);
+        bad.offset = sizeof(Trace::Format::FileHeader) + sizeof(bad);
+        bad.size = (uint64)-1;
+        corruptIndex(0, bad);
+        checkTrace(true);
+        TS_ASSERT_EQUALS(Trace::TraceReader(filename()).numChunks(), 5);
+
+        writeTrace(true);
+        bad.size = 10;
+        corruptIndex(4, bad);
+        checkTrace(true);
+        TS_ASSERT_EQUALS(Trace::TraceReader(filename()).numChunks(), 5);
+
+        writeTrace(true);
+        bad.magic = 0;
+        corruptIndex(1, bad);
+        checkTrace(true);
+        TS_ASSERT_EQUALS(Trace::TraceReader(filename()).numChunks(), 5);
+    }
+
+    static void writeThreadRecords(Trace::ChunkedTraceBuffer* buf, uint32 first) {
+        for(uint32 i = first; i < 1000; i += 2) {
+            IOVec iov(&i, sizeof(i));
+            buf->write(0, Time::microseconds(i), &iov, 1);
+        }
+    }
+
+    void testThreadsMerged() {
+        // Each thread fills its own chunks, but records come out in time order
+        Trace::ChunkedTraceBuffer buf(100);
+        Thread even("TraceReaderTest even", std::tr1::bind(&TraceReaderTest::writeThreadRecords, &buf, 0));
+        Thread odd("TraceReaderTest odd", std::tr1::bind(&TraceReaderTest::writeThreadRecords, &buf, 1));
+        even.join();
+        odd.join();
+        buf.flush();
+        FILE* of = fopen(filename(), "wb");
+        buf.finish(of);
+        fclose(of);
+
+        Trace::TraceReader reader(filename());
+        uint16 type_hint;
+        const uint8* payload;
+        uint32 size;
+        uint32 count = 0;
+        while(reader.next(&type_hint, &payload, &size)) {
+            uint32 val;
+            memcpy(&val, payload, sizeof(val));
+            TS_ASSERT_EQUALS(val, count);
+            count++;
+        }
+        TS_ASSERT_EQUALS(count, 1000);
+    }
+
+    uint32 countRecords() {
+        Trace::TraceReader reader(filename());
+        uint16 type_hint;
+        const uint8* payload;
+        uint32 size;
+        uint32 count = 0;
+        while(reader.next(&type_hint, &payload, &size))
+            count++;
+        return count;
+    }
+
+    void testHandoff() {
+        // Partial chunks are only handed over once they're old enough
+        Trace::ChunkedTraceBuffer buf;
+        for(uint32 i = 0; i < 10; i++) {
+            IOVec iov(&i, sizeof(i));
+            buf.write(0, Time::microseconds(i), &iov, 1);
+        }
+        buf.handoff(Duration::seconds(1000));
+        TS_ASSERT(buf.empty());
+        buf.handoff(Duration::zero());
+        TS_ASSERT(!buf.empty());
+
+        FILE* of = fopen(filename(), "wb");
+        buf.store(of);
+        fclose(of);
+        TS_ASSERT_EQUALS(countRecords(), 10);
+    }
+
+    static void writeHandoffRecords(Trace::ChunkedTraceBuffer* buf) {
+        for(uint32 i = 0; i < 100000; i++) {
+            IOVec iov(&i, sizeof(i));
+            buf->write(0, Time::microseconds(i), &iov, 1);
+        }
+    }
+
+    void testHandoffWhileWriting() {
+        // Taking chunks from a thread while it writes loses no records
+        Trace::ChunkedTraceBuffer buf;
+        FILE* of = fopen(filename(), "wb");
+        Thread writer("TraceReaderTest writer", std::tr1::bind(&TraceReaderTest::writeHandoffRecords, &buf));
+        for(uint32 i = 0; i < 1000; i++) {
+            buf.handoff(Duration::zero());
+            buf.store(of);
+        }
+        writer.join();
+        buf.flush();
+        buf.finish(of);
+        fclose(of);
+        TS_ASSERT_EQUALS(countRecords(), 100000);
+    }
+
+    void testUnchunked() {
+        FILE* of = fopen(filename(), "wb");
+        for(uint32 i = 0; i < 50; i++) {
+            uint32 size = sizeof(i);
+            uint16 type_hint = i % 3;
+            fwrite(&size, sizeof(size), 1, of);
+            fwrite(&type_hint, sizeof(type_hint), 1, of);
+            fwrite(&i, sizeof(i), 1, of);
+        }
+        fclose(of);
+        checkTrace(false);
+    }
+};
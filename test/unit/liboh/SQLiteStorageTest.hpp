@@ -75,3 +75,32 @@ public:
 };
 
 const Sirikata::String SQLiteStorageTest::dbfile("test.db");
+
+// Runs the same tests with group commit turned on and a small group size, so
+// transactions wait to be batched and some batches are split.
+class SQLiteGroupCommitStorageTest : public CxxTest::TestSuite
+{
+    StorageTestBase _base;
+public:
+    SQLiteGroupCommitStorageTest()
+     : _base("oh-sqlite", "sqlite", "--db=test-group-commit.db --group-commit-latency=5ms --max-group-commit=2")
+    {
+    }
+
+    void setUp() {_base.setUp(); }
+    void tearDown() {_base.tearDown(); }
+
+    void testMultiWrite() {_base.testMultiWrite(); }
+    void testMultiRead() {_base.testMultiRead(); }
+    void testMultiErase() {_base.testMultiErase(); }
+
+    void testAtomicWrite() {_base.testAtomicWrite(); }
+    void testAtomicWriteErase() {_base.testAtomicWriteErase(); }
+
+    void testRangeRead() {_base.testRangeRead(); }
+    void testCount() {_base.testCount(); }
+
+    void testAllTransaction() {_base.testAllTransaction(); }
+
+    void testRollback() {_base.testRollback(); }
+};
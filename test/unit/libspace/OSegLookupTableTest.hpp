@@ -0,0 +1,137 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include "../../../space/src/OSegLookupTable.hpp"
+
+class OSegLookupTableTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::uint32 uint32;
+    typedef Sirikata::UUID UUID;
+    typedef Sirikata::Time Time;
+    typedef Sirikata::Duration Duration;
+
+    struct Lookup {
+        Lookup(uint32 _id, uint32 _size) : id(_id), size(_size) {}
+
+        uint32 id;
+        uint32 size;
+    };
+    typedef Sirikata::OSegLookupTable<Lookup> LookupTable;
+
+    std::vector<UUID> mObjs;
+
+    Time at(uint32 secs) { return Time::null() + Duration::seconds(secs); }
+
+public:
+    void setUp() {
+        mObjs.clear();
+        for(uint32 i = 0; i < 10; i++)
+            mObjs.push_back(UUID::random());
+    }
+
+    void testCoalesce() {
+        LookupTable table(10, 1000);
+        table.start(mObjs[0], Lookup(0, 10), at(0));
+        TS_ASSERT(table.contains(mObjs[0]));
+        TS_ASSERT(table.append(mObjs[0], Lookup(1, 20)));
+        TS_ASSERT_EQUALS(table.size(), (uint32)1);
+        TS_ASSERT_EQUALS(table.messages(mObjs[0]), (uint32)2);
+        TS_ASSERT_EQUALS(table.byteSize(), (uint32)30);
+
+        LookupTable::LookupList lookups;
+        TS_ASSERT(table.take(mObjs[0], &lookups));
+        TS_ASSERT_EQUALS(lookups.size(), (size_t)2);
+        TS_ASSERT_EQUALS(lookups[0].id, (uint32)0);
+        TS_ASSERT_EQUALS(lookups[1].id, (uint32)1);
+        TS_ASSERT(table.empty());
+        TS_ASSERT_EQUALS(table.byteSize(), (uint32)0);
+        TS_ASSERT(!table.take(mObjs[0], &lookups));
+    }
+
+    void testPauseResume() {
+        LookupTable table(2, 1000);
+        TS_ASSERT(!table.full());
+        table.start(mObjs[0], Lookup(0, 10), at(0));
+        table.start(mObjs[1], Lookup(1, 10), at(0));
+
+        // Nobody was told we're full yet, so nobody is owed a notification
+        LookupTable::LookupList lookups;
+        TS_ASSERT(table.take(mObjs[0], &lookups));
+        TS_ASSERT(!table.available());
+        table.start(mObjs[0], Lookup(0, 10), at(0));
+
+        // Pause, then resume once a lookup finishes, but only once
+        TS_ASSERT(table.full());
+        TS_ASSERT(!table.available());
+        TS_ASSERT(table.take(mObjs[1], &lookups));
+        TS_ASSERT(table.available());
+        TS_ASSERT(!table.available());
+        TS_ASSERT(!table.full());
+    }
+
+    void testByteLimit() {
+        LookupTable table(10, 100);
+        table.start(mObjs[0], Lookup(0, 60), at(0));
+        // Messages for an object already being looked up are limited too
+        TS_ASSERT(!table.append(mObjs[0], Lookup(1, 60)));
+        TS_ASSERT_EQUALS(table.messages(mObjs[0]), (uint32)1);
+        TS_ASSERT(table.append(mObjs[0], Lookup(2, 40)));
+        TS_ASSERT(table.full());
+
+        LookupTable::LookupList lookups;
+        TS_ASSERT(table.take(mObjs[0], &lookups));
+        TS_ASSERT(table.available());
+    }
+
+    void testTimeoutResumes() {
+        LookupTable table(2, 1000);
+        table.start(mObjs[0], Lookup(0, 10), at(0));
+        table.start(mObjs[1], Lookup(1, 10), at(5));
+        TS_ASSERT(table.full());
+
+        std::vector<UUID> expired;
+        table.expired(at(0), &expired);
+        TS_ASSERT(expired.empty());
+
+        // The OSeg never answers the first lookup. Failing it frees its slot
+        // and lets the paused caller resume.
+        table.expired(at(3), &expired);
+        TS_ASSERT_EQUALS(expired.size(), (size_t)1);
+        TS_ASSERT_EQUALS(expired[0], mObjs[0]);
+        TS_ASSERT(!table.available());
+        LookupTable::LookupList lookups;
+        TS_ASSERT(table.take(expired[0], &lookups));
+        TS_ASSERT_EQUALS(lookups.size(), (size_t)1);
+        TS_ASSERT(table.available());
+
+        // Objects are only reported once
+        table.expired(at(3), &expired);
+        TS_ASSERT(expired.empty());
+    }
+
+    void testTimeoutSkipsFinished() {
+        LookupTable table(10, 1000);
+        table.start(mObjs[0], Lookup(0, 10), at(0));
+        table.start(mObjs[1], Lookup(1, 10), at(1));
+        table.start(mObjs[2], Lookup(2, 10), at(2));
+
+        // Finished lookups don't expire, and neither do lookups for the same
+        // object started again later
+        LookupTable::LookupList lookups;
+        TS_ASSERT(table.take(mObjs[0], &lookups));
+        TS_ASSERT(table.take(mObjs[1], &lookups));
+        table.start(mObjs[1], Lookup(3, 10), at(4));
+
+        std::vector<UUID> expired;
+        table.expired(at(3), &expired);
+        TS_ASSERT_EQUALS(expired.size(), (size_t)1);
+        TS_ASSERT_EQUALS(expired[0], mObjs[2]);
+        TS_ASSERT(table.take(mObjs[2], &lookups));
+
+        table.expired(at(5), &expired);
+        TS_ASSERT_EQUALS(expired.size(), (size_t)1);
+        TS_ASSERT_EQUALS(expired[0], mObjs[1]);
+    }
+};
@@ -0,0 +1,238 @@
+// Copyright (c) 2012 Sirikata Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE file.
+
+#include <cxxtest/TestSuite.h>
+#include "../../../libspace/plugins/redis/RedisLookupQueue.hpp"
+
+class RedisLookupQueueTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::uint32 uint32;
+    typedef Sirikata::String String;
+    typedef Sirikata::UUID UUID;
+    typedef Sirikata::RedisLookupQueue RedisLookupQueue;
+
+    // Stands in for the Redis server: keeps the values that are stored and
+    // builds the replies an MGET for a batch would get.
+    class FakeRedis {
+    public:
+        ~FakeRedis() {
+            for(uint32 i = 0; i < mReplies.size(); i++)
+                freeReply(mReplies[i]);
+        }
+
+        void set(const UUID& obj, const String& val) { mValues[obj] = val; }
+
+        redisReply* mget(const std::vector<UUID>& objs) {
+            redisReply* reply = newReply(REDIS_REPLY_ARRAY);
+            reply->elements = objs.size();
+            reply->element = new redisReply*[objs.size()];
+            for(uint32 i = 0; i < objs.size(); i++) {
+                std::map<UUID, String>::iterator it = mValues.find(objs[i]);
+                if (it == mValues.end()) {
+                    reply->element[i] = newReply(REDIS_REPLY_NIL);
+                }
+                else {
+                    reply->element[i] = newReply(REDIS_REPLY_STRING);
+                    setString(reply->element[i], it->second);
+                }
+            }
+            mReplies.push_back(reply);
+            return reply;
+        }
+
+        redisReply* error(const String& msg) {
+            redisReply* reply = newReply(REDIS_REPLY_ERROR);
+            setString(reply, msg);
+            mReplies.push_back(reply);
+            return reply;
+        }
+
+    private:
+        static redisReply* newReply(int type) {
+            redisReply* reply = new redisReply();
+            memset(reply, 0, sizeof(redisReply));
+            reply->type = type;
+            return reply;
+        }
+        static void setString(redisReply* reply, const String& val) {
+            reply->str = new char[val.size()];
+            memcpy(reply->str, val.data(), val.size());
+            reply->len = val.size();
+        }
+        static void freeReply(redisReply* reply) {
+            for(uint32 i = 0; i < reply->elements; i++)
+                freeReply(reply->element[i]);
+            delete[] reply->element;
+            delete[] reply->str;
+            delete reply;
+        }
+
+        std::map<UUID, String> mValues;
+        std::vector<redisReply*> mReplies;
+    };
+
+    std::vector<UUID> mObjs;
+    std::map<UUID, String> mFound;
+    std::vector<UUID> mFailed;
+
+    void found(const UUID& obj, const String& val) { mFound[obj] = val; }
+    void failed(const UUID& obj) { mFailed.push_back(obj); }
+
+    RedisLookupQueue::FoundCallback foundCallback() {
+        return std::tr1::bind(&RedisLookupQueueTest::found, this, std::tr1::placeholders::_1, std::tr1::placeholders::_2);
+    }
+    RedisLookupQueue::FailedCallback failedCallback() {
+        return std::tr1::bind(&RedisLookupQueueTest::failed, this, std::tr1::placeholders::_1);
+    }
+
+public:
+    void setUp() {
+        mObjs.clear();
+        for(uint32 i = 0; i < 10; i++)
+            mObjs.push_back(UUID::random());
+        mFound.clear();
+        mFailed.clear();
+    }
+
+    void testBatching() {
+        RedisLookupQueue q(3, 3);
+        for(uint32 i = 0; i < 7; i++)
+            q.push(mObjs[i]);
+        TS_ASSERT_EQUALS(q.size(), (uint32)7);
+        TS_ASSERT_EQUALS(q.fullBatches(), (uint32)2);
+
+        std::vector<UUID> batch;
+        TS_ASSERT(q.takeBatch(false, &batch));
+        TS_ASSERT_EQUALS(batch.size(), (size_t)3);
+        TS_ASSERT_EQUALS(batch[0], mObjs[0]);
+        TS_ASSERT_EQUALS(batch[2], mObjs[2]);
+        TS_ASSERT(q.takeBatch(false, &batch));
+        TS_ASSERT_EQUALS(batch[0], mObjs[3]);
+        TS_ASSERT_EQUALS(q.fullBatches(), (uint32)0);
+
+        // Partial batches wait unless flushed
+        TS_ASSERT(!q.takeBatch(false, &batch));
+        TS_ASSERT(q.takeBatch(true, &batch));
+        TS_ASSERT_EQUALS(batch.size(), (size_t)1);
+        TS_ASSERT_EQUALS(batch[0], mObjs[6]);
+        TS_ASSERT(q.empty());
+        TS_ASSERT(!q.takeBatch(true, &batch));
+    }
+
+    void testReply() {
+        FakeRedis redis;
+        redis.set(mObjs[0], "1:10");
+        redis.set(mObjs[2], "2:20");
+
+        RedisLookupQueue q(3, 3);
+        for(uint32 i = 0; i < 3; i++)
+            q.push(mObjs[i]);
+        std::vector<UUID> batch;
+        TS_ASSERT(q.takeBatch(false, &batch));
+
+        TS_ASSERT(q.handleReply(batch, redis.mget(batch), foundCallback(), failedCallback()));
+        TS_ASSERT_EQUALS(mFound.size(), (size_t)2);
+        TS_ASSERT_EQUALS(mFound[mObjs[0]], String("1:10"));
+        TS_ASSERT_EQUALS(mFound[mObjs[2]], String("2:20"));
+        // Missing keys fail
+        TS_ASSERT_EQUALS(mFailed.size(), (size_t)1);
+        TS_ASSERT_EQUALS(mFailed[0], mObjs[1]);
+        TS_ASSERT(q.empty());
+    }
+
+    void testErrorReply() {
+        FakeRedis redis;
+        redis.set(mObjs[0], "1:10");
+
+        RedisLookupQueue q(3, 3);
+        for(uint32 i = 0; i < 3; i++)
+            q.push(mObjs[i]);
+        std::vector<UUID> batch;
+        TS_ASSERT(q.takeBatch(false, &batch));
+
+        // The connection is still fine, but every lookup in the batch fails
+        TS_ASSERT(q.handleReply(batch, redis.error("ERR"), foundCallback(), failedCallback()));
+        TS_ASSERT(mFound.empty());
+        TS_ASSERT_EQUALS(mFailed.size(), (size_t)3);
+        TS_ASSERT(q.empty());
+    }
+
+    void testDisconnectRequeues() {
+        FakeRedis redis;
+        redis.set(mObjs[0], "1:10");
+
+        RedisLookupQueue q(3, 3);
+        for(uint32 i = 0; i < 3; i++)
+            q.push(mObjs[i]);
+        std::vector<UUID> batch;
+        TS_ASSERT(q.takeBatch(false, &batch));
+        // Lookups queued while the batch was in flight
+        q.push(mObjs[3]);
+
+        // Losing the connection neither completes nor fails anything, the
+        // lookups go back to the front of the queue
+        TS_ASSERT(!q.handleReply(batch, NULL, foundCallback(), failedCallback()));
+        TS_ASSERT(mFound.empty());
+        TS_ASSERT(mFailed.empty());
+        TS_ASSERT_EQUALS(q.size(), (uint32)4);
+        TS_ASSERT_EQUALS(q.fullBatches(), (uint32)1);
+
+        TS_ASSERT(q.retry(failedCallback()));
+        std::vector<UUID> retried;
+        TS_ASSERT(q.takeBatch(false, &retried));
+        TS_ASSERT(retried == batch);
+        TS_ASSERT(q.handleReply(retried, redis.mget(retried), foundCallback(), failedCallback()));
+        TS_ASSERT_EQUALS(mFound.size(), (size_t)1);
+        TS_ASSERT_EQUALS(mFailed.size(), (size_t)2);
+
+        TS_ASSERT(q.takeBatch(true, &batch));
+        TS_ASSERT_EQUALS(batch.size(), (size_t)1);
+        TS_ASSERT_EQUALS(batch[0], mObjs[3]);
+    }
+
+    void testRetryLimit() {
+        RedisLookupQueue q(2, 2);
+        for(uint32 i = 0; i < 3; i++)
+            q.push(mObjs[i]);
+
+        std::vector<UUID> batch;
+        for(uint32 attempt = 0; attempt < 2; attempt++) {
+            TS_ASSERT(q.takeBatch(false, &batch));
+            TS_ASSERT(!q.handleReply(batch, NULL, foundCallback(), failedCallback()));
+            TS_ASSERT(q.retry(failedCallback()));
+        }
+        TS_ASSERT(mFailed.empty());
+
+        // Out of retries, everything pending fails
+        TS_ASSERT(q.takeBatch(false, &batch));
+        TS_ASSERT(!q.handleReply(batch, NULL, foundCallback(), failedCallback()));
+        TS_ASSERT(!q.retry(failedCallback()));
+        TS_ASSERT_EQUALS(mFailed.size(), (size_t)3);
+        TS_ASSERT(q.empty());
+
+        // And the count starts over
+        q.push(mObjs[3]);
+        TS_ASSERT(q.retry(failedCallback()));
+    }
+
+    void testReplyResetsRetries() {
+        FakeRedis redis;
+        RedisLookupQueue q(1, 1);
+        q.push(mObjs[0]);
+        q.push(mObjs[1]);
+
+        std::vector<UUID> batch;
+        TS_ASSERT(q.takeBatch(false, &batch));
+        TS_ASSERT(!q.handleReply(batch, NULL, foundCallback(), failedCallback()));
+        TS_ASSERT(q.retry(failedCallback()));
+
+        // Getting any reply means the reconnection worked
+        TS_ASSERT(q.takeBatch(false, &batch));
+        TS_ASSERT(q.handleReply(batch, redis.mget(batch), foundCallback(), failedCallback()));
+        TS_ASSERT(q.takeBatch(false, &batch));
+        TS_ASSERT(!q.handleReply(batch, NULL, foundCallback(), failedCallback()));
+        TS_ASSERT(q.retry(failedCallback()));
+        TS_ASSERT_EQUALS(mFailed.size(), (size_t)1);
+    }
+};